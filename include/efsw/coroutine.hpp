@@ -0,0 +1,125 @@
+#ifndef EFSW_COROUTINE_HPP
+#define EFSW_COROUTINE_HPP
+
+#include <efsw/efsw.hpp>
+
+#if __cplusplus < 202002L && ( !defined( _MSVC_LANG ) || _MSVC_LANG < 202002L )
+#error "efsw/coroutine.hpp requires C++20"
+#endif
+
+#include <coroutine>
+#include <utility>
+#include <vector>
+
+namespace efsw {
+
+/// Awaitable stream of the events of the watches added without a listener, built on
+/// FileWatcher::readEvents. The stream doesn't start any thread nor block: the executor waits
+/// for FileWatcher::pollHandle to become readable ( or a timer, if it's -1 ) and calls dispatch(),
+/// which resumes the coroutines waiting for events in the thread of the executor.
+/// A stream serves every watch of its FileWatcher, so one coroutine can wait for all of them.
+/// The stream, its FileWatcher and the coroutines waiting on it must be used from one thread.
+/// @class EventStream
+class EventStream {
+  public:
+	/// Awaiter returned by next(), resumes with the next event
+	class Awaiter {
+	  public:
+		explicit Awaiter( EventStream* stream ) : mStream( stream ), mNext( NULL ) {}
+
+		bool await_ready() {
+			/// The coroutines already waiting get the events first
+			return NULL == mStream->mFirst && mStream->take( mEvent );
+		}
+
+		void await_suspend( std::coroutine_handle<> handle ) {
+			mHandle = handle;
+
+			if ( NULL == mStream->mLast ) {
+				mStream->mFirst = this;
+			} else {
+				mStream->mLast->mNext = this;
+			}
+
+			mStream->mLast = this;
+		}
+
+		FileEvent await_resume() { return std::move( mEvent ); }
+
+	  protected:
+		friend class EventStream;
+
+		EventStream* mStream;
+		std::coroutine_handle<> mHandle;
+		Awaiter* mNext;
+		FileEvent mEvent;
+	};
+
+	/// @param watcher The FileWatcher read, watch() must not be called on it
+	/// @param batch Maximum number of events read at once
+	explicit EventStream( FileWatcher& watcher, size_t batch = 64 ) :
+		mWatcher( watcher ), mEvents( batch ? batch : 1 ), mRead( 0 ), mCount( 0 ),
+		mFirst( NULL ), mLast( NULL ) {}
+
+	EventStream( const EventStream& ) = delete;
+
+	EventStream& operator=( const EventStream& ) = delete;
+
+	/// @return The handle the executor waits on before calling dispatch()
+	PollHandle pollHandle() { return mWatcher.pollHandle(); }
+
+	/// @return An awaiter for the next event: `FileEvent event = co_await stream.next();`
+	Awaiter next() { return Awaiter( this ); }
+
+	/// @return True if a coroutine is waiting for an event
+	bool waiting() const { return NULL != mFirst; }
+
+	/// Reads the events of the watcher and resumes the coroutines waiting for them, in the order
+	/// they started waiting. A coroutine resumed that waits again is resumed again by the same
+	/// call while there are events left.
+	void dispatch() {
+		while ( NULL != mFirst ) {
+			Awaiter* awaiter = mFirst;
+
+			if ( !take( awaiter->mEvent ) )
+				return;
+
+			mFirst = awaiter->mNext;
+
+			if ( NULL == mFirst ) {
+				mLast = NULL;
+			}
+
+			awaiter->mHandle.resume();
+		}
+	}
+
+  protected:
+	FileWatcher& mWatcher;
+
+	/// The events read and not yet taken, the buffer is reused between reads
+	std::vector<FileEvent> mEvents;
+	size_t mRead;
+	size_t mCount;
+
+	/// The coroutines waiting, first to last
+	Awaiter* mFirst;
+	Awaiter* mLast;
+
+	bool take( FileEvent& event ) {
+		if ( mRead == mCount ) {
+			mRead = 0;
+			mCount = mWatcher.readEvents( &mEvents[0], mEvents.size() );
+
+			if ( 0 == mCount )
+				return false;
+		}
+
+		event = std::move( mEvents[mRead++] );
+		return true;
+	}
+};
+
+} // namespace efsw
+
+#endif
@@ -28,6 +28,8 @@
 #ifndef ESFW_H
 #define ESFW_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -65,12 +67,28 @@ typedef long efsw_watchid;
 /// Type for watcher
 typedef void* efsw_watcher;
 
+/// Type for a backend shared by many watchers
+typedef void* efsw_reactor;
+
+/// Type for a reader of a journal published by another process
+typedef void* efsw_journal_reader;
+
+/// Handle to wait for the events read with efsw_read_events: a file descriptor, or a HANDLE on
+/// Windows
+#if defined(_WIN32)
+typedef void* efsw_poll_handle;
+#else
+typedef int efsw_poll_handle;
+#endif
+
 enum efsw_action
 {
 	EFSW_ADD = 1,		/// Sent when a file is created or renamed
 	EFSW_DELETE = 2,	/// Sent when a file is deleted or renamed
 	EFSW_MODIFIED = 3,	/// Sent when a file is modified
-	EFSW_MOVED = 4		/// Sent when a file is moved
+	EFSW_MOVED = 4,		/// Sent when a file is moved
+	EFSW_OVERFLOW = 5,	/// Sent when events were lost, the watch is resynced after it
+	EFSW_HISTORY_DONE = 6	/// Sent once the events replayed for a watch were delivered
 };
 
 enum efsw_error
@@ -95,7 +113,117 @@ enum efsw_option
 	/// For Windows, per default all events are captured but we might only be interested
 	/// in a subset; the value of the option should be set to a bitwise or'ed set of
 	/// FILE_NOTIFY_CHANGE_* flags.
-	EFSW_OPT_WIN_NOTIFY_FILTER = 2
+	EFSW_OPT_WIN_NOTIFY_FILTER = 2,
+	/// The kinds of changes reported by the watch, the value should be set to a bitwise or'ed
+	/// set of efsw_interest flags ( EFSW_INTEREST_DEFAULT if not set ).
+	EFSW_OPT_EVENT_INTEREST = 3,
+	/// For recursive watches on the backends with a kernel watch per directory ( inotify ), the
+	/// maximum number of kernel watches the watch can use, the least recently active subtrees
+	/// beyond it are polled instead. 0 ( the default ) is unlimited.
+	EFSW_OPT_WATCH_BUDGET = 4,
+	/// For inotify, the milliseconds a rename source waits for its destination before it's
+	/// reported as deleted ( moved outside the watches ). 100 by default.
+	EFSW_OPT_MOVE_PAIRING_WINDOW = 5,
+	/// Quiet window in milliseconds for the events of a path, the events of a path are merged
+	/// until it's left unchanged for the window. 0 ( the default ) delivers them as they happen.
+	EFSW_OPT_COALESCE_WINDOW = 6,
+	/// Capacity in events of a queue between the backend and the callback, called from a
+	/// dispatcher thread. 0 ( the default ) calls the callback from the backend.
+	EFSW_OPT_DISPATCH_QUEUE_SIZE = 7,
+	/// What the backend does when the dispatch queue is full, an efsw_queue_policy
+	EFSW_OPT_DISPATCH_POLICY = 8,
+	/// For the generic watcher, the milliseconds between the scans of a directory that changed.
+	/// 1000 by default.
+	EFSW_OPT_POLL_MIN_INTERVAL = 13,
+	/// For the generic watcher, the maximum milliseconds between the scans of a directory, the
+	/// unchanged ones back off doubling their interval up to it. EFSW_OPT_POLL_MIN_INTERVAL by
+	/// default.
+	EFSW_OPT_POLL_MAX_INTERVAL = 14,
+	/// For the generic watcher, the number of threads scanning the directories, shared by the
+	/// watches of the watcher. 1 by default.
+	EFSW_OPT_POLL_THREADS = 15,
+	/// For the generic watcher, the maximum milliseconds a pass scans the directories of the
+	/// watch for, the directories not done are resumed by the next pass. 0 ( no limit ) by
+	/// default.
+	EFSW_OPT_POLL_TIME_SLICE = 17,
+	/// For the kqueue backend, set to 1 to only register the directories, not a file descriptor per
+	/// file. A file modified in place is reported once its directory changes. 0 by default.
+	EFSW_OPT_KQUEUE_DIRECTORIES_ONLY = 18,
+	/// For the FSEvents backend, the milliseconds the stream waits for more events before
+	/// delivering them. The smallest asked by the watches is used. 0 by default.
+	EFSW_OPT_FSEVENTS_LATENCY = 20,
+	/// For the FSEvents backend, set to 1 to deliver the first event after a quiet period at once,
+	/// 0 to always wait the latency. 1 by default.
+	EFSW_OPT_FSEVENTS_NO_DEFER = 21,
+	/// For the FSEvents backend, set to 1 for the events of each file, 0 for the events of the
+	/// directories only, which are then scanned. 1 by default.
+	EFSW_OPT_FSEVENTS_FILE_EVENTS = 22,
+	/// For Windows, the number of threads handling the completed notifications, shared by the
+	/// watches of the watcher. 1 by default.
+	EFSW_OPT_WIN_COMPLETION_THREADS = 24,
+	/// For Windows, whether a watch keeps a snapshot of its tree to resync it once the buffer
+	/// overflowed. 1 by default.
+	EFSW_OPT_WIN_OVERFLOW_RESYNC = 25,
+	/// Set to 1 to record the events of the watch in the journal of the watcher, see
+	/// efsw_publish_journal. The callback may be NULL then. 0 by default.
+	EFSW_OPT_JOURNAL = 27,
+	/// Events per second delivered to the callback of the watch, through its dispatch queue. 0
+	/// ( the default ) is unlimited.
+	EFSW_OPT_RATE_LIMIT = 28,
+	/// Events delivered at once before EFSW_OPT_RATE_LIMIT applies, the rate by default
+	EFSW_OPT_RATE_BURST = 29,
+	/// What happens to the events past EFSW_OPT_RATE_LIMIT, an efsw_rate_policy
+	EFSW_OPT_RATE_LIMIT_POLICY = 30,
+	/// Levels of subdirectories a recursive watch descends into, 0 only watching the directory.
+	/// Negative ( the default ) is unlimited, see efsw::Options::MaxDepth.
+	EFSW_OPT_MAX_DEPTH = 31,
+	/// Set to 1 to keep an index of the tree of the watch, queried with efsw_find_entry,
+	/// efsw_list_entries and efsw_walk_entries, see efsw::Options::TreeIndex. 0 by default.
+	EFSW_OPT_TREE_INDEX = 32,
+	/// Drops the modifications leaving the content of a file unchanged, for the files up to that
+	/// many bytes ( negative for any size ), see efsw::Options::ContentFingerprint. 0 by default.
+	EFSW_OPT_CONTENT_FINGERPRINT = 33
+};
+
+/// Behaviors of a full dispatch queue, see EFSW_OPT_DISPATCH_POLICY.
+enum efsw_queue_policy
+{
+	/// The backend waits for room
+	EFSW_QUEUE_BLOCK = 0,
+	/// The oldest events are dropped, the callback receives an EFSW_OVERFLOW
+	EFSW_QUEUE_DROP_OLDEST = 1,
+	/// The events are kept out of the queue until the callback catches up, repeated ones merged
+	EFSW_QUEUE_COALESCE = 2
+};
+
+/// Behaviors of a watch past its rate limit, see EFSW_OPT_RATE_LIMIT.
+enum efsw_rate_policy
+{
+	/// The events are dropped, the directories they happened in reported as modified later
+	EFSW_RATE_SUMMARIZE = 0,
+	/// The events are dropped, the callback receives an EFSW_OVERFLOW
+	EFSW_RATE_DROP = 1
+};
+
+/// Kinds of changes a watch can be interested in, see EFSW_OPT_EVENT_INTEREST.
+enum efsw_interest
+{
+	/// Files and directories created
+	EFSW_INTEREST_CREATED = 1,
+	/// Files and directories deleted
+	EFSW_INTEREST_DELETED = 2,
+	/// Files and directories renamed, the moves between directories are reported as deleted and
+	/// created
+	EFSW_INTEREST_MOVED = 4,
+	/// Files closed after being written
+	EFSW_INTEREST_CONTENT_CLOSED = 8,
+	/// Every write to a file
+	EFSW_INTEREST_CONTENT_MODIFIED = 16,
+	/// Permissions, ownership and timestamps changes
+	EFSW_INTEREST_ATTRIBUTES = 32,
+	/// The changes reported when the option is not set
+	EFSW_INTEREST_DEFAULT = 31,
+	EFSW_INTEREST_ALL = 63
 };
 
 /// Basic interface for listening for file events.
@@ -109,11 +237,92 @@ typedef void (*efsw_pfn_fileaction_callback) (
 		void* param
 );
 
+/// An event delivered to an efsw_pfn_batch_callback or read with efsw_read_events. The strings
+/// aren't null terminated.
+typedef struct {
+	efsw_watchid watchid;
+	enum efsw_action action;
+	const char* dir;
+	size_t dir_length;
+	const char* filename;
+	size_t filename_length;
+	const char* old_filename;
+	size_t old_filename_length;
+} efsw_event;
+
+/// Receives the events read at once by the backend, see efsw::FileWatchListener::handleFileActions.
+/// The events and their strings are only valid during the call.
+typedef void (*efsw_pfn_batch_callback) (
+		efsw_watcher watcher,
+		const efsw_event* events,
+		size_t count,
+		void* param
+);
+
 typedef struct {
 	enum efsw_option option;
 	int value;
 } efsw_watcher_option;
 
+/// A watch to add with efsw_addwatches
+typedef struct {
+	const char* directory;
+	efsw_pfn_fileaction_callback callback_fn;
+	int recursive;
+	efsw_watcher_option* options;
+	int options_number;
+	void* param;
+} efsw_watch_spec;
+
+/// An event read with efsw_journal_read. The strings point into the shared memory and aren't
+/// null terminated, the names are only valid while efsw_journal_intact returns 1.
+typedef struct {
+	unsigned long long sequence;
+	efsw_watchid watchid;
+	enum efsw_action action;
+	const char* dir;
+	size_t dir_length;
+	const char* filename;
+	size_t filename_length;
+	const char* old_filename;
+	size_t old_filename_length;
+} efsw_journal_event;
+
+/// Counters of a watch, see efsw_getstats and efsw::WatchStats for their meaning.
+typedef struct {
+	unsigned long long received;
+	unsigned long long filtered;
+	unsigned long long coalesced;
+	unsigned long long dropped;
+	unsigned long long delivered;
+	unsigned long long overflows;
+	unsigned long long kernel_watches;
+	unsigned long long scans;
+	/// Microseconds
+	unsigned long long scan_time;
+	/// Milliseconds since the epoch
+	unsigned long long last_crawl;
+	/// Microseconds
+	unsigned long long crawl_time;
+} efsw_stats;
+
+/// An entry of the index of a watch added with EFSW_OPT_TREE_INDEX, see efsw::TreeEntry
+typedef struct {
+	/// Relative to the watched directory, with '/' separators
+	const char* path;
+	int directory;
+	unsigned long long size;
+	/// Seconds since the epoch
+	unsigned long long modification_time;
+	unsigned long long inode;
+	unsigned long long sequence;
+} efsw_tree_entry;
+
+/// Called for the entries of efsw_list_entries and efsw_walk_entries, the entry is only valid
+/// during the call
+/// @return 0 to stop
+typedef int (*efsw_pfn_entry_callback)(const efsw_tree_entry* entry, void* param);
+
 /**
  * Creates a new file-watcher
  * @param generic_mode Force the use of the Generic file watcher
@@ -123,7 +332,27 @@ efsw_watcher EFSW_API efsw_create(int generic_mode);
 /// Release the file-watcher and unwatch any directories
 void EFSW_API efsw_release(efsw_watcher watcher);
 
-/// Retrieve last error occured by file-watcher
+/**
+ * Creates a backend and its thread to share between watchers
+ * @param generic_mode Force the use of the Generic file watcher
+ */
+efsw_reactor EFSW_API efsw_reactor_create(int generic_mode);
+
+/// Release the reactor, once the watchers attached to it are released
+void EFSW_API efsw_reactor_release(efsw_reactor reactor);
+
+/// Creates a new file-watcher attached to the backend of the reactor
+efsw_watcher EFSW_API efsw_create_with_reactor(efsw_reactor reactor);
+
+/// Follow the symbolic links in the watches of every file-watcher attached to the reactor,
+/// see efsw_follow_symlinks. The file-watchers attached can't change it.
+void EFSW_API efsw_reactor_follow_symlinks(efsw_reactor reactor, int enable);
+
+/// Allow the symbolic links out of scope in the watches of every file-watcher attached to the
+/// reactor, see efsw_allow_outofscopelinks
+void EFSW_API efsw_reactor_allow_outofscopelinks(efsw_reactor reactor, int allow);
+
+/// Retrieve last error occured by file-watcher in the calling thread
 EFSW_API const char* efsw_getlasterror();
 
 /// Reset file-watcher last error
@@ -135,24 +364,121 @@ efsw_watchid EFSW_API efsw_addwatch(efsw_watcher watcher, const char* directory,
 	efsw_pfn_fileaction_callback callback_fn, int recursive, void* param);
 
 /// Add a directory watch, specifying options
+/// @param callback_fn NULL to read the events with efsw_read_events
 /// @param options Pointer to an array of watcher options
 /// @param nr_options Number of options referenced by \p options
 efsw_watchid EFSW_API efsw_addwatch_withoptions(efsw_watcher watcher, const char* directory,
 	efsw_pfn_fileaction_callback callback_fn, int recursive, efsw_watcher_option *options,
 	int options_number, void* param);
 
+/// Add a directory watch whose callback receives the events in batches, one call for all the
+/// events the backend read at once
+/// @param options Pointer to an array of watcher options, NULL if \p options_number is 0
+efsw_watchid EFSW_API efsw_addwatch_batch(efsw_watcher watcher, const char* directory,
+	efsw_pfn_batch_callback callback_fn, int recursive, efsw_watcher_option *options,
+	int options_number, void* param);
+
+/// Add many directory watches at once, sharing the watch of the directories nested in a recursive
+/// one ( see efsw::FileWatcher::addWatches )
+/// @param ids Receives the watch id, or the error, of each spec
+void EFSW_API efsw_addwatches(efsw_watcher watcher, const efsw_watch_spec* specs, int count,
+	efsw_watchid* ids);
+
 /// Remove a directory watch. This is a brute force search O(nlogn).
 void EFSW_API efsw_removewatch(efsw_watcher watcher, const char* directory);
 
 /// Remove a directory watch. This is a map lookup O(logn).
 void EFSW_API efsw_removewatch_byid(efsw_watcher watcher, efsw_watchid watchid);
 
+/// Watches the subdirectories of a directory of a watch added with EFSW_OPT_MAX_DEPTH, see
+/// efsw::FileWatcher::expandWatch
+/// @return 1 on success, 0 if there's no such watch or the directory isn't watched
+int EFSW_API efsw_expandwatch(efsw_watcher watcher, efsw_watchid watchid, const char* directory);
+
+/// Stops watching the subdirectories of a directory of a watch added with EFSW_OPT_MAX_DEPTH, see
+/// efsw::FileWatcher::collapseWatch
+/// @return 1 on success, 0 if there's no such watch or the directory isn't watched
+int EFSW_API efsw_collapsewatch(efsw_watcher watcher, efsw_watchid watchid,
+	const char* directory);
+
+/// Looks up an entry of the index of a watch added with EFSW_OPT_TREE_INDEX, see
+/// efsw::FileWatcher::findEntry. The path of the entry is valid until the next call from the
+/// same thread.
+/// @return 1 if found, 0 if there's no such entry or the watch has no index
+int EFSW_API efsw_find_entry(efsw_watcher watcher, efsw_watchid watchid, const char* path,
+	efsw_tree_entry* entry);
+
+/// Calls the callback for the entries of a directory of the index, see
+/// efsw::FileWatcher::listEntries
+/// @return 1 on success, 0 if the directory isn't indexed or the watch has no index
+int EFSW_API efsw_list_entries(efsw_watcher watcher, efsw_watchid watchid,
+	const char* directory, efsw_pfn_entry_callback callback_fn, void* param);
+
+/// Calls the callback for the entries of the index whose path starts with the prefix, see
+/// efsw::FileWatcher::walkEntries
+/// @return 1 on success, 0 if the watch has no index
+int EFSW_API efsw_walk_entries(efsw_watcher watcher, efsw_watchid watchid, const char* prefix,
+	efsw_pfn_entry_callback callback_fn, void* param);
+
+/// @return The sequence of the last event applied to the index of the watch, 0 without index
+unsigned long long EFSW_API efsw_index_sequence(efsw_watcher watcher, efsw_watchid watchid);
+
+/// Spreads the watches over that many inotify instances, see efsw::FileWatcher::setShards
+/// @return 1 on success, 0 if the backend can't be sharded or watches were added already
+int EFSW_API efsw_set_shards(efsw_watcher watcher, unsigned int shards);
+
 /// Starts watching ( in other thread )
 void EFSW_API efsw_watch(efsw_watcher watcher);
 
+/// @return A handle that becomes readable when there is work for efsw_read_events, to drive the
+/// watcher from an event loop instead of calling efsw_watch. -1 ( NULL on Windows ) if the
+/// backend has none, efsw_read_events must then be called periodically.
+efsw_poll_handle EFSW_API efsw_get_fd(efsw_watcher watcher);
+
+/// Reads the events of the watches added without a callback, handling first what the backend
+/// has pending unless efsw_watch was called ( see efsw::FileWatcher::readEvents ). The strings
+/// stay valid until the next call for the watcher.
+/// @return The number of events read, less than \p max once no event is left
+size_t EFSW_API efsw_read_events(efsw_watcher watcher, efsw_event* events, size_t max);
+
+/// Fills the counters of a watch, or the ones of all the watches summed if \p watchid is 0
+void EFSW_API efsw_getstats(efsw_watcher watcher, efsw_watchid watchid, efsw_stats* stats);
+
+/// Publishes the journal of the watcher in shared memory under the name, for the other processes
+/// of the user to read with efsw_journal_open ( see efsw::FileWatcher::publishJournal )
+/// @param ring_size The bytes of the ring of events, 0 for the default 16 MB
+/// @param paths_size The bytes of the table of the directories, 0 for the default 4 MB
+/// @return 1 on success, 0 if the shared memory couldn't be created
+int EFSW_API efsw_publish_journal(efsw_watcher watcher, const char* name, size_t ring_size,
+	size_t paths_size);
+
+/// Maps the journal published under the name, to read the events published from now on
+/// @return NULL if no journal is published under that name
+efsw_journal_reader EFSW_API efsw_journal_open(const char* name);
+
+/// Unmaps the journal
+void EFSW_API efsw_journal_close(efsw_journal_reader reader);
+
+/// Reads up to \p max events from the cursor of the reader, without copying them. A reader that
+/// fell behind reads an EFSW_OVERFLOW of watch 0 where events were lost.
+/// @return The number of events read
+size_t EFSW_API efsw_journal_read(efsw_journal_reader reader, efsw_journal_event* events,
+	size_t max);
+
+/// @return 1 if the events last read weren't overwritten yet
+int EFSW_API efsw_journal_intact(efsw_journal_reader reader);
+
+/// Waits up to the milliseconds for an event to read
+/// @return 1 if there's one, 0 once the time is up or the publisher is gone
+int EFSW_API efsw_journal_wait(efsw_journal_reader reader, unsigned int milliseconds);
+
+/// @return 1 once the publisher is gone
+int EFSW_API efsw_journal_closed(efsw_journal_reader reader);
+
 /**
  * Allow recursive watchers to follow symbolic links to other directories
  * followSymlinks is disabled by default
+ * A watcher attached to a reactor ignores it, see efsw_reactor_follow_symlinks
  */
 void EFSW_API efsw_follow_symlinks(efsw_watcher watcher, int enable);
 
@@ -167,6 +493,7 @@ int EFSW_API efsw_follow_symlinks_isenabled(efsw_watcher watcher);
  * Enabling this could lead in infinite recursion, and crash the watcher ( it will try not to avoid this ).
  * Buy enabling out of scope links, it will allow this behavior.
  * allowOutOfScopeLinks are disabled by default.
+ * A watcher attached to a reactor ignores it, see efsw_reactor_allow_outofscopelinks
  */
 void EFSW_API efsw_allow_outofscopelinks(efsw_watcher watcher, int allow);
 
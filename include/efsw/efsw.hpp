@@ -31,14 +31,22 @@
 #include "efsw/Mutex.hpp"
 #include "efsw/Lock.hpp"
 
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <mutex>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <filesystem>
+#include <thread>
 
 #if defined( _WIN32 )
 #ifdef EFSW_DYNAMIC
@@ -74,10 +82,29 @@ namespace efsw {
 /// Type for a watch id
 typedef long WatchID;
 
+/// Handle to wait for the events of a FileWatcher driven with FileWatcher::readEvents: a file
+/// descriptor, or a HANDLE on Windows
+#if defined( _WIN32 )
+typedef void* PollHandle;
+#else
+typedef int PollHandle;
+#endif
+
 // forward declarations
+class EventCoalescer;
+class EventDispatcher;
+class EventJournal;
+class EventQueue;
 class FileWatcherImpl;
 class FileWatchListener;
+class Reactor;
+struct Event;
+class SharedMemory;
+class SnapshotStore;
+class WatchGrouper;
+class WatchStages;
 class WatcherOption;
+struct WatchSpec;
 
 /// Actions to listen for. Rename will send two events, one for
 /// the deletion of the old file, and one for the creation of the
@@ -91,7 +118,13 @@ enum Action {
 	/// Sent when a file is modified
 	Modified = 3,
 	/// Sent when a file is moved
-	Moved = 4
+	Moved = 4,
+	/// Sent when events were lost because the backend queue overflowed, the filename is empty.
+	/// The backend resyncs the watch when it can, otherwise its state should be considered unknown.
+	Overflow = 5,
+	/// Sent once the events replayed for a watch started from Options::FSEventsSinceId or
+	/// Options::UsnSinceId were all delivered, the filename is empty
+	HistoryDone = 6
 };
 }
 typedef Actions::Action Action;
@@ -113,19 +146,21 @@ enum Error {
 	Unspecified = -7
 };
 
+/// The last error is kept per thread, so each thread adding watches reads its own
 class EFSW_API Log {
   public:
-	/// @return The last error logged
+	/// @return The message of the last error logged by the calling thread
 	static std::string getLastErrorLog();
 
-	/// @return The code of the last error logged
+	/// @return The code of the last error logged by the calling thread
 	static Error getLastErrorCode();
 
 	/// Reset last error
 	static void clearLastError();
 
-	/// Creates an error of the type specified
-	static Error createLastError( Error err, std::string log );
+	/// Creates an error of the type specified. Only the code and the path are kept, the message
+	/// is formatted by getLastErrorLog.
+	static Error createLastError( Error err, std::string_view log );
 };
 
 } // namespace Errors
@@ -143,11 +178,382 @@ enum Option {
 	/// For Windows, per default all events are captured but we might only be interested
 	/// in a subset; the value of the option should be set to a bitwise or'ed set of
 	/// FILE_NOTIFY_CHANGE_* flags.
-	WinNotifyFilter = 2
+	WinNotifyFilter = 2,
+	/// The kinds of changes reported by the watch, the value should be set to a bitwise or'ed
+	/// set of Interests::Interest flags ( Interests::Default if not set ). The backends request
+	/// only those changes to the kernel when the platform allows it, the rest are filtered out
+	/// before reaching the listener.
+	EventInterest = 3,
+	/// For recursive watches on the backends with a kernel watch per directory ( inotify ), the
+	/// maximum number of kernel watches the watch can use. The least recently active subtrees
+	/// beyond it are polled instead, and get their kernel watches back once a change is seen in
+	/// them. A directory is active when an entry is created, deleted, renamed, or written and
+	/// closed in it. Only the times of their directories are polled: the entries created, deleted
+	/// and renamed are reported, a file modified in place isn't seen until the subtree is watched
+	/// again. 0 ( the default ) is unlimited, the subtrees are only polled when the system limit
+	/// is reached.
+	WatchBudget = 4,
+	/// For inotify, the milliseconds a rename source waits for its destination before it's
+	/// reported as deleted ( moved outside the watches ). 100 by default.
+	MovePairingWindow = 5,
+	/// Quiet window in milliseconds for the events of a path. The events of a path are merged
+	/// until it's left unchanged for the window, then delivered from a thread of the FileWatcher:
+	/// repeated modifications are reported once, a file created and modified as added, a file
+	/// created and deleted not at all, and a file deleted and created again as modified. Works
+	/// the same on every backend. 0 ( the default ) delivers the events as they happen.
+	/// A listener of the watch must not remove a watch from its callback, the removal waits for
+	/// the delivery in progress.
+	CoalesceWindow = 6,
+	/// Capacity in events of a queue between the backend and the listener. The backend thread
+	/// only pushes the events into it and a dispatcher thread calls the listener, so a slow
+	/// listener doesn't stall the backend. 0 ( the default ) calls the listener from the backend.
+	/// As with CoalesceWindow, a listener of the watch must not remove a watch from its callback.
+	DispatchQueueSize = 7,
+	/// What the backend does when the dispatch queue is full, a QueuePolicies::QueuePolicy.
+	/// QueuePolicies::Block by default.
+	DispatchPolicy = 8,
+	/// A glob pattern of the entries reported, set with the string constructor of WatcherOption
+	/// and repeatable. Only the entries matching one of them reach the listener. A pattern
+	/// without a slash matches the name of the entry ( `*.cpp`, `Makefile`, `test_*` ), one with
+	/// a slash its path relative to the watched directory ( `src/**/*.h` ), where `*` doesn't
+	/// match a slash and `**` does. The directories are entries too: `*.cpp` hides the creation
+	/// of a directory, but not the files created inside of it.
+	IncludePattern = 9,
+	/// A glob pattern of the entries not reported, with the syntax of IncludePattern. A pattern
+	/// ending with a slash excludes a directory and everything under it ( `build/` ). The
+	/// directories excluded aren't descended into by the recursive watches, they don't use any
+	/// kernel watch nor are scanned.
+	ExcludePattern = 10,
+	/// The path of a .gitignore-style file of exclude patterns, one per line, set with the
+	/// string constructor of WatcherOption. A relative path is relative to the watched
+	/// directory. The negated patterns ( `!pattern` ) aren't supported. The file is read once,
+	/// when the watch is added.
+	ExcludeFile = 11,
+	/// Set to 1 to have the events delivered to handleFileActions carry the path of the file
+	/// already joined ( Event::path, Event::oldPath and Event::nameOffset ), built into a buffer
+	/// reused between batches. 0 ( the default ) leaves them empty.
+	FullPath = 12,
+	/// For the generic watcher, the milliseconds between the scans of a directory that changed.
+	/// 1000 by default.
+	PollMinInterval = 13,
+	/// For the generic watcher, the maximum milliseconds between the scans of a directory. The
+	/// directories that stay unchanged are scanned less and less often, doubling their interval
+	/// from PollMinInterval up to it, and back to PollMinInterval once they change. Each
+	/// directory is scanned on its own schedule, only the ones due are. PollMinInterval by
+	/// default, so every directory is scanned at the same pace.
+	PollMaxInterval = 14,
+	/// For the generic watcher, the number of threads scanning the directories due, the watcher
+	/// thread included. The threads are shared by all the watches of the FileWatcher, their
+	/// number is the largest one asked by a watch. The events of a directory are still reported
+	/// in order, from the watcher thread. 1 by default.
+	PollThreads = 15,
+	/// The path of a file keeping the state of the watched directories, set with the string
+	/// constructor of WatcherOption. When the watch is added, the changes made since the file was
+	/// saved are reported to its listener, from addWatch. The file is saved again when the watch
+	/// is removed or the FileWatcher destroyed. A file missing or of another watch is ignored.
+	SnapshotFile = 16,
+	/// For the generic watcher, the maximum milliseconds a pass scans the directories of the
+	/// watch for. A directory not fully scanned by then is resumed by the next pass, right
+	/// after, and its changes reported once it's done, so a huge directory doesn't delay the
+	/// others for seconds. Every directory scans a few hundred entries a pass at least, the
+	/// small ones are done in one. 0 ( the default ) for no limit.
+	PollTimeSlice = 17,
+	/// For the kqueue backend, set to 1 to only register the directories, instead of a file
+	/// descriptor per file, so large trees don't run out of descriptors. The changes of the
+	/// files are found by the scan of their directory once it changes ( entries created, deleted
+	/// or renamed, a file saved by replacing it ): a file modified in place isn't reported until
+	/// then, unless it's a KqueueHotFile. 0 by default.
+	KqueueDirectoriesOnly = 18,
+	/// A glob pattern of the files that keep their own descriptor with KqueueDirectoriesOnly, so
+	/// their modifications are reported as they happen. Set with the string constructor of
+	/// WatcherOption and repeatable, with the syntax of IncludePattern.
+	KqueueHotFile = 19,
+	/// For the FSEvents backend, the milliseconds the stream waits for more events before
+	/// delivering them, coalescing the changes of a busy directory into fewer wakeups. The watches
+	/// share a stream, which uses the smallest latency asked. 0 by default.
+	FSEventsLatency = 20,
+	/// For the FSEvents backend, set to 1 to deliver the first event after a quiet period at once
+	/// and only coalesce the following ones for the latency, 0 to always wait the latency. The
+	/// stream doesn't defer if a watch asks so. 1 by default.
+	FSEventsNoDefer = 21,
+	/// For the FSEvents backend, set to 1 for the events of each file ( OS X 10.7 and newer ),
+	/// 0 for the events of the directories only, which are then scanned for their changes: far
+	/// fewer events on busy trees, but each costs a scan. 1 by default.
+	FSEventsFileEvents = 22,
+	/// For the FSEvents backend, the event ID to start the watch from, in decimal, set with the
+	/// string constructor of WatcherOption. The changes made since that event, e.g. while the
+	/// program wasn't running, are replayed by the OS, then Actions::HistoryDone is sent. Save
+	/// FileWatcher::getEventId() to resume from it later.
+	FSEventsSinceId = 23,
+	/// For Windows, the number of threads handling the completed notifications, shared by the
+	/// watches of the FileWatcher, their number is the largest one asked by a watch. The
+	/// notifications of a watch are still handled in order, one at a time. 1 by default.
+	WinCompletionThreads = 24,
+	/// For Windows, whether a watch keeps a snapshot of its tree to resync it once the buffer
+	/// overflowed: the changes since the last resync are reported after Actions::Overflow. Set
+	/// to 0 to save the memory of the snapshot, only Actions::Overflow is reported then.
+	/// 1 by default.
+	WinOverflowResync = 25,
+	/// For the USN journal backend, the USN to start the watch from, in decimal, set with the
+	/// string constructor of WatcherOption. The changes made since then, e.g. while the program
+	/// wasn't running, are replayed from the journal of the volume, then Actions::HistoryDone is
+	/// sent ( Actions::Overflow first if the journal doesn't hold them anymore ). Save
+	/// FileWatcher::getEventId( watchid ) to resume from it later.
+	UsnSinceId = 26,
+	/// Set to 1 to record the events of the watch in the journal of the FileWatcher, numbered in
+	/// sequence, for the consumers reading it from their own cursor with
+	/// FileWatcher::readJournal. The events still reach the listener, a watch added without one
+	/// only records them. 0 by default.
+	Journal = 27,
+	/// Events per second delivered to the listener of the watch, through its dispatch queue
+	/// ( one of 4096 events if DispatchQueueSize isn't set ). The events past the limit are
+	/// handled as RateLimitPolicy tells, so a noisy tree doesn't hold back the other watches the
+	/// dispatcher thread serves. 0 ( the default ) is unlimited.
+	RateLimit = 28,
+	/// Events delivered at once before RateLimit applies, RateLimit by default
+	RateBurst = 29,
+	/// What happens to the events past RateLimit, a RatePolicies::RatePolicy.
+	/// RatePolicies::Summarize by default.
+	RateLimitPolicy = 30,
+	/// Levels of subdirectories a recursive watch descends into: 0 only watches the directory,
+	/// 1 its subdirectories too, and so on. The entries of the deepest directories watched are
+	/// still reported, the subdirectories among them just aren't watched. Set it to let
+	/// FileWatcher::expandWatch and FileWatcher::collapseWatch change the directories watched
+	/// later, a negative value being unlimited. Unlimited by default.
+	MaxDepth = 31,
+	/// Set to 1 to keep an index of the tree of the watch in memory: the type, size,
+	/// modification time and inode of its entries, listed once the watch is added and kept up to
+	/// date from its events, to be queried with FileWatcher::findEntry, listEntries and
+	/// walkEntries without touching the disk. The events are applied right before they reach
+	/// the listener, so the listener finds the index up to date with them. The index only
+	/// follows the changes the watch reports: the entries its patterns reject aren't indexed,
+	/// the changes its interests drop are missed until an Actions::Overflow lists the tree
+	/// again. 0 by default.
+	TreeIndex = 32,
+	/// Drops the Actions::Modified of the files whose content didn't change, as editors and
+	/// generators rewriting a file as it was cause. The content of a file modified is hashed
+	/// and compared with the hash of its last change, unless its size and modification time
+	/// show it unchanged since then. The value is the largest size in bytes of the files
+	/// compared, the bigger ones are always reported; negative for any size. The files are
+	/// hashed when added or moved in, and the first time a file is modified otherwise, so the
+	/// first modification of a file there since the watch was added is reported. The backends
+	/// reporting every write ( inotify, kqueue ) see a file truncated before it's rewritten, so
+	/// set a CoalesceWindow too: the file is compared once the rewrite settled. The events
+	/// dropped are counted as filtered. 0 ( the default ) disables it.
+	ContentFingerprint = 33
 };
 }
 typedef Options::Option Option;
 
+/// Kinds of changes a watch can be interested in, see Options::EventInterest.
+namespace Interests {
+enum Interest {
+	/// Files and directories created ( Actions::Add )
+	Created = 1,
+	/// Files and directories deleted ( Actions::Delete )
+	Deleted = 2,
+	/// Files and directories renamed ( Actions::Moved ). The entries moved between directories
+	/// are reported as deleted and created, so they depend on those interests instead.
+	Moved = 4,
+	/// Files closed after being written ( Actions::Modified )
+	ContentClosed = 8,
+	/// Every write to a file ( Actions::Modified ), much more frequent than ContentClosed
+	ContentModified = 16,
+	/// Permissions, ownership and timestamps changes ( Actions::Modified )
+	Attributes = 32,
+	/// The changes reported when the option is not set
+	Default = Created | Deleted | Moved | ContentClosed | ContentModified,
+	All = Default | Attributes
+};
+}
+typedef Interests::Interest Interest;
+
+/// Behaviors of a full dispatch queue, see Options::DispatchPolicy.
+namespace QueuePolicies {
+enum QueuePolicy {
+	/// The backend waits for room. A listener of the watch must not remove a watch from its
+	/// callback, the backend could be waiting for it.
+	Block = 0,
+	/// The oldest events queued are dropped, the listener receives an Actions::Overflow where
+	/// the events were lost
+	DropOldest = 1,
+	/// The events are kept out of the queue until the listener catches up, the repeated ones
+	/// merged into one
+	Coalesce = 2
+};
+}
+typedef QueuePolicies::QueuePolicy QueuePolicy;
+
+/// Behaviors of a watch past its rate limit, see Options::RateLimit.
+namespace RatePolicies {
+enum RatePolicy {
+	/// The events are dropped, and each directory they happened in is reported once the rate
+	/// allows it: an Actions::Modified of the directory with an empty filename, for the listener
+	/// to scan it
+	Summarize = 0,
+	/// The events are dropped, the listener receives an Actions::Overflow where they were lost
+	Drop = 1
+};
+}
+typedef RatePolicies::RatePolicy RatePolicy;
+
+/// An event read with FileWatcher::readEvents. Reusing the buffer between reads reuses the
+/// capacity of its strings.
+struct FileEvent {
+	WatchID watchid;
+	std::string dir;
+	std::string filename;
+	Action action;
+	std::string oldFilename;
+};
+
+/// An event read from the journal with FileWatcher::readJournal
+struct JournalEvent : FileEvent {
+	/// The sequence number of the event, one more than the previous one
+	uint64_t sequence;
+};
+
+/// An entry of the index of a watch with Options::TreeIndex
+struct TreeEntry {
+	/// Relative to the watched directory, with '/' separators
+	std::string path;
+	bool directory;
+	uint64_t size;
+	/// In seconds since the epoch
+	uint64_t modificationTime;
+	uint64_t inode;
+	/// The event of the watch that last changed the entry, see FileWatcher::indexSequence. 0 if
+	/// none did since the tree was listed.
+	uint64_t sequence;
+};
+
+/// Counters of the dispatch queue of a watch, see Options::DispatchQueueSize.
+struct DispatchStats {
+	/// Events waiting in the queue
+	size_t depth;
+	/// Capacity of the queue ( 0 if the watch has no dispatch queue )
+	size_t capacity;
+	/// Events dropped because the queue was full
+	size_t dropped;
+	/// Events merged into a repeated one because the queue was full
+	size_t coalesced;
+	/// Times the backend waited for room in the queue
+	size_t blocked;
+	/// Events past Options::RateLimit, dropped or summarized
+	size_t limited;
+};
+
+/// Counters of a watch, see FileWatcher::getStats. They are kept with relaxed atomics, so they
+/// only add up once the watch is idle. A change read from the system can be reported as several
+/// events ( a file moved in is added and modified ), or as none.
+struct WatchStats {
+	/// Events read from the system for the watch, or changes found by its scans
+	uint64_t received;
+	/// Events dropped by the interests or the patterns of the watch, or as leaving the content
+	/// unchanged
+	uint64_t filtered;
+	/// Events merged into others by Options::CoalesceWindow or by a full dispatch queue
+	uint64_t coalesced;
+	/// Events dropped because the dispatch queue was full, or past Options::RateLimit
+	uint64_t dropped;
+	/// Events delivered to the listener
+	uint64_t delivered;
+	/// Actions::Overflow notifications delivered
+	uint64_t overflows;
+	/// Kernel watches and descriptors held: inotify watches, kqueue descriptors or Win32
+	/// directory handles ( 0 with fanotify, FSEvents and the USN journal, which share theirs )
+	uint64_t kernelWatches;
+	/// Polling passes made by the generic watcher, and their time in microseconds
+	uint64_t scans;
+	uint64_t scanTime;
+	/// When the watch was added, in milliseconds since the epoch, and the time the backend took
+	/// to crawl its tree, in microseconds. In the totals, the last watch added and the time of
+	/// all the crawls.
+	uint64_t lastCrawl;
+	uint64_t crawlTime;
+};
+
+/// A latency histogram of a watch, see FileWatcher::getLatency. The values are kept in
+/// logarithmic buckets of 16 sub-buckets each, so the percentiles are within about 6% of the
+/// exact ones. All 0 unless efsw is built with EFSW_TRACING.
+struct LatencyStats {
+	/// Values recorded
+	uint64_t count;
+	/// In microseconds
+	uint64_t min;
+	uint64_t max;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+/// Receives the timings of a FileWatcher built with EFSW_TRACING, e.g. to emit trace events.
+/// The times are nanoseconds of std::chrono::steady_clock. The hooks are called from the threads
+/// of the backend and of the dispatching stages, so they must be thread safe and quick.
+class TraceHooks {
+  public:
+	virtual ~TraceHooks() {}
+
+	/// A stage of the backend ran from begin to end: "inotify.read", "inotify.lock",
+	/// "inotify.batch", "inotify.movePairing" ( from the IN_MOVED_FROM to its pair or expiry ),
+	/// and "fanotify.read", "fanotify.lock", "fanotify.batch"
+	/// @param watchid The watch of the stage, 0 for the ones serving all of them
+	virtual void onSpan( const char* /*name*/, WatchID /*watchid*/, uint64_t /*begin*/,
+						 uint64_t /*end*/ ) {}
+
+	/// A batch of a watch is about to reach its listener, Event::captured is when each of its
+	/// events was read
+	virtual void onDeliveryBegin( const Event* /*events*/, size_t /*count*/, uint64_t /*time*/ ) {}
+
+	/// The listener returned from the batch
+	virtual void onDeliveryEnd( const Event* /*events*/, size_t /*count*/, uint64_t /*time*/ ) {}
+};
+
+/// A change replayed by the simulated backend, see Simulation::script
+struct SimulatedChange {
+	/// Actions::Add, Delete, Modified or Moved
+	Action action;
+	/// The file changed, relative to the watched directory, with '/' separators
+	std::string path;
+	/// Where a moved file was, relative to the watched directory
+	std::string oldPath;
+};
+
+/// The changes made up by the simulated backend, see FileWatcher( const Simulation& ). Nothing is
+/// read from the disk: every watch gets a tree of the shape given under its directory, and the
+/// backend thread changes random files of it at the rate given. The changes are read as a native
+/// backend reads its events, so they go through the same move pairing, filtering and stages.
+/// The same settings make the same changes in the same order, on every platform.
+struct Simulation {
+	/// Changes per second of each watch, 0 for as fast as they are delivered
+	unsigned int rate = 0;
+	/// Changes made by each watch, 0 for no limit
+	uint64_t changes = 0;
+	/// Changes read together, as the events of one buffer of the system
+	unsigned int batch = 256;
+	/// Shape of the tree of each watch ( a watch not recursive only has the files of its
+	/// directory ): levels of subdirectories, subdirectories per directory and files per
+	/// directory
+	int depth = 2;
+	int fanout = 4;
+	int files = 16;
+	/// Seed of the random changes, the watch id is added to it
+	uint32_t seed = 1;
+	/// Relative weights of the random changes: files added, deleted, modified, renamed and moved
+	/// to another directory. Each change is reported as one event, but the moves between
+	/// directories, reported as a deletion and an addition.
+	unsigned int adds = 1;
+	unsigned int deletes = 1;
+	unsigned int modifications = 4;
+	unsigned int renames = 1;
+	unsigned int moves = 0;
+	/// Changes replayed in order instead of the random ones, from the first one again once all
+	/// were made, until the number of changes is reached ( once if there's no limit )
+	std::vector<SimulatedChange> script;
+};
+
 /// Listens to files and directories and dispatches events
 /// to notify the listener of files and directories changes.
 /// @class FileWatcher
@@ -159,6 +565,16 @@ class EFSW_API FileWatcher {
 	/// Constructor that lets you force the use of the Generic File Watcher
 	explicit FileWatcher( bool useGenericFileWatcher );
 
+	/// Constructor using the simulated backend, to load the library with events made up at a
+	/// known rate, see Simulation
+	explicit FileWatcher( const Simulation& simulation );
+
+	/// Constructor attaching the watcher to the backend of the reactor instead of creating one.
+	/// The watcher keeps its own watches, but the thread started by watch() is the one of the
+	/// reactor, pollHandle() has no handle and readEvents() only reads the events queued. The
+	/// links are followed as the last of the watchers attached set.
+	explicit FileWatcher( Reactor& reactor );
+
 	virtual ~FileWatcher();
 
 	/// Add a directory watch. Same as the other addWatch, but doesn't have recursive option.
@@ -172,27 +588,174 @@ class EFSW_API FileWatcher {
 
 	/// Add a directory watch, allowing customization with options
 	/// @param directory The folder to be watched
-	/// @param watcher The listener to receive events
+	/// @param watcher The listener to receive events, NULL to read them with readEvents
 	/// @param recursive Set this to true to include subdirectories
 	/// @param options Allows customization of a watcher
 	/// @return Returns the watch id for the directory or, on error, a WatchID with Error type.
+	/// A directory watched already by a recursive watch ( or by a watch not recursive, for one not
+	/// recursive either ) with the same options shares its kernel watches instead of being crawled
+	/// and watched again, until the last watch of the tree is removed.
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive, 
 					  const std::vector<WatcherOption> &options );
 
-	/// Remove a directory watch. This is a brute force search O(nlogn).
+	/// Same as addWatch, but returns once the directory itself is watched: the subdirectories of
+	/// a recursive watch are crawled and watched from another thread, without blocking the
+	/// events of the other watches. The events of the directory are delivered right away, the
+	/// ones of the subdirectories watched meanwhile once the crawl is done, then the
+	/// handleWatchReady of the listener is called. The backends that
+	/// can't crawl in the background ( all but inotify ) add the watch as addWatch does, ready
+	/// before returning, as is a watch sharing a tree watched already.
+	WatchID addWatchAsync( const std::string& directory, FileWatchListener* watcher,
+						   bool recursive, const std::vector<WatcherOption>& options = {} );
+
+	/// Adds many watches at once. The directories are sorted, so the ones nested in a recursive
+	/// watch with the same options ( and no pattern nor snapshot file ) share its tree as addWatch
+	/// does, whatever the order of the specs. Every watch keeps its listener and gets an id of its
+	/// own, the same specs repeated get the same id.
+	/// @return The watch id of each spec, or its error, in the order of the specs
+	std::vector<WatchID> addWatches( const std::vector<WatchSpec>& specs );
+
+	/// Remove a directory watch. This is a hash lookup O(1): the directory is compared normalized
+	/// ( "a/./b", "a//b" and "a/x/../b" are "a/b" ), and resolved if it's a symbolic link.
 	void removeWatch( const std::string& directory );
 
 	/// Remove a directory watch. This is a map lookup O(logn).
 	void removeWatch( WatchID watchid );
 
+	/// Watches the subdirectories of a directory of a watch added with Options::MaxDepth, down to
+	/// MaxDepth levels below it, as the user navigates into it. The backends watching every
+	/// directory on their own ( inotify, kqueue and the generic one ) watch the subtree, inotify
+	/// from its event loop, the ones watching the whole tree only start reporting it.
+	/// @param directory Relative to the directory of the watch, or the full path
+	/// @return False if there's no such watch, or the directory isn't watched
+	bool expandWatch( WatchID watchid, const std::string& directory );
+
+	/// Stops watching the subdirectories of a directory of a watch added with Options::MaxDepth,
+	/// removing their kernel watches. The entries of the directory are still reported.
+	/// @return False if there's no such watch, or the directory isn't watched
+	bool collapseWatch( WatchID watchid, const std::string& directory );
+
+	/// Looks up an entry of the index of a watch added with Options::TreeIndex
+	/// @param path Relative to the watched directory, or the full path
+	/// @return False if there's no such entry, or the watch has no index
+	bool findEntry( WatchID watchid, const std::string& path, TreeEntry& entry );
+
+	/// Fills the entries of a directory of the index, sorted by name
+	/// @param directory Relative to the watched directory ( empty for the watched one ), or the
+	/// full path
+	/// @return False if the directory isn't in the index, or the watch has no index
+	bool listEntries( WatchID watchid, const std::string& directory,
+					  std::vector<TreeEntry>& entries );
+
+	/// Calls the visitor for the entries of the index whose relative path starts with the
+	/// prefix, sorted by path, until it returns false. The events of the watch wait for the walk
+	/// to be done, the visitor must not add nor remove watches.
+	/// @return False if the watch has no index
+	bool walkEntries( WatchID watchid, const std::string& prefix,
+					  const std::function<bool( const TreeEntry& entry )>& visitor );
+
+	/// @return The sequence of the last event applied to the index of the watch: the events
+	/// delivered to its listener are numbered from 1. 0 if the watch has no index.
+	uint64_t indexSequence( WatchID watchid );
+
 	/// Starts watching ( in other thread )
 	void watch();
 
+	/// @return A handle that becomes readable when there is work for readEvents, to drive the
+	/// watcher from an existing event loop instead of calling watch(). -1 ( NULL on Windows ) if
+	/// the backend can't provide one, readEvents must then be called periodically.
+	PollHandle pollHandle();
+
+	/// Reads into the buffer the events of the watches added without a listener. Unless watch()
+	/// was called, it first handles what the backend has pending without blocking, calling the
+	/// listeners of the other watches from the calling thread. Must not be called from several
+	/// threads at once.
+	/// @return The number of events read, less than max once no event is left
+	size_t readEvents( FileEvent* events, size_t max );
+
+	/// Sets the number of events the journal keeps ( see Options::Journal ), 65536 by default.
+	/// The events kept are dropped, the cursors behind them read a gap.
+	void setJournalCapacity( size_t events );
+
+	/// @return The sequence the next event recorded in the journal will get, a cursor reading the
+	/// events from now on
+	uint64_t journalHead();
+
+	/// @return The sequence of the oldest event kept in the journal, a cursor reading all of them
+	uint64_t journalTail();
+
+	/// Reads into the buffer the events recorded in the journal from the cursor, the sequence of
+	/// the next event to read, and moves it past them. Each consumer keeps its own cursor and
+	/// reads at its own pace, the journal doesn't wait for any: once the oldest events are
+	/// overwritten, a cursor left behind reads an Actions::Overflow of watch 0 instead, with the
+	/// sequence of the first event lost, and resumes from the oldest event kept. Its state of
+	/// the watched trees should then be rescanned. Can be called from any thread.
+	/// @return The number of events read, less than max once the cursor is at the head
+	size_t readJournal( uint64_t& cursor, JournalEvent* events, size_t max );
+
+	/// Waits for an event to be recorded in the journal at the cursor or past it
+	/// @return True if there's one to read, false once the time is up
+	bool waitJournal( uint64_t cursor, unsigned int milliseconds );
+
+	/// Publishes the journal in shared memory under the name, for the other processes of the
+	/// user to read with a JournalReader: the events recorded from now on are also appended to
+	/// a ring in the segment, with the same sequences. Publishing again replaces the segment.
+	/// @param ringSize The bytes of the ring, rounded up to a power of two of 1 MB at least. An
+	/// event takes 40 bytes and its names, aligned to 8.
+	/// @param pathsSize The bytes of the path table, where the directories of the events are
+	/// interned. Once full, the new directories are stored with each event.
+	/// @return False if the segment couldn't be created
+	bool publishJournal( const std::string& name, size_t ringSize = 16 << 20,
+						 size_t pathsSize = 4 << 20 );
+
 	/// @return Returns a list of the directories that are being watched
 	std::vector<std::string> directories();
 
+	/// @return The counters of the dispatch queue of the watch, all 0 if it has none
+	DispatchStats getDispatchStats( WatchID watchid );
+
+	/// @return The counters of the watch, all 0 if there's no such watch
+	WatchStats getStats( WatchID watchid );
+
+	/// @return The counters of all the watches added, summed
+	WatchStats getStats();
+
+	/// @return The latencies of the events of the watch, from their capture by the backend to
+	/// their delivery to the listener ( all 0 unless built with EFSW_TRACING )
+	LatencyStats getLatency( WatchID watchid );
+
+	/// @return The times the listener of the watch took to handle its batches ( all 0 unless
+	/// built with EFSW_TRACING )
+	LatencyStats getListenerTime( WatchID watchid );
+
+	/// Sets the hooks receiving the timings of the backend and of the deliveries, NULL to stop.
+	/// Only called when efsw is built with EFSW_TRACING. Set them before adding the watches, the
+	/// hooks must outlive the FileWatcher.
+	void setTraceHooks( TraceHooks* hooks );
+
+	/// @return The hooks set with setTraceHooks
+	TraceHooks* traceHooks() const;
+
+	/// Spreads the watches over that many inotify instances, each with its own kernel queue and
+	/// event loop thread, for the trees too busy for a single one. A watch stays in one instance,
+	/// so its events keep their order; a move between two instances is reported as a deletion and
+	/// an addition. Call it before adding any watch.
+	/// @return False if the backend isn't inotify, the FileWatcher shares the backend of a
+	/// Reactor, or watches were added already
+	bool setShards( unsigned int shards );
+
+	/// @return The ID of the last event delivered by the backend, to start the watches from it
+	/// with Options::FSEventsSinceId. 0 if the backend has no event IDs ( all but FSEvents ).
+	uint64_t getEventId();
+
+	/// @return The ID to resume the watch from: the USN of its volume with the USN journal
+	/// backend ( see Options::UsnSinceId ), otherwise the same as getEventId().
+	uint64_t getEventId( WatchID watchid );
+
 	/** Allow recursive watchers to follow symbolic links to other directories
 	 * followSymlinks is disabled by default
+	 * A watcher attached to a Reactor ignores it and follows the setting of the reactor, see
+	 * Reactor::followSymlinks
 	 */
 	void followSymlinks( bool follow );
 
@@ -206,6 +769,8 @@ class EFSW_API FileWatcher {
 	 * great levels of recursion. Enabling this could lead in infinite recursion, and crash the
 	 * watcher ( it will try not to avoid this ). Buy enabling out of scope links, it will allow
 	 * this behavior. allowOutOfScopeLinks are disabled by default.
+	 * A watcher attached to a Reactor ignores it and follows the setting of the reactor, see
+	 * Reactor::allowOutOfScopeLinks
 	 */
 	void allowOutOfScopeLinks( bool allow );
 
@@ -215,11 +780,168 @@ class EFSW_API FileWatcher {
   private:
 	/// The implementation
 	FileWatcherImpl* mImpl;
+	/// Shares the trees watched with the watches added on them later
+	WatchGrouper* mGrouper;
+	/// Merges the events of the watches with Options::CoalesceWindow
+	EventCoalescer* mCoalescer;
+	/// Calls the listeners of the watches with Options::DispatchQueueSize
+	EventDispatcher* mDispatcher;
+	/// Saves the state of the watches with Options::SnapshotFile
+	SnapshotStore* mSnapshots;
+	/// Keeps the events of the watches without a listener for readEvents
+	EventQueue* mQueue;
+	/// Records the events of the watches with Options::Journal
+	EventJournal* mJournal;
+	/// The stages placed between the backend and the listener of each watch
+	WatchStages* mStages;
+	TraceHooks* mTraceHooks;
 	bool mFollowSymlinks;
 	bool mOutOfScopeLinks;
+	/// The reactor whose backend and groups the watcher shares, NULL if it owns them
+	Reactor* mReactor;
+
+	/// Adds the watch sharing the tree it's in if already watched, see addWatch
+	WatchID addSharedWatch( const std::string& directory, FileWatchListener* watcher,
+							bool recursive, const std::vector<WatcherOption>& options, bool async );
+
+	/// Places the stages set by the options in front of the listener, then adds the watch to
+	/// the backend with the listener of the first stage
+	WatchID addStagedWatch( const std::string& directory, FileWatchListener* watcher,
+							bool recursive, const std::vector<WatcherOption>& options,
+							const std::function<WatchID( FileWatchListener* listener )>& add );
+};
+
+/// A backend shared by many FileWatcher: one kernel notification object ( one inotify or
+/// fanotify descriptor, one kqueue, one completion port ) and one thread for all of them, instead
+/// of one for each. Every FileWatcher attached keeps its own listeners and watch ids, and only
+/// sees and removes its own watches; the ones of the same tree share it as addWatch does.
+/// The FileWatcher attached must be destroyed before the reactor.
+/// @class Reactor
+class EFSW_API Reactor {
+  public:
+	/// Creates the default platform backend
+	Reactor();
+
+	/// Constructor that lets you force the use of the Generic File Watcher
+	explicit Reactor( bool useGenericFileWatcher );
+
+	~Reactor();
+
+	Reactor( const Reactor& ) = delete;
+
+	Reactor& operator=( const Reactor& ) = delete;
+
+	/// Sets the hooks receiving the spans of the shared backend, see FileWatcher::setTraceHooks
+	void setTraceHooks( TraceHooks* hooks );
+
+	/// Follows the symbolic links in the watches of every FileWatcher attached, see
+	/// FileWatcher::followSymlinks. Set it before adding the watches, the attached ones can't
+	/// change it.
+	void followSymlinks( bool follow );
+
+	/// Allows the symbolic links out of scope in the watches of every FileWatcher attached, see
+	/// FileWatcher::allowOutOfScopeLinks
+	void allowOutOfScopeLinks( bool allow );
+
+  private:
+	friend class FileWatcher;
+
+	/// Owns the backend and the groups shared, without watches of its own
+	FileWatcher* mHost;
+	/// Guards starting the thread of the backend
+	Mutex mMutex;
+
+	/// Starts the thread of the backend, once
+	void watch();
+};
+
+/// An event of a batch delivered to FileWatchListener::handleFileActions. The views point to the
+/// buffers of the backend and are only valid during the call, they aren't null terminated.
+struct Event {
+	WatchID watchid;
+	std::string_view dir;
+	std::string_view filename;
+	Action action;
+	std::string_view oldFilename;
+	/// dir and filename joined, only set for the watches with Options::FullPath
+	std::string_view path;
+	/// dir and oldFilename joined for the moves, with Options::FullPath
+	std::string_view oldPath;
+	/// Offset of the name of the file in path ( after the last slash )
+	size_t nameOffset = 0;
+	/// When the backend read the event, in nanoseconds of std::chrono::steady_clock. Only set
+	/// when efsw is built with EFSW_TRACING.
+	uint64_t captured = 0;
+};
+
+/// An event read with a JournalReader. The views point into the shared memory, see
+/// JournalReader::read.
+struct JournalView : Event {
+	/// The sequence number of the event, one more than the previous one
+	uint64_t sequence = 0;
+};
+
+/// Reads the journal a FileWatcher of another process publishes with
+/// FileWatcher::publishJournal, without copying the events nor locking anything the publisher
+/// or the other readers wait for. Each reader keeps its own cursor. A reader that falls behind
+/// the ring reads an Actions::Overflow of watch 0 where the events were lost, its state of the
+/// watched trees should then be rescanned. A reader is used from one thread at a time.
+class EFSW_API JournalReader {
+  public:
+	JournalReader();
+
+	~JournalReader();
+
+	JournalReader( const JournalReader& ) = delete;
+
+	JournalReader& operator=( const JournalReader& ) = delete;
+
+	/// Maps the journal published under the name, the cursor at its head so the events
+	/// published from now on are read
+	/// @return False if no journal is published under that name
+	bool open( const std::string& name );
+
+	void close();
+
+	/// Moves the cursor to the oldest event kept in the ring
+	void rewind();
+
+	/// @return The sequence of the next event to read
+	uint64_t sequence() const;
+
+	/// Reads up to max events from the cursor and moves it past them. The views of the
+	/// directories stay valid until the reader is closed, the ones of the names only until the
+	/// publisher overwrites the events: intact() tells whether it didn't yet, copy the names to
+	/// keep them longer.
+	/// @return The number of events read, less than max once the cursor is at the head
+	size_t read( JournalView* events, size_t max );
+
+	/// @return True if the events last read are still in the ring, their views valid
+	bool intact() const;
+
+	/// Waits for an event to be published past the cursor, with a futex on Linux
+	/// @return True if there's one to read, false once the time is up
+	bool wait( unsigned int milliseconds );
+
+	/// @return True once the publisher is gone, no more events will be published
+	bool closed() const;
+
+  private:
+	SharedMemory* mMemory;
+	const char* mRing;
+	const char* mPaths;
+	uint64_t mRingSize;
+	uint64_t mPathsSize;
+	/// The position of the cursor in the ring and the sequence of the event there
+	uint64_t mPosition;
+	uint64_t mSequence;
+	/// The position of the first event last read
+	uint64_t mFirst;
 };
 
 /// Basic interface for listening for file events.
+/// A listener overrides either handleFileAction, or handleFileEvent to receive the events
+/// without any string being copied for it, or handleFileActions to receive them in batches.
 /// @class FileWatchListener
 class FileWatchListener {
   public:
@@ -231,9 +953,218 @@ class FileWatchListener {
 	/// @param filename The filename that was accessed (not full path)
 	/// @param action Action that was performed
 	/// @param oldFilename The name of the file or directory moved
-	virtual void handleFileAction( WatchID watchid, const std::string& dir,
-								   const std::string& filename, Action action,
-								   std::string oldFilename = "" ) = 0;
+	virtual void handleFileAction( WatchID /*watchid*/, const std::string& /*dir*/,
+								   const std::string& /*filename*/, Action /*action*/,
+								   std::string /*oldFilename*/ = "" ) {}
+
+	/// Handles the file action, every event is delivered through it. The views point to the
+	/// buffers of the backend and are only valid during the call, they aren't null terminated.
+	/// The default implementation copies them to call handleFileAction.
+	virtual void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+								  Action action, std::string_view oldFilename = {} ) {
+		handleFileAction( watchid, std::string( dir ), std::string( filename ), action,
+						  std::string( oldFilename ) );
+	}
+
+	/// Handles the events read at once by the backend ( an inotify or fanotify read, a
+	/// ReadDirectoryChangesW buffer, an FSEvents callback ), in the order they happened, so the
+	/// listener can amortize its own overhead. The default implementation delivers them one by
+	/// one to handleFileEvent.
+	virtual void handleFileActions( const Event* events, size_t count ) {
+		for ( size_t i = 0; i < count; i++ ) {
+			handleFileEvent( events[i].watchid, events[i].dir, events[i].filename,
+							 events[i].action, events[i].oldFilename );
+		}
+	}
+
+	/// Handles a directory of a recursive watch that couldn't be watched while crawling it,
+	/// which addWatch can't report once the watch is added: an unreadable directory, a kernel
+	/// watch refused. The directory and what's under it are missing from the watch.
+	/// Called from the thread crawling, addWatch's or the backend's. The symlinks skipped as
+	/// repeated or out of scope aren't reported.
+	/// @param path The directory, only valid during the call
+	virtual void handleWatchError( WatchID /*watchid*/, Error /*error*/,
+								   std::string_view /*path*/ ) {}
+
+	/// Handles the end of the crawl of a watch added with FileWatcher::addWatchAsync: its whole
+	/// tree is watched from now on. Called from the thread crawling, or from addWatchAsync itself
+	/// when the watch is ready right away.
+	/// @param directories The directories watched, 0 if the backend watches the tree as a whole
+	/// @param failures The directories that couldn't be watched, each reported to
+	/// handleWatchError before
+	virtual void handleWatchReady( WatchID /*watchid*/, size_t /*directories*/,
+								   size_t /*failures*/ ) {}
+};
+
+/// Listener calling a callable stored by its type with every event as a `const Event&`, so the
+/// call is resolved statically and can be inlined. Only the batch of events costs a virtual
+/// call, nothing is copied nor type erased. The callable runs in the thread of the backend.
+/// @class Listener
+template <typename F> class Listener : public FileWatchListener {
+  public:
+	explicit Listener( F callback ) : mCallback( std::move( callback ) ) {}
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override {
+		Event event;
+		event.watchid = watchid;
+		event.dir = dir;
+		event.filename = filename;
+		event.action = action;
+		event.oldFilename = oldFilename;
+
+		mCallback( event );
+	}
+
+	void handleFileActions( const Event* events, size_t count ) override {
+		for ( size_t i = 0; i < count; i++ ) {
+			mCallback( events[i] );
+		}
+	}
+
+	/// @return The callable, e.g. to read the state it accumulated
+	F& callback() { return mCallback; }
+
+  protected:
+	F mCallback;
+};
+
+/// Listener referencing a callable owned by the caller, called with every event as a
+/// `const Event&` through a plain function pointer. The callable must outlive the watch.
+/// @class ListenerRef
+class ListenerRef : public FileWatchListener {
+  public:
+	template <typename F, typename = typename std::enable_if<
+							  !std::is_same<typename std::decay<F>::type, ListenerRef>::value>::type>
+	ListenerRef( F& callback ) :
+		mObject( &callback ), mCall( []( void* object, const Event& event ) {
+			( *static_cast<F*>( object ) )( event );
+		} ) {}
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override {
+		Event event;
+		event.watchid = watchid;
+		event.dir = dir;
+		event.filename = filename;
+		event.action = action;
+		event.oldFilename = oldFilename;
+
+		mCall( mObject, event );
+	}
+
+	void handleFileActions( const Event* events, size_t count ) override {
+		for ( size_t i = 0; i < count; i++ ) {
+			mCall( mObject, events[i] );
+		}
+	}
+
+  protected:
+	void* mObject;
+	void ( *mCall )( void* object, const Event& event );
+};
+
+/// The compact binary encoding of the batches of events, to relay them to other processes or
+/// hosts. A frame holds a batch and is decoded on its own: the length of the frame, the version
+/// of the format, then the events in varints, each one only carrying what differs from the
+/// previous one ( its sequence when not the next one, its watch id when it changes, the part of
+/// its strings they don't share with the previous event's ). A frame fits the payload of a
+/// record of a journal, or a message of a socket.
+/// @class EventCodec
+class EFSW_API EventCodec {
+  public:
+	/// The version of the format, written in every frame
+	static const uint8_t VERSION = 1;
+
+	/// Returned by decode for the data that isn't a frame of this version
+	static const size_t INVALID = (size_t)-1;
+
+	/// The longest frame decoded, in bytes. A longer length is INVALID: the data is out of sync, or
+	/// not a stream of frames, and waiting for all of it would never end.
+	static const size_t MAX_FRAME = 64 * 1024 * 1024;
+
+	/// Appends the frame of the batch to the buffer, the events numbered in sequence from the
+	/// one given
+	static void encode( const Event* events, size_t count, uint64_t sequence,
+						std::string& buffer );
+
+	/// Same as encode, for the events read with FileWatcher::readJournal and their sequences
+	static void encode( const JournalEvent* events, size_t count, std::string& buffer );
+
+	/// Same as encode, for the events read with a JournalReader and their sequences
+	static void encode( const JournalView* events, size_t count, std::string& buffer );
+
+	/// Decodes the frame at the start of the data into the events, resized to its batch,
+	/// reusing the capacity of their strings
+	/// @return The bytes of the frame, 0 if the data doesn't hold it whole yet, INVALID if it
+	/// isn't a frame of this version or is longer than MAX_FRAME
+	static size_t decode( const char* data, size_t size, std::vector<JournalEvent>& events );
+};
+
+/// Listener writing every batch of its watches as a frame of EventCodec to a descriptor: a
+/// file, a pipe or a socket, the socket of a relay to other hosts. The events are numbered in
+/// sequence from 1, in the order the sink was given them by all of its watches. The frames are
+/// queued for a thread of the sink writing them, so a slow reader doesn't hold the watch: the
+/// frames that don't fit in the queue are dropped, their events keep their sequences and the
+/// gap before the next frame written tells the reader how many were lost. A write that fails
+/// stops the sink, the stream would be cut in the middle of a frame. A reader gone fails the
+/// write with EPIPE, without raising SIGPIPE.
+/// @class EventStreamSink
+class EFSW_API EventStreamSink : public FileWatchListener {
+  public:
+	/// The bytes queued by default
+	static const size_t DEFAULT_CAPACITY = 4 * 1024 * 1024;
+
+	/// @param fd The descriptor written to, not closed by the sink
+	/// @param listener Also receives the batches once queued, NULL if none
+	/// @param capacity The bytes of the frames queued at most, a frame is queued whatever its
+	/// size when the queue is empty, up to EventCodec::MAX_FRAME
+	explicit EventStreamSink( int fd, FileWatchListener* listener = NULL,
+							  size_t capacity = DEFAULT_CAPACITY );
+
+	/// Writes the frames queued, then stops the thread of the sink
+	~EventStreamSink();
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	void handleWatchReady( WatchID watchid, size_t directories, size_t failures ) override;
+
+	/// @return The sequence the next event written gets
+	uint64_t sequence();
+
+	/// @return The errno of the write that failed and stopped the sink, 0 if none did
+	int error();
+
+	/// @return The events dropped with their frames, as the queue was full
+	uint64_t dropped();
+
+  protected:
+	int mFD;
+	/// The descriptor is a socket, written with send. Told once, as the sink is created.
+	bool mSocket;
+	FileWatchListener* mListener;
+	size_t mCapacity;
+	/// Guards the sequence, the queue and the counters between the watches and the thread
+	Mutex mMutex;
+	std::condition_variable mWake;
+	bool mRunning;
+	uint64_t mSequence;
+	uint64_t mDropped;
+	int mError;
+	/// The frames queued, and the ones being written by the thread
+	std::string mQueue;
+	std::string mWriting;
+	std::thread mWriter;
+
+	void run();
+
+	/// @return The errno of the write that failed, 0 if the frames were written whole
+	int write( const std::string& data );
 };
 
 class GenericFileWatchListener : public FileWatchListener
@@ -392,7 +1323,8 @@ private:
 	{
 	public:
 		DirectoryWatch(FileWatcher& watcher, const std::string directory)
-		: mListener(ScopedWatchListener{
+		: mCallbacks(std::make_shared<const Callbacks>())
+		, mListener(ScopedWatchListener{
 			watcher,
 			[this](GenericFileWatchListener::Event event){
 				handle(std::move(event));
@@ -404,49 +1336,89 @@ private:
 		size_t addDirectoryCallback(GenericFileWatchListener::Callback callback)
 		{
 			Lock lock{mMutex};
-			mDirectoryCallbacks[++mLastId] = std::move(callback);
+			auto callbacks = std::make_shared<Callbacks>(*mCallbacks);
+			callbacks->directory.push_back({++mLastId, makeCallback(std::move(callback))});
+			publish(std::move(callbacks));
 			return mLastId;
 		}
 		size_t addFileCallback(std::string filename, GenericFileWatchListener::Callback callback)
 		{
 			Lock lock{mMutex};
-			mFileCallbacks[++mLastId] = {
+			auto callbacks = std::make_shared<Callbacks>(*mCallbacks);
+			callbacks->files.insert({
 				std::move(filename),
-				std::move(callback),
-			};
+				{++mLastId, makeCallback(std::move(callback))},
+			});
+			publish(std::move(callbacks));
 			return mLastId;
 		}
 		void removeCallback(size_t id)
 		{
-			Lock lock{mMutex};
-			mFileCallbacks.erase(id);
-			mDirectoryCallbacks.erase(id);
+			{
+				Lock lock{mMutex};
+				auto callbacks = std::make_shared<Callbacks>(*mCallbacks);
+				for (auto i = callbacks->directory.begin(); i != callbacks->directory.end(); ++i)
+					if (i->id == id)
+					{
+						callbacks->directory.erase(i);
+						break;
+					}
+				for (auto i = callbacks->files.begin(); i != callbacks->files.end(); ++i)
+					if (i->second.id == id)
+					{
+						callbacks->files.erase(i);
+						break;
+					}
+				publish(std::move(callbacks));
+			}
+			// Once a dispatch still using the previous callbacks ends, the callback removed is
+			// never called again
+			Lock dispatchLock{mDispatchMutex};
 		}
 		bool hasCallbacks()
 		{
 			Lock lock{mMutex};
-			return !mDirectoryCallbacks.empty() || !mFileCallbacks.empty();
+			return !mCallbacks->directory.empty() || !mCallbacks->files.empty();
 		}
 	private:
-		struct FileCallback
+		struct Entry
 		{
-			std::string filename;
-			GenericFileWatchListener::Callback callback;
+			size_t id;
+			std::shared_ptr<const GenericFileWatchListener::Callback> callback;
 		};
+		// Replaced as a whole when a callback is added or removed, so the events are dispatched
+		// without holding mMutex. The callbacks are shared between the copies.
+		struct Callbacks
+		{
+			std::vector<Entry> directory;
+			std::unordered_multimap<std::string, Entry> files;
+		};
+		static std::shared_ptr<const GenericFileWatchListener::Callback> makeCallback(
+			GenericFileWatchListener::Callback callback)
+		{
+			return std::make_shared<const GenericFileWatchListener::Callback>(std::move(callback));
+		}
+		void publish(std::shared_ptr<const Callbacks> callbacks)
+		{
+			std::atomic_store(&mCallbacks, std::move(callbacks));
+		}
 		void handle(GenericFileWatchListener::Event event)
 		{
-			Lock lock{mMutex};
-			for (auto& callback : mDirectoryCallbacks)
-				callback.second(event);
-			for (auto& callback : mFileCallbacks)
-				if (callback.second.filename == event.filename)
-					callback.second.callback(event);
+			Lock dispatchLock{mDispatchMutex};
+			auto callbacks = std::atomic_load(&mCallbacks);
+			for (auto& entry : callbacks->directory)
+				(*entry.callback)(event);
+			auto range = callbacks->files.equal_range(event.filename);
+			for (auto i = range.first; i != range.second; ++i)
+				(*i->second.callback)(event);
 		}
+		// Guards the changes of the callbacks
 		Mutex mMutex;
-		ScopedWatchListener mListener;
+		// Held while dispatching, only waited for by removeCallback
+		Mutex mDispatchMutex;
+		std::shared_ptr<const Callbacks> mCallbacks;
 		size_t mLastId = 0;
-		std::map<size_t,GenericFileWatchListener::Callback> mDirectoryCallbacks;
-		std::map<size_t,FileCallback> mFileCallbacks;
+		ScopedWatchListener mListener;
 	};
 
 	DirectoryWatch& getDirectoryWatch(const std::string& directory)
@@ -489,8 +1461,21 @@ inline ConvenientFileWatcher::Guard watch(const std::string& path, GenericFileWa
 class WatcherOption {
   public:
 	WatcherOption(Option option, int value) : mOption(option), mValue(value) {};
+	WatcherOption(Option option, std::string pattern) :
+		mOption(option), mValue(0), mPattern(std::move(pattern)) {};
 	Option mOption;
 	int mValue;
+	/// The value of the options taking a string, e.g. Options::IncludePattern
+	std::string mPattern;
+};
+
+/// A watch to add with FileWatcher::addWatches
+struct WatchSpec {
+	std::string directory;
+	/// The listener to receive events, NULL to read them with readEvents
+	FileWatchListener* listener = NULL;
+	bool recursive = false;
+	std::vector<WatcherOption> options;
 };
 
 } // namespace efsw
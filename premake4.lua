@@ -1,4 +1,6 @@
 newoption { trigger = "verbose", description = "Build efsw with verbose mode." }
+newoption { trigger = "fanotify", description = "Use fanotify on Linux when the process has the capabilities." }
+newoption { trigger = "tracing", description = "Time the events and call the trace hooks ( see FileWatcher::setTraceHooks )." }
 newoption { trigger = "strip-symbols", description = "Strip debugging symbols in other file ( only for relwithdbginfo configuration )." }
 newoption { trigger = "thread-sanitizer", description ="Compile with ThreadSanitizer." }
 
@@ -98,17 +100,21 @@ function conf_links()
 	if os.is("macosx") then
 		links { "CoreFoundation.framework", "CoreServices.framework" }
 	end
+
+	if os.is("linux") then
+		links { "rt" }
+	end
 end
 
 function conf_excludes()
 	if os.is("windows") then
-		excludes { "src/efsw/WatcherKqueue.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/WatcherInotify.cpp", "src/efsw/FileWatcherKqueue.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
+		excludes { "src/efsw/WatcherKqueue.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/WatcherInotify.cpp", "src/efsw/WatcherFanotify.cpp", "src/efsw/FileWatcherKqueue.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherInotifyShards.cpp", "src/efsw/FileWatcherFanotify.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
 	elseif os.is("linux") then
-		excludes { "src/efsw/WatcherKqueue.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/FileWatcherKqueue.cpp", "src/efsw/FileWatcherWin32.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
+		excludes { "src/efsw/WatcherKqueue.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/WatcherUSN.cpp", "src/efsw/FileWatcherKqueue.cpp", "src/efsw/FileWatcherWin32.cpp", "src/efsw/FileWatcherUSN.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
 	elseif os.is("macosx") then
-		excludes { "src/efsw/WatcherInotify.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherWin32.cpp" }
+		excludes { "src/efsw/WatcherInotify.cpp", "src/efsw/WatcherFanotify.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/WatcherUSN.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherInotifyShards.cpp", "src/efsw/FileWatcherFanotify.cpp", "src/efsw/FileWatcherWin32.cpp", "src/efsw/FileWatcherUSN.cpp" }
 	elseif os.is("freebsd") then
-		excludes { "src/efsw/WatcherInotify.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherWin32.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
+		excludes { "src/efsw/WatcherInotify.cpp", "src/efsw/WatcherFanotify.cpp", "src/efsw/WatcherWin32.cpp", "src/efsw/WatcherUSN.cpp", "src/efsw/WatcherFSEvents.cpp", "src/efsw/FileWatcherInotify.cpp", "src/efsw/FileWatcherInotifyShards.cpp", "src/efsw/FileWatcherFanotify.cpp", "src/efsw/FileWatcherWin32.cpp", "src/efsw/FileWatcherUSN.cpp", "src/efsw/FileWatcherFSEvents.cpp" }
 	end
 
 	if os.is("linux") and not inotify_header_exists() then
@@ -132,6 +138,15 @@ solution "efsw"
 		defines { "EFSW_VERBOSE" }
 	end
 
+	-- Times the events for the latency histograms and the trace hooks
+	if _OPTIONS["tracing"] then
+		defines { "EFSW_TRACING" }
+	end
+
+	if _OPTIONS["fanotify"] then
+		defines { "EFSW_USE_FANOTIFY" }
+	end
+
 	if not is_vs() then
 		buildoptions { "-std=c++11" }
 	end
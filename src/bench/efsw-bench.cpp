@@ -0,0 +1,421 @@
+#include <efsw/efsw.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+/// Runs repeatable scenarios against the native backend and the generic one, printing the
+/// results as JSON: the event throughput of a file creation storm, the latency from a write to
+/// its callback, the time taken by a recursive addWatch and removeWatch of a synthetic tree, and
+/// the memory used per directory watched. The simulated backend measures the overhead of the
+/// library alone: the throughput of changes made up in memory, in a tree of the same shape.
+/// Usage: efsw-bench [--backend=all|native|generic|simulated] [--dir=PATH] [--files=N]
+///                   [--samples=N] [--depth=N] [--fanout=N] [--tree-files=N] [--timeout=MS]
+///                   [--poll=MS] [--changes=N] [--rate=N]
+
+namespace fs = std::filesystem;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Settings {
+	std::string Backend = "all";
+	fs::path Dir = fs::temp_directory_path() / "efsw-bench";
+	/// Files created by the storm
+	int Files = 10000;
+	/// Writes measured for the latency
+	int Samples = 200;
+	/// Shape of the tree crawled: levels of directories, directories per directory and files per
+	/// directory
+	int Depth = 4;
+	int Fanout = 6;
+	int TreeFiles = 10;
+	/// Milliseconds waited for the events of a scenario
+	int Timeout = 10000;
+	/// Scan interval of the generic backend, in milliseconds
+	int Poll = 50;
+	/// Changes made by the simulated backend, and per second ( 0 for as fast as it can )
+	int Changes = 1000000;
+	int Rate = 0;
+};
+
+/// Counts the events of the scenarios from the backend threads
+class BenchListener : public efsw::FileWatchListener {
+  public:
+	std::atomic<long> Storm{ 0 };
+	std::atomic<long> Events{ 0 };
+	std::vector<std::atomic<long long>> Arrivals;
+	Clock::time_point Origin = Clock::now();
+
+	explicit BenchListener( int samples ) : Arrivals( samples ) {
+		for ( size_t i = 0; i < Arrivals.size(); i++ ) {
+			Arrivals[i] = -1;
+		}
+	}
+
+	void handleFileActions( const efsw::Event* events, size_t count ) override {
+		Events += (long)count;
+
+		efsw::FileWatchListener::handleFileActions( events, count );
+	}
+
+	void handleFileEvent( efsw::WatchID, std::string_view, std::string_view filename,
+						  efsw::Action action, std::string_view ) override {
+		static const std::string_view storm( "storm-" );
+		static const std::string_view latency( "latency-" );
+
+		if ( efsw::Actions::Add == action && 0 == filename.compare( 0, storm.size(), storm ) ) {
+			Storm++;
+		} else if ( 0 == filename.compare( 0, latency.size(), latency ) ) {
+			size_t index = std::strtoul( std::string( filename.substr( latency.size() ) ).c_str(),
+										 NULL, 10 );
+			long long expected = -1;
+
+			/// The first event of the file is its arrival, the following ones are ignored
+			if ( index < Arrivals.size() ) {
+				Arrivals[index].compare_exchange_strong( expected, nanoseconds() );
+			}
+		}
+	}
+
+	long long nanoseconds() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - Origin )
+			.count();
+	}
+};
+
+/// @return The resident memory of the process in bytes, 0 where unknown
+static size_t residentMemory() {
+#if defined( _WIN32 )
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return counters.WorkingSetSize;
+
+	return 0;
+#else
+	std::ifstream statm( "/proc/self/statm" );
+	size_t size = 0;
+	size_t resident = 0;
+
+	if ( !( statm >> size >> resident ) )
+		return 0;
+
+	return resident * static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+#endif
+}
+
+static double milliseconds( Clock::duration duration ) {
+	return std::chrono::duration<double, std::milli>( duration ).count();
+}
+
+static void touch( const fs::path& path ) {
+	std::ofstream( path ).put( 'x' );
+}
+
+/// Waits until the condition holds or the timeout expires
+/// @return True if the condition holds
+template <typename Condition> static bool waitFor( Condition condition, int timeout ) {
+	Clock::time_point end = Clock::now() + std::chrono::milliseconds( timeout );
+
+	while ( !condition() ) {
+		if ( Clock::now() >= end )
+			return false;
+
+		std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+	}
+
+	return true;
+}
+
+/// @return The percentile of the sorted values
+static double percentile( const std::vector<double>& sorted, double rank ) {
+	if ( sorted.empty() )
+		return 0;
+
+	size_t index = static_cast<size_t>( rank * ( sorted.size() - 1 ) + 0.5 );
+
+	return sorted[std::min( index, sorted.size() - 1 )];
+}
+
+/// Creates the tree crawled
+/// @return The number of directories in it, the root included
+static long makeTree( const fs::path& dir, int depth, const Settings& settings ) {
+	long dirs = 1;
+
+	fs::create_directories( dir );
+
+	for ( int i = 0; i < settings.TreeFiles; i++ ) {
+		touch( dir / ( "file-" + std::to_string( i ) ) );
+	}
+
+	if ( depth > 0 ) {
+		for ( int i = 0; i < settings.Fanout; i++ ) {
+			dirs += makeTree( dir / ( "dir-" + std::to_string( i ) ), depth - 1, settings );
+		}
+	}
+
+	return dirs;
+}
+
+static efsw::FileWatcher* createWatcher( const std::string& backend ) {
+	return "generic" == backend ? new efsw::FileWatcher( true ) : new efsw::FileWatcher( false );
+}
+
+static std::vector<efsw::WatcherOption> watchOptions( const Settings& settings ) {
+	return { efsw::WatcherOption( efsw::Options::PollMinInterval, settings.Poll ),
+			 efsw::WatcherOption( efsw::Options::PollMaxInterval, settings.Poll ) };
+}
+
+static void throughput( const std::string& backend, const Settings& settings,
+						std::ostream& out ) {
+	fs::path dir( settings.Dir / ( backend + "-storm" ) );
+	fs::create_directories( dir );
+
+	BenchListener listener( 0 );
+	efsw::FileWatcher* watcher = createWatcher( backend );
+
+	watcher->addWatch( dir.string(), &listener, false, watchOptions( settings ) );
+	watcher->watch();
+
+	Clock::time_point start = Clock::now();
+
+	for ( int i = 0; i < settings.Files; i++ ) {
+		touch( dir / ( "storm-" + std::to_string( i ) ) );
+	}
+
+	Clock::time_point written = Clock::now();
+
+	waitFor( [&] { return listener.Storm >= settings.Files; }, settings.Timeout );
+
+	Clock::time_point end = Clock::now();
+	long received = listener.Storm;
+
+	delete watcher;
+
+	out << "\"throughput\": { \"files\": " << settings.Files << ", \"received\": " << received
+		<< ", \"write_ms\": " << milliseconds( written - start )
+		<< ", \"total_ms\": " << milliseconds( end - start ) << ", \"events_per_second\": "
+		<< ( end > start ? received / std::chrono::duration<double>( end - start ).count() : 0 )
+		<< " }";
+}
+
+static void latency( const std::string& backend, const Settings& settings, std::ostream& out ) {
+	fs::path dir( settings.Dir / ( backend + "-latency" ) );
+	fs::create_directories( dir );
+
+	BenchListener listener( settings.Samples );
+	efsw::FileWatcher* watcher = createWatcher( backend );
+
+	watcher->addWatch( dir.string(), &listener, false, watchOptions( settings ) );
+	watcher->watch();
+
+	std::vector<double> latencies;
+	int lost = 0;
+
+	for ( int i = 0; i < settings.Samples; i++ ) {
+		long long sent = listener.nanoseconds();
+
+		touch( dir / ( "latency-" + std::to_string( i ) ) );
+
+		if ( waitFor( [&] { return listener.Arrivals[i] >= 0; }, settings.Timeout ) ) {
+			latencies.push_back( ( listener.Arrivals[i] - sent ) / 1000.0 );
+		} else {
+			lost++;
+		}
+	}
+
+	delete watcher;
+
+	std::sort( latencies.begin(), latencies.end() );
+
+	out << "\"latency_us\": { \"samples\": " << settings.Samples << ", \"lost\": " << lost
+		<< ", \"p50\": " << percentile( latencies, 0.5 )
+		<< ", \"p90\": " << percentile( latencies, 0.9 )
+		<< ", \"p99\": " << percentile( latencies, 0.99 )
+		<< ", \"max\": " << ( latencies.empty() ? 0 : latencies.back() ) << " }";
+}
+
+static void crawl( const std::string& backend, const Settings& settings, std::ostream& out ) {
+	fs::path dir( settings.Dir / ( backend + "-tree" ) );
+	long dirs = makeTree( dir, settings.Depth, settings );
+
+	BenchListener listener( 0 );
+	efsw::FileWatcher* watcher = createWatcher( backend );
+
+	size_t before = residentMemory();
+	Clock::time_point start = Clock::now();
+
+	efsw::WatchID id = watcher->addWatch( dir.string(), &listener, true, watchOptions( settings ) );
+
+	Clock::time_point added = Clock::now();
+	size_t after = residentMemory();
+
+	watcher->removeWatch( id );
+
+	Clock::time_point removed = Clock::now();
+
+	delete watcher;
+
+	out << "\"crawl\": { \"depth\": " << settings.Depth << ", \"fanout\": " << settings.Fanout
+		<< ", \"files_per_dir\": " << settings.TreeFiles << ", \"dirs\": " << dirs
+		<< ", \"watch_id\": " << id << ", \"add_ms\": " << milliseconds( added - start )
+		<< ", \"remove_ms\": " << milliseconds( removed - added ) << ", \"rss_per_dir_bytes\": "
+		<< ( after > before ? (double)( after - before ) / dirs : 0 ) << " }";
+}
+
+static void simulated( const Settings& settings, std::ostream& out ) {
+	efsw::Simulation simulation;
+	simulation.changes = settings.Changes;
+	simulation.rate = settings.Rate;
+	simulation.depth = settings.Depth;
+	simulation.fanout = settings.Fanout;
+	simulation.files = settings.TreeFiles;
+
+	BenchListener listener( 0 );
+	efsw::FileWatcher* watcher = new efsw::FileWatcher( simulation );
+
+	/// Nothing is read from the directory
+	efsw::WatchID id =
+		watcher->addWatch( ( settings.Dir / "simulated" ).string(), &listener, true );
+
+	Clock::time_point start = Clock::now();
+
+	watcher->watch();
+
+	/// Without moves between directories each change is one event
+	waitFor( [&] { return listener.Events >= settings.Changes; },
+			 settings.Rate > 0 ? settings.Timeout + 1000 * settings.Changes / settings.Rate
+							   : settings.Timeout );
+
+	Clock::time_point end = Clock::now();
+	long received = listener.Events;
+	efsw::WatchStats stats = watcher->getStats( id );
+
+	delete watcher;
+
+	out << "\"throughput\": { \"changes\": " << settings.Changes << ", \"rate\": " << settings.Rate
+		<< ", \"received\": " << received << ", \"delivered\": " << stats.delivered
+		<< ", \"total_ms\": " << milliseconds( end - start ) << ", \"events_per_second\": "
+		<< ( end > start ? received / std::chrono::duration<double>( end - start ).count() : 0 )
+		<< " }";
+}
+
+static bool parse( int argc, char** argv, Settings& settings ) {
+	for ( int i = 1; i < argc; i++ ) {
+		std::string arg( argv[i] );
+		size_t eq = arg.find( '=' );
+		std::string key( arg.substr( 0, eq ) );
+		std::string value( std::string::npos != eq ? arg.substr( eq + 1 ) : "" );
+
+		if ( "--backend" == key ) {
+			settings.Backend = value;
+		} else if ( "--dir" == key ) {
+			settings.Dir = value;
+		} else if ( "--files" == key ) {
+			settings.Files = std::atoi( value.c_str() );
+		} else if ( "--samples" == key ) {
+			settings.Samples = std::atoi( value.c_str() );
+		} else if ( "--depth" == key ) {
+			settings.Depth = std::atoi( value.c_str() );
+		} else if ( "--fanout" == key ) {
+			settings.Fanout = std::atoi( value.c_str() );
+		} else if ( "--tree-files" == key ) {
+			settings.TreeFiles = std::atoi( value.c_str() );
+		} else if ( "--timeout" == key ) {
+			settings.Timeout = std::atoi( value.c_str() );
+		} else if ( "--poll" == key ) {
+			settings.Poll = std::atoi( value.c_str() );
+		} else if ( "--changes" == key ) {
+			settings.Changes = std::atoi( value.c_str() );
+		} else if ( "--rate" == key ) {
+			settings.Rate = std::atoi( value.c_str() );
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return false;
+		}
+	}
+
+	return "all" == settings.Backend || "native" == settings.Backend ||
+		   "generic" == settings.Backend || "simulated" == settings.Backend;
+}
+
+int main( int argc, char** argv ) {
+	Settings settings;
+
+	if ( !parse( argc, argv, settings ) ) {
+		std::cerr << "Usage: efsw-bench [--backend=all|native|generic|simulated] [--dir=PATH] "
+					 "[--files=N] [--samples=N] [--depth=N] [--fanout=N] [--tree-files=N] "
+					 "[--timeout=MS] [--poll=MS] [--changes=N] [--rate=N]"
+				  << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> backends;
+
+	if ( "all" == settings.Backend || "native" == settings.Backend )
+		backends.push_back( "native" );
+
+	if ( "all" == settings.Backend || "generic" == settings.Backend )
+		backends.push_back( "generic" );
+
+	if ( "all" == settings.Backend || "simulated" == settings.Backend )
+		backends.push_back( "simulated" );
+
+	std::error_code ec;
+	fs::remove_all( settings.Dir, ec );
+	fs::create_directories( settings.Dir );
+
+	std::ostringstream out;
+
+	out << "{ \"settings\": { \"files\": " << settings.Files
+		<< ", \"samples\": " << settings.Samples << ", \"depth\": " << settings.Depth
+		<< ", \"fanout\": " << settings.Fanout << ", \"tree_files\": " << settings.TreeFiles
+		<< ", \"timeout_ms\": " << settings.Timeout << ", \"poll_ms\": " << settings.Poll
+		<< ", \"changes\": " << settings.Changes << ", \"rate\": " << settings.Rate
+		<< " },\n  \"backends\": {";
+
+	for ( size_t i = 0; i < backends.size(); i++ ) {
+		out << ( i > 0 ? ",\n" : "\n" ) << "    \"" << backends[i] << "\": { ";
+
+		if ( "simulated" == backends[i] ) {
+			simulated( settings, out );
+			out << " }";
+
+			std::cerr << backends[i] << " done" << std::endl;
+			continue;
+		}
+
+		throughput( backends[i], settings, out );
+		out << ",\n      ";
+		latency( backends[i], settings, out );
+		out << ",\n      ";
+		crawl( backends[i], settings, out );
+		out << " }";
+
+		std::cerr << backends[i] << " done" << std::endl;
+	}
+
+	out << "\n  }\n}" << std::endl;
+
+	fs::remove_all( settings.Dir, ec );
+
+	std::cout << out.str();
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+#include <efsw/ContentFilter.hpp>
+#include <efsw/FileSystem.hpp>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+namespace efsw {
+
+/// The files are read by blocks of this size, a multiple of the stripes hashed
+static const size_t READ_BLOCK_SIZE = 64 * 1024;
+
+/// The 64 bits variant of xxHash, for the content of the files: it reads 32 bytes in 4 lanes at
+/// a time, so it hashes faster than the disk or the page cache deliver
+namespace {
+
+const Uint64 PRIME1 = 0x9E3779B185EBCA87ULL;
+const Uint64 PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const Uint64 PRIME3 = 0x165667B19E3779F9ULL;
+const Uint64 PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const Uint64 PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline Uint64 rotate( Uint64 value, int bits ) {
+	return ( value << bits ) | ( value >> ( 64 - bits ) );
+}
+
+inline Uint64 read64( const char* data ) {
+	Uint64 value;
+	memcpy( &value, data, sizeof( value ) );
+	return value;
+}
+
+inline Uint32 read32( const char* data ) {
+	Uint32 value;
+	memcpy( &value, data, sizeof( value ) );
+	return value;
+}
+
+inline Uint64 mix( Uint64 acc, Uint64 input ) {
+	return rotate( acc + input * PRIME2, 31 ) * PRIME1;
+}
+
+inline Uint64 merge( Uint64 acc, Uint64 value ) {
+	return ( acc ^ mix( 0, value ) ) * PRIME1 + PRIME4;
+}
+
+class Hasher {
+  public:
+	Hasher() : mTotal( 0 ) {
+		mLanes[0] = PRIME1 + PRIME2;
+		mLanes[1] = PRIME2;
+		mLanes[2] = 0;
+		mLanes[3] = 0 - PRIME1;
+	}
+
+	/// Hashes whole stripes of 32 bytes
+	void stripes( const char* data, size_t size ) {
+		for ( const char* end = data + size; data < end; data += 32 ) {
+			mLanes[0] = mix( mLanes[0], read64( data ) );
+			mLanes[1] = mix( mLanes[1], read64( data + 8 ) );
+			mLanes[2] = mix( mLanes[2], read64( data + 16 ) );
+			mLanes[3] = mix( mLanes[3], read64( data + 24 ) );
+		}
+
+		mTotal += size;
+	}
+
+	/// @return The hash, with the last bytes, less than a stripe
+	Uint64 finish( const char* data, size_t size ) {
+		size_t whole = size & ~(size_t)31;
+		stripes( data, whole );
+		data += whole;
+		size -= whole;
+
+		Uint64 hash;
+
+		if ( mTotal >= 32 ) {
+			hash = rotate( mLanes[0], 1 ) + rotate( mLanes[1], 7 ) + rotate( mLanes[2], 12 ) +
+				   rotate( mLanes[3], 18 );
+
+			for ( int i = 0; i < 4; i++ ) {
+				hash = merge( hash, mLanes[i] );
+			}
+		} else {
+			hash = PRIME5;
+		}
+
+		hash += mTotal + size;
+
+		for ( ; size >= 8; data += 8, size -= 8 ) {
+			hash = rotate( hash ^ mix( 0, read64( data ) ), 27 ) * PRIME1 + PRIME4;
+		}
+
+		if ( size >= 4 ) {
+			hash = rotate( hash ^ ( read32( data ) * PRIME1 ), 23 ) * PRIME2 + PRIME3;
+			data += 4;
+			size -= 4;
+		}
+
+		for ( ; size > 0; data++, size-- ) {
+			hash = rotate( hash ^ ( (unsigned char)*data * PRIME5 ), 11 ) * PRIME1;
+		}
+
+		hash ^= hash >> 33;
+		hash *= PRIME2;
+		hash ^= hash >> 29;
+		hash *= PRIME3;
+		hash ^= hash >> 32;
+
+		return hash;
+	}
+
+  protected:
+	Uint64 mLanes[4];
+	Uint64 mTotal;
+};
+
+} // namespace
+
+FingerprintingListener::FingerprintingListener( FileWatchListener* listener,
+												const std::string& directory, Int64 maxSize ) :
+	WatchStage( listener, directory ), mMaxSize( maxSize ), mSuppressed( 0 ) {}
+
+/// Sets the path to the directory joined with the name
+static void joinPath( std::string& path, std::string_view dir, std::string_view name ) {
+	path.assign( dir.data(), dir.size() );
+
+	if ( !path.empty() && '/' != path.back() && '\\' != path.back() ) {
+		path += FileSystem::getOSSlash();
+	}
+
+	path.append( name.data(), name.size() );
+}
+
+void FingerprintingListener::handleFileActions( const Event* events, size_t count ) {
+	/// The events are only copied once one is dropped
+	bool dropped = false;
+	Print print;
+
+	for ( size_t i = 0; i < count; i++ ) {
+		const Event& event = events[i];
+		bool keep = true;
+
+		switch ( event.action ) {
+			case Actions::Modified:
+				if ( !event.filename.empty() ) {
+					joinPath( mPath, event.dir, event.filename );
+					keep = changed();
+				}
+				break;
+			case Actions::Add:
+				joinPath( mPath, event.dir, event.filename );
+
+				if ( mInfo.getInfo( mPath ) && record( print ) ) {
+					mPrints[mPath] = print;
+				}
+				break;
+			case Actions::Delete:
+				joinPath( mPath, event.dir, event.filename );
+				forget();
+				break;
+			case Actions::Moved:
+				joinPath( mPath, event.dir, event.oldFilename );
+				forget();
+				joinPath( mPath, event.dir, event.filename );
+				forget();
+
+				if ( mInfo.getInfo( mPath ) && record( print ) ) {
+					mPrints[mPath] = print;
+				}
+				break;
+			case Actions::Overflow:
+				mPrints.clear();
+				break;
+			default:
+				break;
+		}
+
+		if ( !keep ) {
+			mSuppressed.fetch_add( 1, std::memory_order_relaxed );
+
+			if ( !dropped ) {
+				mEvents.assign( events, events + i );
+				dropped = true;
+			}
+		} else if ( dropped ) {
+			mEvents.push_back( event );
+		}
+	}
+
+	if ( !dropped ) {
+		mListener->handleFileActions( events, count );
+	} else if ( !mEvents.empty() ) {
+		mListener->handleFileActions( mEvents.data(), mEvents.size() );
+	}
+}
+
+Uint64 FingerprintingListener::suppressed() const {
+	return mSuppressed.load( std::memory_order_relaxed );
+}
+
+bool FingerprintingListener::record( Print& print ) {
+	if ( !mInfo.isRegularFile() || ( mMaxSize >= 0 && mInfo.Size > (Uint64)mMaxSize ) )
+		return false;
+
+	/// Taken before reading, a write of the same second leaves the modification time as it is
+	print.Hashed = (Uint64)std::time( NULL );
+	print.Size = mInfo.Size;
+	print.ModificationTime = mInfo.ModificationTime;
+
+	return hash( print.Hash );
+}
+
+bool FingerprintingListener::changed() {
+	PrintMap::iterator it = mPrints.find( mPath );
+	Print print;
+	bool exists = mInfo.getInfo( mPath );
+
+	/// Unchanged since hashed, its modification time having passed then: a write since would
+	/// have moved it
+	if ( exists && it != mPrints.end() && it->second.Size == mInfo.Size &&
+		 it->second.ModificationTime == mInfo.ModificationTime &&
+		 it->second.ModificationTime < it->second.Hashed )
+		return false;
+
+	if ( !exists || !record( print ) ) {
+		if ( it != mPrints.end() ) {
+			mPrints.erase( it );
+		}
+
+		return true;
+	}
+
+	if ( it == mPrints.end() ) {
+		mPrints.emplace( mPath, print );
+		return true;
+	}
+
+	Print& last = it->second;
+	bool same = last.Size == print.Size && last.Hash == print.Hash;
+
+	last = print;
+
+	return !same;
+}
+
+void FingerprintingListener::forget() {
+	PrintMap::iterator it = mPrints.find( mPath );
+
+	if ( it != mPrints.end() ) {
+		mPrints.erase( it );
+	}
+
+	/// The files below sort between "path/" and the slash's successor
+	mPath += FileSystem::getOSSlash();
+	PrintMap::iterator first = mPrints.lower_bound( mPath );
+	mPath.back()++;
+	PrintMap::iterator last = mPrints.lower_bound( mPath );
+	mPath.pop_back();
+
+	mPrints.erase( first, last );
+}
+
+bool FingerprintingListener::hash( Uint64& hash ) {
+	std::ifstream stream( mPath.c_str(), std::ios::binary );
+
+	if ( !stream.is_open() )
+		return false;
+
+	mBuffer.resize( READ_BLOCK_SIZE );
+
+	Hasher hasher;
+
+	while ( true ) {
+		stream.read( mBuffer.data(), mBuffer.size() );
+
+		size_t read = (size_t)stream.gcount();
+
+		if ( read < mBuffer.size() ) {
+			if ( stream.bad() )
+				return false;
+
+			hash = hasher.finish( mBuffer.data(), read );
+			return true;
+		}
+
+		hasher.stripes( mBuffer.data(), read );
+	}
+}
+
+} // namespace efsw
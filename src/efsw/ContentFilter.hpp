@@ -0,0 +1,75 @@
+#ifndef EFSW_CONTENTFILTER_HPP
+#define EFSW_CONTENTFILTER_HPP
+
+#include <efsw/FileInfo.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace efsw {
+
+/// Listener placed after the coalescing stage of a watch with Options::ContentFingerprint. It
+/// keeps the fingerprint of the files of the watch as of their last change, and drops the
+/// modifications that leave the content of a file as it was. The batches of a watch are
+/// delivered from one thread at a time, as for any listener.
+class FingerprintingListener : public WatchStage {
+  public:
+	FingerprintingListener( FileWatchListener* listener, const std::string& directory,
+							Int64 maxSize );
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// @return The modifications dropped
+	Uint64 suppressed() const;
+
+  protected:
+
+	/// The state of a file as of its last change
+	struct Print {
+		Uint64 Size;
+		Uint64 ModificationTime;
+		/// When the content was hashed, in seconds as the modification time
+		Uint64 Hashed;
+		Uint64 Hash;
+	};
+
+	typedef std::map<std::string, Print, std::less<>> PrintMap;
+
+	/// The largest file hashed, negative for any size
+	Int64 mMaxSize;
+
+	/// The files by their full path
+	PrintMap mPrints;
+
+	/// The modifications dropped
+	std::atomic<Uint64> mSuppressed;
+
+	/// Reused between batches: the events kept, the path of the file and its information, and
+	/// the buffer the files are read into
+	std::vector<Event> mEvents;
+	std::string mPath;
+	FileInfo mInfo;
+	std::vector<char> mBuffer;
+
+	/// Hashes the file of mPath into its print, if it's a regular file not too big
+	/// @return False if it wasn't hashed
+	bool record( Print& print );
+
+	/// @return True if the file of mPath was modified since its last change, updating its print
+	bool changed();
+
+	/// Forgets the file of mPath, and the ones below it
+	void forget();
+
+	/// Hashes the content of the file of mPath
+	/// @return False if it couldn't be read
+	bool hash( Uint64& hash );
+};
+
+} // namespace efsw
+
+#endif
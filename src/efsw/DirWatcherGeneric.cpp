@@ -1,5 +1,6 @@
 #include <efsw/Debug.hpp>
 #include <efsw/DirWatcherGeneric.hpp>
+#include <efsw/EventBatch.hpp>
 #include <efsw/FileSystem.hpp>
 #include <efsw/String.hpp>
 
@@ -8,13 +9,21 @@ namespace efsw {
 DirWatcherGeneric::DirWatcherGeneric( DirWatcherGeneric* parent, WatcherGeneric* ws,
 									  const std::string& directory, bool recursive,
 									  bool reportNewFiles ) :
-	Parent( parent ), Watch( ws ), Recursive( recursive ), Deleted( false ) {
+	Parent( parent ), Watch( ws ), Recursive( recursive ), Serial( 0 ), Interval( 0 ),
+	Pending( false ), Deleted( false ) {
+	DirSnap.shareListing( &Watch->Listing );
+
+	/// The subdirectories of a recursive watch report their own changes when they are scanned
+	DirSnap.setStatDirectories( !Recursive );
+
 	resetDirectory( directory );
 
+	Watch->schedule( this );
+
 	if ( !reportNewFiles ) {
-		DirSnap.scan();
+		DirSnap.init( DirSnap.DirectoryInfo.Filepath );
 	} else {
-		DirectorySnapshotDiff Diff = DirSnap.scan();
+		DirectorySnapshotDiff& Diff = DirSnap.scan();
 
 		if ( Diff.changed() ) {
 			FileInfoList::iterator it;
@@ -27,9 +36,11 @@ DirWatcherGeneric::DirWatcherGeneric( DirWatcherGeneric* parent, WatcherGeneric*
 }
 
 DirWatcherGeneric::~DirWatcherGeneric() {
+	Watch->unschedule( this );
+
 	/// If the directory was deleted mark the files as deleted
 	if ( Deleted ) {
-		DirectorySnapshotDiff Diff = DirSnap.scan();
+		DirectorySnapshotDiff& Diff = DirSnap.scan();
 
 		if ( !DirSnap.exists() ) {
 			FileInfoList::iterator it;
@@ -44,6 +55,8 @@ DirWatcherGeneric::~DirWatcherGeneric() {
 		}
 	}
 
+	Watch->WatcherImpl->mWatchRegistry.removeDirectory( DirSnap.DirectoryInfo.Filepath );
+
 	DirWatchMap::iterator it = Directories.begin();
 
 	for ( ; it != Directories.end(); ++it ) {
@@ -77,14 +90,31 @@ void DirWatcherGeneric::resetDirectory( std::string directory ) {
 		}
 	}
 
+	WatchRegistry& registry = Watch->WatcherImpl->mWatchRegistry;
+
+	if ( !DirSnap.DirectoryInfo.Filepath.empty() ) {
+		registry.removeDirectory( DirSnap.DirectoryInfo.Filepath );
+	}
+
 	DirSnap.setDirectoryInfo( dir );
+
+	registry.addDirectory( DirSnap.DirectoryInfo.Filepath );
 }
 
 void DirWatcherGeneric::handleAction( const std::string& filename, unsigned long action,
 									  std::string oldFilename ) {
-	Watch->Listener->handleFileAction( Watch->ID, DirSnap.DirectoryInfo.Filepath,
-									   FileSystem::fileNameFromPath( filename ), (Action)action,
-									   oldFilename );
+	WatchCounters::add( Watch->Counters->Received );
+
+	if ( !Watch->accepts( (Action)action ) )
+		return;
+
+	std::string name( FileSystem::fileNameFromPath( filename ) );
+
+	if ( !Watch->matches( DirSnap.DirectoryInfo.Filepath, name, oldFilename ) )
+		return;
+
+	EventBatch::send( Watch->Listener, Watch->ID, DirSnap.DirectoryInfo.Filepath, name,
+					  (Action)action, oldFilename );
 }
 
 void DirWatcherGeneric::addChilds( bool reportNewFiles ) {
@@ -93,14 +123,35 @@ void DirWatcherGeneric::addChilds( bool reportNewFiles ) {
 		std::string dir;
 
 		for ( FileInfoMap::iterator it = DirSnap.Files.begin(); it != DirSnap.Files.end(); it++ ) {
-			if ( it->second.isDirectory() && it->second.isReadable() &&
-				 !FileSystem::isRemoteFS( it->second.Filepath ) ) {
-				/// Check if the directory is a symbolic link
-				std::string curPath;
-				std::string link( FileSystem::getLinkRealPath( it->second.Filepath, curPath ) );
+			if ( !it->second.isDirectory() )
+				continue;
 
+			std::string path( DirSnap.entryPath( it->first ) );
+
+			if ( !Watch->prunes( path ) ) {
 				dir = it->first;
 
+				/// Already watched, a subdirectory of its own can be in scope since
+				DirWatchMap::iterator existing = Directories.find( dir );
+
+				if ( existing != Directories.end() ) {
+					existing->second->addChilds( reportNewFiles );
+					continue;
+				}
+
+				/// The subdirectories aren't stat'ed by the listing ( see setStatDirectories )
+				if ( !FileInfo( path ).isReadable() ) {
+					Watch->reportError( Errors::FileNotReadable, path );
+					continue;
+				}
+
+				/// Check if the directory is a symbolic link
+				std::string curPath;
+				RealPathCache::Key target;
+				std::string link( NULL != Watch->Links
+									  ? Watch->Links->resolve( path, curPath, target )
+									  : FileSystem::getLinkRealPath( path, curPath ) );
+
 				if ( "" != link ) {
 					/// Avoid adding symlinks directories if it's now enabled
 					if ( !Watch->WatcherImpl->mFileWatcher->followSymlinks() ) {
@@ -110,16 +161,16 @@ void DirWatcherGeneric::addChilds( bool reportNewFiles ) {
 					/// If it's a symlink check if the realpath exists as a watcher, or
 					/// if the path is outside the current dir
 					if ( Watch->WatcherImpl->pathInWatches( link ) ||
-						 Watch->pathInWatches( link ) ||
 						 !Watch->WatcherImpl->linkAllowed( curPath, link ) ) {
 						continue;
-					} else {
-						dir = link;
 					}
-				} else {
-					if ( Watch->pathInWatches( dir ) || Watch->WatcherImpl->pathInWatches( dir ) ) {
+
+					/// Added already by the crawl through another link, no need to search it
+					if ( NULL != Watch->Links && !Watch->Links->visit( target ) ) {
 						continue;
 					}
+
+					dir = link;
 				}
 
 				if ( reportNewFiles ) {
@@ -135,13 +186,40 @@ void DirWatcherGeneric::addChilds( bool reportNewFiles ) {
 	}
 }
 
+void DirWatcherGeneric::removeChilds() {
+	for ( DirWatchMap::iterator it = Directories.begin(); it != Directories.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+
+	Directories.clear();
+}
+
 void DirWatcherGeneric::watch( bool reportOwnChange ) {
-	DirectorySnapshotDiff Diff = DirSnap.scan();
+	scan( reportOwnChange );
 
-	if ( reportOwnChange && Diff.DirChanged && NULL != Parent ) {
-		Watch->Listener->handleFileAction(
-			Watch->ID, FileSystem::pathRemoveFileName( DirSnap.DirectoryInfo.Filepath ),
-			FileSystem::fileNameFromPath( DirSnap.DirectoryInfo.Filepath ), Actions::Modified );
+	/// Process the subdirectories looking for changes
+	for ( DirWatchMap::iterator dit = Directories.begin(); dit != Directories.end(); ++dit ) {
+		/// Just watch
+		dit->second->watch();
+	}
+}
+
+bool DirWatcherGeneric::scan( bool reportOwnChange ) {
+	return report( DirSnap.scan(), reportOwnChange );
+}
+
+bool DirWatcherGeneric::report( DirectorySnapshotDiff& Diff, bool reportOwnChange ) {
+	/// A directory gone is reported deleted by its parent
+	if ( reportOwnChange && Diff.DirChanged && NULL != Parent &&
+		 DirSnap.DirectoryInfo.isDirectory() ) {
+		std::string dir( FileSystem::pathRemoveFileName( DirSnap.DirectoryInfo.Filepath ) );
+		std::string name( FileSystem::fileNameFromPath( DirSnap.DirectoryInfo.Filepath ) );
+
+		WatchCounters::add( Watch->Counters->Received );
+
+		if ( Watch->matches( dir, name ) ) {
+			EventBatch::send( Watch->Listener, Watch->ID, dir, name, Actions::Modified );
+		}
 	}
 
 	if ( Diff.changed() ) {
@@ -185,11 +263,7 @@ void DirWatcherGeneric::watch( bool reportOwnChange ) {
 		}
 	}
 
-	/// Process the subdirectories looking for changes
-	for ( DirWatchMap::iterator dit = Directories.begin(); dit != Directories.end(); ++dit ) {
-		/// Just watch
-		dit->second->watch();
-	}
+	return Diff.DirChanged || Diff.changed();
 }
 
 void DirWatcherGeneric::watchDir( std::string& dir ) {
@@ -273,9 +347,12 @@ DirWatcherGeneric* DirWatcherGeneric::createDirectory( std::string newdir ) {
 
 	FileSystem::dirAddSlashAtEnd( dir );
 
+	if ( Watch->prunes( dir ) )
+		return NULL;
+
 	FileInfo fi( dir );
 
-	if ( !fi.isDirectory() || !fi.isReadable() || FileSystem::isRemoteFS( dir ) ) {
+	if ( !fi.isDirectory() || !fi.isReadable() ) {
 		return NULL;
 	}
 
@@ -291,14 +368,14 @@ DirWatcherGeneric* DirWatcherGeneric::createDirectory( std::string newdir ) {
 
 		/// If it's a symlink check if the realpath exists as a watcher, or
 		/// if the path is outside the current dir
-		if ( Watch->WatcherImpl->pathInWatches( link ) || Watch->pathInWatches( link ) ||
+		if ( Watch->WatcherImpl->pathInWatches( link ) ||
 			 !Watch->WatcherImpl->linkAllowed( curPath, link ) ) {
 			skip = true;
 		} else {
 			dir = link;
 		}
 	} else {
-		if ( Watch->pathInWatches( dir ) || Watch->WatcherImpl->pathInWatches( dir ) ) {
+		if ( Watch->WatcherImpl->pathInWatches( dir ) ) {
 			skip = true;
 		}
 	}
@@ -17,22 +17,42 @@ class DirWatcherGeneric {
 	DirectorySnapshot DirSnap;
 	DirWatchMap Directories;
 	bool Recursive;
+	/// Identifies the scans of the watcher in the schedule of the watch
+	size_t Serial;
+	/// Milliseconds until the next scan, adapted to the activity of the directory
+	long Interval;
+	/// Taken out of the schedule of the watch, waiting for its scan
+	bool Pending;
 
 	DirWatcherGeneric( DirWatcherGeneric* parent, WatcherGeneric* ws, const std::string& directory,
 					   bool recursive, bool reportNewFiles = false );
 
 	~DirWatcherGeneric();
 
+	/// Scans the directory and its subdirectories
 	void watch( bool reportOwnChange = false );
 
+	/// Scans the directory alone
+	/// @return True if anything changed in it
+	bool scan( bool reportOwnChange = false );
+
+	/// Reports the changes found by a scan of the snapshot of the directory
+	/// @return True if anything changed in it
+	bool report( DirectorySnapshotDiff& Diff, bool reportOwnChange = false );
+
 	void watchDir( std::string& dir );
 
 	static bool isDir( const std::string& directory );
 
 	bool pathInWatches( std::string path );
 
+	/// Creates the watchers of the subdirectories not pruned, descending into the ones that
+	/// already have one
 	void addChilds( bool reportNewFiles = true );
 
+	/// Deletes the watchers of the subdirectories, without reporting anything
+	void removeChilds();
+
 	DirWatcherGeneric* findDirWatcher( std::string dir );
 
 	DirWatcherGeneric* findDirWatcherFast( std::string dir );
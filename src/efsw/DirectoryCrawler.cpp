@@ -0,0 +1,333 @@
+#include <efsw/DirectoryCrawler.hpp>
+#include <efsw/FileInfo.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+
+#if defined( EFSW_PLATFORM_POSIX )
+
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_ANDROID
+#include <sys/syscall.h>
+#define EFSW_HAS_GETDENTS64
+#endif
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+#endif
+
+/// Number of queued directories per running thread before spawning another worker
+#define CRAWLER_TASKS_PER_THREAD 8
+
+namespace efsw {
+
+#ifdef EFSW_HAS_GETDENTS64
+struct LinuxDirent64 {
+	Uint64 d_ino;
+	Int64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+DirectoryCrawler::Directory::Directory() :
+	Parent( NoParent ),
+	Device( 0 ),
+	Inode( 0 ),
+	ModificationTime( 0 ),
+	IsLink( false ),
+	MountPoint( false ),
+	Handle( -1 ),
+	Data( NULL ) {}
+
+DirectoryCrawler::DirectoryCrawler( bool followSymlinks, unsigned int maxThreads ) :
+	mFollowSymlinks( followSymlinks ), mMaxThreads( maxThreads ), mPending( 0 ) {
+	if ( 0 == mMaxThreads ) {
+		mMaxThreads = std::thread::hardware_concurrency();
+
+		if ( mMaxThreads > 8 )
+			mMaxThreads = 8;
+	}
+
+	if ( 0 == mMaxThreads )
+		mMaxThreads = 1;
+}
+
+DirectoryCrawler::DirectoryList DirectoryCrawler::crawl( const std::string& root,
+														 const Visitor& visitor ) {
+	Task task;
+	task.Path = root;
+	task.Parent = NoParent;
+	task.ParentDevice = 0;
+	task.IsLink = false;
+
+	FileSystem::dirAddSlashAtEnd( task.Path );
+
+	{
+		Lock lock( mMutex );
+		mResults.clear();
+		mUnreadable.clear();
+		mLinks.clear();
+		mTasks.push_back( task );
+		mPending = 1;
+	}
+
+	// The calling thread does its share of the work, helpers are only spawned when the queue
+	// grows, so crawling a small tree never creates a thread.
+	work( visitor );
+
+	for ( size_t i = 0; i < mWorkers.size(); i++ ) {
+		mWorkers[i].join();
+	}
+
+	mWorkers.clear();
+
+	DirectoryList results;
+	results.swap( mResults );
+	return results;
+}
+
+const std::vector<std::string>& DirectoryCrawler::unreadable() const {
+	return mUnreadable;
+}
+
+void DirectoryCrawler::addUnreadable( const std::string& path ) {
+	Lock lock( mMutex );
+	mUnreadable.push_back( path );
+}
+
+void DirectoryCrawler::work( const Visitor& visitor ) {
+	std::vector<Task> found;
+
+	while ( true ) {
+		Task task;
+
+		{
+			Lock lock( mMutex );
+
+			mCondition.wait( lock, [this] { return !mTasks.empty() || 0 == mPending; } );
+
+			if ( mTasks.empty() )
+				return;
+
+			task = std::move( mTasks.front() );
+			mTasks.pop_front();
+		}
+
+		found.clear();
+
+		process( task, visitor, found );
+
+		Lock lock( mMutex );
+
+		for ( size_t i = 0; i < found.size(); i++ ) {
+			mTasks.push_back( std::move( found[i] ) );
+		}
+
+		mPending += found.size();
+		mPending--;
+
+		if ( mWorkers.size() + 1 < mMaxThreads &&
+			 mTasks.size() > ( mWorkers.size() + 1 ) * CRAWLER_TASKS_PER_THREAD ) {
+			mWorkers.push_back( std::thread( [this, &visitor] { work( visitor ); } ) );
+		}
+
+		if ( 0 == mPending ) {
+			mCondition.notify_all();
+		} else if ( !found.empty() ) {
+			mCondition.notify_all();
+		}
+	}
+}
+
+void DirectoryCrawler::addSubdirectory( const Directory& dir, size_t index,
+										const std::string& name,
+										const RealPathCache::Key* link,
+										std::vector<Task>& found ) {
+	Task task;
+	task.Name = name;
+	task.Parent = index;
+	task.ParentDevice = dir.Device;
+	task.IsLink = NULL != link;
+
+	if ( NULL != link ) {
+		std::string curPath;
+		task.Path = mLinks.resolve( dir.Path + name, *link, curPath );
+
+		if ( task.Path.empty() )
+			return;
+
+		task.LinkBase = curPath;
+	} else {
+		task.Path = dir.Path + name;
+		FileSystem::dirAddSlashAtEnd( task.Path );
+	}
+
+	found.push_back( std::move( task ) );
+}
+
+void DirectoryCrawler::process( Task& task, const Visitor& visitor, std::vector<Task>& found ) {
+	Directory dir;
+	dir.Path = std::move( task.Path );
+	dir.Name = std::move( task.Name );
+	dir.LinkBase = std::move( task.LinkBase );
+	dir.Parent = task.Parent;
+	dir.IsLink = task.IsLink;
+
+#if defined( EFSW_PLATFORM_POSIX )
+	int fd = open( dir.Path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	if ( -1 == fd ) {
+		if ( EACCES == errno ) {
+			addUnreadable( dir.Path );
+		}
+
+		return;
+	}
+
+	struct stat st;
+
+	if ( 0 != fstat( fd, &st ) || !S_ISDIR( st.st_mode ) ) {
+		close( fd );
+		return;
+	}
+
+	dir.Device = st.st_dev;
+	dir.Inode = st.st_ino;
+#if EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_ANDROID
+	dir.ModificationTime = (Uint64)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#else
+	dir.ModificationTime = (Uint64)st.st_mtime * 1000000000ULL;
+#endif
+	dir.MountPoint = NoParent != dir.Parent && task.ParentDevice != dir.Device;
+
+	RealPathCache::Key key = { dir.Device, dir.Inode };
+
+	/// Reached twice during the crawl, e.g. through a link pointing above it. The first worker
+	/// marking it is the only one offering it to the visitor.
+	if ( !mLinks.visit( key ) || !visitor( dir ) ) {
+		close( fd );
+		return;
+	}
+
+	size_t index;
+
+	{
+		Lock lock( mMutex );
+		index = mResults.size();
+		mResults.push_back( dir );
+	}
+
+	// Classifies an entry of the directory, only entries of unknown type and symlinks ( when
+	// following them ) need a fstatat, the rest are resolved from the d_type.
+	auto handleEntry = [&]( const char* name, unsigned char type ) {
+		if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) )
+			return;
+
+#ifdef DT_DIR
+		if ( DT_DIR == type ) {
+			addSubdirectory( dir, index, name, NULL, found );
+			return;
+		} else if ( DT_UNKNOWN != type && ( DT_LNK != type || !mFollowSymlinks ) ) {
+			return;
+		}
+#endif
+
+		struct stat est;
+
+		if ( 0 != fstatat( fd, name, &est, AT_SYMLINK_NOFOLLOW ) )
+			return;
+
+		if ( S_ISDIR( est.st_mode ) ) {
+			addSubdirectory( dir, index, name, NULL, found );
+		} else if ( S_ISLNK( est.st_mode ) && mFollowSymlinks &&
+					0 == fstatat( fd, name, &est, 0 ) && S_ISDIR( est.st_mode ) ) {
+			RealPathCache::Key link = { (Uint64)est.st_dev, (Uint64)est.st_ino };
+			addSubdirectory( dir, index, name, &link, found );
+		}
+	};
+
+#ifdef EFSW_HAS_GETDENTS64
+	char buffer[32 * 1024];
+	long nread;
+
+	while ( ( nread = syscall( SYS_getdents64, fd, buffer, sizeof( buffer ) ) ) > 0 ) {
+		for ( long pos = 0; pos < nread; ) {
+			LinuxDirent64* entry = reinterpret_cast<LinuxDirent64*>( buffer + pos );
+			pos += entry->d_reclen;
+
+			handleEntry( entry->d_name, entry->d_type );
+		}
+	}
+
+	close( fd );
+#else
+	DIR* dp = fdopendir( fd );
+
+	if ( NULL == dp ) {
+		close( fd );
+		return;
+	}
+
+	struct dirent* entry;
+
+	while ( ( entry = readdir( dp ) ) != NULL ) {
+#ifdef DT_DIR
+		handleEntry( entry->d_name, entry->d_type );
+#else
+		handleEntry( entry->d_name, 0 );
+#endif
+	}
+
+	closedir( dp );
+#endif
+#else
+	FileInfo fi( dir.Path );
+
+	if ( !fi.isDirectory() )
+		return;
+
+	if ( !fi.isReadable() ) {
+		addUnreadable( dir.Path );
+		return;
+	}
+
+	dir.Inode = fi.Inode;
+	dir.ModificationTime = fi.ModificationTime * 1000000000ULL;
+
+	if ( !visitor( dir ) )
+		return;
+
+	size_t index;
+
+	{
+		Lock lock( mMutex );
+		index = mResults.size();
+		mResults.push_back( dir );
+	}
+
+	FileInfoMap files = FileSystem::filesInfoFromPath( dir.Path );
+
+	for ( FileInfoMap::iterator it = files.begin(); it != files.end(); ++it ) {
+		if ( it->second.isDirectory() ) {
+			addSubdirectory( dir, index, std::string( it->first ), NULL, found );
+		}
+	}
+#endif
+}
+
+} // namespace efsw
@@ -0,0 +1,108 @@
+#ifndef EFSW_DIRECTORYCRAWLER_HPP
+#define EFSW_DIRECTORYCRAWLER_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/RealPathCache.hpp>
+#include <efsw/base.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace efsw {
+
+/** @brief Walks a directory tree with a pool of worker threads, reporting only directories.
+ * Regular files are never stat'ed: entries are classified with the d_type reported by the
+ * directory listing, falling back to a fstatat relative to the open directory when unknown.
+ * The symlinks followed are resolved once per directory they point to, and a directory already
+ * crawled isn't crawled again through another link, so the cycles end there.
+ */
+class DirectoryCrawler {
+  public:
+	static const size_t NoParent = (size_t)-1;
+
+	/// A directory found while crawling
+	class Directory {
+	  public:
+		Directory();
+
+		/// The full path of the directory ( ends with the OS slash )
+		std::string Path;
+		/// The name of the directory entry in its parent ( empty for the root )
+		std::string Name;
+		/// The path of the directory containing the symlink ( only set if IsLink )
+		std::string LinkBase;
+		/// Index of the parent directory in the crawl results ( NoParent for the root )
+		size_t Parent;
+		Uint64 Device;
+		Uint64 Inode;
+		/// Modification time of the directory in nanoseconds
+		Uint64 ModificationTime;
+		/// True if the directory was reached through a symbolic link, Path is the real path
+		bool IsLink;
+		/// True if the directory lives in a different device than its parent
+		bool MountPoint;
+		/// Free slot for the backend ( i.e. the inotify watch descriptor )
+		int Handle;
+		/// Free slot for the backend, owned by the backend
+		void* Data;
+	};
+
+	typedef std::vector<Directory> DirectoryList;
+
+	/// Called from the worker threads for every directory found, before descending into it, once
+	/// however many links lead to it. Returning false skips the directory and its subtree.
+	typedef std::function<bool( Directory& dir )> Visitor;
+
+	/// @param followSymlinks Descend into symbolic links pointing to directories
+	/// @param maxThreads Maximum number of threads used, 0 to use the hardware concurrency
+	explicit DirectoryCrawler( bool followSymlinks = false, unsigned int maxThreads = 0 );
+
+	/// Crawls the directory tree starting at root ( root included ).
+	/// @return The directories accepted by the visitor, a parent always precedes its children.
+	DirectoryList crawl( const std::string& root, const Visitor& visitor );
+
+	/// @return The directories the last crawl couldn't open for lack of permission, their
+	/// subtree was skipped
+	const std::vector<std::string>& unreadable() const;
+
+  protected:
+	struct Task {
+		std::string Path;
+		std::string Name;
+		std::string LinkBase;
+		size_t Parent;
+		Uint64 ParentDevice;
+		bool IsLink;
+	};
+
+	bool mFollowSymlinks;
+	unsigned int mMaxThreads;
+
+	Mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<Task> mTasks;
+	DirectoryList mResults;
+	std::vector<std::string> mUnreadable;
+	std::vector<std::thread> mWorkers;
+	/// The links resolved and the directories visited by the crawl
+	RealPathCache mLinks;
+	/// Tasks queued or being processed
+	size_t mPending;
+
+	void work( const Visitor& visitor );
+
+	void process( Task& task, const Visitor& visitor, std::vector<Task>& found );
+
+	void addUnreadable( const std::string& path );
+
+	/// @param link The directory the entry points to if it's a symlink, NULL if it isn't one
+	void addSubdirectory( const Directory& dir, size_t index, const std::string& name,
+						  const RealPathCache::Key* link, std::vector<Task>& found );
+};
+
+} // namespace efsw
+
+#endif
@@ -1,35 +1,90 @@
 #include <efsw/DirectorySnapshot.hpp>
 #include <efsw/FileSystem.hpp>
+#include <chrono>
 
 namespace efsw {
 
-DirectorySnapshot::DirectorySnapshot() {}
+/// The time after its last change a directory must have been listed at for its time to be
+/// trusted: a change within the granularity of the times of the file system ( up to 2 seconds )
+/// can leave the time of the directory unchanged
+static const Uint64 RacyTime = 2000000000ULL;
 
-DirectorySnapshot::DirectorySnapshot( std::string directory ) {
+/// The entries a sliced scan stats between two looks at the clock
+static const size_t SliceEntries = 256;
+
+static Uint64 wallClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::system_clock::now().time_since_epoch() )
+		.count();
+}
+
+DirectorySnapshot::DirectorySnapshot() :
+	mListing( NULL ),
+	mStatDirectories( true ),
+	mListedTime( 0 ),
+	mListedAt( 0 ),
+	mSliced( false ) {}
+
+DirectorySnapshot::DirectorySnapshot( std::string directory ) :
+	mListing( NULL ),
+	mStatDirectories( true ),
+	mListedTime( 0 ),
+	mListedAt( 0 ),
+	mSliced( false ) {
 	init( directory );
 }
 
 DirectorySnapshot::~DirectorySnapshot() {}
 
 void DirectorySnapshot::init( std::string directory ) {
-	setDirectoryInfo( directory );
+	dropSlice();
+
+	DirectoryInfo.Filepath = directory;
+	mListedAt = wallClock();
+
+	FileSystem::directoryInfo( DirectoryInfo.Filepath, DirectoryInfo, mListedTime );
+
 	initFiles();
 }
 
+void DirectorySnapshot::restore( std::string directory, Uint64 listedTime, Uint64 listedAt ) {
+	dropSlice();
+
+	DirectoryInfo = FileInfo();
+	DirectoryInfo.Filepath = directory;
+	mListedTime = listedTime;
+	mListedAt = listedAt;
+}
+
+Uint64 DirectorySnapshot::listedTime() const {
+	return mListedTime;
+}
+
+Uint64 DirectorySnapshot::listedAt() const {
+	return mListedAt;
+}
+
+bool DirectorySnapshot::namesChanged() const {
+	FileInfo info;
+	Uint64 modificationTime = 0;
+
+	/// A directory gone is listed again, reporting its entries deleted
+	if ( !FileSystem::directoryInfo( DirectoryInfo.Filepath, info, modificationTime ) )
+		return true;
+
+	return mustList( modificationTime );
+}
+
 bool DirectorySnapshot::exists() {
 	return DirectoryInfo.exists();
 }
 
 void DirectorySnapshot::deleteAll( DirectorySnapshotDiff& Diff ) {
-	FileInfo fi;
-
 	for ( FileInfoMap::iterator it = Files.begin(); it != Files.end(); it++ ) {
-		fi = it->second;
-
-		if ( fi.isDirectory() ) {
-			Diff.DirsDeleted.push_back( fi );
+		if ( it->second.isDirectory() ) {
+			Diff.DirsDeleted.push_back( withPath( *it ) );
 		} else {
-			Diff.FilesDeleted.push_back( fi );
+			Diff.FilesDeleted.push_back( withPath( *it ) );
 		}
 	}
 
@@ -37,167 +92,358 @@ void DirectorySnapshot::deleteAll( DirectorySnapshotDiff& Diff ) {
 }
 
 void DirectorySnapshot::setDirectoryInfo( std::string directory ) {
+	dropSlice();
+
 	DirectoryInfo = FileInfo( directory );
 }
 
 void DirectorySnapshot::initFiles() {
-	Files = FileSystem::filesInfoFromPath( DirectoryInfo.Filepath );
+	FileSystem::listDirectory( DirectoryInfo.Filepath, Files, mStatDirectories );
+}
 
-	FileInfoMap::iterator it = Files.begin();
-	std::vector<std::string> eraseFiles;
+DirectorySnapshotDiff& DirectorySnapshot::scan() {
+	if ( NULL != mListing )
+		return scan( *mListing );
+
+	FileInfoMap listing;
+
+	return scan( listing );
+}
+
+DirectorySnapshotDiff& DirectorySnapshot::scan( FileInfoMap& listing ) {
+	dropSlice();
+
+	Uint64 modificationTime;
+	Uint64 now;
+
+	if ( !start( modificationTime, now ) )
+		return mDiff;
 
-	/// Remove all non regular files and non directories
-	for ( ; it != Files.end(); it++ ) {
-		if ( !it->second.isRegularFile() && !it->second.isDirectory() ) {
-			eraseFiles.push_back( it->first );
+	if ( mustList( modificationTime ) ) {
+		mListedTime = modificationTime;
+		mListedAt = now;
+
+		FileSystem::listDirectory( DirectoryInfo.Filepath, listing, mStatDirectories );
+	} else {
+		FileSystem::statEntries( DirectoryInfo.Filepath, Files, listing, mStatDirectories );
+	}
+
+	return merge( listing );
+}
+
+DirectorySnapshotDiff& DirectorySnapshot::scanNames( FileInfoMap& listing ) {
+	dropSlice();
+
+	Uint64 modificationTime;
+	Uint64 now;
+
+	if ( !start( modificationTime, now ) )
+		return mDiff;
+
+	mListedTime = modificationTime;
+	mListedAt = now;
+
+	if ( !FileSystem::listNames( DirectoryInfo.Filepath, listing ) ) {
+		/// The runs of entries not known are stat'ed at once
+		FileInfoMap::iterator first = listing.end();
+
+		for ( FileInfoMap::iterator it = listing.begin(); it != listing.end(); ++it ) {
+			FileInfoMap::iterator known = Files.find( it->first );
+
+			if ( known != Files.end() && known->second.Inode == it->second.Inode &&
+				 known->second.isDirectory() == it->second.isDirectory() ) {
+				it->second = known->second;
+
+				if ( first != listing.end() ) {
+					FileSystem::statNames( DirectoryInfo.Filepath, listing, first, it,
+										   mStatDirectories );
+					first = listing.end();
+				}
+			} else if ( first == listing.end() ) {
+				first = it;
+			}
+		}
+
+		if ( first != listing.end() ) {
+			FileSystem::statNames( DirectoryInfo.Filepath, listing, first, listing.end(),
+								   mStatDirectories );
 		}
 	}
 
-	for ( std::vector<std::string>::iterator eit = eraseFiles.begin(); eit != eraseFiles.end();
-		  eit++ ) {
-		Files.erase( *eit );
+	listing.sort();
+
+	return merge( listing );
+}
+
+DirectorySnapshotDiff* DirectorySnapshot::scan( FileInfoMap& listing,
+												Clock::time_point deadline ) {
+	/// A directory gone meanwhile is scanned again from the start
+	if ( mSliced && !FileSystem::isDirectory( DirectoryInfo.Filepath ) ) {
+		dropSlice();
+	}
+
+	FileInfoMap& current = mSliced ? mPartial : listing;
+
+	if ( !mSliced ) {
+		Uint64 modificationTime;
+		Uint64 now;
+
+		if ( !start( modificationTime, now ) )
+			return &mDiff;
+
+		bool complete = false;
+
+		/// The names are listed at once, the entries stat'ed slice by slice
+		if ( mustList( modificationTime ) ) {
+			mListedTime = modificationTime;
+			mListedAt = now;
+
+			complete = FileSystem::listNames( DirectoryInfo.Filepath, listing );
+		} else {
+			listing.recycle();
+
+			for ( FileInfoMap::iterator it = Files.begin(); it != Files.end(); ++it ) {
+				listing.append( it->first ).assignInfo( it->second );
+			}
+		}
+
+		mCursor = complete ? listing.end() : listing.begin();
+	}
+
+	while ( mCursor != current.end() ) {
+		FileInfoMap::iterator last = mCursor;
+
+		for ( size_t i = 0; i < SliceEntries && last != current.end(); i++ ) {
+			++last;
+		}
+
+		FileSystem::statNames( DirectoryInfo.Filepath, current, mCursor, last, mStatDirectories );
+		mCursor = last;
+
+		if ( mCursor != current.end() && Clock::now() >= deadline ) {
+			/// The listing is kept until the next call, the storage of the entries ( and the
+			/// cursor ) moves along
+			if ( !mSliced ) {
+				mSliced = true;
+				std::swap( mPartial, listing );
+			}
+
+			return NULL;
+		}
+	}
+
+	current.sort();
+
+	DirectorySnapshotDiff& Diff = merge( current );
+
+	/// The listing resumed goes back to the caller, whose buffer is dropped instead
+	if ( mSliced ) {
+		std::swap( mPartial, listing );
+		dropSlice();
+	}
+
+	return &Diff;
+}
+
+void DirectorySnapshot::dropSlice() {
+	if ( mSliced ) {
+		mSliced = false;
+		mPartial = FileInfoMap();
 	}
 }
 
-DirectorySnapshotDiff DirectorySnapshot::scan() {
-	DirectorySnapshotDiff Diff;
+bool DirectorySnapshot::start( Uint64& modificationTime, Uint64& now ) {
+	DirectorySnapshotDiff& Diff = mDiff;
 
 	Diff.clear();
 
-	FileInfo curFI( DirectoryInfo.Filepath );
+	now = wallClock();
+
+	FileInfo curFI;
+	bool exists = FileSystem::directoryInfo( DirectoryInfo.Filepath, curFI, modificationTime );
 
 	Diff.DirChanged = DirectoryInfo != curFI;
 
 	if ( Diff.DirChanged ) {
-		DirectoryInfo = curFI;
+		DirectoryInfo.assignInfo( curFI );
 	}
 
 	/// If the directory was erased, create the events for files and directories deletion
-	if ( !curFI.exists() ) {
+	if ( !exists ) {
 		deleteAll( Diff );
 
-		return Diff;
-	}
-
-	FileInfoMap files = FileSystem::filesInfoFromPath( DirectoryInfo.Filepath );
+		mListedTime = 0;
 
-	if ( files.empty() && Files.empty() ) {
-		return Diff;
+		return false;
 	}
 
-	FileInfo fi;
-	FileInfoMap FilesCpy;
-	FileInfoMap::iterator it;
-	FileInfoMap::iterator fiIt;
+	Files.sort();
 
-	if ( Diff.DirChanged ) {
-		FilesCpy = Files;
-	}
+	return true;
+}
+
+bool DirectorySnapshot::mustList( Uint64 modificationTime ) const {
+	/// Only the creations, deletions and renames of entries change the time of the directory
+	return 0 == modificationTime || modificationTime != mListedTime ||
+		   mListedTime + RacyTime > mListedAt;
+}
 
-	for ( it = files.begin(); it != files.end(); it++ ) {
-		fi = it->second;
+DirectorySnapshotDiff& DirectorySnapshot::merge( FileInfoMap& listing ) {
+	DirectorySnapshotDiff& Diff = mDiff;
 
-		/// File existed before?
-		fiIt = Files.find( it->first );
+	if ( listing.empty() && Files.empty() ) {
+		return Diff;
+	}
 
-		if ( fiIt != Files.end() ) {
-			/// Erase from the file list copy
-			FilesCpy.erase( it->first );
+	mCreated.clear();
+	mMissing.clear();
 
+	/// Both listings are sorted by name, a single pass over them finds what changed
+	FileInfoMap::iterator it = Files.begin();
+	FileInfoMap::iterator lit = listing.begin();
+
+	while ( it != Files.end() || lit != listing.end() ) {
+		if ( lit == listing.end() || ( it != Files.end() && it->first < lit->first ) ) {
+			mMissing.push_back( it );
+			++it;
+		} else if ( it == Files.end() || lit->first < it->first ) {
+			mCreated.push_back( lit );
+			++lit;
+		} else {
 			/// File changed?
-			if ( ( *fiIt ).second != fi ) {
-				/// Update the new file info
-				Files[it->first] = fi;
+			if ( it->second != lit->second ) {
+				it->second.assignInfo( lit->second );
 
-				/// handle modified event
-				if ( fi.isDirectory() ) {
-					Diff.DirsModified.push_back( fi );
+				if ( it->second.isDirectory() ) {
+					Diff.DirsModified.push_back( withPath( *it ) );
 				} else {
-					Diff.FilesModified.push_back( fi );
+					Diff.FilesModified.push_back( withPath( *it ) );
 				}
 			}
+
+			++it;
+			++lit;
 		}
-		/// Only add regular files or directories
-		else if ( fi.isRegularFile() || fi.isDirectory() ) {
-			/// New file found
-			Files[it->first] = fi;
+	}
 
-			FileInfoMap::iterator fit;
-			std::string oldFile = "";
+	mMissingInodes.clear();
 
-			/// Check if the same inode already existed
-			if ( ( fit = nodeInFiles( fi ) ) != Files.end() ) {
-				oldFile = fit->first;
+	/// Every entry missing can be the source of a move, deferred or not
+	if ( FileInfo::inodeSupported() && !mCreated.empty() && !mMissing.empty() ) {
+		mMissingInodes.reserve( mMissing.size() );
 
-				/// Avoid firing a Delete event
-				FilesCpy.erase( fit->first );
+		for ( size_t m = 0; m < mMissing.size(); m++ ) {
+			mMissingInodes.emplace( mMissing[m]->second.Inode, m );
+		}
+	}
 
-				/// Delete the old file name
-				Files.erase( fit->first );
+	/// A new entry with the inode of a missing one was moved, the rest were deleted. The
+	/// missing entries are erased before the new ones are inserted, which can move them.
+	for ( size_t i = 0; i < mCreated.size(); i++ ) {
+		FileInfoMap::iterator& created = mCreated[i];
+		std::string oldFile( takeMoved( created->second ) );
+		FileInfo fi( withPath( *created ) );
 
-				if ( fi.isDirectory() ) {
-					Diff.DirsMoved.push_back( std::make_pair( oldFile, fi ) );
-				} else {
-					Diff.FilesMoved.push_back( std::make_pair( oldFile, fi ) );
-				}
+		if ( !oldFile.empty() ) {
+			if ( fi.isDirectory() ) {
+				Diff.DirsMoved.push_back( std::make_pair( oldFile, fi ) );
 			} else {
-				if ( fi.isDirectory() ) {
-					Diff.DirsCreated.push_back( fi );
-				} else {
-					Diff.FilesCreated.push_back( fi );
-				}
+				Diff.FilesMoved.push_back( std::make_pair( oldFile, fi ) );
 			}
+		} else if ( fi.isDirectory() ) {
+			Diff.DirsCreated.push_back( fi );
+		} else {
+			Diff.FilesCreated.push_back( fi );
 		}
 	}
 
-	if ( !Diff.DirChanged ) {
-		return Diff;
+	/// The entries missing and not moved are only reported as deleted once the directory itself
+	/// changed, they are kept until then. A move is paired whatever the time of the directory,
+	/// a rename within the same tick of its clock leaves it looking unchanged.
+	for ( size_t m = 0; m < mMissing.size() && Diff.DirChanged; m++ ) {
+		if ( Files.end() == mMissing[m] )
+			continue;
+
+		if ( mMissing[m]->second.isDirectory() ) {
+			Diff.DirsDeleted.push_back( withPath( *mMissing[m] ) );
+		} else {
+			Diff.FilesDeleted.push_back( withPath( *mMissing[m] ) );
+		}
+
+		Files.erase( mMissing[m] );
 	}
 
-	/// The files or directories that remains were deleted
-	for ( it = FilesCpy.begin(); it != FilesCpy.end(); it++ ) {
-		fi = it->second;
+	/// The names created aren't live entries, the erased entries of the same name are dropped by
+	/// the sort
+	if ( !mCreated.empty() ) {
+		/// The first listing is stored as is, growing it later is amortized
+		if ( Files.empty() ) {
+			Files.reserve( mCreated.size() );
+		}
 
-		if ( fi.isDirectory() ) {
-			Diff.DirsDeleted.push_back( fi );
-		} else {
-			Diff.FilesDeleted.push_back( fi );
+		for ( size_t i = 0; i < mCreated.size(); i++ ) {
+			Files.append( mCreated[i]->first ).assignInfo( mCreated[i]->second );
 		}
 
-		/// Remove the file or directory from the list of files
-		Files.erase( it->first );
+		Files.sort();
 	}
 
+	mCreated.clear();
+	mMissing.clear();
+	mMissingInodes.clear();
+
 	return Diff;
 }
 
-FileInfoMap::iterator DirectorySnapshot::nodeInFiles( FileInfo& fi ) {
-	FileInfoMap::iterator it;
+std::string DirectorySnapshot::takeMoved( const FileStat& created ) {
+	std::unordered_map<Uint64, size_t>::iterator found = mMissingInodes.find( created.Inode );
 
-	if ( FileInfo::inodeSupported() ) {
-		for ( it = Files.begin(); it != Files.end(); it++ ) {
-			if ( it->second.sameInode( fi ) && it->second.Filepath != fi.Filepath ) {
-				return it;
-			}
-		}
-	}
+	if ( mMissingInodes.end() == found )
+		return std::string();
+
+	FileInfoMap::iterator& missing = mMissing[found->second];
+	std::string oldFile( missing->first );
 
-	return Files.end();
+	mMissingInodes.erase( found );
+	Files.erase( missing );
+	missing = Files.end();
+
+	return oldFile;
+}
+
+void DirectorySnapshot::shareListing( FileInfoMap* listing ) {
+	mListing = listing;
+}
+
+void DirectorySnapshot::setStatDirectories( bool statDirectories ) {
+	mStatDirectories = statDirectories;
+}
+
+std::string DirectorySnapshot::entryPath( std::string_view name ) const {
+	std::string path;
+	path.reserve( DirectoryInfo.Filepath.size() + name.size() );
+	path.append( DirectoryInfo.Filepath ).append( name.data(), name.size() );
+	return path;
+}
+
+FileInfo DirectorySnapshot::withPath( const FileInfoMap::value_type& entry ) const {
+	FileInfo fi;
+	fi.assignInfo( entry.second );
+	fi.Filepath = entryPath( entry.first );
+	return fi;
+}
+
+void DirectorySnapshot::setFile( const std::string& name, const FileInfo& fi ) {
+	Files[name].assignInfo( fi );
 }
 
 void DirectorySnapshot::addFile( std::string path ) {
 	std::string name( FileSystem::fileNameFromPath( path ) );
-	Files[name] = FileInfo( path );
+	setFile( name, FileInfo( path ) );
 }
 
 void DirectorySnapshot::removeFile( std::string path ) {
-	std::string name( FileSystem::fileNameFromPath( path ) );
-
-	FileInfoMap::iterator it = Files.find( name );
-
-	if ( Files.end() != it ) {
-		Files.erase( it );
-	}
+	Files.erase( FileSystem::fileNameFromPath( path ) );
 }
 
 void DirectorySnapshot::moveFile( std::string oldPath, std::string newPath ) {
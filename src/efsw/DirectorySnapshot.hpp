@@ -2,11 +2,25 @@
 #define EFSW_DIRECTORYSNAPSHOT_HPP
 
 #include <efsw/DirectorySnapshotDiff.hpp>
+#include <chrono>
+#include <unordered_map>
 
 namespace efsw {
 
+/// The entries of a directory, by name. The entries don't keep their path ( the Filepath of the
+/// FileInfos stored is empty ), it's the path of the directory followed by their name. The paths
+/// are only built for the entries reported by a diff.
+/// A scan lists the directory into a sorted listing and merges it with the entries. With a
+/// listing shared by the snapshots scanned from the same thread, a scan that finds no change
+/// doesn't allocate. Where the platform tells the modification time of the directory with enough
+/// precision, a directory that didn't change since it was listed isn't listed again: only its
+/// entries are stat'ed, for the changes of their content.
+/// A sliced scan stops once its deadline passed and is resumed by the next call, so a large
+/// directory is scanned across several calls.
 class DirectorySnapshot {
   public:
+	typedef std::chrono::steady_clock Clock;
+
 	FileInfo DirectoryInfo;
 	FileInfoMap Files;
 
@@ -20,11 +34,53 @@ class DirectorySnapshot {
 
 	void init( std::string directory );
 
+	/// Sets the state of the directory as it was when it was listed, the entries are then
+	/// appended to Files. The next scan reports the changes since then, the entries missing
+	/// included.
+	void restore( std::string directory, Uint64 listedTime, Uint64 listedAt );
+
+	/// @return The modification time of the directory when it was last listed, in nanoseconds
+	Uint64 listedTime() const;
+
+	/// @return The time it was last listed at, in nanoseconds
+	Uint64 listedAt() const;
+
+	/// Only reads the time of the directory, where the platform doesn't tell it it's always true
+	/// @return True if entries may have been created, deleted or renamed since it was last listed
+	bool namesChanged() const;
+
 	bool exists();
 
-	DirectorySnapshotDiff scan();
+	/// @return The changes since the last scan, valid until the next one
+	DirectorySnapshotDiff& scan();
+
+	/// Scans listing the directory into the buffer given, so the snapshots of a watch can be
+	/// scanned from several threads at once
+	DirectorySnapshotDiff& scan( FileInfoMap& listing );
 
-	FileInfoMap::iterator nodeInFiles( FileInfo& fi );
+	/// Scans until the deadline, at least a few hundred entries. A scan not done by then keeps
+	/// what it found so far, the next call resumes it. A scan without deadline drops it.
+	/// @return The changes since the last scan, NULL if the scan isn't done yet
+	DirectorySnapshotDiff* scan( FileInfoMap& listing, Clock::time_point deadline );
+
+	/// Scans listing only the names of the directory: the entries known keep their information,
+	/// only the names new ( or of another file ) are stat'ed, so the cost of the syscalls grows
+	/// with the changes rather than with the directory. The changes of the content of the
+	/// entries known aren't seen, it's for the directories whose files report their own.
+	DirectorySnapshotDiff& scanNames( FileInfoMap& listing );
+
+	/// Sets the buffer the scans list the directory into, NULL for a buffer of their own
+	void shareListing( FileInfoMap* listing );
+
+	/// False if the subdirectories report their own changes, they are then only told apart by
+	/// their inode, which the listing gives without a stat
+	void setStatDirectories( bool statDirectories );
+
+	/// @return The path of an entry of the directory
+	std::string entryPath( std::string_view name ) const;
+
+	/// Stores the information of the entry, without its path
+	void setFile( const std::string& name, const FileInfo& fi );
 
 	void addFile( std::string path );
 
@@ -35,9 +91,52 @@ class DirectorySnapshot {
 	void updateFile( std::string path );
 
   protected:
+	FileInfoMap* mListing;
+
+	bool mStatDirectories;
+
+	/// The modification time of the directory when it was last listed, and the time it was
+	/// listed at, in nanoseconds
+	Uint64 mListedTime;
+	Uint64 mListedAt;
+
+	/// The listing of a sliced scan not done yet and the first entry not stat'ed in it
+	bool mSliced;
+	FileInfoMap mPartial;
+	FileInfoMap::iterator mCursor;
+
+	/// Reused between scans: the changes and the entries created and missing
+	DirectorySnapshotDiff mDiff;
+	std::vector<FileInfoMap::iterator> mCreated;
+	std::vector<FileInfoMap::iterator> mMissing;
+
+	/// The missing entries by inode, all of them whether the directory changed or not, so each
+	/// created entry finds the one it was moved from at once. An entry matched is set to the end
+	/// of Files in mMissing.
+	std::unordered_map<Uint64, size_t> mMissingInodes;
+
 	void initFiles();
 
 	void deleteAll( DirectorySnapshotDiff& Diff );
+
+	/// Drops the sliced scan in progress, if any
+	void dropSlice();
+
+	/// Reads the information of the directory
+	/// @return False if it's gone, the changes are then its entries deleted
+	bool start( Uint64& modificationTime, Uint64& now );
+
+	/// @return True if the directory must be listed, its time having changed since its listing
+	bool mustList( Uint64 modificationTime ) const;
+
+	/// Merges the sorted listing of the directory with the entries, into the changes
+	DirectorySnapshotDiff& merge( FileInfoMap& listing );
+
+	/// @return The name of the missing entry the new one was moved from, empty if none
+	std::string takeMoved( const FileStat& created );
+
+	/// @return The entry stored with its path set, for a diff
+	FileInfo withPath( const FileInfoMap::value_type& entry ) const;
 };
 
 } // namespace efsw
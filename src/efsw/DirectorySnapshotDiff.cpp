@@ -2,15 +2,26 @@
 
 namespace efsw {
 
+/// Lists of more entries than this give their storage back once cleared
+static const size_t KeptCapacity = 64;
+
+template <typename List> static void clearList( List& list ) {
+	if ( list.capacity() > KeptCapacity ) {
+		List().swap( list );
+	} else {
+		list.clear();
+	}
+}
+
 void DirectorySnapshotDiff::clear() {
-	FilesCreated.clear();
-	FilesModified.clear();
-	FilesMoved.clear();
-	FilesDeleted.clear();
-	DirsCreated.clear();
-	DirsModified.clear();
-	DirsMoved.clear();
-	DirsDeleted.clear();
+	clearList( FilesCreated );
+	clearList( FilesModified );
+	clearList( FilesMoved );
+	clearList( FilesDeleted );
+	clearList( DirsCreated );
+	clearList( DirsModified );
+	clearList( DirsMoved );
+	clearList( DirsDeleted );
 }
 
 bool DirectorySnapshotDiff::changed() {
@@ -17,6 +17,7 @@ class DirectorySnapshotDiff {
 	MovedList DirsMoved;
 	bool DirChanged;
 
+	/// Empties the lists, keeping the storage of the small ones for the next diff
 	void clear();
 
 	bool changed();
@@ -0,0 +1,114 @@
+#include <efsw/EventBatch.hpp>
+#include <efsw/Trace.hpp>
+
+namespace efsw {
+
+EventBatch::EventBatch() : mCaptured( 0 ) {}
+
+void EventBatch::capture( Uint64 time ) {
+	mCaptured = time;
+}
+
+size_t EventBatch::append( std::string_view text ) {
+	size_t offset = mText.size();
+	mText.append( text.data(), text.size() );
+	return offset;
+}
+
+void EventBatch::add( FileWatchListener* listener, WatchID watchid, std::string_view dir,
+					  std::string_view filename, Action action, std::string_view oldFilename,
+					  Uint64 captured ) {
+	Entry entry;
+	entry.Listener = listener;
+	entry.ID = watchid;
+	entry.Kind = action;
+	entry.DirLength = dir.size();
+	entry.Captured = captured;
+
+#ifdef EFSW_TRACING
+	if ( 0 == captured ) {
+		if ( 0 == mCaptured ) {
+			mCaptured = traceTime();
+		}
+
+		entry.Captured = mCaptured;
+	}
+#endif
+
+	/// The events of a buffer usually come from a few directories, consecutive ones share it
+	if ( !mEntries.empty() && mEntries.back().DirLength == dir.size() &&
+		 0 == mText.compare( mEntries.back().Dir, dir.size(), dir.data(), dir.size() ) ) {
+		entry.Dir = mEntries.back().Dir;
+	} else {
+		entry.Dir = append( dir );
+	}
+
+	entry.FilenameLength = filename.size();
+	entry.Filename = append( filename );
+	entry.OldFilenameLength = oldFilename.size();
+	entry.OldFilename = append( oldFilename );
+
+	mEntries.push_back( entry );
+}
+
+void EventBatch::flush() {
+	if ( mEntries.empty() ) {
+		mCaptured = 0;
+		return;
+	}
+
+	/// The views are built once the text buffer stopped growing
+	const char* text = mText.data();
+
+	mEvents.resize( mEntries.size() );
+
+	for ( size_t i = 0; i < mEntries.size(); i++ ) {
+		const Entry& entry = mEntries[i];
+		Event& event = mEvents[i];
+
+		event.watchid = entry.ID;
+		event.dir = std::string_view( text + entry.Dir, entry.DirLength );
+		event.filename = std::string_view( text + entry.Filename, entry.FilenameLength );
+		event.action = entry.Kind;
+		event.oldFilename = std::string_view( text + entry.OldFilename, entry.OldFilenameLength );
+		event.captured = entry.Captured;
+	}
+
+	for ( size_t start = 0; start < mEntries.size(); ) {
+		size_t end = start + 1;
+
+		while ( end < mEntries.size() && mEntries[end].Listener == mEntries[start].Listener ) {
+			end++;
+		}
+
+		mEntries[start].Listener->handleFileActions( &mEvents[start], end - start );
+
+		start = end;
+	}
+
+	mEntries.clear();
+	mEvents.clear();
+	mText.clear();
+	mCaptured = 0;
+}
+
+bool EventBatch::empty() const {
+	return mEntries.empty();
+}
+
+void EventBatch::send( FileWatchListener* listener, WatchID watchid, std::string_view dir,
+					   std::string_view filename, Action action, std::string_view oldFilename ) {
+	Event event;
+	event.watchid = watchid;
+	event.dir = dir;
+	event.filename = filename;
+	event.action = action;
+	event.oldFilename = oldFilename;
+#ifdef EFSW_TRACING
+	event.captured = traceTime();
+#endif
+
+	listener->handleFileActions( &event, 1 );
+}
+
+} // namespace efsw
@@ -0,0 +1,71 @@
+#ifndef EFSW_EVENTBATCH_HPP
+#define EFSW_EVENTBATCH_HPP
+
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace efsw {
+
+/// Collects the events of a backend buffer to deliver them with a single
+/// FileWatchListener::handleFileActions call per run of consecutive events of the same listener.
+/// The strings are copied into buffers reused between batches, so the steady state doesn't
+/// allocate. Not thread safe, the backends fill and flush it from their event loop.
+class EventBatch {
+  public:
+	EventBatch();
+
+	/// Queues an event for the listener
+	/// @param captured When the event was read ( see Event::captured ), 0 for the time the batch
+	/// was captured
+	void add( FileWatchListener* listener, WatchID watchid, std::string_view dir,
+			  std::string_view filename, Action action, std::string_view oldFilename = {},
+			  Uint64 captured = 0 );
+
+	/// Sets when the events queued next were read ( a traceTime ), by default the time the first
+	/// one is queued. Only used when built with EFSW_TRACING.
+	void capture( Uint64 time );
+
+	/// Delivers the events queued and empties the batch
+	void flush();
+
+	bool empty() const;
+
+	/// Delivers a single event as a batch of one, for the backends that don't batch
+	static void send( FileWatchListener* listener, WatchID watchid, std::string_view dir,
+					  std::string_view filename, Action action,
+					  std::string_view oldFilename = {} );
+
+  protected:
+	struct Entry {
+		FileWatchListener* Listener;
+		WatchID ID;
+		Action Kind;
+		size_t Dir;
+		size_t DirLength;
+		size_t Filename;
+		size_t FilenameLength;
+		size_t OldFilename;
+		size_t OldFilenameLength;
+		Uint64 Captured;
+	};
+
+	/// The strings of the events queued, one after the other
+	std::string mText;
+
+	std::vector<Entry> mEntries;
+
+	/// The events of the flush in progress, pointing into mText
+	std::vector<Event> mEvents;
+
+	/// When the events of the batch were read
+	Uint64 mCaptured;
+
+	size_t append( std::string_view text );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,308 @@
+#include <efsw/EventCoalescer.hpp>
+#include <efsw/Lock.hpp>
+#include <algorithm>
+
+namespace efsw {
+
+CoalescingListener::CoalescingListener( EventCoalescer* coalescer, FileWatchListener* listener,
+										const std::string& directory, long window ) :
+	WatchStage( listener, directory ),
+	mCoalescer( coalescer ),
+	mWindow( std::chrono::milliseconds( window ) ),
+	mAdded( 0 ),
+	mCollected( 0 ) {
+	mCoalescer->add( this );
+}
+
+CoalescingListener::~CoalescingListener() {
+	mCoalescer->remove( this );
+}
+
+Uint64 CoalescingListener::coalesced() {
+	Lock lock( mCoalescer->mMutex );
+
+	/// The events pending aren't merged yet, they may still be delivered as they are
+	Uint64 pending = 0;
+
+	for ( EntryList::iterator it = mQueue.begin(); it != mQueue.end(); ++it ) {
+		pending += it->Modified ? 2 : 1;
+	}
+
+	Uint64 kept = mCollected + pending;
+
+	return mAdded > kept ? mAdded - kept : 0;
+}
+
+void CoalescingListener::handleFileActions( const Event* events, size_t count ) {
+	bool notify;
+
+	{
+		Lock lock( mCoalescer->mMutex );
+
+		Clock::time_point now = Clock::now();
+		bool idle = mQueue.empty();
+
+		for ( size_t i = 0; i < count; i++ ) {
+			add( events[i], now );
+		}
+
+		mAdded += count;
+
+		/// The thread only needs to wake up if the earliest deadline of the watch moved closer
+		notify = !mQueue.empty() && ( idle || mQueue.front().Deadline <= now );
+	}
+
+	if ( notify ) {
+		mCoalescer->mCondition.notify_one();
+	}
+}
+
+void CoalescingListener::add( const Event& event, Clock::time_point now ) {
+	if ( Actions::Overflow == event.action || Actions::HistoryDone == event.action ) {
+		/// The changes pending are delivered before the notification, right away
+		for ( EntryList::iterator it = mQueue.begin(); it != mQueue.end(); ++it ) {
+			it->Deadline = now;
+		}
+
+		mQueue.push_back( Entry() );
+
+		Entry& overflow = mQueue.back();
+		overflow.ID = event.watchid;
+		overflow.Dir.assign( event.dir );
+		overflow.Kind = event.action;
+		overflow.Modified = false;
+		overflow.Deadline = now;
+		overflow.Captured = event.captured;
+		return;
+	}
+
+	Entry entry;
+	entry.ID = event.watchid;
+	entry.Dir.assign( event.dir );
+	entry.Filename.assign( event.filename );
+	entry.Kind = event.action;
+	entry.Modified = false;
+	entry.Key = entry.Dir + entry.Filename;
+	entry.Captured = event.captured;
+
+	if ( Actions::Moved == event.action ) {
+		entry.OldFilename.assign( event.oldFilename );
+
+		/// The pending change of the old name follows the file to its new name
+		std::unordered_map<std::string, EntryList::iterator>::iterator old =
+			mIndex.find( entry.Dir + entry.OldFilename );
+
+		if ( old != mIndex.end() ) {
+			Entry& prev = *old->second;
+
+			if ( Actions::Add == prev.Kind ) {
+				/// Created and renamed, it's new under its last name
+				entry.Kind = Actions::Add;
+				entry.OldFilename.clear();
+			} else if ( Actions::Modified == prev.Kind ) {
+				entry.Modified = true;
+			} else if ( Actions::Moved == prev.Kind ) {
+				entry.OldFilename = prev.OldFilename;
+				entry.Modified = prev.Modified;
+			}
+
+			erase( old->second );
+
+			/// Renamed back to its original name
+			if ( Actions::Moved == entry.Kind && entry.OldFilename == entry.Filename ) {
+				if ( !entry.Modified )
+					return;
+
+				entry.Kind = Actions::Modified;
+				entry.OldFilename.clear();
+				entry.Modified = false;
+			}
+		}
+	}
+
+	Clock::time_point deadline = now + mWindow;
+	std::unordered_map<std::string, EntryList::iterator>::iterator cur = mIndex.find( entry.Key );
+
+	if ( cur == mIndex.end() ) {
+		entry.Deadline = deadline;
+		mQueue.push_back( std::move( entry ) );
+		mIndex[mQueue.back().Key] = std::prev( mQueue.end() );
+		return;
+	}
+
+	EntryList::iterator it = cur->second;
+	Entry& prev = *it;
+
+	if ( Actions::Moved == entry.Kind ) {
+		/// Renamed over a path with changes pending, the rename is what's left of it
+		prev.Kind = Actions::Moved;
+		prev.OldFilename.swap( entry.OldFilename );
+		prev.Modified = entry.Modified;
+	} else if ( Actions::Delete == entry.Kind ) {
+		if ( Actions::Add == prev.Kind ) {
+			/// Created and deleted, nothing to report
+			erase( it );
+			return;
+		}
+
+		if ( Actions::Moved == prev.Kind ) {
+			/// Renamed and deleted, the file is gone from its original name
+			std::string oldKey( prev.Dir + prev.OldFilename );
+			std::unordered_map<std::string, EntryList::iterator>::iterator old =
+				mIndex.find( oldKey );
+
+			entry.Filename = prev.OldFilename;
+			entry.Key = oldKey;
+			entry.Captured = prev.Captured;
+
+			erase( it );
+
+			if ( old != mIndex.end() ) {
+				/// The original name was taken again meanwhile, by now it was replaced
+				if ( Actions::Add == old->second->Kind ) {
+					old->second->Kind = Actions::Modified;
+				}
+
+				return;
+			}
+
+			entry.Deadline = deadline;
+			mQueue.push_back( std::move( entry ) );
+			mIndex[mQueue.back().Key] = std::prev( mQueue.end() );
+			return;
+		}
+
+		prev.Kind = Actions::Delete;
+		prev.Modified = false;
+	} else if ( Actions::Moved == prev.Kind ) {
+		prev.Modified = true;
+	} else if ( Actions::Delete == prev.Kind ||
+				( Actions::Add == entry.Kind && Actions::Modified == prev.Kind ) ) {
+		/// Deleted and created again, the file was replaced
+		prev.Kind = Actions::Modified;
+	}
+
+	prev.ID = entry.ID;
+
+	touch( it, deadline );
+}
+
+void CoalescingListener::touch( EntryList::iterator it, Clock::time_point deadline ) {
+	mQueue.splice( mQueue.end(), mQueue, it );
+	it->Deadline = deadline;
+}
+
+void CoalescingListener::erase( EntryList::iterator it ) {
+	mIndex.erase( it->Key );
+	mQueue.erase( it );
+}
+
+void CoalescingListener::collect( EventBatch& batch, Clock::time_point now ) {
+	while ( !mQueue.empty() && mQueue.front().Deadline <= now ) {
+		Entry& entry = mQueue.front();
+
+		mCollected += entry.Modified ? 2 : 1;
+
+		if ( Actions::Overflow == entry.Kind || Actions::HistoryDone == entry.Kind ) {
+			batch.add( mListener, entry.ID, entry.Dir, "", entry.Kind, {}, entry.Captured );
+		} else {
+			batch.add( mListener, entry.ID, entry.Dir, entry.Filename, entry.Kind,
+					   entry.OldFilename, entry.Captured );
+
+			if ( entry.Modified ) {
+				batch.add( mListener, entry.ID, entry.Dir, entry.Filename, Actions::Modified, {},
+						   entry.Captured );
+			}
+
+			mIndex.erase( entry.Key );
+		}
+
+		mQueue.pop_front();
+	}
+}
+
+EventCoalescer::EventCoalescer() : mThread( NULL ), mRunning( true ) {}
+
+EventCoalescer::~EventCoalescer() {
+	{
+		Lock lock( mMutex );
+		mRunning = false;
+	}
+
+	mCondition.notify_all();
+
+	efSAFE_DELETE( mThread );
+}
+
+void EventCoalescer::add( CoalescingListener* listener ) {
+	Lock lock( mMutex );
+
+	mListeners.push_back( listener );
+
+	if ( NULL == mThread ) {
+		mThread = new Thread( [this] { run(); } );
+		mThread->launch();
+	}
+}
+
+void EventCoalescer::remove( CoalescingListener* listener ) {
+	Lock deliveryLock( mDeliveryLock );
+	Lock lock( mMutex );
+
+	mListeners.erase( std::find( mListeners.begin(), mListeners.end(), listener ) );
+}
+
+bool EventCoalescer::nextDeadlineLocked( CoalescingListener::Clock::time_point& deadline ) {
+	bool found = false;
+
+	for ( size_t i = 0; i < mListeners.size(); i++ ) {
+		CoalescingListener::EntryList& queue = mListeners[i]->mQueue;
+
+		if ( !queue.empty() && ( !found || queue.front().Deadline < deadline ) ) {
+			deadline = queue.front().Deadline;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+void EventCoalescer::run() {
+	while ( true ) {
+		{
+			Lock lock( mMutex );
+			CoalescingListener::Clock::time_point deadline;
+
+			while ( mRunning ) {
+				if ( !nextDeadlineLocked( deadline ) ) {
+					mCondition.wait( lock );
+				} else if ( deadline > CoalescingListener::Clock::now() ) {
+					mCondition.wait_until( lock, deadline );
+				} else {
+					break;
+				}
+			}
+
+			if ( !mRunning )
+				return;
+		}
+
+		/// The listeners are called without holding mMutex, so the backends keep queueing events
+		/// meanwhile
+		Lock deliveryLock( mDeliveryLock );
+
+		{
+			Lock lock( mMutex );
+
+			CoalescingListener::Clock::time_point now = CoalescingListener::Clock::now();
+
+			for ( size_t i = 0; i < mListeners.size(); i++ ) {
+				mListeners[i]->collect( mBatch, now );
+			}
+		}
+
+		mBatch.flush();
+	}
+}
+
+} // namespace efsw
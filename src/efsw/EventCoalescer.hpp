@@ -0,0 +1,132 @@
+#ifndef EFSW_EVENTCOALESCER_HPP
+#define EFSW_EVENTCOALESCER_HPP
+
+#include <efsw/EventBatch.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/Thread.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+class EventCoalescer;
+
+/// Listener placed between a backend and the listener of a watch with Options::CoalesceWindow.
+/// The events of a path are merged until the path stays quiet for the window, then delivered
+/// from the thread of the coalescer: repeated modifications collapse into one, a file created
+/// and modified is reported as added, a file created and deleted isn't reported at all, and a
+/// file deleted and created again is reported as modified. The paths are delivered in the order
+/// their last change happened, so the events of a path keep their order.
+class CoalescingListener : public WatchStage {
+  public:
+	typedef std::chrono::steady_clock Clock;
+
+	CoalescingListener( EventCoalescer* coalescer, FileWatchListener* listener,
+						const std::string& directory, long window );
+
+	/// Drops the pending events. Once deleted no event of the watch is being delivered, nor will
+	/// be.
+	~CoalescingListener();
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// @return The events merged into others or dropped as cancelled out
+	Uint64 coalesced();
+
+  protected:
+	friend class EventCoalescer;
+
+	/// The net change of a path pending to be delivered
+	struct Entry {
+		std::string Key;
+		WatchID ID;
+		std::string Dir;
+		std::string Filename;
+		std::string OldFilename;
+		Action Kind;
+		/// A moved file was also modified, a Modified follows the Moved
+		bool Modified;
+		Clock::time_point Deadline;
+		/// When the first change merged was read, see Event::captured
+		Uint64 Captured;
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	EventCoalescer* mCoalescer;
+
+	Clock::duration mWindow;
+
+	/// The pending entries in the order of their last change, so in the order of their deadline
+	EntryList mQueue;
+
+	/// The pending entry of every path ( the overflow notifications aren't indexed )
+	std::unordered_map<std::string, EntryList::iterator> mIndex;
+
+	/// The events received and the events delivered, for EventCoalescer::coalesced
+	Uint64 mAdded;
+	Uint64 mCollected;
+
+	/// Merges the event into the pending entries, holding the lock of the coalescer
+	void add( const Event& event, Clock::time_point now );
+
+	/// Moves the entry to the end of the queue, waiting for another quiet window
+	void touch( EntryList::iterator it, Clock::time_point deadline );
+
+	void erase( EntryList::iterator it );
+
+	/// Queues the entries whose window expired in the batch, holding the lock of the coalescer
+	void collect( EventBatch& batch, Clock::time_point now );
+};
+
+/// The thread delivering the events of the coalescing listeners of a FileWatcher, started once
+/// the first one is created. The listeners are owned by the stage chains of their watches.
+class EventCoalescer {
+  public:
+	EventCoalescer();
+
+	/// The listeners must be deleted already
+	~EventCoalescer();
+
+  protected:
+	friend class CoalescingListener;
+
+	/// The listeners delivered from the thread
+	std::vector<CoalescingListener*> mListeners;
+
+	/// Guards the listeners and their pending entries
+	Mutex mMutex;
+
+	/// Held while delivering, so a release waits for the delivery in progress
+	Mutex mDeliveryLock;
+
+	std::condition_variable mCondition;
+
+	Thread* mThread;
+
+	bool mRunning;
+
+	/// The events being delivered ( guarded by mDeliveryLock )
+	EventBatch mBatch;
+
+	void run();
+
+	/// @return True if an entry is pending, with the earliest deadline set
+	bool nextDeadlineLocked( CoalescingListener::Clock::time_point& deadline );
+
+	void add( CoalescingListener* listener );
+
+	/// Waits for the delivery in progress, then stops delivering the events of the listener
+	void remove( CoalescingListener* listener );
+};
+
+} // namespace efsw
+
+#endif
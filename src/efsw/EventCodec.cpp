@@ -0,0 +1,515 @@
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <errno.h>
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace efsw {
+
+/// The flags byte of an event: the action in the low bits, then what it shares with the previous
+/// event of the frame
+#define CODEC_ACTION_MASK 0x0F
+#define CODEC_SAME_WATCH 0x10
+#define CODEC_SAME_DIR 0x20
+#define CODEC_OLD_NAME 0x40
+#define CODEC_SEQUENCE_GAP 0x80
+
+/// The longest varint, of a 64 bits value
+#define CODEC_VARINT_MAX 10
+
+/// The bytes reserved in front of a frame for its length
+#define CODEC_LENGTH_RESERVED 5
+
+const uint8_t EventCodec::VERSION;
+const size_t EventCodec::INVALID;
+const size_t EventCodec::MAX_FRAME;
+
+namespace {
+
+void putVarint( std::string& buffer, uint64_t value ) {
+	char bytes[CODEC_VARINT_MAX];
+	size_t size = 0;
+
+	while ( value >= 0x80 ) {
+		bytes[size++] = (char)( ( value & 0x7F ) | 0x80 );
+		value >>= 7;
+	}
+
+	bytes[size++] = (char)value;
+	buffer.append( bytes, size );
+}
+
+/// Signed values are zigzagged, so a small negative one stays short
+uint64_t zigzag( int64_t value ) {
+	return ( (uint64_t)value << 1 ) ^ (uint64_t)( value >> 63 );
+}
+
+int64_t unzigzag( uint64_t value ) {
+	return (int64_t)( value >> 1 ) ^ -(int64_t)( value & 1 );
+}
+
+size_t sharedPrefix( std::string_view a, std::string_view b ) {
+	size_t size = a.size() < b.size() ? a.size() : b.size();
+	size_t i = 0;
+
+	while ( i < size && a[i] == b[i] ) {
+		i++;
+	}
+
+	return i;
+}
+
+/// A string as the length it shares with the previous one, then the rest of it
+void putString( std::string& buffer, std::string_view value, std::string_view previous ) {
+	size_t shared = sharedPrefix( value, previous );
+
+	putVarint( buffer, shared );
+	putVarint( buffer, value.size() - shared );
+	buffer.append( value.data() + shared, value.size() - shared );
+}
+
+/// Reads the data of a frame, failing for good once it ran past its end
+class Reader {
+  public:
+	Reader( const char* data, size_t size ) : mData( data ), mEnd( data + size ), mOK( true ) {}
+
+	bool ok() const { return mOK; }
+
+	bool done() const { return mData == mEnd; }
+
+	size_t left() const { return mEnd - mData; }
+
+	uint8_t byte() {
+		if ( mData == mEnd ) {
+			mOK = false;
+			return 0;
+		}
+
+		return (uint8_t)*mData++;
+	}
+
+	uint64_t varint() {
+		uint64_t value = 0;
+
+		for ( int shift = 0; shift < 64; shift += 7 ) {
+			uint8_t b = byte();
+			value |= (uint64_t)( b & 0x7F ) << shift;
+
+			if ( 0 == ( b & 0x80 ) )
+				return value;
+		}
+
+		mOK = false;
+		return 0;
+	}
+
+	/// Reads a string written against the previous one, which it replaces
+	void string( std::string& value, const std::string& previous ) {
+		uint64_t shared = varint();
+		uint64_t size = varint();
+
+		if ( !mOK || shared > previous.size() || size > left() ) {
+			mOK = false;
+			return;
+		}
+
+		value.assign( previous, 0, (size_t)shared );
+		value.append( mData, (size_t)size );
+		mData += size;
+	}
+
+  protected:
+	const char* mData;
+	const char* mEnd;
+	bool mOK;
+};
+
+/// Encodes the events, the sequence of each one given by the functor
+template <typename E, typename S>
+void encodeFrame( const E* events, size_t count, S sequenceOf, std::string& buffer ) {
+	/// The body is written after room for its length, moved back once it's known
+	size_t start = buffer.size();
+	buffer.append( CODEC_LENGTH_RESERVED, '\0' );
+	size_t body = buffer.size();
+
+	uint64_t first = count > 0 ? sequenceOf( events[0] ) : 0;
+
+	buffer.push_back( (char)EventCodec::VERSION );
+	putVarint( buffer, count );
+	putVarint( buffer, first );
+
+	uint64_t expected = first;
+
+	for ( size_t i = 0; i < count; i++ ) {
+		const E& event = events[i];
+		uint64_t sequence = sequenceOf( event );
+		uint8_t flags = (uint8_t)event.action & CODEC_ACTION_MASK;
+
+		if ( sequence != expected ) {
+			flags |= CODEC_SEQUENCE_GAP;
+		}
+
+		if ( i > 0 && event.watchid == events[i - 1].watchid ) {
+			flags |= CODEC_SAME_WATCH;
+		}
+
+		std::string_view dir( event.dir );
+		std::string_view previousDir( i > 0 ? std::string_view( events[i - 1].dir )
+											: std::string_view() );
+
+		if ( i > 0 && dir == previousDir ) {
+			flags |= CODEC_SAME_DIR;
+		}
+
+		if ( !std::string_view( event.oldFilename ).empty() ) {
+			flags |= CODEC_OLD_NAME;
+		}
+
+		buffer.push_back( (char)flags );
+
+		if ( flags & CODEC_SEQUENCE_GAP ) {
+			/// Signed, a journal gap starts back at the first event lost
+			putVarint( buffer, zigzag( (int64_t)( sequence - expected ) ) );
+		}
+
+		if ( !( flags & CODEC_SAME_WATCH ) ) {
+			putVarint( buffer, zigzag( (int64_t)event.watchid ) );
+		}
+
+		if ( !( flags & CODEC_SAME_DIR ) ) {
+			putString( buffer, dir, previousDir );
+		}
+
+		std::string_view filename( event.filename );
+
+		putString( buffer, filename,
+				   i > 0 ? std::string_view( events[i - 1].filename ) : std::string_view() );
+
+		/// A moved file mostly keeps a part of its name
+		if ( flags & CODEC_OLD_NAME ) {
+			putString( buffer, event.oldFilename, filename );
+		}
+
+		expected = sequence + 1;
+	}
+
+	/// The length as a varint right in front of the body
+	std::string length;
+	putVarint( length, buffer.size() - body );
+
+	size_t offset = body - length.size();
+	buffer.replace( offset, length.size(), length );
+	buffer.erase( start, offset - start );
+}
+
+} // namespace
+
+void EventCodec::encode( const Event* events, size_t count, uint64_t sequence,
+						 std::string& buffer ) {
+	encodeFrame(
+		events, count,
+		[events, sequence]( const Event& event ) { return sequence + ( &event - events ); },
+		buffer );
+}
+
+void EventCodec::encode( const JournalEvent* events, size_t count, std::string& buffer ) {
+	encodeFrame( events, count, []( const JournalEvent& event ) { return event.sequence; },
+				 buffer );
+}
+
+void EventCodec::encode( const JournalView* events, size_t count, std::string& buffer ) {
+	encodeFrame( events, count, []( const JournalView& event ) { return event.sequence; },
+				 buffer );
+}
+
+size_t EventCodec::decode( const char* data, size_t size, std::vector<JournalEvent>& events ) {
+	Reader header( data, size < CODEC_VARINT_MAX ? size : CODEC_VARINT_MAX );
+	uint64_t length = header.varint();
+
+	if ( !header.ok() ) {
+		/// Either the length isn't all there yet, or it's longer than the room reserved for it
+		return size < CODEC_LENGTH_RESERVED ? 0 : INVALID;
+	}
+
+	if ( length > MAX_FRAME )
+		return INVALID;
+
+	size_t lengthSize = ( size < CODEC_VARINT_MAX ? size : CODEC_VARINT_MAX ) - header.left();
+
+	if ( length > size - lengthSize )
+		return 0;
+
+	Reader reader( data + lengthSize, (size_t)length );
+
+	if ( VERSION != reader.byte() )
+		return INVALID;
+
+	uint64_t count = reader.varint();
+	uint64_t sequence = reader.varint();
+
+	/// Every event takes 3 bytes at least, its flags and the lengths of its name
+	if ( !reader.ok() || count > reader.left() / 3 )
+		return INVALID;
+
+	events.resize( (size_t)count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		JournalEvent& event = events[i];
+		uint8_t flags = reader.byte();
+
+		if ( flags & CODEC_SEQUENCE_GAP ) {
+			sequence += (uint64_t)unzigzag( reader.varint() );
+		}
+
+		event.sequence = sequence++;
+		event.action = (Action)( flags & CODEC_ACTION_MASK );
+
+		if ( flags & CODEC_SAME_WATCH ) {
+			if ( 0 == i )
+				return INVALID;
+
+			event.watchid = events[i - 1].watchid;
+		} else {
+			event.watchid = (WatchID)unzigzag( reader.varint() );
+		}
+
+		static const std::string none;
+		const std::string& previousDir = i > 0 ? events[i - 1].dir : none;
+
+		if ( flags & CODEC_SAME_DIR ) {
+			if ( 0 == i )
+				return INVALID;
+
+			event.dir.assign( previousDir );
+		} else {
+			reader.string( event.dir, previousDir );
+		}
+
+		reader.string( event.filename, i > 0 ? events[i - 1].filename : none );
+
+		if ( flags & CODEC_OLD_NAME ) {
+			reader.string( event.oldFilename, event.filename );
+		} else {
+			event.oldFilename.clear();
+		}
+
+		if ( !reader.ok() )
+			return INVALID;
+	}
+
+	if ( !reader.done() )
+		return INVALID;
+
+	return lengthSize + (size_t)length;
+}
+
+const size_t EventStreamSink::DEFAULT_CAPACITY;
+
+EventStreamSink::EventStreamSink( int fd, FileWatchListener* listener, size_t capacity ) :
+	mFD( fd ),
+	mSocket( false ),
+	mListener( listener ),
+	mCapacity( capacity ),
+	mRunning( true ),
+	mSequence( 1 ),
+	mDropped( 0 ),
+	mError( 0 ) {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	struct stat st;
+
+	mSocket = 0 == fstat( mFD, &st ) && S_ISSOCK( st.st_mode );
+#endif
+
+	mWriter = std::thread( [this] { run(); } );
+}
+
+EventStreamSink::~EventStreamSink() {
+	{
+		Lock lock( mMutex );
+		mRunning = false;
+	}
+
+	mWake.notify_one();
+	mWriter.join();
+}
+
+void EventStreamSink::handleFileEvent( WatchID watchid, std::string_view dir,
+									   std::string_view filename, Action action,
+									   std::string_view oldFilename ) {
+	Event event;
+	event.watchid = watchid;
+	event.dir = dir;
+	event.filename = filename;
+	event.action = action;
+	event.oldFilename = oldFilename;
+
+	handleFileActions( &event, 1 );
+}
+
+void EventStreamSink::handleFileActions( const Event* events, size_t count ) {
+	if ( count > 0 ) {
+		bool wake = false;
+
+		{
+			Lock lock( mMutex );
+
+			if ( 0 == mError ) {
+				size_t queued = mQueue.size();
+
+				EventCodec::encode( events, count, mSequence, mQueue );
+				mSequence += count;
+
+				/// The sequences go on, the reader sees the gap. A frame the reader can't decode
+				/// is dropped as well.
+				if ( ( queued > 0 && mQueue.size() > mCapacity ) ||
+					 mQueue.size() - queued > EventCodec::MAX_FRAME ) {
+					mQueue.resize( queued );
+					mDropped += count;
+				} else {
+					wake = 0 == queued;
+				}
+			}
+		}
+
+		if ( wake ) {
+			mWake.notify_one();
+		}
+	}
+
+	if ( NULL != mListener ) {
+		mListener->handleFileActions( events, count );
+	}
+}
+
+void EventStreamSink::handleWatchError( WatchID watchid, Error error, std::string_view path ) {
+	if ( NULL != mListener ) {
+		mListener->handleWatchError( watchid, error, path );
+	}
+}
+
+void EventStreamSink::handleWatchReady( WatchID watchid, size_t directories, size_t failures ) {
+	if ( NULL != mListener ) {
+		mListener->handleWatchReady( watchid, directories, failures );
+	}
+}
+
+uint64_t EventStreamSink::sequence() {
+	Lock lock( mMutex );
+
+	return mSequence;
+}
+
+int EventStreamSink::error() {
+	Lock lock( mMutex );
+
+	return mError;
+}
+
+uint64_t EventStreamSink::dropped() {
+	Lock lock( mMutex );
+
+	return mDropped;
+}
+
+void EventStreamSink::run() {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	/// A pipe whose reader is gone raises SIGPIPE on the thread writing, blocked so the write
+	/// fails with EPIPE instead
+	sigset_t pipe;
+	sigemptyset( &pipe );
+	sigaddset( &pipe, SIGPIPE );
+	pthread_sigmask( SIG_BLOCK, &pipe, NULL );
+#endif
+
+	Lock lock( mMutex );
+
+	while ( true ) {
+		mWake.wait( lock, [this] { return !mRunning || !mQueue.empty(); } );
+
+		if ( mQueue.empty() || 0 != mError )
+			break;
+
+		mWriting.clear();
+		mWriting.swap( mQueue );
+
+		lock.unlock();
+		int error = write( mWriting );
+		lock.lock();
+
+		if ( 0 != error ) {
+			mError = error;
+			mQueue.clear();
+		}
+	}
+}
+
+int EventStreamSink::write( const std::string& buffer ) {
+	const char* data = buffer.data();
+	size_t left = buffer.size();
+
+	while ( left > 0 ) {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+		ssize_t written = mSocket ? send( mFD, data, left, MSG_NOSIGNAL )
+								  : ::write( mFD, data, left );
+
+		if ( written < 0 ) {
+			if ( EINTR == errno )
+				continue;
+
+			/// A non blocking descriptor is waited for, only this thread waits
+			if ( EAGAIN == errno || EWOULDBLOCK == errno ) {
+				struct pollfd pfd;
+				pfd.fd = mFD;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+
+				if ( poll( &pfd, 1, -1 ) >= 0 || EINTR == errno )
+					continue;
+			}
+
+			int error = errno;
+
+			/// The SIGPIPE blocked stays pending on the thread, it's taken out
+			if ( EPIPE == error ) {
+				sigset_t pending;
+				sigpending( &pending );
+
+				if ( sigismember( &pending, SIGPIPE ) ) {
+					int signal;
+					sigset_t pipe;
+					sigemptyset( &pipe );
+					sigaddset( &pipe, SIGPIPE );
+					sigwait( &pipe, &signal );
+				}
+			}
+
+			return error;
+		}
+#else
+		int written = _write( mFD, data, left > 0x40000000 ? 0x40000000 : (unsigned int)left );
+
+		if ( written < 0 )
+			return errno;
+#endif
+
+		data += written;
+		left -= (size_t)written;
+	}
+
+	return 0;
+}
+
+} // namespace efsw
@@ -0,0 +1,88 @@
+#include <efsw/EventCounter.hpp>
+#include <efsw/Trace.hpp>
+
+namespace efsw {
+
+CountingListener::CountingListener( FileWatcher* watcher, FileWatchListener* listener,
+									const std::string& directory ) :
+	WatchStage( listener, directory ),
+	mWatcher( watcher ),
+	mDelivered( 0 ),
+	mOverflows( 0 ),
+	mCreated( std::chrono::steady_clock::now() ),
+	mCrawledAt( 0 ),
+	mCrawlTime( 0 ) {}
+
+void CountingListener::attach( WatchID watchid ) {
+	WatchStage::attach( watchid );
+
+	mCrawlTime = std::chrono::duration_cast<std::chrono::microseconds>(
+					 std::chrono::steady_clock::now() - mCreated )
+					 .count();
+	mCrawledAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+					 std::chrono::system_clock::now().time_since_epoch() )
+					 .count();
+}
+
+void CountingListener::handleFileActions( const Event* events, size_t count ) {
+	Uint64 overflows = 0;
+
+	for ( size_t i = 0; i < count; i++ ) {
+		if ( Actions::Overflow == events[i].action ) {
+			overflows++;
+		}
+	}
+
+	mDelivered.fetch_add( count, std::memory_order_relaxed );
+
+	if ( overflows > 0 ) {
+		mOverflows.fetch_add( overflows, std::memory_order_relaxed );
+	}
+
+#ifdef EFSW_TRACING
+	Uint64 now = traceTime();
+
+	for ( size_t i = 0; i < count; i++ ) {
+		/// The overflows and the events of the snapshots weren't read from the backend
+		if ( 0 != events[i].captured && events[i].captured <= now ) {
+			mLatency.record( now - events[i].captured );
+		}
+	}
+
+	TraceHooks* hooks = mWatcher->traceHooks();
+
+	if ( NULL != hooks ) {
+		hooks->onDeliveryBegin( events, count, now );
+	}
+
+	mListener->handleFileActions( events, count );
+
+	Uint64 end = traceTime();
+
+	mListenerTime.record( end - now );
+
+	if ( NULL != hooks ) {
+		hooks->onDeliveryEnd( events, count, end );
+	}
+#else
+	mListener->handleFileActions( events, count );
+#endif
+}
+
+void CountingListener::stats( WatchStats& stats ) const {
+	stats.delivered = mDelivered.load( std::memory_order_relaxed );
+	stats.overflows = mOverflows.load( std::memory_order_relaxed );
+	stats.lastCrawl = mCrawledAt;
+	stats.crawlTime = mCrawlTime;
+}
+
+#ifdef EFSW_TRACING
+void CountingListener::latency( LatencyStats& stats, bool listenerTime ) const {
+	stats = listenerTime ? mListenerTime.stats() : mLatency.stats();
+}
+#else
+/// Nothing is measured, the stats are left as they are
+void CountingListener::latency( LatencyStats&, bool ) const {}
+#endif
+
+} // namespace efsw
@@ -0,0 +1,56 @@
+#ifndef EFSW_EVENTCOUNTER_HPP
+#define EFSW_EVENTCOUNTER_HPP
+
+#include <efsw/LatencyHistogram.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace efsw {
+
+/// Listener placed right in front of the listener of every watch, after the other stages, so it
+/// counts the events as the listener sees them. The batches are passed through as they are.
+/// Built with EFSW_TRACING it also times the batches and reports them to the trace hooks.
+class CountingListener : public WatchStage {
+  public:
+	CountingListener( FileWatcher* watcher, FileWatchListener* listener,
+					  const std::string& directory );
+
+	/// Takes the time the backend took to add the watch, since the stage was created
+	void attach( WatchID watchid ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// Sets the counters of the listener in the stats
+	void stats( WatchStats& stats ) const;
+
+	/// Sets the latencies of the events, or the times the listener took
+	void latency( LatencyStats& stats, bool listenerTime ) const;
+
+  protected:
+	FileWatcher* mWatcher;
+
+	std::atomic<Uint64> mDelivered;
+	std::atomic<Uint64> mOverflows;
+
+	std::chrono::steady_clock::time_point mCreated;
+
+	/// When the watch was added, in milliseconds since the epoch, and the time the backend took
+	/// to crawl it, in microseconds. Set once attached, before the stage can be queried.
+	Uint64 mCrawledAt;
+	Uint64 mCrawlTime;
+
+#ifdef EFSW_TRACING
+	/// From the capture of the events to their delivery
+	LatencyHistogram mLatency;
+	/// The times the listener took to return
+	LatencyHistogram mListenerTime;
+#endif
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,448 @@
+#include <efsw/EventDispatcher.hpp>
+#include <efsw/Lock.hpp>
+#include <algorithm>
+#include <chrono>
+
+namespace efsw {
+
+/// Maximum number of events delivered in a single call to the listener
+static const size_t MAX_BATCH = 256;
+
+AsyncListener::AsyncListener( EventDispatcher* dispatcher, FileWatchListener* listener,
+							  const std::string& directory, size_t capacity, QueuePolicy policy,
+							  int rate, int burst, RatePolicy ratePolicy ) :
+	WatchStage( listener, directory ),
+	mDispatcher( dispatcher ),
+	mPolicy( policy ),
+	mConsumer( 0 ),
+	mTail( 0 ),
+	mHead( 0 ),
+	mOverflowed( false ),
+	mDropped( 0 ),
+	mCoalesced( 0 ),
+	mBlocked( 0 ),
+	mLimited( 0 ),
+	mWaiters( 0 ),
+	mHasPending( false ),
+	mRate( rate > 0 ? rate : 0 ),
+	mBurst( burst > 0 ? burst : mRate ),
+	mTokens( mBurst ),
+	mRefilled( Clock::now() ),
+	mRatePolicy( ratePolicy ),
+	mLimitOverflowed( false ) {
+	size_t size = 2;
+
+	while ( size < capacity ) {
+		size *= 2;
+	}
+
+	mSlots = new Slot[size];
+	mMask = size - 1;
+
+	for ( size_t i = 0; i < size; i++ ) {
+		mSlots[i].Sequence.store( i, std::memory_order_relaxed );
+	}
+
+	mDispatcher->add( this );
+}
+
+AsyncListener::~AsyncListener() {
+	mDispatcher->remove( this );
+
+	delete[] mSlots;
+}
+
+void AsyncListener::handleFileActions( const Event* events, size_t count ) {
+	for ( size_t i = 0; i < count; i++ ) {
+		push( events[i] );
+	}
+
+	mDispatcher->signal( this );
+}
+
+DispatchStats AsyncListener::stats() const {
+	DispatchStats stats;
+	size_t tail = mTail.load( std::memory_order_relaxed );
+	size_t head = mHead.load( std::memory_order_relaxed );
+
+	stats.depth = tail > head ? tail - head : 0;
+	stats.capacity = mMask + 1;
+	stats.dropped = mDropped.load( std::memory_order_relaxed );
+	stats.coalesced = mCoalesced.load( std::memory_order_relaxed );
+	stats.blocked = mBlocked.load( std::memory_order_relaxed );
+	stats.limited = mLimited.load( std::memory_order_relaxed );
+
+	return stats;
+}
+
+void AsyncListener::push( const Event& event ) {
+	if ( QueuePolicies::Coalesce == mPolicy && mHasPending.load( std::memory_order_acquire ) ) {
+		addPending( event );
+		return;
+	}
+
+	if ( tryPush( event ) )
+		return;
+
+	switch ( mPolicy ) {
+		case QueuePolicies::DropOldest: {
+			do {
+				size_t pos;
+
+				mDropped++;
+				mOverflowed.store( true, std::memory_order_release );
+
+				/// Every event queued is being delivered, the new one is the one lost
+				if ( !tryPop( pos ) )
+					return;
+
+				release( pos );
+			} while ( !tryPush( event ) );
+
+			break;
+		}
+		case QueuePolicies::Coalesce:
+			addPending( event );
+			break;
+		default: {
+			mBlocked++;
+			mWaiters++;
+
+			/// The events pushed before are delivered meanwhile
+			mDispatcher->signal( this );
+
+			Lock lock( mWaitLock );
+
+			while ( !tryPush( event ) ) {
+				mRoom.wait_for( lock, std::chrono::milliseconds( 10 ) );
+			}
+
+			mWaiters--;
+			break;
+		}
+	}
+}
+
+bool AsyncListener::tryPush( const Event& event ) {
+	size_t pos = mTail.load( std::memory_order_relaxed );
+	Slot* slot;
+
+	while ( true ) {
+		slot = &mSlots[pos & mMask];
+
+		size_t seq = slot->Sequence.load( std::memory_order_acquire );
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if ( 0 == diff ) {
+			if ( mTail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				break;
+		} else if ( diff < 0 ) {
+			return false;
+		} else {
+			pos = mTail.load( std::memory_order_relaxed );
+		}
+	}
+
+	/// The strings keep their capacity between uses of the slot
+	slot->ID = event.watchid;
+	slot->Kind = event.action;
+	slot->Dir.assign( event.dir );
+	slot->Filename.assign( event.filename );
+	slot->OldFilename.assign( event.oldFilename );
+	slot->Captured = event.captured;
+
+	slot->Sequence.store( pos + 1, std::memory_order_release );
+
+	return true;
+}
+
+bool AsyncListener::tryPop( size_t& pos ) {
+	pos = mHead.load( std::memory_order_relaxed );
+
+	while ( true ) {
+		Slot* slot = &mSlots[pos & mMask];
+
+		size_t seq = slot->Sequence.load( std::memory_order_acquire );
+		intptr_t diff = (intptr_t)seq - (intptr_t)( pos + 1 );
+
+		if ( 0 == diff ) {
+			if ( mHead.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				return true;
+		} else if ( diff < 0 ) {
+			return false;
+		} else {
+			pos = mHead.load( std::memory_order_relaxed );
+		}
+	}
+}
+
+void AsyncListener::release( size_t pos ) {
+	mSlots[pos & mMask].Sequence.store( pos + mMask + 1, std::memory_order_release );
+}
+
+void AsyncListener::addPending( const Event& event ) {
+	std::string key( 1, (char)event.action );
+	key.append( event.dir ).append( 1, '\0' ).append( event.filename ).append( 1, '\0' ).append(
+		event.oldFilename );
+
+	Lock lock( mPendingLock );
+
+	if ( mPendingIndex.find( key ) != mPendingIndex.end() ) {
+		mCoalesced++;
+		return;
+	}
+
+	mPendingIndex[key] = mPending.size();
+	mPending.push_back( Pending() );
+
+	Pending& pending = mPending.back();
+	pending.ID = event.watchid;
+	pending.Kind = event.action;
+	pending.Dir.assign( event.dir );
+	pending.Filename.assign( event.filename );
+	pending.OldFilename.assign( event.oldFilename );
+	pending.Captured = event.captured;
+
+	mHasPending.store( true, std::memory_order_release );
+}
+
+bool AsyncListener::takeToken() {
+	if ( 0 == mRate )
+		return true;
+
+	if ( mTokens < 1 ) {
+		Clock::time_point now = Clock::now();
+		double elapsed = std::chrono::duration<double>( now - mRefilled ).count();
+
+		mTokens = std::min( mBurst, mTokens + elapsed * mRate );
+		mRefilled = now;
+
+		if ( mTokens < 1 )
+			return false;
+	}
+
+	mTokens -= 1;
+
+	return true;
+}
+
+void AsyncListener::limit( const std::string& dir ) {
+	mLimited++;
+
+	if ( RatePolicies::Drop == mRatePolicy ) {
+		mLimitOverflowed = true;
+	} else {
+		mSummaries.insert( dir );
+	}
+}
+
+bool AsyncListener::dispatch( Clock::time_point& wake ) {
+	mEvents.clear();
+	mPopped.clear();
+	mTaken.clear();
+	mSummarized.clear();
+
+	bool overflowed = mOverflowed.exchange( false, std::memory_order_acq_rel );
+
+	/// The notices of the events past the limit take a token too, not to flood the listener
+	if ( mLimitOverflowed && takeToken() ) {
+		mLimitOverflowed = false;
+		overflowed = true;
+	}
+
+	if ( overflowed ) {
+		Event overflow;
+		overflow.watchid = mID;
+		overflow.dir = mDirectory;
+		overflow.action = Actions::Overflow;
+		mEvents.push_back( overflow );
+	}
+
+	/// The summaries are of events older than the ones queued
+	while ( !mSummaries.empty() && mSummarized.size() < MAX_BATCH && takeToken() ) {
+		mSummarized.push_back( std::move( mSummaries.extract( mSummaries.begin() ).value() ) );
+	}
+
+	for ( size_t i = 0; i < mSummarized.size(); i++ ) {
+		Event summary;
+		summary.watchid = mID;
+		summary.dir = mSummarized[i];
+		summary.action = Actions::Modified;
+		mEvents.push_back( summary );
+	}
+
+	size_t pos;
+
+	while ( mPopped.size() < MAX_BATCH && tryPop( pos ) ) {
+		const Slot& slot = mSlots[pos & mMask];
+
+		mPopped.push_back( pos );
+
+		if ( !takeToken() ) {
+			limit( slot.Dir );
+			continue;
+		}
+
+		Event event;
+		event.watchid = slot.ID;
+		event.dir = slot.Dir;
+		event.filename = slot.Filename;
+		event.action = slot.Kind;
+		event.oldFilename = slot.OldFilename;
+		event.captured = slot.Captured;
+
+		mEvents.push_back( event );
+	}
+
+	/// The events kept out of the queue are newer than the ones queued
+	if ( mPopped.empty() && mHasPending.load( std::memory_order_acquire ) ) {
+		Lock lock( mPendingLock );
+
+		mTaken.swap( mPending );
+		mPendingIndex.clear();
+		mHasPending.store( false, std::memory_order_release );
+	}
+
+	for ( size_t i = 0; i < mTaken.size(); i++ ) {
+		if ( !takeToken() ) {
+			limit( mTaken[i].Dir );
+			continue;
+		}
+
+		Event event;
+		event.watchid = mTaken[i].ID;
+		event.dir = mTaken[i].Dir;
+		event.filename = mTaken[i].Filename;
+		event.action = mTaken[i].Kind;
+		event.oldFilename = mTaken[i].OldFilename;
+		event.captured = mTaken[i].Captured;
+
+		mEvents.push_back( event );
+	}
+
+	if ( !mSummaries.empty() || mLimitOverflowed ) {
+		Clock::time_point refill =
+			mRefilled + std::chrono::duration_cast<Clock::duration>(
+							std::chrono::duration<double>( ( 1 - mTokens ) / mRate ) );
+
+		wake = std::min( wake, refill );
+	}
+
+	if ( !mEvents.empty() ) {
+		mListener->handleFileActions( mEvents.data(), mEvents.size() );
+	}
+
+	for ( size_t i = 0; i < mPopped.size(); i++ ) {
+		release( mPopped[i] );
+	}
+
+	if ( !mPopped.empty() && mWaiters.load() > 0 ) {
+		Lock lock( mWaitLock );
+		mRoom.notify_all();
+	}
+
+	return !mEvents.empty() || !mPopped.empty() || !mTaken.empty();
+}
+
+EventDispatcher::EventDispatcher() :
+	mConsumers( std::max( 1u, std::thread::hardware_concurrency() / 2 ), NULL ),
+	mRunning( true ),
+	mAssigned( 0 ) {}
+
+EventDispatcher::~EventDispatcher() {
+	mRunning = false;
+
+	for ( size_t i = 0; i < mConsumers.size(); i++ ) {
+		if ( NULL != mConsumers[i] ) {
+			{
+				Lock lock( mConsumers[i]->WakeLock );
+				mConsumers[i]->Wake.notify_all();
+			}
+
+			efSAFE_DELETE( mConsumers[i]->Worker );
+		}
+	}
+
+	for ( size_t i = 0; i < mConsumers.size(); i++ ) {
+		efSAFE_DELETE( mConsumers[i] );
+	}
+}
+
+void EventDispatcher::add( AsyncListener* listener ) {
+	Lock lock( mMutex );
+
+	listener->mConsumer = mAssigned++ % mConsumers.size();
+
+	/// The consumers are never moved, so the producers reach them without locking
+	Consumer*& consumer = mConsumers[listener->mConsumer];
+
+	if ( NULL == consumer ) {
+		Consumer* created = new Consumer();
+		created->Signaled.store( false );
+		created->Worker = new Thread( [this, created] { run( created ); } );
+		created->Worker->launch();
+
+		consumer = created;
+	}
+
+	Lock deliveryLock( consumer->DeliveryLock );
+	consumer->Listeners.push_back( listener );
+}
+
+void EventDispatcher::remove( AsyncListener* listener ) {
+	Consumer* consumer = mConsumers[listener->mConsumer];
+
+	/// Waits for the delivery in progress
+	Lock deliveryLock( consumer->DeliveryLock );
+
+	consumer->Listeners.erase(
+		std::find( consumer->Listeners.begin(), consumer->Listeners.end(), listener ) );
+}
+
+void EventDispatcher::signal( AsyncListener* listener ) {
+	Consumer* consumer = mConsumers[listener->mConsumer];
+
+	if ( !consumer->Signaled.exchange( true ) ) {
+		Lock lock( consumer->WakeLock );
+		consumer->Wake.notify_one();
+	}
+}
+
+void EventDispatcher::run( Consumer* consumer ) {
+	/// When the summaries of a watch over its rate can be delivered
+	AsyncListener::Clock::time_point wake = AsyncListener::Clock::time_point::max();
+
+	while ( mRunning ) {
+		{
+			Lock lock( consumer->WakeLock );
+			auto ready = [&] { return consumer->Signaled.load() || !mRunning; };
+
+			if ( AsyncListener::Clock::time_point::max() == wake ) {
+				consumer->Wake.wait( lock, ready );
+			} else {
+				consumer->Wake.wait_until( lock, wake, ready );
+			}
+		}
+
+		/// Cleared before draining, an event pushed meanwhile signals it again
+		consumer->Signaled.store( false );
+		wake = AsyncListener::Clock::time_point::max();
+
+		Lock deliveryLock( consumer->DeliveryLock );
+
+		/// A batch of each watch in turn, until they're all drained
+		bool more = true;
+
+		while ( more && mRunning ) {
+			more = false;
+
+			for ( size_t i = 0; i < consumer->Listeners.size() && mRunning; i++ ) {
+				if ( consumer->Listeners[i]->dispatch( wake ) ) {
+					more = true;
+				}
+			}
+		}
+	}
+}
+
+} // namespace efsw
@@ -0,0 +1,204 @@
+#ifndef EFSW_EVENTDISPATCHER_HPP
+#define EFSW_EVENTDISPATCHER_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/Thread.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/efsw.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+class EventDispatcher;
+
+/// Listener placed between a backend and the listener of a watch with Options::DispatchQueueSize.
+/// The backend threads push the events into a bounded ring without locking, a thread of the
+/// dispatcher pops them and calls the listener with batches of them.
+/// The ring is a multi-producer queue of slots with a sequence number each: a producer claims
+/// the tail, fills the slot and publishes it bumping its sequence, the consumer claims the head
+/// the same way. A producer dropping the oldest events claims the head as well.
+/// With Options::RateLimit the consumer takes a token of a bucket for each event it delivers,
+/// the events popped once it's empty are dropped or summarized. They are still popped, so the
+/// backend isn't held back by a watch over its rate.
+/// The errors and the ready notifications are rare enough to skip the queue.
+class AsyncListener : public WatchStage {
+  public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// @param rate Options::RateLimit, 0 if unlimited
+	AsyncListener( EventDispatcher* dispatcher, FileWatchListener* listener,
+				   const std::string& directory, size_t capacity, QueuePolicy policy, int rate,
+				   int burst, RatePolicy ratePolicy );
+
+	/// Drops the events queued. Once deleted no event of the watch is being delivered, nor will
+	/// be.
+	~AsyncListener();
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// @return The counters of the queue
+	DispatchStats stats() const;
+
+  protected:
+	friend class EventDispatcher;
+
+	struct Slot {
+		std::atomic<size_t> Sequence;
+		WatchID ID;
+		Action Kind;
+		std::string Dir;
+		std::string Filename;
+		std::string OldFilename;
+		Uint64 Captured;
+	};
+
+	/// An event kept out of the queue by the Coalesce policy
+	struct Pending {
+		WatchID ID;
+		Action Kind;
+		std::string Dir;
+		std::string Filename;
+		std::string OldFilename;
+		Uint64 Captured;
+	};
+
+	EventDispatcher* mDispatcher;
+
+	QueuePolicy mPolicy;
+
+	/// Index of the consumer thread serving the watch
+	size_t mConsumer;
+
+	Slot* mSlots;
+	size_t mMask;
+
+	/// Next position to push and to pop, on their own cache lines
+	alignas( 64 ) std::atomic<size_t> mTail;
+	alignas( 64 ) std::atomic<size_t> mHead;
+
+	/// Events were dropped, the next batch starts with an overflow notification
+	std::atomic<bool> mOverflowed;
+
+	std::atomic<size_t> mDropped;
+	std::atomic<size_t> mCoalesced;
+	std::atomic<size_t> mBlocked;
+	std::atomic<size_t> mLimited;
+
+	/// Producers waiting for room ( Block policy )
+	std::atomic<int> mWaiters;
+	Mutex mWaitLock;
+	std::condition_variable mRoom;
+
+	/// Events kept out of the queue once it filled up ( Coalesce policy ), delivered after the
+	/// events queued. Every event goes there while it isn't empty, so they keep their order.
+	Mutex mPendingLock;
+	std::vector<Pending> mPending;
+	std::unordered_map<std::string, size_t> mPendingIndex;
+	std::atomic<bool> mHasPending;
+
+	/// Reused by the consumer: the positions popped, the pending events taken and the batch
+	std::vector<size_t> mPopped;
+	std::vector<Pending> mTaken;
+	std::vector<Event> mEvents;
+
+	/// The bucket of Options::RateLimit, used by the consumer only: the events it can deliver,
+	/// refilled at mRate per second up to mBurst. A rate of 0 is unlimited.
+	double mRate;
+	double mBurst;
+	double mTokens;
+	Clock::time_point mRefilled;
+	RatePolicy mRatePolicy;
+
+	/// The directories of the events past the limit ( Summarize policy ), reported as the
+	/// bucket refills, and the ones taken for the batch
+	std::set<std::string> mSummaries;
+	std::vector<std::string> mSummarized;
+	/// Events past the limit were dropped ( Drop policy ), an Actions::Overflow is delivered
+	/// once the bucket refills
+	bool mLimitOverflowed;
+
+	void push( const Event& event );
+
+	bool tryPush( const Event& event );
+
+	/// Claims the oldest event queued
+	/// @return False if the queue is empty
+	bool tryPop( size_t& pos );
+
+	/// Frees the slot popped for the producers
+	void release( size_t pos );
+
+	/// Keeps the event out of the queue, merged with an identical one if any
+	void addPending( const Event& event );
+
+	/// @return True if the bucket had a token for one more event, taking it
+	bool takeToken();
+
+	/// Drops an event past the limit, keeping its directory to summarize
+	void limit( const std::string& dir );
+
+	/// Delivers a batch of the events queued, from the consumer thread
+	/// @param wake Set to the time the summaries waiting for the bucket can be delivered, if
+	/// earlier
+	/// @return True if there may be more to deliver at once
+	bool dispatch( Clock::time_point& wake );
+};
+
+/// The threads calling the listeners of the dispatching listeners of a FileWatcher, which are
+/// owned by the stage chains of their watches. A watch is always served by the same thread, so
+/// its events keep their order. The threads are started as the watches are added, up to one per
+/// two hardware threads. A thread delivers a batch of each of its watches in turn, so a watch
+/// with few events isn't delayed by more than a batch of each of the busy ones.
+class EventDispatcher {
+  public:
+	EventDispatcher();
+
+	/// The listeners must be deleted already
+	~EventDispatcher();
+
+  protected:
+	friend class AsyncListener;
+
+	/// A thread calling the listeners of some of the watches
+	struct Consumer {
+		Thread* Worker;
+		/// Held while delivering and while its listeners change
+		Mutex DeliveryLock;
+		std::vector<AsyncListener*> Listeners;
+		/// Set by the producers, so the thread is woken up once for many events
+		std::atomic<bool> Signaled;
+		Mutex WakeLock;
+		std::condition_variable Wake;
+	};
+
+	std::vector<Consumer*> mConsumers;
+
+	/// Guards the consumers list
+	Mutex mMutex;
+
+	std::atomic<bool> mRunning;
+
+	/// Number of watches added, assigns the consumer of the next one
+	size_t mAssigned;
+
+	void run( Consumer* consumer );
+
+	/// Wakes up the consumer of the listener
+	void signal( AsyncListener* listener );
+
+	/// Assigns the listener to a consumer
+	void add( AsyncListener* listener );
+
+	/// Waits for the delivery in progress, then stops delivering the events of the listener
+	void remove( AsyncListener* listener );
+};
+
+} // namespace efsw
+
+#endif
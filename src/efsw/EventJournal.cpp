@@ -0,0 +1,143 @@
+#include <efsw/EventJournal.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/SharedJournal.hpp>
+#include <chrono>
+
+#define JOURNAL_DEFAULT_CAPACITY 65536
+
+namespace efsw {
+
+JournalingListener::JournalingListener( EventJournal* journal, FileWatchListener* listener,
+										const std::string& directory ) :
+	WatchStage( listener, directory ), mJournal( journal ) {}
+
+void JournalingListener::handleFileActions( const Event* events, size_t count ) {
+	mJournal->append( events, count );
+
+	if ( NULL != mListener ) {
+		mListener->handleFileActions( events, count );
+	}
+}
+
+EventJournal::EventJournal() :
+	mCapacity( JOURNAL_DEFAULT_CAPACITY ), mBase( 1 ), mTail( 1 ), mHead( 1 ), mShared( NULL ) {}
+
+EventJournal::~EventJournal() {
+	efSAFE_DELETE( mShared );
+}
+
+void EventJournal::append( const Event* events, size_t count ) {
+	if ( 0 == count )
+		return;
+
+	{
+		Lock lock( mEventsLock );
+
+		if ( NULL != mShared ) {
+			mShared->publish( events, count, mHead );
+		}
+
+		for ( size_t i = 0; i < count; i++ ) {
+			size_t slot = ( mHead - mBase ) % mCapacity;
+
+			/// The ring grows until it's full, then the oldest event gives its slot
+			if ( slot == mEvents.size() ) {
+				mEvents.push_back( FileEvent() );
+			}
+
+			FileEvent& recorded = mEvents[slot];
+			recorded.watchid = events[i].watchid;
+			recorded.dir.assign( events[i].dir );
+			recorded.filename.assign( events[i].filename );
+			recorded.action = events[i].action;
+			recorded.oldFilename.assign( events[i].oldFilename );
+
+			mHead++;
+
+			if ( mHead - mTail > mCapacity ) {
+				mTail++;
+			}
+		}
+	}
+
+	mAppended.notify_all();
+}
+
+void EventJournal::setCapacity( size_t capacity ) {
+	Lock lock( mEventsLock );
+
+	mCapacity = capacity > 0 ? capacity : 1;
+	mEvents.clear();
+	mEvents.shrink_to_fit();
+	mBase = mTail = mHead;
+}
+
+bool EventJournal::publish( const std::string& name, size_t ringSize, size_t pathsSize ) {
+	Lock lock( mEventsLock );
+
+	efSAFE_DELETE( mShared );
+
+	SharedJournal* shared = new SharedJournal();
+
+	if ( !shared->create( name, ringSize, pathsSize, mHead ) ) {
+		efSAFE_DELETE( shared );
+		return false;
+	}
+
+	mShared = shared;
+
+	return true;
+}
+
+uint64_t EventJournal::head() {
+	Lock lock( mEventsLock );
+
+	return mHead;
+}
+
+uint64_t EventJournal::tail() {
+	Lock lock( mEventsLock );
+
+	return mTail;
+}
+
+size_t EventJournal::read( uint64_t& cursor, JournalEvent* events, size_t max ) {
+	Lock lock( mEventsLock );
+
+	size_t count = 0;
+
+	if ( cursor < mTail && max > 0 ) {
+		JournalEvent& gap = events[count++];
+		gap.sequence = cursor;
+		gap.watchid = 0;
+		gap.dir.clear();
+		gap.filename.clear();
+		gap.action = Actions::Overflow;
+		gap.oldFilename.clear();
+
+		cursor = mTail;
+	}
+
+	for ( ; count < max && cursor < mHead; count++, cursor++ ) {
+		const FileEvent& recorded = mEvents[( cursor - mBase ) % mCapacity];
+		JournalEvent& event = events[count];
+
+		event.sequence = cursor;
+		event.watchid = recorded.watchid;
+		event.dir.assign( recorded.dir );
+		event.filename.assign( recorded.filename );
+		event.action = recorded.action;
+		event.oldFilename.assign( recorded.oldFilename );
+	}
+
+	return count;
+}
+
+bool EventJournal::wait( uint64_t cursor, unsigned int milliseconds ) {
+	Lock lock( mEventsLock );
+
+	return mAppended.wait_for( lock, std::chrono::milliseconds( milliseconds ),
+							   [&]() { return cursor < mHead; } );
+}
+
+} // namespace efsw
@@ -0,0 +1,91 @@
+#ifndef EFSW_EVENTJOURNAL_HPP
+#define EFSW_EVENTJOURNAL_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+namespace efsw {
+
+class EventJournal;
+class SharedJournal;
+
+/// Listener placed right in front of the listener of a watch with Options::Journal, after the
+/// other stages. It records the events into the journal of the FileWatcher, then passes them on
+/// to the listener, if the watch has one.
+class JournalingListener : public WatchStage {
+  public:
+	/// @param listener The listener of the watch, NULL if its events are only journaled
+	JournalingListener( EventJournal* journal, FileWatchListener* listener,
+						const std::string& directory );
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+  protected:
+	EventJournal* mJournal;
+};
+
+/// The journal of a FileWatcher: a ring of the last events of the watches with
+/// Options::Journal, numbered in sequence. The consumers keep their own cursor, the sequence of
+/// the next event they read, so none of them waits for another nor holds the backend: the oldest
+/// events are overwritten whoever didn't read them yet, and a cursor left behind them reads a
+/// gap instead. The strings of the ring keep their capacity, so once full it doesn't allocate.
+class EventJournal {
+  public:
+	EventJournal();
+
+	~EventJournal();
+
+	/// Appends the events, overwriting the oldest ones once the ring is full
+	void append( const Event* events, size_t count );
+
+	/// Sets the number of events kept. The events kept are dropped, the cursors behind get a gap.
+	void setCapacity( size_t capacity );
+
+	/// Publishes the events appended from now on in shared memory, see SharedJournal
+	/// @return False if the segment couldn't be created
+	bool publish( const std::string& name, size_t ringSize, size_t pathsSize );
+
+	/// @return The sequence the next event appended gets
+	uint64_t head();
+
+	/// @return The sequence of the oldest event kept, head() if none
+	uint64_t tail();
+
+	/// Copies up to max events from the cursor into the buffer, reusing the capacity of its
+	/// strings, and moves the cursor past them. A cursor behind the oldest event kept first reads
+	/// an Actions::Overflow of watch 0, with the sequence of the first event lost, then resumes
+	/// from the oldest one.
+	/// @return The number of events copied
+	size_t read( uint64_t& cursor, JournalEvent* events, size_t max );
+
+	/// Waits for an event to be appended at the cursor or past it
+	/// @return True if there's one to read, false once the time is up
+	bool wait( uint64_t cursor, unsigned int milliseconds );
+
+  protected:
+	/// The ring, grown up to mCapacity. The event of sequence s is at ( s - mBase ) % mCapacity.
+	std::vector<FileEvent> mEvents;
+	size_t mCapacity;
+	/// The sequence of the first event put at the start of the ring
+	uint64_t mBase;
+	/// The sequence of the oldest event kept, and of the next one
+	uint64_t mTail;
+	uint64_t mHead;
+
+	/// Guards the ring and its sequences
+	Mutex mEventsLock;
+	/// Notified when events are appended
+	std::condition_variable mAppended;
+
+	/// The journal published, NULL if none ( guarded by mEventsLock )
+	SharedJournal* mShared;
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,66 @@
+#include <efsw/EventQueue.hpp>
+#include <efsw/Lock.hpp>
+
+namespace efsw {
+
+EventQueue::EventQueue() : mRead( 0 ), mCount( 0 ) {}
+
+void EventQueue::handleFileEvent( WatchID watchid, std::string_view dir,
+								  std::string_view filename, Action action,
+								  std::string_view oldFilename ) {
+	Event event;
+	event.watchid = watchid;
+	event.dir = dir;
+	event.filename = filename;
+	event.action = action;
+	event.oldFilename = oldFilename;
+
+	Lock lock( mMutex );
+
+	push( event );
+}
+
+void EventQueue::handleFileActions( const Event* events, size_t count ) {
+	Lock lock( mMutex );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		push( events[i] );
+	}
+}
+
+void EventQueue::push( const Event& event ) {
+	if ( mCount == mEvents.size() ) {
+		mEvents.push_back( FileEvent() );
+	}
+
+	FileEvent& queued = mEvents[mCount++];
+	queued.watchid = event.watchid;
+	queued.dir.assign( event.dir );
+	queued.filename.assign( event.filename );
+	queued.action = event.action;
+	queued.oldFilename.assign( event.oldFilename );
+}
+
+size_t EventQueue::read( FileEvent* events, size_t max ) {
+	Lock lock( mMutex );
+
+	size_t count = 0;
+
+	for ( ; count < max && mRead < mCount; count++, mRead++ ) {
+		FileEvent& queued = mEvents[mRead];
+
+		events[count].watchid = queued.watchid;
+		events[count].dir.swap( queued.dir );
+		events[count].filename.swap( queued.filename );
+		events[count].action = queued.action;
+		events[count].oldFilename.swap( queued.oldFilename );
+	}
+
+	if ( mRead == mCount ) {
+		mRead = mCount = 0;
+	}
+
+	return count;
+}
+
+} // namespace efsw
@@ -0,0 +1,40 @@
+#ifndef EFSW_EVENTQUEUE_HPP
+#define EFSW_EVENTQUEUE_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/efsw.hpp>
+#include <vector>
+
+namespace efsw {
+
+/// Listener of the watches added without one, keeps their events until FileWatcher::readEvents
+/// takes them. The events are swapped into the buffer of the caller, the strings of both sides
+/// keep their capacity, so the steady state doesn't allocate.
+class EventQueue : public FileWatchListener {
+  public:
+	EventQueue();
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// Moves up to max events queued into the buffer, in the order they happened
+	/// @return The number of events moved
+	size_t read( FileEvent* events, size_t max );
+
+  protected:
+	Mutex mMutex;
+
+	/// The events queued are the ones between mRead and mCount, the rest are kept for their
+	/// capacity
+	std::vector<FileEvent> mEvents;
+	size_t mRead;
+	size_t mCount;
+
+	void push( const Event& event );
+};
+
+} // namespace efsw
+
+#endif
@@ -1,6 +1,8 @@
 #include <efsw/FileInfo.hpp>
 #include <efsw/FileSystem.hpp>
 #include <efsw/String.hpp>
+#include <algorithm>
+#include <cstring>
 
 #ifndef _DARWIN_FEATURE_64_BIT_INODE
 #define _DARWIN_FEATURE_64_BIT_INODE
@@ -37,6 +39,17 @@
 
 namespace efsw {
 
+#if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
+/// @return The path converted for _wstat, into a buffer the thread reuses for every stat
+static const wchar_t* widePath( const std::string& path ) {
+	static thread_local std::wstring wide;
+
+	String::utf8ToWide( path, wide );
+
+	return wide.c_str();
+}
+#endif
+
 bool FileInfo::exists( const std::string& filePath ) {
 	FileInfo fi( filePath );
 	return fi.exists();
@@ -56,11 +69,12 @@ bool FileInfo::inodeSupported() {
 }
 
 FileInfo::FileInfo() :
-	ModificationTime( 0 ), OwnerId( 0 ), GroupId( 0 ), Permissions( 0 ), Inode( 0 ) {}
+	ModificationTime( 0 ), Size( 0 ), OwnerId( 0 ), GroupId( 0 ), Permissions( 0 ), Inode( 0 ) {}
 
 FileInfo::FileInfo( const std::string& filepath ) :
 	Filepath( filepath ),
 	ModificationTime( 0 ),
+	Size( 0 ),
 	OwnerId( 0 ),
 	GroupId( 0 ),
 	Permissions( 0 ),
@@ -71,6 +85,7 @@ FileInfo::FileInfo( const std::string& filepath ) :
 FileInfo::FileInfo( const std::string& filepath, bool linkInfo ) :
 	Filepath( filepath ),
 	ModificationTime( 0 ),
+	Size( 0 ),
 	OwnerId( 0 ),
 	GroupId( 0 ),
 	Permissions( 0 ),
@@ -102,7 +117,7 @@ void FileInfo::getInfo() {
 	int res = stat( Filepath.c_str(), &st );
 #else
 	struct _stat st;
-	int res = _wstat( String::fromUtf8( Filepath ).toWideString().c_str(), &st );
+	int res = _wstat( widePath( Filepath ), &st );
 #endif
 
 	if ( 0 == res ) {
@@ -119,6 +134,30 @@ void FileInfo::getInfo() {
 	}
 }
 
+bool FileInfo::getInfo( const std::string& path ) {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	struct stat st;
+
+	if ( 0 != stat( path.c_str(), &st ) ) {
+		ModificationTime = Size = Inode = 0;
+		OwnerId = GroupId = Permissions = 0;
+		return false;
+	}
+
+	ModificationTime = st.st_mtime;
+	Size = st.st_size;
+	OwnerId = st.st_uid;
+	GroupId = st.st_gid;
+	Permissions = st.st_mode;
+	Inode = st.st_ino;
+	return true;
+#else
+	FileInfo fi( path );
+	assignInfo( fi );
+	return fi.exists();
+#endif
+}
+
 void FileInfo::getRealInfo() {
 	bool slashAtEnd = FileSystem::slashAtEnd( Filepath );
 
@@ -131,7 +170,7 @@ void FileInfo::getRealInfo() {
 	int res = lstat( Filepath.c_str(), &st );
 #else
 	struct _stat st;
-	int res = _wstat( String::fromUtf8( Filepath ).toWideString().c_str(), &st );
+	int res = _wstat( widePath( Filepath ), &st );
 #endif
 
 	if ( 0 == res ) {
@@ -208,7 +247,7 @@ bool FileInfo::exists() {
 	int res = stat( Filepath.c_str(), &st );
 #else
 	struct _stat st;
-	int res = _wstat( String::fromUtf8( Filepath ).toWideString().c_str(), &st );
+	int res = _wstat( widePath( Filepath ), &st );
 #endif
 
 	if ( slashAtEnd ) {
@@ -220,13 +259,26 @@ bool FileInfo::exists() {
 
 FileInfo& FileInfo::operator=( const FileInfo& Other ) {
 	this->Filepath = Other.Filepath;
+	assignInfo( Other );
+	return *this;
+}
+
+void FileInfo::assignInfo( const FileInfo& Other ) {
 	this->Size = Other.Size;
 	this->ModificationTime = Other.ModificationTime;
 	this->GroupId = Other.GroupId;
 	this->OwnerId = Other.OwnerId;
 	this->Permissions = Other.Permissions;
 	this->Inode = Other.Inode;
-	return *this;
+}
+
+void FileInfo::assignInfo( const FileStat& stat ) {
+	this->Size = stat.Size;
+	this->ModificationTime = stat.ModificationTime;
+	this->GroupId = 0;
+	this->OwnerId = 0;
+	this->Permissions = stat.Permissions;
+	this->Inode = stat.Inode;
 }
 
 bool FileInfo::sameInode( const FileInfo& Other ) const {
@@ -237,4 +289,273 @@ bool FileInfo::operator!=( const FileInfo& Other ) const {
 	return !( *this == Other );
 }
 
+FileStat::FileStat() : ModificationTime( 0 ), Size( 0 ), Inode( 0 ), Permissions( 0 ), Ownership( 0 ) {}
+
+bool FileStat::operator==( const FileStat& Other ) const {
+	return ModificationTime == Other.ModificationTime && Size == Other.Size &&
+		   Inode == Other.Inode && Permissions == Other.Permissions &&
+		   Ownership == Other.Ownership;
+}
+
+bool FileStat::operator!=( const FileStat& Other ) const {
+	return !( *this == Other );
+}
+
+void FileStat::assignInfo( const FileInfo& info ) {
+	ModificationTime = info.ModificationTime;
+	Size = info.Size;
+	Inode = info.Inode;
+	Permissions = info.Permissions;
+	Ownership = ownership( info.OwnerId, info.GroupId );
+}
+
+void FileStat::assignInfo( const FileStat& Other ) {
+	*this = Other;
+}
+
+bool FileStat::isDirectory() const {
+	return 0 != S_ISDIR( Permissions );
+}
+
+bool FileStat::isRegularFile() const {
+	return 0 != S_ISREG( Permissions );
+}
+
+bool FileStat::isReadable() const {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	static bool isRoot = getuid() == 0;
+	return isRoot || 0 != S_ISRDBL( Permissions );
+#else
+	return 0 != S_ISRDBL( Permissions );
+#endif
+}
+
+Uint32 FileStat::ownership( Uint32 ownerId, Uint32 groupId ) {
+	/// The group rotated, so an owner and a group swapping still change the word
+	return ownerId ^ ( ( groupId << 16 ) | ( groupId >> 16 ) ) * 0x9E3779B1u;
+}
+
+/// The size of the first block of names of a map, the next ones double up to NamesMaxBlock
+static const size_t NamesMinBlock = 256;
+static const size_t NamesMaxBlock = 64 * 1024;
+
+FileInfoMap::Names::Names() : mBlock( 0 ), mOffset( 0 ), mUsed( 0 ) {}
+
+std::string_view FileInfoMap::Names::store( std::string_view name ) {
+	/// Null terminated, to be passed to the system as they are
+	size_t size = name.size() + 1;
+
+	while ( mBlock < mBlocks.size() && mOffset + size > mSizes[mBlock] ) {
+		mBlock++;
+		mOffset = 0;
+	}
+
+	if ( mBlock == mBlocks.size() ) {
+		size_t block =
+			mSizes.empty() ? NamesMinBlock : std::min( mSizes.back() * 2, NamesMaxBlock );
+		block = std::max( block, size );
+
+		mBlocks.emplace_back( new char[block] );
+		mSizes.push_back( block );
+		mOffset = 0;
+	}
+
+	char* text = mBlocks[mBlock].get() + mOffset;
+	memcpy( text, name.data(), name.size() );
+	text[name.size()] = '\0';
+
+	mOffset += size;
+	mUsed += size;
+
+	return std::string_view( text, name.size() );
+}
+
+void FileInfoMap::Names::reset() {
+	mBlock = mOffset = mUsed = 0;
+}
+
+size_t FileInfoMap::Names::used() const {
+	return mUsed;
+}
+
+static bool entryBefore( const FileInfoMap::Entry& entry, std::string_view name ) {
+	return entry.first < name;
+}
+
+static bool entryLess( const FileInfoMap::Entry& a, const FileInfoMap::Entry& b ) {
+	return a.first < b.first;
+}
+
+FileInfoMap::FileInfoMap() : mUsed( 0 ), mSorted( 0 ), mErased( 0 ) {}
+
+FileInfoMap::iterator FileInfoMap::begin() {
+	Entry* entries = mEntries.data();
+	return iterator( entries, entries + mUsed );
+}
+
+FileInfoMap::iterator FileInfoMap::end() {
+	Entry* last = mEntries.data() + mUsed;
+	return iterator( last, last );
+}
+
+FileInfoMap::Entry* FileInfoMap::lookup( std::string_view name ) {
+	std::vector<Entry>::iterator sortedEnd = mEntries.begin() + mSorted;
+	std::vector<Entry>::iterator it =
+		std::lower_bound( mEntries.begin(), sortedEnd, name, entryBefore );
+
+	if ( it != sortedEnd && it->first == name )
+		return &*it;
+
+	for ( size_t i = mSorted; i < mUsed; i++ ) {
+		if ( mEntries[i].first == name )
+			return &mEntries[i];
+	}
+
+	return NULL;
+}
+
+FileInfoMap::iterator FileInfoMap::find( std::string_view name ) {
+	Entry* entry = lookup( name );
+
+	if ( NULL == entry || entry->Erased )
+		return end();
+
+	return iterator( entry, mEntries.data() + mUsed );
+}
+
+size_t FileInfoMap::count( std::string_view name ) {
+	return find( name ) != end() ? 1 : 0;
+}
+
+FileStat& FileInfoMap::operator[]( std::string_view name ) {
+	Entry* entry = lookup( name );
+
+	if ( NULL != entry ) {
+		if ( entry->Erased ) {
+			entry->Erased = false;
+			entry->second = FileStat();
+			mErased--;
+		}
+
+		return entry->second;
+	}
+
+	/// The unsorted entries are searched one by one, they are merged in before they get many
+	if ( mUsed - mSorted >= 32 + mSorted / 64 || mErased > 32 + mUsed / 2 ) {
+		sort();
+	}
+
+	FileStat& fi = append( name );
+	fi = FileStat();
+	return fi;
+}
+
+FileInfoMap::iterator FileInfoMap::erase( iterator it ) {
+	if ( !it.mCur->Erased ) {
+		it.mCur->Erased = true;
+		mErased++;
+	}
+
+	return ++it;
+}
+
+size_t FileInfoMap::erase( std::string_view name ) {
+	iterator it = find( name );
+
+	if ( it == end() )
+		return 0;
+
+	erase( it );
+	return 1;
+}
+
+void FileInfoMap::clear() {
+	mEntries.clear();
+	mNames = Names();
+	mUsed = mSorted = mErased = 0;
+}
+
+bool FileInfoMap::empty() const {
+	return mUsed == mErased;
+}
+
+size_t FileInfoMap::size() const {
+	return mUsed - mErased;
+}
+
+void FileInfoMap::sort() {
+	if ( mSorted == mUsed && 0 == mErased )
+		return;
+
+	/// Drops the erased entries keeping the order, the sorted ones stay at the start
+	size_t used = 0;
+	size_t sorted = 0;
+	size_t text = 0;
+
+	for ( size_t i = 0; i < mUsed; i++ ) {
+		if ( mEntries[i].Erased )
+			continue;
+
+		text += mEntries[i].first.size() + 1;
+
+		if ( used != i ) {
+			std::swap( mEntries[used], mEntries[i] );
+		}
+
+		if ( i < mSorted ) {
+			sorted++;
+		}
+
+		used++;
+	}
+
+	std::vector<Entry>::iterator first = mEntries.begin();
+
+	/// The entries are often appended in order already, a listing copied or merged
+	if ( !std::is_sorted( first + sorted, first + used, entryLess ) ) {
+		std::sort( first + sorted, first + used, entryLess );
+	}
+
+	if ( 0 != sorted && sorted != used ) {
+		std::inplace_merge( first, first + sorted, first + used, entryLess );
+	}
+
+	mUsed = mSorted = used;
+	mErased = 0;
+
+	/// The names of the entries erased are only reclaimed once they take as much as the others
+	if ( mNames.used() > 2 * text + NamesMaxBlock ) {
+		Names names;
+
+		for ( size_t i = 0; i < mUsed; i++ ) {
+			mEntries[i].first = names.store( mEntries[i].first );
+		}
+
+		mNames = std::move( names );
+	}
+}
+
+void FileInfoMap::reserve( size_t count ) {
+	if ( count > mEntries.size() ) {
+		mEntries.reserve( count );
+	}
+}
+
+void FileInfoMap::recycle() {
+	mUsed = mSorted = mErased = 0;
+	mNames.reset();
+}
+
+FileStat& FileInfoMap::append( std::string_view name ) {
+	if ( mUsed == mEntries.size() ) {
+		mEntries.push_back( Entry() );
+	}
+
+	Entry& entry = mEntries[mUsed++];
+	entry.first = mNames.store( name );
+	entry.Erased = false;
+
+	return entry.second;
+}
+
 } // namespace efsw
@@ -2,12 +2,15 @@
 #define EFSW_FILEINFO_HPP
 
 #include <efsw/base.hpp>
-#include <vector>
-#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace efsw {
 
+class FileStat;
+
 class FileInfo {
   public:
 	static bool exists( const std::string& filePath );
@@ -22,12 +25,20 @@ class FileInfo {
 
 	FileInfo( const std::string& filepath, bool linkInfo );
 
+	FileInfo( const FileInfo& Other ) = default;
+
 	bool operator==( const FileInfo& Other ) const;
 
 	bool operator!=( const FileInfo& Other ) const;
 
 	FileInfo& operator=( const FileInfo& Other );
 
+	/// Copies the information of the file, but not its path
+	void assignInfo( const FileInfo& Other );
+
+	/// Copies the information of an entry, the owner and the group aren't kept there
+	void assignInfo( const FileStat& stat );
+
 	bool isDirectory() const;
 
 	bool isRegularFile() const;
@@ -44,6 +55,10 @@ class FileInfo {
 
 	void getInfo();
 
+	/// Reads the information of the file at path, leaving Filepath unchanged
+	/// @return True if the file exists
+	bool getInfo( const std::string& path );
+
 	void getRealInfo();
 
 	std::string Filepath;
@@ -55,7 +70,184 @@ class FileInfo {
 	Uint64 Inode;
 };
 
-typedef std::map<std::string, FileInfo> FileInfoMap;
+/// The information of an entry of a FileInfoMap, the compact form of a FileInfo: without a path,
+/// and with the owner and the group folded into a single word, only compared to tell they
+/// changed. The FileInfo of an entry is built when it's reported.
+class FileStat {
+  public:
+	FileStat();
+
+	bool operator==( const FileStat& Other ) const;
+
+	bool operator!=( const FileStat& Other ) const;
+
+	void assignInfo( const FileInfo& info );
+
+	void assignInfo( const FileStat& Other );
+
+	bool isDirectory() const;
+
+	bool isRegularFile() const;
+
+	bool isReadable() const;
+
+	/// @return The word the owner and the group are folded into
+	static Uint32 ownership( Uint32 ownerId, Uint32 groupId );
+
+	Uint64 ModificationTime;
+	Uint64 Size;
+	Uint64 Inode;
+	Uint32 Permissions;
+	Uint32 Ownership;
+};
+
+/// The entries of a directory by name, kept contiguous in a vector sorted by name.
+/// The entries inserted one by one are appended unsorted and merged in once they add up, and
+/// the entries erased are only flagged until the next insertion or sort(), so the updates of a
+/// large directory don't move all of it and erasing while iterating is safe. The iteration
+/// skips the erased entries, it's in the order of the names after a sort().
+/// The names are kept in blocks owned by the map, the entries only point to them, so an entry
+/// takes 56 bytes plus its name.
+class FileInfoMap {
+  public:
+	struct Entry {
+		/// Null terminated
+		std::string_view first;
+		FileStat second;
+		bool Erased;
+	};
+
+	typedef Entry value_type;
+
+	class iterator {
+	  public:
+		iterator() : mCur( NULL ), mEnd( NULL ) {}
+
+		iterator( Entry* cur, Entry* end ) : mCur( cur ), mEnd( end ) { skip(); }
+
+		Entry& operator*() const { return *mCur; }
+
+		Entry* operator->() const { return mCur; }
+
+		iterator& operator++() {
+			++mCur;
+			skip();
+			return *this;
+		}
+
+		iterator operator++( int ) {
+			iterator it( *this );
+			++*this;
+			return it;
+		}
+
+		bool operator==( const iterator& other ) const { return mCur == other.mCur; }
+
+		bool operator!=( const iterator& other ) const { return mCur != other.mCur; }
+
+	  protected:
+		friend class FileInfoMap;
+
+		Entry* mCur;
+		Entry* mEnd;
+
+		void skip() {
+			while ( mCur != mEnd && mCur->Erased ) {
+				++mCur;
+			}
+		}
+	};
+
+	FileInfoMap();
+
+	iterator begin();
+
+	iterator end();
+
+	FileInfoMap( FileInfoMap&& ) = default;
+
+	FileInfoMap& operator=( FileInfoMap&& ) = default;
+
+	FileInfoMap( const FileInfoMap& ) = delete;
+
+	FileInfoMap& operator=( const FileInfoMap& ) = delete;
+
+	/// @return The entry of the name, end() if there is none
+	iterator find( std::string_view name );
+
+	size_t count( std::string_view name );
+
+	/// @return The information of the entry of the name, inserted if there was none. It can sort
+	/// the entries, invalidating the iterators.
+	FileStat& operator[]( std::string_view name );
+
+	/// Erases the entry, the iterators stay valid
+	/// @return The next entry
+	iterator erase( iterator it );
+
+	size_t erase( std::string_view name );
+
+	void clear();
+
+	bool empty() const;
+
+	size_t size() const;
+
+	/// Sorts the entries by name and drops the erased ones
+	void sort();
+
+	/// Makes room for count entries in use, erased ones included
+	void reserve( size_t count );
+
+	/// Empties the map keeping the storage of its entries and names, to be refilled with append()
+	void recycle();
+
+	/// Appends an entry without looking for another of the same name, reusing the storage of a
+	/// recycled entry. The names appended must be unique, the map must be sorted afterwards.
+	FileStat& append( std::string_view name );
+
+  protected:
+	/// The text of the names, in blocks that never move so the entries can point into them. The
+	/// blocks grow with the names stored, a small directory only takes a small one.
+	class Names {
+	  public:
+		Names();
+
+		/// @return The copy of the name
+		std::string_view store( std::string_view name );
+
+		/// Forgets the names stored, keeping the blocks
+		void reset();
+
+		/// @return The bytes of the names stored since the last reset, the ones of the entries
+		/// erased included
+		size_t used() const;
+
+	  protected:
+		std::vector<std::unique_ptr<char[]>> mBlocks;
+		std::vector<size_t> mSizes;
+		size_t mBlock;
+		size_t mOffset;
+		size_t mUsed;
+	};
+
+	Names mNames;
+
+	std::vector<Entry> mEntries;
+
+	/// The entries in use, the ones after them were recycled
+	size_t mUsed;
+
+	/// The entries sorted by name, at the start
+	size_t mSorted;
+
+	/// The entries flagged as erased
+	size_t mErased;
+
+	/// @return The entry of the name, erased or not, NULL if there is none
+	Entry* lookup( std::string_view name );
+};
+
 typedef std::vector<FileInfo> FileInfoList;
 typedef std::vector<std::pair<std::string, FileInfo>> MovedList;
 
@@ -1,6 +1,7 @@
 #include <efsw/FileSystem.hpp>
 #include <efsw/platform/platformimpl.hpp>
 #include <cstring>
+#include <vector>
 
 #if EFSW_OS == EFSW_OS_MACOSX
 #include <CoreFoundation/CoreFoundation.h>
@@ -18,6 +19,41 @@ FileInfoMap FileSystem::filesInfoFromPath( std::string path ) {
 	return Platform::FileSystem::filesInfoFromPath( path );
 }
 
+void FileSystem::listDirectory( const std::string& path, FileInfoMap& files,
+								bool statDirectories ) {
+	files.recycle();
+
+	Platform::FileSystem::listDirectory( path, files, statDirectories );
+
+	files.sort();
+}
+
+void FileSystem::statEntries( const std::string& path, FileInfoMap& entries, FileInfoMap& listing,
+							  bool statDirectories ) {
+	listing.recycle();
+
+	Platform::FileSystem::statEntries( path, entries, listing, statDirectories );
+
+	listing.sort();
+}
+
+bool FileSystem::listNames( const std::string& path, FileInfoMap& files ) {
+	files.recycle();
+
+	return Platform::FileSystem::listNames( path, files );
+}
+
+void FileSystem::statNames( const std::string& path, FileInfoMap& files,
+							FileInfoMap::iterator first, FileInfoMap::iterator last,
+							bool statDirectories ) {
+	Platform::FileSystem::statNames( path, files, first, last, statDirectories );
+}
+
+bool FileSystem::directoryInfo( const std::string& path, FileInfo& info,
+								Uint64& modificationTime ) {
+	return Platform::FileSystem::directoryInfo( path, info, modificationTime );
+}
+
 char FileSystem::getOSSlash() {
 	return Platform::FileSystem::getOSSlash();
 }
@@ -84,37 +120,108 @@ std::string FileSystem::getLinkRealPath( std::string dir, std::string& curPath )
 	return "";
 }
 
+std::string FileSystem::normalizeDirectory( const std::string& directory ) {
+	char slash = getOSSlash();
+	std::string dir;
+	/// Where each component kept starts, to drop the last one for a ".."
+	std::vector<size_t> components;
+	size_t i = 0;
+
+	dir.reserve( directory.size() + 1 );
+
+	/// An absolute path keeps its root, and a network share its two slashes on Windows
+	while ( i < directory.size() && ( '/' == directory[i] || slash == directory[i] ) ) {
+		if ( 0 == i || ( 1 == i && '\\' == slash ) ) {
+			dir.push_back( slash );
+		}
+
+		i++;
+	}
+
+	bool absolute = !dir.empty();
+
+	while ( i < directory.size() ) {
+		size_t end = i;
+
+		while ( end < directory.size() && '/' != directory[end] && slash != directory[end] ) {
+			end++;
+		}
+
+		std::string_view name( directory.data() + i, end - i );
+		i = end + 1;
+
+		if ( name.empty() || "." == name )
+			continue;
+
+		if ( ".." == name ) {
+			if ( !components.empty() ) {
+				dir.resize( components.back() );
+				components.pop_back();
+				continue;
+			}
+
+			/// Nothing is above the root
+			if ( absolute )
+				continue;
+		}
+
+		/// A drive is kept as the root, and the ".." a relative path starts with
+		if ( ".." != name && !( dir.empty() && ':' == name.back() ) ) {
+			components.push_back( dir.size() );
+		}
+
+		dir.append( name.data(), name.size() );
+		dir.push_back( slash );
+	}
+
+	if ( dir.empty() && !directory.empty() ) {
+		dir.push_back( '.' );
+		dir.push_back( slash );
+	}
+
+	return dir;
+}
+
+bool FileSystem::isAscii( std::string_view name ) {
+	for ( size_t i = 0; i < name.size(); i++ ) {
+		if ( (unsigned char)name[i] >= 0x80 )
+			return false;
+	}
+
+	return true;
+}
+
 std::string FileSystem::precomposeFileName( const std::string& name ) {
 #if EFSW_OS == EFSW_OS_MACOSX
-	CFStringRef cfStringRef =
-		CFStringCreateWithCString( kCFAllocatorDefault, name.c_str(), kCFStringEncodingUTF8 );
-	CFMutableStringRef cfMutable = CFStringCreateMutableCopy( NULL, 0, cfStringRef );
+	/// Nothing to compose, no need for CoreFoundation
+	if ( isAscii( name ) )
+		return name;
 
+	CFMutableStringRef cfMutable = CFStringCreateMutable( kCFAllocatorDefault, 0 );
+
+	CFStringAppendCString( cfMutable, name.c_str(), kCFStringEncodingUTF8 );
 	CFStringNormalize( cfMutable, kCFStringNormalizationFormC );
 
 	const char* c_str = CFStringGetCStringPtr( cfMutable, kCFStringEncodingUTF8 );
 	if ( c_str != NULL ) {
 		std::string result( c_str );
-		CFRelease( cfStringRef );
 		CFRelease( cfMutable );
 		return result;
 	}
 	CFIndex length = CFStringGetLength( cfMutable );
 	CFIndex maxSize = CFStringGetMaximumSizeForEncoding( length, kCFStringEncodingUTF8 );
 	if ( maxSize == kCFNotFound ) {
-		CFRelease( cfStringRef );
 		CFRelease( cfMutable );
 		return std::string();
 	}
 
-	std::string result( maxSize, '\0' );
+	std::string result( maxSize + 1, '\0' );
 	if ( CFStringGetCString( cfMutable, &result[0], result.size(), kCFStringEncodingUTF8 ) ) {
 		result.resize( std::strlen( result.c_str() ) );
-		CFRelease( cfStringRef );
-		CFRelease( cfMutable );
 	} else {
 		result.clear();
 	}
+	CFRelease( cfMutable );
 	return result;
 #else
 	return name;
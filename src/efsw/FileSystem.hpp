@@ -4,6 +4,7 @@
 #include <efsw/FileInfo.hpp>
 #include <efsw/base.hpp>
 #include <map>
+#include <string_view>
 
 namespace efsw {
 
@@ -13,6 +14,38 @@ class FileSystem {
 
 	static FileInfoMap filesInfoFromPath( std::string path );
 
+	/// Lists the regular files and the directories of a directory ( with the slash at the end )
+	/// into files, reusing the storage of its entries. The entries are sorted, without their path.
+	/// @param statDirectories False to keep only the inode of the subdirectories, from the listing
+	/// where the platform tells, for the callers that watch them on their own
+	static void listDirectory( const std::string& path, FileInfoMap& files,
+							   bool statDirectories = true );
+
+	/// Stats again the entries of a directory that neither gained nor lost any, into listing,
+	/// without listing the directory. The entries that can't be stat'ed are left out.
+	/// @param statDirectories False to copy the subdirectories as they are
+	static void statEntries( const std::string& path, FileInfoMap& entries, FileInfoMap& listing,
+							 bool statDirectories = true );
+
+	/// Lists the names of the entries of a directory into files, reusing the storage of its
+	/// entries, to be stat'ed with statNames. The entries aren't sorted. A subdirectory gets its
+	/// inode where the listing tells it, the other entries no information.
+	/// @return True if the platform lists the information of the entries along with their names,
+	/// they needn't be stat'ed then
+	static bool listNames( const std::string& path, FileInfoMap& files );
+
+	/// Stats the entries of files from first to last in place, erasing the ones that aren't
+	/// regular files nor directories, or are gone
+	/// @param statDirectories False to leave the subdirectories listed with their inode as they are
+	static void statNames( const std::string& path, FileInfoMap& files, FileInfoMap::iterator first,
+						   FileInfoMap::iterator last, bool statDirectories = true );
+
+	/// Reads the information of a directory into info, leaving its Filepath unchanged
+	/// @param modificationTime The modification time of the directory in nanoseconds, 0 where the
+	/// platform doesn't tell
+	/// @return True if the directory exists
+	static bool directoryInfo( const std::string& path, FileInfo& info, Uint64& modificationTime );
+
 	static char getOSSlash();
 
 	static bool slashAtEnd( std::string& dir );
@@ -27,8 +60,18 @@ class FileSystem {
 
 	static std::string getLinkRealPath( std::string dir, std::string& curPath );
 
+	/// @return The directory with the slash at the end, its empty and "." components dropped and
+	/// each ".." dropped with the component before it, as written: symbolic links aren't
+	/// resolved
+	static std::string normalizeDirectory( const std::string& directory );
+
+	/// @return The name in Unicode normalization form C, as macOS gives decomposed names.
+	/// Elsewhere, and for the names in ASCII, the name itself.
 	static std::string precomposeFileName( const std::string& name );
 
+	/// @return True if the name is in ASCII, the same precomposed or not
+	static bool isAscii( std::string_view name );
+
 	static bool isRemoteFS( const std::string& directory );
 
 	static bool changeWorkingDirectory( const std::string& path );
@@ -1,16 +1,39 @@
+#include <efsw/ContentFilter.hpp>
+#include <efsw/EventCoalescer.hpp>
+#include <efsw/EventCounter.hpp>
+#include <efsw/EventDispatcher.hpp>
+#include <efsw/EventJournal.hpp>
+#include <efsw/EventQueue.hpp>
 #include <efsw/FileSystem.hpp>
 #include <efsw/FileWatcherGeneric.hpp>
 #include <efsw/FileWatcherImpl.hpp>
+#include <efsw/FileWatcherSimulated.hpp>
+#include <efsw/PathJoiner.hpp>
+#include <efsw/SnapshotIndex.hpp>
+#include <efsw/TreeIndex.hpp>
+#include <efsw/WatchGrouper.hpp>
+#include <efsw/WatchStages.hpp>
 #include <efsw/efsw.hpp>
+#include <algorithm>
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
+#include <efsw/FileWatcherUSN.hpp>
 #include <efsw/FileWatcherWin32.hpp>
 #define FILEWATCHER_IMPL FileWatcherWin32
 #define BACKEND_NAME "Win32"
+#ifdef EFSW_USN
+#define FILEWATCHER_PREFERRED_IMPL FileWatcherUSN
+#define PREFERRED_BACKEND_NAME "USN"
+#endif
 #elif EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY
+#include <efsw/FileWatcherFanotify.hpp>
 #include <efsw/FileWatcherInotify.hpp>
 #define FILEWATCHER_IMPL FileWatcherInotify
 #define BACKEND_NAME "Inotify"
+#ifdef EFSW_FANOTIFY
+#define FILEWATCHER_PREFERRED_IMPL FileWatcherFanotify
+#define PREFERRED_BACKEND_NAME "Fanotify"
+#endif
 #elif EFSW_PLATFORM == EFSW_PLATFORM_KQUEUE
 #include <efsw/FileWatcherKqueue.hpp>
 #define FILEWATCHER_IMPL FileWatcherKqueue
@@ -26,45 +49,132 @@
 
 #include <efsw/Debug.hpp>
 
+/// The capacity of the dispatch queue of a watch with a rate limit but no queue size
+#define RATE_LIMIT_QUEUE_SIZE 4096
+
 namespace efsw {
 
-FileWatcher::FileWatcher() : mFollowSymlinks( false ), mOutOfScopeLinks( false ) {
+/// Creates the native backend. The preferred backend is only available when the process has
+/// the capabilities it needs, otherwise it falls back to the default one.
+static FileWatcherImpl* createNativeBackend( FileWatcher* parent ) {
+	FileWatcherImpl* impl;
+
+#ifdef FILEWATCHER_PREFERRED_IMPL
+	efDEBUG( "Using backend: %s\n", PREFERRED_BACKEND_NAME );
+
+	impl = new FILEWATCHER_PREFERRED_IMPL( parent );
+
+	if ( impl->initOK() )
+		return impl;
+
+	efSAFE_DELETE( impl );
+
+	efDEBUG( "Falled back to backend: %s\n", BACKEND_NAME );
+#else
 	efDEBUG( "Using backend: %s\n", BACKEND_NAME );
+#endif
 
-	mImpl = new FILEWATCHER_IMPL( this );
+	impl = new FILEWATCHER_IMPL( parent );
 
-	if ( !mImpl->initOK() ) {
-		efSAFE_DELETE( mImpl );
+	if ( !impl->initOK() ) {
+		efSAFE_DELETE( impl );
 
-		efDEBUG( "Falled back to backend: %s\n", BACKEND_NAME );
+		efDEBUG( "Falled back to backend: Generic\n" );
 
-		mImpl = new FileWatcherGeneric( this );
+		impl = new FileWatcherGeneric( parent );
 	}
+
+	return impl;
+}
+
+FileWatcher::FileWatcher() :
+	mGrouper( new WatchGrouper() ),
+	mCoalescer( new EventCoalescer() ),
+	mDispatcher( new EventDispatcher() ),
+	mSnapshots( new SnapshotStore() ),
+	mQueue( new EventQueue() ),
+	mJournal( new EventJournal() ),
+	mStages( new WatchStages() ),
+	mTraceHooks( NULL ),
+	mFollowSymlinks( false ),
+	mOutOfScopeLinks( false ),
+	mReactor( NULL ) {
+	mImpl = createNativeBackend( this );
 }
 
 FileWatcher::FileWatcher( bool useGenericFileWatcher ) :
-	mFollowSymlinks( false ), mOutOfScopeLinks( false ) {
+	mGrouper( new WatchGrouper() ),
+	mCoalescer( new EventCoalescer() ),
+	mDispatcher( new EventDispatcher() ),
+	mSnapshots( new SnapshotStore() ),
+	mQueue( new EventQueue() ),
+	mJournal( new EventJournal() ),
+	mStages( new WatchStages() ),
+	mTraceHooks( NULL ),
+	mFollowSymlinks( false ),
+	mOutOfScopeLinks( false ),
+	mReactor( NULL ) {
 	if ( useGenericFileWatcher ) {
 		efDEBUG( "Using backend: Generic\n" );
 
 		mImpl = new FileWatcherGeneric( this );
 	} else {
-		efDEBUG( "Using backend: %s\n", BACKEND_NAME );
+		mImpl = createNativeBackend( this );
+	}
+}
+
+FileWatcher::FileWatcher( const Simulation& simulation ) :
+	mGrouper( new WatchGrouper() ),
+	mCoalescer( new EventCoalescer() ),
+	mDispatcher( new EventDispatcher() ),
+	mSnapshots( new SnapshotStore() ),
+	mQueue( new EventQueue() ),
+	mJournal( new EventJournal() ),
+	mStages( new WatchStages() ),
+	mTraceHooks( NULL ),
+	mFollowSymlinks( false ),
+	mOutOfScopeLinks( false ),
+	mReactor( NULL ) {
+	efDEBUG( "Using backend: Simulated\n" );
 
-		mImpl = new FILEWATCHER_IMPL( this );
+	mImpl = new FileWatcherSimulated( this, simulation );
+}
 
-		if ( !mImpl->initOK() ) {
-			efSAFE_DELETE( mImpl );
+FileWatcher::FileWatcher( Reactor& reactor ) :
+	mImpl( reactor.mHost->mImpl ),
+	mGrouper( reactor.mHost->mGrouper ),
+	mCoalescer( new EventCoalescer() ),
+	mDispatcher( new EventDispatcher() ),
+	mSnapshots( new SnapshotStore() ),
+	mQueue( new EventQueue() ),
+	mJournal( new EventJournal() ),
+	mStages( new WatchStages() ),
+	mTraceHooks( NULL ),
+	mFollowSymlinks( false ),
+	mOutOfScopeLinks( false ),
+	mReactor( &reactor ) {}
 
-			efDEBUG( "Falled back to backend: %s\n", BACKEND_NAME );
+FileWatcher::~FileWatcher() {
+	if ( NULL != mReactor ) {
+		/// The backend stays with the reactor, only the watches of this watcher leave it
+		std::vector<WatchID> watches( mStages->watches() );
 
-			mImpl = new FileWatcherGeneric( this );
+		for ( size_t i = 0; i < watches.size(); i++ ) {
+			removeWatch( watches[i] );
 		}
+	} else {
+		efSAFE_DELETE( mImpl );
+		/// Once the backend is gone nothing reaches the grouping listeners nor the stages
+		efSAFE_DELETE( mGrouper );
 	}
-}
 
-FileWatcher::~FileWatcher() {
-	efSAFE_DELETE( mImpl );
+	efSAFE_DELETE( mStages );
+	efSAFE_DELETE( mDispatcher );
+	efSAFE_DELETE( mCoalescer );
+	efSAFE_DELETE( mJournal );
+	/// Saves the state of the watches left, once the backend stopped changing it
+	efSAFE_DELETE( mSnapshots );
+	efSAFE_DELETE( mQueue );
 }
 
 WatchID FileWatcher::addWatch( const std::string& directory, FileWatchListener* watcher ) {
@@ -78,43 +188,475 @@ WatchID FileWatcher::addWatch( const std::string& directory, FileWatchListener*
 
 WatchID FileWatcher::addWatch( const std::string& directory, FileWatchListener* watcher,
 							   bool recursive, const std::vector<WatcherOption>& options ) {
-	if ( mImpl->mIsGeneric || !FileSystem::isRemoteFS( directory ) ) {
-		return mImpl->addWatch( directory, watcher, recursive, options );
-	} else {
+	return addSharedWatch( directory, watcher, recursive, options, false );
+}
+
+WatchID FileWatcher::addWatchAsync( const std::string& directory, FileWatchListener* watcher,
+									bool recursive, const std::vector<WatcherOption>& options ) {
+	return addSharedWatch( directory, watcher, recursive, options, true );
+}
+
+WatchID FileWatcher::addSharedWatch( const std::string& directory, FileWatchListener* watcher,
+									 bool recursive, const std::vector<WatcherOption>& options,
+									 bool async ) {
+	if ( !mImpl->mIsGeneric && FileSystem::isRemoteFS( directory ) ) {
 		return Errors::Log::createLastError( Errors::FileRemote, directory );
 	}
+
+	std::function<WatchID( FileWatchListener* )> add = [&]( FileWatchListener* listener ) {
+		return async ? mImpl->addWatchAsync( directory, listener, recursive, options )
+					 : mImpl->addWatch( directory, listener, recursive, options );
+	};
+
+	if ( !WatchGrouper::groupable( options ) ) {
+		return addStagedWatch( directory, watcher, recursive, options, add );
+	}
+
+	std::string dir( WatchGrouper::normalize( directory ) );
+
+	/// A tree watched already with the same options is shared: the new watch joins its group,
+	/// the backend crawls and watches it only for the first one
+	return addStagedWatch(
+		directory, watcher, recursive, options, [&]( FileWatchListener* listener ) {
+			WatchID watchid = mGrouper->join( dir, recursive, options, watcher, listener );
+
+			if ( 0 != watchid ) {
+				if ( async && watchid > 0 ) {
+					listener->handleWatchReady( watchid, 0, 0 );
+				}
+
+				return watchid;
+			}
+
+			GroupingListener* group =
+				new GroupingListener( listener, watcher, dir, recursive, options );
+			watchid = add( group );
+
+			if ( watchid > 0 ) {
+				mGrouper->insert( group, watchid );
+			} else {
+				efSAFE_DELETE( group );
+			}
+
+			return watchid;
+		} );
+}
+
+std::vector<WatchID> FileWatcher::addWatches( const std::vector<WatchSpec>& specs ) {
+	static const size_t NONE = (size_t)-1;
+
+	std::vector<WatchID> ids( specs.size(), 0 );
+	std::vector<std::string> dirs( specs.size() );
+	std::vector<size_t> order( specs.size() );
+
+	for ( size_t i = 0; i < specs.size(); i++ ) {
+		dirs[i] = WatchGrouper::normalize( specs[i].directory );
+		order[i] = i;
+	}
+
+	/// A directory sorts right before the ones inside it, its recursive specs first, so the
+	/// nested ones join the watch of the tree added before them
+	std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+		if ( dirs[a] != dirs[b] )
+			return dirs[a] < dirs[b];
+
+		return specs[a].recursive && !specs[b].recursive;
+	} );
+
+	/// The spec each one repeats, it gets the same id
+	std::vector<size_t> repeats( specs.size(), NONE );
+
+	for ( size_t k = 0; k < order.size(); k++ ) {
+		size_t i = order[k];
+		const WatchSpec& spec = specs[i];
+
+		for ( size_t p = k; p > 0 && dirs[order[p - 1]] == dirs[i]; p-- ) {
+			const WatchSpec& other = specs[order[p - 1]];
+
+			if ( other.listener == spec.listener && other.recursive == spec.recursive &&
+				 WatchGrouper::sameOptions( other.options, spec.options ) ) {
+				repeats[i] = order[p - 1];
+				break;
+			}
+		}
+
+		if ( NONE != repeats[i] ) {
+			ids[i] = ids[repeats[i]];
+		} else {
+			ids[i] = addWatch( spec.directory, spec.listener, spec.recursive, spec.options );
+		}
+	}
+
+	return ids;
+}
+
+WatchID FileWatcher::addStagedWatch(
+	const std::string& directory, FileWatchListener* watcher, bool recursive,
+	const std::vector<WatcherOption>& options,
+	const std::function<WatchID( FileWatchListener* listener )>& add ) {
+	bool journal = 0 != mImpl->getOptionValue( options, Options::Journal, 0 );
+	bool index = 0 != mImpl->getOptionValue( options, Options::TreeIndex, 0 );
+
+	/// The events of a watch without listener are kept for readEvents, unless journaled
+	if ( NULL == watcher && !journal ) {
+		watcher = mQueue;
+	}
+
+	int window = mImpl->getOptionValue( options, Options::CoalesceWindow, 0 );
+	int queueSize = mImpl->getOptionValue( options, Options::DispatchQueueSize, 0 );
+	int rate = mImpl->getOptionValue( options, Options::RateLimit, 0 );
+	int fingerprint = mImpl->getOptionValue( options, Options::ContentFingerprint, 0 );
+	/// The events read with readEvents don't carry the paths
+	bool fullPath =
+		watcher != mQueue && 0 != mImpl->getOptionValue( options, Options::FullPath, 0 );
+
+	std::string snapshotFile( SnapshotStore::file( options ) );
+
+	/// The backend delivers to the dispatch queue, its thread to the coalescing stage, the
+	/// coalescing stage to the fingerprinting one, that to the joining one, that to the counting
+	/// one, that to the journaling one, that to the indexing one and that to the listener
+	StageChain* chain = new StageChain( directory );
+	FileWatchListener* inner = watcher;
+
+	if ( index ) {
+		inner = chain->push( new IndexingListener( inner, directory, recursive, options ) );
+	}
+
+	if ( journal ) {
+		inner = chain->push( new JournalingListener( mJournal, inner, directory ) );
+	}
+
+	FileWatchListener* listener = chain->push( new CountingListener( this, inner, directory ) );
+
+	if ( fullPath ) {
+		listener = chain->push( new JoiningListener( listener, directory ) );
+	}
+
+	if ( 0 != fingerprint ) {
+		listener = chain->push( new FingerprintingListener( listener, directory, fingerprint ) );
+	}
+
+	if ( window > 0 ) {
+		listener = chain->push( new CoalescingListener( mCoalescer, listener, directory, window ) );
+	}
+
+	if ( queueSize > 0 || rate > 0 ) {
+		QueuePolicy policy = (QueuePolicy)mImpl->getOptionValue( options, Options::DispatchPolicy,
+																  QueuePolicies::Block );
+		int burst = mImpl->getOptionValue( options, Options::RateBurst, rate );
+		RatePolicy ratePolicy = (RatePolicy)mImpl->getOptionValue(
+			options, Options::RateLimitPolicy, RatePolicies::Summarize );
+
+		listener = chain->push( new AsyncListener(
+			mDispatcher, listener, directory, queueSize > 0 ? queueSize : RATE_LIMIT_QUEUE_SIZE,
+			policy, rate, burst, ratePolicy ) );
+	}
+
+	WatchID watchid = add( listener );
+
+	if ( watchid > 0 ) {
+		chain->attach( watchid );
+		mStages->insert( chain );
+	} else {
+		efSAFE_DELETE( chain );
+	}
+
+	/// The changes made while the watch wasn't running go through the same listeners
+	if ( !snapshotFile.empty() && watchid > 0 ) {
+		mSnapshots->attach( watchid, directory, listener, recursive,
+							mImpl->getEventInterests( options ), options, followSymlinks(),
+							mImpl->getCounters( watchid ) );
+	}
+
+	return watchid;
 }
 
 void FileWatcher::removeWatch( const std::string& directory ) {
-	mImpl->removeWatch( directory );
+	/// Every watch has its stages, the ones sharing a group as well
+	WatchID watchid = mStages->find( directory );
+
+	if ( 0 != watchid ) {
+		removeWatch( watchid );
+	} else if ( NULL == mReactor ) {
+		/// The backend and the groups of a reactor hold the watches of the other watchers as well
+		mImpl->removeWatch( directory );
+	}
 }
 
 void FileWatcher::removeWatch( WatchID watchid ) {
-	mImpl->removeWatch( watchid );
+	if ( NULL != mReactor && !mStages->contains( watchid ) )
+		return;
+
+	/// A watch sharing its tree with nested ones is only removed from the backend with the last
+	WatchID backend = mGrouper->remove( watchid );
+
+	if ( 0 != backend ) {
+		mImpl->removeWatch( backend );
+		mGrouper->release( backend );
+	}
+
+	StageChain* chain = mStages->remove( watchid );
+	efSAFE_DELETE( chain );
+
+	mSnapshots->release( watchid );
+}
+
+bool FileWatcher::expandWatch( WatchID watchid, const std::string& directory ) {
+	if ( NULL != mReactor && !mStages->contains( watchid ) )
+		return false;
+
+	return mImpl->expandWatch( watchid, directory );
+}
+
+bool FileWatcher::collapseWatch( WatchID watchid, const std::string& directory ) {
+	if ( NULL != mReactor && !mStages->contains( watchid ) )
+		return false;
+
+	return mImpl->collapseWatch( watchid, directory );
+}
+
+bool FileWatcher::findEntry( WatchID watchid, const std::string& path, TreeEntry& entry ) {
+	bool found = false;
+
+	mStages->visit<IndexingListener>(
+		watchid, [&]( IndexingListener& index ) { found = index.find( path, entry ); } );
+
+	return found;
+}
+
+bool FileWatcher::listEntries( WatchID watchid, const std::string& directory,
+							   std::vector<TreeEntry>& entries ) {
+	bool found = false;
+
+	entries.clear();
+
+	mStages->visit<IndexingListener>(
+		watchid, [&]( IndexingListener& index ) { found = index.list( directory, entries ); } );
+
+	return found;
+}
+
+bool FileWatcher::walkEntries( WatchID watchid, const std::string& prefix,
+							   const std::function<bool( const TreeEntry& entry )>& visitor ) {
+	return mStages->visit<IndexingListener>(
+		watchid, [&]( IndexingListener& index ) { index.walk( prefix, visitor ); } );
+}
+
+uint64_t FileWatcher::indexSequence( WatchID watchid ) {
+	uint64_t sequence = 0;
+
+	mStages->visit<IndexingListener>(
+		watchid, [&]( IndexingListener& index ) { sequence = index.sequence(); } );
+
+	return sequence;
 }
 
 void FileWatcher::watch() {
-	mImpl->watch();
+	if ( NULL != mReactor ) {
+		mReactor->watch();
+	} else {
+		mImpl->watch();
+	}
+}
+
+PollHandle FileWatcher::pollHandle() {
+	/// A shared backend is only driven by the thread of its reactor
+	if ( NULL != mReactor ) {
+		return mImpl->FileWatcherImpl::pollHandle();
+	}
+
+	return mImpl->pollHandle();
+}
+
+size_t FileWatcher::readEvents( FileEvent* events, size_t max ) {
+	size_t count = mQueue->read( events, max );
+
+	if ( count < max && NULL == mReactor ) {
+		mImpl->poll();
+
+		count += mQueue->read( events + count, max - count );
+	}
+
+	return count;
+}
+
+void FileWatcher::setJournalCapacity( size_t events ) {
+	mJournal->setCapacity( events );
+}
+
+uint64_t FileWatcher::journalHead() {
+	return mJournal->head();
+}
+
+uint64_t FileWatcher::journalTail() {
+	return mJournal->tail();
+}
+
+size_t FileWatcher::readJournal( uint64_t& cursor, JournalEvent* events, size_t max ) {
+	return mJournal->read( cursor, events, max );
+}
+
+bool FileWatcher::waitJournal( uint64_t cursor, unsigned int milliseconds ) {
+	return mJournal->wait( cursor, milliseconds );
+}
+
+bool FileWatcher::publishJournal( const std::string& name, size_t ringSize, size_t pathsSize ) {
+	if ( !mJournal->publish( name, ringSize, pathsSize ) ) {
+		Errors::Log::createLastError( Errors::Unspecified, name );
+		return false;
+	}
+
+	return true;
 }
 
 std::vector<std::string> FileWatcher::directories() {
-	return mImpl->directories();
+	if ( NULL != mReactor ) {
+		return mStages->directories();
+	}
+
+	std::vector<std::string> dirs( mImpl->directories() );
+	std::vector<std::string> nested( mGrouper->directories() );
+
+	dirs.insert( dirs.end(), nested.begin(), nested.end() );
+
+	return dirs;
+}
+
+DispatchStats FileWatcher::getDispatchStats( WatchID watchid ) {
+	DispatchStats stats = {};
+
+	mStages->visit<AsyncListener>( watchid,
+								   [&]( AsyncListener& stage ) { stats = stage.stats(); } );
+
+	return stats;
+}
+
+WatchStats FileWatcher::getStats( WatchID watchid ) {
+	WatchStats stats = {};
+
+	if ( !mStages->visit<CountingListener>(
+			 watchid, [&]( CountingListener& stage ) { stage.stats( stats ); } ) )
+		return stats;
+
+	if ( std::shared_ptr<WatchCounters> counters = mImpl->getCounters( watchid ) ) {
+		stats.received = WatchCounters::get( counters->Received );
+		stats.filtered = WatchCounters::get( counters->Filtered );
+		stats.kernelWatches = WatchCounters::get( counters->KernelWatches );
+		stats.scans = WatchCounters::get( counters->Scans );
+		stats.scanTime = WatchCounters::get( counters->ScanTime );
+	}
+
+	DispatchStats dispatch = getDispatchStats( watchid );
+
+	mStages->visit<FingerprintingListener>(
+		watchid, [&]( FingerprintingListener& stage ) { stats.filtered += stage.suppressed(); } );
+
+	mStages->visit<CoalescingListener>(
+		watchid, [&]( CoalescingListener& stage ) { stats.coalesced += stage.coalesced(); } );
+	stats.coalesced += dispatch.coalesced;
+	stats.dropped = dispatch.dropped + dispatch.limited;
+
+	return stats;
+}
+
+WatchStats FileWatcher::getStats() {
+	WatchStats total = {};
+	std::vector<WatchID> watches( mStages->watches() );
+
+	for ( size_t i = 0; i < watches.size(); i++ ) {
+		WatchStats stats = getStats( watches[i] );
+
+		total.received += stats.received;
+		total.filtered += stats.filtered;
+		total.coalesced += stats.coalesced;
+		total.dropped += stats.dropped;
+		total.delivered += stats.delivered;
+		total.overflows += stats.overflows;
+		total.kernelWatches += stats.kernelWatches;
+		total.scans += stats.scans;
+		total.scanTime += stats.scanTime;
+		total.lastCrawl = std::max( total.lastCrawl, stats.lastCrawl );
+		total.crawlTime += stats.crawlTime;
+	}
+
+	return total;
+}
+
+LatencyStats FileWatcher::getLatency( WatchID watchid ) {
+	LatencyStats stats = {};
+
+	mStages->visit<CountingListener>(
+		watchid, [&]( CountingListener& stage ) { stage.latency( stats, false ); } );
+
+	return stats;
+}
+
+LatencyStats FileWatcher::getListenerTime( WatchID watchid ) {
+	LatencyStats stats = {};
+
+	mStages->visit<CountingListener>(
+		watchid, [&]( CountingListener& stage ) { stage.latency( stats, true ); } );
+
+	return stats;
+}
+
+void FileWatcher::setTraceHooks( TraceHooks* hooks ) {
+	mTraceHooks = hooks;
+}
+
+TraceHooks* FileWatcher::traceHooks() const {
+	return mTraceHooks;
+}
+
+bool FileWatcher::setShards( unsigned int shards ) {
+	if ( NULL != mReactor || shards < 2 || !mImpl->directories().empty() )
+		return false;
+
+	FileWatcherImpl* impl = mImpl->shard( shards );
+
+	if ( NULL == impl )
+		return false;
+
+	if ( !impl->initOK() ) {
+		efSAFE_DELETE( impl );
+		return false;
+	}
+
+	efSAFE_DELETE( mImpl );
+	mImpl = impl;
+
+	return true;
+}
+
+uint64_t FileWatcher::getEventId() {
+	return mImpl->getEventId();
+}
+
+uint64_t FileWatcher::getEventId( WatchID watchid ) {
+	return mImpl->getEventId( watchid );
 }
 
 void FileWatcher::followSymlinks( bool follow ) {
+	/// The backend shared reads the ones of the reactor, for the watches of every watcher
+	if ( NULL != mReactor )
+		return;
+
 	mFollowSymlinks = follow;
 }
 
 const bool& FileWatcher::followSymlinks() const {
-	return mFollowSymlinks;
+	return NULL != mReactor ? mReactor->mHost->mFollowSymlinks : mFollowSymlinks;
 }
 
 void FileWatcher::allowOutOfScopeLinks( bool allow ) {
+	if ( NULL != mReactor )
+		return;
+
 	mOutOfScopeLinks = allow;
 }
 
 const bool& FileWatcher::allowOutOfScopeLinks() const {
-	return mOutOfScopeLinks;
+	return NULL != mReactor ? mReactor->mHost->mOutOfScopeLinks : mOutOfScopeLinks;
 }
 
 } // namespace efsw
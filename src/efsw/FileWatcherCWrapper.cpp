@@ -23,10 +23,69 @@ class Watcher_CAPI : public efsw::FileWatchListener {
 	}
 };
 
+/// Listener of the watches added with efsw_addwatch_batch
+class BatchWatcher_CAPI : public efsw::FileWatchListener {
+  public:
+	efsw_watcher mWatcher;
+	efsw_pfn_batch_callback mFn;
+	void* mParam;
+
+  public:
+	BatchWatcher_CAPI( efsw_watcher watcher, efsw_pfn_batch_callback fn, void* param ) :
+		mWatcher( watcher ), mFn( fn ), mParam( param ) {}
+
+	void handleFileEvent( efsw::WatchID watchid, std::string_view dir, std::string_view filename,
+						  efsw::Action action, std::string_view oldFilename = {} ) override {
+		efsw::Event event;
+		event.watchid = watchid;
+		event.dir = dir;
+		event.filename = filename;
+		event.action = action;
+		event.oldFilename = oldFilename;
+
+		handleFileActions( &event, 1 );
+	}
+
+	void handleFileActions( const efsw::Event* events, size_t count ) override {
+		/// The watches sharing the callback can be delivered from several threads at once
+		static thread_local std::vector<efsw_event> batch;
+
+		batch.resize( count );
+
+		for ( size_t i = 0; i < count; i++ ) {
+			batch[i].watchid = events[i].watchid;
+			batch[i].action = (enum efsw_action)events[i].action;
+			batch[i].dir = events[i].dir.data();
+			batch[i].dir_length = events[i].dir.size();
+			batch[i].filename = events[i].filename.data();
+			batch[i].filename_length = events[i].filename.size();
+			batch[i].old_filename = events[i].oldFilename.data();
+			batch[i].old_filename_length = events[i].oldFilename.size();
+		}
+
+		mFn( mWatcher, batch.data(), count, mParam );
+	}
+};
+
+/// The buffer of the events a watcher read with efsw_read_events, their strings valid until the
+/// next read
+struct ReadBuffer_CAPI {
+	efsw_watcher mWatcher;
+	std::vector<efsw::FileEvent> mEvents;
+};
+
+/// A journal reader with the buffer of the events it reads
+struct JournalReader_CAPI {
+	efsw::JournalReader mReader;
+	std::vector<efsw::JournalView> mViews;
+};
+
 /*************************************************************************************************
  * globals
  */
 static std::vector<Watcher_CAPI*> g_callbacks;
+static std::vector<BatchWatcher_CAPI*> g_batch_callbacks;
+static std::vector<ReadBuffer_CAPI*> g_read_buffers;
 
 Watcher_CAPI* find_callback( efsw_watcher watcher, efsw_pfn_fileaction_callback fn ) {
 	for ( std::vector<Watcher_CAPI*>::iterator i = g_callbacks.begin(); i != g_callbacks.end();
@@ -63,10 +122,48 @@ efsw_watcher efsw_create( int generic_mode ) {
 void efsw_release( efsw_watcher watcher ) {
 	remove_callback( watcher );
 	delete (efsw::FileWatcher*)watcher;
+
+	/// Deleted once the watcher can't deliver to them anymore
+	for ( size_t i = 0; i < g_batch_callbacks.size(); ) {
+		if ( g_batch_callbacks[i]->mWatcher == watcher ) {
+			delete g_batch_callbacks[i];
+			g_batch_callbacks.erase( g_batch_callbacks.begin() + i );
+		} else {
+			i++;
+		}
+	}
+
+	for ( size_t i = 0; i < g_read_buffers.size(); i++ ) {
+		if ( g_read_buffers[i]->mWatcher == watcher ) {
+			delete g_read_buffers[i];
+			g_read_buffers.erase( g_read_buffers.begin() + i );
+			break;
+		}
+	}
+}
+
+efsw_reactor efsw_reactor_create( int generic_mode ) {
+	return ( efsw_reactor ) new efsw::Reactor( TOBOOL( generic_mode ) );
+}
+
+void efsw_reactor_release( efsw_reactor reactor ) {
+	delete (efsw::Reactor*)reactor;
+}
+
+efsw_watcher efsw_create_with_reactor( efsw_reactor reactor ) {
+	return ( efsw_watcher ) new efsw::FileWatcher( *(efsw::Reactor*)reactor );
+}
+
+void efsw_reactor_follow_symlinks( efsw_reactor reactor, int enable ) {
+	( (efsw::Reactor*)reactor )->followSymlinks( TOBOOL( enable ) );
+}
+
+void efsw_reactor_allow_outofscopelinks( efsw_reactor reactor, int allow ) {
+	( (efsw::Reactor*)reactor )->allowOutOfScopeLinks( TOBOOL( allow ) );
 }
 
 const char* efsw_getlasterror() {
-	static std::string log_str;
+	static thread_local std::string log_str;
 	log_str = efsw::Errors::Log::getLastErrorLog();
 	return log_str.c_str();
 }
@@ -80,17 +177,24 @@ efsw_watchid efsw_addwatch( efsw_watcher watcher, const char* directory,
 	return efsw_addwatch_withoptions( watcher, directory, callback_fn, recursive, 0, 0, param );
 }
 
-efsw_watchid  efsw_addwatch_withoptions(efsw_watcher watcher, const char* directory,
-										efsw_pfn_fileaction_callback callback_fn, int recursive,
-										efsw_watcher_option *options, int options_number,
-										void* param) {
-	Watcher_CAPI* callback = find_callback( watcher, callback_fn );
+static Watcher_CAPI* get_callback( efsw_watcher watcher, efsw_pfn_fileaction_callback fn,
+								   void* param ) {
+	/// The events of a watch without callback are read with efsw_read_events
+	if ( NULL == fn )
+		return NULL;
+
+	Watcher_CAPI* callback = find_callback( watcher, fn );
 
 	if ( callback == NULL ) {
-		callback = new Watcher_CAPI( watcher, callback_fn, param );
+		callback = new Watcher_CAPI( watcher, fn, param );
 		g_callbacks.push_back( callback );
 	}
 
+	return callback;
+}
+
+static std::vector<efsw::WatcherOption> get_options( efsw_watcher_option* options,
+													 int options_number ) {
 	std::vector<efsw::WatcherOption> watcher_options{};
 	for ( int i = 0; i < options_number; i++ ) {
 		efsw_watcher_option* option = &options[i];
@@ -98,8 +202,61 @@ efsw_watchid  efsw_addwatch_withoptions(efsw_watcher watcher, const char* direct
 			static_cast<efsw::Option>(option->option), option->value } );
 	}
 
+	return watcher_options;
+}
+
+efsw_watchid  efsw_addwatch_withoptions(efsw_watcher watcher, const char* directory,
+										efsw_pfn_fileaction_callback callback_fn, int recursive,
+										efsw_watcher_option *options, int options_number,
+										void* param) {
+	Watcher_CAPI* callback = get_callback( watcher, callback_fn, param );
+
 	return ( (efsw::FileWatcher*)watcher )
-		->addWatch( std::string( directory ), callback, TOBOOL( recursive ), watcher_options );
+		->addWatch( std::string( directory ), callback, TOBOOL( recursive ),
+					get_options( options, options_number ) );
+}
+
+efsw_watchid efsw_addwatch_batch( efsw_watcher watcher, const char* directory,
+								  efsw_pfn_batch_callback callback_fn, int recursive,
+								  efsw_watcher_option* options, int options_number,
+								  void* param ) {
+	BatchWatcher_CAPI* callback = NULL;
+
+	for ( size_t i = 0; i < g_batch_callbacks.size(); i++ ) {
+		if ( g_batch_callbacks[i]->mFn == callback_fn &&
+			 g_batch_callbacks[i]->mWatcher == watcher ) {
+			callback = g_batch_callbacks[i];
+			break;
+		}
+	}
+
+	if ( NULL == callback ) {
+		callback = new BatchWatcher_CAPI( watcher, callback_fn, param );
+		g_batch_callbacks.push_back( callback );
+	}
+
+	return ( (efsw::FileWatcher*)watcher )
+		->addWatch( std::string( directory ), callback, TOBOOL( recursive ),
+					get_options( options, options_number ) );
+}
+
+void efsw_addwatches( efsw_watcher watcher, const efsw_watch_spec* specs, int count,
+					  efsw_watchid* ids ) {
+	std::vector<efsw::WatchSpec> watch_specs( count );
+
+	for ( int i = 0; i < count; i++ ) {
+		watch_specs[i].directory = specs[i].directory;
+		watch_specs[i].listener = get_callback( watcher, specs[i].callback_fn, specs[i].param );
+		watch_specs[i].recursive = TOBOOL( specs[i].recursive );
+		watch_specs[i].options = get_options( specs[i].options, specs[i].options_number );
+	}
+
+	std::vector<efsw::WatchID> watch_ids =
+		( (efsw::FileWatcher*)watcher )->addWatches( watch_specs );
+
+	for ( int i = 0; i < count; i++ ) {
+		ids[i] = watch_ids[i];
+	}
 }
 
 void efsw_removewatch( efsw_watcher watcher, const char* directory ) {
@@ -110,10 +267,200 @@ void efsw_removewatch_byid( efsw_watcher watcher, efsw_watchid watchid ) {
 	( (efsw::FileWatcher*)watcher )->removeWatch( watchid );
 }
 
+int efsw_expandwatch( efsw_watcher watcher, efsw_watchid watchid, const char* directory ) {
+	return ( (efsw::FileWatcher*)watcher )->expandWatch( watchid, directory ) ? 1 : 0;
+}
+
+int efsw_collapsewatch( efsw_watcher watcher, efsw_watchid watchid, const char* directory ) {
+	return ( (efsw::FileWatcher*)watcher )->collapseWatch( watchid, directory ) ? 1 : 0;
+}
+
+static void assignEntry( efsw_tree_entry* entry, const efsw::TreeEntry& treeEntry ) {
+	entry->path = treeEntry.path.c_str();
+	entry->directory = treeEntry.directory ? 1 : 0;
+	entry->size = treeEntry.size;
+	entry->modification_time = treeEntry.modificationTime;
+	entry->inode = treeEntry.inode;
+	entry->sequence = treeEntry.sequence;
+}
+
+int efsw_find_entry( efsw_watcher watcher, efsw_watchid watchid, const char* path,
+					 efsw_tree_entry* entry ) {
+	static thread_local efsw::TreeEntry found;
+
+	if ( !( (efsw::FileWatcher*)watcher )->findEntry( watchid, path, found ) )
+		return 0;
+
+	assignEntry( entry, found );
+
+	return 1;
+}
+
+int efsw_list_entries( efsw_watcher watcher, efsw_watchid watchid, const char* directory,
+					   efsw_pfn_entry_callback callback_fn, void* param ) {
+	std::vector<efsw::TreeEntry> entries;
+
+	if ( !( (efsw::FileWatcher*)watcher )->listEntries( watchid, directory, entries ) )
+		return 0;
+
+	efsw_tree_entry entry;
+
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		assignEntry( &entry, entries[i] );
+
+		if ( 0 == callback_fn( &entry, param ) )
+			break;
+	}
+
+	return 1;
+}
+
+int efsw_walk_entries( efsw_watcher watcher, efsw_watchid watchid, const char* prefix,
+					   efsw_pfn_entry_callback callback_fn, void* param ) {
+	efsw_tree_entry entry;
+
+	return ( (efsw::FileWatcher*)watcher )
+				   ->walkEntries( watchid, prefix,
+								  [&]( const efsw::TreeEntry& treeEntry ) {
+									  assignEntry( &entry, treeEntry );
+									  return 0 != callback_fn( &entry, param );
+								  } )
+			   ? 1
+			   : 0;
+}
+
+unsigned long long efsw_index_sequence( efsw_watcher watcher, efsw_watchid watchid ) {
+	return ( (efsw::FileWatcher*)watcher )->indexSequence( watchid );
+}
+
+int efsw_set_shards( efsw_watcher watcher, unsigned int shards ) {
+	return (int)( (efsw::FileWatcher*)watcher )->setShards( shards );
+}
+
 void efsw_watch( efsw_watcher watcher ) {
 	( (efsw::FileWatcher*)watcher )->watch();
 }
 
+efsw_poll_handle efsw_get_fd( efsw_watcher watcher ) {
+	return ( (efsw::FileWatcher*)watcher )->pollHandle();
+}
+
+size_t efsw_read_events( efsw_watcher watcher, efsw_event* events, size_t max ) {
+	ReadBuffer_CAPI* buffer = NULL;
+
+	for ( size_t i = 0; i < g_read_buffers.size(); i++ ) {
+		if ( g_read_buffers[i]->mWatcher == watcher ) {
+			buffer = g_read_buffers[i];
+			break;
+		}
+	}
+
+	if ( NULL == buffer ) {
+		buffer = new ReadBuffer_CAPI();
+		buffer->mWatcher = watcher;
+		g_read_buffers.push_back( buffer );
+	}
+
+	/// Reused between reads, the strings keep their capacity
+	if ( buffer->mEvents.size() < max ) {
+		buffer->mEvents.resize( max );
+	}
+
+	size_t count = ( (efsw::FileWatcher*)watcher )->readEvents( buffer->mEvents.data(), max );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		const efsw::FileEvent& event = buffer->mEvents[i];
+
+		events[i].watchid = event.watchid;
+		events[i].action = (enum efsw_action)event.action;
+		events[i].dir = event.dir.c_str();
+		events[i].dir_length = event.dir.size();
+		events[i].filename = event.filename.c_str();
+		events[i].filename_length = event.filename.size();
+		events[i].old_filename = event.oldFilename.c_str();
+		events[i].old_filename_length = event.oldFilename.size();
+	}
+
+	return count;
+}
+
+void efsw_getstats( efsw_watcher watcher, efsw_watchid watchid, efsw_stats* stats ) {
+	efsw::WatchStats ws = 0 == watchid ? ( (efsw::FileWatcher*)watcher )->getStats()
+									   : ( (efsw::FileWatcher*)watcher )->getStats( watchid );
+
+	stats->received = ws.received;
+	stats->filtered = ws.filtered;
+	stats->coalesced = ws.coalesced;
+	stats->dropped = ws.dropped;
+	stats->delivered = ws.delivered;
+	stats->overflows = ws.overflows;
+	stats->kernel_watches = ws.kernelWatches;
+	stats->scans = ws.scans;
+	stats->scan_time = ws.scanTime;
+	stats->last_crawl = ws.lastCrawl;
+	stats->crawl_time = ws.crawlTime;
+}
+
+int efsw_publish_journal( efsw_watcher watcher, const char* name, size_t ring_size,
+						  size_t paths_size ) {
+	return (int)( (efsw::FileWatcher*)watcher )
+		->publishJournal( name, 0 != ring_size ? ring_size : 16 << 20,
+						  0 != paths_size ? paths_size : 4 << 20 );
+}
+
+efsw_journal_reader efsw_journal_open( const char* name ) {
+	JournalReader_CAPI* reader = new JournalReader_CAPI();
+
+	if ( !reader->mReader.open( name ) ) {
+		delete reader;
+		return NULL;
+	}
+
+	return ( efsw_journal_reader )reader;
+}
+
+void efsw_journal_close( efsw_journal_reader reader ) {
+	delete (JournalReader_CAPI*)reader;
+}
+
+size_t efsw_journal_read( efsw_journal_reader reader, efsw_journal_event* events, size_t max ) {
+	JournalReader_CAPI* r = (JournalReader_CAPI*)reader;
+
+	if ( r->mViews.size() < max ) {
+		r->mViews.resize( max );
+	}
+
+	size_t count = r->mReader.read( r->mViews.data(), max );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		const efsw::JournalView& view = r->mViews[i];
+
+		events[i].sequence = view.sequence;
+		events[i].watchid = view.watchid;
+		events[i].action = (enum efsw_action)view.action;
+		events[i].dir = view.dir.data();
+		events[i].dir_length = view.dir.size();
+		events[i].filename = view.filename.data();
+		events[i].filename_length = view.filename.size();
+		events[i].old_filename = view.oldFilename.data();
+		events[i].old_filename_length = view.oldFilename.size();
+	}
+
+	return count;
+}
+
+int efsw_journal_intact( efsw_journal_reader reader ) {
+	return (int)( (JournalReader_CAPI*)reader )->mReader.intact();
+}
+
+int efsw_journal_wait( efsw_journal_reader reader, unsigned int milliseconds ) {
+	return (int)( (JournalReader_CAPI*)reader )->mReader.wait( milliseconds );
+}
+
+int efsw_journal_closed( efsw_journal_reader reader ) {
+	return (int)( (JournalReader_CAPI*)reader )->mReader.closed();
+}
+
 void efsw_follow_symlinks( efsw_watcher watcher, int enable ) {
 	( (efsw::FileWatcher*)watcher )->followSymlinks( TOBOOL( enable ) );
 }
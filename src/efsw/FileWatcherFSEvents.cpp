@@ -7,6 +7,8 @@
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_FSEVENTS
 
+#include <algorithm>
+#include <cstring>
 #include <sys/utsname.h>
 
 namespace efsw {
@@ -41,29 +43,92 @@ bool FileWatcherFSEvents::isGranular() {
 	return getOSXReleaseNumber() >= 11;
 }
 
+bool FileWatcherFSEvents::hasExtendedData() {
+	return getOSXReleaseNumber() >= 17;
+}
+
+static std::string stringFromCFString( CFStringRef string ) {
+	const char* cstr = CFStringGetCStringPtr( string, kCFStringEncodingUTF8 );
+
+	if ( NULL != cstr ) {
+		return std::string( cstr );
+	}
+
+	CFIndex maxSize = CFStringGetMaximumSizeForEncoding( CFStringGetLength( string ),
+														 kCFStringEncodingUTF8 );
+
+	if ( maxSize == kCFNotFound ) {
+		return std::string();
+	}
+
+	std::string result( maxSize + 1, '\0' );
+
+	if ( !CFStringGetCString( string, &result[0], result.size(), kCFStringEncodingUTF8 ) ) {
+		return std::string();
+	}
+
+	result.resize( std::strlen( result.c_str() ) );
+
+	return result;
+}
+
 void FileWatcherFSEvents::FSEventCallback( ConstFSEventStreamRef streamRef, void* userData,
 										   size_t numEvents, void* eventPaths,
 										   const FSEventStreamEventFlags eventFlags[],
 										   const FSEventStreamEventId eventIds[] ) {
-	WatcherFSEvents* watcher = static_cast<WatcherFSEvents*>( userData );
+	FileWatcherFSEvents* watcher = static_cast<FileWatcherFSEvents*>( userData );
 
 	std::vector<FSEvent> events;
 	events.reserve( numEvents );
 
-	for ( size_t i = 0; i < numEvents; i++ ) {
-		events.push_back( FSEvent( std::string( ( (char**)eventPaths )[i] ), (long)eventFlags[i],
-								   (Uint64)eventIds[i] ) );
-	}
+	if ( watcher->mExtendedData ) {
+		/// A dictionary per event, with the path and the inode of the item
+		CFArrayRef array = static_cast<CFArrayRef>( eventPaths );
+
+		for ( size_t i = 0; i < numEvents; i++ ) {
+			CFDictionaryRef data =
+				static_cast<CFDictionaryRef>( CFArrayGetValueAtIndex( array, i ) );
+			CFStringRef path = static_cast<CFStringRef>(
+				CFDictionaryGetValue( data, CFSTR( "path" ) ) );
+			CFNumberRef fileId = static_cast<CFNumberRef>(
+				CFDictionaryGetValue( data, CFSTR( "fileID" ) ) );
+			SInt64 inode = 0;
+
+			if ( NULL != fileId ) {
+				CFNumberGetValue( fileId, kCFNumberSInt64Type, &inode );
+			}
 
-	watcher->handleActions( events );
+			events.push_back( FSEvent( NULL != path ? stringFromCFString( path ) : std::string(),
+									   (long)eventFlags[i], (Uint64)eventIds[i],
+									   (Uint64)inode ) );
+		}
+	} else {
+		for ( size_t i = 0; i < numEvents; i++ ) {
+			events.push_back( FSEvent( std::string( ( (char**)eventPaths )[i] ),
+									   (long)eventFlags[i], (Uint64)eventIds[i] ) );
+		}
+	}
 
-	watcher->process();
+	watcher->handleEvents( events );
 
 	efDEBUG( "\n" );
 }
 
+void FileWatcherFSEvents::restartStreamCallback( void* context ) {
+	static_cast<FileWatcherFSEvents*>( context )->restartStream();
+}
+
+void FileWatcherFSEvents::stopStreamCallback( void* context ) {
+	static_cast<FileWatcherFSEvents*>( context )->stopStream();
+}
+
 FileWatcherFSEvents::FileWatcherFSEvents( FileWatcher* parent ) :
-	FileWatcherImpl( parent ), mLastWatchID( 0 ) {
+	FileWatcherImpl( parent ),
+	mStream( NULL ),
+	mQueue( dispatch_queue_create( NULL, NULL ) ),
+	mLastEventId( 0 ),
+	mExtendedData( false ),
+	mLastWatchID( 0 ) {
 	mInitOK = true;
 
 	watch();
@@ -72,6 +137,10 @@ FileWatcherFSEvents::FileWatcherFSEvents( FileWatcher* parent ) :
 FileWatcherFSEvents::~FileWatcherFSEvents() {
 	mInitOK = false;
 
+	dispatch_sync_f( mQueue, this, &FileWatcherFSEvents::stopStreamCallback );
+
+	dispatch_release( mQueue );
+
 	WatchMap::iterator iter = mWatches.begin();
 
 	for ( ; iter != mWatches.end(); ++iter ) {
@@ -122,45 +191,68 @@ WatchID FileWatcherFSEvents::addWatch( const std::string& directory, FileWatchLi
 	pWatch->ID = mLastWatchID;
 	pWatch->Directory = dir;
 	pWatch->Recursive = recursive;
+	pWatch->EventInterests = getEventInterests( options );
+	pWatch->Filter = PathFilter::create( dir, options );
 	pWatch->FWatcher = this;
+	pWatch->SinceId = FSEventsGetCurrentEventId();
+
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		Uint64 since;
+
+		if ( Options::FSEventsSinceId == options[i].mOption &&
+			 String::fromString<Uint64>( since, options[i].mPattern ) ) {
+			pWatch->SinceId = since;
+			pWatch->ReportHistory = true;
+		}
+	}
+
+	pWatch->Latency = std::max( 0, getOptionValue( options, Options::FSEventsLatency, 0 ) );
+	pWatch->NoDefer = 0 != getOptionValue( options, Options::FSEventsNoDefer, 1 );
+	pWatch->FileEvents =
+		isGranular() && 0 != getOptionValue( options, Options::FSEventsFileEvents, 1 );
 
 	pWatch->init();
 
 	{
 		Lock lock( mWatchesLock );
 		mWatches.insert( std::make_pair( mLastWatchID, pWatch ) );
+		mWatchRegistry.add( pWatch );
 	}
+
+	/// Serialized with the callbacks. They lock the watches, so it's called without the lock.
+	dispatch_sync_f( mQueue, this, &FileWatcherFSEvents::restartStreamCallback );
+
 	return pWatch->ID;
 }
 
 void FileWatcherFSEvents::removeWatch( const std::string& directory ) {
-	Lock lock( mWatchesLock );
-
-	WatchMap::iterator iter = mWatches.begin();
+	Watcher* watch = mWatchRegistry.find( directory );
 
-	for ( ; iter != mWatches.end(); ++iter ) {
-		if ( directory == iter->second->Directory ) {
-			removeWatch( iter->second->ID );
-			return;
-		}
+	if ( NULL != watch ) {
+		removeWatch( watch->ID );
 	}
 }
 
 void FileWatcherFSEvents::removeWatch( WatchID watchid ) {
-	Lock lock( mWatchesLock );
+	{
+		Lock lock( mWatchesLock );
 
-	WatchMap::iterator iter = mWatches.find( watchid );
+		WatchMap::iterator iter = mWatches.find( watchid );
 
-	if ( iter == mWatches.end() )
-		return;
+		if ( iter == mWatches.end() )
+			return;
 
-	WatcherFSEvents* watch = iter->second;
+		WatcherFSEvents* watch = iter->second;
 
-	mWatches.erase( iter );
+		mWatches.erase( iter );
+		mWatchRegistry.remove( watchid );
 
-	efDEBUG( "Removed watch %s\n", watch->Directory.c_str() );
+		efDEBUG( "Removed watch %s\n", watch->Directory.c_str() );
 
-	efSAFE_DELETE( watch );
+		efSAFE_DELETE( watch );
+	}
+
+	dispatch_sync_f( mQueue, this, &FileWatcherFSEvents::restartStreamCallback );
 }
 
 void FileWatcherFSEvents::watch() {}
@@ -171,27 +263,198 @@ void FileWatcherFSEvents::handleAction( Watcher* watch, const std::string& filen
 }
 
 std::vector<std::string> FileWatcherFSEvents::directories() {
-	std::vector<std::string> dirs;
+	return mWatchRegistry.directories();
+}
+
+Uint64 FileWatcherFSEvents::getEventId() {
+	return mLastEventId.load();
+}
+
+bool FileWatcherFSEvents::pathInWatches( const std::string& path ) {
+	return mWatchRegistry.contains( path );
+}
 
+void FileWatcherFSEvents::handleEvents( std::vector<FSEvent>& events ) {
 	Lock lock( mWatchesLock );
 
-	dirs.reserve( mWatches.size() );
+	/// The events of each watch keep their order, so its renames are still paired
+	std::map<WatchID, std::vector<FSEvent>> dispatch;
+	std::string dir;
+	Uint64 lastId = mLastEventId.load();
+	bool historyDone = false;
+	bool wrapped = false;
+
+	for ( size_t i = 0; i < events.size(); i++ ) {
+		const FSEvent& event = events[i];
+
+		/// The notices of the stream aren't about a path
+		if ( event.Flags & kFSEventStreamEventFlagHistoryDone ) {
+			historyDone = true;
+			continue;
+		}
+
+		if ( event.Flags & kFSEventStreamEventFlagEventIdsWrapped ) {
+			wrapped = true;
+			continue;
+		}
+
+		if ( event.Id > lastId ) {
+			lastId = event.Id;
+		}
+
+		dir = event.Path;
+		FileSystem::dirAddSlashAtEnd( dir );
+
+		/// The watches can be nested, every watch above the path gets the event
+		while ( !dir.empty() ) {
+			WatcherFSEvents* watch = static_cast<WatcherFSEvents*>( mWatchRegistry.find( dir ) );
+
+			if ( NULL != watch && event.Id > watch->SinceId ) {
+				dispatch[watch->ID].push_back( event );
+			}
+
+			size_t pos = dir.size() > 1 ? dir.find_last_of( '/', dir.size() - 2 )
+										 : std::string::npos;
+
+			if ( std::string::npos == pos )
+				break;
+
+			dir.resize( pos + 1 );
+		}
+	}
+
+	for ( std::map<WatchID, std::vector<FSEvent>>::iterator it = dispatch.begin();
+		  it != dispatch.end(); ++it ) {
+		WatchMap::iterator wit = mWatches.find( it->first );
+
+		if ( wit != mWatches.end() ) {
+			wit->second->handleActions( it->second );
+			wit->second->process();
+		}
+	}
+
+	mLastEventId = lastId;
 
 	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		dirs.push_back( std::string( it->second->Directory ) );
+		WatcherFSEvents* watch = it->second;
+
+		/// The IDs starting over, the ones saved can't be resumed from
+		if ( wrapped ) {
+			watch->sendNotice( Actions::Overflow );
+		}
+
+		if ( historyDone && watch->ReportHistory && watch->Started ) {
+			watch->ReportHistory = false;
+			watch->sendNotice( Actions::HistoryDone );
+		}
 	}
+}
 
-	return dirs;
+void FileWatcherFSEvents::stopStream() {
+	if ( NULL != mStream ) {
+		FSEventStreamStop( mStream );
+		FSEventStreamInvalidate( mStream );
+		FSEventStreamRelease( mStream );
+		mStream = NULL;
+	}
 }
 
-bool FileWatcherFSEvents::pathInWatches( const std::string& path ) {
-	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		if ( it->second->Directory == path ) {
-			return true;
+void FileWatcherFSEvents::restartStream() {
+	stopStream();
+
+	std::vector<std::string> dirs;
+	/// The stream serves every watch: the smallest latency, and the events of the files or not
+	/// deferring if any watch asks so
+	int latency = -1;
+	bool noDefer = false;
+	bool fileEvents = false;
+
+	/// The first stream starts from now, the next ones from the last event delivered, replaying
+	/// what happened meanwhile, or from the earliest event a watch added asks for
+	if ( 0 == mLastEventId.load() ) {
+		mLastEventId = FSEventsGetCurrentEventId();
+	}
+
+	Uint64 since = mLastEventId.load();
+
+	{
+		Lock lock( mWatchesLock );
+
+		for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+			WatcherFSEvents* watch = it->second;
+
+			dirs.push_back( watch->Directory );
+
+			if ( watch->Started ) {
+				/// The events it already got are replayed for the others only
+				watch->SinceId = std::max( watch->SinceId, mLastEventId.load() );
+			} else {
+				watch->Started = true;
+				since = std::min( since, watch->SinceId );
+			}
+
+			if ( latency < 0 || watch->Latency < latency ) {
+				latency = watch->Latency;
+			}
+
+			noDefer = noDefer || watch->NoDefer;
+			fileEvents = fileEvents || watch->FileEvents;
 		}
 	}
 
-	return false;
+	if ( dirs.empty() )
+		return;
+
+	std::vector<CFStringRef> cfDirs;
+	cfDirs.reserve( dirs.size() );
+
+	for ( size_t i = 0; i < dirs.size(); i++ ) {
+		cfDirs.push_back(
+			CFStringCreateWithCString( NULL, dirs[i].c_str(), kCFStringEncodingUTF8 ) );
+	}
+
+	CFArrayRef CFDirectoryArray =
+		CFArrayCreate( NULL, (const void**)cfDirs.data(), cfDirs.size(), &kCFTypeArrayCallBacks );
+
+	for ( size_t i = 0; i < cfDirs.size(); i++ ) {
+		CFRelease( cfDirs[i] );
+	}
+
+	Uint32 streamFlags = kFSEventStreamCreateFlagNone;
+
+	if ( fileEvents ) {
+		streamFlags |= efswFSEventStreamCreateFlagFileEvents;
+	}
+
+	if ( noDefer ) {
+		streamFlags |= efswFSEventStreamCreateFlagNoDefer;
+	}
+
+	/// The inodes pair the renames without stat'ing the items
+	mExtendedData = fileEvents && hasExtendedData();
+
+	if ( mExtendedData ) {
+		streamFlags |=
+			efswFSEventStreamCreateFlagUseCFTypes | efswFSEventStreamCreateFlagUseExtendedData;
+	}
+
+	FSEventStreamContext ctx;
+	/* Initialize context */
+	ctx.version = 0;
+	ctx.info = this;
+	ctx.retain = NULL;
+	ctx.release = NULL;
+	ctx.copyDescription = NULL;
+
+	mStream = FSEventStreamCreate( kCFAllocatorDefault, &FileWatcherFSEvents::FSEventCallback,
+								   &ctx, CFDirectoryArray, since, latency / 1000.,
+								   streamFlags );
+
+	FSEventStreamSetDispatchQueue( mStream, mQueue );
+
+	FSEventStreamStart( mStream );
+
+	CFRelease( CFDirectoryArray );
 }
 
 } // namespace efsw
@@ -19,8 +19,10 @@ namespace efsw {
 /* OSX < 10.7 has no file events */
 /* So i declare the events constants */
 enum FSEventEvents {
+	efswFSEventStreamCreateFlagUseCFTypes = 0x00000001,
 	efswFSEventStreamCreateFlagNoDefer = 0x00000002,
 	efswFSEventStreamCreateFlagFileEvents = 0x00000010,
+	efswFSEventStreamCreateFlagUseExtendedData = 0x00000040,
 	efswFSEventStreamEventFlagItemCreated = 0x00000100,
 	efswFSEventStreamEventFlagItemRemoved = 0x00000200,
 	efswFSEventStreamEventFlagItemInodeMetaMod = 0x00000400,
@@ -46,6 +48,9 @@ class FileWatcherFSEvents : public FileWatcherImpl {
 	/// @return If FSEvents supports file-level notifications ( true if OS X >= 10.7 )
 	static bool isGranular();
 
+	/// @return If FSEvents can report the inodes of the items ( true if macOS >= 10.13 )
+	static bool hasExtendedData();
+
 	/// type for a map from WatchID to WatcherWin32 pointer
 	typedef std::map<WatchID, WatcherFSEvents*> WatchMap;
 
@@ -58,7 +63,7 @@ class FileWatcherFSEvents : public FileWatcherImpl {
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 	                  const std::vector<WatcherOption> &options ) override;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Remove a directory watch. This is a hash lookup O(1).
 	void removeWatch( const std::string& directory ) override;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -74,14 +79,34 @@ class FileWatcherFSEvents : public FileWatcherImpl {
 	/// @return Returns a list of the directories that are being watched
 	std::vector<std::string> directories() override;
 
+	Uint64 getEventId() override;
+
 private:
 	static void FSEventCallback( ConstFSEventStreamRef streamRef, void* userData, size_t numEvents,
 								 void* eventPaths, const FSEventStreamEventFlags eventFlags[],
 								 const FSEventStreamEventId eventIds[] );
 
+	static void restartStreamCallback( void* context );
+
+	static void stopStreamCallback( void* context );
+
 	/// Vector of WatcherWin32 pointers
 	WatchMap mWatches;
 
+	/// The stream of the directories of all the watches, NULL while there's none. Only used from
+	/// mQueue.
+	FSEventStreamRef mStream;
+
+	/// The serial queue the stream is delivered to and recreated from
+	dispatch_queue_t mQueue;
+
+	/// The last event delivered, the stream recreated starts from it so the events in between
+	/// aren't lost. Written from mQueue.
+	Atomic<Uint64> mLastEventId;
+
+	/// If the paths of the stream come with their extended data. Only used from mQueue.
+	bool mExtendedData;
+
 	/// The last watchid
 	WatchID mLastWatchID;
 
@@ -89,6 +114,14 @@ private:
 
 	bool pathInWatches( const std::string& path ) override;
 
+	/// Delivers the events read to the watches of their path and of its parents
+	void handleEvents( std::vector<FSEvent>& events );
+
+	/// Recreates the stream for the directories watched, from mQueue
+	void restartStream();
+
+	void stopStream();
+
 	std::mutex mWatchesMutex;
 };
 
@@ -0,0 +1,981 @@
+#include <efsw/FileWatcherFanotify.hpp>
+
+#ifdef EFSW_FANOTIFY
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include <efsw/Debug.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/FileWatcherInotify.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/Trace.hpp>
+
+#define BUFF_SIZE ( 64 * 1024 )
+
+/// Maximum number of directory paths cached, the cache is emptied when reached
+#define DIRECTORY_CACHE_MAX 65536
+
+/// Events requested for every marked file system, besides the moves. The directory cache
+/// depends on them, so they are requested whatever the interests of the watches.
+#define FANOTIFY_EVENTS ( FAN_CREATE | FAN_DELETE | FAN_ONDIR )
+
+namespace efsw {
+
+/// @return The content events requested for a watch with the interests
+static Uint64 contentMask( int interests ) {
+	Uint64 mask = 0;
+
+	if ( interests & Interests::ContentClosed )
+		mask |= FAN_CLOSE_WRITE;
+
+	if ( interests & Interests::ContentModified )
+		mask |= FAN_MODIFY;
+
+	if ( interests & Interests::Attributes )
+		mask |= FAN_ATTRIB;
+
+	return mask;
+}
+
+/// @return The interests a content event is reported for
+static int contentInterests( Uint64 mask ) {
+	int interests = 0;
+
+	if ( mask & FAN_CLOSE_WRITE )
+		interests |= Interests::ContentClosed;
+
+	if ( mask & FAN_MODIFY )
+		interests |= Interests::ContentModified;
+
+	if ( mask & FAN_ATTRIB )
+		interests |= Interests::Attributes;
+
+	return interests;
+}
+
+/// @return The real path of the directory ending with a slash, empty if it can't be resolved
+static std::string realDirectory( const std::string& directory ) {
+	char* real = realpath( directory.c_str(), NULL );
+
+	if ( NULL == real )
+		return "";
+
+	std::string path( real );
+	free( real );
+
+	FileSystem::dirAddSlashAtEnd( path );
+	return path;
+}
+
+/// @return True if the process is allowed to open file handles ( CAP_DAC_READ_SEARCH )
+static bool canOpenFileHandles() {
+	struct {
+		struct file_handle Handle;
+		unsigned char Data[MAX_HANDLE_SZ];
+	} fh;
+	int mountId;
+
+	fh.Handle.handle_bytes = MAX_HANDLE_SZ;
+
+	if ( 0 != name_to_handle_at( AT_FDCWD, "/", &fh.Handle, &mountId, 0 ) )
+		return false;
+
+	int mountFD = open( "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	if ( mountFD < 0 )
+		return false;
+
+	int fd = open_by_handle_at( mountFD, &fh.Handle, O_PATH | O_CLOEXEC );
+
+	close( mountFD );
+
+	if ( fd < 0 )
+		return false;
+
+	close( fd );
+	return true;
+}
+
+FileWatcherFanotify::FileWatcherFanotify( FileWatcher* parent ) :
+	FileWatcherImpl( parent ),
+	mInotify( NULL ),
+	mFD( -1 ),
+	mEpollFD( -1 ),
+	mControlFD( -1 ),
+	mEventMask( FANOTIFY_EVENTS ),
+	mLastWatchID( 0 ),
+	mThread( NULL ),
+	mPollBuffer( NULL ) {
+#ifdef FAN_RENAME
+	mEventMask |= FAN_RENAME;
+#else
+	mEventMask |= FAN_MOVED_FROM | FAN_MOVED_TO;
+#endif
+
+	mFD = fanotify_init( FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+						 O_RDONLY | O_LARGEFILE );
+
+	if ( mFD < 0 ) {
+		efDEBUG( "fanotify not available: %s\n", strerror( errno ) );
+		return;
+	}
+
+	if ( !canOpenFileHandles() ) {
+		efDEBUG( "fanotify not available: file handles can't be opened\n" );
+		return;
+	}
+
+	mEpollFD = epoll_create1( EPOLL_CLOEXEC );
+	mControlFD = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+	if ( mEpollFD < 0 || mControlFD < 0 ) {
+		efDEBUG( "Error: %s\n", strerror( errno ) );
+		return;
+	}
+
+	int fds[] = { mFD, mControlFD };
+
+	for ( size_t i = 0; i < efARRAY_SIZE( fds ); i++ ) {
+		struct epoll_event ev;
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+
+		if ( epoll_ctl( mEpollFD, EPOLL_CTL_ADD, fds[i], &ev ) < 0 ) {
+			efDEBUG( "Error: %s\n", strerror( errno ) );
+			return;
+		}
+	}
+
+	mInitOK = true;
+}
+
+FileWatcherFanotify::~FileWatcherFanotify() {
+	mInitOK = false;
+
+	if ( mControlFD != -1 ) {
+		Uint64 value = 1;
+
+		if ( write( mControlFD, &value, sizeof( value ) ) < 0 ) {
+			efDEBUG( "Error waking up the event loop: %s\n", strerror( errno ) );
+		}
+	}
+
+	efSAFE_DELETE( mThread );
+
+	/// The delegated watches forward their events through the watchers, stop them first
+	efSAFE_DELETE( mInotify );
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+
+	mWatches.clear();
+	mWatchRegistry.clear();
+
+	for ( std::unordered_map<std::string, Mark>::iterator it = mMarks.begin(); it != mMarks.end();
+		  ++it ) {
+		close( it->second.MountFD );
+	}
+
+	mMarks.clear();
+
+	/// Closing the fanotify descriptor removes its marks
+	int fds[] = { mFD, mEpollFD, mControlFD };
+
+	for ( size_t i = 0; i < efARRAY_SIZE( fds ); i++ ) {
+		if ( fds[i] != -1 ) {
+			close( fds[i] );
+		}
+	}
+
+	mFD = mEpollFD = mControlFD = -1;
+
+	delete[] mPollBuffer;
+}
+
+WatchID FileWatcherFanotify::addWatch( const std::string& directory, FileWatchListener* watcher,
+									   bool recursive, const std::vector<WatcherOption>& options ) {
+	if ( !mInitOK )
+		return Errors::Log::createLastError( Errors::Unspecified, directory );
+
+	Lock initLock( mInitLock );
+
+	std::string dir( directory );
+
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	FileInfo fi( dir );
+
+	if ( !fi.isDirectory() ) {
+		return Errors::Log::createLastError( Errors::FileNotFound, dir );
+	} else if ( !fi.isReadable() ) {
+		return Errors::Log::createLastError( Errors::FileNotReadable, dir );
+	} else if ( pathInWatches( dir ) ) {
+		return Errors::Log::createLastError( Errors::FileRepeated, directory );
+	}
+
+	/// Check if the directory is a symbolic link
+	std::string curPath;
+	std::string link( FileSystem::getLinkRealPath( dir, curPath ) );
+
+	if ( "" != link ) {
+		if ( pathInWatches( link ) ) {
+			return Errors::Log::createLastError( Errors::FileRepeated, directory );
+		} else if ( !linkAllowed( curPath, link ) ) {
+			return Errors::Log::createLastError( Errors::FileOutOfScope, dir );
+		} else {
+			dir = link;
+		}
+	}
+
+	WatcherFanotify* watch;
+
+	{
+		Lock lock( mWatchesLock );
+		watch = new WatcherFanotify( ++mLastWatchID, dir, watcher, recursive );
+	}
+
+	watch->EventInterests = getEventInterests( options );
+	watch->Filter = PathFilter::create( dir, options );
+
+	/// The paths reported by the events are always real paths, the watch is indexed by it
+	std::string realDir( realDirectory( dir ) );
+
+	/// Only the recursive watches benefit from the filesystem marks. The symlinks inside the tree
+	/// lead outside of the marked file system, those watches are served by inotify.
+	if ( recursive && !mFileWatcher->followSymlinks() && !realDir.empty() ) {
+		watch->FileSystemID = addMark( realDir, contentMask( watch->EventInterests ) );
+	}
+
+	if ( watch->FileSystemID.empty() ) {
+		WatchID id = delegateWatch( watch, options );
+
+		if ( id < 0 ) {
+			efSAFE_DELETE( watch );
+			return id;
+		}
+
+		realDir = dir;
+	}
+
+	efDEBUG( "Added watch %s with id: %ld%s\n", dir.c_str(), watch->ID,
+			 watch->isDelegated() ? " ( inotify )" : "" );
+
+	Lock lock( mWatchesLock );
+
+	mWatches.insert( std::make_pair( watch->ID, watch ) );
+	mWatchRegistry.add( watch, realDir );
+
+	return watch->ID;
+}
+
+std::string FileWatcherFanotify::addMark( const std::string& directory, Uint64 content ) {
+	int fd = open( directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	if ( fd < 0 )
+		return "";
+
+	struct statfs sfs;
+
+	if ( 0 != fstatfs( fd, &sfs ) ) {
+		close( fd );
+		return "";
+	}
+
+	std::string fsid( (const char*)&sfs.f_fsid, sizeof( sfs.f_fsid ) );
+
+	Lock lock( mWatchesLock );
+
+	std::unordered_map<std::string, Mark>::iterator it = mMarks.find( fsid );
+
+	if ( it != mMarks.end() ) {
+		close( fd );
+
+		/// The content events are requested once a watch of the file system needs them
+		Uint64 missing = content & ~it->second.Mask;
+
+		if ( 0 != missing && fanotify_mark( mFD, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, missing,
+											it->second.MountFD, NULL ) < 0 ) {
+			efDEBUG( "Can't extend the file system mark of %s: %s\n", directory.c_str(),
+					 strerror( errno ) );
+			return "";
+		}
+
+		it->second.Mask |= missing;
+		it->second.Count++;
+		return fsid;
+	}
+
+	int res = fanotify_mark( mFD, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mEventMask | content, fd,
+							 NULL );
+
+#ifdef FAN_RENAME
+	/// Kernels older than 5.17 don't know FAN_RENAME, the moves are paired from its halves
+	if ( res < 0 && EINVAL == errno && ( mEventMask & FAN_RENAME ) ) {
+		Uint64 mask = ( mEventMask & ~(Uint64)FAN_RENAME ) | FAN_MOVED_FROM | FAN_MOVED_TO;
+
+		res = fanotify_mark( mFD, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask | content, fd, NULL );
+
+		if ( res == 0 ) {
+			mEventMask = mask;
+		}
+	}
+#endif
+
+	/// The file systems without file handle support ( or a non unique fsid ) can't be marked
+	if ( res < 0 ) {
+		efDEBUG( "Can't mark the file system of %s: %s\n", directory.c_str(), strerror( errno ) );
+		close( fd );
+		return "";
+	}
+
+	Mark mark;
+	mark.MountFD = fd;
+	mark.Count = 1;
+	mark.Mask = content;
+
+	mMarks[fsid] = mark;
+
+	return fsid;
+}
+
+void FileWatcherFanotify::removeMarkLocked( const std::string& fsid ) {
+	std::unordered_map<std::string, Mark>::iterator it = mMarks.find( fsid );
+
+	if ( it == mMarks.end() )
+		return;
+
+	if ( --it->second.Count > 0 ) {
+		/// Stop the content events no remaining watch of the file system is interested in
+		Uint64 content = 0;
+
+		for ( WatchMap::iterator wit = mWatches.begin(); wit != mWatches.end(); ++wit ) {
+			if ( wit->second->FileSystemID == fsid ) {
+				content |= contentMask( wit->second->EventInterests );
+			}
+		}
+
+		Uint64 unused = it->second.Mask & ~content;
+
+		if ( 0 != unused && 0 == fanotify_mark( mFD, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, unused,
+												it->second.MountFD, NULL ) ) {
+			it->second.Mask = content;
+		}
+
+		return;
+	}
+
+	if ( fanotify_mark( mFD, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM,
+						mEventMask | it->second.Mask, it->second.MountFD, NULL ) < 0 ) {
+		efDEBUG( "Error removing the file system mark: %s\n", strerror( errno ) );
+	}
+
+	close( it->second.MountFD );
+	mMarks.erase( it );
+}
+
+WatchID FileWatcherFanotify::delegateWatch( WatcherFanotify* watch,
+										   const std::vector<WatcherOption>& options ) {
+	if ( NULL == mInotify ) {
+		mInotify = new FileWatcherInotify( mFileWatcher );
+
+		if ( !mInotify->initOK() ) {
+			efSAFE_DELETE( mInotify );
+			return Errors::Log::createLastError( Errors::WatcherFailed, watch->Directory );
+		}
+
+		if ( NULL != mThread ) {
+			mInotify->watch();
+		} else {
+			/// Without an event loop thread the caller waits for both backends on the epoll
+			/// descriptor of this one
+			struct epoll_event ev;
+			memset( &ev, 0, sizeof( ev ) );
+			ev.events = EPOLLIN;
+			ev.data.fd = mInotify->pollHandle();
+
+			epoll_ctl( mEpollFD, EPOLL_CTL_ADD, mInotify->pollHandle(), &ev );
+		}
+	}
+
+	/// The watcher is the listener of the inotify watch, it forwards the events with its own id.
+	/// The options ( interests, watch budget ) are applied by inotify.
+	WatchID id = mInotify->addWatch( watch->Directory, watch, watch->Recursive, options );
+
+	if ( id > 0 ) {
+		watch->InotifyID = id;
+		/// The counters are the ones of the inotify watch doing the work
+		watch->Counters = mInotify->getCounters( id );
+	}
+
+	return id;
+}
+
+void FileWatcherFanotify::removeWatchLocked( WatcherFanotify* watch ) {
+	mWatches.erase( watch->ID );
+	mWatchRegistry.remove( watch->ID );
+
+	if ( watch->isDelegated() ) {
+		mInotify->removeWatch( watch->InotifyID );
+	} else {
+		removeMarkLocked( watch->FileSystemID );
+	}
+
+	efDEBUG( "Removed watch %s with id: %ld\n", watch->Directory.c_str(), watch->ID );
+
+	efSAFE_DELETE( watch );
+}
+
+void FileWatcherFanotify::removeWatch( const std::string& directory ) {
+	if ( !mInitOK )
+		return;
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	Watcher* watch = mWatchRegistry.find( directory );
+
+	if ( NULL == watch ) {
+		std::string realDir( realDirectory( directory ) );
+
+		if ( !realDir.empty() ) {
+			watch = mWatchRegistry.find( realDir );
+		}
+	}
+
+	if ( NULL != watch ) {
+		removeWatchLocked( static_cast<WatcherFanotify*>( watch ) );
+	}
+}
+
+void FileWatcherFanotify::removeWatch( WatchID watchid ) {
+	if ( !mInitOK )
+		return;
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	WatchMap::iterator it = mWatches.find( watchid );
+
+	if ( it != mWatches.end() ) {
+		removeWatchLocked( it->second );
+	}
+}
+
+bool FileWatcherFanotify::expandWatch( WatchID watchid, const std::string& directory ) {
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		WatchMap::iterator it = mWatches.find( watchid );
+
+		/// The delegated watches are scoped by inotify
+		if ( it != mWatches.end() && it->second->isDelegated() )
+			return mInotify->expandWatch( it->second->InotifyID, directory );
+	}
+
+	return FileWatcherImpl::expandWatch( watchid, directory );
+}
+
+bool FileWatcherFanotify::collapseWatch( WatchID watchid, const std::string& directory ) {
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		WatchMap::iterator it = mWatches.find( watchid );
+
+		if ( it != mWatches.end() && it->second->isDelegated() )
+			return mInotify->collapseWatch( it->second->InotifyID, directory );
+	}
+
+	return FileWatcherImpl::collapseWatch( watchid, directory );
+}
+
+void FileWatcherFanotify::watch() {
+	if ( NULL == mThread ) {
+		mThread = new Thread( [this] { run(); } );
+		mThread->launch();
+
+		Lock initLock( mInitLock );
+
+		if ( NULL != mInotify ) {
+			/// The inotify backend runs its own event loop from now on
+			epoll_ctl( mEpollFD, EPOLL_CTL_DEL, mInotify->pollHandle(), NULL );
+
+			mInotify->watch();
+		}
+	}
+}
+
+PollHandle FileWatcherFanotify::pollHandle() {
+	return mEpollFD;
+}
+
+void FileWatcherFanotify::poll() {
+	if ( NULL != mThread || !mInitOK )
+		return;
+
+	if ( NULL == mPollBuffer ) {
+		mPollBuffer = new char[BUFF_SIZE];
+	}
+
+	processEvents( mPollBuffer, 0 );
+}
+
+void FileWatcherFanotify::run() {
+	char* buff = new char[BUFF_SIZE];
+
+	while ( mInitOK && processEvents( buff, -1 ) )
+		;
+
+	delete[] buff;
+}
+
+bool FileWatcherFanotify::processEvents( char* buff, int timeout ) {
+	struct epoll_event events[3];
+
+	int nfds = epoll_wait( mEpollFD, events, efARRAY_SIZE( events ), timeout );
+
+	if ( nfds < 0 ) {
+		if ( errno == EINTR )
+			return true;
+
+		efDEBUG( "epoll_wait error: %s\n", strerror( errno ) );
+		return false;
+	}
+
+	bool running = true;
+
+	for ( int n = 0; n < nfds; n++ ) {
+		if ( events[n].data.fd == mControlFD ) {
+			running = false;
+		} else if ( events[n].data.fd == mFD ) {
+			readEvents( buff );
+		} else if ( NULL != mInotify && events[n].data.fd == mInotify->pollHandle() ) {
+			mInotify->poll();
+		}
+	}
+
+	return running;
+}
+
+void FileWatcherFanotify::readEvents( char* buff ) {
+	ssize_t len;
+
+	/// Without FAN_RENAME the halves of a move are queued one after the other
+	bool moveFromPending = false;
+	bool moveFromIsDir = false;
+	std::string moveFromDir;
+	std::string moveFromName;
+
+	std::string& dir = mEventBuffers[0];
+	std::string& name = mEventBuffers[1];
+	std::string& oldDir = mEventBuffers[2];
+	std::string& oldName = mEventBuffers[3];
+
+	efTRACE_TIME( readBegin );
+
+	while ( mInitOK && ( len = read( mFD, buff, BUFF_SIZE ) ) > 0 ) {
+		efTRACE_TIME( readEnd );
+		efTRACE_SINCE( mFileWatcher, "fanotify.read", 0, readBegin );
+#ifdef EFSW_TRACING
+		mBatch.capture( readEnd );
+#endif
+
+		/// The events of the buffer are delivered in a batch, once it's fully processed
+		Lock initLock( mInitLock );
+
+		efTRACE_SINCE( mFileWatcher, "fanotify.lock", 0, readEnd );
+		efTRACE_TIME( batchBegin );
+
+		struct fanotify_event_metadata* metadata = (struct fanotify_event_metadata*)buff;
+
+		for ( ; FAN_EVENT_OK( metadata, len ); metadata = FAN_EVENT_NEXT( metadata, len ) ) {
+			if ( metadata->vers != FANOTIFY_METADATA_VERSION ) {
+				efDEBUG( "Unexpected fanotify metadata version: %d\n", metadata->vers );
+				mBatch.flush();
+				return;
+			}
+
+			if ( metadata->fd >= 0 ) {
+				close( metadata->fd );
+			}
+
+			if ( metadata->mask & FAN_Q_OVERFLOW ) {
+				/// The pair of the move pending could have been lost
+				if ( moveFromPending ) {
+					moveFromPending = false;
+					handleMove( moveFromDir, moveFromName, "", "", moveFromIsDir );
+				}
+
+				resync();
+				continue;
+			}
+
+			dir.clear();
+			name.clear();
+			oldDir.clear();
+			oldName.clear();
+
+			char* info = (char*)metadata + metadata->metadata_len;
+			char* end = (char*)metadata + metadata->event_len;
+
+			while ( info + sizeof( struct fanotify_event_info_header ) <= end ) {
+				struct fanotify_event_info_header* header =
+					(struct fanotify_event_info_header*)info;
+
+				if ( 0 == header->len )
+					break;
+
+				bool isOld = false;
+				bool isName = FAN_EVENT_INFO_TYPE_DFID_NAME == header->info_type;
+
+#ifdef FAN_RENAME
+				isOld = FAN_EVENT_INFO_TYPE_OLD_DFID_NAME == header->info_type;
+				isName = isName || isOld ||
+						 FAN_EVENT_INFO_TYPE_NEW_DFID_NAME == header->info_type;
+#endif
+
+				if ( isName ) {
+					struct fanotify_event_info_fid* fid = (struct fanotify_event_info_fid*)info;
+					struct file_handle* handle = (struct file_handle*)fid->handle;
+					std::string fsid( (const char*)&fid->fsid, sizeof( fid->fsid ) );
+					const char* filename = (const char*)handle->f_handle + handle->handle_bytes;
+
+					if ( isOld ) {
+						resolveDirectory( fsid, handle, oldDir );
+						oldName.assign( filename );
+					} else {
+						resolveDirectory( fsid, handle, dir );
+						name.assign( filename );
+					}
+				}
+
+				info += header->len;
+			}
+
+			Uint64 mask = metadata->mask;
+			bool isDir = 0 != ( mask & FAN_ONDIR );
+
+			if ( moveFromPending && !( mask & FAN_MOVED_TO ) ) {
+				moveFromPending = false;
+				handleMove( moveFromDir, moveFromName, "", "", moveFromIsDir );
+			}
+
+			if ( dir.empty() && oldDir.empty() )
+				continue;
+
+			/// A created and deleted entry could have been merged into one event, the order is
+			/// guessed from its current existence
+			bool deletedFirst = ( mask & FAN_CREATE ) && ( mask & FAN_DELETE ) &&
+								FileInfo::exists( dir + name );
+
+			if ( ( mask & FAN_DELETE ) && deletedFirst ) {
+				if ( isDir ) {
+					invalidateDirectory( dir + name + FileSystem::getOSSlash() );
+				}
+
+				dispatch( dir, name, Actions::Delete );
+			}
+
+			if ( mask & FAN_CREATE ) {
+				dispatch( dir, name, Actions::Add );
+			}
+
+			if ( mask & ( FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ATTRIB ) ) {
+				dispatch( dir, name, Actions::Modified, "", contentInterests( mask ) );
+			}
+
+#ifdef FAN_RENAME
+			if ( mask & FAN_RENAME ) {
+				handleMove( oldDir, oldName, dir, name, isDir );
+			}
+#endif
+
+			if ( mask & FAN_MOVED_FROM ) {
+				if ( moveFromPending ) {
+					handleMove( moveFromDir, moveFromName, "", "", moveFromIsDir );
+				}
+
+				moveFromPending = true;
+				moveFromIsDir = isDir;
+				moveFromDir = dir;
+				moveFromName = name;
+			}
+
+			if ( mask & FAN_MOVED_TO ) {
+				if ( moveFromPending ) {
+					moveFromPending = false;
+					handleMove( moveFromDir, moveFromName, dir, name, isDir );
+				} else {
+					handleMove( "", "", dir, name, isDir );
+				}
+			}
+
+			if ( ( mask & FAN_DELETE ) && !deletedFirst ) {
+				if ( isDir ) {
+					invalidateDirectory( dir + name + FileSystem::getOSSlash() );
+				}
+
+				dispatch( dir, name, Actions::Delete );
+			}
+		}
+
+		mBatch.flush();
+
+		efTRACE_SINCE( mFileWatcher, "fanotify.batch", 0, batchBegin );
+		efTRACE_SET_TIME( readBegin );
+	}
+
+	if ( moveFromPending ) {
+		Lock initLock( mInitLock );
+
+		/// Moved outside the file system
+		handleMove( moveFromDir, moveFromName, "", "", moveFromIsDir );
+
+		mBatch.flush();
+	}
+}
+
+void FileWatcherFanotify::handleMove( const std::string& oldDir, const std::string& oldName,
+									  const std::string& dir, const std::string& name,
+									  bool isDir ) {
+	if ( isDir && !oldDir.empty() ) {
+		invalidateDirectory( oldDir + oldName + FileSystem::getOSSlash() );
+	}
+
+	if ( !oldDir.empty() && oldDir == dir ) {
+		dispatch( dir, name, Actions::Moved, oldName );
+		return;
+	}
+
+	/// Moved between directories, or from / to outside the file system
+	if ( !oldDir.empty() ) {
+		dispatch( oldDir, oldName, Actions::Delete );
+	}
+
+	if ( !dir.empty() ) {
+		dispatch( dir, name, Actions::Add );
+		dispatch( dir, name, Actions::Modified );
+	}
+}
+
+bool FileWatcherFanotify::resolveDirectory( const std::string& fsid, struct file_handle* handle,
+											std::string& path ) {
+	std::string& key = mHandleKey;
+	key.assign( fsid );
+	key.append( (const char*)&handle->handle_type, sizeof( handle->handle_type ) );
+	key.append( (const char*)handle->f_handle, handle->handle_bytes );
+
+	std::unordered_map<std::string, std::string>::iterator it = mDirectoryCache.find( key );
+
+	if ( it != mDirectoryCache.end() ) {
+		path.assign( it->second );
+		return true;
+	}
+
+	path.clear();
+
+	{
+		Lock lock( mWatchesLock );
+
+		std::unordered_map<std::string, Mark>::iterator mit = mMarks.find( fsid );
+
+		if ( mit == mMarks.end() )
+			return false;
+
+		int fd = open_by_handle_at( mit->second.MountFD, handle, O_PATH | O_CLOEXEC );
+
+		if ( fd < 0 )
+			return false;
+
+		char link[64];
+		char buf[PATH_MAX];
+
+		snprintf( link, sizeof( link ), "/proc/self/fd/%d", fd );
+
+		ssize_t len = readlink( link, buf, sizeof( buf ) );
+
+		close( fd );
+
+		if ( len <= 0 )
+			return false;
+
+		path.assign( buf, len );
+	}
+
+	/// A directory deleted meanwhile can't be reached anymore
+	static const std::string deleted( " (deleted)" );
+
+	if ( path[0] != '/' || ( path.size() > deleted.size() &&
+							 0 == path.compare( path.size() - deleted.size(), deleted.size(),
+												deleted ) ) ) {
+		path.clear();
+		return false;
+	}
+
+	FileSystem::dirAddSlashAtEnd( path );
+
+	if ( mDirectoryCache.size() >= DIRECTORY_CACHE_MAX ) {
+		mDirectoryCache.clear();
+		mCachedPaths.clear();
+	}
+
+	/// A directory reached through another handle keeps the last one
+	std::string& cached = mCachedPaths[path];
+
+	if ( !cached.empty() ) {
+		mDirectoryCache.erase( cached );
+	}
+
+	cached = key;
+	mDirectoryCache[key] = path;
+
+	return true;
+}
+
+void FileWatcherFanotify::invalidateDirectory( const std::string& path ) {
+	if ( path.empty() )
+		return;
+
+	/// The subdirectories sort between "path/" and the slash's successor
+	std::string last( path );
+	last.back()++;
+
+	std::map<std::string, std::string>::iterator first = mCachedPaths.lower_bound( path );
+	std::map<std::string, std::string>::iterator end = mCachedPaths.lower_bound( last );
+
+	for ( std::map<std::string, std::string>::iterator it = first; it != end; ++it ) {
+		mDirectoryCache.erase( it->second );
+	}
+
+	mCachedPaths.erase( first, end );
+}
+
+void FileWatcherFanotify::dispatch( const std::string& dir, const std::string& filename,
+									Action action, const std::string& oldFilename,
+									int interests ) {
+	if ( dir.empty() )
+		return;
+
+	size_t len = dir.size();
+
+	/// The file system events are filtered down to the watches containing the directory
+	while ( len > 0 && mInitOK ) {
+		mLookupDirectory.assign( dir, 0, len );
+
+		WatcherFanotify* watch =
+			static_cast<WatcherFanotify*>( mWatchRegistry.find( mLookupDirectory ) );
+
+		if ( NULL != watch && !watch->isDelegated() && NULL != watch->Listener ) {
+			WatchCounters::add( watch->Counters->Received );
+
+			bool accepted =
+				0 != interests ? watch->acceptsInterests( interests ) : watch->accepts( action );
+
+			if ( accepted ) {
+				/// The directory is reported as watched, not as the real path
+				mEventDirectory.assign( watch->Directory );
+				mEventDirectory.append( dir, len, std::string::npos );
+
+				if ( watch->matches( mEventDirectory, filename, oldFilename ) ) {
+					mBatch.add( watch->Listener, watch->ID, mEventDirectory, filename, action,
+								oldFilename );
+				}
+			}
+		}
+
+		size_t slash = len >= 2 ? dir.find_last_of( FileSystem::getOSSlash(), len - 2 )
+								: std::string::npos;
+
+		len = std::string::npos != slash ? slash + 1 : 0;
+	}
+}
+
+void FileWatcherFanotify::resync() {
+	efDEBUG( "Event queue overflow, resyncing the marks\n" );
+
+	mDirectoryCache.clear();
+	mCachedPaths.clear();
+
+	{
+		Lock lock( mWatchesLock );
+
+		for ( std::unordered_map<std::string, Mark>::iterator it = mMarks.begin();
+			  it != mMarks.end(); ++it ) {
+			/// The content events follow the interests of the watches of the file system now
+			Uint64 content = 0;
+
+			for ( WatchMap::iterator wit = mWatches.begin(); wit != mWatches.end(); ++wit ) {
+				if ( wit->second->FileSystemID == it->first ) {
+					content |= contentMask( wit->second->EventInterests );
+				}
+			}
+
+			if ( fanotify_mark( mFD, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mEventMask | content,
+								it->second.MountFD, NULL ) < 0 ) {
+				efDEBUG( "Can't mark the file system again: %s\n", strerror( errno ) );
+				continue;
+			}
+
+			Uint64 unused = it->second.Mask & ~content;
+
+			if ( 0 != unused && fanotify_mark( mFD, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM,
+											   unused, it->second.MountFD, NULL ) < 0 ) {
+				content |= unused;
+			}
+
+			it->second.Mask = content;
+		}
+	}
+
+	std::vector<Watcher*> watches = mWatchRegistry.watches();
+
+	for ( size_t i = 0; i < watches.size(); i++ ) {
+		WatcherFanotify* watch = static_cast<WatcherFanotify*>( watches[i] );
+
+		if ( !watch->isDelegated() && NULL != watch->Listener ) {
+			mBatch.add( watch->Listener, watch->ID, watch->Directory, "", Actions::Overflow );
+		}
+	}
+}
+
+void FileWatcherFanotify::handleAction( Watcher* watch, const std::string& filename,
+										unsigned long action, std::string oldFilename ) {
+	/// The events are dispatched by directory, so the action is relative to the watch root
+	if ( NULL != watch && NULL != watch->Listener ) {
+		EventBatch::send( watch->Listener, watch->ID, watch->Directory, filename, (Action)action,
+						  oldFilename );
+	}
+}
+
+std::vector<std::string> FileWatcherFanotify::directories() {
+	return mWatchRegistry.directories();
+}
+
+bool FileWatcherFanotify::pathInWatches( const std::string& path ) {
+	if ( NULL != mWatchRegistry.find( path ) )
+		return true;
+
+	std::string realDir( realDirectory( path ) );
+
+	return !realDir.empty() && NULL != mWatchRegistry.find( realDir );
+}
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef EFSW_FILEWATCHERFANOTIFY_HPP
+#define EFSW_FILEWATCHERFANOTIFY_HPP
+
+#include <efsw/EventBatch.hpp>
+#include <efsw/FileWatcherImpl.hpp>
+
+#if EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY && !defined( EFSW_INOTIFY_NOSYS ) && \
+	defined( EFSW_USE_FANOTIFY )
+#include <fcntl.h>
+#include <sys/fanotify.h>
+
+/// Directory entry events with the parent directory file handle and name ( Linux 5.9 )
+#if defined( FAN_REPORT_DFID_NAME )
+#define EFSW_FANOTIFY
+#endif
+#endif
+
+#ifdef EFSW_FANOTIFY
+
+#include <efsw/WatcherFanotify.hpp>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+class FileWatcherInotify;
+
+/// Implementation for Linux based on fanotify. A single filesystem mark reports the changes of
+/// a whole file system, so recursive watches cost no kernel watch per directory. The events
+/// carry the file handle of the parent directory, resolved to its path through a cache, and
+/// are filtered down to the watched trees.
+/// Requires CAP_SYS_ADMIN ( for the filesystem marks ) and CAP_DAC_READ_SEARCH ( to open the
+/// file handles ). Non recursive watches, watches following symlinks and the file systems that
+/// don't support file handles are delegated to inotify.
+/// @class FileWatcherFanotify
+class FileWatcherFanotify : public FileWatcherImpl {
+  public:
+	typedef std::map<WatchID, WatcherFanotify*> WatchMap;
+
+	FileWatcherFanotify( FileWatcher* parent );
+
+	virtual ~FileWatcherFanotify();
+
+	/// Add a directory watch
+	/// On error returns WatchID with Error type.
+	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
+					  const std::vector<WatcherOption>& options ) override;
+
+	/// Remove a directory watch. This is a hash lookup O(1).
+	void removeWatch( const std::string& directory ) override;
+
+	/// Remove a directory watch. This is a map lookup O(logn).
+	void removeWatch( WatchID watchid ) override;
+
+	/// Updates the watcher. Must be called often.
+	void watch() override;
+
+	/// Handles the action
+	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
+					   std::string oldFilename = "" ) override;
+
+	/// @return Returns a list of the directories that are being watched
+	std::vector<std::string> directories() override;
+
+	/// @return The epoll descriptor of the event loop, it also waits for the delegated watches
+	PollHandle pollHandle() override;
+
+	/// Runs an iteration of the event loop without blocking, when watch() wasn't called
+	void poll() override;
+
+	/// Changes the scope of the watch, the one of inotify for a delegated watch
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
+  protected:
+	/// A marked file system
+	struct Mark {
+		/// Descriptor of the first directory marked, used to open the file handles
+		int MountFD;
+		/// Number of watches in the file system
+		int Count;
+		/// Content events requested by the watches of the file system
+		Uint64 Mask;
+	};
+
+	/// Map of WatchID to WatchStruct pointers
+	WatchMap mWatches;
+
+	/// Marked file systems indexed by its fsid
+	std::unordered_map<std::string, Mark> mMarks;
+
+	/// Directory paths indexed by its file handle ( only used from the event loop )
+	std::unordered_map<std::string, std::string> mDirectoryCache;
+
+	/// File handle keys of the cached directories sorted by path, so a directory and its
+	/// subdirectories are a range of it ( only used from the event loop )
+	std::map<std::string, std::string> mCachedPaths;
+
+	/// Buffers reused by the event loop so the steady state doesn't allocate: the directories and
+	/// names of the event read, the cache key being looked up, the directory prefix searched in
+	/// the registry and the directory reported
+	std::string mEventBuffers[4];
+	std::string mHandleKey;
+	std::string mLookupDirectory;
+	std::string mEventDirectory;
+
+	/// Events queued for delivery, flushed once per read buffer ( guarded by mInitLock )
+	EventBatch mBatch;
+
+	/// Backend serving the delegated watches, created on demand
+	FileWatcherInotify* mInotify;
+
+	/// fanotify file descriptor
+	int mFD;
+
+	/// epoll instance multiplexing the fanotify and control descriptors
+	int mEpollFD;
+
+	/// eventfd used to wake up the event loop on shutdown
+	int mControlFD;
+
+	/// The directory entry events requested to the marks
+	Uint64 mEventMask;
+
+	/// The last watchid
+	WatchID mLastWatchID;
+
+	Thread* mThread;
+
+	/// Read buffer of poll(), allocated on its first call
+	char* mPollBuffer;
+
+	/// Held while dispatching events, so no event is delivered after removeWatch returns
+	Mutex mInitLock;
+	Mutex mWatchesLock;
+
+	bool pathInWatches( const std::string& path ) override;
+
+  private:
+	void run();
+
+	/// Waits up to timeout milliseconds ( -1 for ever ) for the descriptors of the event loop and
+	/// handles what's ready
+	/// @return False if the event loop must stop
+	bool processEvents( char* buff, int timeout );
+
+	/// Drains the fanotify descriptor and dispatches the events read
+	void readEvents( char* buff );
+
+	/// Adds the filesystem mark of the directory, or references the existing one, requesting the
+	/// content events also
+	/// @return The fsid key of the file system, empty if it can't be marked
+	std::string addMark( const std::string& directory, Uint64 content );
+
+	/// Unreferences the filesystem mark, removing it when no watch uses it. The watch must be
+	/// already out of the watches map.
+	void removeMarkLocked( const std::string& fsid );
+
+	/// Watches the directory through inotify with the options of the watch
+	WatchID delegateWatch( WatcherFanotify* watch, const std::vector<WatcherOption>& options );
+
+	/// Removes the watcher from the indexes and deletes it
+	void removeWatchLocked( WatcherFanotify* watch );
+
+	/// Resolves the path of a directory file handle reported in an event into path, ending with a
+	/// slash ( empty if it's unreachable )
+	/// @return True if the directory was resolved
+	bool resolveDirectory( const std::string& fsid, struct file_handle* handle,
+						   std::string& path );
+
+	/// Drops the cached paths of a directory and its subdirectories after it's moved or deleted
+	void invalidateDirectory( const std::string& path );
+
+	/// Emits a move, as a Moved inside the same directory or as a Delete / Add pair otherwise.
+	/// The old or the new directory is empty if it's outside the file system.
+	void handleMove( const std::string& oldDir, const std::string& oldName, const std::string& dir,
+					 const std::string& name, bool isDir );
+
+	/// Queues the event for every watch containing the directory and interested in it, holding
+	/// mInitLock
+	/// @param interests The interests the event is reported for, deduced from the action if 0
+	void dispatch( const std::string& dir, const std::string& filename, Action action,
+				   const std::string& oldFilename = "", int interests = 0 );
+
+	/// Called after the event queue overflowed, holding mInitLock: drops the cached paths, as the
+	/// directories could have been renamed or deleted in the events lost, requests the events of
+	/// the marks again and queues the overflow notification for every watch served by fanotify
+	void resync();
+};
+
+} // namespace efsw
+
+#endif
+
+#endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <efsw/FileSystem.hpp>
 #include <efsw/FileWatcherGeneric.hpp>
 #include <efsw/Lock.hpp>
@@ -17,11 +18,7 @@ FileWatcherGeneric::~FileWatcherGeneric() {
 	efSAFE_DELETE( mThread );
 
 	/// Delete the watches
-	WatchList::iterator it = mWatches.begin();
-
-	for ( ; it != mWatches.end(); ++it ) {
-		efSAFE_DELETE( ( *it ) );
-	}
+	mWatches.clear();
 }
 
 WatchID FileWatcherGeneric::addWatch( const std::string& directory, FileWatchListener* watcher,
@@ -56,47 +53,106 @@ WatchID FileWatcherGeneric::addWatch( const std::string& directory, FileWatchLis
 	mLastWatchID++;
 
 	WatcherGeneric* pWatch = new WatcherGeneric( mLastWatchID, dir, watcher, this, recursive );
+	pWatch->EventInterests = getEventInterests( options );
+	pWatch->Filter = PathFilter::create( dir, options );
+
+	int minInterval = std::max( 1, getOptionValue( options, Options::PollMinInterval, 1000 ) );
+	int maxInterval =
+		std::max( minInterval, getOptionValue( options, Options::PollMaxInterval, minInterval ) );
+
+	pWatch->MinInterval = minInterval;
+	pWatch->MaxInterval = maxInterval;
+	pWatch->TimeSlice = std::max( 0, getOptionValue( options, Options::PollTimeSlice, 0 ) );
+	pWatch->init();
+
+	mPool.setThreads( std::max( 1, getOptionValue( options, Options::PollThreads, 1 ) ) );
 
 	Lock lock( mWatchesLock );
-	mWatches.push_back( pWatch );
+	mWatches.push_back( std::shared_ptr<WatcherGeneric>( pWatch ) );
+	mWatchRegistry.add( pWatch );
 
 	return pWatch->ID;
 }
 
 void FileWatcherGeneric::removeWatch( const std::string& directory ) {
-	WatchList::iterator it = mWatches.begin();
+	Watcher* watch = mWatchRegistry.find( directory );
 
-	for ( ; it != mWatches.end(); ++it ) {
-		if ( ( *it )->Directory == directory ) {
-			WatcherGeneric* watch = ( *it );
+	if ( NULL != watch ) {
+		removeWatch( watch->ID );
+	}
+}
 
-			Lock lock( mWatchesLock );
+void FileWatcherGeneric::removeWatch( WatchID watchid ) {
+	std::shared_ptr<WatcherGeneric> watch;
 
-			mWatches.erase( it );
+	{
+		Lock lock( mWatchesLock );
 
-			efSAFE_DELETE( watch );
+		Watcher* removed = mWatchRegistry.remove( watchid );
 
+		if ( NULL == removed )
 			return;
+
+		for ( WatchList::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+			if ( it->get() == removed ) {
+				watch = *it;
+				mWatches.erase( it );
+				break;
+			}
 		}
 	}
+
+	if ( !watch )
+		return;
+
+	/// Once the scan in progress is done with the watch it's skipped, and deleted by the pass
+	Lock scan( watch->ScanLock );
+	watch->Removed = true;
 }
 
-void FileWatcherGeneric::removeWatch( WatchID watchid ) {
-	WatchList::iterator it = mWatches.begin();
+std::shared_ptr<WatcherGeneric> FileWatcherGeneric::findWatch( WatchID watchid ) {
+	Lock lock( mWatchesLock );
 
-	for ( ; it != mWatches.end(); ++it ) {
+	for ( WatchList::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
 		if ( ( *it )->ID == watchid ) {
-			WatcherGeneric* watch = ( *it );
+			return *it;
+		}
+	}
+
+	return NULL;
+}
 
-			Lock lock( mWatchesLock );
+bool FileWatcherGeneric::expandWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<WatcherGeneric> watch( findWatch( watchid ) );
+	WatchScope* scope = watch && watch->Filter ? watch->Filter->scope() : NULL;
 
-			mWatches.erase( it );
+	if ( NULL == scope || !scope->expand( directory ) )
+		return false;
 
-			efSAFE_DELETE( watch );
+	/// The directories watched only change between the scans
+	Lock scan( watch->ScanLock );
 
-			return;
-		}
+	if ( !watch->Removed ) {
+		watch->expand( scope->fullPath( directory ) );
 	}
+
+	return true;
+}
+
+bool FileWatcherGeneric::collapseWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<WatcherGeneric> watch( findWatch( watchid ) );
+	WatchScope* scope = watch && watch->Filter ? watch->Filter->scope() : NULL;
+
+	if ( NULL == scope || !scope->collapse( directory ) )
+		return false;
+
+	Lock scan( watch->ScanLock );
+
+	if ( !watch->Removed ) {
+		watch->collapse( scope->fullPath( directory ) );
+	}
+
+	return true;
 }
 
 void FileWatcherGeneric::watch() {
@@ -106,53 +162,101 @@ void FileWatcherGeneric::watch() {
 	}
 }
 
-void FileWatcherGeneric::run() {
-	do {
-		{
-			Lock lock( mWatchesLock );
+void FileWatcherGeneric::poll() {
+	if ( NULL == mThread ) {
+		checkWatches();
+	}
+}
+
+WatcherGeneric::Clock::time_point FileWatcherGeneric::checkWatches() {
+	{
+		Lock lock( mWatchesLock );
+		mPass.assign( mWatches.begin(), mWatches.end() );
+	}
+
+	WatcherGeneric::Clock::time_point now = WatcherGeneric::Clock::now();
+	WatcherGeneric::Clock::time_point next = now + std::chrono::milliseconds( 1000 );
+
+	/// The watches stay locked from the scans of their directories until their changes are
+	/// reported, the ones removed are skipped
+	for ( size_t i = 0; i < mPass.size(); i++ ) {
+		mPass[i]->ScanLock.lock();
 
-			WatchList::iterator it = mWatches.begin();
+		if ( !mPass[i]->Removed ) {
+			mPass[i]->takeDue( now );
+		}
+	}
 
-			for ( ; it != mWatches.end(); ++it ) {
-				( *it )->watch();
+	/// Every round scans the directories of all the watches at once
+	while ( true ) {
+		mDue.clear();
+		mDueEnd.clear();
+
+		for ( size_t i = 0; i < mPass.size(); i++ ) {
+			if ( !mPass[i]->Removed ) {
+				mPass[i]->nextRound( mDue );
 			}
+
+			mDueEnd.push_back( mDue.size() );
 		}
 
-		if ( mInitOK )
-			System::sleep( 1000 );
-	} while ( mInitOK );
-}
+		if ( mDue.empty() )
+			break;
 
-void FileWatcherGeneric::handleAction( Watcher*, const std::string&, unsigned long, std::string ) {
-	/// Not used
-}
+		mPool.run( mDue.size(), [this, now]( size_t i, FileInfoMap& listing ) {
+			mDue[i].Dir->Watch->scan( mDue[i], listing, now );
+		} );
 
-std::vector<std::string> FileWatcherGeneric::directories() {
-	std::vector<std::string> dirs;
+		size_t first = 0;
 
-	Lock lock( mWatchesLock );
+		for ( size_t i = 0; i < mPass.size(); i++ ) {
+			if ( !mPass[i]->Removed ) {
+				mPass[i]->report( mDue.data() + first, mDueEnd[i] - first );
+			}
 
-	dirs.reserve( mWatches.size() );
+			first = mDueEnd[i];
+		}
+	}
 
-	WatchList::iterator it = mWatches.begin();
+	for ( size_t i = 0; i < mPass.size(); i++ ) {
+		if ( !mPass[i]->Removed ) {
+			mPass[i]->countPass( now );
+			next = std::min( next, mPass[i]->nextScan() );
+		}
 
-	for ( ; it != mWatches.end(); ++it ) {
-		dirs.push_back( ( *it )->Directory );
+		mPass[i]->ScanLock.unlock();
 	}
 
-	return dirs;
+	mPass.clear();
+
+	return next;
 }
 
-bool FileWatcherGeneric::pathInWatches( const std::string& path ) {
-	WatchList::iterator it = mWatches.begin();
+void FileWatcherGeneric::run() {
+	do {
+		WatcherGeneric::Clock::time_point next = checkWatches();
 
-	for ( ; it != mWatches.end(); ++it ) {
-		if ( ( *it )->Directory == path || ( *it )->pathInWatches( path ) ) {
-			return true;
+		/// Sleeps until the next directory is due, a second at most so the watcher stops in time
+		if ( mInitOK ) {
+			long long ms = std::chrono::ceil<std::chrono::milliseconds>(
+							   next - WatcherGeneric::Clock::now() )
+							   .count();
+
+			System::sleep( (unsigned long)std::max( 1LL, std::min( ms, 1000LL ) ) );
 		}
-	}
+	} while ( mInitOK );
+}
 
-	return false;
+void FileWatcherGeneric::handleAction( Watcher*, const std::string&, unsigned long, std::string ) {
+	/// Not used
+}
+
+std::vector<std::string> FileWatcherGeneric::directories() {
+	return mWatchRegistry.directories();
+}
+
+bool FileWatcherGeneric::pathInWatches( const std::string& path ) {
+	return mWatchRegistry.contains( path );
 }
 
 } // namespace efsw
@@ -3,16 +3,22 @@
 
 #include <efsw/DirWatcherGeneric.hpp>
 #include <efsw/FileWatcherImpl.hpp>
+#include <efsw/ScanPool.hpp>
 #include <efsw/WatcherGeneric.hpp>
+#include <memory>
 #include <vector>
 
 namespace efsw {
 
 /// Implementation for Generic File Watcher.
+/// The directories due of all the watches are scanned at once by a pool of threads
+/// ( Options::PollThreads ), without holding the list of watches: removeWatch only waits for the
+/// pass in progress to be done with the watch removed, addWatch doesn't wait at all.
 /// @class FileWatcherGeneric
 class FileWatcherGeneric : public FileWatcherImpl {
   public:
-	typedef std::vector<WatcherGeneric*> WatchList;
+	/// The watches are shared with the pass scanning them, the last one to drop a watch deletes it
+	typedef std::vector<std::shared_ptr<WatcherGeneric>> WatchList;
 
 	FileWatcherGeneric( FileWatcher* parent );
 
@@ -23,7 +29,7 @@ class FileWatcherGeneric : public FileWatcherImpl {
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 					  const std::vector<WatcherOption> &options ) override;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Remove a directory watch. This is a hash lookup O(1).
 	void removeWatch( const std::string& directory ) override;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -32,6 +38,9 @@ class FileWatcherGeneric : public FileWatcherImpl {
 	/// Updates the watcher. Must be called often.
 	void watch() override;
 
+	/// Checks the watches once from the calling thread, when watch() wasn't called
+	void poll() override;
+
 	/// Handles the action
 	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
 					   std::string oldFilename = "" ) override;
@@ -39,6 +48,12 @@ class FileWatcherGeneric : public FileWatcherImpl {
 	/// @return Returns a list of the directories that are being watched
 	std::vector<std::string> directories() override;
 
+	/// Changes the scope and watches the subdirectories brought in it, between two scans
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	/// Changes the scope and stops watching the subdirectories of the directory
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
   protected:
 	Thread* mThread;
 
@@ -50,10 +65,25 @@ class FileWatcherGeneric : public FileWatcherImpl {
 
 	Mutex mWatchesLock;
 
+	/// @return The watch, NULL if there's no such watch
+	std::shared_ptr<WatcherGeneric> findWatch( WatchID watchid );
+
+	ScanPool mPool;
+
+	/// Reused by the passes: the watches scanned, the directories due of all of them and where
+	/// the ones of each watch end
+	WatchList mPass;
+	std::vector<WatcherGeneric::DueScan> mDue;
+	std::vector<size_t> mDueEnd;
+
 	bool pathInWatches( const std::string& path ) override;
 
   private:
 	void run();
+
+	/// Scans the directories due of every watch
+	/// @return When the next directory is due, a second from now at most
+	WatcherGeneric::Clock::time_point checkWatches();
 };
 
 } // namespace efsw
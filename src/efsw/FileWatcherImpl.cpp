@@ -11,10 +11,62 @@ FileWatcherImpl::FileWatcherImpl( FileWatcher* parent ) :
 
 FileWatcherImpl::~FileWatcherImpl() {}
 
+WatchID FileWatcherImpl::addWatchAsync( const std::string& directory,
+										FileWatchListener* watcher, bool recursive,
+										const std::vector<WatcherOption>& options ) {
+	WatchID watchid = addWatch( directory, watcher, recursive, options );
+
+	/// The backends watching the tree as a whole don't count its directories
+	if ( watchid > 0 ) {
+		watcher->handleWatchReady( watchid, 0, 0 );
+	}
+
+	return watchid;
+}
+
 bool FileWatcherImpl::initOK() {
 	return static_cast<bool>( mInitOK );
 }
 
+PollHandle FileWatcherImpl::pollHandle() {
+#if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
+	return NULL;
+#else
+	return -1;
+#endif
+}
+
+void FileWatcherImpl::poll() {}
+
+Uint64 FileWatcherImpl::getEventId() {
+	return 0;
+}
+
+Uint64 FileWatcherImpl::getEventId( WatchID ) {
+	return getEventId();
+}
+
+std::shared_ptr<WatchCounters> FileWatcherImpl::getCounters( WatchID watchid ) {
+	return mWatchRegistry.counters( watchid );
+}
+
+bool FileWatcherImpl::expandWatch( WatchID watchid, const std::string& directory ) {
+	/// The filter keeps the scope alive if the watch is removed meanwhile
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+
+	return filter && NULL != filter->scope() && filter->scope()->expand( directory );
+}
+
+bool FileWatcherImpl::collapseWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+
+	return filter && NULL != filter->scope() && filter->scope()->collapse( directory );
+}
+
+FileWatcherImpl* FileWatcherImpl::shard( unsigned int ) {
+	return NULL;
+}
+
 bool FileWatcherImpl::linkAllowed( const std::string& curPath, const std::string& link ) {
 	return ( mFileWatcher->followSymlinks() && mFileWatcher->allowOutOfScopeLinks() ) ||
 		   -1 != String::strStartsWith( curPath, link );
@@ -31,4 +83,8 @@ int FileWatcherImpl::getOptionValue( const std::vector<WatcherOption>& options,
 	return defaultValue;
 }
 
+int FileWatcherImpl::getEventInterests( const std::vector<WatcherOption>& options ) {
+	return getOptionValue( options, Options::EventInterest, Interests::Default ) & Interests::All;
+}
+
 } // namespace efsw
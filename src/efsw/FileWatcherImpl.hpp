@@ -4,6 +4,7 @@
 #include <efsw/Atomic.hpp>
 #include <efsw/Mutex.hpp>
 #include <efsw/Thread.hpp>
+#include <efsw/WatchRegistry.hpp>
 #include <efsw/Watcher.hpp>
 #include <efsw/base.hpp>
 #include <efsw/efsw.hpp>
@@ -21,7 +22,13 @@ class FileWatcherImpl {
 	virtual WatchID addWatch( const std::string& directory, FileWatchListener* watcher,
 							  bool recursive, const std::vector<WatcherOption>& options = {} ) = 0;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Same as addWatch, but the subdirectories of a recursive watch can be crawled and watched
+	/// from another thread, calling the handleWatchReady of the listener once they are. By
+	/// default the watch is added as addWatch does, and reported ready before returning.
+	virtual WatchID addWatchAsync( const std::string& directory, FileWatchListener* watcher,
+								   bool recursive, const std::vector<WatcherOption>& options );
+
+	/// Remove a directory watch. This is a hash lookup O(1).
 	virtual void removeWatch( const std::string& directory ) = 0;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -47,6 +54,37 @@ class FileWatcherImpl {
 	/// Search if a directory already exists in the watches
 	virtual bool pathInWatches( const std::string& path ) = 0;
 
+	/// @return The handle that becomes readable when poll() has work to do, -1 ( NULL on Windows )
+	/// if the backend has none
+	virtual PollHandle pollHandle();
+
+	/// Handles what the backend has pending without blocking, from the calling thread. Does
+	/// nothing once watch() was called, or if the backend needs its own thread.
+	virtual void poll();
+
+	/// @return The ID of the last event delivered, 0 if the backend has no event IDs
+	virtual Uint64 getEventId();
+
+	/// @return The ID to resume the watch from, by default the one of the last event delivered
+	virtual Uint64 getEventId( WatchID watchid );
+
+	/// @return The counters of the watch, NULL if there's no such watch
+	virtual std::shared_ptr<WatchCounters> getCounters( WatchID watchid );
+
+	/// Brings the subdirectories of a directory of the watch in scope, see
+	/// FileWatcher::expandWatch. By default only the scope changes, for the backends watching
+	/// the whole tree.
+	virtual bool expandWatch( WatchID watchid, const std::string& directory );
+
+	/// Takes the subdirectories of a directory of the watch out of the scope, see
+	/// FileWatcher::collapseWatch. By default only the scope changes.
+	virtual bool collapseWatch( WatchID watchid, const std::string& directory );
+
+	/// @return A backend spreading the watches over that many instances of this one, each with
+	/// its own thread, NULL ( the default ) if the backend can't be sharded. Called before any
+	/// watch is added.
+	virtual FileWatcherImpl* shard( unsigned int shards );
+
   protected:
 	friend class FileWatcher;
 	friend class DirWatcherGeneric;
@@ -55,8 +93,14 @@ class FileWatcherImpl {
 	Atomic<bool> mInitOK;
 	bool mIsGeneric;
 
+	/// Index of the watches added by the user
+	WatchRegistry mWatchRegistry;
+
 	int getOptionValue( const std::vector<WatcherOption>& options, Option option,
 						int defaultValue );
+
+	/// @return The Interests::Interest flags selected by the options
+	int getEventInterests( const std::vector<WatcherOption>& options );
 };
 
 } // namespace efsw
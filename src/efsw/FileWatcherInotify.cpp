@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <efsw/FileWatcherInotify.hpp>
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY
@@ -7,8 +8,13 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
+#include <unordered_set>
 
 #ifdef EFSW_INOTIFY_NOSYS
 #include <efsw/inotify-nosys.h>
@@ -17,72 +23,433 @@
 #endif
 
 #include <efsw/Debug.hpp>
+#include <efsw/DirectoryCrawler.hpp>
 #include <efsw/FileSystem.hpp>
+#include <efsw/FileWatcherInotifyShards.hpp>
 #include <efsw/Lock.hpp>
 #include <efsw/String.hpp>
 #include <efsw/System.hpp>
+#include <efsw/Trace.hpp>
+#include <efsw/WatcherGeneric.hpp>
 
 #define BUFF_SIZE ( ( sizeof( struct inotify_event ) + FILENAME_MAX ) * 1024 )
 
+/// Time to wait for the IN_MOVED_TO that pairs an IN_MOVED_FROM before considering the file
+/// moved outside the watched directories
+#define MOVE_PAIRING_TIMEOUT_MS 100
+
+/// Maximum number of recently active directories that keep a snapshot to resync after an overflow
+#define ACTIVE_SNAPSHOTS_MAX 1024
+
+/// Interval between the polls of the directories left out of the watch budget
+#define COLD_POLL_INTERVAL_MS 1000
+
+/// Maximum number of events kept for the directories of the crawls running
+#define MAX_STASHED_EVENTS 65536
+
 namespace efsw {
 
+/// @return The inotify events requested for a directory of a watch with the interests
+static uint32_t watchMask( int interests, bool recursive ) {
+	uint32_t mask = 0;
+
+	if ( interests & Interests::Created )
+		mask |= IN_CREATE | IN_MOVED_TO;
+
+	if ( interests & Interests::Deleted )
+		mask |= IN_DELETE | IN_MOVED_FROM;
+
+	if ( interests & Interests::Moved )
+		mask |= IN_MOVED_FROM | IN_MOVED_TO;
+
+	if ( interests & Interests::ContentClosed )
+		mask |= IN_CLOSE_WRITE;
+
+	if ( interests & Interests::ContentModified )
+		mask |= IN_MODIFY;
+
+	if ( interests & Interests::Attributes )
+		mask |= IN_ATTRIB;
+
+	/// The subdirectories of a recursive watch are tracked from the directory entry events
+	if ( recursive )
+		mask |= IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+	/// A watch needs at least one event, without interests it only learns about its removal
+	if ( 0 == mask )
+		mask = IN_DELETE_SELF;
+
+	/// A directory watched by several watches shares its watch descriptor, the masks are merged
+	return mask | IN_MASK_ADD;
+}
+
+/// @return The monotonic time in milliseconds
+static Uint64 monotonicTime() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (Uint64)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000L;
+}
+
+static Uint64 modificationTime( const struct stat& st ) {
+	return (Uint64)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+/// @return The modification time of the directory in nanoseconds, 0 if it doesn't exist
+static Uint64 directoryModificationTime( const std::string& path ) {
+	struct stat st;
+
+	if ( 0 != stat( path.c_str(), &st ) || !S_ISDIR( st.st_mode ) )
+		return 0;
+
+	return modificationTime( st );
+}
+
+/// @return True if the entry of the directory was modified after the time given ( in
+/// nanoseconds )
+static bool modifiedAfter( const DirectorySnapshot& snapshot, const FileInfoMap::value_type& entry,
+						   Uint64 time ) {
+	Uint64 seconds = time / 1000000000ULL;
+
+	if ( entry.second.ModificationTime != seconds )
+		return entry.second.ModificationTime > seconds;
+
+	/// Within the same second only the nanoseconds tell
+	struct stat st;
+
+	return 0 != stat( snapshot.entryPath( entry.first ).c_str(), &st ) ||
+		   modificationTime( st ) > time;
+}
+
 FileWatcherInotify::FileWatcherInotify( FileWatcher* parent ) :
-	FileWatcherImpl( parent ), mFD( -1 ), mThread( NULL ), mIsTakingAction( false ) {
-	mFD = inotify_init1(IN_CLOEXEC);
+	FileWatcherImpl( parent ),
+	mGroup( NULL ),
+	mShard( 0 ),
+	mShards( 1 ),
+	mFD( -1 ),
+	mEpollFD( -1 ),
+	mControlFD( -1 ),
+	mTimerFD( -1 ),
+	mThread( NULL ),
+	mPollBuffer( NULL ),
+	mPendingMoveCount( 0 ),
+	mPathGeneration( 0 ),
+	mActivityClock( 0 ),
+	mColdWatches( 0 ),
+	mNextColdPoll( 0 ),
+	mCrawling( 0 ),
+	mStashOverflowed( false ) {
+	init();
+}
+
+FileWatcherInotify::FileWatcherInotify( FileWatcher* parent, FileWatcherInotifyShards* group,
+										unsigned int shard, unsigned int shards ) :
+	FileWatcherImpl( parent ),
+	mGroup( group ),
+	mShard( shard ),
+	mShards( shards ),
+	mFD( -1 ),
+	mEpollFD( -1 ),
+	mControlFD( -1 ),
+	mTimerFD( -1 ),
+	mThread( NULL ),
+	mPollBuffer( NULL ),
+	mPendingMoveCount( 0 ),
+	mPathGeneration( 0 ),
+	mActivityClock( 0 ),
+	mColdWatches( 0 ),
+	mNextColdPoll( 0 ),
+	mCrawling( 0 ),
+	mStashOverflowed( false ) {
+	init();
+}
+
+void FileWatcherInotify::init() {
+	mFD = inotify_init1( IN_CLOEXEC | IN_NONBLOCK );
 
 	if ( mFD < 0 ) {
 		efDEBUG( "Error: %s\n", strerror( errno ) );
-	} else {
-		mInitOK = true;
+		return;
+	}
+
+	mEpollFD = epoll_create1( EPOLL_CLOEXEC );
+	mControlFD = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+	mTimerFD = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK );
+
+	if ( mEpollFD < 0 || mControlFD < 0 || mTimerFD < 0 ) {
+		efDEBUG( "Error: %s\n", strerror( errno ) );
+		return;
 	}
+
+	int fds[] = { mFD, mControlFD, mTimerFD };
+
+	for ( size_t i = 0; i < efARRAY_SIZE( fds ); i++ ) {
+		struct epoll_event ev;
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+
+		if ( epoll_ctl( mEpollFD, EPOLL_CTL_ADD, fds[i], &ev ) < 0 ) {
+			efDEBUG( "Error: %s\n", strerror( errno ) );
+			return;
+		}
+	}
+
+	mInitOK = true;
 }
 
 FileWatcherInotify::~FileWatcherInotify() {
 	mInitOK = false;
-	// There is deadlock when release FileWatcherInotify instance since its handAction
-	// function is still running and hangs in requiring lock without init lock captured.
-	while ( mIsTakingAction ) {
-		// It'd use condition-wait instead of sleep. Actually efsw has no such
-		// implementation so we just skip and sleep while for that to avoid deadlock.
-		usleep( 1000 );
-	};
-	Lock initLock( mInitLock );
+
+	// Wake up the event loop and wait for it to finish, any handleAction in progress will
+	// complete before the thread exits so there's no need to wait for it while holding the locks.
+	postControlMessage( Shutdown );
 
 	efSAFE_DELETE( mThread );
 
+	/// The crawls stop at their next directory
+	std::vector<Crawl*> crawls;
+
+	{
+		Lock lock( mCrawlsLock );
+		crawls.swap( mCrawls );
+	}
+
+	for ( size_t i = 0; i < crawls.size(); i++ ) {
+		crawls[i]->Cancelled = true;
+		efSAFE_DELETE( crawls[i]->Runner );
+		efSAFE_DELETE( crawls[i] );
+	}
+
+	Lock initLock( mInitLock );
 	Lock l( mWatchesLock );
-	Lock l2( mRealWatchesLock );
 
 	WatchMap::iterator iter = mWatches.begin();
 	WatchMap::iterator end = mWatches.end();
 
 	for ( ; iter != end; ++iter ) {
-		efSAFE_DELETE( iter->second );
+		for ( WatcherInotify* watch = iter->second; NULL != watch; ) {
+			WatcherInotify* next = watch->Shared.load( std::memory_order_relaxed );
+			efSAFE_DELETE( watch );
+			watch = next;
+		}
 	}
 
 	mWatches.clear();
+	mActiveWatches.clear();
 
-	if ( mFD != -1 ) {
-		close( mFD );
-		mFD = -1;
+	for ( size_t i = 0; i < mRemovedWatches.size(); i++ ) {
+		efSAFE_DELETE( mRemovedWatches[i] );
 	}
+
+	mRemovedWatches.clear();
+
+	int fds[] = { mFD, mEpollFD, mControlFD, mTimerFD };
+
+	for ( size_t i = 0; i < efARRAY_SIZE( fds ); i++ ) {
+		if ( fds[i] != -1 ) {
+			close( fds[i] );
+		}
+	}
+
+	mFD = mEpollFD = mControlFD = mTimerFD = -1;
+
+	delete[] mPollBuffer;
 }
 
 WatchID FileWatcherInotify::addWatch( const std::string& directory, FileWatchListener* watcher,
-									  bool recursive, const std::vector<WatcherOption>& ) {
+									  bool recursive, const std::vector<WatcherOption>& options ) {
 	if ( !mInitOK )
 		return Errors::Log::createLastError( Errors::Unspecified, directory );
+
+	WatchSettings settings( watchSettings( options ) );
+
 	Lock initLock( mInitLock );
-	return addWatch( directory, watcher, recursive, NULL );
+	WatchID wd = addWatch( directory, watcher, recursive, settings, NULL );
+
+	return wd > 0 ? rootID( (int)wd ) : wd;
+}
+
+WatchID FileWatcherInotify::addWatchAsync( const std::string& directory,
+										   FileWatchListener* watcher, bool recursive,
+										   const std::vector<WatcherOption>& options ) {
+	if ( !mInitOK )
+		return Errors::Log::createLastError( Errors::Unspecified, directory );
+
+	WatchSettings settings( watchSettings( options ) );
+	WatchID wd;
+
+	{
+		Lock initLock( mInitLock );
+		wd = addWatch( directory, watcher, recursive, settings, NULL, false );
+	}
+
+	if ( wd <= 0 )
+		return wd;
+
+	if ( !recursive ) {
+		watcher->handleWatchReady( rootID( (int)wd ), 1, 0 );
+		return rootID( (int)wd );
+	}
+
+	reapCrawls();
+
+	Crawl* crawl = new Crawl();
+	crawl->ID = wd;
+	crawl->Cancelled = false;
+	crawl->Remove = false;
+	crawl->Done = false;
+	crawl->Directories = 0;
+	crawl->Failures = 0;
+	crawl->Runner = new Thread( [this, crawl] { runCrawl( crawl ); } );
+
+	/// Counted before any subdirectory is watched, so none of their events is dropped
+	mCrawling++;
+
+	{
+		Lock lock( mCrawlsLock );
+		mCrawls.push_back( crawl );
+	}
+
+	crawl->Runner->launch();
+
+	return rootID( (int)wd );
+}
+
+void FileWatcherInotify::runCrawl( Crawl* crawl ) {
+	{
+		Lock lock( mCrawlsLock );
+		crawl->RunnerID = std::this_thread::get_id();
+	}
+
+	/// The root isn't removed while its crawl runs
+	WatcherInotify* watch = NULL;
+
+	{
+		Lock lock( mWatchesLock );
+
+		watch = findShared( crawl->ID, rootID( crawl->ID ) );
+	}
+
+	if ( NULL != watch ) {
+		addChildWatches( watch, crawl );
+
+		if ( mInitOK ) {
+			replayStash( watch, !crawl->Cancelled );
+		}
+
+		if ( mInitOK && !crawl->Cancelled ) {
+			watch->Listener->handleWatchReady( watch->ID, crawl->Directories, crawl->Failures );
+		}
+	}
+
+	mCrawling--;
+
+	bool remove;
+
+	{
+		Lock lock( mCrawlsLock );
+		remove = crawl->Remove;
+		crawl->Done = true;
+	}
+
+	if ( remove ) {
+		removeWatch( rootID( (int)crawl->ID ) );
+	}
+}
+
+void FileWatcherInotify::stopCrawl( WatchID watchid ) {
+	Crawl* crawl = NULL;
+
+	{
+		Lock lock( mCrawlsLock );
+
+		for ( std::vector<Crawl*>::iterator it = mCrawls.begin(); it != mCrawls.end(); ++it ) {
+			if ( ( *it )->ID != watchid || ( *it )->Done )
+				continue;
+
+			( *it )->Cancelled = true;
+
+			/// Removed from one of its listeners, the crawl can't wait for itself: it doesn't
+			/// use the watch once cancelled
+			if ( ( *it )->RunnerID == std::this_thread::get_id() )
+				return;
+
+			crawl = *it;
+			mCrawls.erase( it );
+			break;
+		}
+	}
+
+	if ( NULL != crawl ) {
+		efSAFE_DELETE( crawl->Runner );
+		efSAFE_DELETE( crawl );
+	}
+}
+
+bool FileWatcherInotify::deferRemoval( WatchID watchid ) {
+	Lock lock( mCrawlsLock );
+
+	for ( size_t i = 0; i < mCrawls.size(); i++ ) {
+		if ( mCrawls[i]->ID == watchid && !mCrawls[i]->Done ) {
+			mCrawls[i]->Cancelled = true;
+			mCrawls[i]->Remove = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FileWatcherInotify::reapCrawls() {
+	std::vector<Crawl*> done;
+
+	{
+		Lock lock( mCrawlsLock );
+
+		for ( std::vector<Crawl*>::iterator it = mCrawls.begin(); it != mCrawls.end(); ) {
+			if ( ( *it )->Done ) {
+				done.push_back( *it );
+				it = mCrawls.erase( it );
+			} else {
+				++it;
+			}
+		}
+	}
+
+	for ( size_t i = 0; i < done.size(); i++ ) {
+		efSAFE_DELETE( done[i]->Runner );
+		efSAFE_DELETE( done[i] );
+	}
+}
+
+FileWatcherInotify::WatchSettings
+FileWatcherInotify::watchSettings( const std::vector<WatcherOption>& options ) {
+	WatchSettings settings;
+	settings.Interests = getEventInterests( options );
+	settings.Budget = getOptionValue( options, Options::WatchBudget, 0 );
+	settings.MoveWindow =
+		getOptionValue( options, Options::MovePairingWindow, MOVE_PAIRING_TIMEOUT_MS );
+	settings.Options = &options;
+
+	int minInterval = std::max( 1, getOptionValue( options, Options::PollMinInterval, 1000 ) );
+
+	settings.PollMinInterval = minInterval;
+	settings.PollMaxInterval =
+		std::max( minInterval, getOptionValue( options, Options::PollMaxInterval, minInterval ) );
+
+	return settings;
 }
 
 WatchID FileWatcherInotify::addWatch( const std::string& directory, FileWatchListener* watcher,
-									  bool recursive, WatcherInotify* parent ) {
+									  bool recursive, const WatchSettings& settings,
+									  WatcherInotify* parent, bool crawl ) {
 	std::string dir( directory );
 
 	FileSystem::dirAddSlashAtEnd( dir );
 
 	FileInfo fi( dir );
+	bool isLink = false;
 
 	if ( !fi.isDirectory() ) {
 		return Errors::Log::createLastError( Errors::FileNotFound, dir );
@@ -91,6 +458,11 @@ WatchID FileWatcherInotify::addWatch( const std::string& directory, FileWatchLis
 	} else if ( pathInWatches( dir ) ) {
 		return Errors::Log::createLastError( Errors::FileRepeated, directory );
 	} else if ( NULL != parent && FileSystem::isRemoteFS( dir ) ) {
+		/// The kernel doesn't see the changes made by the other clients, the subdirectory is polled
+		std::string name( directory );
+		FileSystem::dirRemoveSlashAtEnd( name );
+		addColdChild( parent, FileSystem::fileNameFromPath( name ) );
+
 		return Errors::Log::createLastError( Errors::FileRemote, dir );
 	}
 
@@ -112,16 +484,23 @@ WatchID FileWatcherInotify::addWatch( const std::string& directory, FileWatchLis
 			return Errors::Log::createLastError( Errors::FileOutOfScope, dir );
 		} else {
 			dir = link;
+			isLink = true;
 		}
 	}
 
-	int wd = inotify_add_watch( mFD, dir.c_str(),
-								IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM |
-									IN_DELETE | IN_MODIFY );
+	/// A directory of another watch keeps the events that one asked for, see watchMask
+	int wd = inotify_add_watch( mFD, dir.c_str(), watchMask( settings.Interests, recursive ) );
 
 	if ( wd < 0 ) {
 		if ( errno == ENOENT ) {
 			return Errors::Log::createLastError( Errors::FileNotFound, dir );
+		} else if ( errno == ENOSPC && NULL != parent ) {
+			/// Out of kernel watches ( fs.inotify.max_user_watches ), the subdirectory is polled
+			std::string name( directory );
+			FileSystem::dirRemoveSlashAtEnd( name );
+			addColdChild( parent, FileSystem::fileNameFromPath( name ) );
+
+			return Errors::Log::createLastError( Errors::WatcherFailed, dir );
 		} else {
 			return Errors::Log::createLastError( Errors::Unspecified,
 												 std::string( strerror( errno ) ) );
@@ -132,429 +511,2270 @@ WatchID FileWatcherInotify::addWatch( const std::string& directory, FileWatchLis
 
 	WatcherInotify* pWatch = new WatcherInotify();
 	pWatch->Listener = watcher;
-	pWatch->ID = parent ? parent->ID : wd;
+	pWatch->ID = parent ? parent->ID : rootID( wd );
 	pWatch->InotifyID = wd;
 	pWatch->Directory = dir;
 	pWatch->Recursive = recursive;
-	pWatch->Parent = parent;
+	pWatch->EventInterests = settings.Interests;
+	pWatch->MoveWindow = settings.MoveWindow;
+
+	if ( NULL != parent ) {
+		pWatch->Filter = parent->Filter;
+		pWatch->Counters = parent->Counters;
+	} else if ( NULL != settings.Options ) {
+		pWatch->Filter = PathFilter::create( dir, *settings.Options );
+	}
+
+	pWatch->IsLink = isLink;
+	pWatch->DirModificationTime = directoryModificationTime( dir );
 
 	{
 		Lock lock( mWatchesLock );
-		mWatches.insert( std::make_pair( wd, pWatch ) );
-		mWatchesRef[pWatch->Directory] = wd;
-	}
 
-	if ( NULL == pWatch->Parent ) {
-		Lock l( mRealWatchesLock );
-		mRealWatches[pWatch->InotifyID] = pWatch;
-	}
+		/// The directory is already watched by the watch. The watches nested in each other
+		/// share the descriptors of their common directories.
+		if ( NULL != findShared( wd, pWatch->ID ) ) {
+			efSAFE_DELETE( pWatch );
+			return wd;
+		}
 
-	if ( pWatch->Recursive ) {
-		std::map<std::string, FileInfo> files = FileSystem::filesInfoFromPath( pWatch->Directory );
-		std::map<std::string, FileInfo>::iterator it = files.begin();
+		attachWatchLocked( pWatch );
 
-		for ( ; it != files.end(); ++it ) {
-			if ( !mInitOK )
-				break;
+		pWatch->PathGeneration = mPathGeneration;
 
-			const FileInfo& cfi = it->second;
+		if ( NULL != parent ) {
+			std::string name( directory );
+			FileSystem::dirRemoveSlashAtEnd( name );
+			pWatch->setParent( parent, FileSystem::fileNameFromPath( name ) );
 
-			if ( cfi.isDirectory() && cfi.isReadable() ) {
-				addWatch( cfi.Filepath, watcher, recursive, pWatch );
-			}
+			WatcherInotify* root = pWatch->root();
+			pWatch->RecentEntry = root->Recent.insert( root->Recent.begin(), pWatch );
+			touchWatchLocked( pWatch );
+
+			root->KernelWatches++;
+			WatchCounters::add( pWatch->Counters->KernelWatches );
+		} else {
+			pWatch->LastActivity = ++mActivityClock;
+			pWatch->WatchBudget = settings.Budget;
+			pWatch->PollMinInterval = settings.PollMinInterval;
+			pWatch->PollMaxInterval = settings.PollMaxInterval;
+			pWatch->KernelWatches = 1;
+			WatchCounters::add( pWatch->Counters->KernelWatches );
 		}
 	}
 
+	if ( NULL == pWatch->Parent ) {
+		mWatchRegistry.add( pWatch );
+	}
+
+	if ( pWatch->Recursive && crawl ) {
+		addChildWatches( pWatch );
+	}
+
 	return wd;
 }
 
-void FileWatcherInotify::removeWatchLocked( WatchID watchid ) {
-	WatchMap::iterator iter = mWatches.find( watchid );
-	if ( iter == mWatches.end() )
+void FileWatcherInotify::addChildWatches( WatcherInotify* watch, Crawl* crawl,
+										  std::vector<std::pair<Error, std::string>>* errors,
+										  std::vector<WatcherInotify*>* added ) {
+	Mutex crawlLock;
+	std::unordered_set<int> crawled;
+	// Subdirectories of a remote file system are never watched
+	if ( NULL == watch->Parent && FileSystem::isRemoteFS( watch->Directory ) )
 		return;
 
-	WatcherInotify* watch = iter->second;
+	crawled.insert( watch->InotifyID );
 
-	for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator itm =
-			  mMovedOutsideWatches.begin();
-		  mMovedOutsideWatches.end() != itm; ++itm ) {
-		if ( itm->first == watch ) {
-			mMovedOutsideWatches.erase( itm );
-			break;
-		}
-	}
+	size_t budget;
+	std::atomic<size_t> used;
 
-	if ( watch->Recursive && NULL == watch->Parent ) {
-		WatchMap::iterator it = mWatches.begin();
-		std::vector<WatchID> eraseWatches;
+	{
+		Lock lock( mWatchesLock );
+		WatcherInotify* root = watch->root();
+		budget = root->WatchBudget;
+		used = root->KernelWatches;
+	}
 
-		for ( ; it != mWatches.end(); ++it )
-			if ( it->second != watch && it->second->inParentTree( watch ) )
-				eraseWatches.push_back( it->second->InotifyID );
+	/// Subdirectories left out of the kernel watches: the index of the parent and their name
+	std::vector<std::pair<size_t, std::string>> cold;
+
+	/// Subdirectories the kernel refused to watch, reported once the crawl is done
+	std::vector<std::pair<Error, std::string>> failed;
+
+	// The kernel watches are added from the crawler threads, the watchers are created at the end
+	// in a single pass so the watches map is locked only once.
+	uint32_t mask = watchMask( watch->EventInterests, watch->Recursive );
+	DirectoryCrawler crawler( mFileWatcher->followSymlinks() );
+	DirectoryCrawler::DirectoryList dirs =
+		crawler.crawl( watch->Directory, [&]( DirectoryCrawler::Directory& dir ) {
+			if ( DirectoryCrawler::NoParent == dir.Parent ) {
+				dir.Handle = watch->InotifyID;
+				return true;
+			}
 
-		for ( std::vector<WatchID>::iterator eit = eraseWatches.begin(); eit != eraseWatches.end();
-			  ++eit ) {
-			removeWatch( *eit );
-		}
-	}
+			if ( !mInitOK || cancelled( crawl ) )
+				return false;
 
-	mWatchesRef.erase( watch->Directory );
-	mWatches.erase( iter );
+			/// The subtrees excluded aren't crawled at all
+			if ( watch->prunes( dir.Path ) )
+				return false;
 
-	if ( NULL == watch->Parent ) {
-		WatchMap::iterator eraseit = mRealWatches.find( watch->InotifyID );
+			if ( dir.IsLink && !linkAllowed( dir.LinkBase, dir.Path ) )
+				return false;
 
-		if ( eraseit != mRealWatches.end() ) {
-			mRealWatches.erase( eraseit );
-		}
-	}
+			// A remote file system can only start at a mount point, its subtree is polled
+			if ( dir.MountPoint ) {
+				Lock lock( crawlLock );
 
-	int err = inotify_rm_watch( mFD, watchid );
+				if ( FileSystem::isRemoteFS( dir.Path ) ) {
+					cold.push_back( std::make_pair( dir.Parent, dir.Name ) );
+					return false;
+				}
+			}
 
-	if ( err < 0 ) {
-		efDEBUG( "Error removing watch %d: %s\n", watchid, strerror( errno ) );
-	} else {
-		efDEBUG( "Removed watch %s with id: %d\n", watch->Directory.c_str(), watchid );
-	}
+			// Over the budget ( or the system limit ) the subtree is polled instead
+			if ( budget > 0 && used.fetch_add( 1 ) >= budget ) {
+				used--;
 
-	efSAFE_DELETE( watch );
-}
+				Lock lock( crawlLock );
+				cold.push_back( std::make_pair( dir.Parent, dir.Name ) );
+				return false;
+			}
 
-void FileWatcherInotify::removeWatch( const std::string& directory ) {
-	if ( !mInitOK )
-		return;
-	Lock initLock( mInitLock );
-	Lock lock( mWatchesLock );
-	Lock l( mRealWatchesLock );
+			int wd = inotify_add_watch( mFD, dir.Path.c_str(), mask );
 
-	std::unordered_map<std::string, WatchID>::iterator ref = mWatchesRef.find( directory );
-	if ( ref == mWatchesRef.end() )
-		return;
+			if ( wd < 0 ) {
+				int err = errno;
 
-	removeWatchLocked( ref->second );
-}
+				efDEBUG( "Error adding watch %s: %s\n", dir.Path.c_str(), strerror( err ) );
 
-void FileWatcherInotify::removeWatch( WatchID watchid ) {
-	if ( !mInitOK )
-		return;
-	Lock initLock( mInitLock );
-	Lock lock( mWatchesLock );
-	removeWatchLocked( watchid );
-}
+				if ( budget > 0 )
+					used--;
 
-void FileWatcherInotify::watch() {
-	if ( NULL == mThread ) {
-		mThread = new Thread([this]{run();});
-		mThread->launch();
-	}
-}
+				if ( err == ENOSPC ) {
+					Lock lock( crawlLock );
+					cold.push_back( std::make_pair( dir.Parent, dir.Name ) );
+				} else if ( err != ENOENT ) {
+					/// Gone meanwhile isn't an error, its parent reports it deleted
+					Error error = EACCES == err ? Errors::FileNotReadable : Errors::WatcherFailed;
 
-Watcher* FileWatcherInotify::watcherContainsDirectory( std::string dir ) {
-	FileSystem::dirRemoveSlashAtEnd( dir );
-	std::string watcherPath = FileSystem::pathRemoveFileName( dir );
-	FileSystem::dirAddSlashAtEnd( watcherPath );
-	Lock lock( mWatchesLock );
+					Lock lock( crawlLock );
+					failed.push_back( std::make_pair( error, dir.Path ) );
+				}
 
-	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		Watcher* watcher = it->second;
-		if ( watcher->Directory == watcherPath )
-			return watcher;
-	}
+				return false;
+			}
 
-	return NULL;
-}
+			// The same inode reached twice ( through a symlink or an existing watch ) returns the
+			// same watch descriptor, only the first one is kept.
+			{
+				Lock lock( crawlLock );
 
-void FileWatcherInotify::run() {
-	char* buff = new char[BUFF_SIZE];
-	memset( buff, 0, BUFF_SIZE );
-	WatchMap::iterator wit;
-
-	WatcherInotify* currentMoveFrom = NULL;
-	u_int32_t currentMoveCookie = -1;
-	bool lastWasMovedFrom = false;
-	std::string prevOldFileName;
-
-	do {
-		fd_set rfds;
-		FD_ZERO( &rfds );
-		FD_SET( mFD, &rfds );
-		timeval timeout;
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 100000;
-
-		if ( select( FD_SETSIZE, &rfds, NULL, NULL, &timeout ) > 0 ) {
-			ssize_t len;
-
-			len = read( mFD, buff, BUFF_SIZE );
-
-			if ( len != -1 ) {
-				ssize_t i = 0;
-
-				while ( i < len ) {
-					struct inotify_event* pevent = (struct inotify_event*)&buff[i];
-
-					{
-						{
-							Lock lock( mWatchesLock );
-
-							wit = mWatches.find( pevent->wd );
-						}
-
-						if ( wit != mWatches.end() ) {
-							handleAction( wit->second, (char*)pevent->name, pevent->mask );
-
-							if ( ( pevent->mask & IN_MOVED_TO ) && wit->second == currentMoveFrom &&
-								 pevent->cookie == currentMoveCookie ) {
-								/// make pair success
-								currentMoveFrom = NULL;
-								currentMoveCookie = -1;
-							} else if ( pevent->mask & IN_MOVED_FROM ) {
-								// Previous event was moved from and current event is moved from
-								// Treat it as a DELETE or moved ouside watches
-								if ( lastWasMovedFrom && currentMoveFrom ) {
-									mMovedOutsideWatches.push_back(
-										std::make_pair( currentMoveFrom, prevOldFileName ) );
-								}
-
-								currentMoveFrom = wit->second;
-								currentMoveCookie = pevent->cookie;
-							} else {
-								/// Keep track of the IN_MOVED_FROM events to know
-								/// if the IN_MOVED_TO event is also fired
-								if ( currentMoveFrom ) {
-									mMovedOutsideWatches.push_back(
-										std::make_pair( currentMoveFrom, prevOldFileName ) );
-								}
-
-								currentMoveFrom = NULL;
-								currentMoveCookie = -1;
-							}
-						}
-
-						lastWasMovedFrom = ( pevent->mask & IN_MOVED_FROM ) != 0;
-						if ( pevent->mask & IN_MOVED_FROM )
-							prevOldFileName = std::string( (char*)pevent->name );
-					}
+				if ( !crawled.insert( wd ).second ) {
+					if ( budget > 0 )
+						used--;
 
-					i += sizeof( struct inotify_event ) + pevent->len;
+					return false;
 				}
 			}
-		} else {
-			// Here means no event received
-			// If last event is IN_MOVED_FROM, we assume no IN_MOVED_TO
-			if ( currentMoveFrom ) {
-				mMovedOutsideWatches.push_back(
-					std::make_pair( currentMoveFrom, currentMoveFrom->OldFileName ) );
-			}
-
-			currentMoveFrom = NULL;
-			currentMoveCookie = -1;
-		}
-
-		if ( !mMovedOutsideWatches.empty() ) {
-			// We need to make a copy since the element mMovedOutsideWatches could be modified
-			// during the iteration.
-			std::vector<std::pair<WatcherInotify*, std::string>> movedOutsideWatches(
-				mMovedOutsideWatches );
-
-			/// In case that the IN_MOVED_TO is never fired means that the file was moved to other
-			/// folder
-			for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator it =
-					  movedOutsideWatches.begin();
-				  it != movedOutsideWatches.end(); ++it ) {
-
-				// Skip if the watch has already being removed
-				if ( mMovedOutsideWatches.size() != movedOutsideWatches.size() ) {
-					bool found = false;
-					for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator itm =
-							  mMovedOutsideWatches.begin();
-						  mMovedOutsideWatches.end() != itm; ++itm ) {
-						if ( itm->first == it->first ) {
-							found = true;
-							break;
-						}
-					}
-					if ( !found )
-						continue;
-				}
 
-				Watcher* watch = ( *it ).first;
-				const std::string& oldFileName = ( *it ).second;
+			dir.Handle = wd;
+			return true;
+		} );
 
-				/// Check if the file move was a folder already being watched
-				std::vector<Watcher*> eraseWatches;
+	std::vector<WatcherInotify*> watchers( dirs.size(), NULL );
+	std::vector<std::pair<WatcherInotify*, std::string>> coldChildren;
 
-				{
-					Lock lock( mWatchesLock );
+	{
+		Lock lock( mWatchesLock );
 
-					for ( ; wit != mWatches.end(); ++wit ) {
-						Watcher* oldWatch = wit->second;
+		WatcherInotify* root = watch->root();
+		Uint64 activity = ++mActivityClock;
 
-						if ( oldWatch != watch &&
-							 -1 != String::strStartsWith( watch->Directory + oldFileName + "/",
-														  oldWatch->Directory ) ) {
-							eraseWatches.push_back( oldWatch );
-						}
-					}
-				}
+		/// Removed meanwhile by another thread, its subtree isn't watched
+		bool removed = !attached( watch );
 
-				/// Remove invalid watches
-				std::stable_sort( eraseWatches.begin(), eraseWatches.end(),
-								  []( const Watcher* left, const Watcher* right ) {
-									  return left->Directory < right->Directory;
-								  } );
+		/// Parents first, as they're crawled
+		std::list<WatcherInotify*> recent;
 
-				if ( eraseWatches.empty() ) {
-					handleAction( watch, oldFileName, IN_DELETE );
-				} else {
-					for ( std::vector<Watcher*>::reverse_iterator eit = eraseWatches.rbegin();
-						  eit != eraseWatches.rend(); ++eit ) {
-						Watcher* rmWatch = *eit;
-
-						/// Create Delete event for removed watches that have been moved too
-						if ( Watcher* cntWatch = watcherContainsDirectory( rmWatch->Directory ) ) {
-							handleAction( cntWatch,
-										  FileSystem::fileNameFromPath( rmWatch->Directory ),
-										  IN_DELETE );
-						}
-					}
-				}
-			}
+		for ( size_t i = 0; i < dirs.size(); i++ ) {
+			DirectoryCrawler::Directory& dir = dirs[i];
 
-			mMovedOutsideWatches.clear();
-		}
-	} while ( mInitOK );
+			if ( DirectoryCrawler::NoParent == dir.Parent ) {
+				watchers[i] = removed ? NULL : watch;
 
-	delete[] buff;
-}
+				if ( NULL != added && !removed ) {
+					added->push_back( watch );
+				}
 
-void FileWatcherInotify::checkForNewWatcher( Watcher* watch, std::string fpath ) {
-	FileSystem::dirAddSlashAtEnd( fpath );
+				continue;
+			}
 
-	/// If the watcher is recursive, checks if the new file is a folder, and creates a watcher
-	if ( watch->Recursive && FileSystem::isDirectory( fpath ) ) {
-		bool found = false;
+			WatcherInotify* parent = watchers[dir.Parent];
+			bool shared = mWatches.find( dir.Handle ) != mWatches.end();
 
-		{
-			Lock lock( mWatchesLock );
+			/// Created in the tree during a crawl from another thread, and watched meanwhile by
+			/// the event loop. The directories of another watch get a watcher of this one too.
+			if ( shared ) {
+				if ( WatcherInotify* existing = findShared( dir.Handle, watch->ID ) ) {
+					watchers[i] = existing;
+					continue;
+				}
+			}
 
-			/// First check if exists
-			for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-				if ( it->second->Directory == fpath ) {
-					found = true;
-					break;
+			// The parent was left out, so is its subtree
+			if ( NULL == parent ) {
+				if ( !shared ) {
+					inotify_rm_watch( mFD, dir.Handle );
 				}
+
+				continue;
+			}
+
+			efDEBUG( "Added watch %s with id: %d\n", dir.Path.c_str(), dir.Handle );
+
+			WatcherInotify* pWatch = new WatcherInotify();
+			pWatch->Listener = watch->Listener;
+			pWatch->ID = watch->ID;
+			pWatch->InotifyID = dir.Handle;
+			pWatch->Directory = dir.Path;
+			pWatch->Recursive = watch->Recursive;
+			pWatch->EventInterests = watch->EventInterests;
+			pWatch->Filter = watch->Filter;
+			pWatch->Counters = watch->Counters;
+			pWatch->MoveWindow = watch->MoveWindow;
+			pWatch->IsLink = dir.IsLink;
+			pWatch->DirModificationTime = dir.ModificationTime;
+			pWatch->PathGeneration = mPathGeneration;
+			pWatch->LastActivity = activity;
+			pWatch->RecentEntry = recent.insert( recent.end(), pWatch );
+			pWatch->setParent( parent, dir.Name );
+
+			attachWatchLocked( pWatch );
+			root->KernelWatches++;
+			WatchCounters::add( root->Counters->KernelWatches );
+
+			watchers[i] = pWatch;
+
+			if ( NULL != added ) {
+				added->push_back( pWatch );
 			}
 		}
 
-		if ( !found ) {
-			addWatch( fpath, watch->Listener, watch->Recursive,
-					  static_cast<WatcherInotify*>( watch ) );
+		/// The directory crawled and its parents stay ahead of the subtree
+		root->Recent.splice( root->Recent.begin(), recent );
+		touchWatchLocked( watch );
+
+		for ( size_t i = 0; i < cold.size(); i++ ) {
+			if ( NULL != watchers[cold[i].first] ) {
+				coldChildren.push_back( std::make_pair( watchers[cold[i].first], cold[i].second ) );
+			}
 		}
 	}
-}
 
-void FileWatcherInotify::handleAction( Watcher* watch, const std::string& filename,
-									   unsigned long action, std::string ) {
-	if ( !watch || !watch->Listener || !mInitOK ) {
+	/// The cold children snapshot their subtree, so they are created without holding the lock
+	for ( size_t i = 0; i < coldChildren.size(); i++ ) {
+		addColdChild( coldChildren[i].first, coldChildren[i].second );
+	}
+
+	if ( NULL != errors ) {
+		for ( size_t i = 0; i < crawler.unreadable().size(); i++ ) {
+			errors->push_back( std::make_pair( Errors::FileNotReadable, crawler.unreadable()[i] ) );
+		}
+
+		errors->insert( errors->end(), failed.begin(), failed.end() );
 		return;
 	}
-	mIsTakingAction = true;
-	Lock initLock( mInitLock );
 
-	std::string fpath( watch->Directory + filename );
+	/// A listener can remove the watch being crawled from its error handler
+	for ( size_t i = 0; i < crawler.unreadable().size() && !cancelled( crawl ); i++ ) {
+		watch->reportError( Errors::FileNotReadable, crawler.unreadable()[i] );
+	}
 
-	if ( ( IN_CLOSE_WRITE & action ) || ( IN_MODIFY & action ) ) {
-		watch->Listener->handleFileAction( watch->ID, watch->Directory, filename,
-										   Actions::Modified );
-	} else if ( IN_MOVED_TO & action ) {
-		/// If OldFileName doesn't exist means that the file has been moved from other folder, so we
-		/// just send the Add event
-		if ( watch->OldFileName.empty() ) {
-			watch->Listener->handleFileAction( watch->ID, watch->Directory, filename,
-											   Actions::Add );
+	for ( size_t i = 0; i < failed.size() && !cancelled( crawl ); i++ ) {
+		watch->reportError( failed[i].first, failed[i].second );
+	}
 
-			watch->Listener->handleFileAction( watch->ID, watch->Directory, filename,
-											   Actions::Modified );
+	if ( NULL != crawl ) {
+		/// The directories polled count as watched
+		crawl->Directories = coldChildren.size();
 
-			checkForNewWatcher( watch, fpath );
-		} else {
-			watch->Listener->handleFileAction( watch->ID, watch->Directory, filename,
-											   Actions::Moved, watch->OldFileName );
+		for ( size_t i = 0; i < watchers.size(); i++ ) {
+			if ( NULL != watchers[i] ) {
+				crawl->Directories++;
+			}
 		}
 
-		if ( watch->Recursive && FileSystem::isDirectory( fpath ) ) {
-			/// Update the new directory path
-			std::string opath( watch->Directory + watch->OldFileName );
-			FileSystem::dirAddSlashAtEnd( opath );
-			FileSystem::dirAddSlashAtEnd( fpath );
-
+		crawl->Failures = crawler.unreadable().size() + failed.size();
+	}
+}
+
+void FileWatcherInotify::detachWatchLocked( WatcherInotify* watch,
+										   std::vector<WatcherInotify*>& detached ) {
+	size_t first = detached.size();
+	WatcherInotify* root = NULL != watch->Parent ? watch->Parent->root() : NULL;
+
+	watch->setParent( NULL, "" );
+	detached.push_back( watch );
+
+	/// Collect the subtree, only the watchers that belong to it are visited
+	for ( size_t i = first; i < detached.size(); i++ ) {
+		WatcherInotify* cur = detached[i];
+
+		for ( WatcherInotify::ChildList::iterator it = cur->Children.begin();
+			  it != cur->Children.end(); ++it ) {
+			detached.push_back( it->second );
+		}
+	}
+
+	for ( size_t i = first; i < detached.size(); i++ ) {
+		WatcherInotify* cur = detached[i];
+
+		for ( PendingMoveMap::iterator itp = mPendingMoves.begin(); itp != mPendingMoves.end(); ) {
+			if ( itp->second.Watch == cur ) {
+				itp = mPendingMoves.erase( itp );
+			} else {
+				++itp;
+			}
+		}
+
+		countMovesLocked();
+
+		/// Each name moved out of the watcher has its entry
+		mMovedOutsideWatches.erase(
+			std::remove_if( mMovedOutsideWatches.begin(), mMovedOutsideWatches.end(),
+							[cur]( const std::pair<WatcherInotify*, std::string>& moved ) {
+								return moved.first == cur;
+							} ),
+			mMovedOutsideWatches.end() );
+
+		if ( NULL != cur->Snapshot ) {
+			/// The snapshot is deleted with the watcher, the event loop could still be using it
+			mActiveWatches.erase( cur->ActiveEntry );
+			cur->ActiveEntry = mActiveWatches.end();
+		}
+
+		if ( NULL != root ) {
+			root->Recent.erase( cur->RecentEntry );
+		}
+
+		unlinkWatchLocked( cur );
+		cur->Children.clear();
+		cur->Parent = NULL;
+
+		/// The cold children are deleted with the watcher
+		mColdWatches -= cur->ColdChildren.size();
+	}
+
+	if ( NULL != root ) {
+		root->KernelWatches -= detached.size() - first;
+		WatchCounters::sub( root->Counters->KernelWatches, detached.size() - first );
+	}
+
+	if ( mWatchRegistry.find( watch->ID ) == watch ) {
+		mWatchRegistry.remove( watch->ID );
+	}
+}
+
+void FileWatcherInotify::attachWatchLocked( WatcherInotify* watch ) {
+	WatchMap::iterator it = mWatches.find( watch->InotifyID );
+
+	if ( it == mWatches.end() ) {
+		mWatches.insert( std::make_pair( watch->InotifyID, watch ) );
+		mWatchTable.insert( watch->InotifyID, watch );
+		return;
+	}
+
+	WatcherInotify* last = it->second;
+
+	while ( NULL != last->Shared.load( std::memory_order_relaxed ) ) {
+		last = last->Shared.load( std::memory_order_relaxed );
+	}
+
+	/// Published last, so the event loop walking the chain sees the watcher complete
+	last->Shared.store( watch, std::memory_order_release );
+}
+
+void FileWatcherInotify::unlinkWatchLocked( WatcherInotify* watch ) {
+	WatchMap::iterator it = mWatches.find( watch->InotifyID );
+
+	if ( it == mWatches.end() )
+		return;
+
+	/// The watcher keeps its link, the event loop can be walking the chain through it
+	WatcherInotify* next = watch->Shared.load( std::memory_order_relaxed );
+
+	if ( it->second == watch ) {
+		if ( NULL == next ) {
+			mWatches.erase( it );
+			mWatchTable.erase( watch->InotifyID );
+			return;
+		}
+
+		/// The next watch sharing the descriptor takes its place
+		it->second = next;
+		mWatchTable.insert( watch->InotifyID, next );
+		watch->KeepDescriptor = true;
+		return;
+	}
+
+	for ( WatcherInotify* prev = it->second; NULL != prev;
+		  prev = prev->Shared.load( std::memory_order_relaxed ) ) {
+		if ( prev->Shared.load( std::memory_order_relaxed ) == watch ) {
+			prev->Shared.store( next, std::memory_order_release );
+			watch->KeepDescriptor = true;
+			return;
+		}
+	}
+}
+
+bool FileWatcherInotify::attached( WatcherInotify* watch ) const {
+	for ( WatcherInotify* cur = mWatchTable.find( watch->InotifyID ); NULL != cur;
+		  cur = cur->Shared.load( std::memory_order_acquire ) ) {
+		if ( cur == watch )
+			return true;
+	}
+
+	return false;
+}
+
+WatcherInotify* FileWatcherInotify::findShared( int wd, WatchID watchid ) const {
+	for ( WatcherInotify* cur = mWatchTable.find( wd ); NULL != cur;
+		  cur = cur->Shared.load( std::memory_order_acquire ) ) {
+		if ( cur->ID == watchid )
+			return cur;
+	}
+
+	return NULL;
+}
+
+void FileWatcherInotify::releaseWatches( std::vector<WatcherInotify*>& watches, bool deferDelete ) {
+	for ( std::vector<WatcherInotify*>::iterator it = watches.begin(); it != watches.end();
+		  ++it ) {
+		/// Another watch still uses the directory
+		if ( ( *it )->KeepDescriptor )
+			continue;
+
+		if ( inotify_rm_watch( mFD, ( *it )->InotifyID ) < 0 ) {
+			efDEBUG( "Error removing watch %d: %s\n", ( *it )->InotifyID, strerror( errno ) );
+		} else {
+			efDEBUG( "Removed watch %s with id: %d\n", ( *it )->Directory.c_str(),
+					 ( *it )->InotifyID );
+		}
+	}
+
+	if ( deferDelete && NULL != mThread ) {
+		/// The event loop could be holding a pointer to any of the watchers, they are deleted
+		/// from the loop once the current events are processed
+		Lock lock( mWatchesLock );
+		mRemovedWatches.insert( mRemovedWatches.end(), watches.begin(), watches.end() );
+	} else {
+		for ( size_t i = 0; i < watches.size(); i++ ) {
+			efSAFE_DELETE( watches[i] );
+		}
+	}
+
+	watches.clear();
+}
+
+void FileWatcherInotify::removeWatchLocked( WatchID watchid ) {
+	std::vector<WatcherInotify*> detached;
+
+	/// Every watch sharing the descriptor loses the directory
+	for ( WatchMap::iterator iter = mWatches.find( watchid ); iter != mWatches.end();
+		  iter = mWatches.find( watchid ) ) {
+		detachWatchLocked( iter->second, detached );
+	}
+
+	releaseWatches( detached, false );
+}
+
+void FileWatcherInotify::removeWatch( const std::string& directory ) {
+	if ( !mInitOK )
+		return;
+
+	std::vector<WatcherInotify*> detached;
+	WatchID root = 0;
+
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		WatcherInotify* watch = findWatcherLocked( directory );
+
+		if ( NULL == watch )
+			return;
+
+		/// A root can be being crawled
+		if ( mWatchRegistry.find( watch->ID ) == watch ) {
+			root = watch->ID;
+		} else {
+			detachWatchLocked( watch, detached );
+		}
+	}
+
+	if ( 0 != root ) {
+		removeWatch( root );
+		return;
+	}
+
+	/// The kernel watches are removed without holding the locks, so the event loop keeps
+	/// processing the events of the other watches meanwhile
+	releaseWatches( detached, true );
+}
+
+void FileWatcherInotify::removeWatch( WatchID watchid ) {
+	int wd = rootDescriptor( watchid );
+
+	if ( !mInitOK || wd < 0 )
+		return;
+
+	stopCrawl( wd );
+
+	std::vector<WatcherInotify*> detached;
+
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		/// The descriptor can be shared with a directory of another watch
+		WatcherInotify* watch = findShared( wd, watchid );
+
+		if ( NULL == watch || NULL != watch->Parent )
+			return;
+
+		detachWatchLocked( watch, detached );
+	}
+
+	releaseWatches( detached, true );
+}
+
+bool FileWatcherInotify::expandWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+	WatchScope* scope = filter ? filter->scope() : NULL;
+
+	if ( NULL == scope || !scope->expand( directory ) )
+		return false;
+
+	/// The watchers are only deleted by the event loop, so it's the one crawling them
+	{
+		Lock lock( mControlLock );
+		mExpansions.push_back( std::make_pair( watchid, scope->fullPath( directory ) ) );
+	}
+
+	postControlMessage( Expand );
+
+	return true;
+}
+
+void FileWatcherInotify::expandWatches() {
+	std::vector<std::pair<WatchID, std::string>> expansions;
+
+	{
+		Lock lock( mControlLock );
+		expansions.swap( mExpansions );
+	}
+
+	Lock initLock( mInitLock );
+
+	for ( size_t i = 0; i < expansions.size() && mInitOK; i++ ) {
+		std::vector<WatcherInotify*> subtree;
+		std::vector<ColdChild*> cold;
+
+		{
+			Lock lock( mWatchesLock );
+
+			WatcherInotify* watch =
+				findWatcherLocked( expansions[i].second, expansions[i].first );
+
+			if ( NULL == watch || watch->ID != expansions[i].first || !watch->Recursive )
+				continue;
+
+			/// Any directory watched in the subtree can have subdirectories brought in scope
+			subtree.push_back( watch );
+
+			for ( size_t j = 0; j < subtree.size(); j++ ) {
+				for ( WatcherInotify::ChildList::iterator it = subtree[j]->Children.begin();
+					  it != subtree[j]->Children.end(); ++it ) {
+					subtree.push_back( it->second );
+				}
+
+				for ( WatcherInotify::ColdChildList::iterator it =
+						  subtree[j]->ColdChildren.begin();
+					  it != subtree[j]->ColdChildren.end(); ++it ) {
+					cold.push_back( it->second );
+				}
+			}
+		}
+
+		/// The crawls skip the subdirectories already watched
+		for ( size_t j = 0; j < subtree.size() && mInitOK; j++ ) {
+			addChildWatches( subtree[j] );
+		}
+
+		for ( size_t j = 0; j < cold.size(); j++ ) {
+			cold[j]->expand( expansions[i].second );
+		}
+	}
+}
+
+void FileWatcherInotify::queueCrawl( WatchID watchid, int wd, bool created ) {
+	bool wakeup;
+
+	{
+		Lock lock( mControlLock );
+
+		PendingCrawl crawl;
+		crawl.ID = watchid;
+		crawl.InotifyID = wd;
+		crawl.Created = created;
+
+		wakeup = mPendingCrawls.empty();
+		mPendingCrawls.push_back( crawl );
+	}
+
+	/// The event loop crawls them once the events read are handled, the wake up is for the ones
+	/// queued off it ( replaying the events of a crawl )
+	if ( wakeup ) {
+		postControlMessage( CrawlAdded );
+	}
+}
+
+void FileWatcherInotify::crawlPending() {
+	std::vector<PendingCrawl> pending;
+
+	{
+		Lock lock( mControlLock );
+		pending.swap( mPendingCrawls );
+	}
+
+	std::vector<std::pair<Error, std::string>> errors;
+	std::vector<WatcherInotify*> added;
+
+	for ( size_t i = 0; i < pending.size() && mInitOK; i++ ) {
+		WatcherInotify* watch = NULL;
+
+		{
+			Lock lock( mWatchesLock );
+
+			watch = findShared( pending[i].InotifyID, pending[i].ID );
+		}
+
+		if ( NULL == watch )
+			continue;
+
+		errors.clear();
+		added.clear();
+
+		addChildWatches( watch, NULL, &errors, pending[i].Created ? &added : NULL );
+
+		if ( errors.empty() && added.empty() )
+			continue;
+
+		/// Reported holding mInitLock, so none reaches a watch once it's removed
+		Lock initLock( mInitLock );
+
+		/// The entries made in a new directory before it was watched raised no event, e.g. the
+		/// subdirectories of a mkdir -p
+		reportEntries( added );
+
+		if ( !attached( watch ) )
+			continue;
+
+		for ( size_t e = 0; e < errors.size(); e++ ) {
+			watch->reportError( errors[e].first, errors[e].second );
+		}
+	}
+}
+
+void FileWatcherInotify::reportEntries( const std::vector<WatcherInotify*>& watchers ) {
+	FileInfoMap files;
+	std::string dir;
+
+	for ( size_t i = 0; i < watchers.size() && mInitOK; i++ ) {
+		WatcherInotify* watch = watchers[i];
+
+		if ( !attached( watch ) || !watch->accepts( Actions::Add ) )
+			continue;
+
+		{
+			Lock lock( mWatchesLock );
+			dir.assign( watch->path( mPathGeneration ) );
+		}
+
+		FileSystem::listDirectory( dir, files, false );
+
+		for ( FileInfoMap::iterator it = files.begin(); it != files.end(); ++it ) {
+			if ( watch->matches( dir, it->first ) ) {
+				mBatch.add( watch->Listener, watch->ID, dir, it->first, Actions::Add );
+			}
+		}
+	}
+
+	mBatch.flush();
+}
+
+bool FileWatcherInotify::collapseWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+	WatchScope* scope = filter ? filter->scope() : NULL;
+
+	if ( NULL == scope || !scope->collapse( directory ) )
+		return false;
+
+	std::vector<WatcherInotify*> detached;
+
+	{
+		Lock initLock( mInitLock );
+		std::vector<ColdChild*> coldChildren;
+
+		{
+			Lock lock( mWatchesLock );
+
+			WatcherInotify* watch = findWatcherLocked( scope->fullPath( directory ), watchid );
+
+			if ( NULL != watch && watch->ID == watchid ) {
+				/// The directory itself stays watched, only its subtrees are detached
+				std::vector<WatcherInotify*> children;
+				std::vector<std::string> cold;
+
+				for ( WatcherInotify::ChildList::iterator it = watch->Children.begin();
+					  it != watch->Children.end(); ++it ) {
+					children.push_back( it->second );
+				}
+
+				for ( size_t i = 0; i < children.size(); i++ ) {
+					detachWatchLocked( children[i], detached );
+				}
+
+				for ( WatcherInotify::ColdChildList::iterator it = watch->ColdChildren.begin();
+					  it != watch->ColdChildren.end(); ++it ) {
+					cold.push_back( it->first );
+				}
+
+				for ( size_t i = 0; i < cold.size(); i++ ) {
+					coldChildren.push_back( takeColdChildLocked( watch, cold[i] ) );
+				}
+			}
+		}
+
+		/// The cold children are only deleted holding mInitLock, as the event loop polls them
+		for ( size_t i = 0; i < coldChildren.size(); i++ ) {
+			efSAFE_DELETE( coldChildren[i] );
+		}
+	}
+
+	releaseWatches( detached, true );
+
+	return true;
+}
+
+void FileWatcherInotify::watch() {
+	if ( NULL == mThread ) {
+		mThread = new Thread([this]{run();});
+		mThread->launch();
+	}
+}
+
+WatcherInotify* FileWatcherInotify::findWatcherLocked( std::string dir, WatchID watchid ) {
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	size_t len = dir.size();
+
+	/// Find the deepest root that contains the directory and descend through the tree by name
+	while ( len > 0 ) {
+		WatcherInotify* watcher =
+			static_cast<WatcherInotify*>( mWatchRegistry.find( dir.substr( 0, len ) ) );
+
+		/// The root of another watch nested in the tree searched
+		if ( NULL != watcher && 0 != watchid && watcher->ID != watchid ) {
+			watcher = NULL;
+		}
+
+		for ( size_t pos = len; NULL != watcher && pos < dir.size(); ) {
+			size_t end = dir.find( FileSystem::getOSSlash(), pos );
+
+			watcher = watcher->findChild( dir.substr( pos, end - pos ) );
+			pos = end + 1;
+		}
+
+		if ( NULL != watcher )
+			return watcher;
+
+		size_t slash = len >= 2 ? dir.find_last_of( FileSystem::getOSSlash(), len - 2 )
+								: std::string::npos;
+
+		len = std::string::npos != slash ? slash + 1 : 0;
+	}
+
+	return NULL;
+}
+
+void FileWatcherInotify::postControlMessage( ControlMessage message ) {
+	if ( mControlFD == -1 )
+		return;
+
+	{
+		Lock lock( mControlLock );
+		mControlMessages.push_back( message );
+	}
+
+	Uint64 value = 1;
+
+	if ( write( mControlFD, &value, sizeof( value ) ) < 0 && errno != EAGAIN ) {
+		efDEBUG( "Error waking up the event loop: %s\n", strerror( errno ) );
+	}
+}
+
+void FileWatcherInotify::armTimer( long ms ) {
+	struct itimerspec its;
+	memset( &its, 0, sizeof( its ) );
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = ( ms % 1000 ) * 1000000L;
+
+	timerfd_settime( mTimerFD, 0, &its, NULL );
+}
+
+long FileWatcherInotify::nextMoveTimeout() {
+	Lock lock( mWatchesLock );
+
+	if ( mPendingMoves.empty() )
+		return 0;
+
+	Uint64 next = mPendingMoves.begin()->second.Deadline;
+
+	for ( PendingMoveMap::iterator it = mPendingMoves.begin(); it != mPendingMoves.end(); ++it ) {
+		next = std::min( next, it->second.Deadline );
+	}
+
+	Uint64 now = monotonicTime();
+
+	/// An expired move still needs the timer to fire
+	return next > now ? (long)( next - now ) : 1;
+}
+
+void FileWatcherInotify::expireMoves( bool all ) {
+	Lock lock( mWatchesLock );
+
+	Uint64 now = monotonicTime();
+
+	for ( PendingMoveMap::iterator it = mPendingMoves.begin(); it != mPendingMoves.end(); ) {
+		/// The IN_MOVED_TO read by another shard was reported as an addition there
+		if ( all || it->second.Deadline <= now ||
+			 ( NULL != mGroup && mGroup->claimed( it->first ) ) ) {
+			it = expireMoveLocked( it );
+		} else {
+			++it;
+		}
+	}
+}
+
+void FileWatcherInotify::flushMoves( WatcherInotify* watch, std::string_view name, Uint32 keep ) {
+	/// Nothing can be added meanwhile, the moves are added by the events dispatched
+	if ( 0 == mPendingMoveCount.load( std::memory_order_relaxed ) )
+		return;
+
+	{
+		Lock lock( mWatchesLock );
+
+		bool expired = false;
+
+		for ( PendingMoveMap::iterator it = mPendingMoves.begin(); it != mPendingMoves.end(); ) {
+			if ( it->second.Watch == watch && it->first != keep && it->second.Name == name ) {
+				it = expireMoveLocked( it );
+				expired = true;
+			} else {
+				++it;
+			}
+		}
+
+		if ( !expired )
+			return;
+	}
+
+	processMovedOutside();
+}
+
+FileWatcherInotify::PendingMoveMap::iterator
+FileWatcherInotify::expireMoveLocked( PendingMoveMap::iterator it ) {
+	efTRACE_SINCE( mFileWatcher, "inotify.movePairing", it->second.Watch->ID,
+				   it->second.Captured );
+
+	if ( NULL != mGroup ) {
+		mGroup->movePaired( it->first );
+	}
+
+	mMovedOutsideWatches.push_back( std::make_pair( it->second.Watch, it->second.Name ) );
+
+	PendingMoveMap::iterator next = mPendingMoves.erase( it );
+	countMovesLocked();
+	return next;
+}
+
+void FileWatcherInotify::countMovesLocked() {
+	mPendingMoveCount.store( mPendingMoves.size(), std::memory_order_relaxed );
+}
+
+bool FileWatcherInotify::takeMoveLocked( Uint32 cookie, WatcherInotify* watch,
+										 PendingMove& move ) {
+	std::pair<PendingMoveMap::iterator, PendingMoveMap::iterator> range =
+		mPendingMoves.equal_range( cookie );
+	PendingMoveMap::iterator found = mPendingMoves.end();
+
+	for ( PendingMoveMap::iterator it = range.first; it != range.second; ++it ) {
+		if ( it->second.Watch->ID == watch->ID ) {
+			found = it;
+			break;
+		}
+
+		/// A watch sharing the descriptor pairs its own move
+		if ( found == mPendingMoves.end() &&
+			 NULL == findShared( watch->InotifyID, it->second.Watch->ID ) ) {
+			found = it;
+		}
+	}
+
+	if ( found == mPendingMoves.end() )
+		return false;
+
+	move = std::move( found->second );
+	mPendingMoves.erase( found );
+	countMovesLocked();
+	return true;
+}
+
+void FileWatcherInotify::run() {
+	char* buff = new char[BUFF_SIZE];
+	memset( buff, 0, BUFF_SIZE );
+
+	while ( mInitOK ) {
+		/// The loop wakes up on the poll tick when there are cold directories or activity to sync
+		int timeout = -1;
+
+		{
+			Lock lock( mWatchesLock );
+
+			if ( mColdWatches > 0 || !mSyncPending.empty() ) {
+				Uint64 now = monotonicTime();
+				timeout = mNextColdPoll > now ? (int)( mNextColdPoll - now ) : 0;
+			}
+		}
+
+		if ( !processEvents( buff, timeout ) )
+			break;
+	}
+
+	delete[] buff;
+}
+
+PollHandle FileWatcherInotify::pollHandle() {
+	return mEpollFD;
+}
+
+void FileWatcherInotify::poll() {
+	if ( NULL != mThread || !mInitOK )
+		return;
+
+	if ( NULL == mPollBuffer ) {
+		mPollBuffer = new char[BUFF_SIZE];
+		memset( mPollBuffer, 0, BUFF_SIZE );
+	}
+
+	processEvents( mPollBuffer, 0 );
+}
+
+bool FileWatcherInotify::processEvents( char* buff, int timeout ) {
+	struct epoll_event events[3];
+	bool running = true;
+
+	int nfds = epoll_wait( mEpollFD, events, efARRAY_SIZE( events ), timeout );
+
+	if ( nfds < 0 ) {
+		if ( errno == EINTR )
+			return true;
+
+		efDEBUG( "epoll_wait error: %s\n", strerror( errno ) );
+		return false;
+	}
+
+	for ( int n = 0; n < nfds; n++ ) {
+		int fd = events[n].data.fd;
+
+		if ( fd == mControlFD ) {
+			Uint64 value;
+
+			while ( read( mControlFD, &value, sizeof( value ) ) > 0 )
+				;
+
+			std::vector<ControlMessage> messages;
+
+			{
+				Lock lock( mControlLock );
+				messages.swap( mControlMessages );
+			}
+
+			bool expand = false;
+			bool crawlAdded = false;
+			bool claimed = false;
+
+			for ( size_t i = 0; i < messages.size(); i++ ) {
+				if ( messages[i] == Shutdown ) {
+					running = false;
+				} else if ( messages[i] == Expand ) {
+					expand = true;
+				} else if ( messages[i] == CrawlAdded ) {
+					crawlAdded = true;
+				} else if ( messages[i] == Claimed ) {
+					claimed = true;
+				}
+			}
+
+			if ( expand && running ) {
+				expandWatches();
+			}
+
+			if ( crawlAdded && running ) {
+				crawlPending();
+			}
+
+			if ( claimed && running ) {
+				expireMoves( false );
+			}
+		} else if ( fd == mTimerFD ) {
+			Uint64 expirations;
+
+			while ( read( mTimerFD, &expirations, sizeof( expirations ) ) > 0 )
+				;
+
+			// No IN_MOVED_TO arrived in time, assume the files were moved outside the watches
+			expireMoves( false );
+		} else if ( fd == mFD ) {
+			readEvents( buff );
+		}
+	}
+
+	if ( !running || !mInitOK )
+		return false;
+
+	bool cold;
+	bool sync;
+
+	{
+		Lock lock( mWatchesLock );
+		cold = mColdWatches > 0;
+		sync = !mSyncPending.empty();
+	}
+
+	long timer = nextMoveTimeout();
+
+	/// Without an event loop thread the timer also wakes up the caller on the poll tick
+	if ( ( cold || sync ) && NULL == mThread ) {
+		Uint64 now = monotonicTime();
+		long next = mNextColdPoll > now ? (long)( mNextColdPoll - now ) : 1;
+		timer = 0 == timer ? next : std::min( timer, next );
+	}
+
+	armTimer( timer );
+
+	{
+		/// The events of a crawl replayed also report the moves of their directories
+		Lock initLock( mInitLock );
+		processMovedOutside();
+		mBatch.flush();
+	}
+
+	if ( ( cold || sync ) && monotonicTime() >= mNextColdPoll ) {
+		syncActivity();
+
+		if ( cold ) {
+			pollColdWatches();
+		}
+
+		mNextColdPoll = monotonicTime() + COLD_POLL_INTERVAL_MS;
+	}
+
+	deleteRemovedWatches();
+
+	return true;
+}
+
+void FileWatcherInotify::deleteRemovedWatches() {
+	std::vector<WatcherInotify*> removed;
+
+	{
+		Lock lock( mWatchesLock );
+
+		/// No lookup is in progress between the iterations of the event loop
+		mWatchTable.reclaim();
+
+		if ( mRemovedWatches.empty() )
+			return;
+
+		removed.swap( mRemovedWatches );
+
+		/// The pairing state could have been set from a watcher removed meanwhile
+		for ( size_t i = 0; i < removed.size(); i++ ) {
+			for ( PendingMoveMap::iterator itp = mPendingMoves.begin();
+				  itp != mPendingMoves.end(); ) {
+				if ( itp->second.Watch == removed[i] ) {
+					itp = mPendingMoves.erase( itp );
+				} else {
+					++itp;
+				}
+			}
+
+			countMovesLocked();
+
+			for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator itm =
+					  mMovedOutsideWatches.begin();
+				  mMovedOutsideWatches.end() != itm; ) {
+				if ( itm->first == removed[i] ) {
+					itm = mMovedOutsideWatches.erase( itm );
+				} else {
+					++itm;
+				}
+			}
+		}
+	}
+
+	for ( size_t i = 0; i < removed.size(); i++ ) {
+		efSAFE_DELETE( removed[i] );
+	}
+}
+
+void FileWatcherInotify::readEvents( char* buff ) {
+	ssize_t len;
+	bool overflowed = false;
+	efTRACE_TIME( readBegin );
+
+	while ( mInitOK && ( len = read( mFD, buff, BUFF_SIZE ) ) > 0 ) {
+		efTRACE_TIME( readEnd );
+		efTRACE_SINCE( mFileWatcher, "inotify.read", 0, readBegin );
+#ifdef EFSW_TRACING
+		mBatch.capture( readEnd );
+#endif
+
+		/// The events of the buffer are delivered in a batch, once it's fully processed
+		Lock initLock( mInitLock );
+
+		efTRACE_SINCE( mFileWatcher, "inotify.lock", 0, readEnd );
+		efTRACE_TIME( batchBegin );
+
+		ssize_t i = 0;
+
+		while ( i < len ) {
+			struct inotify_event* pevent = (struct inotify_event*)&buff[i];
+			WatcherInotify* watch = NULL;
+
+			i += sizeof( struct inotify_event ) + pevent->len;
+
+			if ( pevent->mask & IN_Q_OVERFLOW ) {
+				/// Events were lost, the watches are resynced once the queue is drained
+				overflowed = true;
+				continue;
+			}
+
+			if ( pevent->mask & IN_IGNORED ) {
+				/// The kernel dropped the watch ( directory deleted or file system unmounted ), the
+				/// events of the parent already reported it
+				Lock lock( mWatchesLock );
+
+				efDEBUG( "Watch %d ignored\n", pevent->wd );
+
+				/// A root being crawled is removed by its crawl
+				if ( !deferRemoval( pevent->wd ) ) {
+					removeWatchLocked( pevent->wd );
+				}
+
+				continue;
+			}
+
+			/// The watchers are only deleted from the event loop, a watcher found stays valid
+			/// while its event is handled
+			watch = mWatchTable.find( pevent->wd );
+
+			/// The name points to the read buffer, padded with null bytes
+			std::string_view name( pevent->len > 0 ? pevent->name : "" );
+			Uint64 captured = 0;
+#ifdef EFSW_TRACING
+			captured = readEnd;
+#endif
+
+			if ( NULL != watch ) {
+				/// Every watch sharing the descriptor gets the event
+				for ( ; NULL != watch; watch = watch->Shared.load( std::memory_order_acquire ) ) {
+					dispatchEvent( watch, name, pevent->mask, pevent->cookie, captured );
+				}
+			} else if ( mCrawling > 0 ) {
+				stashEvent( pevent->wd, name, pevent->mask, pevent->cookie, captured );
+			}
+		}
+
+		mBatch.flush();
+
+		initLock.unlock();
+
+		/// The directories added are crawled before the next events, as when they were added
+		crawlPending();
+
+		efTRACE_SINCE( mFileWatcher, "inotify.batch", 0, batchBegin );
+		efTRACE_SET_TIME( readBegin );
+	}
+
+	if ( overflowed && mInitOK ) {
+		resync();
+	}
+}
+
+/// Content and attribute events are handled without locking. The structural events lock the
+/// mWatchesLock to track the activity, the moves also to pair them, to re-parent a renamed
+/// directory and to flush the pending moves while any is left.
+void FileWatcherInotify::dispatchEvent( WatcherInotify* watch, std::string_view name,
+										 Uint32 mask, Uint32 cookie, Uint64 captured ) {
+	/// An unpaired move of the same name is reported first, only the pair of an IN_MOVED_TO
+	/// waits for it
+	flushMoves( watch, name, ( mask & IN_MOVED_TO ) ? cookie : 0 );
+
+	trackActivity( watch, name, mask );
+
+	if ( mask & IN_MOVED_FROM ) {
+		/// Reported when its pair arrives, or as moved outside the watches when the pairing window
+		/// expires. Any number of moves can be pending at once.
+		Lock lock( mWatchesLock );
+
+		PendingMove& move = mPendingMoves.emplace( cookie, PendingMove() )->second;
+		countMovesLocked();
+		move.Watch = watch;
+		move.Name.assign( name.data(), name.size() );
+		move.Deadline = monotonicTime() + watch->MoveWindow;
+		move.Captured = captured;
+
+		/// Its IN_MOVED_TO was read by another shard already, it's expired right away
+		if ( NULL != mGroup && mGroup->moveFrom( cookie, this ) ) {
+			move.Deadline = 0;
+		}
+	} else if ( mask & IN_MOVED_TO ) {
+		WatcherInotify* from = NULL;
+		std::string oldName;
+
+		{
+			Lock lock( mWatchesLock );
+
+			PendingMove move;
+
+			if ( takeMoveLocked( cookie, watch, move ) ) {
+				efTRACE_SINCE( mFileWatcher, "inotify.movePairing", move.Watch->ID,
+							   move.Captured );
+				from = move.Watch;
+				oldName.swap( move.Name );
+			}
+		}
+
+		/// The IN_MOVED_FROM can be read by another shard, which expires it once claimed
+		if ( NULL != mGroup ) {
+			if ( NULL != from ) {
+				mGroup->movePaired( cookie );
+			} else {
+				mGroup->moveTo( cookie, this );
+			}
+		}
+
+		if ( NULL != from && from != watch ) {
+			handleMoveBetween( from, oldName, watch, name );
+		} else {
+			/// A rename inside the directory, or a file moved in from outside
+			watch->OldFileName.swap( oldName );
+
+			handleEvent( watch, name, mask );
+		}
+	} else {
+		handleEvent( watch, name, mask );
+	}
+}
+
+void FileWatcherInotify::stashEvent( int wd, std::string_view name, Uint32 mask, Uint32 cookie,
+									 Uint64 captured ) {
+	if ( mStash.size() >= MAX_STASHED_EVENTS ) {
+		/// The crawls resync their trees once done instead
+		mStashOverflowed = true;
+		return;
+	}
+
+	mStash.emplace_back();
+
+	StashedEvent& event = mStash.back();
+	event.WD = wd;
+	event.Name.assign( name.data(), name.size() );
+	event.Mask = mask;
+	event.Cookie = cookie;
+	event.Captured = captured;
+}
+
+void FileWatcherInotify::replayStash( WatcherInotify* root, bool deliver ) {
+	bool overflowed;
+
+	{
+		Lock initLock( mInitLock );
+
+		size_t kept = 0;
+
+		for ( size_t i = 0; i < mStash.size(); i++ ) {
+			StashedEvent& event = mStash[i];
+			WatcherInotify* watch = mWatchTable.find( event.WD );
+
+			if ( NULL != watch ) {
+				for ( ; NULL != watch; watch = watch->Shared.load( std::memory_order_acquire ) ) {
+					if ( deliver || watch->root() != root ) {
+						dispatchEvent( watch, event.Name, event.Mask, event.Cookie,
+									   event.Captured );
+					}
+				}
+			} else if ( mCrawling > 1 ) {
+				/// It can belong to a crawl still running
+				if ( kept != i ) {
+					mStash[kept] = std::move( event );
+				}
+
+				kept++;
+			}
+		}
+
+		mStash.resize( kept );
+
+		mBatch.flush();
+
+		overflowed = mStashOverflowed;
+
+		if ( mCrawling == 1 ) {
+			mStashOverflowed = false;
+		}
+	}
+
+	/// Replayed from the thread of the crawl, the moves left to pair expire on the event loop
+	bool moves;
+
+	{
+		Lock lock( mWatchesLock );
+		moves = !mPendingMoves.empty();
+	}
+
+	if ( moves ) {
+		postControlMessage( Wakeup );
+	}
+
+	if ( overflowed && deliver && mInitOK ) {
+		resync();
+	}
+}
+
+void FileWatcherInotify::processMovedOutside() {
+	std::vector<std::pair<WatcherInotify*, std::string>> movedOutsideWatches;
+
+	{
+		Lock lock( mWatchesLock );
+
+		if ( mMovedOutsideWatches.empty() )
+			return;
+
+		// We need to make a copy since the element mMovedOutsideWatches could be modified
+		// during the iteration.
+		movedOutsideWatches = mMovedOutsideWatches;
+	}
+
+	/// In case that the IN_MOVED_TO is never fired means that the file was moved to other
+	/// folder
+	for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator it =
+			  movedOutsideWatches.begin();
+		  it != movedOutsideWatches.end(); ++it ) {
+		WatcherInotify* watch = ( *it ).first;
+		const std::string& oldFileName = ( *it ).second;
+
+		/// Check if the file move was a folder already being watched
+		std::vector<WatcherInotify*> eraseWatches;
+
+		{
+			Lock lock( mWatchesLock );
+
+			// Skip if the watch has already being removed
+			bool found = false;
+
+			for ( std::vector<std::pair<WatcherInotify*, std::string>>::iterator itm =
+					  mMovedOutsideWatches.begin();
+				  mMovedOutsideWatches.end() != itm; ++itm ) {
+				if ( itm->first == it->first ) {
+					found = true;
+					break;
+				}
+			}
+
+			if ( !found )
+				continue;
+
+			if ( WatcherInotify* moved = watch->findChild( oldFileName ) ) {
+				eraseWatches.push_back( moved );
+
+				for ( size_t i = 0; i < eraseWatches.size(); i++ ) {
+					WatcherInotify::ChildList& children = eraseWatches[i]->Children;
+
+					for ( WatcherInotify::ChildList::iterator cit = children.begin();
+						  cit != children.end(); ++cit ) {
+						eraseWatches.push_back( cit->second );
+					}
+				}
+			}
+		}
+
+		if ( eraseWatches.empty() ) {
+			handleEvent( watch, oldFileName, IN_DELETE );
+		} else {
+			/// Children always come after their parent, so the deepest directories are removed
+			/// first. Copy the name, the watcher is deleted while handling its removal.
+			for ( std::vector<WatcherInotify*>::reverse_iterator eit = eraseWatches.rbegin();
+				  eit != eraseWatches.rend(); ++eit ) {
+				std::string name( ( *eit )->Name );
+
+				/// Create Delete event for removed watches that have been moved too
+				handleEvent( ( *eit )->Parent, name, IN_DELETE );
+			}
+		}
+	}
+
+	Lock lock( mWatchesLock );
+	mMovedOutsideWatches.clear();
+}
+
+void FileWatcherInotify::trackActivity( WatcherInotify* watch, std::string_view name,
+										 Uint32 mask ) {
+	/// Content changes are tracked on IN_CLOSE_WRITE, stat'ing on every write is too expensive.
+	/// The other events don't take the lock.
+	if ( !( mask & ( IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CLOSE_WRITE ) ) )
+		return;
+
+	Lock lock( mWatchesLock );
+
+	if ( !attached( watch ) )
+		return;
+
+	touchWatchLocked( watch );
+
+	if ( NULL != watch->Snapshot ) {
+		mActiveWatches.splice( mActiveWatches.begin(), mActiveWatches, watch->ActiveEntry );
+	}
+
+	if ( mask & ( IN_DELETE | IN_MOVED_FROM ) ) {
+		/// The snapshot is only modified holding mInitLock, as the events are dispatched
+		if ( NULL != watch->Snapshot ) {
+			watch->Snapshot->Files.erase( name );
+		}
+
+		WatcherInotify::NameSet::iterator it = watch->Touched.find( name );
+
+		if ( it != watch->Touched.end() ) {
+			watch->Touched.erase( it );
+		}
+	} else {
+		/// Only a name not touched yet is copied
+		WatcherInotify::NameSet::iterator it = watch->Touched.lower_bound( name );
+
+		if ( it == watch->Touched.end() || *it != name ) {
+			watch->Touched.emplace_hint( it, name );
+		}
+	}
+
+	if ( !watch->SyncPending ) {
+		watch->SyncPending = true;
+		mSyncPending.push_back( watch->InotifyID );
+	}
+}
+
+void FileWatcherInotify::syncActivity() {
+	Lock initLock( mInitLock );
+
+	std::vector<int> pending;
+
+	{
+		Lock lock( mWatchesLock );
+		pending.swap( mSyncPending );
+	}
+
+	for ( size_t i = 0; i < pending.size(); i++ ) {
+		WatcherInotify* watch;
+		WatcherInotify::NameSet touched;
+		std::string dir;
+
+		{
+			Lock lock( mWatchesLock );
+
+			/// A descriptor reused by a directory watched meanwhile isn't pending
+			watch = mWatchTable.find( pending[i] );
+
+			while ( NULL != watch && !watch->SyncPending ) {
+				watch = watch->Shared.load( std::memory_order_relaxed );
+			}
+
+			if ( NULL == watch )
+				continue;
+
+			watch->SyncPending = false;
+			touched.swap( watch->Touched );
+			dir = watch->path( mPathGeneration );
+		}
+
+		if ( NULL == watch->Snapshot ) {
+			/// First activity of the directory. The listing can be ahead of the events still
+			/// queued, so the entries changed since the directory was last known in sync are left
+			/// out: they are added back by their events, or reported by the resync if the events
+			/// are lost.
+			DirectorySnapshot* snapshot = new DirectorySnapshot( dir );
+
+			Lock lock( mWatchesLock );
+
+			if ( !attached( watch ) ) {
+				efSAFE_DELETE( snapshot );
+				continue;
+			}
+
+			for ( FileInfoMap::iterator fit = snapshot->Files.begin();
+				  fit != snapshot->Files.end(); ) {
+				if ( modifiedAfter( *snapshot, *fit, watch->DirModificationTime ) &&
+					 !( fit->second.isDirectory() &&
+						NULL != watch->findChild( std::string( fit->first ) ) ) ) {
+					fit = snapshot->Files.erase( fit );
+				} else {
+					++fit;
+				}
+			}
+
+			activateWatchLocked( watch, snapshot );
+		}
+
+		for ( WatcherInotify::NameSet::iterator it = touched.begin(); it != touched.end(); ++it ) {
+			FileInfo fi( dir + *it );
+
+			if ( fi.isRegularFile() || fi.isDirectory() ) {
+				watch->Snapshot->setFile( *it, fi );
+			} else {
+				watch->Snapshot->Files.erase( *it );
+			}
+		}
+	}
+}
+
+void FileWatcherInotify::activateWatchLocked( WatcherInotify* watch,
+											  DirectorySnapshot* snapshot ) {
+	watch->Snapshot = snapshot;
+
+	mActiveWatches.push_front( watch );
+	watch->ActiveEntry = mActiveWatches.begin();
+
+	while ( mActiveWatches.size() > ACTIVE_SNAPSHOTS_MAX ) {
+		deactivateWatchLocked( mActiveWatches.back() );
+	}
+}
+
+void FileWatcherInotify::deactivateWatchLocked( WatcherInotify* watch ) {
+	mActiveWatches.erase( watch->ActiveEntry );
+	watch->ActiveEntry = mActiveWatches.end();
+
+	/// The snapshot was in sync with the directory, so is its current modification time
+	watch->DirModificationTime = directoryModificationTime( watch->path( mPathGeneration ) );
+
+	efSAFE_DELETE( watch->Snapshot );
+}
+
+void FileWatcherInotify::resync() {
+	efDEBUG( "Event queue overflow, resyncing the watches\n" );
+
+	/// The snapshots are diffed against the directories, they must cover the events handled
+	syncActivity();
+
+	/// The moves pending to be paired won't be completed, their pairs could have been lost
+	expireMoves( true );
+
+	std::vector<Watcher*> roots = mWatchRegistry.watches();
+
+	{
+		Lock initLock( mInitLock );
+
+		for ( size_t i = 0; i < roots.size(); i++ ) {
+			if ( NULL != roots[i]->Listener ) {
+				mBatch.add( roots[i]->Listener, roots[i]->ID, roots[i]->Directory, "",
+							Actions::Overflow );
+			}
+		}
+
+		mBatch.flush();
+	}
+
+	/// Parents are resynced before their children, so a directory deleted or moved is handled
+	/// once from its parent. The watchers are only deleted by the event loop, running this.
+	std::vector<WatcherInotify*> tree;
+
+	{
+		Lock lock( mWatchesLock );
+
+		for ( size_t i = 0; i < roots.size(); i++ ) {
+			WatcherInotify* root = static_cast<WatcherInotify*>( roots[i] );
+
+			if ( attached( root ) ) {
+				tree.push_back( root );
+			}
+		}
+
+		for ( size_t i = 0; i < tree.size(); i++ ) {
+			for ( WatcherInotify::ChildList::iterator cit = tree[i]->Children.begin();
+				  cit != tree[i]->Children.end(); ++cit ) {
+				tree.push_back( cit->second );
+			}
+		}
+	}
+
+	for ( size_t i = 0; i < tree.size() && mInitOK; i++ ) {
+		bool watched;
+
+		{
+			Lock lock( mWatchesLock );
+			watched = attached( tree[i] );
+		}
+
+		if ( watched ) {
+			resyncWatch( tree[i] );
+		}
+	}
+}
+
+void FileWatcherInotify::resyncWatch( WatcherInotify* watch ) {
+	std::string dir;
+	std::string name;
+	WatcherInotify* parent;
+
+	{
+		Lock lock( mWatchesLock );
+		dir = watch->path( mPathGeneration );
+		name = watch->Name;
+		parent = watch->Parent;
+	}
+
+	Uint64 modificationTime = directoryModificationTime( dir );
+
+	if ( 0 == modificationTime ) {
+		/// The directory is gone, the parent reports it and removes the subtree
+		if ( NULL != parent ) {
+			handleAction( parent, name, IN_DELETE );
+		}
+
+		return;
+	}
+
+	if ( NULL != watch->Snapshot ) {
+		/// An active directory: diff it against its snapshot. The deletions are always checked,
+		/// the directory could have changed again within the same second.
+		DirectorySnapshot* snapshot = watch->Snapshot;
+		snapshot->DirectoryInfo.Filepath = dir;
+		snapshot->DirectoryInfo.ModificationTime = 0;
+
+		DirectorySnapshotDiff& Diff = snapshot->scan();
+		FileInfoList::iterator it;
+		MovedList::iterator mit;
+
+		DiffIterator( FilesDeleted ) {
+			handleAction( watch, FileSystem::fileNameFromPath( it->Filepath ), IN_DELETE );
+		}
+
+		DiffIterator( DirsDeleted ) {
+			handleAction( watch, FileSystem::fileNameFromPath( it->Filepath ), IN_DELETE );
+		}
+
+		DiffMovedIterator( FilesMoved ) {
+			watch->OldFileName = mit->first;
+			handleAction( watch, FileSystem::fileNameFromPath( mit->second.Filepath ), IN_MOVED_TO );
+		}
+
+		DiffMovedIterator( DirsMoved ) {
+			watch->OldFileName = mit->first;
+			handleAction( watch, FileSystem::fileNameFromPath( mit->second.Filepath ), IN_MOVED_TO );
+		}
+
+		DiffIterator( FilesCreated ) {
+			handleAction( watch, FileSystem::fileNameFromPath( it->Filepath ), IN_CREATE );
+		}
+
+		DiffIterator( DirsCreated ) {
+			handleAction( watch, FileSystem::fileNameFromPath( it->Filepath ), IN_CREATE );
+		}
+
+		/// The kind of write lost is unknown, it's reported to any content interest
+		DiffIterator( FilesModified ) {
+			handleAction( watch, FileSystem::fileNameFromPath( it->Filepath ),
+						  IN_CLOSE_WRITE | IN_MODIFY );
+		}
+
+		watch->DirModificationTime = modificationTime;
+		return;
+	}
+
+	/// Nothing was created, deleted or renamed in an inactive directory that kept its
+	/// modification time, only those are listed again
+	if ( modificationTime == watch->DirModificationTime )
+		return;
+
+	DirectorySnapshot* snapshot = new DirectorySnapshot( dir );
+
+	for ( FileInfoMap::iterator it = snapshot->Files.begin(); it != snapshot->Files.end(); ++it ) {
+		const FileStat& fi = it->second;
+		std::string name( it->first );
+
+		if ( fi.isDirectory() && watch->Recursive ) {
+			bool watched;
+
+			{
+				Lock lock( mWatchesLock );
+				watched = NULL != watch->findChild( name );
+			}
+
+			/// The subdirectories not watched yet are new
+			if ( !watched ) {
+				handleAction( watch, name, IN_CREATE );
+			}
+		} else if ( modifiedAfter( *snapshot, *it, watch->DirModificationTime ) ) {
+			/// Without the previous listing a new file can't be told apart from a modified one,
+			/// it's reported as a file moved in ( added and modified )
+			handleAction( watch, name, IN_MOVED_TO );
+		}
+	}
+
+	Lock lock( mWatchesLock );
+
+	watch->DirModificationTime = modificationTime;
+
+	/// The directory is known from now on
+	if ( attached( watch ) && NULL == watch->Snapshot ) {
+		activateWatchLocked( watch, snapshot );
+	} else {
+		efSAFE_DELETE( snapshot );
+	}
+}
+
+void FileWatcherInotify::checkForNewWatcher( WatcherInotify* watch, const std::string& dir,
+											 std::string_view filename, bool created ) {
+	if ( !watch->Recursive )
+		return;
+
+	std::string path( dir );
+	path.append( filename.data(), filename.size() );
+
+	/// An excluded name is never watched, whatever it is
+	if ( watch->prunes( path ) )
+		return;
+
+	/// If the watcher is recursive, checks if the new file is a folder, and creates a watcher
+	if ( FileSystem::isDirectory( path ) ) {
+		bool found = false;
+
+		std::string name( filename );
+
+		{
 			Lock lock( mWatchesLock );
 
-			for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-				if ( it->second->Directory == opath ) {
-					it->second->Directory = fpath;
-					it->second->DirInfo = FileInfo( fpath );
-				} else if ( -1 != String::strStartsWith( opath, it->second->Directory ) ) {
-					it->second->Directory = fpath + it->second->Directory.substr( opath.size() );
-					it->second->DirInfo.Filepath = it->second->Directory;
-				}
+			/// First check if exists
+			found = NULL != watch->findChild( name ) ||
+					watch->ColdChildren.find( name ) != watch->ColdChildren.end();
+		}
+
+		if ( found ) {
+			return;
+		} else if ( reserveWatches( watch, 1 ) ) {
+			WatchSettings settings;
+			settings.Interests = watch->EventInterests;
+			settings.Budget = 0;
+			settings.PollMinInterval = 0;
+			settings.PollMaxInterval = 0;
+			settings.MoveWindow = watch->MoveWindow;
+			settings.Options = NULL;
+
+			WatchID id =
+				addWatch( path, watch->Listener, watch->Recursive, settings, watch, false );
+
+			if ( Errors::FileNotReadable == id || Errors::Unspecified == id ) {
+				watch->reportError( (Error)id, path );
+			} else if ( id > 0 && watch->Recursive ) {
+				queueCrawl( watch->ID, (int)id, created );
 			}
+		} else {
+			/// No subtree can be evicted to make room, the new directory is polled itself
+			addColdChild( watch, name );
 		}
+	}
+}
 
-		watch->OldFileName = "";
-	} else if ( IN_CREATE & action ) {
-		watch->Listener->handleFileAction( watch->ID, watch->Directory, filename, Actions::Add );
+void FileWatcherInotify::handleMoveBetween( WatcherInotify* from, const std::string& oldName,
+											WatcherInotify* to, std::string_view name ) {
+	ColdChild* cold = NULL;
 
-		checkForNewWatcher( watch, fpath );
-	} else if ( IN_MOVED_FROM & action ) {
-		watch->OldFileName = filename;
-	} else if ( IN_DELETE & action ) {
-		watch->Listener->handleFileAction( watch->ID, watch->Directory, filename, Actions::Delete );
+	{
+		Lock lock( mWatchesLock );
 
-		FileSystem::dirAddSlashAtEnd( fpath );
+		WatcherInotify* moved = from->Recursive ? from->findChild( oldName ) : NULL;
 
-		/// If the file erased is a directory and recursive is enabled, removes the directory erased
-		if ( watch->Recursive ) {
-			Lock l( mWatchesLock );
+		if ( NULL != moved && to->Recursive && from->root() == to->root() &&
+			 NULL == to->findChild( std::string( name ) ) ) {
+			/// The subtree keeps its watches, only its paths change
+			moved->setParent( to, std::string( name ) );
+			mPathGeneration++;
+		} else if ( !from->ColdChildren.empty() ) {
+			cold = takeColdChildLocked( from, oldName );
+		}
+	}
 
-			for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-				if ( it->second->Directory == fpath ) {
-					removeWatchLocked( it->second->InotifyID );
-					break;
+	/// A cold directory moved is active again, it's watched from its new parent
+	efSAFE_DELETE( cold );
+
+	/// The deletion only removes the watches of a directory that left the tree, while the
+	/// addition finds the re-parented directory already watched
+	handleEvent( from, oldName, IN_DELETE );
+	handleEvent( to, name, IN_MOVED_TO );
+}
+
+bool FileWatcherInotify::reserveWatches( WatcherInotify* keep, size_t count ) {
+	while ( true ) {
+		WatcherInotify* evicted;
+
+		{
+			Lock lock( mWatchesLock );
+
+			if ( !attached( keep ) )
+				return false;
+
+			WatcherInotify* root = keep->root();
+
+			if ( 0 == root->WatchBudget || root->KernelWatches + count <= root->WatchBudget )
+				return true;
+
+			evicted = findEvictionCandidateLocked( root, keep );
+
+			if ( NULL == evicted )
+				return root->KernelWatches < root->WatchBudget;
+		}
+
+		/// Every eviction releases at least a kernel watch
+		evictWatch( evicted );
+	}
+}
+
+void FileWatcherInotify::touchWatchLocked( WatcherInotify* watch ) {
+	/// Already touched last, or below the one touched last
+	if ( watch->LastActivity == mActivityClock )
+		return;
+
+	WatcherInotify* root = watch->root();
+
+	/// The order is only read to evict, within a budget
+	if ( 0 == root->WatchBudget )
+		return;
+
+	Uint64 activity = ++mActivityClock;
+
+	/// From the directory up, so the parents end up ahead of it
+	for ( WatcherInotify* cur = watch; cur != root; cur = cur->Parent ) {
+		cur->LastActivity = activity;
+		root->Recent.splice( root->Recent.begin(), root->Recent, cur->RecentEntry );
+	}
+
+	root->LastActivity = activity;
+}
+
+WatcherInotify* FileWatcherInotify::findEvictionCandidateLocked( WatcherInotify* root,
+																 WatcherInotify* keep ) {
+	for ( std::list<WatcherInotify*>::reverse_iterator it = root->Recent.rbegin();
+		  it != root->Recent.rend(); ++it ) {
+		WatcherInotify* candidate = *it;
+
+		/// The directories containing the one that needs the watch are kept
+		if ( candidate == keep || keep->inParentTree( candidate ) )
+			continue;
+
+		while ( candidate->Parent != root &&
+				candidate->Parent->LastActivity == candidate->LastActivity &&
+				candidate->Parent != keep && !keep->inParentTree( candidate->Parent ) ) {
+			candidate = candidate->Parent;
+		}
+
+		return candidate;
+	}
+
+	return NULL;
+}
+
+void FileWatcherInotify::evictWatch( WatcherInotify* watch ) {
+	std::vector<WatcherInotify*> detached;
+	WatcherInotify* parent;
+	std::string name;
+
+	{
+		Lock lock( mWatchesLock );
+
+		parent = watch->Parent;
+		name = watch->Name;
+	}
+
+	/// Snapshotted while the kernel watches still report the changes, so none falls in between
+	ColdChild* cold = createColdChild( parent, name );
+
+	{
+		Lock lock( mWatchesLock );
+
+		/// Removed or renamed meanwhile
+		if ( !attached( watch ) || watch->Parent != parent || watch->Name != name ) {
+			efSAFE_DELETE( cold );
+			return;
+		}
+
+		detachWatchLocked( watch, detached );
+	}
+
+	efDEBUG( "Evicted watch %s, %d kernel watches released\n", name.c_str(),
+			 (int)detached.size() );
+
+	releaseWatches( detached, true );
+
+	insertColdChild( parent, name, cold );
+}
+
+void FileWatcherInotify::addColdChild( WatcherInotify* watch, const std::string& name ) {
+	insertColdChild( watch, name, createColdChild( watch, name ) );
+}
+
+ColdChild* FileWatcherInotify::createColdChild( WatcherInotify* watch, const std::string& name ) {
+	std::string path;
+	long minInterval;
+	long maxInterval;
+
+	{
+		Lock lock( mWatchesLock );
+
+		if ( !attached( watch ) || watch->ColdChildren.find( name ) != watch->ColdChildren.end() )
+			return NULL;
+
+		path = watch->path( mPathGeneration ) + name;
+		minInterval = watch->root()->PollMinInterval;
+		maxInterval = watch->root()->PollMaxInterval;
+	}
+
+	FileSystem::dirAddSlashAtEnd( path );
+
+	if ( !FileSystem::isRemoteFS( path ) )
+		return new ColdChild( watch, path, NULL );
+
+	/// The watcher forwards the changes found by the poller
+	WatcherGeneric* poller = new WatcherGeneric( watch->ID, path, watch, this, watch->Recursive );
+	poller->EventInterests = watch->EventInterests;
+	poller->Filter = watch->Filter;
+	poller->Counters = watch->Counters;
+	poller->MinInterval = minInterval;
+	poller->MaxInterval = maxInterval;
+	poller->init();
+
+	return new ColdChild( watch, path, poller );
+}
+
+void FileWatcherInotify::insertColdChild( WatcherInotify* watch, const std::string& name,
+										  ColdChild* cold ) {
+	if ( NULL == cold )
+		return;
+
+	bool wakeup;
+
+	{
+		Lock lock( mWatchesLock );
+
+		if ( !attached( watch ) ||
+			 !watch->ColdChildren.insert( std::make_pair( name, cold ) ).second ) {
+			efSAFE_DELETE( cold );
+			return;
+		}
+
+		efDEBUG( "Polling %s\n", cold->path().c_str() );
+
+		wakeup = 0 == mColdWatches++;
+	}
+
+	/// The event loop only wakes up to poll while there are cold directories
+	if ( wakeup && NULL != mThread ) {
+		postControlMessage( Wakeup );
+	}
+}
+
+ColdChild* FileWatcherInotify::takeColdChildLocked( WatcherInotify* watch,
+													const std::string& name ) {
+	WatcherInotify::ColdChildList::iterator it = watch->ColdChildren.find( name );
+
+	if ( it == watch->ColdChildren.end() )
+		return NULL;
+
+	ColdChild* cold = it->second;
+
+	watch->ColdChildren.erase( it );
+	mColdWatches--;
+
+	return cold;
+}
+
+void FileWatcherInotify::pollColdWatches() {
+	Lock initLock( mInitLock );
+
+	std::vector<WatcherInotify*> watches;
+
+	{
+		Lock lock( mWatchesLock );
+
+		for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+			for ( WatcherInotify* watch = it->second; NULL != watch;
+				  watch = watch->Shared.load( std::memory_order_relaxed ) ) {
+				if ( !watch->ColdChildren.empty() ) {
+					watches.push_back( watch );
 				}
 			}
 		}
 	}
-	mIsTakingAction = false;
+
+	/// The cold children are only added or removed holding mInitLock, so they can be iterated
+	/// while they report their changes. A watcher is only deleted from this thread.
+	std::vector<std::pair<WatcherInotify*, std::string>> promoted;
+
+	for ( size_t i = 0; i < watches.size() && mInitOK; i++ ) {
+		WatcherInotify* watch = watches[i];
+		std::vector<std::string> moved;
+		std::string dir;
+
+		{
+			Lock lock( mWatchesLock );
+
+			if ( !attached( watch ) )
+				continue;
+
+			dir = watch->path( mPathGeneration );
+		}
+
+		for ( WatcherInotify::ColdChildList::iterator it = watch->ColdChildren.begin();
+			  it != watch->ColdChildren.end(); ++it ) {
+			const std::string& path = it->second->path();
+
+			/// An ancestor was renamed, the cold child is recreated at the new path
+			if ( path.size() != dir.size() + it->first.size() + 1 ||
+				 path.compare( 0, dir.size(), dir ) != 0 ||
+				 path.compare( dir.size(), it->first.size(), it->first ) != 0 ) {
+				moved.push_back( it->first );
+				continue;
+			}
+
+			/// The remote subtrees stay polled
+			if ( it->second->poll( mBatch ) ) {
+				promoted.push_back( std::make_pair( watch, it->first ) );
+			}
+		}
+
+		for ( size_t m = 0; m < moved.size(); m++ ) {
+			ColdChild* cold;
+
+			{
+				Lock lock( mWatchesLock );
+				cold = takeColdChildLocked( watch, moved[m] );
+			}
+
+			efSAFE_DELETE( cold );
+
+			addColdChild( watch, moved[m] );
+		}
+	}
+
+	/// The changes found are reported before the directories are watched again
+	mBatch.flush();
+
+	/// A change was seen, the directory gets its kernel watches back
+	for ( size_t i = 0; i < promoted.size() && mInitOK; i++ ) {
+		WatcherInotify* watch = promoted[i].first;
+		ColdChild* cold = NULL;
+		std::string dir;
+
+		{
+			Lock lock( mWatchesLock );
+
+			if ( !attached( watch ) )
+				continue;
+
+			cold = takeColdChildLocked( watch, promoted[i].second );
+			dir = watch->path( mPathGeneration );
+		}
+
+		if ( NULL == cold )
+			continue;
+
+		efSAFE_DELETE( cold );
+
+		checkForNewWatcher( watch, dir, promoted[i].second );
+	}
 }
 
-std::vector<std::string> FileWatcherInotify::directories() {
-	std::vector<std::string> dirs;
+void FileWatcherInotify::handleAction( Watcher* watcher, const std::string& filename,
+									   unsigned long action, std::string ) {
+	if ( !watcher || !mInitOK ) {
+		return;
+	}
+
+	Lock initLock( mInitLock );
+
+	handleEvent( static_cast<WatcherInotify*>( watcher ), filename, action );
+
+	mBatch.flush();
+}
+
+void FileWatcherInotify::handleEvent( WatcherInotify* watch, std::string_view filename,
+									  Uint32 action ) {
+	if ( !watch->Listener || !mInitOK ) {
+		return;
+	}
+
+	std::string& dir = mEventDirectory;
+
+	/// A watcher removed meanwhile must not reach its listener, removeWatch waits for the
+	/// mInitLock so no event is delivered after it returns
+	if ( !attached( watch ) )
+		return;
+
+	WatchCounters::add( watch->Counters->Received );
+
+	/// Assigned to keep the capacity of the buffer. The path generation only changes from the
+	/// event loop, so an up to date path can be read without locking.
+	if ( watch->PathGeneration == mPathGeneration ) {
+		dir.assign( watch->Directory );
+	} else {
+		Lock lock( mWatchesLock );
+		dir.assign( watch->path( mPathGeneration ) );
+	}
+
+	if ( action & ( IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB ) ) {
+		int interests = 0;
+
+		if ( action & IN_CLOSE_WRITE )
+			interests |= Interests::ContentClosed;
+
+		if ( action & IN_MODIFY )
+			interests |= Interests::ContentModified;
+
+		if ( action & IN_ATTRIB )
+			interests |= Interests::Attributes;
+
+		/// The attributes of the watched directory itself are reported without name
+		if ( !filename.empty() && watch->acceptsInterests( interests ) &&
+			 watch->matches( dir, filename ) ) {
+			mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Modified );
+		}
+	} else if ( IN_MOVED_TO & action ) {
+		/// If OldFileName doesn't exist means that the file has been moved from other folder, so we
+		/// just send the Add event
+		if ( watch->OldFileName.empty() ) {
+			bool matches = watch->matches( dir, filename );
+
+			if ( matches && watch->accepts( Actions::Add ) ) {
+				mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Add );
+			}
+
+			if ( matches && watch->accepts( Actions::Modified ) ) {
+				mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Modified );
+			}
+
+			checkForNewWatcher( watch, dir, filename );
+		} else {
+			if ( watch->accepts( Actions::Moved ) &&
+				 watch->matches( dir, filename, watch->OldFileName ) ) {
+				mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Moved,
+							watch->OldFileName );
+			}
+
+			/// Re-parent the renamed directory, the paths of its subtree are rebuilt lazily
+			if ( watch->Recursive ) {
+				ColdChild* cold = NULL;
+
+				{
+					Lock lock( mWatchesLock );
+
+					if ( WatcherInotify* moved = watch->findChild( watch->OldFileName ) ) {
+						moved->setParent( watch, std::string( filename ) );
+						mPathGeneration++;
+					} else if ( !watch->ColdChildren.empty() ) {
+						cold = takeColdChildLocked( watch, watch->OldFileName );
+					}
+				}
+
+				/// A renamed cold directory is active again
+				if ( NULL != cold ) {
+					efSAFE_DELETE( cold );
+
+					checkForNewWatcher( watch, dir, filename );
+				}
+			}
+		}
+
+		watch->OldFileName.clear();
+	} else if ( IN_CREATE & action ) {
+		if ( watch->accepts( Actions::Add ) && watch->matches( dir, filename ) ) {
+			mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Add );
+		}
+
+		checkForNewWatcher( watch, dir, filename, true );
+	} else if ( IN_MOVED_FROM & action ) {
+		watch->OldFileName.assign( filename.data(), filename.size() );
+	} else if ( IN_DELETE & action ) {
+		if ( watch->accepts( Actions::Delete ) && watch->matches( dir, filename ) ) {
+			mBatch.add( watch->Listener, watch->ID, dir, filename, Actions::Delete );
+		}
 
-	Lock l( mRealWatchesLock );
+		/// If the file erased is a directory and recursive is enabled, removes the directory erased
+		if ( watch->Recursive ) {
+			ColdChild* cold = NULL;
+
+			{
+				Lock l( mWatchesLock );
+
+				/// The watches sharing the directory remove theirs from their own events
+				if ( WatcherInotify* erased = watch->findChild( std::string( filename ) ) ) {
+					std::vector<WatcherInotify*> detached;
+					detachWatchLocked( erased, detached );
+					releaseWatches( detached, false );
+				} else if ( !watch->ColdChildren.empty() ) {
+					cold = takeColdChildLocked( watch, std::string( filename ) );
+				}
+			}
 
-	dirs.reserve( mRealWatches.size() );
+			/// A last poll reports the deletion of the contents of a cold directory, after the
+			/// events queued before it
+			if ( NULL != cold ) {
+				mBatch.flush();
 
-	WatchMap::iterator it = mRealWatches.begin();
+				cold->poll( mBatch );
 
-	for ( ; it != mRealWatches.end(); ++it )
-		dirs.push_back( it->second->Directory );
+				efSAFE_DELETE( cold );
+			}
+		}
+	}
+}
 
-	return dirs;
+std::vector<std::string> FileWatcherInotify::directories() {
+	return mWatchRegistry.directories();
 }
 
 bool FileWatcherInotify::pathInWatches( const std::string& path ) {
-	Lock l( mRealWatchesLock );
-
 	/// Search in the real watches, since it must allow adding a watch already watched as a subdir
-	WatchMap::iterator it = mRealWatches.begin();
+	return NULL != mWatchRegistry.find( path );
+}
 
-	for ( ; it != mRealWatches.end(); ++it )
-		if ( it->second->Directory == path )
-			return true;
+FileWatcherImpl* FileWatcherInotify::shard( unsigned int shards ) {
+	return new FileWatcherInotifyShards( mFileWatcher, shards );
+}
 
-	return false;
+size_t FileWatcherInotify::kernelWatches() {
+	Lock lock( mWatchesLock );
+
+	return mWatches.size();
 }
 
 } // namespace efsw
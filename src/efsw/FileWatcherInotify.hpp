@@ -1,17 +1,24 @@
 #ifndef EFSW_FILEWATCHERLINUX_HPP
 #define EFSW_FILEWATCHERLINUX_HPP
 
+#include <efsw/EventBatch.hpp>
 #include <efsw/FileWatcherImpl.hpp>
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY
 
+#include <efsw/WatchTable.hpp>
 #include <efsw/WatcherInotify.hpp>
+#include <atomic>
+#include <list>
 #include <map>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace efsw {
 
+class FileWatcherInotifyShards;
+
 /// Implementation for Linux based on inotify.
 /// @class FileWatcherInotify
 class FileWatcherInotify : public FileWatcherImpl {
@@ -19,8 +26,26 @@ class FileWatcherInotify : public FileWatcherImpl {
 	/// type for a map from WatchID to WatchStruct pointer
 	typedef std::map<WatchID, WatcherInotify*> WatchMap;
 
+	/// Messages posted to the event loop through the control eventfd
+	enum ControlMessage {
+		Shutdown,
+		/// Recomputes the wait timeout after the first cold directory is polled
+		Wakeup,
+		/// Crawls the directories queued by expandWatch
+		Expand,
+		/// Crawls the subtrees of the directories the events added
+		CrawlAdded,
+		/// Expires the pending moves whose IN_MOVED_TO another shard read
+		Claimed
+	};
+
 	FileWatcherInotify( FileWatcher* parent );
 
+	/// A shard of the watches of a FileWatcherInotifyShards, the watch ids of its roots being
+	/// wd * shards + shard so they're unique among the shards
+	FileWatcherInotify( FileWatcher* parent, FileWatcherInotifyShards* group, unsigned int shard,
+						unsigned int shards );
+
 	virtual ~FileWatcherInotify();
 
 	/// Add a directory watch
@@ -28,7 +53,12 @@ class FileWatcherInotify : public FileWatcherImpl {
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 					  const std::vector<WatcherOption>& options ) override;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Adds the kernel watch of the directory, then crawls the subdirectories of a recursive
+	/// watch from a thread of its own, without blocking the event loop
+	WatchID addWatchAsync( const std::string& directory, FileWatchListener* watcher,
+						   bool recursive, const std::vector<WatcherOption>& options ) override;
+
+	/// Remove a directory watch. This is a hash lookup O(1).
 	void removeWatch( const std::string& directory ) override;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -44,39 +74,405 @@ class FileWatcherInotify : public FileWatcherImpl {
 	/// @return Returns a list of the directories that are being watched
 	std::vector<std::string> directories() override;
 
+	/// @return The epoll descriptor of the event loop
+	PollHandle pollHandle() override;
+
+	/// Runs an iteration of the event loop without blocking, when watch() wasn't called
+	void poll() override;
+
+	/// Changes the scope, then has the event loop watch the subdirectories brought in it
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	/// Changes the scope and removes the watches of the subdirectories of the directory
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
+	/// @return A FileWatcherInotifyShards spreading the watches over that many instances
+	FileWatcherImpl* shard( unsigned int shards ) override;
+
+	/// @return The kernel watches held
+	size_t kernelWatches();
+
   protected:
+	friend class FileWatcherInotifyShards;
+
+	/// The shards this one belongs to, NULL if it isn't one
+	FileWatcherInotifyShards* mGroup;
+	unsigned int mShard;
+	unsigned int mShards;
 	/// Map of WatchID to WatchStruct pointers
 	WatchMap mWatches;
 
-	/// User added watches
-	WatchMap mRealWatches;
-
-	std::unordered_map<std::string, WatchID> mWatchesRef;
+	/// The watches map indexed for the event loop, which resolves the watch descriptors of the
+	/// events without locking ( written holding mWatchesLock )
+	WatchTable<WatcherInotify> mWatchTable;
 
 	/// inotify file descriptor
 	int mFD;
 
+	/// epoll instance multiplexing the inotify, control and timer descriptors
+	int mEpollFD;
+
+	/// eventfd used to wake up the event loop when a control message is posted
+	int mControlFD;
+
+	/// timerfd used to expire unpaired IN_MOVED_FROM events ( and to poll the cold directories
+	/// when there is no event loop thread )
+	int mTimerFD;
+
 	Thread* mThread;
 
+	/// Read buffer of poll(), allocated on its first call
+	char* mPollBuffer;
+
 	Mutex mWatchesLock;
-	Mutex mRealWatchesLock;
 	Mutex mInitLock;
-	bool mIsTakingAction;
+	Mutex mControlLock;
+	std::vector<ControlMessage> mControlMessages;
+	/// The watches and the full paths of the directories expanded, crawled by the event loop
+	/// ( guarded by mControlLock )
+	std::vector<std::pair<WatchID, std::string>> mExpansions;
+	/// A directory the events added, its subtree is crawled by the event loop once the events
+	/// are handled
+	struct PendingCrawl {
+		WatchID ID;
+		int InotifyID;
+		/// Created in the tree: the entries made before it was watched are reported added
+		bool Created;
+	};
+
+	/// The crawls queued ( guarded by mControlLock )
+	std::vector<PendingCrawl> mPendingCrawls;
 	std::vector<std::pair<WatcherInotify*, std::string>> mMovedOutsideWatches;
 
+	/// Watchers removed from outside the event loop, pending to be deleted by it
+	std::vector<WatcherInotify*> mRemovedWatches;
+
+	/// An IN_MOVED_FROM waiting for its IN_MOVED_TO
+	struct PendingMove {
+		WatcherInotify* Watch;
+		std::string Name;
+		/// Monotonic time in milliseconds when it's considered moved outside the watches
+		Uint64 Deadline;
+		/// When the IN_MOVED_FROM was read, see Event::captured
+		Uint64 Captured;
+	};
+
+	typedef std::unordered_multimap<Uint32, PendingMove> PendingMoveMap;
+
+	/// The moves waiting to be paired indexed by their cookie, one per watcher of the descriptor
+	/// ( guarded by mWatchesLock )
+	PendingMoveMap mPendingMoves;
+
+	/// The size of mPendingMoves, set holding mWatchesLock and read without it by the events
+	/// dispatched: only those add moves, so none is pending when it's 0
+	std::atomic<size_t> mPendingMoveCount;
+
+	/// Incremented on every directory rename, invalidating the cached paths of the watchers
+	/// ( guarded by mWatchesLock )
+	Uint64 mPathGeneration;
+
+	/// Watchers with a directory snapshot, most recently active first ( guarded by mWatchesLock )
+	std::list<WatcherInotify*> mActiveWatches;
+
+	/// Incremented on every activity, orders the directories by their last one ( guarded by
+	/// mWatchesLock )
+	Uint64 mActivityClock;
+
+	/// Number of cold directories polled out of the watch budget ( guarded by mWatchesLock )
+	size_t mColdWatches;
+
+	/// Monotonic time of the next poll tick in milliseconds, when the snapshots of the active
+	/// directories are synced and the cold directories polled ( event loop only )
+	Uint64 mNextColdPoll;
+
+	/// Inotify watch descriptors of the directories with activity to sync on the next poll tick
+	/// ( guarded by mWatchesLock )
+	std::vector<int> mSyncPending;
+
+	/// Directory of the event being delivered, reused to not allocate on every event ( guarded
+	/// by mInitLock )
+	std::string mEventDirectory;
+
+	/// Events queued for delivery, flushed once per read buffer ( guarded by mInitLock )
+	EventBatch mBatch;
+
+	/// The crawl of a watch added by addWatchAsync
+	struct Crawl {
+		/// The watch descriptor of the root
+		WatchID ID;
+		Thread* Runner;
+		std::thread::id RunnerID;
+		std::atomic<bool> Cancelled;
+		/// The kernel dropped the root meanwhile, it's removed once the crawl is done ( guarded
+		/// by mCrawlsLock, as Done )
+		bool Remove;
+		bool Done;
+		/// The directories watched and the ones that couldn't be
+		size_t Directories;
+		size_t Failures;
+	};
+
+	std::vector<Crawl*> mCrawls;
+
+	/// The crawls running
+	std::atomic<size_t> mCrawling;
+
+	Mutex mCrawlsLock;
+
+	/// An event of a directory watched by a crawl that didn't create its watcher yet
+	struct StashedEvent {
+		int WD;
+		std::string Name;
+		Uint32 Mask;
+		Uint32 Cookie;
+		Uint64 Captured;
+	};
+
+	/// The events kept for the crawls running, replayed once they're done ( guarded by
+	/// mInitLock )
+	std::vector<StashedEvent> mStash;
+
+	/// Events weren't kept over the limit, the watches are resynced instead ( guarded by
+	/// mInitLock )
+	bool mStashOverflowed;
+
+	/// The options of a new watch, the children inherit them from its parent
+	struct WatchSettings {
+		int Interests;
+		/// Watch budget of the tree, only used for the root watches
+		size_t Budget;
+		/// Bounds of the poll interval of the subtrees polled, only used for the root watches
+		long PollMinInterval;
+		long PollMaxInterval;
+		long MoveWindow;
+		/// The options of a new root watch, to compile its patterns ( NULL for the subdirectories,
+		/// they share the patterns of their parent )
+		const std::vector<WatcherOption>* Options;
+	};
+
+	/// @param crawl False to leave the subdirectories of a recursive watch to the caller
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
-					  WatcherInotify* parent = NULL );
+					  const WatchSettings& settings, WatcherInotify* parent = NULL,
+					  bool crawl = true );
+
+	WatchSettings watchSettings( const std::vector<WatcherOption>& options );
 
 	bool pathInWatches( const std::string& path ) override;
 
   private:
+	void init();
+
 	void run();
 
+	/// @return The watch id of the root of the watch descriptor
+	WatchID rootID( int wd ) const { return wd * (WatchID)mShards + (WatchID)mShard; }
+
+	/// @return The watch descriptor of the root of the watch id, -1 if it's from another shard
+	int rootDescriptor( WatchID watchid ) const {
+		return watchid > 0 && (WatchID)mShard == watchid % (WatchID)mShards
+				   ? (int)( watchid / (WatchID)mShards )
+				   : -1;
+	}
+
+	/// Waits up to timeout milliseconds ( -1 for ever ) for the descriptors of the event loop and
+	/// handles what's ready
+	/// @return False if the event loop must stop
+	bool processEvents( char* buff, int timeout );
+
+	/// Queues a control message and wakes up the event loop
+	void postControlMessage( ControlMessage message );
+
+	/// Crawls the subtrees of the directories expanded, from the event loop
+	void expandWatches();
+
+	/// Queues the crawl of the subtree of a directory the events added, not to hold mInitLock
+	/// through it
+	/// @param created True if the directory was created, the entries found in its subtree are
+	/// reported added then
+	void queueCrawl( WatchID watchid, int wd, bool created );
+
+	/// Crawls the subtrees queued, from the event loop without holding mInitLock. A watch removed
+	/// meanwhile isn't deleted before the event loop gets back to it.
+	void crawlPending();
+
+	/// Drains the inotify descriptor and dispatches the events read
+	void readEvents( char* buff );
+
+	/// Handles an event read for the watcher, holding mInitLock
+	void dispatchEvent( WatcherInotify* watch, std::string_view name, Uint32 mask, Uint32 cookie,
+						Uint64 captured );
+
+	/// Keeps an event of a watch descriptor unknown while a crawl runs, holding mInitLock
+	void stashEvent( int wd, std::string_view name, Uint32 mask, Uint32 cookie,
+					 Uint64 captured );
+
+	/// Dispatches the events kept for the watchers created since, the ones of the tree of the
+	/// root only if deliver is set, and drops the ones no crawl running can claim
+	void replayStash( WatcherInotify* root, bool deliver );
+
+	/// Crawls the tree of a watch added by addWatchAsync, then reports it ready
+	void runCrawl( Crawl* crawl );
+
+	/// Cancels the crawl of the watch and waits for it, unless called from its thread
+	void stopCrawl( WatchID watchid );
+
+	/// Has the crawl of the watch running remove it once done
+	/// @return False if there's no such crawl
+	bool deferRemoval( WatchID watchid );
+
+	/// Deletes the crawls done
+	void reapCrawls();
+
+	static bool cancelled( const Crawl* crawl ) { return NULL != crawl && crawl->Cancelled; }
+
+	/// Arms ( or disarms when ms is 0 ) the timer
+	void armTimer( long ms );
+
+	/// @return Milliseconds until the first pending move expires, 0 if there are none
+	long nextMoveTimeout();
+
+	/// Treats the pending moves past their deadline ( or all of them ) as moved outside the
+	/// watches
+	void expireMoves( bool all );
+
+	/// Treats the pending moves of the name in the watch as moved outside the watches right away,
+	/// but the one of the cookie kept, and emits their events. Called before any later event of
+	/// the watch, so a name moved out and created again is deleted before it's added. The moves
+	/// of the other names wait for their pair or their deadline.
+	void flushMoves( WatcherInotify* watch, std::string_view name, Uint32 keep );
+
+	/// Sets mPendingMoveCount after mPendingMoves changed, holding mWatchesLock
+	void countMovesLocked();
+
+	/// Expires the pending move, holding mWatchesLock
+	PendingMoveMap::iterator expireMoveLocked( PendingMoveMap::iterator it );
+
+	/// Takes the pending move of the cookie the IN_MOVED_TO of the watcher completes: the one of
+	/// its own watch, else one of a watch not sharing the descriptor of the watcher, which gets
+	/// its own IN_MOVED_TO. Holding mWatchesLock.
+	/// @return False if there's none
+	bool takeMoveLocked( Uint32 cookie, WatcherInotify* watch, PendingMove& move );
+
+	/// Emits a move between two watched directories as a Delete / Add pair, keeping the watches
+	/// of a directory moved inside the same tree
+	void handleMoveBetween( WatcherInotify* from, const std::string& oldName, WatcherInotify* to,
+							std::string_view name );
+
+	/// Emits the events of the watches moved outside the watched directories, holding mInitLock
+	void processMovedOutside();
+
+	/// Records the activity of the directory of the event. The entries deleted are dropped from
+	/// its snapshot right away, the rest is left to syncActivity.
+	void trackActivity( WatcherInotify* watch, std::string_view name, Uint32 mask );
+
+	/// Brings the snapshots of the directories with activity up to date, snapshotting the ones
+	/// that weren't active and stat'ing the entries touched. Run on the poll tick and before a
+	/// resync, never per event. A directory is only listed once it becomes active on the tick,
+	/// until then an overflow misses its deletions as in an inactive directory.
+	void syncActivity();
+
+	/// Queues the event for the listener of the watch in the batch, holding mInitLock. It doesn't
+	/// allocate unless the event changes the watches tree.
+	void handleEvent( WatcherInotify* watch, std::string_view filename, Uint32 mask );
+
+	/// Sets the snapshot of the watcher and moves it to the front of the active directories,
+	/// evicting the least recently active ones over the limit
+	void activateWatchLocked( WatcherInotify* watch, DirectorySnapshot* snapshot );
+
+	/// Drops the snapshot of the watcher, remembering the directory state it was in sync with
+	void deactivateWatchLocked( WatcherInotify* watch );
+
+	/// Called after the event queue overflowed: notifies the listeners and emits the changes lost
+	/// by diffing the watched directories against their last known state
+	void resync();
+
+	/// Emits the changes of a single directory lost in an overflow
+	void resyncWatch( WatcherInotify* watch );
+
+	/// Crawls the directory tree of a recursive watch adding a watch for every subdirectory
+	/// @param crawl The crawl of addWatchAsync running it, to stop once cancelled and to count
+	/// the directories
+	/// @param errors Given, the directories that couldn't be watched are appended to it instead
+	/// of being reported
+	/// @param added Given, the watch and the watchers the crawl created are appended to it,
+	/// parents first
+	void addChildWatches( WatcherInotify* watch, Crawl* crawl = NULL,
+						  std::vector<std::pair<Error, std::string>>* errors = NULL,
+						  std::vector<WatcherInotify*>* added = NULL );
+
+	/// Reports added the entries of the directories of the watchers, found there by a crawl
+	/// rather than by their events. Called holding mInitLock.
+	void reportEntries( const std::vector<WatcherInotify*>& watchers );
+
+	/// Unlinks the watcher and its subtree from the watches maps, appending them to detached
+	void detachWatchLocked( WatcherInotify* watch, std::vector<WatcherInotify*>& detached );
+
+	/// Adds the watcher to the watches maps, after the watchers of other watches sharing its
+	/// descriptor. Holding mWatchesLock.
+	void attachWatchLocked( WatcherInotify* watch );
+
+	/// Takes the watcher out of the watches maps, the next watcher sharing its descriptor taking
+	/// its place. Holding mWatchesLock.
+	void unlinkWatchLocked( WatcherInotify* watch );
+
+	/// @return True if the watcher is in the watches maps, first on its descriptor or sharing it.
+	/// Holding mWatchesLock, or lock free from the event loop.
+	bool attached( WatcherInotify* watch ) const;
+
+	/// @return The watcher of the watch on the descriptor, NULL if none. Holding mWatchesLock, or
+	/// lock free from the event loop.
+	WatcherInotify* findShared( int wd, WatchID watchid ) const;
+
+	/// Removes the kernel watches of detached watchers and deletes them ( or defers the
+	/// deletion to the event loop ). The descriptors other watches still share are kept.
+	void releaseWatches( std::vector<WatcherInotify*>& watches, bool deferDelete );
+
+	/// Deletes the watchers removed from other threads
+	void deleteRemovedWatches();
+
 	void removeWatchLocked( WatchID watchid );
 
-	void checkForNewWatcher( Watcher* watch, std::string fpath );
+	/// @param created True if the entry was created, rather than moved in or polled before
+	void checkForNewWatcher( WatcherInotify* watch, const std::string& dir,
+							 std::string_view filename, bool created = false );
+
+	/// Makes room for count kernel watches in the tree of the watcher, evicting the least recently
+	/// active subtrees that don't contain it. Without a watch budget there's always room.
+	/// @return True if there's room for at least one kernel watch
+	bool reserveWatches( WatcherInotify* keep, size_t count );
+
+	/// Makes the directory and its parents the most recently active of their tree, if the tree
+	/// has a budget
+	void touchWatchLocked( WatcherInotify* watch );
+
+	/// Takes the least recently active directory of the tree from the back of its Recent list,
+	/// then its parents as little active, so a whole idle subtree goes at once
+	/// @return The least recently active subtree of the root that doesn't contain keep, or NULL
+	WatcherInotify* findEvictionCandidateLocked( WatcherInotify* root, WatcherInotify* keep );
+
+	/// Releases the kernel watches of the subtree, polling the directory instead. The subtree is
+	/// snapshotted before, while its kernel watches still report the changes.
+	void evictWatch( WatcherInotify* watch );
+
+	/// Polls a subdirectory of the watcher that has no kernel watch
+	void addColdChild( WatcherInotify* watch, const std::string& name );
+
+	/// Snapshots a subdirectory of the watcher to be polled
+	/// @return NULL if the watcher is gone or already polls it
+	ColdChild* createColdChild( WatcherInotify* watch, const std::string& name );
+
+	/// Polls the subdirectory snapshotted, deleting it if the watcher is gone meanwhile
+	void insertColdChild( WatcherInotify* watch, const std::string& name, ColdChild* cold );
+
+	/// Unlinks a cold subdirectory of the watcher and returns it, NULL if there's none
+	ColdChild* takeColdChildLocked( WatcherInotify* watch, const std::string& name );
+
+	/// Polls the cold directories, promoting the ones that changed back to kernel watches
+	void pollColdWatches();
 
-	Watcher* watcherContainsDirectory( std::string dir );
+	/// Finds the watcher of a directory walking down the tree from the root that contains it
+	/// @param watchid Given, only the tree of that watch is searched
+	WatcherInotify* findWatcherLocked( std::string dir, WatchID watchid = 0 );
 };
 
 } // namespace efsw
@@ -0,0 +1,282 @@
+#include <efsw/FileWatcherInotifyShards.hpp>
+
+#if EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY
+
+#include <efsw/Debug.hpp>
+#include <efsw/Lock.hpp>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Time a move or a claim is kept for the other shards, well past any move pairing window
+#define MOVE_CLAIM_TIMEOUT_MS 10000
+
+/// Number of moves or claims kept before the ones past their deadline are dropped
+#define MOVE_CLAIMS_PRUNE 4096
+
+namespace efsw {
+
+/// @return The monotonic time in milliseconds
+static Uint64 monotonicTime() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (Uint64)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000L;
+}
+
+FileWatcherInotifyShards::FileWatcherInotifyShards( FileWatcher* parent, unsigned int shards ) :
+	FileWatcherImpl( parent ), mEpollFD( -1 ), mClosing( false ) {
+	for ( unsigned int i = 0; i < shards; i++ ) {
+		mShards.push_back( new FileWatcherInotify( parent, this, i, shards ) );
+
+		if ( !mShards.back()->initOK() )
+			return;
+	}
+
+	mEpollFD = epoll_create1( EPOLL_CLOEXEC );
+
+	if ( mEpollFD < 0 ) {
+		efDEBUG( "Error: %s\n", strerror( errno ) );
+		return;
+	}
+
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		struct epoll_event ev;
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.u32 = (Uint32)i;
+
+		if ( epoll_ctl( mEpollFD, EPOLL_CTL_ADD, mShards[i]->pollHandle(), &ev ) < 0 ) {
+			efDEBUG( "Error: %s\n", strerror( errno ) );
+			return;
+		}
+	}
+
+	mInitOK = true;
+}
+
+FileWatcherInotifyShards::~FileWatcherInotifyShards() {
+	mInitOK = false;
+
+	/// A shard still running doesn't wake up the ones deleted
+	{
+		Lock lock( mMovesLock );
+		mClosing = true;
+		mMovesFrom.clear();
+		mClaims.clear();
+	}
+
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		efSAFE_DELETE( mShards[i] );
+	}
+
+	if ( mEpollFD != -1 ) {
+		close( mEpollFD );
+	}
+}
+
+FileWatcherInotify* FileWatcherInotifyShards::shardOf( WatchID watchid ) {
+	return watchid > 0 ? mShards[watchid % (WatchID)mShards.size()] : NULL;
+}
+
+FileWatcherInotify* FileWatcherInotifyShards::pick( const std::string& directory ) {
+	FileWatcherInotify* shard = NULL;
+	size_t least = 0;
+
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		if ( mShards[i]->pathInWatches( directory ) )
+			return NULL;
+
+		size_t watches = mShards[i]->kernelWatches();
+
+		if ( NULL == shard || watches < least ) {
+			shard = mShards[i];
+			least = watches;
+		}
+	}
+
+	return shard;
+}
+
+WatchID FileWatcherInotifyShards::addWatch( const std::string& directory,
+											FileWatchListener* watcher, bool recursive,
+											const std::vector<WatcherOption>& options ) {
+	Lock lock( mAddLock );
+
+	FileWatcherInotify* shard = pick( directory );
+
+	if ( NULL == shard )
+		return Errors::Log::createLastError( Errors::FileRepeated, directory );
+
+	return shard->addWatch( directory, watcher, recursive, options );
+}
+
+WatchID FileWatcherInotifyShards::addWatchAsync( const std::string& directory,
+												 FileWatchListener* watcher, bool recursive,
+												 const std::vector<WatcherOption>& options ) {
+	Lock lock( mAddLock );
+
+	FileWatcherInotify* shard = pick( directory );
+
+	if ( NULL == shard )
+		return Errors::Log::createLastError( Errors::FileRepeated, directory );
+
+	return shard->addWatchAsync( directory, watcher, recursive, options );
+}
+
+void FileWatcherInotifyShards::removeWatch( const std::string& directory ) {
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		mShards[i]->removeWatch( directory );
+	}
+}
+
+void FileWatcherInotifyShards::removeWatch( WatchID watchid ) {
+	if ( FileWatcherInotify* shard = shardOf( watchid ) ) {
+		shard->removeWatch( watchid );
+	}
+}
+
+void FileWatcherInotifyShards::watch() {
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		mShards[i]->watch();
+	}
+}
+
+void FileWatcherInotifyShards::handleAction( Watcher*, const std::string&, unsigned long,
+											 std::string ) {}
+
+std::vector<std::string> FileWatcherInotifyShards::directories() {
+	std::vector<std::string> dirs;
+
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		std::vector<std::string> shardDirs( mShards[i]->directories() );
+		dirs.insert( dirs.end(), shardDirs.begin(), shardDirs.end() );
+	}
+
+	return dirs;
+}
+
+bool FileWatcherInotifyShards::pathInWatches( const std::string& path ) {
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		if ( mShards[i]->pathInWatches( path ) )
+			return true;
+	}
+
+	return false;
+}
+
+PollHandle FileWatcherInotifyShards::pollHandle() {
+	return mEpollFD;
+}
+
+void FileWatcherInotifyShards::poll() {
+	for ( size_t i = 0; i < mShards.size(); i++ ) {
+		mShards[i]->poll();
+	}
+}
+
+std::shared_ptr<WatchCounters> FileWatcherInotifyShards::getCounters( WatchID watchid ) {
+	FileWatcherInotify* shard = shardOf( watchid );
+
+	return NULL != shard ? shard->getCounters( watchid ) : NULL;
+}
+
+bool FileWatcherInotifyShards::expandWatch( WatchID watchid, const std::string& directory ) {
+	FileWatcherInotify* shard = shardOf( watchid );
+
+	return NULL != shard && shard->expandWatch( watchid, directory );
+}
+
+bool FileWatcherInotifyShards::collapseWatch( WatchID watchid, const std::string& directory ) {
+	FileWatcherInotify* shard = shardOf( watchid );
+
+	return NULL != shard && shard->collapseWatch( watchid, directory );
+}
+
+bool FileWatcherInotifyShards::moveFrom( Uint32 cookie, FileWatcherInotify* shard ) {
+	Lock lock( mMovesLock );
+
+	if ( mClosing )
+		return false;
+
+	std::unordered_map<Uint32, Uint64>::iterator it = mClaims.find( cookie );
+
+	if ( it != mClaims.end() ) {
+		mClaims.erase( it );
+		return true;
+	}
+
+	Uint64 now = monotonicTime();
+	MoveFrom& move = mMovesFrom[cookie];
+	move.Shard = shard;
+	move.Deadline = now + MOVE_CLAIM_TIMEOUT_MS;
+
+	pruneLocked( now );
+
+	return false;
+}
+
+void FileWatcherInotifyShards::moveTo( Uint32 cookie, FileWatcherInotify* shard ) {
+	Lock lock( mMovesLock );
+
+	if ( mClosing )
+		return;
+
+	Uint64 now = monotonicTime();
+	std::unordered_map<Uint32, MoveFrom>::iterator it = mMovesFrom.find( cookie );
+
+	if ( it == mMovesFrom.end() ) {
+		/// The IN_MOVED_FROM can still be unread in the queue of another shard, or there's none
+		mClaims[cookie] = now + MOVE_CLAIM_TIMEOUT_MS;
+		pruneLocked( now );
+	} else if ( it->second.Shard != shard ) {
+		FileWatcherInotify* owner = it->second.Shard;
+		mMovesFrom.erase( it );
+		mClaims[cookie] = now + MOVE_CLAIM_TIMEOUT_MS;
+
+		/// Posted holding the lock, so the shard isn't deleted meanwhile
+		owner->postControlMessage( FileWatcherInotify::Claimed );
+	}
+}
+
+void FileWatcherInotifyShards::movePaired( Uint32 cookie ) {
+	Lock lock( mMovesLock );
+
+	mMovesFrom.erase( cookie );
+}
+
+bool FileWatcherInotifyShards::claimed( Uint32 cookie ) {
+	Lock lock( mMovesLock );
+
+	return mClaims.erase( cookie ) > 0;
+}
+
+void FileWatcherInotifyShards::pruneLocked( Uint64 now ) {
+	if ( mMovesFrom.size() > MOVE_CLAIMS_PRUNE ) {
+		for ( std::unordered_map<Uint32, MoveFrom>::iterator it = mMovesFrom.begin();
+			  it != mMovesFrom.end(); ) {
+			if ( it->second.Deadline <= now ) {
+				it = mMovesFrom.erase( it );
+			} else {
+				++it;
+			}
+		}
+	}
+
+	if ( mClaims.size() > MOVE_CLAIMS_PRUNE ) {
+		for ( std::unordered_map<Uint32, Uint64>::iterator it = mClaims.begin();
+			  it != mClaims.end(); ) {
+			if ( it->second <= now ) {
+				it = mClaims.erase( it );
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+} // namespace efsw
+
+#endif
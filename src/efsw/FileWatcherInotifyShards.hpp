@@ -0,0 +1,117 @@
+#ifndef EFSW_FILEWATCHERINOTIFYSHARDS_HPP
+#define EFSW_FILEWATCHERINOTIFYSHARDS_HPP
+
+#include <efsw/FileWatcherImpl.hpp>
+
+#if EFSW_PLATFORM == EFSW_PLATFORM_INOTIFY
+
+#include <efsw/FileWatcherInotify.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+/// The inotify backend spread over several inotify instances, see FileWatcher::setShards.
+/// Each shard has its own descriptor, kernel queue, read buffer and event loop thread, and
+/// holds whole watches: a root and its tree go to the shard holding the fewest kernel watches,
+/// so the events of a watch keep their order. A move between the trees of two shards is
+/// paired by its cookie, unique to the kernel: the shard reading the IN_MOVED_TO reports the
+/// addition and claims the cookie, so the shard holding the IN_MOVED_FROM reports the deletion
+/// right away instead of after the move pairing window.
+/// @class FileWatcherInotifyShards
+class FileWatcherInotifyShards : public FileWatcherImpl {
+  public:
+	FileWatcherInotifyShards( FileWatcher* parent, unsigned int shards );
+
+	virtual ~FileWatcherInotifyShards();
+
+	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
+					  const std::vector<WatcherOption>& options ) override;
+
+	WatchID addWatchAsync( const std::string& directory, FileWatchListener* watcher,
+						   bool recursive, const std::vector<WatcherOption>& options ) override;
+
+	void removeWatch( const std::string& directory ) override;
+
+	void removeWatch( WatchID watchid ) override;
+
+	/// Starts the event loop threads of the shards
+	void watch() override;
+
+	/// The shards handle the actions of their watches
+	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
+					   std::string oldFilename = "" ) override;
+
+	std::vector<std::string> directories() override;
+
+	/// @return An epoll descriptor readable when any shard has work to do
+	PollHandle pollHandle() override;
+
+	/// Runs an iteration of the event loop of every shard, when watch() wasn't called
+	void poll() override;
+
+	std::shared_ptr<WatchCounters> getCounters( WatchID watchid ) override;
+
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
+	/// Registers the IN_MOVED_FROM of a shard
+	/// @return True if another shard read its IN_MOVED_TO already
+	bool moveFrom( Uint32 cookie, FileWatcherInotify* shard );
+
+	/// Claims the IN_MOVED_TO a shard read without its IN_MOVED_FROM, waking up the shard that
+	/// read it if any
+	void moveTo( Uint32 cookie, FileWatcherInotify* shard );
+
+	/// Forgets the IN_MOVED_FROM of the cookie, paired or expired by its shard
+	void movePaired( Uint32 cookie );
+
+	/// @return True if the IN_MOVED_FROM pending of the cookie was claimed by another shard
+	bool claimed( Uint32 cookie );
+
+  protected:
+	struct MoveFrom {
+		FileWatcherInotify* Shard;
+		/// Monotonic time in milliseconds when it's forgotten
+		Uint64 Deadline;
+	};
+
+	std::vector<FileWatcherInotify*> mShards;
+
+	/// Multiplexes the epoll descriptors of the shards for pollHandle
+	int mEpollFD;
+
+	/// Held while a watch is added, so a directory isn't watched by two shards
+	Mutex mAddLock;
+
+	/// Guards the moves and the claims
+	Mutex mMovesLock;
+
+	/// The IN_MOVED_FROM pending in the shards, by cookie
+	std::unordered_map<Uint32, MoveFrom> mMovesFrom;
+
+	/// The cookies of the IN_MOVED_TO read without their IN_MOVED_FROM, with when they're
+	/// forgotten
+	std::unordered_map<Uint32, Uint64> mClaims;
+
+	/// Set once destroyed, the shards aren't woken up anymore
+	bool mClosing;
+
+	bool pathInWatches( const std::string& path ) override;
+
+	/// @return The shard of the watch id, NULL if it's not a watch id
+	FileWatcherInotify* shardOf( WatchID watchid );
+
+	/// @return The shard to add a watch on the directory to, NULL if it's watched already
+	FileWatcherInotify* pick( const std::string& directory );
+
+	/// Drops the moves and the claims past their deadline when there are many
+	void pruneLocked( Uint64 now );
+};
+
+} // namespace efsw
+
+#endif
+
+#endif
@@ -17,20 +17,96 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+/// Maximum number of events read by a kevent call
+#define KEVENT_BATCH_SIZE ( 1024 )
+
+/// Milliseconds between the polls of the watchers that fell back to the generic watcher
+#define POLL_INTERVAL_MS ( 1000 )
+
 namespace efsw {
 
+/// @return The filter of the hot files of the options, NULL if there are none
+static std::shared_ptr<const PathFilter> hotFiles( const std::string& directory,
+												   const std::vector<WatcherOption>& options ) {
+	std::shared_ptr<PathFilter> filter;
+
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		if ( Options::KqueueHotFile != options[i].mOption )
+			continue;
+
+		if ( !filter ) {
+			filter = std::make_shared<PathFilter>( directory );
+		}
+
+		filter->include( options[i].mPattern );
+	}
+
+	return filter;
+}
+
 FileWatcherKqueue::FileWatcherKqueue( FileWatcher* parent ) :
 	FileWatcherImpl( parent ),
+#ifdef __FreeBSD__
+	mKqueue( kqueue1( O_CLOEXEC ) ),
+#else
+	mKqueue( kqueue() ),
+#endif
+	mLastToken( 0 ),
 	mLastWatchID( 0 ),
 	mThread( NULL ),
 	mFileDescriptorCount( 1 ),
 	mAddingWatcher( false ) {
-	mTimeOut.tv_sec = 0;
-	mTimeOut.tv_nsec = 0;
+	mInitOK = false;
+
+#ifndef EVFILT_USER
+	mWakeupPipe[0] = mWakeupPipe[1] = -1;
+#endif
+
+	if ( -1 == mKqueue ) {
+		efDEBUG( "kqueue() returned invalid descriptor: %s\n", strerror( errno ) );
+		return;
+	}
+
+#ifndef __FreeBSD__
+	// this is racey, but only freebsd has kqueue1
+	fcntl( mKqueue, F_SETFD, fcntl( mKqueue, F_GETFD ) | FD_CLOEXEC );
+#endif
+
+	addFD();
+
+	KEvent wakeup;
+
+#ifdef EVFILT_USER
+	EV_SET( &wakeup, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL );
+#else
+	if ( -1 == pipe( mWakeupPipe ) )
+		return;
+
+	for ( int i = 0; i < 2; i++ ) {
+		fcntl( mWakeupPipe[i], F_SETFD, FD_CLOEXEC );
+		fcntl( mWakeupPipe[i], F_SETFL, fcntl( mWakeupPipe[i], F_GETFL ) | O_NONBLOCK );
+		addFD();
+	}
+
+	EV_SET( &wakeup, mWakeupPipe[0], EVFILT_READ, EV_ADD, 0, 0, NULL );
+#endif
+
+	if ( -1 == kevent( mKqueue, &wakeup, 1, NULL, 0, NULL ) ) {
+		efDEBUG( "kevent() couldn't register the wakeup event: %s\n", strerror( errno ) );
+		return;
+	}
+
+	mEvents.resize( KEVENT_BATCH_SIZE );
 	mInitOK = true;
 }
 
 FileWatcherKqueue::~FileWatcherKqueue() {
+	mInitOK = false;
+
+	wakeup();
+
+	efSAFE_DELETE( mThread );
+
 	WatchMap::iterator iter = mWatches.begin();
 
 	for ( ; iter != mWatches.end(); ++iter ) {
@@ -38,10 +114,19 @@ FileWatcherKqueue::~FileWatcherKqueue() {
 	}
 
 	mWatches.clear();
+	mPollers.clear();
 
-	mInitOK = false;
+#ifndef EVFILT_USER
+	for ( int i = 0; i < 2; i++ ) {
+		if ( -1 != mWakeupPipe[i] ) {
+			close( mWakeupPipe[i] );
+		}
+	}
+#endif
 
-	efSAFE_DELETE( mThread );
+	if ( -1 != mKqueue ) {
+		close( mKqueue );
+	}
 }
 
 WatchID FileWatcherKqueue::addWatch( const std::string& directory, FileWatchListener* watcher,
@@ -75,17 +160,25 @@ WatchID FileWatcherKqueue::addWatch( const std::string& directory, FileWatchList
 		}
 	}
 
+	int interests = getEventInterests( options );
+	std::shared_ptr<const PathFilter> filter( PathFilter::create( dir, options ) );
+
+	/// The events of the kqueue are handled holding the lock, so the tree is registered under it
+	Lock lock( mWatchesLock );
+
 	/// Check first if are enough file descriptors available to create another kqueue watcher,
 	/// otherwise it creates a generic watcher
 	if ( availablesFD() ) {
 		mAddingWatcher = true;
 
 		WatcherKqueue* watch = new WatcherKqueue( ++mLastWatchID, dir, watcher, recursive, this );
+		watch->EventInterests = interests;
+		watch->Filter = filter;
+		watch->DirectoriesOnly = 0 != getOptionValue( options, Options::KqueueDirectoriesOnly, 0 );
+		watch->HotFiles = hotFiles( dir, options );
 
-		{
-			Lock lock( mWatchesLock );
-			mWatches.insert( std::make_pair( mLastWatchID, watch ) );
-		}
+		mWatches.insert( std::make_pair( mLastWatchID, watch ) );
+		mWatchRegistry.add( watch );
 
 		watch->addAll();
 
@@ -94,6 +187,7 @@ WatchID FileWatcherKqueue::addWatch( const std::string& directory, FileWatchList
 			int le = watch->lastErrno();
 
 			mWatches.erase( watch->ID );
+			mWatchRegistry.remove( watch->ID );
 
 			efSAFE_DELETE( watch );
 
@@ -103,10 +197,16 @@ WatchID FileWatcherKqueue::addWatch( const std::string& directory, FileWatchList
 			if ( EACCES != le ) {
 				WatcherGeneric* genericWatch =
 					new WatcherGeneric( ++mLastWatchID, dir, watcher, this, recursive );
+				genericWatch->EventInterests = interests;
+				genericWatch->Filter = filter;
+				genericWatch->init();
 
-				Lock lock( mWatchesLock );
 				mWatches.insert( std::make_pair( mLastWatchID, genericWatch ) );
+				mWatchRegistry.add( genericWatch );
+				addPoller( genericWatch );
 			} else {
+				mAddingWatcher = false;
+
 				return Errors::Log::createLastError( Errors::Unspecified, link );
 			}
 		}
@@ -120,24 +220,23 @@ WatchID FileWatcherKqueue::addWatch( const std::string& directory, FileWatchList
 		}
 
 		WatcherGeneric* watch = new WatcherGeneric( ++mLastWatchID, dir, watcher, this, recursive );
+		watch->EventInterests = interests;
+		watch->Filter = filter;
+		watch->init();
 
-		Lock lock( mWatchesLock );
 		mWatches.insert( std::make_pair( mLastWatchID, watch ) );
+		mWatchRegistry.add( watch );
+		addPoller( watch );
 	}
 
 	return mLastWatchID;
 }
 
 void FileWatcherKqueue::removeWatch( const std::string& directory ) {
-	Lock lock( mWatchesLock );
-
-	WatchMap::iterator iter = mWatches.begin();
+	Watcher* watch = mWatchRegistry.find( directory );
 
-	for ( ; iter != mWatches.end(); ++iter ) {
-		if ( directory == iter->second->Directory ) {
-			removeWatch( iter->first );
-			return;
-		}
+	if ( NULL != watch ) {
+		removeWatch( watch->ID );
 	}
 }
 
@@ -152,10 +251,51 @@ void FileWatcherKqueue::removeWatch( WatchID watchid ) {
 	Watcher* watch = iter->second;
 
 	mWatches.erase( iter );
+	mWatchRegistry.remove( watchid );
+	removePoller( watch );
 
 	efSAFE_DELETE( watch );
 }
 
+bool FileWatcherKqueue::expandWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+	WatchScope* scope = filter ? filter->scope() : NULL;
+
+	if ( NULL == scope || !scope->expand( directory ) )
+		return false;
+
+	Lock lock( mWatchesLock );
+
+	WatchMap::iterator it = mWatches.find( watchid );
+
+	/// The directories that were there already aren't reported as added
+	if ( it != mWatches.end() ) {
+		mAddingWatcher = true;
+		it->second->expand( scope->fullPath( directory ) );
+		mAddingWatcher = false;
+	}
+
+	return true;
+}
+
+bool FileWatcherKqueue::collapseWatch( WatchID watchid, const std::string& directory ) {
+	std::shared_ptr<const PathFilter> filter( mWatchRegistry.filter( watchid ) );
+	WatchScope* scope = filter ? filter->scope() : NULL;
+
+	if ( NULL == scope || !scope->collapse( directory ) )
+		return false;
+
+	Lock lock( mWatchesLock );
+
+	WatchMap::iterator it = mWatches.find( watchid );
+
+	if ( it != mWatches.end() ) {
+		it->second->collapse( scope->fullPath( directory ) );
+	}
+
+	return true;
+}
+
 bool FileWatcherKqueue::isAddingWatcher() const {
 	return mAddingWatcher;
 }
@@ -167,49 +307,196 @@ void FileWatcherKqueue::watch() {
 	}
 }
 
+PollHandle FileWatcherKqueue::pollHandle() {
+	return mKqueue;
+}
+
+void FileWatcherKqueue::poll() {
+	if ( NULL != mThread || !mInitOK )
+		return;
+
+	struct timespec timeout = { 0, 0 };
+
+	processEvents( &timeout );
+
+	bool polling;
+
+	{
+		Lock lock( mWatchesLock );
+		polling = !mPollers.empty();
+	}
+
+	if ( polling && std::chrono::steady_clock::now() >= mNextPoll ) {
+		pollWatchers();
+	}
+}
+
 void FileWatcherKqueue::run() {
-	do {
+	while ( mInitOK ) {
+		bool polling;
+
 		{
 			Lock lock( mWatchesLock );
+			polling = !mPollers.empty();
+		}
 
-			for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-				it->second->watch();
-			}
+		/// Without generic watchers the thread only wakes up for the events
+		if ( !polling ) {
+			processEvents( NULL );
+			continue;
+		}
+
+		long long ms = std::chrono::ceil<std::chrono::milliseconds>(
+						   mNextPoll - std::chrono::steady_clock::now() )
+						   .count();
+
+		if ( ms > 0 ) {
+			struct timespec timeout;
+			timeout.tv_sec = (time_t)( ms / 1000 );
+			timeout.tv_nsec = (long)( ms % 1000 ) * 1000000;
+
+			processEvents( &timeout );
+		} else {
+			pollWatchers();
 		}
+	}
+}
+
+void FileWatcherKqueue::wakeup() {
+	if ( -1 == mKqueue )
+		return;
 
-		System::sleep( 500 );
-	} while ( mInitOK );
+#ifdef EVFILT_USER
+	KEvent event;
+	EV_SET( &event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL );
+
+	kevent( mKqueue, &event, 1, NULL, 0, NULL );
+#else
+	char byte = 0;
+
+	if ( -1 != mWakeupPipe[1] && write( mWakeupPipe[1], &byte, 1 ) < 0 ) {
+		efDEBUG( "wakeup(): write failed: %s\n", strerror( errno ) );
+	}
+#endif
 }
 
-void FileWatcherKqueue::handleAction( Watcher* watch, const std::string& filename,
-									  unsigned long action, std::string oldFilename ) {}
+void FileWatcherKqueue::processEvents( const struct timespec* timeout ) {
+	int count = kevent( mKqueue, NULL, 0, &mEvents[0], (int)mEvents.size(), timeout );
 
-std::vector<std::string> FileWatcherKqueue::directories() {
-	std::vector<std::string> dirs;
+	if ( count <= 0 ) {
+		if ( -1 == count && EINTR != errno ) {
+			efDEBUG( "processEvents(): kevent failed: %s\n", strerror( errno ) );
+		}
+
+		return;
+	}
+
+	Lock lock( mWatchesLock );
+
+	for ( int i = 0; i < count; i++ ) {
+		const KEvent& event = mEvents[i];
 
+		/// The wakeup event
+		if ( NULL == event.udata ) {
+#ifndef EVFILT_USER
+			char buf[64];
+
+			while ( read( mWakeupPipe[0], buf, sizeof( buf ) ) > 0 )
+				;
+#endif
+			continue;
+		}
+
+		TargetMap::iterator it = mTargets.find( (Uint64)(uintptr_t)event.udata );
+
+		/// Removed by an event handled before, or since the events were read
+		if ( it == mTargets.end() )
+			continue;
+
+		WatcherKqueue* watch = it->second.Watch;
+
+		if ( watch->handleKevent( event, it->second.File ) && !watch->RescanPending ) {
+			watch->RescanPending = true;
+			mRescans.push_back( watch->token() );
+		}
+	}
+
+	/// The directories are rescanned once per read, after the events of their files
+	for ( size_t i = 0; i < mRescans.size(); i++ ) {
+		TargetMap::iterator it = mTargets.find( mRescans[i] );
+
+		if ( it != mTargets.end() ) {
+			it->second.Watch->RescanPending = false;
+			it->second.Watch->rescan();
+		}
+	}
+
+	mRescans.clear();
+}
+
+void FileWatcherKqueue::pollWatchers() {
 	Lock lock( mWatchesLock );
 
-	dirs.reserve( mWatches.size() );
+	for ( std::unordered_set<Watcher*>::iterator it = mPollers.begin(); it != mPollers.end();
+		  ++it ) {
+		( *it )->watch();
+	}
+
+	mNextPoll = std::chrono::steady_clock::now() + std::chrono::milliseconds( POLL_INTERVAL_MS );
+}
+
+Uint64 FileWatcherKqueue::addKevent( int fd, unsigned int fflags, WatcherKqueue* watch,
+									 WatcherKqueue::File* file ) {
+	Uint64 token = ++mLastToken;
 
-	WatchMap::iterator it = mWatches.begin();
+	KEvent event;
+	EV_SET( &event, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, fflags, 0, (void*)(uintptr_t)token );
 
-	for ( ; it != mWatches.end(); ++it ) {
-		dirs.push_back( it->second->Directory );
+	if ( -1 == kevent( mKqueue, &event, 1, NULL, 0, NULL ) ) {
+		efDEBUG( "addKevent(): Couldn't register descriptor %d: %s\n", fd, strerror( errno ) );
+		return 0;
 	}
 
-	return dirs;
+	Target target;
+	target.Watch = watch;
+	target.File = file;
+
+	mTargets.insert( std::make_pair( token, target ) );
+
+	return token;
 }
 
-bool FileWatcherKqueue::pathInWatches( const std::string& path ) {
-	WatchMap::iterator it = mWatches.begin();
+void FileWatcherKqueue::removeKevent( Uint64 token ) {
+	mTargets.erase( token );
+}
 
-	for ( ; it != mWatches.end(); ++it ) {
-		if ( it->second->Directory == path ) {
-			return true;
-		}
+void FileWatcherKqueue::addPoller( Watcher* watch ) {
+	bool wasEmpty = mPollers.empty();
+
+	mPollers.insert( watch );
+
+	/// The thread may be blocked without a timeout
+	if ( wasEmpty ) {
+		mNextPoll =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds( POLL_INTERVAL_MS );
+
+		wakeup();
 	}
+}
 
-	return false;
+void FileWatcherKqueue::removePoller( Watcher* watch ) {
+	mPollers.erase( watch );
+}
+
+void FileWatcherKqueue::handleAction( Watcher* watch, const std::string& filename,
+									  unsigned long action, std::string oldFilename ) {}
+
+std::vector<std::string> FileWatcherKqueue::directories() {
+	return mWatchRegistry.directories();
+}
+
+bool FileWatcherKqueue::pathInWatches( const std::string& path ) {
+	return mWatchRegistry.contains( path );
 }
 
 void FileWatcherKqueue::addFD() {
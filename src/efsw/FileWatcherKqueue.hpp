@@ -6,10 +6,18 @@
 #if EFSW_PLATFORM == EFSW_PLATFORM_KQUEUE || EFSW_PLATFORM == EFSW_PLATFORM_FSEVENTS
 
 #include <efsw/WatcherKqueue.hpp>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace efsw {
 
 /// Implementation for OSX based on kqueue.
+/// Every directory and file watched is registered once on a single kqueue, the udata of their
+/// kevents is a token that maps back to the watcher. One thread blocks on the kqueue, woken up by
+/// an EVFILT_USER event ( a pipe where it's not supported ) to stop. The watches that fell back to
+/// the generic watcher are polled between the waits.
 /// @class FileWatcherKqueue
 class FileWatcherKqueue : public FileWatcherImpl {
 	friend class WatcherKqueue;
@@ -24,7 +32,7 @@ class FileWatcherKqueue : public FileWatcherImpl {
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 					  const std::vector<WatcherOption> &options ) override;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Remove a directory watch. This is a hash lookup O(1).
 	void removeWatch( const std::string& directory ) override;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -33,6 +41,13 @@ class FileWatcherKqueue : public FileWatcherImpl {
 	/// Updates the watcher. Must be called often.
 	void watch() override;
 
+	/// The kqueue, readable when it has events pending
+	PollHandle pollHandle() override;
+
+	/// Handles the events pending and polls the generic watchers from the calling thread, when
+	/// watch() wasn't called
+	void poll() override;
+
 	/// Handles the action
 	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
 					   std::string oldFilename = "" ) override;
@@ -40,12 +55,53 @@ class FileWatcherKqueue : public FileWatcherImpl {
 	/// @return Returns a list of the directories that are being watched
 	std::vector<std::string> directories() override;
 
+	/// Changes the scope and watches the subdirectories brought in it
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	/// Changes the scope and removes the watchers of the subdirectories of the directory
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
   protected:
+	/// The watcher and the file of a kevent
+	struct Target {
+		WatcherKqueue* Watch;
+		/// NULL for the directory of the watcher
+		WatcherKqueue::File* File;
+	};
+
+	typedef std::unordered_map<Uint64, Target> TargetMap;
+
 	/// Map of WatchID to WatchStruct pointers
 	WatchMap mWatches;
 
-	/// time out data
-	struct timespec mTimeOut;
+	/// The kqueue shared by all the watchers
+	int mKqueue;
+
+#ifndef EVFILT_USER
+	/// Wakes up the thread blocked on the kqueue
+	int mWakeupPipe[2];
+#endif
+
+	/// The targets of the kevents by token. The tokens aren't reused, so the events read before
+	/// their target was removed are dropped. Guarded by mWatchesLock.
+	TargetMap mTargets;
+	Uint64 mLastToken;
+
+	/// The events read by a kevent call
+	std::vector<KEvent> mEvents;
+
+	/// The tokens of the directories to rescan once the events read are handled
+	std::vector<Uint64> mRescans;
+
+	/// The listing reused by the rescans. Guarded by mWatchesLock.
+	FileInfoMap mListing;
+
+	/// The watchers that fell back to the generic watcher, polled between the waits. Guarded by
+	/// mWatchesLock.
+	std::unordered_set<Watcher*> mPollers;
+
+	/// When the generic watchers are polled next
+	std::chrono::steady_clock::time_point mNextPoll;
 
 	/// WatchID allocator
 	int mLastWatchID;
@@ -70,8 +126,33 @@ class FileWatcherKqueue : public FileWatcherImpl {
 
 	bool availablesFD();
 
+	/// Registers the vnode kevent of a watched descriptor on the kqueue, holding mWatchesLock
+	/// @param file The file of the watcher, NULL for its directory
+	/// @return The token of the kevent, 0 if it couldn't be registered
+	Uint64 addKevent( int fd, unsigned int fflags, WatcherKqueue* watch,
+					  WatcherKqueue::File* file );
+
+	/// Forgets the target of a kevent, holding mWatchesLock. The kevent is removed from the
+	/// kqueue once its descriptor is closed.
+	void removeKevent( Uint64 token );
+
+	/// Adds a watcher that fell back to the generic watcher to the ones polled, holding
+	/// mWatchesLock
+	void addPoller( Watcher* watch );
+
+	void removePoller( Watcher* watch );
+
   private:
 	void run();
+
+	/// Wakes up the thread blocked on the kqueue
+	void wakeup();
+
+	/// Waits for the kevents up to the timeout ( NULL blocks ) and handles the ones read
+	void processEvents( const struct timespec* timeout );
+
+	/// Polls the generic watchers once
+	void pollWatchers();
 };
 
 } // namespace efsw
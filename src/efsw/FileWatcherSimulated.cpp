@@ -0,0 +1,415 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/FileWatcherSimulated.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/System.hpp>
+#include <algorithm>
+
+/// Longest sleep of the thread, so it stops in time
+#define SIMULATION_MAX_SLEEP_MS 100
+
+namespace efsw {
+
+FileWatcherSimulated::FileWatcherSimulated( FileWatcher* parent, const Simulation& simulation ) :
+	FileWatcherImpl( parent ),
+	mSimulation( simulation ),
+	mThread( NULL ),
+	mLastWatchID( 0 ),
+	mBufferSize( 0 ),
+	mPendingSize( 0 ),
+	mCookie( 0 ) {
+	mSimulation.batch = std::max( 1u, mSimulation.batch );
+	mInitOK = true;
+	/// Nothing is read from the disk, so the watches aren't refused on remote file systems
+	mIsGeneric = true;
+}
+
+FileWatcherSimulated::~FileWatcherSimulated() {
+	mInitOK = false;
+
+	efSAFE_DELETE( mThread );
+
+	for ( size_t i = 0; i < mWatches.size(); i++ ) {
+		efSAFE_DELETE( mWatches[i] );
+	}
+}
+
+WatchID FileWatcherSimulated::addWatch( const std::string& directory,
+										FileWatchListener* watcher, bool recursive,
+										const std::vector<WatcherOption>& options ) {
+	std::string dir( directory );
+
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	Lock lock( mWatchesLock );
+
+	if ( pathInWatches( dir ) ) {
+		return Errors::Log::createLastError( Errors::FileRepeated, dir );
+	}
+
+	mLastWatchID++;
+
+	WatcherSimulated* watch =
+		new WatcherSimulated( mLastWatchID, dir, watcher, recursive, mSimulation.seed );
+	watch->EventInterests = getEventInterests( options );
+	watch->Filter = PathFilter::create( dir, options );
+	watch->build( mSimulation.depth, mSimulation.fanout, mSimulation.files );
+
+	mWatches.push_back( watch );
+	mWatchRegistry.add( watch );
+
+	return watch->ID;
+}
+
+void FileWatcherSimulated::removeWatch( const std::string& directory ) {
+	Watcher* watch = mWatchRegistry.find( directory );
+
+	if ( NULL != watch ) {
+		removeWatch( watch->ID );
+	}
+}
+
+void FileWatcherSimulated::removeWatch( WatchID watchid ) {
+	Lock lock( mWatchesLock );
+
+	Watcher* removed = mWatchRegistry.remove( watchid );
+
+	if ( NULL == removed )
+		return;
+
+	std::vector<WatcherSimulated*>::iterator it =
+		std::find( mWatches.begin(), mWatches.end(), removed );
+
+	if ( it != mWatches.end() ) {
+		mWatches.erase( it );
+	}
+
+	efSAFE_DELETE( removed );
+}
+
+void FileWatcherSimulated::watch() {
+	if ( NULL == mThread ) {
+		mThread = new Thread( [this] { run(); } );
+		mThread->launch();
+	}
+}
+
+void FileWatcherSimulated::poll() {
+	if ( NULL == mThread ) {
+		process();
+	}
+}
+
+void FileWatcherSimulated::run() {
+	while ( mInitOK ) {
+		Clock::time_point next = process();
+		long long ms =
+			std::chrono::ceil<std::chrono::milliseconds>( next - Clock::now() ).count();
+
+		/// Without a rate the changes are made as fast as they are delivered
+		if ( mInitOK && ms > 0 ) {
+			System::sleep( (unsigned long)std::min( ms, (long long)SIMULATION_MAX_SLEEP_MS ) );
+		}
+	}
+}
+
+FileWatcherSimulated::Clock::time_point FileWatcherSimulated::process() {
+	Lock lock( mWatchesLock );
+
+	Clock::time_point now = Clock::now();
+	Clock::time_point next = now + std::chrono::milliseconds( SIMULATION_MAX_SLEEP_MS );
+
+	mBufferSize = 0;
+
+	for ( size_t i = 0; i < mWatches.size(); i++ ) {
+		WatcherSimulated* watch = mWatches[i];
+		Uint64 count = mSimulation.batch;
+
+		if ( 0 == watch->Changes ) {
+			watch->Start = now;
+		}
+
+		/// The changes due since the watch started, so the rate holds whatever the thread slept
+		if ( mSimulation.rate > 0 ) {
+			double elapsed = std::chrono::duration<double>( now - watch->Start ).count();
+			Uint64 due = (Uint64)( elapsed * mSimulation.rate ) + 1;
+
+			count = due > watch->Changes ? std::min( count, due - watch->Changes ) : 0;
+		}
+
+		Uint64 made = 0;
+
+		while ( made < count && change( watch ) ) {
+			made++;
+		}
+
+		if ( made < count )
+			continue;
+
+		if ( 0 == mSimulation.rate ) {
+			next = now;
+		} else {
+			next = std::min(
+				next, watch->Start + std::chrono::duration_cast<Clock::duration>(
+										 std::chrono::duration<double>(
+											 (double)watch->Changes / mSimulation.rate ) ) );
+		}
+	}
+
+	readBuffer();
+
+	mBatch.flush();
+
+	return next;
+}
+
+bool FileWatcherSimulated::change( WatcherSimulated* watch ) {
+	if ( mSimulation.changes > 0 && watch->Changes >= mSimulation.changes )
+		return false;
+
+	if ( mSimulation.script.empty() ) {
+		changeRandom( watch );
+	} else if ( 0 == mSimulation.changes && watch->Changes >= mSimulation.script.size() ) {
+		return false;
+	} else {
+		changeScripted( watch );
+	}
+
+	watch->Changes++;
+
+	return true;
+}
+
+void FileWatcherSimulated::changeRandom( WatcherSimulated* watch ) {
+	const Simulation& sim = mSimulation;
+	Uint32 total = sim.adds + sim.deletes + sim.modifications + sim.renames + sim.moves;
+	/// Only modifications without weights
+	Uint32 pick = total > 0 ? watch->random( total ) : sim.adds + sim.deletes;
+
+	WatcherSimulated::Node& node = watch->Tree[watch->random( (Uint32)watch->Tree.size() )];
+
+	/// An empty directory gets a file first
+	if ( pick < sim.adds || node.Files.empty() ) {
+		node.Files.push_back( "new-" + std::to_string( watch->NextName++ ) );
+
+		push( watch, RawChange::Created, node.Path, node.Files.back() );
+		return;
+	}
+
+	pick -= sim.adds;
+
+	size_t index = watch->random( (Uint32)node.Files.size() );
+
+	if ( pick < sim.deletes ) {
+		push( watch, RawChange::Deleted, node.Path, node.Files[index] );
+
+		std::swap( node.Files[index], node.Files.back() );
+		node.Files.pop_back();
+		return;
+	}
+
+	pick -= sim.deletes;
+
+	if ( pick < sim.modifications ) {
+		push( watch, RawChange::Modified, node.Path, node.Files[index] );
+		return;
+	}
+
+	pick -= sim.modifications;
+
+	Uint32 cookie = ++mCookie;
+
+	push( watch, RawChange::MovedFrom, node.Path, node.Files[index], cookie );
+
+	std::string name( "renamed-" + std::to_string( watch->NextName++ ) );
+
+	if ( pick < sim.renames ) {
+		node.Files[index].swap( name );
+
+		push( watch, RawChange::MovedTo, node.Path, node.Files[index], cookie );
+		return;
+	}
+
+	/// The node is taken again, the target can be the same directory
+	WatcherSimulated::Node& target = watch->Tree[watch->random( (Uint32)watch->Tree.size() )];
+
+	std::swap( node.Files[index], node.Files.back() );
+	node.Files.pop_back();
+	target.Files.push_back( name );
+
+	push( watch, RawChange::MovedTo, target.Path, target.Files.back(), cookie );
+}
+
+bool FileWatcherSimulated::resolve( WatcherSimulated* watch, const std::string& path,
+									std::string& dir, std::string& name ) {
+	size_t slash = path.find_last_of( '/' );
+
+	dir.assign( watch->Directory );
+	name.assign( path, std::string::npos != slash ? slash + 1 : 0, std::string::npos );
+
+	if ( std::string::npos == slash )
+		return true;
+
+	if ( !watch->Recursive )
+		return false;
+
+	for ( size_t start = 0; start < slash; ) {
+		size_t end = path.find( '/', start );
+
+		dir.append( path, start, end - start );
+
+		if ( watch->prunes( dir ) )
+			return false;
+
+		dir += FileSystem::getOSSlash();
+		start = end + 1;
+	}
+
+	return true;
+}
+
+void FileWatcherSimulated::changeScripted( WatcherSimulated* watch ) {
+	const SimulatedChange& change = mSimulation.script[watch->ScriptPosition];
+
+	watch->ScriptPosition = ( watch->ScriptPosition + 1 ) % mSimulation.script.size();
+
+	bool watched = resolve( watch, change.path, mScriptDir, mScriptName );
+
+	switch ( change.action ) {
+		case Actions::Add:
+			if ( watched )
+				push( watch, RawChange::Created, mScriptDir, mScriptName );
+			break;
+		case Actions::Delete:
+			if ( watched )
+				push( watch, RawChange::Deleted, mScriptDir, mScriptName );
+			break;
+		case Actions::Modified:
+			if ( watched )
+				push( watch, RawChange::Modified, mScriptDir, mScriptName );
+			break;
+		case Actions::Moved: {
+			Uint32 cookie = ++mCookie;
+
+			if ( resolve( watch, change.oldPath, mScriptOldDir, mScriptOldName ) )
+				push( watch, RawChange::MovedFrom, mScriptOldDir, mScriptOldName, cookie );
+
+			if ( watched )
+				push( watch, RawChange::MovedTo, mScriptDir, mScriptName, cookie );
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void FileWatcherSimulated::push( WatcherSimulated* watch, RawChange::Kind type,
+								 std::string_view dir, std::string_view name, Uint32 cookie ) {
+	if ( mBufferSize == mBuffer.size() ) {
+		mBuffer.push_back( RawChange() );
+	}
+
+	RawChange& raw = mBuffer[mBufferSize++];
+	raw.Watch = watch;
+	raw.Type = type;
+	raw.Cookie = cookie;
+	raw.Dir.assign( dir.data(), dir.size() );
+	raw.Name.assign( name.data(), name.size() );
+}
+
+void FileWatcherSimulated::readBuffer() {
+	for ( size_t i = 0; i < mBufferSize; i++ ) {
+		RawChange& raw = mBuffer[i];
+
+		switch ( raw.Type ) {
+			case RawChange::Created:
+				handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Add );
+				break;
+			case RawChange::Deleted:
+				handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Delete );
+				break;
+			case RawChange::Modified:
+				handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Modified );
+				break;
+			case RawChange::MovedFrom: {
+				if ( mPendingSize == mPending.size() ) {
+					mPending.push_back( PendingMove() );
+				}
+
+				PendingMove& move = mPending[mPendingSize++];
+				move.Watch = raw.Watch;
+				move.Cookie = raw.Cookie;
+				move.Dir.swap( raw.Dir );
+				move.Name.swap( raw.Name );
+				break;
+			}
+			case RawChange::MovedTo: {
+				/// The pair is usually the last half queued
+				size_t found = mPendingSize;
+
+				while ( found > 0 && mPending[found - 1].Cookie != raw.Cookie ) {
+					found--;
+				}
+
+				if ( 0 == found ) {
+					handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Add );
+					break;
+				}
+
+				PendingMove& move = mPending[found - 1];
+
+				if ( move.Watch == raw.Watch && move.Dir == raw.Dir ) {
+					handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Moved, move.Name );
+				} else {
+					handleEvent( move.Watch, move.Dir, move.Name, Actions::Delete );
+					handleEvent( raw.Watch, raw.Dir, raw.Name, Actions::Add );
+				}
+
+				std::swap( move, mPending[--mPendingSize] );
+				break;
+			}
+		}
+	}
+
+	/// Moved outside the watches
+	for ( size_t i = 0; i < mPendingSize; i++ ) {
+		handleEvent( mPending[i].Watch, mPending[i].Dir, mPending[i].Name, Actions::Delete );
+	}
+
+	mPendingSize = 0;
+}
+
+void FileWatcherSimulated::handleEvent( WatcherSimulated* watch, std::string_view dir,
+										std::string_view name, Action action,
+										std::string_view oldName ) {
+	if ( !watch->Listener )
+		return;
+
+	WatchCounters::add( watch->Counters->Received );
+
+	if ( watch->accepts( action ) && watch->matches( dir, name, oldName ) ) {
+		mBatch.add( watch->Listener, watch->ID, dir, name, action, oldName );
+	}
+}
+
+void FileWatcherSimulated::handleAction( Watcher* watch, const std::string& filename,
+										 unsigned long action, std::string oldFilename ) {
+	if ( NULL == watch )
+		return;
+
+	Lock lock( mWatchesLock );
+
+	handleEvent( static_cast<WatcherSimulated*>( watch ), watch->Directory, filename,
+				 (Action)action, oldFilename );
+
+	mBatch.flush();
+}
+
+std::vector<std::string> FileWatcherSimulated::directories() {
+	return mWatchRegistry.directories();
+}
+
+bool FileWatcherSimulated::pathInWatches( const std::string& path ) {
+	return mWatchRegistry.contains( path );
+}
+
+} // namespace efsw
@@ -0,0 +1,138 @@
+#ifndef EFSW_FILEWATCHERSIMULATED_HPP
+#define EFSW_FILEWATCHERSIMULATED_HPP
+
+#include <efsw/EventBatch.hpp>
+#include <efsw/FileWatcherImpl.hpp>
+#include <efsw/WatcherSimulated.hpp>
+#include <vector>
+
+namespace efsw {
+
+/// Implementation of the simulated backend, see Simulation.
+/// Its thread makes a buffer of changes of every watch at a time, the way the system fills the
+/// buffer of a native backend, then reads it: the moves are made of two halves paired by their
+/// cookie, and the events go through the interests and the patterns of the watches, then are
+/// delivered in a batch. A buffer is made and delivered holding the watches, so removeWatch
+/// waits for the one in progress.
+/// @class FileWatcherSimulated
+class FileWatcherSimulated : public FileWatcherImpl {
+  public:
+	FileWatcherSimulated( FileWatcher* parent, const Simulation& simulation );
+
+	virtual ~FileWatcherSimulated();
+
+	/// Add a directory watch, with a tree of its own whatever is on the disk
+	/// On error returns WatchID with Error type.
+	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
+					  const std::vector<WatcherOption>& options ) override;
+
+	/// Remove a directory watch. This is a hash lookup O(1).
+	void removeWatch( const std::string& directory ) override;
+
+	/// Remove a directory watch. This is a map lookup O(logn).
+	void removeWatch( WatchID watchid ) override;
+
+	/// Updates the watcher. Must be called often.
+	void watch() override;
+
+	/// Makes and delivers a buffer of changes from the calling thread, when watch() wasn't called
+	void poll() override;
+
+	/// Handles the action
+	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
+					   std::string oldFilename = "" ) override;
+
+	/// @return Returns a list of the directories that are being watched
+	std::vector<std::string> directories() override;
+
+  protected:
+	typedef WatcherSimulated::Clock Clock;
+
+	/// A change as the system reports it, the moves in two halves
+	struct RawChange {
+		enum Kind { Created, Deleted, Modified, MovedFrom, MovedTo };
+
+		WatcherSimulated* Watch;
+		Kind Type;
+		/// Pairs the halves of a move
+		Uint32 Cookie;
+		std::string Dir;
+		std::string Name;
+	};
+
+	/// The first half of a move waiting for the second one
+	struct PendingMove {
+		WatcherSimulated* Watch;
+		Uint32 Cookie;
+		std::string Dir;
+		std::string Name;
+	};
+
+	Simulation mSimulation;
+
+	Thread* mThread;
+
+	/// The last watchid
+	WatchID mLastWatchID;
+
+	std::vector<WatcherSimulated*> mWatches;
+
+	/// Guards the watches, held while a buffer is made and delivered
+	Mutex mWatchesLock;
+
+	/// The buffer of changes, its entries keep the capacity of their strings between buffers
+	std::vector<RawChange> mBuffer;
+	size_t mBufferSize;
+
+	/// The moves of the buffer waiting to be paired, reused the same way
+	std::vector<PendingMove> mPending;
+	size_t mPendingSize;
+
+	/// The last cookie given to a move
+	Uint32 mCookie;
+
+	EventBatch mBatch;
+
+	/// The directory and the name of the scripted change being made, and where it was moved from
+	std::string mScriptDir;
+	std::string mScriptName;
+	std::string mScriptOldDir;
+	std::string mScriptOldName;
+
+	bool pathInWatches( const std::string& path ) override;
+
+	/// Queues a change into the buffer
+	void push( WatcherSimulated* watch, RawChange::Kind type, std::string_view dir,
+			   std::string_view name, Uint32 cookie = 0 );
+
+	/// Makes the next change of the watch
+	/// @return False once the watch made all its changes
+	bool change( WatcherSimulated* watch );
+
+	void changeRandom( WatcherSimulated* watch );
+
+	void changeScripted( WatcherSimulated* watch );
+
+	/// Splits the path of a scripted change into the directory and the name of the file
+	/// @return False if the directory isn't watched: outside a watch not recursive, or pruned
+	bool resolve( WatcherSimulated* watch, const std::string& path, std::string& dir,
+				  std::string& name );
+
+	/// Reads the buffer, pairing the halves of the moves. The halves left alone were moved from
+	/// or to outside the watches, they are reported as a deletion or an addition.
+	void readBuffer();
+
+	void handleEvent( WatcherSimulated* watch, std::string_view dir, std::string_view name,
+					  Action action, std::string_view oldName = {} );
+
+	/// Makes a buffer of the changes due of every watch and delivers it
+	/// @return When the next change is due
+	Clock::time_point process();
+
+  private:
+	void run();
+};
+
+} // namespace efsw
+
+#endif
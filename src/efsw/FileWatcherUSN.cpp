@@ -0,0 +1,942 @@
+#include <efsw/FileWatcherUSN.hpp>
+
+#ifdef EFSW_USN
+
+#include <efsw/Debug.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/FileWatcherWin32.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/String.hpp>
+#include <algorithm>
+#include <stddef.h>
+#include <string.h>
+
+#define BUFF_SIZE ( 64 * 1024 )
+
+/// Maximum number of directory paths cached per volume, the cache is emptied when reached
+#define DIRECTORY_CACHE_MAX 65536
+
+/// Maximum number of open files whose reasons are tracked per volume, the oldest reasons are
+/// forgotten when reached ( their next records are handled as new )
+#define OPEN_FILES_MAX 65536
+
+/// The reasons of the file contents changed
+#define USN_DATA_REASONS ( USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_EXTEND | \
+						   USN_REASON_DATA_TRUNCATION )
+
+/// The reasons of the file attributes changed
+#define USN_ATTRIBUTE_REASONS ( USN_REASON_BASIC_INFO_CHANGE | USN_REASON_SECURITY_CHANGE | \
+								USN_REASON_EA_CHANGE )
+
+/// Reasons read from the journals. The directory cache depends on the names changes, so they
+/// are read whatever the interests of the watches.
+#define USN_REASONS ( USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE | \
+					  USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME | USN_DATA_REASONS | \
+					  USN_ATTRIBUTE_REASONS | USN_REASON_CLOSE )
+
+namespace efsw {
+
+/// @return The path of the file opened ending with a backslash, empty if it can't be resolved
+static std::string finalPath( HANDLE handle ) {
+	DWORD len = GetFinalPathNameByHandleW( handle, NULL, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS );
+
+	if ( 0 == len )
+		return "";
+
+	std::wstring path( len, L'\0' );
+
+	len = GetFinalPathNameByHandleW( handle, &path[0], len, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS );
+
+	if ( 0 == len || len >= path.size() )
+		return "";
+
+	path.resize( len );
+
+	/// The paths are reported as the user gives them, without the \\?\ prefix
+	if ( 0 == path.compare( 0, 8, L"\\\\?\\UNC\\" ) ) {
+		path.replace( 0, 8, L"\\\\" );
+	} else if ( 0 == path.compare( 0, 4, L"\\\\?\\" ) ) {
+		path.erase( 0, 4 );
+	}
+
+	std::string res( String::wideToUtf8( path ) );
+
+	FileSystem::dirAddSlashAtEnd( res );
+	return res;
+}
+
+/// @return The real path of the directory ending with a backslash, empty if it can't be resolved
+static std::string realDirectory( const std::string& directory ) {
+	HANDLE handle = CreateFileW( String::utf8ToWide( directory ).c_str(), 0,
+								 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+								 OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL );
+
+	if ( INVALID_HANDLE_VALUE == handle )
+		return "";
+
+	std::string path( finalPath( handle ) );
+
+	CloseHandle( handle );
+	return path;
+}
+
+/// @return True if the process is allowed to open the volumes to read their journal ( elevated )
+static bool canReadJournals() {
+	WCHAR windows[MAX_PATH];
+	UINT len = GetWindowsDirectoryW( windows, MAX_PATH );
+
+	if ( len < 2 || L':' != windows[1] )
+		return false;
+
+	std::wstring volume( L"\\\\.\\" );
+	volume.append( windows, 2 );
+
+	HANDLE handle = CreateFileW( volume.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+								 NULL, OPEN_EXISTING, 0, NULL );
+
+	if ( INVALID_HANDLE_VALUE == handle )
+		return false;
+
+	CloseHandle( handle );
+	return true;
+}
+
+/// Queries the journal of a volume opened for overlapped reads, waiting for the answer
+static bool queryJournal( HANDLE volume, USN_JOURNAL_DATA_V0& data ) {
+	OVERLAPPED ov;
+	memset( &ov, 0, sizeof( ov ) );
+
+	HANDLE event = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+	if ( NULL == event )
+		return false;
+
+	/// The low bit of the event keeps the completion off the port of the watcher
+	ov.hEvent = (HANDLE)( (ULONG_PTR)event | 1 );
+
+	DWORD bytes = 0;
+	BOOL res = DeviceIoControl( volume, FSCTL_QUERY_USN_JOURNAL, NULL, 0, &data, sizeof( data ),
+								&bytes, &ov );
+
+	if ( !res && ERROR_IO_PENDING == GetLastError() ) {
+		res = GetOverlappedResult( volume, &ov, &bytes, TRUE );
+	}
+
+	CloseHandle( event );
+	return FALSE != res;
+}
+
+/// Closes the volume, waiting for its pending read to be cancelled. Only once no thread handles
+/// the completions anymore.
+static void freeVolume( VolumeUSN* volume ) {
+	if ( volume->Pending ) {
+		DWORD bytes = 0;
+
+		CancelIoEx( volume->Handle, &volume->Overlapped );
+		GetOverlappedResult( volume->Handle, &volume->Overlapped, &bytes, TRUE );
+	}
+
+	CloseHandle( volume->Handle );
+	efSAFE_DELETE( volume );
+}
+
+FileWatcherUSN::FileWatcherUSN( FileWatcher* parent ) :
+	FileWatcherImpl( parent ), mWin32( NULL ), mIOCP( NULL ), mLastWatchID( 0 ), mThread( NULL ) {
+	if ( !canReadJournals() ) {
+		efDEBUG( "USN journal not available: the volumes can't be opened\n" );
+		return;
+	}
+
+	mIOCP = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+
+	if ( NULL == mIOCP ) {
+		efDEBUG( "Error creating the completion port: %lu\n", GetLastError() );
+		return;
+	}
+
+	mInitOK = true;
+}
+
+FileWatcherUSN::~FileWatcherUSN() {
+	mInitOK = false;
+
+	if ( NULL != mThread ) {
+		PostQueuedCompletionStatus( mIOCP, 0, reinterpret_cast<ULONG_PTR>( this ), NULL );
+	}
+
+	efSAFE_DELETE( mThread );
+
+	/// The delegated watches forward their events through the watchers, stop them first
+	efSAFE_DELETE( mWin32 );
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+
+	mWatches.clear();
+	mWatchRegistry.clear();
+
+	for ( std::map<std::string, VolumeUSN*>::iterator it = mVolumes.begin();
+		  it != mVolumes.end(); ++it ) {
+		freeVolume( it->second );
+	}
+
+	mVolumes.clear();
+
+	for ( size_t i = 0; i < mClosing.size(); i++ ) {
+		freeVolume( mClosing[i] );
+	}
+
+	mClosing.clear();
+
+	if ( NULL != mIOCP ) {
+		CloseHandle( mIOCP );
+	}
+}
+
+WatchID FileWatcherUSN::addWatch( const std::string& directory, FileWatchListener* watcher,
+								  bool recursive, const std::vector<WatcherOption>& options ) {
+	if ( !mInitOK )
+		return Errors::Log::createLastError( Errors::Unspecified, directory );
+
+	Lock initLock( mInitLock );
+
+	std::string dir( directory );
+
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	FileInfo fi( dir );
+
+	if ( !fi.isDirectory() ) {
+		return Errors::Log::createLastError( Errors::FileNotFound, dir );
+	} else if ( !fi.isReadable() ) {
+		return Errors::Log::createLastError( Errors::FileNotReadable, dir );
+	} else if ( pathInWatches( dir ) ) {
+		return Errors::Log::createLastError( Errors::FileRepeated, directory );
+	}
+
+	WatcherUSN* watch;
+
+	{
+		Lock lock( mWatchesLock );
+		watch = new WatcherUSN( ++mLastWatchID, dir, watcher, recursive );
+	}
+
+	watch->EventInterests = getEventInterests( options );
+	watch->Filter = PathFilter::create( dir, options );
+
+	bool hasSince = false;
+	Uint64 since = 0;
+
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		if ( Options::UsnSinceId == options[i].mOption &&
+			 String::fromString<Uint64>( since, options[i].mPattern ) ) {
+			hasSince = true;
+		}
+	}
+
+	/// The paths reported by the records are always real paths, the watch is indexed by it
+	std::string realDir( realDirectory( dir ) );
+
+	/// Only the recursive watches benefit from the journal, a directory is cheaper to read alone
+	if ( recursive && !realDir.empty() ) {
+		watch->Volume = addVolume( realDir, watch, hasSince, since );
+	}
+
+	if ( NULL == watch->Volume ) {
+		WatchID id = delegateWatch( watch, options );
+
+		if ( id < 0 ) {
+			efSAFE_DELETE( watch );
+			return id;
+		}
+
+		realDir = dir;
+	}
+
+	efDEBUG( "Added watch %s with id: %ld%s\n", dir.c_str(), watch->ID,
+			 watch->isDelegated() ? " ( Win32 )" : "" );
+
+	{
+		Lock lock( mWatchesLock );
+
+		mWatches.insert( std::make_pair( watch->ID, watch ) );
+		mWatchRegistry.add( watch, realDir );
+	}
+
+	/// The history may be done already if there was nothing to replay
+	if ( watch->ReportHistory ) {
+		notifyWatches( watch->Volume, Actions::HistoryDone, true );
+	}
+
+	mBatch.flush();
+
+	return watch->ID;
+}
+
+VolumeUSN* FileWatcherUSN::addVolume( const std::string& directory, WatcherUSN* watch,
+									  bool hasSince, Uint64 since ) {
+	std::wstring wdir( String::utf8ToWide( directory ) );
+	WCHAR mountPoint[MAX_PATH];
+	WCHAR volumeName[MAX_PATH];
+	WCHAR fileSystem[MAX_PATH];
+
+	if ( !GetVolumePathNameW( wdir.c_str(), mountPoint, MAX_PATH ) ||
+		 !GetVolumeNameForVolumeMountPointW( mountPoint, volumeName, MAX_PATH ) ||
+		 !GetVolumeInformationW( mountPoint, NULL, 0, NULL, NULL, NULL, fileSystem, MAX_PATH ) ||
+		 0 != wcscmp( fileSystem, L"NTFS" ) ) {
+		return NULL;
+	}
+
+	std::string name( String::wideToUtf8( volumeName ) );
+
+	Lock lock( mWatchesLock );
+
+	VolumeUSN* volume;
+	std::map<std::string, VolumeUSN*>::iterator it = mVolumes.find( name );
+	USN_JOURNAL_DATA_V0 data;
+
+	if ( it != mVolumes.end() ) {
+		volume = it->second;
+
+		if ( !queryJournal( volume->Handle, data ) )
+			return NULL;
+	} else {
+		/// The volume is opened by its GUID path without the trailing backslash
+		std::wstring path( volumeName );
+
+		if ( !path.empty() && L'\\' == path[path.size() - 1] ) {
+			path.resize( path.size() - 1 );
+		}
+
+		HANDLE handle = CreateFileW( path.c_str(), GENERIC_READ,
+									 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+									 FILE_FLAG_OVERLAPPED, NULL );
+
+		if ( INVALID_HANDLE_VALUE == handle )
+			return NULL;
+
+		/// The volumes without an active journal are served by Win32
+		if ( !queryJournal( handle, data ) || !CreateIoCompletionPort( handle, mIOCP, 0, 1 ) ) {
+			efDEBUG( "Can't read the USN journal of %s: %lu\n", name.c_str(), GetLastError() );
+			CloseHandle( handle );
+			return NULL;
+		}
+
+		volume = new VolumeUSN();
+		memset( &volume->Overlapped, 0, sizeof( volume->Overlapped ) );
+		memset( &volume->Read, 0, sizeof( volume->Read ) );
+		volume->Handle = handle;
+		volume->Name = name;
+		volume->JournalID = data.UsnJournalID;
+		volume->NextUsn = data.NextUsn;
+		volume->ReadFrom = data.NextUsn;
+		volume->Count = 0;
+		volume->Pending = false;
+		volume->Closing = false;
+		volume->Buffer.resize( BUFF_SIZE );
+		volume->RenamePending = false;
+		volume->RenameIsDir = false;
+		volume->RenameFile = 0;
+
+		mVolumes[name] = volume;
+	}
+
+	watch->SinceUsn = data.NextUsn;
+
+	if ( hasSince ) {
+		/// The records older than the journal were lost, the history is replayed from its start
+		if ( since < (Uint64)data.FirstUsn ) {
+			since = data.FirstUsn;
+
+			if ( NULL != watch->Listener ) {
+				mBatch.add( watch->Listener, watch->ID, watch->Directory, "", Actions::Overflow );
+			}
+		}
+
+		watch->SinceUsn = since;
+		watch->HistoryEnd = data.NextUsn;
+		watch->ReportHistory = true;
+
+		if ( since < volume->NextUsn ) {
+			/// The watches already started don't receive the records read again
+			for ( WatchMap::iterator wit = mWatches.begin(); wit != mWatches.end(); ++wit ) {
+				if ( wit->second->Volume == volume ) {
+					wit->second->SinceUsn = std::max( wit->second->SinceUsn, volume->NextUsn );
+				}
+			}
+
+			volume->NextUsn = since;
+
+			/// The read pending is read again from the new position once cancelled
+			if ( volume->Pending ) {
+				CancelIoEx( volume->Handle, &volume->Overlapped );
+			}
+		}
+	}
+
+	volume->Count++;
+
+	if ( !volume->Pending && !readJournal( volume ) ) {
+		if ( 0 == --volume->Count ) {
+			mVolumes.erase( volume->Name );
+			freeVolume( volume );
+		}
+
+		return NULL;
+	}
+
+	return volume;
+}
+
+void FileWatcherUSN::removeVolumeLocked( VolumeUSN* volume ) {
+	if ( --volume->Count > 0 )
+		return;
+
+	mVolumes.erase( volume->Name );
+
+	if ( volume->Pending ) {
+		/// Its completion is still to be dequeued, the volume is freed then
+		volume->Closing = true;
+		CancelIoEx( volume->Handle, &volume->Overlapped );
+		mClosing.push_back( volume );
+	} else {
+		CloseHandle( volume->Handle );
+		efSAFE_DELETE( volume );
+	}
+}
+
+bool FileWatcherUSN::readJournal( VolumeUSN* volume ) {
+	memset( &volume->Overlapped, 0, sizeof( volume->Overlapped ) );
+
+	volume->Read.StartUsn = volume->NextUsn;
+	volume->Read.ReasonMask = USN_REASONS;
+	volume->Read.ReturnOnlyOnClose = FALSE;
+	volume->Read.Timeout = 0;
+	/// Completes once there's any record to read
+	volume->Read.BytesToWaitFor = 1;
+	volume->Read.UsnJournalID = volume->JournalID;
+	volume->ReadFrom = volume->NextUsn;
+
+	BOOL res = DeviceIoControl( volume->Handle, FSCTL_READ_USN_JOURNAL, &volume->Read,
+								sizeof( volume->Read ), volume->Buffer.data(),
+								static_cast<DWORD>( volume->Buffer.size() ), NULL,
+								&volume->Overlapped );
+
+	if ( !res && ERROR_IO_PENDING != GetLastError() ) {
+		efDEBUG( "Error reading the USN journal of %s: %lu\n", volume->Name.c_str(),
+				 GetLastError() );
+		return false;
+	}
+
+	/// Even completed at once, the completion is queued to the port
+	volume->Pending = true;
+	return true;
+}
+
+WatchID FileWatcherUSN::delegateWatch( WatcherUSN* watch,
+									   const std::vector<WatcherOption>& options ) {
+	if ( NULL == mWin32 ) {
+		mWin32 = new FileWatcherWin32( mFileWatcher );
+
+		if ( !mWin32->initOK() ) {
+			efSAFE_DELETE( mWin32 );
+			return Errors::Log::createLastError( Errors::WatcherFailed, watch->Directory );
+		}
+
+		if ( NULL != mThread ) {
+			mWin32->watch();
+		}
+	}
+
+	/// The watcher is the listener of the Win32 watch, it forwards the events with its own id.
+	/// The options ( interests, buffer size ) are applied by Win32.
+	WatchID id = mWin32->addWatch( watch->Directory, watch, watch->Recursive, options );
+
+	if ( id > 0 ) {
+		watch->Win32ID = id;
+		/// The counters are the ones of the Win32 watch doing the work
+		watch->Counters = mWin32->getCounters( id );
+	}
+
+	return id;
+}
+
+void FileWatcherUSN::removeWatchLocked( WatcherUSN* watch ) {
+	mWatches.erase( watch->ID );
+	mWatchRegistry.remove( watch->ID );
+
+	if ( watch->isDelegated() ) {
+		mWin32->removeWatch( watch->Win32ID );
+	} else {
+		removeVolumeLocked( watch->Volume );
+	}
+
+	efDEBUG( "Removed watch %s with id: %ld\n", watch->Directory.c_str(), watch->ID );
+
+	efSAFE_DELETE( watch );
+}
+
+void FileWatcherUSN::removeWatch( const std::string& directory ) {
+	if ( !mInitOK )
+		return;
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	Watcher* watch = mWatchRegistry.find( directory );
+
+	if ( NULL == watch ) {
+		std::string realDir( realDirectory( directory ) );
+
+		if ( !realDir.empty() ) {
+			watch = mWatchRegistry.find( realDir );
+		}
+	}
+
+	if ( NULL != watch ) {
+		removeWatchLocked( static_cast<WatcherUSN*>( watch ) );
+	}
+}
+
+void FileWatcherUSN::removeWatch( WatchID watchid ) {
+	if ( !mInitOK )
+		return;
+
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	WatchMap::iterator it = mWatches.find( watchid );
+
+	if ( it != mWatches.end() ) {
+		removeWatchLocked( it->second );
+	}
+}
+
+bool FileWatcherUSN::expandWatch( WatchID watchid, const std::string& directory ) {
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		WatchMap::iterator it = mWatches.find( watchid );
+
+		/// The delegated watches are scoped by Win32
+		if ( it != mWatches.end() && it->second->isDelegated() )
+			return mWin32->expandWatch( it->second->Win32ID, directory );
+	}
+
+	return FileWatcherImpl::expandWatch( watchid, directory );
+}
+
+bool FileWatcherUSN::collapseWatch( WatchID watchid, const std::string& directory ) {
+	{
+		Lock initLock( mInitLock );
+		Lock lock( mWatchesLock );
+
+		WatchMap::iterator it = mWatches.find( watchid );
+
+		if ( it != mWatches.end() && it->second->isDelegated() )
+			return mWin32->collapseWatch( it->second->Win32ID, directory );
+	}
+
+	return FileWatcherImpl::collapseWatch( watchid, directory );
+}
+
+void FileWatcherUSN::watch() {
+	if ( NULL == mThread ) {
+		mThread = new Thread( [this] { run(); } );
+		mThread->launch();
+
+		Lock initLock( mInitLock );
+
+		if ( NULL != mWin32 ) {
+			mWin32->watch();
+		}
+	}
+}
+
+void FileWatcherUSN::poll() {
+	if ( NULL != mThread || !mInitOK )
+		return;
+
+	DWORD numOfBytes = 0;
+	OVERLAPPED* ov = NULL;
+	ULONG_PTR compKey = 0;
+	BOOL res;
+
+	/// Handles the reads already completed, without waiting for more
+	while ( ( res = GetQueuedCompletionStatus( mIOCP, &numOfBytes, &compKey, &ov, 0 ) ) !=
+				FALSE ||
+			NULL != ov ) {
+		handleCompletion( reinterpret_cast<VolumeUSN*>( ov ), numOfBytes,
+						  FALSE != res ? 0 : GetLastError() );
+		ov = NULL;
+	}
+
+	if ( NULL != mWin32 ) {
+		mWin32->poll();
+	}
+}
+
+void FileWatcherUSN::run() {
+	for ( ;; ) {
+		DWORD numOfBytes = 0;
+		OVERLAPPED* ov = NULL;
+		ULONG_PTR compKey = 0;
+
+		/// The reads cancelled fail, but still have to be handled to free their volume
+		BOOL res = GetQueuedCompletionStatus( mIOCP, &numOfBytes, &compKey, &ov, INFINITE );
+
+		if ( compKey != 0 && compKey == reinterpret_cast<ULONG_PTR>( this ) )
+			break;
+
+		if ( NULL != ov ) {
+			handleCompletion( reinterpret_cast<VolumeUSN*>( ov ), numOfBytes,
+							  FALSE != res ? 0 : GetLastError() );
+		} else if ( FALSE == res ) {
+			break;
+		}
+	}
+}
+
+Uint64 FileWatcherUSN::getEventId( WatchID watchid ) {
+	Lock initLock( mInitLock );
+	Lock lock( mWatchesLock );
+
+	WatchMap::iterator it = mWatches.find( watchid );
+
+	if ( it == mWatches.end() || NULL == it->second->Volume )
+		return 0;
+
+	return std::max( it->second->SinceUsn, it->second->Volume->NextUsn );
+}
+
+void FileWatcherUSN::handleCompletion( VolumeUSN* volume, DWORD bytes, DWORD error ) {
+	Lock initLock( mInitLock );
+
+	volume->Pending = false;
+
+	if ( volume->Closing ) {
+		Lock lock( mWatchesLock );
+
+		mClosing.erase( std::remove( mClosing.begin(), mClosing.end(), volume ), mClosing.end() );
+		CloseHandle( volume->Handle );
+		efSAFE_DELETE( volume );
+		return;
+	}
+
+	if ( 0 == error ) {
+		/// Rewound by a watch started from an older USN meanwhile, the records are read again
+		if ( volume->ReadFrom == volume->NextUsn && bytes >= sizeof( USN ) ) {
+			readRecords( volume, bytes );
+		}
+	} else if ( ERROR_JOURNAL_ENTRY_DELETED == error ) {
+		/// The journal wrapped around before the records were read
+		USN_JOURNAL_DATA_V0 data;
+
+		notifyWatches( volume, Actions::Overflow, false );
+
+		if ( !queryJournal( volume->Handle, data ) ) {
+			mBatch.flush();
+			return;
+		}
+
+		volume->NextUsn = data.FirstUsn;
+	} else if ( ERROR_OPERATION_ABORTED != error ) {
+		efDEBUG( "Error reading the USN journal of %s: %lu\n", volume->Name.c_str(), error );
+
+		/// The journal was deleted or recreated, its watches don't receive anything else
+		notifyWatches( volume, Actions::Overflow, false );
+		mBatch.flush();
+		return;
+	}
+
+	mBatch.flush();
+
+	if ( mInitOK && !readJournal( volume ) ) {
+		notifyWatches( volume, Actions::Overflow, false );
+		mBatch.flush();
+	}
+}
+
+void FileWatcherUSN::readRecords( VolumeUSN* volume, DWORD bytes ) {
+	const BYTE* buffer = volume->Buffer.data();
+	USN next;
+
+	memcpy( &next, buffer, sizeof( next ) );
+
+	DWORD offset = sizeof( USN );
+
+	while ( offset + offsetof( USN_RECORD_V2, FileName ) <= bytes && mInitOK ) {
+		const USN_RECORD_V2* record = (const USN_RECORD_V2*)( buffer + offset );
+
+		if ( 0 == record->RecordLength || offset + record->RecordLength > bytes )
+			break;
+
+		offset += record->RecordLength;
+
+		if ( 2 == record->MajorVersion ) {
+			handleRecord( volume, record );
+		}
+	}
+
+	volume->NextUsn = next;
+
+	notifyWatches( volume, Actions::HistoryDone, true );
+}
+
+void FileWatcherUSN::handleRecord( VolumeUSN* volume, const USN_RECORD_V2* record ) {
+	Uint64 file = record->FileReferenceNumber;
+	Uint64 usn = record->Usn;
+	Uint32 reason = record->Reason;
+	bool isDir = 0 != ( record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY );
+
+	/// Only the reasons new since the previous record of the file are handled
+	Uint32 fresh = reason;
+	std::unordered_map<Uint64, Uint32>::iterator it = volume->Reasons.find( file );
+
+	if ( it != volume->Reasons.end() ) {
+		fresh &= ~it->second;
+
+		if ( reason & USN_REASON_CLOSE ) {
+			volume->Reasons.erase( it );
+		} else {
+			it->second = reason;
+		}
+	} else if ( !( reason & USN_REASON_CLOSE ) ) {
+		if ( volume->Reasons.size() >= OPEN_FILES_MAX ) {
+			volume->Reasons.clear();
+		}
+
+		volume->Reasons[file] = reason;
+	}
+
+	/// The new name of a rename is the next record of the file, otherwise it was lost
+	if ( volume->RenamePending &&
+		 !( ( fresh & USN_REASON_RENAME_NEW_NAME ) && volume->RenameFile == file ) ) {
+		volume->RenamePending = false;
+		handleMove( volume, usn, volume->RenameDir, volume->RenameName, "", "" );
+	}
+
+	const WCHAR* fileName = (const WCHAR*)( (const BYTE*)record + record->FileNameOffset );
+	int fileNameLength = record->FileNameLength / sizeof( WCHAR );
+
+	/// Converted in one pass into the buffer kept for the names
+	String::wideToUtf8( fileName, fileNameLength, mName );
+
+	if ( mName.empty() )
+		return;
+
+	/// Outside of the reachable directories the records are only used to keep the cache
+	resolveDirectory( volume, record->ParentFileReferenceNumber, mDirectory );
+
+	if ( isDir && ( fresh & ( USN_REASON_RENAME_OLD_NAME | USN_REASON_FILE_DELETE ) ) ) {
+		invalidateDirectory( volume, file,
+							 mDirectory.empty() ? mDirectory
+												: mDirectory + mName + FileSystem::getOSSlash() );
+	}
+
+	if ( fresh & USN_REASON_FILE_CREATE ) {
+		dispatch( volume, usn, mDirectory, mName, Actions::Add );
+	}
+
+	if ( fresh & USN_DATA_REASONS ) {
+		dispatch( volume, usn, mDirectory, mName, Actions::Modified, "",
+				  Interests::ContentModified );
+	}
+
+	if ( ( reason & USN_REASON_CLOSE ) && ( reason & USN_DATA_REASONS ) ) {
+		dispatch( volume, usn, mDirectory, mName, Actions::Modified, "",
+				  Interests::ContentClosed );
+	}
+
+	if ( fresh & USN_ATTRIBUTE_REASONS ) {
+		dispatch( volume, usn, mDirectory, mName, Actions::Modified, "", Interests::Attributes );
+	}
+
+	if ( fresh & USN_REASON_RENAME_OLD_NAME ) {
+		volume->RenamePending = true;
+		volume->RenameIsDir = isDir;
+		volume->RenameFile = file;
+		volume->RenameDir = mDirectory;
+		volume->RenameName = mName;
+	}
+
+	if ( fresh & USN_REASON_RENAME_NEW_NAME ) {
+		if ( volume->RenamePending ) {
+			volume->RenamePending = false;
+			handleMove( volume, usn, volume->RenameDir, volume->RenameName, mDirectory, mName );
+		} else {
+			handleMove( volume, usn, "", "", mDirectory, mName );
+		}
+	}
+
+	if ( fresh & USN_REASON_FILE_DELETE ) {
+		dispatch( volume, usn, mDirectory, mName, Actions::Delete );
+	}
+}
+
+void FileWatcherUSN::handleMove( VolumeUSN* volume, Uint64 usn, const std::string& oldDir,
+								 const std::string& oldName, const std::string& dir,
+								 const std::string& name ) {
+	if ( !oldDir.empty() && oldDir == dir ) {
+		dispatch( volume, usn, dir, name, Actions::Moved, oldName );
+		return;
+	}
+
+	/// Moved between directories, or from / to outside the reachable ones
+	if ( !oldDir.empty() ) {
+		dispatch( volume, usn, oldDir, oldName, Actions::Delete );
+	}
+
+	if ( !dir.empty() ) {
+		dispatch( volume, usn, dir, name, Actions::Add );
+		dispatch( volume, usn, dir, name, Actions::Modified );
+	}
+}
+
+bool FileWatcherUSN::resolveDirectory( VolumeUSN* volume, Uint64 reference, std::string& path ) {
+	std::unordered_map<Uint64, std::string>::iterator it = volume->Directories.find( reference );
+
+	if ( it != volume->Directories.end() ) {
+		path.assign( it->second );
+		return true;
+	}
+
+	FILE_ID_DESCRIPTOR id;
+	memset( &id, 0, sizeof( id ) );
+	id.dwSize = sizeof( id );
+	id.Type = FileIdType;
+	id.FileId.QuadPart = reference;
+
+	HANDLE handle = OpenFileById( volume->Handle, &id, 0,
+								  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+								  FILE_FLAG_BACKUP_SEMANTICS );
+
+	/// A directory deleted meanwhile can't be reached anymore
+	if ( INVALID_HANDLE_VALUE == handle ) {
+		path.clear();
+		return false;
+	}
+
+	path = finalPath( handle );
+
+	CloseHandle( handle );
+
+	if ( path.empty() )
+		return false;
+
+	if ( volume->Directories.size() >= DIRECTORY_CACHE_MAX ) {
+		volume->Directories.clear();
+	}
+
+	volume->Directories[reference] = path;
+
+	return true;
+}
+
+void FileWatcherUSN::invalidateDirectory( VolumeUSN* volume, Uint64 reference,
+										  const std::string& path ) {
+	volume->Directories.erase( reference );
+
+	if ( path.empty() )
+		return;
+
+	for ( std::unordered_map<Uint64, std::string>::iterator it = volume->Directories.begin();
+		  it != volume->Directories.end(); ) {
+		if ( 0 == it->second.compare( 0, path.size(), path ) ) {
+			it = volume->Directories.erase( it );
+		} else {
+			++it;
+		}
+	}
+}
+
+void FileWatcherUSN::dispatch( VolumeUSN* volume, Uint64 usn, const std::string& dir,
+							   const std::string& filename, Action action,
+							   const std::string& oldFilename, int interests ) {
+	if ( dir.empty() )
+		return;
+
+	size_t len = dir.size();
+
+	/// The volume records are filtered down to the watches containing the directory
+	while ( len > 0 && mInitOK ) {
+		mLookupDirectory.assign( dir, 0, len );
+
+		WatcherUSN* watch = static_cast<WatcherUSN*>( mWatchRegistry.find( mLookupDirectory ) );
+
+		if ( NULL != watch && watch->Volume == volume && usn >= watch->SinceUsn &&
+			 NULL != watch->Listener ) {
+			WatchCounters::add( watch->Counters->Received );
+
+			bool accepted =
+				0 != interests ? watch->acceptsInterests( interests ) : watch->accepts( action );
+
+			if ( accepted ) {
+				/// The directory is reported as watched, not as the real path
+				mEventDirectory.assign( watch->Directory );
+				mEventDirectory.append( dir, len, std::string::npos );
+
+				if ( watch->matches( mEventDirectory, filename, oldFilename ) ) {
+					mBatch.add( watch->Listener, watch->ID, mEventDirectory, filename, action,
+								oldFilename );
+				}
+			}
+		}
+
+		size_t slash = len >= 2 ? dir.find_last_of( FileSystem::getOSSlash(), len - 2 )
+								: std::string::npos;
+
+		len = std::string::npos != slash ? slash + 1 : 0;
+	}
+}
+
+void FileWatcherUSN::notifyWatches( VolumeUSN* volume, Action action, bool historyOnly ) {
+	std::vector<Watcher*> watches = mWatchRegistry.watches();
+
+	for ( size_t i = 0; i < watches.size(); i++ ) {
+		WatcherUSN* watch = static_cast<WatcherUSN*>( watches[i] );
+
+		if ( watch->Volume != volume || NULL == watch->Listener )
+			continue;
+
+		if ( historyOnly ) {
+			if ( !watch->ReportHistory || volume->NextUsn < watch->HistoryEnd )
+				continue;
+
+			watch->ReportHistory = false;
+		}
+
+		mBatch.add( watch->Listener, watch->ID, watch->Directory, "", action );
+	}
+}
+
+void FileWatcherUSN::handleAction( Watcher* watch, const std::string& filename,
+								   unsigned long action, std::string oldFilename ) {
+	/// The events are dispatched by directory, so the action is relative to the watch root
+	if ( NULL != watch && NULL != watch->Listener ) {
+		EventBatch::send( watch->Listener, watch->ID, watch->Directory, filename, (Action)action,
+						  oldFilename );
+	}
+}
+
+std::vector<std::string> FileWatcherUSN::directories() {
+	return mWatchRegistry.directories();
+}
+
+bool FileWatcherUSN::pathInWatches( const std::string& path ) {
+	if ( NULL != mWatchRegistry.find( path ) )
+		return true;
+
+	std::string realDir( realDirectory( path ) );
+
+	return !realDir.empty() && NULL != mWatchRegistry.find( realDir );
+}
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef EFSW_FILEWATCHERUSN_HPP
+#define EFSW_FILEWATCHERUSN_HPP
+
+#include <efsw/EventBatch.hpp>
+#include <efsw/FileWatcherImpl.hpp>
+
+#if EFSW_PLATFORM == EFSW_PLATFORM_WIN32 && !defined( EFSW_NO_USN )
+#define EFSW_USN
+#endif
+
+#ifdef EFSW_USN
+
+#include <efsw/WatcherUSN.hpp>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <winioctl.h>
+
+namespace efsw {
+
+class FileWatcherWin32;
+
+/// A volume whose change journal is read
+struct VolumeUSN {
+	/// The journal is read with overlapped requests completed on the port of the watcher
+	OVERLAPPED Overlapped;
+	HANDLE Handle;
+	/// The volume GUID path, its key in the volumes map
+	std::string Name;
+	Uint64 JournalID;
+	/// The USN of the next record to read, and the one the pending read started from
+	Uint64 NextUsn;
+	Uint64 ReadFrom;
+	/// The request of the pending read, it must outlive it
+	READ_USN_JOURNAL_DATA_V0 Read;
+	/// Number of watches in the volume
+	int Count;
+	/// If a read is pending
+	bool Pending;
+	/// Set once no watch uses the volume, it's freed when its pending read completes
+	bool Closing;
+	std::vector<BYTE> Buffer;
+	/// Directory paths indexed by their file reference number
+	std::unordered_map<Uint64, std::string> Directories;
+	/// The reasons already handled of the files still open, the records of a file accumulate
+	/// the reasons until it's closed
+	std::unordered_map<Uint64, Uint32> Reasons;
+	/// The old name of the file being renamed, until the record of its new name is read
+	bool RenamePending;
+	bool RenameIsDir;
+	Uint64 RenameFile;
+	std::string RenameDir;
+	std::string RenameName;
+};
+
+/// Implementation for Windows based on the NTFS change journal. The journal of a volume reports
+/// the changes of all of it, so recursive watches cost no handle or buffer per watched tree,
+/// and it keeps the changes made while the watcher wasn't running ( see Options::UsnSinceId ).
+/// The records carry the file reference number of the parent directory, resolved to its path
+/// through a cache, and are filtered down to the watched trees.
+/// Reading the journal needs an elevated process. Non recursive watches and the volumes
+/// without journal ( FAT, network shares, ReFS... ) are delegated to the Win32 backend.
+/// @class FileWatcherUSN
+class FileWatcherUSN : public FileWatcherImpl {
+  public:
+	typedef std::map<WatchID, WatcherUSN*> WatchMap;
+
+	FileWatcherUSN( FileWatcher* parent );
+
+	virtual ~FileWatcherUSN();
+
+	/// Add a directory watch
+	/// On error returns WatchID with Error type.
+	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
+					  const std::vector<WatcherOption>& options ) override;
+
+	/// Remove a directory watch. This is a hash lookup O(1).
+	void removeWatch( const std::string& directory ) override;
+
+	/// Remove a directory watch. This is a map lookup O(logn).
+	void removeWatch( WatchID watchid ) override;
+
+	/// Updates the watcher. Must be called often.
+	void watch() override;
+
+	/// Handles the action
+	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
+					   std::string oldFilename = "" ) override;
+
+	/// @return Returns a list of the directories that are being watched
+	std::vector<std::string> directories() override;
+
+	/// Handles the records already read without blocking, when watch() wasn't called
+	void poll() override;
+
+	/// @return The USN to resume the watch from with Options::UsnSinceId
+	Uint64 getEventId( WatchID watchid ) override;
+
+	/// Changes the scope of the watch, the one of Win32 for a delegated watch
+	bool expandWatch( WatchID watchid, const std::string& directory ) override;
+
+	bool collapseWatch( WatchID watchid, const std::string& directory ) override;
+
+  protected:
+	/// Map of WatchID to WatchStruct pointers
+	WatchMap mWatches;
+
+	/// The volumes being read indexed by their name
+	std::map<std::string, VolumeUSN*> mVolumes;
+
+	/// The volumes no watch uses anymore, waiting for their read to complete
+	std::vector<VolumeUSN*> mClosing;
+
+	/// Buffers reused while reading the records so the steady state doesn't allocate: the name
+	/// converted, its directory, the directory prefix searched in the registry and the directory
+	/// reported
+	std::string mName;
+	std::string mDirectory;
+	std::string mLookupDirectory;
+	std::string mEventDirectory;
+
+	/// Events queued for delivery, flushed once per read buffer ( guarded by mInitLock )
+	EventBatch mBatch;
+
+	/// Backend serving the delegated watches, created on demand
+	FileWatcherWin32* mWin32;
+
+	/// The completion port of the journal reads
+	HANDLE mIOCP;
+
+	/// The last watchid
+	WatchID mLastWatchID;
+
+	Thread* mThread;
+
+	/// Held while dispatching events, so no event is delivered after removeWatch returns
+	Mutex mInitLock;
+	Mutex mWatchesLock;
+
+	bool pathInWatches( const std::string& path ) override;
+
+  private:
+	void run();
+
+	/// Handles a journal read completed, then reads the next records
+	/// @param error The error of the read, 0 if it succeeded
+	void handleCompletion( VolumeUSN* volume, DWORD bytes, DWORD error );
+
+	/// Opens the volume of the directory, or references the one already read
+	/// @param since The USN the watch starts from if hasSince, the journal is read again from it
+	/// if older
+	/// @return The volume, NULL if its journal can't be read
+	VolumeUSN* addVolume( const std::string& directory, WatcherUSN* watch, bool hasSince,
+						  Uint64 since );
+
+	/// Unreferences the volume, stopping its reads when no watch uses it. The watch must be
+	/// already out of the watches map.
+	void removeVolumeLocked( VolumeUSN* volume );
+
+	/// Requests the next records of the journal
+	/// @return False if the journal can't be read
+	bool readJournal( VolumeUSN* volume );
+
+	/// Dispatches the records of a completed read
+	void readRecords( VolumeUSN* volume, DWORD bytes );
+
+	/// Dispatches the reasons of a record not handled by the previous records of its file
+	void handleRecord( VolumeUSN* volume, const USN_RECORD_V2* record );
+
+	/// Watches the directory through Win32 with the options of the watch
+	WatchID delegateWatch( WatcherUSN* watch, const std::vector<WatcherOption>& options );
+
+	/// Removes the watcher from the indexes and deletes it
+	void removeWatchLocked( WatcherUSN* watch );
+
+	/// Resolves the path of a directory by its file reference number into path, ending with a
+	/// backslash ( empty if it's unreachable )
+	/// @return True if the directory was resolved
+	bool resolveDirectory( VolumeUSN* volume, Uint64 reference, std::string& path );
+
+	/// Drops the cached paths of a directory and its subdirectories after it's moved or deleted
+	void invalidateDirectory( VolumeUSN* volume, Uint64 reference, const std::string& path );
+
+	/// Emits a move, as a Moved inside the same directory or as a Delete / Add pair otherwise.
+	/// The old or the new directory is empty if it's unknown.
+	void handleMove( VolumeUSN* volume, Uint64 usn, const std::string& oldDir,
+					 const std::string& oldName, const std::string& dir, const std::string& name );
+
+	/// Queues the event for every watch of the volume containing the directory, interested in
+	/// it and started before the record, holding mInitLock
+	/// @param interests The interests the event is reported for, deduced from the action if 0
+	void dispatch( VolumeUSN* volume, Uint64 usn, const std::string& dir,
+				   const std::string& filename, Action action,
+				   const std::string& oldFilename = "", int interests = 0 );
+
+	/// Queues a notice with an empty filename for the watches of the volume, holding mInitLock
+	/// @param historyOnly Only for the watches whose history was replayed up to the next record
+	void notifyWatches( VolumeUSN* volume, Action action, bool historyOnly );
+};
+
+} // namespace efsw
+
+#endif
+
+#endif
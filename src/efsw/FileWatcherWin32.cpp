@@ -6,11 +6,33 @@
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
 
+#include <algorithm>
+
 namespace efsw {
 
+/// @return The FILE_NOTIFY_CHANGE_* flags requested for a watch with the interests
+static DWORD notifyFilterFromInterests( int interests ) {
+	DWORD filter = 0;
+
+	if ( interests & ( Interests::Created | Interests::Deleted | Interests::Moved ) )
+		filter |= FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME;
+
+	/// Windows doesn't tell the writes from the handles closed after writing
+	if ( interests & ( Interests::ContentClosed | Interests::ContentModified ) )
+		filter |= FILE_NOTIFY_CHANGE_CREATION | FILE_NOTIFY_CHANGE_LAST_WRITE |
+				  FILE_NOTIFY_CHANGE_SIZE;
+
+	if ( interests & Interests::Attributes )
+		filter |= FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SECURITY;
+
+	/// The filter can't be empty
+	return 0 != filter ? filter : FILE_NOTIFY_CHANGE_DIR_NAME;
+}
+
 FileWatcherWin32::FileWatcherWin32( FileWatcher* parent ) :
-	FileWatcherImpl( parent ), mLastWatchID( 0 ), mThread( NULL ) {
-	mIOCP = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+	FileWatcherImpl( parent ), mLastWatchID( 0 ), mThreadCount( 1 ), mWatching( false ) {
+	/// The concurrency is bounded by the threads started
+	mIOCP = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 0 );
 	if ( mIOCP && mIOCP != INVALID_HANDLE_VALUE )
 		mInitOK = true;
 }
@@ -19,10 +41,17 @@ FileWatcherWin32::~FileWatcherWin32() {
 	mInitOK = false;
 
 	if ( mIOCP && mIOCP != INVALID_HANDLE_VALUE ) {
-		PostQueuedCompletionStatus( mIOCP, 0, reinterpret_cast<ULONG_PTR>( this ), NULL );
+		/// One stop per thread, each one leaves after taking one
+		for ( size_t i = 0; i < mThreads.size(); i++ ) {
+			PostQueuedCompletionStatus( mIOCP, 0, reinterpret_cast<ULONG_PTR>( this ), NULL );
+		}
+	}
+
+	for ( size_t i = 0; i < mThreads.size(); i++ ) {
+		efSAFE_DELETE( mThreads[i] );
 	}
 
-	efSAFE_DELETE( mThread );
+	mThreads.clear();
 
 	removeAllWatches();
 
@@ -51,13 +80,19 @@ WatchID FileWatcherWin32::addWatch( const std::string& directory, FileWatchListe
 
 	WatchID watchid = ++mLastWatchID;
 
+	mThreadCount = std::max<size_t>(
+		mThreadCount, std::max( 1, getOptionValue( options, Options::WinCompletionThreads, 1 ) ) );
+
+	if ( mWatching ) {
+		startThreads();
+	}
+
 	DWORD bufferSize = static_cast<DWORD>( getOptionValue(options, Option::WinBufferSize, 63 * 1024) );
+	int interests = getEventInterests( options );
 	DWORD notifyFilter = static_cast<DWORD>( getOptionValue(options, Option::WinNotifyFilter,
-		FILE_NOTIFY_CHANGE_CREATION | FILE_NOTIFY_CHANGE_LAST_WRITE |
-		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
-		FILE_NOTIFY_CHANGE_SIZE) );
+		notifyFilterFromInterests( interests ) ) );
 
-	WatcherStructWin32* watch = CreateWatch( String::fromUtf8( dir ).toWideString().c_str(),
+	WatcherStructWin32* watch = CreateWatch( String::utf8ToWide( dir ).c_str(),
 											 recursive, bufferSize, notifyFilter, mIOCP );
 
 	if ( NULL == watch ) {
@@ -68,52 +103,72 @@ WatchID FileWatcherWin32::addWatch( const std::string& directory, FileWatchListe
 	watch->Watch->ID = watchid;
 	watch->Watch->Watch = this;
 	watch->Watch->Listener = watcher;
+	watch->Watch->EventInterests = interests;
+	watch->Watch->Filter = PathFilter::create( dir, options );
 	watch->Watch->DirName = new char[dir.length() + 1];
 	strcpy( watch->Watch->DirName, dir.c_str() );
 
+	if ( 0 != getOptionValue( options, Options::WinOverflowResync, 1 ) ) {
+		WatcherGeneric* resync = new WatcherGeneric( watchid, dir, watcher, this, recursive );
+		resync->EventInterests = interests;
+		resync->Filter = watch->Watch->Filter;
+		resync->Counters = watch->Watch->Counters;
+		resync->init();
+		watch->Watch->Resync = resync;
+	}
+
+	/// Only read once set up, the completions are handled without holding the watches lock
+	if ( !StartWatch( watch ) ) {
+		FreeWatch( watch );
+		return Errors::Log::createLastError( Errors::FileNotFound, dir );
+	}
+
+	/// The directory handle
+	WatchCounters::add( watch->Watch->Counters->KernelWatches );
+
 	mWatches.insert( watch );
+	mWatchRegistry.add( watch->Watch, dir );
 
 	return watchid;
 }
 
 void FileWatcherWin32::removeWatch( const std::string& directory ) {
-	Lock lock( mWatchesLock );
+	Watcher* watch = mWatchRegistry.find( directory );
 
-	Watches::iterator iter = mWatches.begin();
-
-	for ( ; iter != mWatches.end(); ++iter ) {
-		if ( directory == ( *iter )->Watch->DirName ) {
-			removeWatch( *iter );
-			break;
-		}
+	if ( NULL != watch ) {
+		removeWatch( watch->ID );
 	}
 }
 
 void FileWatcherWin32::removeWatch( WatchID watchid ) {
 	Lock lock( mWatchesLock );
 
-	Watches::iterator iter = mWatches.begin();
+	WatcherWin32* watch = static_cast<WatcherWin32*>( mWatchRegistry.find( watchid ) );
 
-	for ( ; iter != mWatches.end(); ++iter ) {
-		// Find the watch ID
-		if ( ( *iter )->Watch->ID == watchid ) {
-			removeWatch( *iter );
-			return;
-		}
+	if ( NULL != watch ) {
+		removeWatch( watch->Struct );
 	}
 }
 
 void FileWatcherWin32::removeWatch( WatcherStructWin32* watch ) {
-	Lock lock( mWatchesLock );
-
-	DestroyWatch( watch );
+	mWatchRegistry.remove( watch->Watch->ID );
 	mWatches.erase( watch );
+	DestroyWatch( watch );
 }
 
 void FileWatcherWin32::watch() {
-	if ( NULL == mThread ) {
-		mThread = new Thread([this]{run();});
-		mThread->launch();
+	Lock lock( mWatchesLock );
+
+	mWatching = true;
+
+	startThreads();
+}
+
+void FileWatcherWin32::startThreads() {
+	while ( mThreads.size() < mThreadCount ) {
+		Thread* thread = new Thread( [this] { run(); } );
+		mThreads.push_back( thread );
+		thread->launch();
 	}
 }
 
@@ -122,67 +177,98 @@ void FileWatcherWin32::removeAllWatches() {
 
 	Watches::iterator iter = mWatches.begin();
 
+	/// No thread handles the completions anymore
 	for ( ; iter != mWatches.end(); ++iter ) {
-		DestroyWatch( ( *iter ) );
+		FreeWatch( ( *iter ) );
 	}
 
 	mWatches.clear();
+	mWatchRegistry.clear();
 }
 
 void FileWatcherWin32::run() {
-	do {
-		if ( mInitOK && !mWatches.empty() ) {
-			DWORD numOfBytes = 0;
-			OVERLAPPED* ov = NULL;
-			ULONG_PTR compKey = 0;
-			BOOL res = FALSE;
-
-			while ( ( res = GetQueuedCompletionStatus( mIOCP, &numOfBytes, &compKey, &ov,
-													   INFINITE ) ) != FALSE ) {
-				if ( compKey != 0 && compKey == reinterpret_cast<ULONG_PTR>( this ) ) {
-					break;
-				} else {
-					Lock lock( mWatchesLock );
-					WatchCallback( numOfBytes, ov );
-				}
-			}
-		} else {
-			System::sleep( 10 );
+	for ( ;; ) {
+		DWORD numOfBytes = 0;
+		OVERLAPPED* ov = NULL;
+		ULONG_PTR compKey = 0;
+
+		/// The notifications cancelled fail, but still have to be handled to free their watch
+		BOOL res = GetQueuedCompletionStatus( mIOCP, &numOfBytes, &compKey, &ov, INFINITE );
+
+		if ( compKey != 0 && compKey == reinterpret_cast<ULONG_PTR>( this ) )
+			break;
+
+		if ( NULL != ov ) {
+			CompleteWatch( numOfBytes, ov, FALSE != res );
+		} else if ( FALSE == res ) {
+			break;
 		}
-	} while ( mInitOK );
+	}
+}
 
-	removeAllWatches();
+void FileWatcherWin32::poll() {
+	if ( mWatching || !mInitOK )
+		return;
+
+	DWORD numOfBytes = 0;
+	OVERLAPPED* ov = NULL;
+	ULONG_PTR compKey = 0;
+	BOOL res;
+
+	/// Handles the notifications already completed, without waiting for more
+	while ( ( res = GetQueuedCompletionStatus( mIOCP, &numOfBytes, &compKey, &ov, 0 ) ) !=
+				FALSE ||
+			NULL != ov ) {
+		if ( compKey != 0 && compKey == reinterpret_cast<ULONG_PTR>( this ) )
+			continue;
+
+		CompleteWatch( numOfBytes, ov, FALSE != res );
+		ov = NULL;
+	}
 }
 
 void FileWatcherWin32::handleAction( Watcher* watch, const std::string& filename,
 									 unsigned long action, std::string /*oldFilename*/ ) {
 	Action fwAction;
 
+	WatchCounters::add( watch->Counters->Received );
+
 	switch ( action ) {
 		case FILE_ACTION_RENAMED_OLD_NAME:
 			watch->OldFileName = filename;
+			static_cast<WatcherWin32*>( watch )->OldFileId =
+				static_cast<WatcherWin32*>( watch )->EntryInfo
+					? static_cast<WatcherWin32*>( watch )->EntryId
+					: 0;
 			return;
 		case FILE_ACTION_ADDED:
 			fwAction = Actions::Add;
 			break;
 		case FILE_ACTION_RENAMED_NEW_NAME: {
+			WatcherWin32* wwatch = static_cast<WatcherWin32*>( watch );
+
+			/// The old name of another file, its notification was lost
+			if ( wwatch->EntryInfo && 0 != wwatch->OldFileId &&
+				 wwatch->OldFileId != wwatch->EntryId ) {
+				fwAction = Actions::Add;
+				break;
+			}
+
 			fwAction = Actions::Moved;
 
 			std::string fpath( watch->Directory + filename );
 
 			// Update the directory path
-			if ( watch->Recursive && FileSystem::isDirectory( fpath ) ) {
+			if ( watch->Recursive && ( wwatch->EntryInfo ? wwatch->EntryIsDirectory
+														 : FileSystem::isDirectory( fpath ) ) ) {
 				// Update the new directory path
 				std::string opath( watch->Directory + watch->OldFileName );
 				FileSystem::dirAddSlashAtEnd( opath );
 				FileSystem::dirAddSlashAtEnd( fpath );
 
-				for ( Watches::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-					if ( ( *it )->Watch->Directory == opath ) {
-						( *it )->Watch->Directory = fpath;
-
-						break;
-					}
+				if ( Watcher* moved = mWatchRegistry.find( opath ) ) {
+					moved->Directory = fpath;
+					mWatchRegistry.setDirectory( moved->ID, fpath );
 				}
 			}
 
@@ -199,14 +285,20 @@ void FileWatcherWin32::handleAction( Watcher* watch, const std::string& filename
 				realFilename = filename.substr( sepPos + 1 );
 			}
 
+			if ( !watch->accepts( fwAction ) ||
+				 !watch->matches( static_cast<WatcherWin32*>( watch )->DirName, filename,
+								  watch->OldFileName ) ) {
+				return;
+			}
+
 			if ( folderPath == oldFolderPath ) {
-				watch->Listener->handleFileAction(
-					watch->ID, folderPath, realFilename, fwAction,
+				static_cast<WatcherWin32*>( watch )->Batch.add(
+					watch->Listener, watch->ID, folderPath, realFilename, fwAction,
 					FileSystem::fileNameFromPath( watch->OldFileName ) );
 			} else {
-				watch->Listener->handleFileAction( watch->ID,
-												   static_cast<WatcherWin32*>( watch )->DirName,
-												   filename, fwAction, watch->OldFileName );
+				static_cast<WatcherWin32*>( watch )->Batch.add(
+					watch->Listener, watch->ID, static_cast<WatcherWin32*>( watch )->DirName,
+					filename, fwAction, watch->OldFileName );
 			}
 			return;
 		}
@@ -220,6 +312,12 @@ void FileWatcherWin32::handleAction( Watcher* watch, const std::string& filename
 			return;
 	};
 
+	/// The patterns are matched with the name relative to the watch, as the kernel reported it
+	if ( !watch->accepts( fwAction ) ||
+		 !watch->matches( static_cast<WatcherWin32*>( watch )->DirName, filename ) ) {
+		return;
+	}
+
 	std::string folderPath( static_cast<WatcherWin32*>( watch )->DirName );
 	std::string realFilename = filename;
 	std::size_t sepPos = filename.find_last_of( "/\\" );
@@ -231,33 +329,16 @@ void FileWatcherWin32::handleAction( Watcher* watch, const std::string& filename
 
 	FileSystem::dirAddSlashAtEnd( folderPath );
 
-	watch->Listener->handleFileAction( watch->ID, folderPath, realFilename, fwAction );
+	static_cast<WatcherWin32*>( watch )->Batch.add( watch->Listener, watch->ID, folderPath,
+													realFilename, fwAction );
 }
 
 std::vector<std::string> FileWatcherWin32::directories() {
-	std::vector<std::string> dirs;
-
-	Lock lock( mWatchesLock );
-
-	dirs.reserve( mWatches.size() );
-
-	for ( Watches::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		dirs.push_back( std::string( ( *it )->Watch->DirName ) );
-	}
-
-	return dirs;
+	return mWatchRegistry.directories();
 }
 
 bool FileWatcherWin32::pathInWatches( const std::string& path ) {
-	Lock lock( mWatchesLock );
-
-	for ( Watches::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		if ( ( *it )->Watch->DirName == path ) {
-			return true;
-		}
-	}
-
-	return false;
+	return mWatchRegistry.contains( path );
 }
 
 } // namespace efsw
@@ -28,7 +28,7 @@ class FileWatcherWin32 : public FileWatcherImpl {
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 					  const std::vector<WatcherOption> &options ) override;
 
-	/// Remove a directory watch. This is a brute force lazy search O(nlogn).
+	/// Remove a directory watch. This is a hash lookup O(1).
 	void removeWatch( const std::string& directory ) override;
 
 	/// Remove a directory watch. This is a map lookup O(logn).
@@ -37,6 +37,9 @@ class FileWatcherWin32 : public FileWatcherImpl {
 	/// Updates the watcher. Must be called often.
 	void watch() override;
 
+	/// Handles the notifications completed, when watch() wasn't called
+	void poll() override;
+
 	/// Handles the action
 	void handleAction( Watcher* watch, const std::string& filename, unsigned long action,
 					   std::string oldFilename = "" ) override;
@@ -46,15 +49,27 @@ class FileWatcherWin32 : public FileWatcherImpl {
 
   protected:
 	HANDLE mIOCP;
+	/// Guarded by mWatchesLock, which isn't held while the notifications are handled
 	Watches mWatches;
 
 	/// The last watchid
 	WatchID mLastWatchID;
-	Thread* mThread;
+
+	/// The threads handling the completions, started by watch()
+	std::vector<Thread*> mThreads;
+
+	/// The number of threads asked by the watches, see Options::WinCompletionThreads
+	size_t mThreadCount;
+
+	bool mWatching;
+
 	Mutex mWatchesLock;
 
 	bool pathInWatches( const std::string& path ) override;
 
+	/// Starts the threads missing, with mWatchesLock held
+	void startThreads();
+
 	/// Remove all directory watches.
 	void removeAllWatches();
 
@@ -0,0 +1,196 @@
+#include <efsw/SharedJournal.hpp>
+#include <efsw/efsw.hpp>
+
+namespace efsw {
+
+typedef SharedJournal::Header Header;
+typedef SharedJournal::Record Record;
+
+JournalReader::JournalReader() :
+	mMemory( NULL ),
+	mRing( NULL ),
+	mPaths( NULL ),
+	mRingSize( 0 ),
+	mPathsSize( 0 ),
+	mPosition( 0 ),
+	mSequence( 0 ),
+	mFirst( 0 ) {}
+
+JournalReader::~JournalReader() {
+	close();
+}
+
+bool JournalReader::open( const std::string& name ) {
+	close();
+
+	SharedMemory* memory = new SharedMemory();
+
+	if ( !memory->open( SharedJournal::segmentName( name ) ) ) {
+		efSAFE_DELETE( memory );
+		return false;
+	}
+
+	size_t headerSize = ( sizeof( Header ) + 63 ) & ~(size_t)63;
+	const Header* header = (const Header*)memory->data();
+
+	/// A segment being created, or of another version
+	bool valid = memory->size() >= headerSize && SharedJournal::MAGIC == header->Magic;
+	std::atomic_thread_fence( std::memory_order_acquire );
+
+	if ( !valid || SharedJournal::VERSION != header->Version ||
+		 memory->size() < headerSize + header->RingSize + header->PathsSize ) {
+		efSAFE_DELETE( memory );
+		return false;
+	}
+
+	mMemory = memory;
+	mRing = memory->data() + headerSize;
+	mRingSize = header->RingSize;
+	mPaths = mRing + mRingSize;
+	mPathsSize = header->PathsSize;
+	mSequence = header->Head.load( std::memory_order_acquire );
+	mPosition = mFirst = header->Write.load( std::memory_order_acquire );
+
+	return true;
+}
+
+void JournalReader::close() {
+	efSAFE_DELETE( mMemory );
+	mRing = mPaths = NULL;
+	mRingSize = mPathsSize = 0;
+	mPosition = mSequence = mFirst = 0;
+}
+
+void JournalReader::rewind() {
+	if ( NULL == mMemory )
+		return;
+
+	Header* header = (Header*)mMemory->data();
+
+	mPosition = mFirst = header->Tail.load( std::memory_order_acquire );
+	mSequence = header->TailSequence.load( std::memory_order_acquire );
+}
+
+uint64_t JournalReader::sequence() const {
+	return mSequence;
+}
+
+size_t JournalReader::read( JournalView* events, size_t max ) {
+	if ( NULL == mMemory || 0 == max )
+		return 0;
+
+	Header* header = (Header*)mMemory->data();
+	uint64_t write = header->Write.load( std::memory_order_acquire );
+	size_t count = 0;
+	bool first = true;
+
+	while ( count < max ) {
+		uint64_t tail = header->Tail.load( std::memory_order_acquire );
+
+		/// Overwritten before being read
+		if ( mPosition < tail ) {
+			JournalView& gap = events[count++];
+			gap = JournalView();
+			gap.sequence = mSequence;
+			gap.watchid = 0;
+			gap.action = Actions::Overflow;
+
+			mPosition = tail;
+			mSequence = header->TailSequence.load( std::memory_order_acquire );
+			continue;
+		}
+
+		if ( mPosition >= write )
+			break;
+
+		uint64_t offset = mPosition & ( mRingSize - 1 );
+		const Record* slot = (const Record*)( mRing + offset );
+		Record record = *slot;
+
+		/// The record is only trusted if the tail didn't pass it while it was being read
+		std::atomic_thread_fence( std::memory_order_acquire );
+
+		if ( header->Tail.load( std::memory_order_relaxed ) > mPosition )
+			continue;
+
+		if ( 0 == record.Sequence ) {
+			mPosition += mRingSize - offset;
+			continue;
+		}
+
+		uint64_t inlined =
+			SharedJournal::INLINE_DIRECTORY == record.Directory ? record.DirectoryLength : 0;
+
+		/// Lengths that can't be right mean the ring was corrupted, the rest is dropped
+		if ( record.Size < sizeof( Record ) || record.Size > mRingSize - offset ||
+			 sizeof( Record ) + inlined + record.NameLength + record.OldNameLength >
+				 record.Size ||
+			 ( 0 == inlined && (uint64_t)record.Directory + record.DirectoryLength > mPathsSize ) ) {
+			mPosition = write;
+			break;
+		}
+
+		const char* text = (const char*)( slot + 1 );
+		JournalView& event = events[count++];
+
+		event = JournalView();
+		event.sequence = record.Sequence;
+		event.watchid = (WatchID)record.WatchID;
+		event.action = (Action)record.Action;
+
+		if ( inlined > 0 ) {
+			event.dir = std::string_view( text, record.DirectoryLength );
+			text += inlined;
+		} else {
+			event.dir = std::string_view( mPaths + record.Directory, record.DirectoryLength );
+		}
+
+		event.filename = std::string_view( text, record.NameLength );
+		event.oldFilename = std::string_view( text + record.NameLength, record.OldNameLength );
+
+		if ( first ) {
+			mFirst = mPosition;
+			first = false;
+		}
+
+		mPosition += record.Size;
+		mSequence = record.Sequence + 1;
+	}
+
+	return count;
+}
+
+bool JournalReader::intact() const {
+	if ( NULL == mMemory )
+		return false;
+
+	std::atomic_thread_fence( std::memory_order_acquire );
+
+	return ( (Header*)mMemory->data() )->Tail.load( std::memory_order_relaxed ) <= mFirst;
+}
+
+bool JournalReader::wait( unsigned int milliseconds ) {
+	if ( NULL == mMemory )
+		return false;
+
+	Header* header = (Header*)mMemory->data();
+	Uint32 wakeups = header->Wakeups.load();
+
+	if ( mPosition < header->Write.load() )
+		return true;
+
+	if ( 0 != header->Closed.load() )
+		return false;
+
+	header->Waiters.fetch_add( 1 );
+	SharedMemory::wait( header->Wakeups, wakeups, milliseconds );
+	header->Waiters.fetch_sub( 1 );
+
+	return mPosition < header->Write.load( std::memory_order_acquire );
+}
+
+bool JournalReader::closed() const {
+	return NULL == mMemory || 0 != ( (Header*)mMemory->data() )->Closed.load();
+}
+
+} // namespace efsw
@@ -0,0 +1,101 @@
+#include <efsw/LatencyHistogram.hpp>
+#include <algorithm>
+
+namespace efsw {
+
+LatencyHistogram::LatencyHistogram() : mSum( 0 ), mMin( ~(Uint64)0 ), mMax( 0 ) {
+	for ( size_t i = 0; i < BUCKETS; i++ ) {
+		mBuckets[i].store( 0, std::memory_order_relaxed );
+	}
+}
+
+size_t LatencyHistogram::index( Uint64 value ) {
+	if ( value < 2 * SUB_BUCKETS )
+		return (size_t)value;
+
+	size_t msb = 5;
+
+	while ( 0 != ( value >> ( msb + 1 ) ) ) {
+		msb++;
+	}
+
+	/// The 5 highest bits are kept, the first one is always set
+	size_t shift = msb - 4;
+
+	return ( shift + 1 ) * SUB_BUCKETS + (size_t)( ( value >> shift ) - SUB_BUCKETS );
+}
+
+Uint64 LatencyHistogram::highest( size_t index ) {
+	if ( index < 2 * SUB_BUCKETS )
+		return index;
+
+	size_t shift = index / SUB_BUCKETS - 1;
+	Uint64 sub = index % SUB_BUCKETS + SUB_BUCKETS;
+
+	return ( ( sub + 1 ) << shift ) - 1;
+}
+
+void LatencyHistogram::record( Uint64 value ) {
+	mBuckets[index( value )].fetch_add( 1, std::memory_order_relaxed );
+	mSum.fetch_add( value, std::memory_order_relaxed );
+
+	Uint64 min = mMin.load( std::memory_order_relaxed );
+
+	while ( value < min &&
+			!mMin.compare_exchange_weak( min, value, std::memory_order_relaxed ) ) {
+	}
+
+	Uint64 max = mMax.load( std::memory_order_relaxed );
+
+	while ( value > max &&
+			!mMax.compare_exchange_weak( max, value, std::memory_order_relaxed ) ) {
+	}
+}
+
+Uint64 LatencyHistogram::quantile( const Uint64* buckets, Uint64 count, double q ) const {
+	Uint64 rank = (Uint64)( q * count );
+	Uint64 seen = 0;
+
+	if ( rank >= count ) {
+		rank = count - 1;
+	}
+
+	for ( size_t i = 0; i < BUCKETS; i++ ) {
+		seen += buckets[i];
+
+		if ( seen > rank )
+			return highest( i );
+	}
+
+	return mMax.load( std::memory_order_relaxed );
+}
+
+LatencyStats LatencyHistogram::stats() const {
+	LatencyStats stats = {};
+	Uint64 buckets[BUCKETS];
+	Uint64 count = 0;
+
+	/// The count is taken from the buckets read, so the quantiles are consistent with them
+	for ( size_t i = 0; i < BUCKETS; i++ ) {
+		buckets[i] = mBuckets[i].load( std::memory_order_relaxed );
+		count += buckets[i];
+	}
+
+	if ( 0 == count )
+		return stats;
+
+	Uint64 max = mMax.load( std::memory_order_relaxed );
+
+	stats.count = count;
+	stats.min = mMin.load( std::memory_order_relaxed ) / 1000;
+	stats.max = max / 1000;
+	stats.mean = mSum.load( std::memory_order_relaxed ) / count / 1000;
+	stats.p50 = std::min( quantile( buckets, count, 0.5 ), max ) / 1000;
+	stats.p90 = std::min( quantile( buckets, count, 0.9 ), max ) / 1000;
+	stats.p99 = std::min( quantile( buckets, count, 0.99 ), max ) / 1000;
+	stats.p999 = std::min( quantile( buckets, count, 0.999 ), max ) / 1000;
+
+	return stats;
+}
+
+} // namespace efsw
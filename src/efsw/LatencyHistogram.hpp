@@ -0,0 +1,47 @@
+#ifndef EFSW_LATENCYHISTOGRAM_HPP
+#define EFSW_LATENCYHISTOGRAM_HPP
+
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <atomic>
+
+namespace efsw {
+
+/// Histogram of durations in the HDR style: the values below 32 have a bucket each, the others
+/// fall in one of the 16 sub-buckets of their power of two, so a bucket is never wider than 1/16
+/// of its values. Recording is a few relaxed atomic increments, from any thread.
+class LatencyHistogram {
+  public:
+	LatencyHistogram();
+
+	LatencyHistogram( const LatencyHistogram& ) = delete;
+
+	LatencyHistogram& operator=( const LatencyHistogram& ) = delete;
+
+	/// Records a duration in nanoseconds
+	void record( Uint64 value );
+
+	/// @return The summary of the values recorded, in microseconds
+	LatencyStats stats() const;
+
+  protected:
+	static const size_t SUB_BUCKETS = 16;
+	static const size_t BUCKETS = 32 + 59 * SUB_BUCKETS;
+
+	std::atomic<Uint64> mBuckets[BUCKETS];
+	std::atomic<Uint64> mSum;
+	std::atomic<Uint64> mMin;
+	std::atomic<Uint64> mMax;
+
+	static size_t index( Uint64 value );
+
+	/// @return The highest value of the bucket
+	static Uint64 highest( size_t index );
+
+	/// @return The highest value of the bucket reached by the quantile of the values
+	Uint64 quantile( const Uint64* buckets, Uint64 count, double q ) const;
+};
+
+} // namespace efsw
+
+#endif
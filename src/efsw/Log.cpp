@@ -3,46 +3,57 @@
 
 namespace efsw { namespace Errors {
 
-static std::string LastError = "";
-static Error LastErrorCode = NoError;
+/// The last error of the thread: its code and the path or the text given, formatted only when
+/// the log is asked for. The text keeps its capacity, so an error costs no allocation once the
+/// thread logged a path as long.
+struct LastErrorSlot {
+	Error Code = NoError;
+	std::string Text;
+};
 
-std::string Log::getLastErrorLog() {
-	return LastError;
-}
-
-Error Log::getLastErrorCode() {
-	return LastErrorCode;
-}
+static thread_local LastErrorSlot LastError;
 
-void Log::clearLastError() {
-	LastErrorCode = NoError;
-	LastError = "";
-}
+std::string Log::getLastErrorLog() {
+	const std::string& text = LastError.Text;
 
-Error Log::createLastError( Error err, std::string log ) {
-	switch ( err ) {
+	switch ( LastError.Code ) {
+		case NoError:
+			return "";
 		case FileNotFound:
-			LastError = "File not found ( " + log + " )";
-			break;
+			return "File not found ( " + text + " )";
 		case FileRepeated:
-			LastError = "File repeated in watches ( " + log + " )";
-			break;
+			return "File repeated in watches ( " + text + " )";
 		case FileOutOfScope:
-			LastError = "Symlink file out of scope ( " + log + " )";
-			break;
+			return "Symlink file out of scope ( " + text + " )";
 		case FileRemote:
-			LastError =
-				"File is located in a remote file system, use a generic watcher. ( " + log + " )";
-			break;
+			return "File is located in a remote file system, use a generic watcher. ( " + text +
+				   " )";
 		case WatcherFailed:
-			LastError = "File system watcher failed ( " + log + " )";
-			break;
+			return "File system watcher failed ( " + text + " )";
+		case FileNotReadable:
 		case Unspecified:
 		default:
-			LastError = log;
+			return text;
 	}
+}
+
+Error Log::getLastErrorCode() {
+	return LastError.Code;
+}
+
+void Log::clearLastError() {
+	LastError.Code = NoError;
+	LastError.Text.clear();
+}
+
+Error Log::createLastError( Error err, std::string_view log ) {
+	LastError.Code = err;
+	LastError.Text.assign( log.data(), log.size() );
+
+#ifdef EFSW_VERBOSE
+	efDEBUG( "%s\n", getLastErrorLog().c_str() );
+#endif
 
-	efDEBUG( "%s\n", LastError.c_str() );
 	return err;
 }
 
@@ -0,0 +1,348 @@
+#include <efsw/Debug.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/PathFilter.hpp>
+#include <fstream>
+
+namespace efsw {
+
+namespace {
+
+/// A path made of two consecutive views, so the relative path of an event is matched without
+/// being built
+struct SplitText {
+	std::string_view First;
+	std::string_view Second;
+
+	size_t size() const { return First.size() + Second.size(); }
+
+	char operator[]( size_t i ) const {
+		return i < First.size() ? First[i] : Second[i - First.size()];
+	}
+};
+
+bool isSlash( char c ) {
+	return '/' == c || '\\' == c;
+}
+
+bool hasWildcards( std::string_view pattern ) {
+	return std::string_view::npos != pattern.find_first_of( "*?[\\" );
+}
+
+/// Matches a bracket expression at the start of the pattern, advancing past it
+bool matchClass( std::string_view pattern, size_t& pi, char c ) {
+	size_t i = pi + 1;
+	bool negated = false;
+	bool found = false;
+
+	if ( i < pattern.size() && ( '!' == pattern[i] || '^' == pattern[i] ) ) {
+		negated = true;
+		i++;
+	}
+
+	size_t first = i;
+
+	while ( i < pattern.size() && ( i == first || ']' != pattern[i] ) ) {
+		char low = pattern[i];
+
+		if ( i + 2 < pattern.size() && '-' == pattern[i + 1] && ']' != pattern[i + 2] ) {
+			found = found || ( low <= c && c <= pattern[i + 2] );
+			i += 3;
+		} else {
+			found = found || low == c;
+			i++;
+		}
+	}
+
+	/// An unterminated bracket is a literal one
+	if ( i >= pattern.size() ) {
+		pi++;
+		return '[' == c;
+	}
+
+	pi = i + 1;
+	return found != negated;
+}
+
+bool globMatch( std::string_view pattern, size_t pi, const SplitText& text, size_t ti ) {
+	while ( pi < pattern.size() ) {
+		char p = pattern[pi];
+
+		if ( '*' == p ) {
+			bool deep = pi + 1 < pattern.size() && '*' == pattern[pi + 1];
+
+			while ( pi < pattern.size() && '*' == pattern[pi] ) {
+				pi++;
+			}
+
+			/// "**/" also matches no directory at all
+			if ( deep && pi < pattern.size() && '/' == pattern[pi] &&
+				 globMatch( pattern, pi + 1, text, ti ) ) {
+				return true;
+			}
+
+			for ( size_t i = ti; i <= text.size(); i++ ) {
+				if ( globMatch( pattern, pi, text, i ) )
+					return true;
+
+				if ( i < text.size() && !deep && isSlash( text[i] ) )
+					return false;
+			}
+
+			return false;
+		}
+
+		if ( ti >= text.size() )
+			return false;
+
+		char c = text[ti];
+
+		if ( '?' == p ) {
+			if ( isSlash( c ) )
+				return false;
+
+			pi++;
+		} else if ( '[' == p ) {
+			if ( !matchClass( pattern, pi, c ) )
+				return false;
+		} else {
+			if ( '\\' == p && pi + 1 < pattern.size() ) {
+				p = pattern[++pi];
+			}
+
+			if ( p != c && !( '/' == p && isSlash( c ) ) )
+				return false;
+
+			pi++;
+		}
+
+		ti++;
+	}
+
+	return ti == text.size();
+}
+
+} // namespace
+
+std::shared_ptr<const PathFilter> PathFilter::create( const std::string& directory,
+													  const std::vector<WatcherOption>& options ) {
+	std::shared_ptr<PathFilter> filter;
+
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		const WatcherOption& option = options[i];
+
+		if ( Options::MaxDepth == option.mOption ) {
+			if ( !filter ) {
+				filter = std::make_shared<PathFilter>( directory );
+			}
+
+			filter->mScope.reset( new WatchScope( directory, option.mValue ) );
+			continue;
+		}
+
+		if ( Options::IncludePattern != option.mOption &&
+			 Options::ExcludePattern != option.mOption && Options::ExcludeFile != option.mOption )
+			continue;
+
+		if ( !filter ) {
+			filter = std::make_shared<PathFilter>( directory );
+		}
+
+		if ( Options::IncludePattern == option.mOption ) {
+			filter->include( option.mPattern );
+		} else if ( Options::ExcludePattern == option.mOption ) {
+			filter->exclude( option.mPattern );
+		} else if ( !filter->excludeFile( option.mPattern ) ) {
+			efDEBUG( "Couldn't read the exclude file %s\n", option.mPattern.c_str() );
+		}
+	}
+
+	return filter;
+}
+
+PathFilter::PathFilter( const std::string& directory ) : mDirectory( directory ) {
+	FileSystem::dirAddSlashAtEnd( mDirectory );
+}
+
+void PathFilter::include( const std::string& pattern ) {
+	mIncludes.add( pattern );
+}
+
+void PathFilter::exclude( const std::string& pattern ) {
+	mExcludes.add( pattern );
+}
+
+bool PathFilter::excludeFile( const std::string& path ) {
+	std::string file( path );
+
+	if ( file.empty() )
+		return false;
+
+	if ( '/' != file[0] && '\\' != file[0] && ( file.size() < 2 || ':' != file[1] ) ) {
+		file = mDirectory + file;
+	}
+
+	std::ifstream stream( file.c_str() );
+
+	if ( !stream.is_open() )
+		return false;
+
+	std::string line;
+
+	while ( std::getline( stream, line ) ) {
+		while ( !line.empty() && ( ' ' == line.back() || '\t' == line.back() ||
+								   '\r' == line.back() ) ) {
+			line.erase( line.size() - 1 );
+		}
+
+		if ( line.empty() || '#' == line[0] || '!' == line[0] )
+			continue;
+
+		exclude( line );
+	}
+
+	return true;
+}
+
+std::string_view PathFilter::relativePath( std::string_view path ) const {
+	if ( path.size() >= mDirectory.size() &&
+		 0 == path.compare( 0, mDirectory.size(), mDirectory ) ) {
+		return path.substr( mDirectory.size() );
+	}
+
+	/// The watched directory itself, without the slash
+	if ( path.size() + 1 == mDirectory.size() && 0 == mDirectory.compare( 0, path.size(), path ) )
+		return std::string_view();
+
+	/// Outside of the watched directory ( a symlink followed ), only the names are matched
+	return path;
+}
+
+bool PathFilter::prunes( std::string_view path ) const {
+	if ( mScope && mScope->prunes( path ) )
+		return true;
+
+	if ( mExcludes.Empty )
+		return false;
+
+	while ( !path.empty() && isSlash( path.back() ) ) {
+		path.remove_suffix( 1 );
+	}
+
+	size_t slash = path.find_last_of( "/\\" );
+	std::string_view name( std::string_view::npos != slash ? path.substr( slash + 1 ) : path );
+	std::string_view relative(
+		relativePath( path.substr( 0, std::string_view::npos != slash ? slash + 1 : 0 ) ) );
+
+	return !name.empty() && mExcludes.matches( relative, name, name );
+}
+
+bool PathFilter::matches( std::string_view dir, std::string_view filename ) const {
+	if ( mScope && !mScope->reports( dir, filename ) )
+		return false;
+
+	std::string_view relative( relativePath( dir ) );
+	std::string_view name( filename );
+	size_t slash = name.find_last_of( "/\\" );
+
+	if ( std::string_view::npos != slash ) {
+		name = name.substr( slash + 1 );
+	}
+
+	return ( mIncludes.Empty || mIncludes.matches( relative, filename, name ) ) &&
+		   ( mExcludes.Empty || !mExcludes.matches( relative, filename, name ) );
+}
+
+bool PathFilter::glob( std::string_view pattern, std::string_view text ) {
+	SplitText split;
+	split.First = text;
+
+	return globMatch( pattern, 0, split, 0 );
+}
+
+void PathFilter::PatternSet::add( std::string pattern ) {
+	if ( pattern.empty() )
+		return;
+
+	Empty = false;
+
+	bool anchored = '/' == pattern[0];
+
+	if ( anchored ) {
+		pattern.erase( 0, 1 );
+	}
+
+	/// A directory matches itself and everything under it
+	if ( !pattern.empty() && '/' == pattern.back() ) {
+		pattern.erase( pattern.size() - 1 );
+
+		if ( pattern.empty() )
+			return;
+
+		if ( anchored || std::string::npos != pattern.find( '/' ) ) {
+			PathGlobs.push_back( pattern + "/**" );
+			PathGlobs.push_back( pattern );
+			return;
+		}
+
+		PathGlobs.push_back( "**/" + pattern + "/**" );
+	} else if ( anchored || std::string::npos != pattern.find( '/' ) ) {
+		PathGlobs.push_back( pattern );
+		return;
+	}
+
+	std::string_view view( pattern );
+
+	if ( !hasWildcards( view ) ) {
+		Storage.push_back( pattern );
+		Names.insert( Storage.back() );
+	} else if ( view.size() > 2 && '*' == view[0] && '.' == view[1] &&
+				!hasWildcards( view.substr( 2 ) ) ) {
+		Storage.push_back( pattern.substr( 2 ) );
+		Extensions.insert( Storage.back() );
+	} else if ( view.size() > 1 && '*' == view.back() &&
+				!hasWildcards( view.substr( 0, view.size() - 1 ) ) ) {
+		Prefixes.push_back( pattern.substr( 0, pattern.size() - 1 ) );
+	} else {
+		NameGlobs.push_back( pattern );
+	}
+}
+
+bool PathFilter::PatternSet::matches( std::string_view relative, std::string_view filename,
+									  std::string_view name ) const {
+	if ( !Names.empty() && Names.count( name ) > 0 )
+		return true;
+
+	if ( !Extensions.empty() ) {
+		/// Every suffix after a dot, so "*.gz" and "*.tar.gz" both match
+		for ( size_t dot = name.find( '.' ); std::string_view::npos != dot;
+			  dot = name.find( '.', dot + 1 ) ) {
+			if ( Extensions.count( name.substr( dot + 1 ) ) > 0 )
+				return true;
+		}
+	}
+
+	for ( size_t i = 0; i < Prefixes.size(); i++ ) {
+		if ( 0 == name.compare( 0, Prefixes[i].size(), Prefixes[i] ) )
+			return true;
+	}
+
+	for ( size_t i = 0; i < NameGlobs.size(); i++ ) {
+		if ( glob( NameGlobs[i], name ) )
+			return true;
+	}
+
+	if ( !PathGlobs.empty() ) {
+		SplitText path;
+		path.First = relative;
+		path.Second = filename;
+
+		for ( size_t i = 0; i < PathGlobs.size(); i++ ) {
+			if ( globMatch( PathGlobs[i], 0, path, 0 ) )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+} // namespace efsw
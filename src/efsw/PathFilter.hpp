@@ -0,0 +1,100 @@
+#ifndef EFSW_PATHFILTER_HPP
+#define EFSW_PATHFILTER_HPP
+
+#include <efsw/WatchScope.hpp>
+#include <efsw/efsw.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace efsw {
+
+/// The include and exclude patterns of a watch ( Options::IncludePattern and
+/// Options::ExcludePattern ) compiled once into the matchers of their kind: the literal names and
+/// the extensions ( `*.cpp` ) are hash set lookups, the prefixes ( `build*` ) plain comparisons,
+/// and only the rest are matched as globs. Matching never allocates.
+/// A pattern without a slash matches the name of the entry, one with a slash its path relative
+/// to the watched directory, where `*` doesn't match a slash and `**` does. A pattern ending with
+/// a slash matches everything under that directory. The patterns separate directories with '/'
+/// on every platform, a backslash escapes the next character.
+/// The filter also holds the scope of a watch with Options::MaxDepth, which prunes the
+/// directories out of it and drops the events of their entries.
+class PathFilter {
+  public:
+	/// @return The filter of the patterns and the max depth of the options, NULL if there are
+	/// none
+	static std::shared_ptr<const PathFilter> create( const std::string& directory,
+													 const std::vector<WatcherOption>& options );
+
+	explicit PathFilter( const std::string& directory );
+
+	PathFilter( const PathFilter& ) = delete;
+
+	PathFilter& operator=( const PathFilter& ) = delete;
+
+	void include( const std::string& pattern );
+
+	void exclude( const std::string& pattern );
+
+	/// Adds the exclude patterns of a .gitignore-style file: a pattern per line, the blank lines
+	/// and the lines starting with '#' are ignored. The negated patterns ( "!pattern" ) aren't
+	/// supported and are skipped. A relative path is relative to the watched directory.
+	/// @return False if the file couldn't be read
+	bool excludeFile( const std::string& path );
+
+	/// @param dir The directory of the event, inside the watched directory
+	/// @param filename The name of the entry, or its path relative to dir
+	/// @return True if an include pattern matches, or there are none, and no exclude pattern does,
+	/// in a directory in scope
+	bool matches( std::string_view dir, std::string_view filename ) const;
+
+	/// @param path The path of a directory inside the watched directory
+	/// @return True if an exclude pattern matches the directory, or it's out of the scope, so it
+	/// must not be descended into
+	bool prunes( std::string_view path ) const;
+
+	/// @return The scope of the watch, NULL if it has no Options::MaxDepth
+	WatchScope* scope() const { return mScope.get(); }
+
+	/// @return True if the pattern matches the text, with the glob rules above
+	static bool glob( std::string_view pattern, std::string_view text );
+
+  protected:
+	/// The patterns of one side, by kind
+	struct PatternSet {
+		std::unordered_set<std::string_view> Names;
+		std::unordered_set<std::string_view> Extensions;
+		std::vector<std::string> Prefixes;
+		std::vector<std::string> NameGlobs;
+		std::vector<std::string> PathGlobs;
+		/// Owns the text the sets point to, a deque doesn't move it as it grows
+		std::deque<std::string> Storage;
+		bool Empty = true;
+
+		void add( std::string pattern );
+
+		/// @param relative The directory relative to the watched one, with the slash at the end
+		/// @param filename The entry relative to it
+		/// @param name The name of the entry
+		bool matches( std::string_view relative, std::string_view filename,
+					  std::string_view name ) const;
+	};
+
+	/// The watched directory with the slash at the end
+	std::string mDirectory;
+
+	/// @return The part of the path after the watched directory ( all of it if it's outside )
+	std::string_view relativePath( std::string_view path ) const;
+
+	PatternSet mIncludes;
+	PatternSet mExcludes;
+
+	std::unique_ptr<WatchScope> mScope;
+};
+
+} // namespace efsw
+
+#endif
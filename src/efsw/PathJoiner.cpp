@@ -0,0 +1,63 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/PathJoiner.hpp>
+
+namespace efsw {
+
+JoiningListener::JoiningListener( FileWatchListener* listener, const std::string& directory ) :
+	WatchStage( listener, directory ) {}
+
+size_t JoiningListener::join( std::string_view dir, std::string_view name ) {
+	size_t offset = mText.size();
+	mText.append( dir.data(), dir.size() );
+
+	if ( !dir.empty() && !name.empty() && '/' != dir.back() && '\\' != dir.back() ) {
+		mText += FileSystem::getOSSlash();
+	}
+
+	mText.append( name.data(), name.size() );
+	return offset;
+}
+
+void JoiningListener::handleFileActions( const Event* events, size_t count ) {
+	mJoined.resize( count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		const Event& event = events[i];
+		Joined& joined = mJoined[i];
+
+		joined.Path = join( event.dir, event.filename );
+		joined.PathLength = mText.size() - joined.Path;
+
+		if ( event.oldFilename.empty() ) {
+			joined.OldPath = joined.OldPathLength = 0;
+		} else {
+			joined.OldPath = join( event.dir, event.oldFilename );
+			joined.OldPathLength = mText.size() - joined.OldPath;
+		}
+	}
+
+	/// The views are built once the text buffer stopped growing
+	const char* text = mText.data();
+
+	mEvents.assign( events, events + count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		Event& event = mEvents[i];
+		const Joined& joined = mJoined[i];
+
+		event.path = std::string_view( text + joined.Path, joined.PathLength );
+		event.oldPath = std::string_view( text + joined.OldPath, joined.OldPathLength );
+
+		/// The name starts after the last slash, a filename can hold subdirectories
+		size_t slash = event.path.find_last_of( "/\\" );
+		event.nameOffset = std::string_view::npos != slash && !event.filename.empty()
+							   ? slash + 1
+							   : event.path.size();
+	}
+
+	mListener->handleFileActions( mEvents.data(), count );
+
+	mText.clear();
+}
+
+} // namespace efsw
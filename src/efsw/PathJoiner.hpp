@@ -0,0 +1,42 @@
+#ifndef EFSW_PATHJOINER_HPP
+#define EFSW_PATHJOINER_HPP
+
+#include <efsw/WatchStages.hpp>
+#include <efsw/efsw.hpp>
+#include <string>
+#include <vector>
+
+namespace efsw {
+
+/// Listener placed in front of the listener of a watch with Options::FullPath. It joins the
+/// directory and the names of the events of every batch into a buffer reused between batches,
+/// so Event::path and Event::oldPath are set without allocating in the steady state.
+/// The batches of a watch are delivered from one thread at a time, as for any listener.
+class JoiningListener : public WatchStage {
+  public:
+	JoiningListener( FileWatchListener* listener, const std::string& directory );
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+  protected:
+	/// The paths of a batch, as offsets into mText
+	struct Joined {
+		size_t Path;
+		size_t PathLength;
+		size_t OldPath;
+		size_t OldPathLength;
+	};
+
+	/// Reused between batches: the paths one after the other, their offsets and the events
+	std::string mText;
+	std::vector<Joined> mJoined;
+	std::vector<Event> mEvents;
+
+	/// Appends the directory joined with the name
+	/// @return The offset of the path in mText
+	size_t join( std::string_view dir, std::string_view name );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,34 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/PrecomposeCache.hpp>
+
+/// The names of a generation
+#define PRECOMPOSE_CACHE_CAPACITY 256
+
+namespace efsw {
+
+PrecomposeCache::PrecomposeCache() {}
+
+const std::string& PrecomposeCache::precompose( const std::string& name ) {
+	if ( FileSystem::isAscii( name ) )
+		return name;
+
+	Names::iterator it = mRecent.find( name );
+
+	if ( it != mRecent.end() )
+		return it->second;
+
+	it = mOlder.find( name );
+
+	std::string precomposed( it != mOlder.end() ? it->second
+												: FileSystem::precomposeFileName( name ) );
+
+	/// The names swapped keep their nodes, so the ones just returned stay valid
+	if ( mRecent.size() >= PRECOMPOSE_CACHE_CAPACITY ) {
+		mOlder.clear();
+		mOlder.swap( mRecent );
+	}
+
+	return mRecent.emplace( name, std::move( precomposed ) ).first->second;
+}
+
+} // namespace efsw
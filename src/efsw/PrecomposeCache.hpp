@@ -0,0 +1,32 @@
+#ifndef EFSW_PRECOMPOSECACHE_HPP
+#define EFSW_PRECOMPOSECACHE_HPP
+
+#include <efsw/base.hpp>
+#include <string>
+#include <unordered_map>
+
+namespace efsw {
+
+/// The names of a watch recently precomposed by FileSystem::precomposeFileName, so the names of
+/// the files changing again and again are converted once. The names in ASCII are returned as
+/// they are, neither converted nor cached.
+/// The cache keeps two generations of names: a name is added to the recent one, found in either,
+/// and once the recent one is full the older one is dropped. Used by one thread at a time.
+class PrecomposeCache {
+  public:
+	PrecomposeCache();
+
+	/// @return The name precomposed. Stays valid until the cache converts as many names as it
+	/// holds in a generation.
+	const std::string& precompose( const std::string& name );
+
+  protected:
+	typedef std::unordered_map<std::string, std::string> Names;
+
+	Names mRecent;
+	Names mOlder;
+};
+
+} // namespace efsw
+
+#endif
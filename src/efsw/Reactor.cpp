@@ -0,0 +1,35 @@
+#include <efsw/Lock.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+
+namespace efsw {
+
+Reactor::Reactor() : mHost( new FileWatcher() ) {}
+
+Reactor::Reactor( bool useGenericFileWatcher ) :
+	mHost( new FileWatcher( useGenericFileWatcher ) ) {}
+
+Reactor::~Reactor() {
+	efSAFE_DELETE( mHost );
+}
+
+void Reactor::setTraceHooks( TraceHooks* hooks ) {
+	mHost->setTraceHooks( hooks );
+}
+
+void Reactor::followSymlinks( bool follow ) {
+	mHost->followSymlinks( follow );
+}
+
+void Reactor::allowOutOfScopeLinks( bool allow ) {
+	mHost->allowOutOfScopeLinks( allow );
+}
+
+void Reactor::watch() {
+	/// The watchers attached may start watching from several threads at once
+	Lock lock( mMutex );
+
+	mHost->watch();
+}
+
+} // namespace efsw
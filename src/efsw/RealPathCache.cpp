@@ -0,0 +1,78 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/RealPathCache.hpp>
+
+#if defined( EFSW_PLATFORM_POSIX )
+#include <sys/stat.h>
+#endif
+
+namespace efsw {
+
+std::string RealPathCache::resolve( const std::string& path, std::string& curPath,
+									Key& target ) {
+#if defined( EFSW_PLATFORM_POSIX )
+	std::string dir( path );
+	FileSystem::dirRemoveSlashAtEnd( dir );
+
+	struct stat st;
+
+	if ( 0 != lstat( dir.c_str(), &st ) || !S_ISLNK( st.st_mode ) )
+		return "";
+
+	if ( 0 != stat( dir.c_str(), &st ) || !S_ISDIR( st.st_mode ) )
+		return "";
+
+	target.Device = st.st_dev;
+	target.Inode = st.st_ino;
+
+	return resolve( path, target, curPath );
+#else
+	target.Device = 0;
+	target.Inode = 0;
+
+	/// There are no links to resolve
+	return FileSystem::getLinkRealPath( path, curPath );
+#endif
+}
+
+std::string RealPathCache::resolve( const std::string& path, const Key& target,
+									std::string& curPath ) {
+	{
+		Lock lock( mMutex );
+
+		std::unordered_map<Key, std::string, KeyHash>::iterator it = mPaths.find( target );
+
+		if ( it != mPaths.end() ) {
+			std::string dir( path );
+			FileSystem::dirRemoveSlashAtEnd( dir );
+			curPath = FileSystem::pathRemoveFileName( dir );
+
+			return it->second;
+		}
+	}
+
+	/// Resolved unlocked, two threads resolving the same directory find the same path
+	std::string link( FileSystem::getLinkRealPath( path, curPath ) );
+
+	if ( !link.empty() ) {
+		Lock lock( mMutex );
+		mPaths.emplace( target, link );
+	}
+
+	return link;
+}
+
+bool RealPathCache::visit( const Key& dir ) {
+	Lock lock( mMutex );
+
+	return mVisited.insert( dir ).second;
+}
+
+void RealPathCache::clear() {
+	Lock lock( mMutex );
+
+	mPaths.clear();
+	mVisited.clear();
+}
+
+} // namespace efsw
@@ -0,0 +1,64 @@
+#ifndef EFSW_REALPATHCACHE_HPP
+#define EFSW_REALPATHCACHE_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/base.hpp>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace efsw {
+
+/// The symbolic links resolved by a crawl. realpath() walks the path from the root, so resolving
+/// every link of a tree full of them ( a pnpm layout, a Nix profile ) is quadratic in its depth:
+/// the real path of a directory is kept by its device and inode instead, each directory being
+/// resolved once however many links point to it. The directories visited by the crawl are kept
+/// too, so a link back into the tree or to a directory reached already isn't descended into
+/// again. Only valid for the crawl, the links can change after it. Safe to use from the threads
+/// of a crawl.
+class RealPathCache {
+  public:
+	/// Identifies a directory on its file system
+	struct Key {
+		Uint64 Device;
+		Uint64 Inode;
+
+		bool operator==( const Key& other ) const {
+			return Device == other.Device && Inode == other.Inode;
+		}
+	};
+
+	/// Resolves the directory the link at path points to, as FileSystem::getLinkRealPath does
+	/// @param target Set to the directory the link points to
+	/// @return Its real path with the slash at the end, empty if path isn't a link to a directory
+	std::string resolve( const std::string& path, std::string& curPath, Key& target );
+
+	/// Same as resolve, for a link whose target was stat'ed already
+	std::string resolve( const std::string& path, const Key& target, std::string& curPath );
+
+	/// Marks a directory as visited by the crawl, the caller marking it first is the one to crawl
+	/// it
+	/// @return False if it was visited already
+	bool visit( const Key& dir );
+
+	/// Forgets the links and the directories, for another crawl
+	void clear();
+
+  protected:
+	struct KeyHash {
+		size_t operator()( const Key& key ) const {
+			return (size_t)( key.Inode * 0x9E3779B97F4A7C15ULL ^ key.Device );
+		}
+	};
+
+	Mutex mMutex;
+
+	/// The real paths of the directories pointed to by the links, with the slash at the end
+	std::unordered_map<Key, std::string, KeyHash> mPaths;
+
+	std::unordered_set<Key, KeyHash> mVisited;
+};
+
+} // namespace efsw
+
+#endif
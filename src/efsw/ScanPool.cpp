@@ -0,0 +1,104 @@
+#include <efsw/Lock.hpp>
+#include <efsw/ScanPool.hpp>
+
+namespace efsw {
+
+ScanPool::ScanPool() :
+	mThreads( 1 ), mRunning( true ), mTask( NULL ), mCount( 0 ), mBatch( 0 ), mNext( 0 ),
+	mActive( 0 ) {}
+
+ScanPool::~ScanPool() {
+	{
+		Lock lock( mMutex );
+		mRunning = false;
+	}
+
+	mWake.notify_all();
+
+	for ( size_t i = 0; i < mWorkers.size(); i++ ) {
+		efSAFE_DELETE( mWorkers[i]->Runner );
+		efSAFE_DELETE( mWorkers[i] );
+	}
+}
+
+void ScanPool::setThreads( size_t threads ) {
+	size_t current = mThreads.load();
+
+	while ( threads > current && !mThreads.compare_exchange_weak( current, threads ) ) {
+	}
+}
+
+void ScanPool::run( size_t count, const Task& task ) {
+	if ( 0 == count )
+		return;
+
+	/// The workers are only started from the submitting thread, between batches
+	while ( mWorkers.size() + 1 < mThreads.load() ) {
+		Worker* worker = new Worker();
+		size_t batch = mBatch;
+
+		worker->Runner = new Thread( [this, worker, batch] { work( worker, batch ); } );
+		mWorkers.push_back( worker );
+		worker->Runner->launch();
+	}
+
+	if ( mWorkers.empty() || 1 == count ) {
+		for ( size_t i = 0; i < count; i++ ) {
+			task( i, mListing );
+		}
+
+		return;
+	}
+
+	{
+		Lock lock( mMutex );
+		mTask = &task;
+		mCount = count;
+		mNext = 0;
+		mActive = mWorkers.size();
+		mBatch++;
+	}
+
+	mWake.notify_all();
+
+	drain( mListing );
+
+	Lock lock( mMutex );
+
+	mDone.wait( lock, [this] { return 0 == mActive; } );
+
+	mTask = NULL;
+}
+
+void ScanPool::work( Worker* worker, size_t batch ) {
+	Lock lock( mMutex );
+
+	while ( true ) {
+		mWake.wait( lock, [this, batch] { return !mRunning || batch != mBatch; } );
+
+		if ( !mRunning )
+			return;
+
+		batch = mBatch;
+
+		lock.unlock();
+
+		drain( worker->Listing );
+
+		lock.lock();
+
+		if ( 0 == --mActive ) {
+			mDone.notify_all();
+		}
+	}
+}
+
+void ScanPool::drain( FileInfoMap& listing ) {
+	size_t i;
+
+	while ( ( i = mNext.fetch_add( 1 ) ) < mCount ) {
+		( *mTask )( i, listing );
+	}
+}
+
+} // namespace efsw
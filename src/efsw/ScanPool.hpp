@@ -0,0 +1,72 @@
+#ifndef EFSW_SCANPOOL_HPP
+#define EFSW_SCANPOOL_HPP
+
+#include <efsw/FileInfo.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/Thread.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+namespace efsw {
+
+/// Threads running the scans of a batch along with the thread submitting it. The tasks are
+/// claimed one at a time from a shared counter, so a thread done with a small directory takes
+/// the next one while another is still on a large one. Every thread lists the directories into
+/// a buffer of its own, reused between batches.
+class ScanPool {
+  public:
+	typedef std::function<void( size_t task, FileInfoMap& listing )> Task;
+
+	ScanPool();
+
+	~ScanPool();
+
+	ScanPool( const ScanPool& ) = delete;
+
+	ScanPool& operator=( const ScanPool& ) = delete;
+
+	/// Grows the pool to the number of threads, the submitting one included, once the next
+	/// batch starts. The pool never shrinks.
+	void setThreads( size_t threads );
+
+	/// Runs the task for every index below count
+	/// @return Once all of them ran
+	void run( size_t count, const Task& task );
+
+  protected:
+	struct Worker {
+		Thread* Runner;
+		FileInfoMap Listing;
+	};
+
+	std::vector<Worker*> mWorkers;
+
+	/// The listing buffer of the submitting thread
+	FileInfoMap mListing;
+
+	std::atomic<size_t> mThreads;
+
+	Mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	bool mRunning;
+
+	/// The batch being run, numbered so a worker joins every batch once
+	const Task* mTask;
+	size_t mCount;
+	size_t mBatch;
+	std::atomic<size_t> mNext;
+
+	/// Workers that didn't finish the batch yet
+	size_t mActive;
+
+	void work( Worker* worker, size_t batch );
+
+	void drain( FileInfoMap& listing );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,365 @@
+#include <efsw/SharedJournal.hpp>
+#include <efsw/System.hpp>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#if EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_ANDROID
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define EFSW_FUTEX
+#endif
+
+/// The smallest ring, so any record fits in half of it
+#define MIN_RING_SIZE ( 1 << 20 )
+
+namespace efsw {
+
+SharedMemory::SharedMemory() :
+	mData( NULL ),
+	mSize( 0 ),
+	mOwner( false )
+#if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
+	,
+	mHandle( NULL )
+#endif
+{
+}
+
+SharedMemory::~SharedMemory() {
+	close();
+}
+
+bool SharedMemory::create( const std::string& name, size_t size ) {
+	close();
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	/// A segment left by a publisher that crashed is replaced
+	shm_unlink( name.c_str() );
+
+	int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+
+	if ( -1 == fd )
+		return false;
+
+	if ( 0 != ftruncate( fd, (off_t)size ) ) {
+		::close( fd );
+		shm_unlink( name.c_str() );
+		return false;
+	}
+
+	void* data = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+	::close( fd );
+
+	if ( MAP_FAILED == data ) {
+		shm_unlink( name.c_str() );
+		return false;
+	}
+#else
+	mHandle = CreateFileMappingA( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+								  (DWORD)( (Uint64)size >> 32 ), (DWORD)size, name.c_str() );
+
+	if ( NULL == mHandle )
+		return false;
+
+	void* data = MapViewOfFile( mHandle, FILE_MAP_ALL_ACCESS, 0, 0, size );
+
+	if ( NULL == data ) {
+		CloseHandle( mHandle );
+		mHandle = NULL;
+		return false;
+	}
+#endif
+
+	mData = (char*)data;
+	mSize = size;
+	mName = name;
+	mOwner = true;
+
+	return true;
+}
+
+bool SharedMemory::open( const std::string& name ) {
+	close();
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	int fd = shm_open( name.c_str(), O_RDWR, 0 );
+
+	if ( -1 == fd )
+		return false;
+
+	struct stat st;
+
+	if ( 0 != fstat( fd, &st ) || 0 == st.st_size ) {
+		::close( fd );
+		return false;
+	}
+
+	void* data = mmap( NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+	::close( fd );
+
+	if ( MAP_FAILED == data )
+		return false;
+
+	size_t size = (size_t)st.st_size;
+#else
+	mHandle = OpenFileMappingA( FILE_MAP_ALL_ACCESS, FALSE, name.c_str() );
+
+	if ( NULL == mHandle )
+		return false;
+
+	void* data = MapViewOfFile( mHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+	MEMORY_BASIC_INFORMATION info;
+
+	if ( NULL == data || 0 == VirtualQuery( data, &info, sizeof( info ) ) ) {
+		if ( NULL != data ) {
+			UnmapViewOfFile( data );
+		}
+
+		CloseHandle( mHandle );
+		mHandle = NULL;
+		return false;
+	}
+
+	size_t size = info.RegionSize;
+#endif
+
+	mData = (char*)data;
+	mSize = size;
+	mName = name;
+	mOwner = false;
+
+	return true;
+}
+
+void SharedMemory::close() {
+	if ( NULL == mData )
+		return;
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	munmap( mData, mSize );
+
+	if ( mOwner ) {
+		shm_unlink( mName.c_str() );
+	}
+#else
+	UnmapViewOfFile( mData );
+	CloseHandle( mHandle );
+	mHandle = NULL;
+#endif
+
+	mData = NULL;
+	mSize = 0;
+	mOwner = false;
+}
+
+void SharedMemory::wait( std::atomic<Uint32>& word, Uint32 value, unsigned int milliseconds ) {
+#ifdef EFSW_FUTEX
+	struct timespec timeout;
+	timeout.tv_sec = milliseconds / 1000;
+	timeout.tv_nsec = ( milliseconds % 1000 ) * 1000000L;
+
+	/// Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+	syscall( SYS_futex, reinterpret_cast<Uint32*>( &word ), FUTEX_WAIT, value, &timeout, NULL, 0 );
+#else
+	/// Polled where there's no futex
+	std::chrono::steady_clock::time_point end =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds( milliseconds );
+
+	while ( word.load() == value && std::chrono::steady_clock::now() < end ) {
+		System::sleep( 1 );
+	}
+#endif
+}
+
+void SharedMemory::wake( std::atomic<Uint32>& word ) {
+#ifdef EFSW_FUTEX
+	syscall( SYS_futex, reinterpret_cast<Uint32*>( &word ), FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+#else
+	(void)word;
+#endif
+}
+
+std::string SharedJournal::segmentName( const std::string& name ) {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	std::string segment( "/efsw." );
+#else
+	std::string segment( "Local\\efsw." );
+#endif
+
+	/// The name is a single component
+	for ( size_t i = 0; i < name.size(); i++ ) {
+		segment += '/' == name[i] || '\\' == name[i] ? '_' : name[i];
+	}
+
+	return segment;
+}
+
+SharedJournal::SharedJournal() :
+	mHeader( NULL ),
+	mRing( NULL ),
+	mPaths( NULL ),
+	mRingSize( 0 ),
+	mPathsSize( 0 ),
+	mWrite( 0 ),
+	mTail( 0 ),
+	mTailSequence( 0 ),
+	mPathsUsed( 0 ) {}
+
+SharedJournal::~SharedJournal() {
+	if ( NULL != mHeader ) {
+		mHeader->Closed.store( 1 );
+		mHeader->Wakeups.fetch_add( 1 );
+		SharedMemory::wake( mHeader->Wakeups );
+	}
+}
+
+bool SharedJournal::create( const std::string& name, size_t ringSize, size_t pathsSize,
+							Uint64 sequence ) {
+	mRingSize = MIN_RING_SIZE;
+
+	while ( mRingSize < ringSize ) {
+		mRingSize <<= 1;
+	}
+
+	/// The directories are found by a 32 bit offset
+	mPathsSize = pathsSize < INLINE_DIRECTORY ? pathsSize : INLINE_DIRECTORY - 1;
+
+	size_t headerSize = ( sizeof( Header ) + 63 ) & ~(size_t)63;
+
+	if ( !mMemory.create( segmentName( name ), headerSize + mRingSize + mPathsSize ) )
+		return false;
+
+	mHeader = new ( mMemory.data() ) Header();
+	mHeader->Version = VERSION;
+	mHeader->RingSize = mRingSize;
+	mHeader->PathsSize = mPathsSize;
+	mHeader->Head.store( sequence );
+	mHeader->TailSequence.store( sequence );
+
+	mRing = mMemory.data() + headerSize;
+	mPaths = mRing + mRingSize;
+	mTailSequence = sequence;
+
+	/// The readers check the magic before anything else
+	std::atomic_thread_fence( std::memory_order_release );
+	mHeader->Magic = MAGIC;
+
+	return true;
+}
+
+Uint32 SharedJournal::intern( std::string_view directory ) {
+	mKey.assign( directory.data(), directory.size() );
+
+	std::unordered_map<std::string, Uint32>::iterator it = mInterned.find( mKey );
+
+	if ( it != mInterned.end() )
+		return it->second;
+
+	if ( mPathsSize - mPathsUsed < directory.size() )
+		return INLINE_DIRECTORY;
+
+	Uint32 offset = mPathsUsed;
+	memcpy( mPaths + offset, directory.data(), directory.size() );
+	mPathsUsed += (Uint32)directory.size();
+	mInterned[mKey] = offset;
+
+	return offset;
+}
+
+void SharedJournal::reclaim( Uint64 end ) {
+	if ( end - mTail <= mRingSize )
+		return;
+
+	while ( end - mTail > mRingSize ) {
+		Uint64 offset = mTail & ( mRingSize - 1 );
+		const Record* record = (const Record*)( mRing + offset );
+
+		if ( 0 == record->Sequence ) {
+			mTail += mRingSize - offset;
+		} else {
+			mTail += record->Size;
+			mTailSequence = record->Sequence + 1;
+		}
+	}
+
+	/// The readers of the records about to be overwritten see the tail passed them once they're
+	/// done reading, and drop what they read
+	mHeader->TailSequence.store( mTailSequence, std::memory_order_relaxed );
+	mHeader->Tail.store( mTail, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+}
+
+void SharedJournal::publish( const Event* events, size_t count, Uint64 sequence ) {
+	if ( NULL == mHeader || 0 == count )
+		return;
+
+	for ( size_t i = 0; i < count; i++, sequence++ ) {
+		const Event& event = events[i];
+		Uint32 directory = intern( event.dir );
+		size_t inlined = INLINE_DIRECTORY == directory ? event.dir.size() : 0;
+		Uint64 size = ( sizeof( Record ) + inlined + event.filename.size() +
+						event.oldFilename.size() + 7 ) &
+					  ~(Uint64)7;
+		Uint64 offset = mWrite & ( mRingSize - 1 );
+
+		/// A record doesn't wrap around, the end of the ring is padded instead
+		if ( offset + size > mRingSize ) {
+			reclaim( mWrite + mRingSize - offset );
+			( (Record*)( mRing + offset ) )->Sequence = 0;
+			mWrite += mRingSize - offset;
+			offset = 0;
+		}
+
+		reclaim( mWrite + size );
+
+		Record* record = (Record*)( mRing + offset );
+		record->Sequence = sequence;
+		record->WatchID = event.watchid;
+		record->Size = (Uint32)size;
+		record->Action = event.action;
+		record->Directory = directory;
+		record->DirectoryLength = (Uint32)event.dir.size();
+		record->NameLength = (Uint32)event.filename.size();
+		record->OldNameLength = (Uint32)event.oldFilename.size();
+
+		char* text = (char*)( record + 1 );
+
+		if ( inlined > 0 ) {
+			memcpy( text, event.dir.data(), inlined );
+			text += inlined;
+		}
+
+		memcpy( text, event.filename.data(), event.filename.size() );
+		text += event.filename.size();
+		memcpy( text, event.oldFilename.data(), event.oldFilename.size() );
+
+		mWrite += size;
+	}
+
+	mHeader->Write.store( mWrite, std::memory_order_release );
+	mHeader->Head.store( sequence, std::memory_order_release );
+	mHeader->Wakeups.fetch_add( 1 );
+
+	if ( mHeader->Waiters.load() > 0 ) {
+		SharedMemory::wake( mHeader->Wakeups );
+	}
+}
+
+} // namespace efsw
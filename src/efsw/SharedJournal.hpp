@@ -0,0 +1,156 @@
+#ifndef EFSW_SHAREDJOURNAL_HPP
+#define EFSW_SHAREDJOURNAL_HPP
+
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace efsw {
+
+/// A named shared memory segment: a POSIX shared memory object, or a file mapping on Windows
+class SharedMemory {
+  public:
+	SharedMemory();
+
+	~SharedMemory();
+
+	SharedMemory( const SharedMemory& ) = delete;
+
+	SharedMemory& operator=( const SharedMemory& ) = delete;
+
+	/// Creates the segment zeroed, replacing one left with the same name. It's unlinked once
+	/// closed, the processes that mapped it keep it until they close it too.
+	/// @return False if it couldn't be created
+	bool create( const std::string& name, size_t size );
+
+	/// Maps the segment created by another process
+	/// @return False if there's none with that name
+	bool open( const std::string& name );
+
+	void close();
+
+	char* data() const { return mData; }
+
+	size_t size() const { return mSize; }
+
+	/// Waits for the word to change from the value, or to be woken
+	static void wait( std::atomic<Uint32>& word, Uint32 value, unsigned int milliseconds );
+
+	/// Wakes the processes waiting on the word
+	static void wake( std::atomic<Uint32>& word );
+
+  protected:
+	char* mData;
+	size_t mSize;
+	/// The name as given to the system, to unlink it
+	std::string mName;
+	bool mOwner;
+#if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
+	void* mHandle;
+#endif
+};
+
+/// The journal of a FileWatcher published in shared memory, see FileWatcher::publishJournal.
+/// The segment holds a header, a ring of records of any size, then the path table where the
+/// directories of the events are interned, so a record only carries the names.
+/// The single publisher appends to the ring, moving the tail past the records it's about to
+/// overwrite before writing them, and publishes the records once written. The readers copy
+/// nothing: they read the records in place, then check that the tail didn't pass them meanwhile,
+/// as a sequence lock does. Nothing in the segment is ever locked, a reader that stalls doesn't
+/// hold the publisher nor the other readers.
+class SharedJournal {
+  public:
+	static const Uint32 MAGIC = 0x4A777366; // "fswJ"
+	static const Uint32 VERSION = 1;
+	/// Record::Directory of a directory following the record, the path table being full
+	static const Uint32 INLINE_DIRECTORY = 0xFFFFFFFF;
+
+	struct Header {
+		Uint32 Magic;
+		Uint32 Version;
+		/// Bytes of the ring ( a power of two ) and of the path table
+		Uint64 RingSize;
+		Uint64 PathsSize;
+		/// The positions after the last record published and of the oldest record kept. They
+		/// only grow, the offset in the ring is the position modulo RingSize.
+		std::atomic<Uint64> Write;
+		std::atomic<Uint64> Tail;
+		/// The sequences of the next record and of the one at Tail
+		std::atomic<Uint64> Head;
+		std::atomic<Uint64> TailSequence;
+		/// Changes when records are published, the readers wait on it
+		std::atomic<Uint32> Wakeups;
+		std::atomic<Uint32> Waiters;
+		/// Set once the publisher is gone
+		std::atomic<Uint32> Closed;
+		Uint32 Reserved;
+	};
+
+	/// A record of the ring, followed by the directory when it isn't interned, the name and the
+	/// old name. The records are aligned to 8 bytes, one of sequence 0 pads the end of the ring.
+	struct Record {
+		Uint64 Sequence;
+		Int64 WatchID;
+		/// Of the record and its strings, aligned
+		Uint32 Size;
+		Uint32 Action;
+		/// The offset of the directory in the path table, or INLINE_DIRECTORY
+		Uint32 Directory;
+		Uint32 DirectoryLength;
+		Uint32 NameLength;
+		Uint32 OldNameLength;
+	};
+
+	static_assert( std::atomic<Uint64>::is_always_lock_free,
+				   "the shared journal needs lock free 64 bit atomics" );
+
+	/// @return The segment name given to the system for the journal name
+	static std::string segmentName( const std::string& name );
+
+	SharedJournal();
+
+	/// Marks the journal closed, waking the readers, and unlinks it
+	~SharedJournal();
+
+	/// Creates the segment
+	/// @param ringSize Rounded up to a power of two, of 1 MB at least
+	/// @param sequence The sequence of the next event published
+	/// @return False if it couldn't be
+	bool create( const std::string& name, size_t ringSize, size_t pathsSize, Uint64 sequence );
+
+	/// Appends the events to the ring, numbered from the sequence, and wakes the readers.
+	/// Called by one thread at a time.
+	void publish( const Event* events, size_t count, Uint64 sequence );
+
+  protected:
+	SharedMemory mMemory;
+	Header* mHeader;
+	char* mRing;
+	char* mPaths;
+	Uint64 mRingSize;
+	Uint64 mPathsSize;
+
+	/// The positions of the publisher, ahead of the header while appending
+	Uint64 mWrite;
+	Uint64 mTail;
+	Uint64 mTailSequence;
+
+	/// The directories interned, by their offset in the path table
+	std::unordered_map<std::string, Uint32> mInterned;
+	Uint32 mPathsUsed;
+	/// The directory being looked up, kept to reuse its capacity
+	std::string mKey;
+
+	/// @return The offset of the directory in the path table, INLINE_DIRECTORY if it's full
+	Uint32 intern( std::string_view directory );
+
+	/// Moves the tail past the records overlapping the positions up to the one given
+	void reclaim( Uint64 end );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,597 @@
+#include <efsw/Debug.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/SnapshotIndex.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace efsw {
+
+static const char IndexMagic[8] = { 'E', 'F', 'S', 'W', 'S', 'N', 'A', 'P' };
+
+/// Bumped whenever the layout of the records changes, the older files are then ignored
+static const Uint32 IndexVersion = 2;
+
+static const Uint32 IndexByteOrder = 0x01020304;
+
+struct SnapshotIndex::Header {
+	char Magic[8];
+	Uint32 Version;
+	Uint32 ByteOrder;
+	Uint32 Recursive;
+	/// The watched directory, in the text
+	Uint32 DirectorySize;
+	Uint64 Directory;
+	Uint64 DirectoryCount;
+	Uint64 EntryCount;
+	Uint64 TextSize;
+};
+
+/// Collects the records of the directories listed and writes them
+class SnapshotIndex::Writer {
+  public:
+	std::vector<DirectoryRecord> Directories;
+	std::vector<Info> Entries;
+	std::string Text;
+
+	void addDirectory( const std::string& relative, DirectorySnapshot& snapshot ) {
+		DirectoryRecord record;
+		FileStat directory;
+		directory.assignInfo( snapshot.DirectoryInfo );
+
+		fill( record.Directory, relative, directory );
+		record.ListedTime = snapshot.listedTime();
+		record.ListedAt = snapshot.listedAt();
+		record.FirstEntry = Entries.size();
+		record.EntryCount = 0;
+
+		for ( FileInfoMap::iterator it = snapshot.Files.begin(); it != snapshot.Files.end();
+			  ++it ) {
+			Info entry;
+			fill( entry, it->first, it->second );
+			Entries.push_back( entry );
+			record.EntryCount++;
+		}
+
+		Directories.push_back( record );
+	}
+
+	bool write( const std::string& file, const Watcher& watch ) {
+		/// The directories are looked up by their path
+		std::sort( Directories.begin(), Directories.end(),
+				   [this]( const DirectoryRecord& a, const DirectoryRecord& b ) {
+					   return text( a.Directory ) < text( b.Directory );
+				   } );
+
+		Header header;
+		memcpy( header.Magic, IndexMagic, sizeof( header.Magic ) );
+		header.Version = IndexVersion;
+		header.ByteOrder = IndexByteOrder;
+		header.Recursive = watch.Recursive ? 1 : 0;
+		header.DirectorySize = (Uint32)watch.Directory.size();
+		header.Directory = addText( watch.Directory );
+		header.DirectoryCount = Directories.size();
+		header.EntryCount = Entries.size();
+		header.TextSize = Text.size();
+
+		/// Written aside and moved over the index, so a crash never leaves half of one
+		std::string temporary( file + ".tmp" );
+		std::ofstream stream( temporary.c_str(), std::ios::binary | std::ios::trunc );
+
+		if ( !stream.is_open() )
+			return false;
+
+		stream.write( (const char*)&header, sizeof( header ) );
+		stream.write( (const char*)Directories.data(),
+					  Directories.size() * sizeof( DirectoryRecord ) );
+		stream.write( (const char*)Entries.data(), Entries.size() * sizeof( Info ) );
+		stream.write( Text.data(), Text.size() );
+		stream.close();
+
+		if ( !stream ) {
+			std::remove( temporary.c_str() );
+			return false;
+		}
+
+		/// Win32 doesn't replace an existing file
+		if ( 0 != std::rename( temporary.c_str(), file.c_str() ) ) {
+			std::remove( file.c_str() );
+
+			if ( 0 != std::rename( temporary.c_str(), file.c_str() ) ) {
+				std::remove( temporary.c_str() );
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+  protected:
+	Uint64 addText( std::string_view text ) {
+		Uint64 offset = Text.size();
+		Text.append( text.data(), text.size() );
+		return offset;
+	}
+
+	std::string_view text( const Info& info ) const {
+		return std::string_view( Text ).substr( info.Name, info.NameSize );
+	}
+
+	void fill( Info& info, std::string_view name, const FileStat& fi ) {
+		info.ModificationTime = fi.ModificationTime;
+		info.Size = fi.Size;
+		info.Inode = fi.Inode;
+		info.Permissions = fi.Permissions;
+		info.Ownership = fi.Ownership;
+		info.Reserved = 0;
+		info.NameSize = (Uint32)name.size();
+		info.Name = addText( name );
+	}
+};
+
+SnapshotIndex::SnapshotIndex() :
+	mData( NULL ),
+	mSize( 0 ),
+	mDirectories( NULL ),
+	mDirectoryCount( 0 ),
+	mEntries( NULL ),
+	mText( NULL ),
+	mFollowSymlinks( false ) {}
+
+SnapshotIndex::~SnapshotIndex() {
+	unload();
+}
+
+bool SnapshotIndex::load( const std::string& file, const Watcher& watch ) {
+	unload();
+
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	int fd = open( file.c_str(), O_RDONLY | O_CLOEXEC );
+
+	if ( -1 == fd )
+		return false;
+
+	struct stat st;
+
+	if ( 0 != fstat( fd, &st ) || st.st_size < (off_t)sizeof( Header ) ) {
+		close( fd );
+		return false;
+	}
+
+	void* data = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+	close( fd );
+
+	if ( MAP_FAILED == data )
+		return false;
+
+	mData = (const char*)data;
+	mSize = (size_t)st.st_size;
+#else
+	std::ifstream stream( file.c_str(), std::ios::binary );
+
+	if ( !stream.is_open() )
+		return false;
+
+	mBuffer.assign( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
+
+	if ( mBuffer.size() < sizeof( Header ) ) {
+		mBuffer.clear();
+		return false;
+	}
+
+	mData = mBuffer.data();
+	mSize = mBuffer.size();
+#endif
+
+	if ( !validate( watch ) ) {
+		unload();
+		return false;
+	}
+
+	return true;
+}
+
+void SnapshotIndex::unload() {
+#if EFSW_PLATFORM != EFSW_PLATFORM_WIN32
+	if ( NULL != mData ) {
+		munmap( (void*)mData, mSize );
+	}
+#else
+	mBuffer.clear();
+#endif
+
+	mData = NULL;
+	mSize = 0;
+	mDirectories = NULL;
+	mDirectoryCount = 0;
+	mEntries = NULL;
+	mText = NULL;
+}
+
+bool SnapshotIndex::validate( const Watcher& watch ) {
+	const Header* header = (const Header*)mData;
+
+	if ( 0 != memcmp( header->Magic, IndexMagic, sizeof( IndexMagic ) ) ||
+		 IndexVersion != header->Version || IndexByteOrder != header->ByteOrder ||
+		 ( 0 != header->Recursive ) != watch.Recursive )
+		return false;
+
+	/// Every count and offset is checked against the size of the file before any is used
+	Uint64 available = mSize - sizeof( Header );
+
+	if ( header->DirectoryCount > available / sizeof( DirectoryRecord ) )
+		return false;
+
+	available -= header->DirectoryCount * sizeof( DirectoryRecord );
+
+	if ( header->EntryCount > available / sizeof( Info ) )
+		return false;
+
+	available -= header->EntryCount * sizeof( Info );
+
+	if ( header->TextSize != available )
+		return false;
+
+	mDirectories = (const DirectoryRecord*)( mData + sizeof( Header ) );
+	mDirectoryCount = (size_t)header->DirectoryCount;
+	mEntries = (const Info*)( mDirectories + mDirectoryCount );
+	mText = (const char*)( mEntries + header->EntryCount );
+
+	Uint64 textSize = header->TextSize;
+
+	if ( header->Directory > textSize || header->DirectorySize > textSize - header->Directory ||
+		 std::string_view( mText + header->Directory, header->DirectorySize ) != watch.Directory )
+		return false;
+
+	for ( size_t i = 0; i < mDirectoryCount; i++ ) {
+		const DirectoryRecord& record = mDirectories[i];
+
+		if ( record.Directory.Name > textSize ||
+			 record.Directory.NameSize > textSize - record.Directory.Name ||
+			 record.FirstEntry > header->EntryCount ||
+			 record.EntryCount > header->EntryCount - record.FirstEntry )
+			return false;
+	}
+
+	for ( Uint64 i = 0; i < header->EntryCount; i++ ) {
+		if ( mEntries[i].Name > textSize || mEntries[i].NameSize > textSize - mEntries[i].Name )
+			return false;
+	}
+
+	return true;
+}
+
+std::string_view SnapshotIndex::name( const Info& info ) const {
+	return std::string_view( mText + info.Name, info.NameSize );
+}
+
+const SnapshotIndex::DirectoryRecord* SnapshotIndex::find( std::string_view relative ) const {
+	const DirectoryRecord* end = mDirectories + mDirectoryCount;
+	const DirectoryRecord* found =
+		std::lower_bound( mDirectories, end, relative,
+						  [this]( const DirectoryRecord& record, std::string_view path ) {
+							  return name( record.Directory ) < path;
+						  } );
+
+	return found != end && name( found->Directory ) == relative ? found : NULL;
+}
+
+void SnapshotIndex::assign( FileStat& fi, const Info& info ) {
+	fi.ModificationTime = info.ModificationTime;
+	fi.Size = info.Size;
+	fi.Inode = info.Inode;
+	fi.Permissions = info.Permissions;
+	fi.Ownership = info.Ownership;
+}
+
+bool SnapshotIndex::descends( const Watcher& watch, const std::string& path,
+							  bool followSymlinks ) {
+	return watch.Recursive && !watch.prunes( path ) &&
+		   ( followSymlinks || !FileInfo::isLink( path ) );
+}
+
+void SnapshotIndex::send( const Watcher& watch, std::string_view dir, std::string_view name,
+						  Action action, std::string_view oldName ) {
+	WatchCounters::add( watch.Counters->Received );
+
+	if ( watch.accepts( action ) && watch.matches( dir, name, oldName ) ) {
+		mBatch.add( watch.Listener, watch.ID, dir, name, action, oldName );
+	}
+}
+
+void SnapshotIndex::report( const Watcher& watch, bool followSymlinks ) {
+	const DirectoryRecord* root = find( std::string_view() );
+
+	if ( NULL == root )
+		return;
+
+	mFollowSymlinks = followSymlinks;
+	mVisited.clear();
+
+	reportDirectory( watch, watch.Directory, std::string(), *root );
+
+	mVisited.clear();
+}
+
+void SnapshotIndex::reportDirectory( const Watcher& watch, const std::string& path,
+									 const std::string& relative,
+									 const DirectoryRecord& record ) {
+	DirectorySnapshot snapshot;
+
+	/// The subdirectories have records of their own
+	snapshot.setStatDirectories( false );
+	snapshot.restore( path, record.ListedTime, record.ListedAt );
+
+	for ( Uint64 i = 0; i < record.EntryCount; i++ ) {
+		const Info& entry = mEntries[record.FirstEntry + i];
+
+		assign( snapshot.Files.append( name( entry ) ), entry );
+	}
+
+	snapshot.Files.sort();
+
+	DirectorySnapshotDiff& Diff = snapshot.scan();
+
+	/// Gone, its parent reports it deleted
+	if ( !snapshot.DirectoryInfo.isDirectory() )
+		return;
+
+	if ( FileInfo::inodeSupported() ) {
+		mVisited.insert( snapshot.DirectoryInfo.Inode );
+	}
+
+	FileInfoList::iterator it;
+	MovedList::iterator mit;
+	char slash = FileSystem::getOSSlash();
+
+	DiffIterator( FilesCreated ) {
+		send( watch, path, FileSystem::fileNameFromPath( it->Filepath ), Actions::Add );
+	}
+
+	DiffIterator( FilesModified ) {
+		send( watch, path, FileSystem::fileNameFromPath( it->Filepath ), Actions::Modified );
+	}
+
+	DiffIterator( FilesDeleted ) {
+		send( watch, path, FileSystem::fileNameFromPath( it->Filepath ), Actions::Delete );
+	}
+
+	DiffMovedIterator( FilesMoved ) {
+		send( watch, path, FileSystem::fileNameFromPath( mit->second.Filepath ), Actions::Moved,
+			  mit->first );
+	}
+
+	/// The subdirectories created or moved here aren't compared with the records of their names
+	std::unordered_set<std::string> arrived;
+
+	DiffIterator( DirsCreated ) {
+		std::string dirName( FileSystem::fileNameFromPath( it->Filepath ) );
+
+		send( watch, path, dirName, Actions::Add );
+		arrived.insert( dirName );
+
+		if ( descends( watch, it->Filepath, mFollowSymlinks ) ) {
+			reportCreated( watch, it->Filepath + slash );
+		}
+	}
+
+	DiffIterator( DirsDeleted ) {
+		std::string dirName( FileSystem::fileNameFromPath( it->Filepath ) );
+
+		send( watch, path, dirName, Actions::Delete );
+
+		if ( watch.Recursive ) {
+			reportDeleted( watch, it->Filepath + slash, relative + dirName + slash );
+		}
+	}
+
+	DiffMovedIterator( DirsMoved ) {
+		std::string dirName( FileSystem::fileNameFromPath( mit->second.Filepath ) );
+
+		send( watch, path, dirName, Actions::Moved, mit->first );
+		arrived.insert( dirName );
+
+		if ( descends( watch, mit->second.Filepath, mFollowSymlinks ) ) {
+			const DirectoryRecord* moved = find( relative + mit->first + slash );
+
+			if ( NULL != moved ) {
+				reportDirectory( watch, mit->second.Filepath + slash,
+								 relative + dirName + slash, *moved );
+			} else {
+				reportCreated( watch, mit->second.Filepath + slash );
+			}
+		}
+	}
+
+	mBatch.flush();
+
+	if ( !watch.Recursive )
+		return;
+
+	for ( FileInfoMap::iterator fit = snapshot.Files.begin(); fit != snapshot.Files.end();
+		  ++fit ) {
+		std::string dirName( fit->first );
+
+		if ( !fit->second.isDirectory() || arrived.count( dirName ) > 0 )
+			continue;
+
+		std::string child( snapshot.entryPath( dirName ) );
+		const DirectoryRecord* childRecord = find( relative + dirName + slash );
+
+		/// A directory that wasn't indexed ( excluded then ) has no changes to report
+		if ( NULL != childRecord && descends( watch, child, mFollowSymlinks ) ) {
+			reportDirectory( watch, child + slash, relative + dirName + slash, *childRecord );
+		}
+	}
+}
+
+void SnapshotIndex::reportCreated( const Watcher& watch, const std::string& path ) {
+	DirectorySnapshot snapshot;
+	snapshot.setStatDirectories( false );
+	snapshot.init( path );
+
+	if ( !snapshot.DirectoryInfo.isDirectory() ||
+		 ( FileInfo::inodeSupported() &&
+		   !mVisited.insert( snapshot.DirectoryInfo.Inode ).second ) )
+		return;
+
+	for ( FileInfoMap::iterator it = snapshot.Files.begin(); it != snapshot.Files.end(); ++it ) {
+		send( watch, path, it->first, Actions::Add );
+	}
+
+	mBatch.flush();
+
+	for ( FileInfoMap::iterator it = snapshot.Files.begin(); it != snapshot.Files.end(); ++it ) {
+		std::string child( snapshot.entryPath( it->first ) );
+
+		if ( it->second.isDirectory() && descends( watch, child, mFollowSymlinks ) ) {
+			reportCreated( watch, child + FileSystem::getOSSlash() );
+		}
+	}
+}
+
+void SnapshotIndex::reportDeleted( const Watcher& watch, const std::string& path,
+								   const std::string& relative ) {
+	const DirectoryRecord* record = find( relative );
+
+	if ( NULL == record )
+		return;
+
+	for ( Uint64 i = 0; i < record->EntryCount; i++ ) {
+		send( watch, path, name( mEntries[record->FirstEntry + i] ), Actions::Delete );
+	}
+
+	mBatch.flush();
+
+	for ( Uint64 i = 0; i < record->EntryCount; i++ ) {
+		const Info& entry = mEntries[record->FirstEntry + i];
+
+		if ( 0 != S_ISDIR( entry.Permissions ) ) {
+			std::string entryName( name( entry ) );
+
+			reportDeleted( watch, path + entryName + FileSystem::getOSSlash(),
+						   relative + entryName + FileSystem::getOSSlash() );
+		}
+	}
+}
+
+bool SnapshotIndex::save( const std::string& file, const Watcher& watch, bool followSymlinks ) {
+	Writer writer;
+	std::unordered_set<Uint64> visited;
+
+	saveDirectory( writer, watch, watch.Directory, std::string(), followSymlinks, visited );
+
+	return writer.write( file, watch );
+}
+
+void SnapshotIndex::saveDirectory( Writer& writer, const Watcher& watch, const std::string& path,
+								   const std::string& relative, bool followSymlinks,
+								   std::unordered_set<Uint64>& visited ) {
+	DirectorySnapshot snapshot;
+	snapshot.setStatDirectories( false );
+	snapshot.init( path );
+
+	if ( !snapshot.DirectoryInfo.isDirectory() ||
+		 ( FileInfo::inodeSupported() && !visited.insert( snapshot.DirectoryInfo.Inode ).second ) )
+		return;
+
+	writer.addDirectory( relative, snapshot );
+
+	if ( !watch.Recursive )
+		return;
+
+	for ( FileInfoMap::iterator it = snapshot.Files.begin(); it != snapshot.Files.end(); ++it ) {
+		std::string child( snapshot.entryPath( it->first ) );
+
+		if ( it->second.isDirectory() && descends( watch, child, followSymlinks ) ) {
+			saveDirectory( writer, watch, child + FileSystem::getOSSlash(),
+						   relative + std::string( it->first ) + FileSystem::getOSSlash(),
+						   followSymlinks, visited );
+		}
+	}
+}
+
+SnapshotStore::SnapshotStore() {}
+
+SnapshotStore::~SnapshotStore() {
+	Lock lock( mMutex );
+
+	while ( !mWatches.empty() ) {
+		releaseLocked( mWatches.begin() );
+	}
+}
+
+std::string SnapshotStore::file( const std::vector<WatcherOption>& options ) {
+	std::string file;
+
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		if ( Options::SnapshotFile == options[i].mOption ) {
+			file = options[i].mPattern;
+		}
+	}
+
+	return file;
+}
+
+void SnapshotStore::attach( WatchID watchid, const std::string& directory,
+							FileWatchListener* listener, bool recursive, int interests,
+							const std::vector<WatcherOption>& options, bool followSymlinks,
+							const std::shared_ptr<WatchCounters>& counters ) {
+	std::string dir( directory );
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	Entry* entry = new Entry();
+	entry->Watch = Watcher( watchid, dir, listener, recursive );
+	entry->Watch.EventInterests = interests;
+	entry->Watch.Filter = PathFilter::create( dir, options );
+
+	if ( counters ) {
+		entry->Watch.Counters = counters;
+	}
+
+	entry->File = file( options );
+	entry->FollowSymlinks = followSymlinks;
+
+	SnapshotIndex index;
+
+	if ( index.load( entry->File, entry->Watch ) ) {
+		index.report( entry->Watch, followSymlinks );
+	}
+
+	Lock lock( mMutex );
+	mWatches.push_back( entry );
+}
+
+void SnapshotStore::release( WatchID watchid ) {
+	Lock lock( mMutex );
+
+	for ( std::vector<Entry*>::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		if ( ( *it )->Watch.ID == watchid ) {
+			releaseLocked( it );
+			return;
+		}
+	}
+}
+
+void SnapshotStore::releaseLocked( std::vector<Entry*>::iterator it ) {
+	Entry* entry = *it;
+
+	if ( !SnapshotIndex::save( entry->File, entry->Watch, entry->FollowSymlinks ) ) {
+		efDEBUG( "Couldn't write the snapshot index %s\n", entry->File.c_str() );
+	}
+
+	mWatches.erase( it );
+	efSAFE_DELETE( entry );
+}
+
+} // namespace efsw
@@ -0,0 +1,165 @@
+#ifndef EFSW_SNAPSHOTINDEX_HPP
+#define EFSW_SNAPSHOTINDEX_HPP
+
+#include <efsw/DirectorySnapshot.hpp>
+#include <efsw/EventBatch.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/Watcher.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace efsw {
+
+/// The snapshots of the directories of a watch saved to a file ( Options::SnapshotFile ), to
+/// report the changes made while the watch wasn't running.
+/// The file holds a header, the records of the directories sorted by their path relative to the
+/// watched one, the records of their entries sorted by name, then the text of the paths and the
+/// names. The records have a fixed size and point into the text by offset, so the file is used
+/// mapped as it is, in the byte order of the machine that wrote it ( others are rejected ).
+/// The directories are compared with the snapshots one at a time: a directory whose modification
+/// time didn't change isn't listed, only its entries are stat'ed.
+class SnapshotIndex {
+  public:
+	SnapshotIndex();
+
+	~SnapshotIndex();
+
+	SnapshotIndex( const SnapshotIndex& ) = delete;
+
+	SnapshotIndex& operator=( const SnapshotIndex& ) = delete;
+
+	/// Maps the index of the watch
+	/// @return False if the file is missing, or isn't a valid index of the same watch
+	bool load( const std::string& file, const Watcher& watch );
+
+	/// Scans the directories of the watch against the index loaded, reporting the changes to its
+	/// listener
+	void report( const Watcher& watch, bool followSymlinks );
+
+	/// Lists the directories of the watch and writes their index, replacing the file once written
+	/// @return False if the file couldn't be written
+	static bool save( const std::string& file, const Watcher& watch, bool followSymlinks );
+
+  protected:
+	struct Info {
+		Uint64 ModificationTime;
+		Uint64 Size;
+		Uint64 Inode;
+		Uint32 Permissions;
+		/// See FileStat::Ownership
+		Uint32 Ownership;
+		Uint32 Reserved;
+		/// The name of the entry, or the relative path of the directory with the slash at the end
+		Uint32 NameSize;
+		Uint64 Name;
+	};
+
+	struct DirectoryRecord {
+		Info Directory;
+		/// The state of the snapshot, see DirectorySnapshot::restore
+		Uint64 ListedTime;
+		Uint64 ListedAt;
+		Uint64 FirstEntry;
+		Uint64 EntryCount;
+	};
+
+	struct Header;
+
+	class Writer;
+
+	/// The file mapped
+	const char* mData;
+	size_t mSize;
+	/// The buffer read where mapping isn't supported
+	std::vector<char> mBuffer;
+
+	const DirectoryRecord* mDirectories;
+	size_t mDirectoryCount;
+	const Info* mEntries;
+	const char* mText;
+
+	/// The directories reported during a report, so the links looping back are walked once
+	std::unordered_set<Uint64> mVisited;
+
+	bool mFollowSymlinks;
+
+	EventBatch mBatch;
+
+	void unload();
+
+	bool validate( const Watcher& watch );
+
+	std::string_view name( const Info& info ) const;
+
+	/// @return The record of the directory, relative to the watched one, NULL if there's none
+	const DirectoryRecord* find( std::string_view relative ) const;
+
+	/// @return True if the directory can be descended into
+	static bool descends( const Watcher& watch, const std::string& path, bool followSymlinks );
+
+	void send( const Watcher& watch, std::string_view dir, std::string_view name, Action action,
+			   std::string_view oldName = {} );
+
+	/// Reports the changes of the directory since its record, then of its subdirectories
+	void reportDirectory( const Watcher& watch, const std::string& path,
+						  const std::string& relative, const DirectoryRecord& record );
+
+	/// Reports everything under a directory created as added
+	void reportCreated( const Watcher& watch, const std::string& path );
+
+	/// Reports everything under a directory of the index deleted as deleted
+	void reportDeleted( const Watcher& watch, const std::string& path,
+						const std::string& relative );
+
+	static void assign( FileStat& fi, const Info& info );
+
+	static void saveDirectory( Writer& writer, const Watcher& watch, const std::string& path,
+							   const std::string& relative, bool followSymlinks,
+							   std::unordered_set<Uint64>& visited );
+};
+
+/// Keeps the index files of the watches with Options::SnapshotFile: reports the changes since the
+/// index was saved when a watch is added, and saves it again once the watch is removed or the
+/// FileWatcher destroyed.
+class SnapshotStore {
+  public:
+	SnapshotStore();
+
+	/// Saves the index of the watches left
+	~SnapshotStore();
+
+	/// @return The index file set by the options, empty if none
+	static std::string file( const std::vector<WatcherOption>& options );
+
+	/// Reports the changes since the index of a watch just added was saved, from the calling
+	/// thread, then keeps the watch to save its index once it's removed
+	/// @param listener The listener the backend delivers the events of the watch to
+	/// @param interests The Interests::Interest flags of the watch
+	/// @param counters The counters of the watch in the backend, to count the changes reported
+	void attach( WatchID watchid, const std::string& directory, FileWatchListener* listener,
+				 bool recursive, int interests, const std::vector<WatcherOption>& options,
+				 bool followSymlinks, const std::shared_ptr<WatchCounters>& counters );
+
+	/// Saves the index of the watch and forgets it
+	void release( WatchID watchid );
+
+  protected:
+	struct Entry {
+		Watcher Watch;
+		std::string File;
+		bool FollowSymlinks;
+	};
+
+	std::vector<Entry*> mWatches;
+
+	/// Guards the watches list
+	Mutex mMutex;
+
+	void releaseLocked( std::vector<Entry*>::iterator it );
+};
+
+} // namespace efsw
+
+#endif
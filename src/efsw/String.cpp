@@ -1,7 +1,19 @@
 #include <efsw/String.hpp>
 #include <efsw/Utf.hpp>
+#include <cwchar>
 #include <iterator>
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define EFSW_UTF_SSE2
+#elif defined( _M_ARM64 ) || ( defined( __ARM_NEON ) && defined( __aarch64__ ) )
+#include <arm_neon.h>
+#define EFSW_UTF_NEON
+#endif
+
+/// What the invalid sequences and the unpaired surrogates become
+#define UTF_REPLACEMENT 0xFFFD
+
 namespace efsw {
 
 const std::size_t String::InvalidPos = StringType::npos;
@@ -174,6 +186,229 @@ String String::fromUtf8( const std::string& utf8String ) {
 	return String( utf32 );
 }
 
+/// The units are Uint16, or wchar_t where it's 16 bits
+template <typename Unit>
+static std::size_t utf8ToUnits( const char* input, std::size_t size, Unit* output ) {
+	const Uint8* in = (const Uint8*)input;
+	const Uint8* end = in + size;
+	Unit* out = output;
+
+	while ( in < end ) {
+#if defined( EFSW_UTF_SSE2 )
+		while ( end - in >= 16 ) {
+			__m128i bytes = _mm_loadu_si128( (const __m128i*)in );
+
+			if ( 0 != _mm_movemask_epi8( bytes ) )
+				break;
+
+			__m128i zero = _mm_setzero_si128();
+			_mm_storeu_si128( (__m128i*)out, _mm_unpacklo_epi8( bytes, zero ) );
+			_mm_storeu_si128( (__m128i*)( out + 8 ), _mm_unpackhi_epi8( bytes, zero ) );
+			in += 16;
+			out += 16;
+		}
+#elif defined( EFSW_UTF_NEON )
+		while ( end - in >= 16 ) {
+			uint8x16_t bytes = vld1q_u8( in );
+
+			if ( vmaxvq_u8( bytes ) >= 0x80 )
+				break;
+
+			vst1q_u16( (uint16_t*)out, vmovl_u8( vget_low_u8( bytes ) ) );
+			vst1q_u16( (uint16_t*)( out + 8 ), vmovl_u8( vget_high_u8( bytes ) ) );
+			in += 16;
+			out += 16;
+		}
+#else
+		while ( end - in >= 8 ) {
+			Uint64 word;
+			memcpy( &word, in, 8 );
+
+			if ( 0 != ( word & 0x8080808080808080ULL ) )
+				break;
+
+			for ( int i = 0; i < 8; i++ ) {
+				out[i] = (Unit)in[i];
+			}
+
+			in += 8;
+			out += 8;
+		}
+#endif
+
+		if ( in == end )
+			break;
+
+		Uint32 c = *in++;
+
+		if ( c < 0x80 ) {
+			*out++ = (Unit)c;
+			continue;
+		}
+
+		/// The lead byte gives the length, and the smallest code point of that length
+		int trailing;
+		Uint32 min;
+
+		if ( c >= 0xC2 && c <= 0xDF ) {
+			trailing = 1;
+			min = 0x80;
+			c &= 0x1F;
+		} else if ( 0xE0 == ( c & 0xF0 ) ) {
+			trailing = 2;
+			min = 0x800;
+			c &= 0x0F;
+		} else if ( c >= 0xF0 && c <= 0xF4 ) {
+			trailing = 3;
+			min = 0x10000;
+			c &= 0x07;
+		} else {
+			*out++ = (Unit)UTF_REPLACEMENT;
+			continue;
+		}
+
+		int i = 0;
+
+		for ( ; i < trailing && in < end && 0x80 == ( *in & 0xC0 ); i++ ) {
+			c = ( c << 6 ) | ( *in++ & 0x3F );
+		}
+
+		/// Truncated, overlong, a surrogate or past the last code point
+		if ( i < trailing || c < min || c > 0x10FFFF || ( c >= 0xD800 && c <= 0xDFFF ) ) {
+			*out++ = (Unit)UTF_REPLACEMENT;
+		} else if ( c >= 0x10000 ) {
+			c -= 0x10000;
+			*out++ = (Unit)( 0xD800 + ( c >> 10 ) );
+			*out++ = (Unit)( 0xDC00 + ( c & 0x3FF ) );
+		} else {
+			*out++ = (Unit)c;
+		}
+	}
+
+	return out - output;
+}
+
+template <typename Unit>
+static std::size_t unitsToUtf8( const Unit* input, std::size_t size, char* output ) {
+	const Unit* in = input;
+	const Unit* end = in + size;
+	Uint8* out = (Uint8*)output;
+
+	while ( in < end ) {
+#if defined( EFSW_UTF_SSE2 )
+		while ( end - in >= 8 ) {
+			__m128i units = _mm_loadu_si128( (const __m128i*)in );
+			__m128i high = _mm_and_si128( units, _mm_set1_epi16( (short)0xFF80 ) );
+
+			if ( 0xFFFF != _mm_movemask_epi8( _mm_cmpeq_epi16( high, _mm_setzero_si128() ) ) )
+				break;
+
+			_mm_storel_epi64( (__m128i*)out, _mm_packus_epi16( units, units ) );
+			in += 8;
+			out += 8;
+		}
+#elif defined( EFSW_UTF_NEON )
+		while ( end - in >= 8 ) {
+			uint16x8_t units = vld1q_u16( (const uint16_t*)in );
+
+			if ( vmaxvq_u16( units ) >= 0x80 )
+				break;
+
+			vst1_u8( out, vmovn_u16( units ) );
+			in += 8;
+			out += 8;
+		}
+#else
+		while ( end - in >= 4 && ( in[0] | in[1] | in[2] | in[3] ) < 0x80 ) {
+			for ( int i = 0; i < 4; i++ ) {
+				out[i] = (Uint8)in[i];
+			}
+
+			in += 4;
+			out += 4;
+		}
+#endif
+
+		if ( in == end )
+			break;
+
+		Uint32 c = (Uint16)*in++;
+
+		if ( c < 0x80 ) {
+			*out++ = (Uint8)c;
+			continue;
+		}
+
+		if ( c >= 0xD800 && c <= 0xDFFF ) {
+			Uint32 low = in < end ? (Uint16)*in : 0;
+
+			if ( c <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF ) {
+				c = 0x10000 + ( ( c - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+				in++;
+			} else {
+				c = UTF_REPLACEMENT;
+			}
+		}
+
+		if ( c < 0x800 ) {
+			*out++ = (Uint8)( 0xC0 | ( c >> 6 ) );
+		} else if ( c < 0x10000 ) {
+			*out++ = (Uint8)( 0xE0 | ( c >> 12 ) );
+			*out++ = (Uint8)( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+		} else {
+			*out++ = (Uint8)( 0xF0 | ( c >> 18 ) );
+			*out++ = (Uint8)( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+			*out++ = (Uint8)( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+		}
+
+		*out++ = (Uint8)( 0x80 | ( c & 0x3F ) );
+	}
+
+	return out - (Uint8*)output;
+}
+
+std::size_t String::utf8ToUtf16( const char* input, std::size_t size, Uint16* output ) {
+	return utf8ToUnits( input, size, output );
+}
+
+std::size_t String::utf16ToUtf8( const Uint16* input, std::size_t size, char* output ) {
+	return unitsToUtf8( input, size, output );
+}
+
+#ifndef EFSW_NO_WIDECHAR
+void String::utf8ToWide( std::string_view utf8, std::wstring& wide ) {
+#if WCHAR_MAX <= 0xFFFF
+	wide.resize( utf8.size() );
+	wide.resize( utf8ToUnits( utf8.data(), utf8.size(), &wide[0] ) );
+#else
+	wide.clear();
+	Utf8::ToWide( utf8.begin(), utf8.end(), std::back_inserter( wide ) );
+#endif
+}
+
+std::wstring String::utf8ToWide( std::string_view utf8 ) {
+	std::wstring wide;
+	utf8ToWide( utf8, wide );
+	return wide;
+}
+
+void String::wideToUtf8( const wchar_t* wide, std::size_t size, std::string& utf8 ) {
+#if WCHAR_MAX <= 0xFFFF
+	utf8.resize( size * 3 );
+	utf8.resize( unitsToUtf8( wide, size, &utf8[0] ) );
+#else
+	utf8.clear();
+	Utf32::toUtf8( wide, wide + size, std::back_inserter( utf8 ) );
+#endif
+}
+
+std::string String::wideToUtf8( std::wstring_view wide ) {
+	std::string utf8;
+	wideToUtf8( wide.data(), wide.size(), utf8 );
+	return utf8;
+}
+#endif
+
 String::operator std::string() const {
 	return toAnsiString();
 }
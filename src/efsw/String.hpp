@@ -16,6 +16,7 @@
 #include <locale>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace efsw {
@@ -77,6 +78,35 @@ class String {
 	**/
 	static String fromUtf8( const std::string& utf8String );
 
+	/** @brief Convert UTF-8 to UTF-16 straight into the buffer given, without the UTF-32
+	** intermediate. The runs of ASCII are widened 16 bytes at a time. Invalid sequences become
+	** U+FFFD.
+	** @param output Room for size units, a byte never takes more than one
+	** @return The number of units written
+	**/
+	static std::size_t utf8ToUtf16( const char* input, std::size_t size, Uint16* output );
+
+	/** @brief Convert UTF-16 to UTF-8 straight into the buffer given. The runs of ASCII are
+	** narrowed 8 units at a time. Unpaired surrogates become U+FFFD.
+	** @param output Room for 3 bytes per unit
+	** @return The number of bytes written
+	**/
+	static std::size_t utf16ToUtf8( const Uint16* input, std::size_t size, char* output );
+
+#ifndef EFSW_NO_WIDECHAR
+	/** @brief Convert UTF-8 to a wide string, reusing its capacity
+	** Where wchar_t is 16 bits it's the same as utf8ToUtf16.
+	**/
+	static void utf8ToWide( std::string_view utf8, std::wstring& wide );
+
+	static std::wstring utf8ToWide( std::string_view utf8 );
+
+	/** @brief Convert a wide string to UTF-8, reusing the capacity of the string */
+	static void wideToUtf8( const wchar_t* wide, std::size_t size, std::string& utf8 );
+
+	static std::string wideToUtf8( std::wstring_view wide );
+#endif
+
 	/** @brief Default constructor
 	** This constructor creates an empty string.
 	**/
@@ -0,0 +1,69 @@
+#ifndef EFSW_TRACE_HPP
+#define EFSW_TRACE_HPP
+
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <chrono>
+
+namespace efsw {
+
+/// @return The time of the trace events, in nanoseconds of the steady clock
+inline Uint64 traceTime() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch() )
+		.count();
+}
+
+#ifdef EFSW_TRACING
+
+/// Reports the time from its construction to the end of its scope as a span of the hooks
+class TraceSpan {
+  public:
+	TraceSpan( TraceHooks* hooks, const char* name, WatchID watchid = 0 ) :
+		mHooks( hooks ), mName( name ), mID( watchid ), mBegin( NULL != hooks ? traceTime() : 0 ) {}
+
+	~TraceSpan() {
+		if ( NULL != mHooks ) {
+			mHooks->onSpan( mName, mID, mBegin, traceTime() );
+		}
+	}
+
+  protected:
+	TraceHooks* mHooks;
+	const char* mName;
+	WatchID mID;
+	Uint64 mBegin;
+};
+
+#define efTRACE_CONCAT_( a, b ) a##b
+#define efTRACE_CONCAT( a, b ) efTRACE_CONCAT_( a, b )
+
+/// Traces the rest of the scope as a span of the hooks of the FileWatcher
+#define efTRACE_SPAN( watcher, name ) \
+	efsw::TraceSpan efTRACE_CONCAT( traceSpan, __LINE__ )( ( watcher )->traceHooks(), name )
+
+/// Declares a variable holding the current trace time
+#define efTRACE_TIME( var ) efsw::Uint64 var = efsw::traceTime()
+
+/// Sets a trace time to now
+#define efTRACE_SET_TIME( var ) var = efsw::traceTime()
+
+/// Reports a span from a trace time to now
+#define efTRACE_SINCE( watcher, name, watchid, begin )                        \
+	do {                                                                      \
+		if ( efsw::TraceHooks* efTraceHooks = ( watcher )->traceHooks() )     \
+			efTraceHooks->onSpan( name, watchid, begin, efsw::traceTime() ); \
+	} while ( 0 )
+
+#else
+
+#define efTRACE_SPAN( watcher, name )
+#define efTRACE_TIME( var )
+#define efTRACE_SET_TIME( var )
+#define efTRACE_SINCE( watcher, name, watchid, begin )
+
+#endif
+
+} // namespace efsw
+
+#endif
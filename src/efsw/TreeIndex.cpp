@@ -0,0 +1,313 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/TreeIndex.hpp>
+#include <algorithm>
+#include <unordered_set>
+
+namespace efsw {
+
+/// Converts the separators of the OS to the ones of the keys
+static void toKeySlashes( std::string& path ) {
+	if ( '/' != FileSystem::getOSSlash() ) {
+		std::replace( path.begin(), path.end(), FileSystem::getOSSlash(), '/' );
+	}
+}
+
+IndexingListener::IndexingListener( FileWatchListener* listener, const std::string& directory,
+									bool recursive, const std::vector<WatcherOption>& options ) :
+	WatchStage( listener, directory ), mRecursive( recursive ), mSequence( 0 ) {
+	mFilter = PathFilter::create( mDirectory, options );
+}
+
+void IndexingListener::attach( WatchID watchid ) {
+	WatchStage::attach( watchid );
+
+	Lock lock( mLock );
+
+	listTree( "" );
+}
+
+void IndexingListener::handleFileActions( const Event* events, size_t count ) {
+	{
+		Lock lock( mLock );
+
+		for ( size_t i = 0; i < count; i++ ) {
+			apply( events[i] );
+		}
+	}
+
+	if ( NULL != mListener ) {
+		mListener->handleFileActions( events, count );
+	}
+}
+
+bool IndexingListener::find( const std::string& path, TreeEntry& entry ) {
+	Lock lock( mLock );
+
+	std::string key( queryKey( path ) );
+
+	while ( !key.empty() && '/' == key.back() ) {
+		key.pop_back();
+	}
+
+	EntryMap::iterator it = mEntries.find( key );
+
+	if ( it == mEntries.end() )
+		return false;
+
+	assign( entry, it->first, it->second );
+
+	return true;
+}
+
+bool IndexingListener::list( const std::string& directory, std::vector<TreeEntry>& entries ) {
+	entries.clear();
+
+	Lock lock( mLock );
+
+	std::string prefix( queryKey( directory ) );
+
+	while ( !prefix.empty() && '/' == prefix.back() ) {
+		prefix.pop_back();
+	}
+
+	if ( !prefix.empty() ) {
+		EntryMap::iterator it = mEntries.find( prefix );
+
+		if ( it == mEntries.end() || !it->second.Directory )
+			return false;
+
+		prefix += '/';
+	}
+
+	EntryMap::iterator it = mEntries.lower_bound( prefix );
+
+	while ( it != mEntries.end() && 0 == it->first.compare( 0, prefix.size(), prefix ) ) {
+		size_t slash = it->first.find( '/', prefix.size() );
+
+		if ( std::string::npos == slash ) {
+			entries.push_back( TreeEntry() );
+			assign( entries.back(), it->first, it->second );
+			++it;
+		} else {
+			/// Skips the entries of the subdirectory, they sort right after "sub/"
+			std::string last( it->first, 0, slash );
+			last += char( '/' + 1 );
+
+			it = mEntries.lower_bound( last );
+		}
+	}
+
+	/// The names sort apart from the paths, "a.txt" before "a/b" but "a" before "a.txt"
+	std::sort( entries.begin(), entries.end(),
+			   []( const TreeEntry& a, const TreeEntry& b ) { return a.path < b.path; } );
+
+	return true;
+}
+
+void IndexingListener::walk( const std::string& prefix,
+							 const std::function<bool( const TreeEntry& entry )>& visitor ) {
+	Lock lock( mLock );
+
+	std::string key( queryKey( prefix ) );
+	TreeEntry entry;
+
+	for ( EntryMap::iterator it = mEntries.lower_bound( key );
+		  it != mEntries.end() && 0 == it->first.compare( 0, key.size(), key ); ++it ) {
+		assign( entry, it->first, it->second );
+
+		if ( !visitor( entry ) )
+			break;
+	}
+}
+
+Uint64 IndexingListener::sequence() {
+	Lock lock( mLock );
+
+	return mSequence;
+}
+
+void IndexingListener::apply( const Event& event ) {
+	mSequence++;
+
+	/// The events lost are found listing the tree again
+	if ( Actions::Overflow == event.action ) {
+		mEntries.clear();
+		listTree( "" );
+		return;
+	}
+
+	if ( !entryKey( event.dir, event.filename, mKey ) )
+		return;
+
+	switch ( event.action ) {
+		case Actions::Add:
+			if ( update( mKey ) && mRecursive && mEntries[mKey].Directory ) {
+				listTree( mKey );
+			}
+			break;
+		case Actions::Modified:
+			update( mKey );
+			break;
+		case Actions::Delete:
+			erase( mKey );
+			break;
+		case Actions::Moved:
+			if ( entryKey( event.dir, event.oldFilename, mOldKey ) ) {
+				erase( mOldKey );
+			}
+
+			/// A directory moved is listed again, the changes made in it before the move may not
+			/// be reported under either name
+			erase( mKey );
+
+			if ( update( mKey ) && mRecursive && mEntries[mKey].Directory ) {
+				listTree( mKey );
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+bool IndexingListener::update( const std::string& key ) {
+	if ( !mInfo.getInfo( fullPath( key ) ) ) {
+		erase( key );
+		return false;
+	}
+
+	Record& record = mEntries[key];
+	record.Directory = mInfo.isDirectory();
+	record.Size = mInfo.Size;
+	record.ModificationTime = mInfo.ModificationTime;
+	record.Inode = mInfo.Inode;
+	record.Sequence = mSequence;
+
+	return true;
+}
+
+void IndexingListener::listTree( const std::string& key ) {
+	std::vector<std::string> pending( 1, key );
+	/// The directories listed, so the links looping back are listed once
+	std::unordered_set<Uint64> visited;
+	FileInfoMap files;
+
+	while ( !pending.empty() ) {
+		std::string dirKey;
+		dirKey.swap( pending.back() );
+		pending.pop_back();
+
+		std::string path( fullPath( dirKey ) );
+		FileSystem::dirAddSlashAtEnd( path );
+
+		FileSystem::listDirectory( path, files, true );
+
+		for ( FileInfoMap::iterator it = files.begin(); it != files.end(); ++it ) {
+			bool directory = it->second.isDirectory();
+
+			if ( directory ) {
+				if ( mFilter && mFilter->prunes( path + std::string( it->first ) ) )
+					continue;
+
+				if ( 0 != it->second.Inode && !visited.insert( it->second.Inode ).second )
+					continue;
+			} else if ( mFilter && !mFilter->matches( path, it->first ) ) {
+				continue;
+			}
+
+			std::string entry( dirKey );
+
+			if ( !entry.empty() ) {
+				entry += '/';
+			}
+
+			entry.append( it->first.data(), it->first.size() );
+
+			Record& record = mEntries[entry];
+			record.Directory = directory;
+			record.Size = it->second.Size;
+			record.ModificationTime = it->second.ModificationTime;
+			record.Inode = it->second.Inode;
+			record.Sequence = mSequence;
+
+			if ( directory && mRecursive ) {
+				pending.push_back( entry );
+			}
+		}
+	}
+}
+
+void IndexingListener::erase( std::string_view key ) {
+	EntryMap::iterator it = mEntries.find( key );
+
+	if ( it != mEntries.end() ) {
+		mEntries.erase( it );
+	}
+
+	/// The entries below sort between "key/" and "key0"
+	std::string first( key );
+	first += '/';
+	std::string last( key );
+	last += char( '/' + 1 );
+
+	mEntries.erase( mEntries.lower_bound( first ), mEntries.lower_bound( last ) );
+}
+
+bool IndexingListener::entryKey( std::string_view dir, std::string_view name,
+								 std::string& key ) const {
+	if ( name.empty() || dir.size() < mDirectory.size() ||
+		 dir.substr( 0, mDirectory.size() ) != mDirectory )
+		return false;
+
+	if ( !mRecursive && dir.size() != mDirectory.size() )
+		return false;
+
+	key.assign( dir.data() + mDirectory.size(), dir.size() - mDirectory.size() );
+	key.append( name.data(), name.size() );
+
+	toKeySlashes( key );
+
+	while ( !key.empty() && '/' == key.back() ) {
+		key.pop_back();
+	}
+
+	return !key.empty();
+}
+
+std::string IndexingListener::queryKey( const std::string& path ) const {
+	std::string key( path );
+
+	if ( 0 == key.compare( 0, mDirectory.size(), mDirectory ) ) {
+		key.erase( 0, mDirectory.size() );
+	} else if ( key.size() + 1 == mDirectory.size() &&
+				0 == mDirectory.compare( 0, key.size(), key ) ) {
+		key.clear();
+	}
+
+	toKeySlashes( key );
+
+	return key;
+}
+
+std::string IndexingListener::fullPath( std::string_view key ) const {
+	std::string path( mDirectory );
+	path.append( key.data(), key.size() );
+
+	if ( '/' != FileSystem::getOSSlash() ) {
+		std::replace( path.begin() + mDirectory.size(), path.end(), '/',
+					  FileSystem::getOSSlash() );
+	}
+
+	return path;
+}
+
+void IndexingListener::assign( TreeEntry& entry, const std::string& key, const Record& record ) {
+	entry.path = key;
+	entry.directory = record.Directory;
+	entry.size = record.Size;
+	entry.modificationTime = record.ModificationTime;
+	entry.inode = record.Inode;
+	entry.sequence = record.Sequence;
+}
+
+} // namespace efsw
@@ -0,0 +1,104 @@
+#ifndef EFSW_TREEINDEX_HPP
+#define EFSW_TREEINDEX_HPP
+
+#include <efsw/FileInfo.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/PathFilter.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace efsw {
+
+/// Listener placed right in front of the listener of a watch with Options::TreeIndex, after the
+/// other stages. It applies the events to the index of the watch, then passes them on to the
+/// listener, if the watch has one. The index holds the entries of the tree by their path relative
+/// to the watched directory, so a directory is a range of it.
+class IndexingListener : public WatchStage {
+  public:
+	/// @param listener The listener of the watch, NULL if its events are only indexed
+	IndexingListener( FileWatchListener* listener, const std::string& directory, bool recursive,
+					  const std::vector<WatcherOption>& options );
+
+	/// Lists the tree, once the watch is added so nothing changed in between is missed. The
+	/// events of the watch read meanwhile wait for it.
+	void attach( WatchID watchid ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	/// See FileWatcher::findEntry
+	bool find( const std::string& path, TreeEntry& entry );
+
+	/// See FileWatcher::listEntries
+	bool list( const std::string& directory, std::vector<TreeEntry>& entries );
+
+	/// See FileWatcher::walkEntries
+	void walk( const std::string& prefix,
+			   const std::function<bool( const TreeEntry& entry )>& visitor );
+
+	/// See FileWatcher::indexSequence
+	Uint64 sequence();
+
+  protected:
+	struct Record {
+		bool Directory;
+		Uint64 Size;
+		Uint64 ModificationTime;
+		Uint64 Inode;
+		Uint64 Sequence;
+	};
+
+	typedef std::map<std::string, Record, std::less<>> EntryMap;
+
+	bool mRecursive;
+
+	/// The patterns of the watch, to index what it reports
+	std::shared_ptr<const PathFilter> mFilter;
+
+	EntryMap mEntries;
+
+	/// The events applied
+	Uint64 mSequence;
+
+	/// Guards the entries, held while the events are applied and while the index is queried
+	Mutex mLock;
+
+	/// Reused by the events
+	std::string mKey;
+	std::string mOldKey;
+	FileInfo mInfo;
+
+	/// Lists the directory of the key and the ones below it into the index
+	void listTree( const std::string& key );
+
+	/// Applies the event to the index
+	void apply( const Event& event );
+
+	/// Stats the entry of the key into the index
+	/// @return False if it's gone
+	bool update( const std::string& key );
+
+	/// Erases the entry of the key and the ones below it
+	void erase( std::string_view key );
+
+	/// Sets the key of the event entry
+	/// @return False if the entry isn't in the tree of the watch
+	bool entryKey( std::string_view dir, std::string_view name, std::string& key ) const;
+
+	/// @return The key of a path given to a query, relative or full
+	std::string queryKey( const std::string& path ) const;
+
+	/// @return The full path of the entry of the key
+	std::string fullPath( std::string_view key ) const;
+
+	static void assign( TreeEntry& entry, const std::string& key, const Record& record );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef EFSW_WATCHCOUNTERS_HPP
+#define EFSW_WATCHCOUNTERS_HPP
+
+#include <efsw/base.hpp>
+#include <atomic>
+
+namespace efsw {
+
+/// The counters a backend keeps for a watch, shared by the watchers of its subdirectories and
+/// by its pollers. They are updated with relaxed atomics from the backend threads and read by
+/// FileWatcher::getStats, so they are only consistent with each other once the watch is idle.
+struct WatchCounters {
+	/// Events read from the system for the watch, or changes found by its scans
+	std::atomic<Uint64> Received{ 0 };
+	/// Events dropped by the interests or the patterns of the watch
+	std::atomic<Uint64> Filtered{ 0 };
+	/// Kernel watches and descriptors held by the watch
+	std::atomic<Uint64> KernelWatches{ 0 };
+	/// Polling passes that scanned directories, and their time in microseconds
+	std::atomic<Uint64> Scans{ 0 };
+	std::atomic<Uint64> ScanTime{ 0 };
+
+	static void add( std::atomic<Uint64>& counter, Uint64 value = 1 ) {
+		counter.fetch_add( value, std::memory_order_relaxed );
+	}
+
+	static void sub( std::atomic<Uint64>& counter, Uint64 value = 1 ) {
+		counter.fetch_sub( value, std::memory_order_relaxed );
+	}
+
+	static Uint64 get( const std::atomic<Uint64>& counter ) {
+		return counter.load( std::memory_order_relaxed );
+	}
+};
+
+} // namespace efsw
+
+#endif
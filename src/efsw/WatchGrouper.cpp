@@ -0,0 +1,410 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/WatchGrouper.hpp>
+#include <algorithm>
+
+namespace efsw {
+
+/// The ids of the nested watches start past the ones the backends give, which count up from 1
+static const WatchID NESTED_WATCH_ID_BASE = 0x40000000;
+
+/// Shortens the directory, with the slash at the end, to its parent
+/// @return False if it has none
+static bool parentDirectory( std::string& dir ) {
+	if ( dir.size() < 2 )
+		return false;
+
+	size_t slash = dir.find_last_of( FileSystem::getOSSlash(), dir.size() - 2 );
+
+	if ( std::string::npos == slash )
+		return false;
+
+	dir.resize( slash + 1 );
+	return true;
+}
+
+GroupingListener::GroupingListener( FileWatchListener* listener, FileWatchListener* owner,
+									const std::string& directory, bool recursive,
+									const std::vector<WatcherOption>& options ) :
+	mListener( listener ),
+	mOwner( owner ),
+	mDirectory( directory ),
+	mRecursive( recursive ),
+	mOptions( options ),
+	mID( 0 ) {}
+
+GroupingListener::~GroupingListener() {
+	for ( size_t i = 0; i < mMembers.size(); i++ ) {
+		efSAFE_DELETE( mMembers[i] );
+	}
+}
+
+void GroupingListener::handleFileEvent( WatchID watchid, std::string_view dir,
+										std::string_view filename, Action action,
+										std::string_view oldFilename ) {
+	Event event;
+	event.watchid = watchid;
+	event.dir = dir;
+	event.filename = filename;
+	event.action = action;
+	event.oldFilename = oldFilename;
+
+	handleFileActions( &event, 1 );
+}
+
+void GroupingListener::handleFileActions( const Event* events, size_t count ) {
+	Lock lock( mMutex );
+
+	if ( NULL != mListener ) {
+		mListener->handleFileActions( events, count );
+	}
+
+	if ( mMembers.empty() )
+		return;
+
+	for ( size_t i = 0; i < count; i++ ) {
+		route( events[i] );
+	}
+
+	deliver();
+}
+
+void GroupingListener::handleWatchError( WatchID watchid, Error error, std::string_view path ) {
+	Lock lock( mMutex );
+
+	if ( NULL != mListener ) {
+		mListener->handleWatchError( watchid, error, path );
+	}
+
+	Event event;
+	event.watchid = watchid;
+	event.dir = path;
+	event.action = Actions::Modified;
+
+	route( event );
+
+	for ( size_t i = 0; i < mTouched.size(); i++ ) {
+		Member* member = mTouched[i];
+		member->Listener->handleWatchError( member->ID, error, path );
+		member->Events.clear();
+	}
+
+	mTouched.clear();
+}
+
+void GroupingListener::handleWatchReady( WatchID watchid, size_t directories, size_t failures ) {
+	FileWatchListener* listener;
+
+	{
+		Lock lock( mMutex );
+		listener = mListener;
+	}
+
+	/// Called without the lock so the listener can remove the watch, the backend waits for the
+	/// crawl reporting it before removing it from another thread. The nested watches were ready
+	/// when they joined.
+	if ( NULL != listener ) {
+		listener->handleWatchReady( watchid, directories, failures );
+	}
+}
+
+void GroupingListener::route( const Event& event ) {
+	/// The events about the whole tree concern every watch in it
+	if ( Actions::Overflow == event.action || Actions::HistoryDone == event.action ) {
+		for ( size_t i = 0; i < mMembers.size(); i++ ) {
+			queue( mMembers[i], event );
+		}
+
+		return;
+	}
+
+	mKey.assign( event.dir.data(), event.dir.size() );
+	FileSystem::dirAddSlashAtEnd( mKey );
+
+	/// The members of the directory itself, then the recursive ones of its parents up to the
+	/// directory of the group, looked up by shortening the key
+	bool exact = true;
+
+	while ( mKey.size() >= mDirectory.size() ) {
+		std::unordered_map<std::string, std::vector<Member*>>::iterator it = mIndex.find( mKey );
+
+		if ( it != mIndex.end() ) {
+			for ( size_t i = 0; i < it->second.size(); i++ ) {
+				if ( exact || it->second[i]->Recursive ) {
+					queue( it->second[i], event );
+				}
+			}
+		}
+
+		if ( !parentDirectory( mKey ) )
+			break;
+
+		exact = false;
+	}
+}
+
+void GroupingListener::queue( Member* member, const Event& event ) {
+	if ( member->Events.empty() ) {
+		mTouched.push_back( member );
+	}
+
+	member->Events.push_back( event );
+	member->Events.back().watchid = member->ID;
+}
+
+void GroupingListener::deliver() {
+	for ( size_t i = 0; i < mTouched.size(); i++ ) {
+		Member* member = mTouched[i];
+		member->Listener->handleFileActions( member->Events.data(), member->Events.size() );
+		member->Events.clear();
+	}
+
+	mTouched.clear();
+}
+
+WatchGrouper::WatchGrouper() : mLastID( NESTED_WATCH_ID_BASE ) {}
+
+WatchGrouper::~WatchGrouper() {
+	for ( std::unordered_map<WatchID, GroupingListener*>::iterator it = mGroups.begin();
+		  it != mGroups.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+}
+
+std::string WatchGrouper::normalize( const std::string& directory ) {
+	std::string dir( directory );
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	std::string curPath;
+	std::string link( FileSystem::getLinkRealPath( dir, curPath ) );
+
+	return link.empty() ? dir : link;
+}
+
+bool WatchGrouper::groupable( const std::vector<WatcherOption>& options ) {
+	for ( size_t i = 0; i < options.size(); i++ ) {
+		/// The patterns are relative to the watch, the snapshot file belongs to a single one
+		if ( !options[i].mPattern.empty() )
+			return false;
+
+		/// The scope changes with the watch expanded and collapsed
+		if ( Options::MaxDepth == options[i].mOption )
+			return false;
+
+		/// The history is replayed to the watch asking for it alone
+		if ( ( Options::FSEventsSinceId == options[i].mOption ||
+			   Options::UsnSinceId == options[i].mOption ) &&
+			 0 != options[i].mValue )
+			return false;
+	}
+
+	return true;
+}
+
+/// @return True if the option is applied by FileWatcher to the events of the watch, after the
+/// backend
+static bool isStageOption( int option ) {
+	return Options::CoalesceWindow == option || Options::DispatchQueueSize == option ||
+		   Options::DispatchPolicy == option || Options::FullPath == option ||
+		   Options::Journal == option || Options::RateLimit == option ||
+		   Options::RateBurst == option || Options::RateLimitPolicy == option ||
+		   Options::TreeIndex == option || Options::ContentFingerprint == option;
+}
+
+bool WatchGrouper::sameOptions( const std::vector<WatcherOption>& a,
+								const std::vector<WatcherOption>& b ) {
+	size_t i = 0;
+	size_t j = 0;
+
+	while ( true ) {
+		while ( i < a.size() && isStageOption( a[i].mOption ) )
+			i++;
+
+		while ( j < b.size() && isStageOption( b[j].mOption ) )
+			j++;
+
+		if ( i == a.size() || j == b.size() )
+			return i == a.size() && j == b.size();
+
+		if ( a[i].mOption != b[j].mOption || a[i].mValue != b[j].mValue ||
+			 a[i].mPattern != b[j].mPattern )
+			return false;
+
+		i++;
+		j++;
+	}
+}
+
+void WatchGrouper::insert( GroupingListener* group, WatchID watchid ) {
+	Lock lock( mMutex );
+
+	group->mID = watchid;
+
+	mGroups[watchid] = group;
+	mRoots[group->mDirectory].push_back( group );
+}
+
+WatchID WatchGrouper::join( const std::string& directory, bool recursive,
+							const std::vector<WatcherOption>& options, FileWatchListener* owner,
+							FileWatchListener* listener ) {
+	Lock lock( mMutex );
+
+	if ( mRoots.empty() )
+		return 0;
+
+	/// The groups of the directory itself, then the recursive ones of its parents, looked up by
+	/// shortening the key
+	GroupingListener* group = NULL;
+	bool exact = true;
+
+	mKey = directory;
+
+	while ( NULL == group ) {
+		std::unordered_map<std::string, std::vector<GroupingListener*>>::iterator it =
+			mRoots.find( mKey );
+
+		if ( it != mRoots.end() ) {
+			for ( size_t i = 0; i < it->second.size(); i++ ) {
+				GroupingListener* candidate = it->second[i];
+
+				if ( ( candidate->mRecursive || ( exact && !recursive ) ) &&
+					 sameOptions( candidate->mOptions, options ) ) {
+					group = candidate;
+					break;
+				}
+			}
+		}
+
+		if ( !parentDirectory( mKey ) )
+			break;
+
+		exact = false;
+	}
+
+	if ( NULL == group )
+		return 0;
+
+	Lock memberLock( group->mMutex );
+
+	if ( NULL != group->mListener && group->mOwner == owner &&
+		 group->mDirectory == directory && group->mRecursive == recursive )
+		return Errors::Log::createLastError( Errors::FileRepeated, directory );
+
+	std::unordered_map<std::string, std::vector<GroupingListener::Member*>>::iterator same =
+		group->mIndex.find( directory );
+
+	if ( same != group->mIndex.end() ) {
+		for ( size_t i = 0; i < same->second.size(); i++ ) {
+			if ( same->second[i]->Owner == owner && same->second[i]->Recursive == recursive )
+				return Errors::Log::createLastError( Errors::FileRepeated, directory );
+		}
+	}
+
+	GroupingListener::Member* member = new GroupingListener::Member();
+	member->ID = ++mLastID;
+	member->Directory = directory;
+	member->Recursive = recursive;
+	member->Listener = listener;
+	member->Owner = owner;
+
+	group->mMembers.push_back( member );
+	group->mIndex[directory].push_back( member );
+
+	mNested[member->ID] = group;
+
+	return member->ID;
+}
+
+WatchID WatchGrouper::remove( WatchID watchid ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, GroupingListener*>::iterator nested = mNested.find( watchid );
+
+	if ( nested != mNested.end() ) {
+		GroupingListener* group = nested->second;
+		mNested.erase( nested );
+
+		Lock memberLock( group->mMutex );
+
+		for ( std::vector<GroupingListener::Member*>::iterator it = group->mMembers.begin();
+			  it != group->mMembers.end(); ++it ) {
+			GroupingListener::Member* member = *it;
+
+			if ( member->ID != watchid )
+				continue;
+
+			std::vector<GroupingListener::Member*>& same = group->mIndex[member->Directory];
+			same.erase( std::find( same.begin(), same.end(), member ) );
+
+			if ( same.empty() ) {
+				group->mIndex.erase( member->Directory );
+			}
+
+			group->mMembers.erase( it );
+			efSAFE_DELETE( member );
+			break;
+		}
+
+		/// The last watch of a group removed, the group goes as well
+		return NULL == group->mListener && group->mMembers.empty() ? group->mID : 0;
+	}
+
+	std::unordered_map<WatchID, GroupingListener*>::iterator group = mGroups.find( watchid );
+
+	if ( group == mGroups.end() )
+		return watchid;
+
+	Lock memberLock( group->second->mMutex );
+
+	if ( group->second->mMembers.empty() )
+		return watchid;
+
+	/// The backend keeps watching the tree for the nested watches
+	group->second->mListener = NULL;
+	return 0;
+}
+
+void WatchGrouper::release( WatchID watchid ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, GroupingListener*>::iterator it = mGroups.find( watchid );
+
+	if ( it == mGroups.end() )
+		return;
+
+	GroupingListener* group = it->second;
+
+	for ( size_t i = 0; i < group->mMembers.size(); i++ ) {
+		mNested.erase( group->mMembers[i]->ID );
+	}
+
+	std::vector<GroupingListener*>& roots = mRoots[group->mDirectory];
+	roots.erase( std::find( roots.begin(), roots.end(), group ) );
+
+	if ( roots.empty() ) {
+		mRoots.erase( group->mDirectory );
+	}
+
+	mGroups.erase( it );
+
+	delete group;
+}
+
+std::vector<std::string> WatchGrouper::directories() {
+	std::vector<std::string> dirs;
+
+	Lock lock( mMutex );
+
+	for ( std::unordered_map<WatchID, GroupingListener*>::iterator it = mGroups.begin();
+		  it != mGroups.end(); ++it ) {
+		Lock memberLock( it->second->mMutex );
+
+		for ( size_t j = 0; j < it->second->mMembers.size(); j++ ) {
+			dirs.push_back( it->second->mMembers[j]->Directory );
+		}
+	}
+
+	return dirs;
+}
+
+} // namespace efsw
@@ -0,0 +1,159 @@
+#ifndef EFSW_WATCHGROUPER_HPP
+#define EFSW_WATCHGROUPER_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/base.hpp>
+#include <efsw/efsw.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+/// Listener placed right after the backend for a watch whose tree others can share: the watches
+/// added later on the same tree or inside it, with the same backend options, join it instead of
+/// being crawled and watched again. The events reach the watch, and each nested watch whose
+/// directory they fall in with its id.
+class GroupingListener : public FileWatchListener {
+  public:
+	/// @param owner The listener given to FileWatcher::addWatch, to spot the same watch added twice
+	GroupingListener( FileWatchListener* listener, FileWatchListener* owner,
+					  const std::string& directory, bool recursive,
+					  const std::vector<WatcherOption>& options );
+
+	~GroupingListener();
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	void handleWatchReady( WatchID watchid, size_t directories, size_t failures ) override;
+
+  protected:
+	friend class WatchGrouper;
+
+	struct Member {
+		WatchID ID;
+		/// Normalized, see WatchGrouper::normalize
+		std::string Directory;
+		bool Recursive;
+		FileWatchListener* Listener;
+		/// The listener given to FileWatcher::addWatch
+		FileWatchListener* Owner;
+		/// The events of the batch being routed
+		std::vector<Event> Events;
+	};
+
+	/// The listener of the watch, NULL once removed while nested watches are left
+	FileWatchListener* mListener;
+
+	FileWatchListener* mOwner;
+
+	/// Normalized, see WatchGrouper::normalize
+	std::string mDirectory;
+
+	bool mRecursive;
+
+	/// The options the backend watches the tree with
+	std::vector<WatcherOption> mOptions;
+
+	WatchID mID;
+
+	std::vector<Member*> mMembers;
+
+	/// The members by directory
+	std::unordered_map<std::string, std::vector<Member*>> mIndex;
+
+	/// The members with events in the batch being routed
+	std::vector<Member*> mTouched;
+
+	/// The directories being looked up, kept to reuse its capacity
+	std::string mKey;
+
+	/// Guards the members, held while delivering so a member removed gets no more events
+	Mutex mMutex;
+
+	/// Queues the event for the members it falls in
+	void route( const Event& event );
+
+	void queue( Member* member, const Event& event );
+
+	/// Calls the listeners of the members with their events
+	void deliver();
+};
+
+/// Owns the grouping listeners of the watches of a backend, shared by the watchers of a reactor,
+/// and gives the watches nested in them their ids. A group outlives the watch it was added for
+/// while nested watches are left, so it's kept here rather than in the stages of that watch.
+class WatchGrouper {
+  public:
+	WatchGrouper();
+
+	~WatchGrouper();
+
+	/// @return The directory as the backends watch it: with the slash at the end, a symbolic link
+	/// resolved
+	static std::string normalize( const std::string& directory );
+
+	/// @return True if the options mean the same for a watch of any directory, so a watch nested
+	/// in another can share it
+	static bool groupable( const std::vector<WatcherOption>& options );
+
+	/// @return True if the backend watches the same way with both options, the ones applied
+	/// after it ( coalescing, dispatching, full paths, journal ) left aside
+	static bool sameOptions( const std::vector<WatcherOption>& a,
+							 const std::vector<WatcherOption>& b );
+
+	/// Takes the listener of a watch added to the backend, for the watches added later inside
+	/// it to join. Owned by the grouper from then on, until the backend watch is released.
+	void insert( GroupingListener* group, WatchID watchid );
+
+	/// Adds a watch to the group watching its directory already: one recursive on the directory or
+	/// a parent of it, or one not recursive on the same directory for a watch not recursive either
+	/// @param directory Normalized
+	/// @param owner The listener given to FileWatcher::addWatch
+	/// @param listener The listener to deliver the events of the nested watch to
+	/// @return The id of the nested watch, Errors::FileRepeated if the owner watches the directory
+	/// the same way already, 0 if no group watches it
+	WatchID join( const std::string& directory, bool recursive,
+				  const std::vector<WatcherOption>& options, FileWatchListener* owner,
+				  FileWatchListener* listener );
+
+	/// Takes a watch out of its group: a nested one stops receiving events, and a grouping one
+	/// only keeps delivering to the nested ones left.
+	/// @return The watch to remove from the backend, once its group is left empty ( the watch
+	/// itself if it isn't grouped ), 0 if none
+	WatchID remove( WatchID watchid );
+
+	/// Deletes the listener of a watch returned by remove, once removed from the backend
+	void release( WatchID watchid );
+
+	/// @return The directories of the nested watches
+	std::vector<std::string> directories();
+
+  protected:
+	/// The listeners by the id of their backend watch
+	std::unordered_map<WatchID, GroupingListener*> mGroups;
+
+	/// The listeners by the directory of their watch
+	std::unordered_map<std::string, std::vector<GroupingListener*>> mRoots;
+
+	/// The group of each nested watch
+	std::unordered_map<WatchID, GroupingListener*> mNested;
+
+	/// The id of the next nested watch
+	WatchID mLastID;
+
+	/// The directory being looked up by join, kept to reuse its capacity
+	std::string mKey;
+
+	/// Guards the listeners and the nested watches
+	Mutex mMutex;
+};
+
+} // namespace efsw
+
+#endif
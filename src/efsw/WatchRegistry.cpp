@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/WatchRegistry.hpp>
+
+namespace efsw {
+
+std::string WatchRegistry::normalize( const std::string& directory ) {
+	std::string dir( directory );
+	FileSystem::dirAddSlashAtEnd( dir );
+	return dir;
+}
+
+bool WatchRegistry::add( Watcher* watch, const std::string& directory ) {
+	std::string dir( normalize( directory ) );
+
+	Lock lock( mMutex );
+
+	if ( mWatches.find( watch->ID ) != mWatches.end() || mPaths.find( dir ) != mPaths.end() )
+		return false;
+
+	Entry entry;
+	entry.Watch = watch;
+	entry.Directory = dir;
+
+	mWatches[watch->ID] = entry;
+	mPaths[dir] = watch->ID;
+
+	return true;
+}
+
+bool WatchRegistry::add( Watcher* watch ) {
+	return add( watch, watch->Directory );
+}
+
+Watcher* WatchRegistry::remove( WatchID id ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, Entry>::iterator it = mWatches.find( id );
+
+	if ( it == mWatches.end() )
+		return NULL;
+
+	Watcher* watch = it->second.Watch;
+
+	mPaths.erase( it->second.Directory );
+	mWatches.erase( it );
+
+	return watch;
+}
+
+void WatchRegistry::setDirectory( WatchID id, const std::string& directory ) {
+	std::string dir( normalize( directory ) );
+
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, Entry>::iterator it = mWatches.find( id );
+
+	if ( it == mWatches.end() )
+		return;
+
+	mPaths.erase( it->second.Directory );
+	it->second.Directory = dir;
+	mPaths[dir] = id;
+}
+
+Watcher* WatchRegistry::find( WatchID id ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, Entry>::iterator it = mWatches.find( id );
+
+	return it != mWatches.end() ? it->second.Watch : NULL;
+}
+
+std::shared_ptr<WatchCounters> WatchRegistry::counters( WatchID id ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, Entry>::iterator it = mWatches.find( id );
+
+	return it != mWatches.end() ? it->second.Watch->Counters : NULL;
+}
+
+std::shared_ptr<const PathFilter> WatchRegistry::filter( WatchID id ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, Entry>::iterator it = mWatches.find( id );
+
+	return it != mWatches.end() ? it->second.Watch->Filter : NULL;
+}
+
+Watcher* WatchRegistry::find( const std::string& directory ) {
+	/// The directories already normalized are looked up without a copy
+	bool normalized = !directory.empty() && directory.back() == FileSystem::getOSSlash();
+	std::string dir;
+
+	if ( !normalized ) {
+		dir = normalize( directory );
+	}
+
+	Lock lock( mMutex );
+
+	std::unordered_map<std::string, WatchID>::iterator it =
+		mPaths.find( normalized ? directory : dir );
+
+	if ( it == mPaths.end() )
+		return NULL;
+
+	return mWatches[it->second].Watch;
+}
+
+bool WatchRegistry::contains( const std::string& directory ) {
+	std::string dir( normalize( directory ) );
+
+	Lock lock( mMutex );
+
+	return mPaths.find( dir ) != mPaths.end() || mDirectories.find( dir ) != mDirectories.end();
+}
+
+void WatchRegistry::addDirectory( const std::string& directory ) {
+	std::string dir( normalize( directory ) );
+
+	Lock lock( mMutex );
+
+	mDirectories[dir]++;
+}
+
+void WatchRegistry::removeDirectory( const std::string& directory ) {
+	std::string dir( normalize( directory ) );
+
+	Lock lock( mMutex );
+
+	std::unordered_map<std::string, size_t>::iterator it = mDirectories.find( dir );
+
+	if ( it != mDirectories.end() && 0 == --it->second ) {
+		mDirectories.erase( it );
+	}
+}
+
+std::vector<std::pair<WatchID, WatchRegistry::Entry>> WatchRegistry::sorted() {
+	std::vector<std::pair<WatchID, Entry>> entries( mWatches.begin(), mWatches.end() );
+
+	std::sort( entries.begin(), entries.end(),
+			   []( const std::pair<WatchID, Entry>& left, const std::pair<WatchID, Entry>& right ) {
+				   return left.first < right.first;
+			   } );
+
+	return entries;
+}
+
+std::vector<Watcher*> WatchRegistry::watches() {
+	Lock lock( mMutex );
+
+	std::vector<std::pair<WatchID, Entry>> entries( sorted() );
+	std::vector<Watcher*> watches;
+	watches.reserve( entries.size() );
+
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		watches.push_back( entries[i].second.Watch );
+	}
+
+	return watches;
+}
+
+std::vector<std::string> WatchRegistry::directories() {
+	Lock lock( mMutex );
+
+	std::vector<std::pair<WatchID, Entry>> entries( sorted() );
+	std::vector<std::string> dirs;
+	dirs.reserve( entries.size() );
+
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		dirs.push_back( entries[i].second.Directory );
+	}
+
+	return dirs;
+}
+
+size_t WatchRegistry::size() {
+	Lock lock( mMutex );
+
+	return mWatches.size();
+}
+
+void WatchRegistry::clear() {
+	Lock lock( mMutex );
+
+	mWatches.clear();
+	mPaths.clear();
+	mDirectories.clear();
+}
+
+} // namespace efsw
@@ -0,0 +1,80 @@
+#ifndef EFSW_WATCHREGISTRY_HPP
+#define EFSW_WATCHREGISTRY_HPP
+
+#include <efsw/Mutex.hpp>
+#include <efsw/Watcher.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+/** @brief Index of the watches added to a backend, by WatchID and by directory, plus a
+ * reference counted set of the subdirectories watched inside them ( for the backends that keep
+ * their own directory trees ). Directories are normalized to end with the OS slash.
+ * The registry is thread safe, but it doesn't own the watchers.
+ */
+class WatchRegistry {
+  public:
+	/// Indexes the watch by its ID and directory
+	/// @return false if the ID or the directory are already registered
+	bool add( Watcher* watch, const std::string& directory );
+
+	bool add( Watcher* watch );
+
+	/// Removes the watch from the index
+	/// @return The watch removed, or NULL if not found
+	Watcher* remove( WatchID id );
+
+	/// Re-indexes the directory of a watch
+	void setDirectory( WatchID id, const std::string& directory );
+
+	Watcher* find( WatchID id );
+
+	Watcher* find( const std::string& directory );
+
+	/// @return The counters of the watch, NULL if not found. They outlive the watch removed.
+	std::shared_ptr<WatchCounters> counters( WatchID id );
+
+	/// @return The filter of the watch, NULL if not found or it has none
+	std::shared_ptr<const PathFilter> filter( WatchID id );
+
+	/// @return If the directory is a watch or is being watched inside one
+	bool contains( const std::string& directory );
+
+	/// Adds a reference to a subdirectory being watched
+	void addDirectory( const std::string& directory );
+
+	/// Removes a reference to a subdirectory being watched
+	void removeDirectory( const std::string& directory );
+
+	/// @return The watches sorted by ID
+	std::vector<Watcher*> watches();
+
+	/// @return The directories of the watches sorted by ID
+	std::vector<std::string> directories();
+
+	size_t size();
+
+	void clear();
+
+	static std::string normalize( const std::string& directory );
+
+  protected:
+	struct Entry {
+		Watcher* Watch;
+		std::string Directory;
+	};
+
+	Mutex mMutex;
+	std::unordered_map<WatchID, Entry> mWatches;
+	std::unordered_map<std::string, WatchID> mPaths;
+	std::unordered_map<std::string, size_t> mDirectories;
+
+	std::vector<std::pair<WatchID, Entry>> sorted();
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,194 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/Lock.hpp>
+#include <efsw/WatchScope.hpp>
+
+namespace efsw {
+
+namespace {
+
+/// Appends the path to the key with '/' as separator, the slash at the end and no empty
+/// component
+void appendKey( std::string& key, std::string_view path ) {
+	for ( size_t i = 0; i < path.size(); i++ ) {
+		char c = FileSystem::getOSSlash() == path[i] ? '/' : path[i];
+
+		if ( '/' == c && ( key.empty() || '/' == key.back() ) )
+			continue;
+
+		key += c;
+	}
+
+	if ( !key.empty() && '/' != key.back() ) {
+		key += '/';
+	}
+}
+
+bool isAbsolute( const std::string& path ) {
+	return !path.empty() && ( '/' == path[0] || '\\' == path[0] ||
+							  ( path.size() >= 2 && ':' == path[1] ) );
+}
+
+} // namespace
+
+WatchScope::WatchScope( const std::string& directory, int maxDepth ) :
+	mDirectory( directory ), mMaxDepth( maxDepth ) {
+	FileSystem::dirAddSlashAtEnd( mDirectory );
+}
+
+bool WatchScope::relativeKey( std::string_view path, std::string& key ) const {
+	key.clear();
+
+	if ( path.size() >= mDirectory.size() &&
+		 0 == path.compare( 0, mDirectory.size(), mDirectory ) ) {
+		appendKey( key, path.substr( mDirectory.size() ) );
+		return true;
+	}
+
+	/// The watched directory itself, without the slash
+	return path.size() + 1 == mDirectory.size() && 0 == mDirectory.compare( 0, path.size(), path );
+}
+
+bool WatchScope::inScopeLocked( std::string_view key ) const {
+	bool expanded = true;
+	size_t base = 0;
+
+	if ( !mRules.empty() ) {
+		std::map<std::string, bool, std::less<>>::const_iterator it =
+			mRules.find( std::string_view() );
+
+		if ( it != mRules.end() ) {
+			expanded = it->second;
+		}
+
+		/// The deepest rule above the directory applies, or its own if it's expanded: a directory
+		/// collapsed is still watched, its subdirectories aren't
+		size_t slash = key.find( '/' );
+
+		while ( std::string_view::npos != slash ) {
+			it = mRules.find( key.substr( 0, slash + 1 ) );
+
+			if ( it != mRules.end() && ( slash + 1 < key.size() || it->second ) ) {
+				expanded = it->second;
+				base = slash + 1;
+			}
+
+			slash = key.find( '/', slash + 1 );
+		}
+	}
+
+	if ( key.empty() )
+		return true;
+
+	if ( !expanded )
+		return false;
+
+	if ( mMaxDepth < 0 )
+		return true;
+
+	int depth = 0;
+
+	for ( size_t i = base; i < key.size(); i++ ) {
+		if ( '/' == key[i] ) {
+			depth++;
+		}
+	}
+
+	return depth <= mMaxDepth;
+}
+
+bool WatchScope::prunes( std::string_view path ) const {
+	thread_local std::string key;
+
+	if ( !relativeKey( path, key ) )
+		return false;
+
+	Lock lock( mMutex );
+
+	return !inScopeLocked( key );
+}
+
+bool WatchScope::reports( std::string_view dir, std::string_view filename ) const {
+	thread_local std::string key;
+
+	if ( !relativeKey( dir, key ) )
+		return true;
+
+	/// The directory of an entry given by its path relative to dir
+	size_t slash = filename.find_last_of( "/\\" );
+
+	if ( std::string_view::npos != slash ) {
+		appendKey( key, filename.substr( 0, slash ) );
+	}
+
+	Lock lock( mMutex );
+
+	return inScopeLocked( key );
+}
+
+bool WatchScope::setRule( const std::string& directory, bool expanded ) {
+	std::string key;
+
+	if ( isAbsolute( directory ) ) {
+		if ( !relativeKey( directory, key ) )
+			return false;
+	} else {
+		appendKey( key, directory );
+	}
+
+	Lock lock( mMutex );
+
+	bool inScope = inScopeLocked( key );
+
+	/// A directory can be expanded as soon as it's reported, its parent being in scope
+	if ( !inScope && expanded ) {
+		size_t parent = key.find_last_of( '/', key.size() - 2 );
+
+		inScope = inScopeLocked(
+			std::string_view( key ).substr( 0, std::string::npos != parent ? parent + 1 : 0 ) );
+	}
+
+	if ( !inScope )
+		return false;
+
+	/// The rules under the directory are replaced by its own
+	std::map<std::string, bool, std::less<>>::iterator it = mRules.lower_bound( key );
+
+	while ( it != mRules.end() && 0 == it->first.compare( 0, key.size(), key ) ) {
+		it = mRules.erase( it );
+	}
+
+	/// The watched directory expanded is the default
+	if ( !key.empty() || !expanded ) {
+		mRules[key] = expanded;
+	}
+
+	return true;
+}
+
+bool WatchScope::expand( const std::string& directory ) {
+	return setRule( directory, true );
+}
+
+bool WatchScope::collapse( const std::string& directory ) {
+	return setRule( directory, false );
+}
+
+std::string WatchScope::fullPath( const std::string& directory ) const {
+	std::string path;
+
+	if ( isAbsolute( directory ) ) {
+		path = directory;
+	} else {
+		path = mDirectory;
+
+		for ( size_t i = 0; i < directory.size(); i++ ) {
+			path += '/' == directory[i] ? FileSystem::getOSSlash() : directory[i];
+		}
+	}
+
+	FileSystem::dirAddSlashAtEnd( path );
+
+	return path;
+}
+
+} // namespace efsw
@@ -0,0 +1,72 @@
+#ifndef EFSW_WATCHSCOPE_HPP
+#define EFSW_WATCHSCOPE_HPP
+
+#include <efsw/Mutex.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace efsw {
+
+/// The directories a recursive watch with Options::MaxDepth descends into. A directory is in
+/// scope if it's at most MaxDepth levels below the deepest directory expanded at or above it
+/// ( the watched one by default ), and no directory collapsed since is above it. The directories
+/// outside the watched one ( symlinks followed ) are always in scope.
+/// Thread safe: the backends check it while expandWatch and collapseWatch change it.
+class WatchScope {
+  public:
+	/// @param maxDepth Negative for unlimited
+	WatchScope( const std::string& directory, int maxDepth );
+
+	WatchScope( const WatchScope& ) = delete;
+
+	WatchScope& operator=( const WatchScope& ) = delete;
+
+	/// @param path The path of a directory
+	/// @return True if the directory is out of the scope, so it must not be watched
+	bool prunes( std::string_view path ) const;
+
+	/// @param dir The directory of the event
+	/// @param filename The name of the entry, or its path relative to dir
+	/// @return True if the entry is in a directory in scope
+	bool reports( std::string_view dir, std::string_view filename ) const;
+
+	/// Brings the directory and its subdirectories in scope, down to MaxDepth levels below it
+	/// @param directory Relative to the watched directory, or the full path
+	/// @return False if neither the directory nor its parent are in scope
+	bool expand( const std::string& directory );
+
+	/// Takes the subdirectories of the directory out of the scope
+	/// @return False if the directory is out of the scope
+	bool collapse( const std::string& directory );
+
+	/// @return The full path of a directory given as expand takes it, with the slash at the end
+	std::string fullPath( const std::string& directory ) const;
+
+  protected:
+	/// The watched directory with the slash at the end
+	std::string mDirectory;
+
+	int mMaxDepth;
+
+	/// The directories expanded ( true ) and collapsed ( false ), relative to the watched one
+	/// with '/' as separator and at the end, "" being the watched one. None is under another
+	/// with the same value.
+	std::map<std::string, bool, std::less<>> mRules;
+
+	mutable Mutex mMutex;
+
+	/// Sets key to the path relative to the watched directory, as the rules are
+	/// @return False if the path is outside the watched directory
+	bool relativeKey( std::string_view path, std::string& key ) const;
+
+	/// @param key A key as relativeKey sets them
+	bool inScopeLocked( std::string_view key ) const;
+
+	bool setRule( const std::string& directory, bool expanded );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <efsw/FileSystem.hpp>
+#include <efsw/WatchStages.hpp>
+#include <efsw/base.hpp>
+
+namespace efsw {
+
+WatchStage::WatchStage( FileWatchListener* listener, const std::string& directory ) :
+	mListener( listener ), mDirectory( directory ), mID( 0 ) {
+	FileSystem::dirAddSlashAtEnd( mDirectory );
+}
+
+WatchStage::~WatchStage() {}
+
+void WatchStage::attach( WatchID watchid ) {
+	mID = watchid;
+}
+
+void WatchStage::handleFileEvent( WatchID watchid, std::string_view dir,
+								  std::string_view filename, Action action,
+								  std::string_view oldFilename ) {
+	Event event;
+	event.watchid = watchid;
+	event.dir = dir;
+	event.filename = filename;
+	event.action = action;
+	event.oldFilename = oldFilename;
+
+	handleFileActions( &event, 1 );
+}
+
+void WatchStage::handleWatchError( WatchID watchid, Error error, std::string_view path ) {
+	if ( NULL != mListener ) {
+		mListener->handleWatchError( watchid, error, path );
+	}
+}
+
+void WatchStage::handleWatchReady( WatchID watchid, size_t directories, size_t failures ) {
+	if ( NULL != mListener ) {
+		mListener->handleWatchReady( watchid, directories, failures );
+	}
+}
+
+StageChain::StageChain( const std::string& directory ) : mDirectory( directory ), mID( 0 ) {
+	FileSystem::dirAddSlashAtEnd( mDirectory );
+}
+
+StageChain::~StageChain() {
+	for ( size_t i = mStages.size(); i > 0; i-- ) {
+		efSAFE_DELETE( mStages[i - 1] );
+	}
+}
+
+void StageChain::attach( WatchID watchid ) {
+	mID = watchid;
+
+	for ( size_t i = mStages.size(); i > 0; i-- ) {
+		mStages[i - 1]->attach( watchid );
+	}
+}
+
+WatchStages::WatchStages() {}
+
+WatchStages::~WatchStages() {
+	for ( std::unordered_map<WatchID, StageChain*>::iterator it = mChains.begin();
+		  it != mChains.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+}
+
+void WatchStages::keys( const std::string& directory, std::vector<std::string>& keys ) {
+	keys.clear();
+	keys.push_back( FileSystem::normalizeDirectory( directory ) );
+
+	std::string curPath;
+	std::string link( FileSystem::getLinkRealPath( keys.front(), curPath ) );
+
+	if ( !link.empty() ) {
+		link = FileSystem::normalizeDirectory( link );
+
+		if ( link != keys.front() ) {
+			keys.push_back( link );
+		}
+	}
+}
+
+void WatchStages::insert( StageChain* chain ) {
+	keys( chain->directory(), chain->mKeys );
+
+	Lock lock( mMutex );
+
+	mChains[chain->id()] = chain;
+
+	for ( size_t i = 0; i < chain->mKeys.size(); i++ ) {
+		mDirectories[chain->mKeys[i]].push_back( chain->id() );
+	}
+}
+
+StageChain* WatchStages::remove( WatchID watchid ) {
+	Lock lock( mMutex );
+
+	std::unordered_map<WatchID, StageChain*>::iterator it = mChains.find( watchid );
+
+	if ( it == mChains.end() )
+		return NULL;
+
+	StageChain* chain = it->second;
+	mChains.erase( it );
+
+	for ( size_t i = 0; i < chain->mKeys.size(); i++ ) {
+		std::unordered_map<std::string, std::vector<WatchID>>::iterator dir =
+			mDirectories.find( chain->mKeys[i] );
+
+		if ( dir == mDirectories.end() )
+			continue;
+
+		dir->second.erase( std::remove( dir->second.begin(), dir->second.end(), watchid ),
+						   dir->second.end() );
+
+		if ( dir->second.empty() ) {
+			mDirectories.erase( dir );
+		}
+	}
+
+	return chain;
+}
+
+std::vector<WatchID> WatchStages::watches() {
+	std::vector<WatchID> watches;
+
+	Lock lock( mMutex );
+
+	watches.reserve( mChains.size() );
+
+	for ( std::unordered_map<WatchID, StageChain*>::iterator it = mChains.begin();
+		  it != mChains.end(); ++it ) {
+		watches.push_back( it->first );
+	}
+
+	return watches;
+}
+
+bool WatchStages::contains( WatchID watchid ) {
+	Lock lock( mMutex );
+
+	return mChains.find( watchid ) != mChains.end();
+}
+
+WatchID WatchStages::find( const std::string& directory ) {
+	std::vector<std::string> dirs;
+	keys( directory, dirs );
+
+	Lock lock( mMutex );
+
+	for ( size_t i = 0; i < dirs.size(); i++ ) {
+		std::unordered_map<std::string, std::vector<WatchID>>::iterator it =
+			mDirectories.find( dirs[i] );
+
+		if ( it != mDirectories.end() )
+			return it->second.front();
+	}
+
+	return 0;
+}
+
+std::vector<std::string> WatchStages::directories() {
+	std::vector<std::string> dirs;
+
+	Lock lock( mMutex );
+
+	dirs.reserve( mChains.size() );
+
+	for ( std::unordered_map<WatchID, StageChain*>::iterator it = mChains.begin();
+		  it != mChains.end(); ++it ) {
+		dirs.push_back( it->second->directory() );
+	}
+
+	return dirs;
+}
+
+} // namespace efsw
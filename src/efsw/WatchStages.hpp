@@ -0,0 +1,160 @@
+#ifndef EFSW_WATCHSTAGES_HPP
+#define EFSW_WATCHSTAGES_HPP
+
+#include <efsw/Lock.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/efsw.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace efsw {
+
+/// A listener placed between the backend and the listener of a watch by one of its options,
+/// delivering to the next stage. A batch of one event is what the stages handle, the other
+/// notifications are passed on as they are.
+class WatchStage : public FileWatchListener {
+  public:
+	/// @param listener The next stage, or the listener of the watch. NULL for the stages ending a
+	/// watch without listener.
+	WatchStage( FileWatchListener* listener, const std::string& directory );
+
+	/// A stage delivering from a thread of its own stops before it's deleted, nothing reaches
+	/// the next stage once it returns
+	virtual ~WatchStage();
+
+	/// Called once the watch was added to the backend, the events may have started already
+	virtual void attach( WatchID watchid );
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	void handleWatchReady( WatchID watchid, size_t directories, size_t failures ) override;
+
+	WatchID id() const { return mID; }
+
+	/// The directory of the watch as added, with the slash at the end
+	const std::string& directory() const { return mDirectory; }
+
+  protected:
+	FileWatchListener* mListener;
+
+	std::string mDirectory;
+
+	WatchID mID;
+};
+
+/// The stages of a watch, owned from the moment they're pushed. Deleting the chain deletes them
+/// from the backend onwards, so each one is deleted once nothing delivers to it anymore.
+class StageChain {
+  public:
+	StageChain( const std::string& directory );
+
+	~StageChain();
+
+	/// Places the stage in front of the ones pushed already, the first one pushed delivering to
+	/// the listener of the watch
+	/// @return The stage, to be the listener of the next one
+	template <typename T> T* push( T* stage ) {
+		mStages.push_back( stage );
+		return stage;
+	}
+
+	/// Attaches the stages to the watch added, from the backend onwards
+	void attach( WatchID watchid );
+
+	/// @return The stage of the type, NULL if the watch has none
+	template <typename T> T* find() const {
+		for ( size_t i = 0; i < mStages.size(); i++ ) {
+			if ( T* stage = dynamic_cast<T*>( mStages[i] ) )
+				return stage;
+		}
+
+		return NULL;
+	}
+
+	WatchID id() const { return mID; }
+
+	/// The directory of the watch as added, with the slash at the end
+	const std::string& directory() const { return mDirectory; }
+
+  protected:
+	friend class WatchStages;
+
+	std::string mDirectory;
+
+	WatchID mID;
+
+	/// The directories the watch is found by in WatchStages, see WatchStages::keys
+	std::vector<std::string> mKeys;
+
+	/// In the order they were pushed, from the listener to the backend
+	std::vector<WatchStage*> mStages;
+};
+
+/// The stage chains of the watches of a FileWatcher, by watch id. The stages are only queried
+/// through visit, holding the chains, so a watch removed meanwhile isn't deleted under a query.
+class WatchStages {
+  public:
+	WatchStages();
+
+	~WatchStages();
+
+	/// Adds the chain of a watch, once attached
+	void insert( StageChain* chain );
+
+	/// Takes the chain of the watch out, for the caller to delete once the watch is removed from
+	/// the backend. Deleting it waits for the stages delivering, so it's done without holding
+	/// the chains.
+	/// @return NULL if the watch has none
+	StageChain* remove( WatchID watchid );
+
+	/// Calls the function with the stage of the type of the watch, holding the chains. The
+	/// function must not add nor remove watches.
+	/// @return False if the watch has no such stage
+	template <typename T, typename F> bool visit( WatchID watchid, F function ) {
+		Lock lock( mMutex );
+
+		std::unordered_map<WatchID, StageChain*>::iterator it = mChains.find( watchid );
+		T* stage = it != mChains.end() ? it->second->find<T>() : NULL;
+
+		if ( NULL == stage )
+			return false;
+
+		function( *stage );
+		return true;
+	}
+
+	/// @return The ids of the watches
+	std::vector<WatchID> watches();
+
+	/// @return True if the watch has a chain
+	bool contains( WatchID watchid );
+
+	/// @return The id of a watch of the directory, 0 if none. The directory is compared
+	/// normalized, and resolved if it's a symbolic link.
+	WatchID find( const std::string& directory );
+
+	/// @return The directories of the watches
+	std::vector<std::string> directories();
+
+  protected:
+	std::unordered_map<WatchID, StageChain*> mChains;
+
+	/// The watches by their directories, see keys
+	std::unordered_map<std::string, std::vector<WatchID>> mDirectories;
+
+	/// Guards the chains and the directories
+	Mutex mMutex;
+
+	/// Fills keys with the directory normalized, then resolved if it's a symbolic link to another
+	/// one. A watch is found by either, as the link may be gone or replaced by the time it's
+	/// removed.
+	static void keys( const std::string& directory, std::vector<std::string>& keys );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef EFSW_WATCHTABLE_HPP
+#define EFSW_WATCHTABLE_HPP
+
+#include <efsw/base.hpp>
+
+#include <atomic>
+#include <vector>
+
+namespace efsw {
+
+/// Table of watchers indexed by a small integer key ( a watch descriptor ), looked up without
+/// locking from the event loop. The writers are serialized by the lock of the owner.
+/// Open addressing with linear probing: a key keeps its slot once inserted ( an erased key
+/// leaves its slot empty for its next insertion ), so a reader never sees a slot change of key.
+/// The table is compacted into a new array when it fills up, the replaced arrays are kept until
+/// the event loop reaches a point where it holds no lookup in progress ( reclaim() ).
+template <typename T> class WatchTable {
+  public:
+	WatchTable() : mTable( newTable( 64 ) ), mUsed( 0 ), mCount( 0 ) {}
+
+	~WatchTable() {
+		reclaim();
+		deleteTable( mTable.load( std::memory_order_relaxed ) );
+	}
+
+	/// @return The value of the key, NULL if not found. Lock free, from the event loop or holding
+	/// the writers lock.
+	T* find( int key ) const {
+		const Table* table = mTable.load( std::memory_order_acquire );
+
+		for ( size_t i = slotOf( table, key );; i = ( i + 1 ) & table->Mask ) {
+			int cur = table->Slots[i].Key.load( std::memory_order_acquire );
+
+			if ( cur == key )
+				return table->Slots[i].Value.load( std::memory_order_acquire );
+
+			if ( cur == EmptyKey )
+				return NULL;
+		}
+	}
+
+	/// Sets the value of the key. Holding the writers lock.
+	void insert( int key, T* value ) {
+		Table* table = mTable.load( std::memory_order_relaxed );
+
+		if ( ( mUsed + 1 ) * 2 > table->Mask + 1 ) {
+			table = compact( mCount + 1 );
+		}
+
+		size_t i = probe( table, key );
+		Slot& slot = table->Slots[i];
+
+		if ( NULL == slot.Value.load( std::memory_order_relaxed ) )
+			mCount++;
+
+		slot.Value.store( value, std::memory_order_release );
+
+		if ( slot.Key.load( std::memory_order_relaxed ) != key ) {
+			slot.Key.store( key, std::memory_order_release );
+			mUsed++;
+		}
+	}
+
+	/// Removes the key. Holding the writers lock.
+	void erase( int key ) {
+		Table* table = mTable.load( std::memory_order_relaxed );
+		Slot& slot = table->Slots[probe( table, key )];
+
+		if ( slot.Key.load( std::memory_order_relaxed ) == key &&
+			 NULL != slot.Value.load( std::memory_order_relaxed ) ) {
+			slot.Value.store( NULL, std::memory_order_release );
+			mCount--;
+		}
+	}
+
+	/// Frees the arrays replaced by a compaction. Holding the writers lock, from the event loop
+	/// while it isn't looking up any key ( or once the event loop is gone ).
+	void reclaim() {
+		for ( size_t i = 0; i < mRetired.size(); i++ ) {
+			deleteTable( mRetired[i] );
+		}
+
+		mRetired.clear();
+	}
+
+  protected:
+	static const int EmptyKey = -1;
+
+	struct Slot {
+		std::atomic<int> Key;
+		std::atomic<T*> Value;
+	};
+
+	struct Table {
+		size_t Mask;
+		Slot* Slots;
+	};
+
+	std::atomic<Table*> mTable;
+
+	/// Arrays replaced, pending to be freed
+	std::vector<Table*> mRetired;
+
+	/// Slots with a key assigned in the current array
+	size_t mUsed;
+
+	/// Keys with a value
+	size_t mCount;
+
+	static Table* newTable( size_t size ) {
+		Table* table = new Table();
+		table->Mask = size - 1;
+		table->Slots = new Slot[size];
+
+		for ( size_t i = 0; i < size; i++ ) {
+			table->Slots[i].Key.store( EmptyKey, std::memory_order_relaxed );
+			table->Slots[i].Value.store( NULL, std::memory_order_relaxed );
+		}
+
+		return table;
+	}
+
+	static void deleteTable( Table* table ) {
+		delete[] table->Slots;
+		delete table;
+	}
+
+	static size_t slotOf( const Table* table, int key ) {
+		/// The watch descriptors are sequential, so they are already well distributed
+		return (size_t)key & table->Mask;
+	}
+
+	/// @return The slot of the key, or the empty slot where it goes
+	static size_t probe( const Table* table, int key ) {
+		size_t i = slotOf( table, key );
+
+		while ( true ) {
+			int cur = table->Slots[i].Key.load( std::memory_order_relaxed );
+
+			if ( cur == key || cur == EmptyKey )
+				return i;
+
+			i = ( i + 1 ) & table->Mask;
+		}
+	}
+
+	/// Copies the keys with a value into a new array with room for count keys, and publishes it
+	Table* compact( size_t count ) {
+		Table* old = mTable.load( std::memory_order_relaxed );
+		size_t size = 64;
+
+		while ( size < count * 4 ) {
+			size *= 2;
+		}
+
+		Table* table = newTable( size );
+		mUsed = 0;
+
+		for ( size_t i = 0; i <= old->Mask; i++ ) {
+			T* value = old->Slots[i].Value.load( std::memory_order_relaxed );
+
+			if ( NULL != value ) {
+				int key = old->Slots[i].Key.load( std::memory_order_relaxed );
+				Slot& slot = table->Slots[probe( table, key )];
+
+				slot.Key.store( key, std::memory_order_relaxed );
+				slot.Value.store( value, std::memory_order_relaxed );
+				mUsed++;
+			}
+		}
+
+		mTable.store( table, std::memory_order_release );
+		mRetired.push_back( old );
+
+		return table;
+	}
+};
+
+} // namespace efsw
+
+#endif
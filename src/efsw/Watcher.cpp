@@ -2,9 +2,69 @@
 
 namespace efsw {
 
-Watcher::Watcher() : ID( 0 ), Directory( "" ), Listener( NULL ), Recursive( false ) {}
+Watcher::Watcher() :
+	ID( 0 ),
+	Directory( "" ),
+	Listener( NULL ),
+	Recursive( false ),
+	EventInterests( Interests::Default ),
+	Counters( std::make_shared<WatchCounters>() ) {}
 
 Watcher::Watcher( WatchID id, std::string directory, FileWatchListener* listener, bool recursive ) :
-	ID( id ), Directory( directory ), Listener( listener ), Recursive( recursive ) {}
+	ID( id ),
+	Directory( directory ),
+	Listener( listener ),
+	Recursive( recursive ),
+	EventInterests( Interests::Default ),
+	Counters( std::make_shared<WatchCounters>() ) {}
+
+bool Watcher::interestedIn( int interests ) const {
+	return 0 != ( EventInterests & interests );
+}
+
+bool Watcher::acceptsInterests( int interests ) const {
+	if ( interestedIn( interests ) )
+		return true;
+
+	WatchCounters::add( Counters->Filtered );
+	return false;
+}
+
+bool Watcher::accepts( Action action ) const {
+	switch ( action ) {
+		case Actions::Add:
+			return acceptsInterests( Interests::Created );
+		case Actions::Delete:
+			return acceptsInterests( Interests::Deleted );
+		case Actions::Moved:
+			return acceptsInterests( Interests::Moved );
+		case Actions::Modified:
+			return acceptsInterests( Interests::ContentClosed | Interests::ContentModified |
+								   Interests::Attributes );
+		default:
+			/// The overflows are always reported
+			return true;
+	}
+}
+
+bool Watcher::matches( std::string_view dir, std::string_view filename,
+					   std::string_view oldFilename ) const {
+	if ( !Filter || Filter->matches( dir, filename ) ||
+		 ( !oldFilename.empty() && Filter->matches( dir, oldFilename ) ) )
+		return true;
+
+	WatchCounters::add( Counters->Filtered );
+	return false;
+}
+
+bool Watcher::prunes( std::string_view path ) const {
+	return Filter && Filter->prunes( path );
+}
+
+void Watcher::reportError( Error error, std::string_view path ) const {
+	if ( NULL != Listener ) {
+		Listener->handleWatchError( ID, error, path );
+	}
+}
 
 } // namespace efsw
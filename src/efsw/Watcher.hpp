@@ -1,8 +1,11 @@
 #ifndef EFSW_WATCHERIMPL_HPP
 #define EFSW_WATCHERIMPL_HPP
 
+#include <efsw/PathFilter.hpp>
+#include <efsw/WatchCounters.hpp>
 #include <efsw/base.hpp>
 #include <efsw/efsw.hpp>
+#include <memory>
 
 namespace efsw {
 
@@ -22,6 +25,47 @@ class Watcher {
 	FileWatchListener* Listener;
 	bool Recursive;
 	std::string OldFileName;
+
+	/// The kinds of changes reported, a set of Interests::Interest flags
+	int EventInterests;
+
+	/// @return True if the watch is interested in any of the interests
+	bool interestedIn( int interests ) const;
+
+	/// Same as interestedIn, for the changes about to be reported: the ones the watch isn't
+	/// interested in are counted as filtered
+	bool acceptsInterests( int interests ) const;
+
+	/// The include and exclude patterns of the watch, shared with its subdirectories ( NULL if
+	/// there are none )
+	std::shared_ptr<const PathFilter> Filter;
+
+	/// The counters of the watch, shared with its subdirectories and its pollers
+	std::shared_ptr<WatchCounters> Counters;
+
+	/// @return True if the action must reach the listener according to the watch interests.
+	/// The actions rejected are counted as filtered.
+	bool accepts( Action action ) const;
+
+	/// @return True if the entry passes the patterns of the watch. A rename passes if any of
+	/// its names does. The entries rejected are counted as filtered.
+	bool matches( std::string_view dir, std::string_view filename,
+				  std::string_view oldFilename = {} ) const;
+
+	/// @return True if the subdirectory is excluded by the patterns of the watch, so it must not
+	/// be watched
+	bool prunes( std::string_view path ) const;
+
+	/// Reports a directory of the watch that couldn't be watched while crawling it, see
+	/// FileWatchListener::handleWatchError
+	void reportError( Error error, std::string_view path ) const;
+
+	/// Watches the subdirectories brought in scope under the full path of the directory ( see
+	/// FileWatcher::expandWatch ), for the watchers that watch their subdirectories themselves
+	virtual void expand( const std::string& ) {}
+
+	/// Stops watching the subdirectories of the directory, see FileWatcher::collapseWatch
+	virtual void collapse( const std::string& ) {}
 };
 
 } // namespace efsw
@@ -8,91 +8,84 @@
 namespace efsw {
 
 WatcherFSEvents::WatcherFSEvents() :
-	Watcher(), FWatcher( NULL ), FSStream( NULL ), WatcherGen( NULL ) {}
+	Watcher(),
+	FWatcher( NULL ),
+	SinceId( 0 ),
+	Started( false ),
+	ReportHistory( false ),
+	Latency( 0 ),
+	NoDefer( true ),
+	FileEvents( true ),
+	WatcherGen( NULL ) {}
 
 WatcherFSEvents::WatcherFSEvents( WatchID id, std::string directory, FileWatchListener* listener,
 								  bool recursive, WatcherFSEvents* parent ) :
 	Watcher( id, directory, listener, recursive ),
 	FWatcher( NULL ),
-	FSStream( NULL ),
+	SinceId( 0 ),
+	Started( false ),
+	ReportHistory( false ),
+	Latency( 0 ),
+	NoDefer( true ),
+	FileEvents( true ),
 	WatcherGen( NULL ) {}
 
 WatcherFSEvents::~WatcherFSEvents() {
-	if ( NULL != FSStream ) {
-		FSEventStreamStop( FSStream );
-		FSEventStreamInvalidate( FSStream );
-		FSEventStreamRelease( FSStream );
-	}
-
 	efSAFE_DELETE( WatcherGen );
 }
 
 void WatcherFSEvents::init() {
-	CFStringRef CFDirectory =
-		CFStringCreateWithCString( NULL, Directory.c_str(), kCFStringEncodingUTF8 );
-	CFArrayRef CFDirectoryArray = CFArrayCreate( NULL, (const void**)&CFDirectory, 1, NULL );
-
-	Uint32 streamFlags = kFSEventStreamCreateFlagNone;
-
-	if ( FileWatcherFSEvents::isGranular() ) {
-		streamFlags = efswFSEventStreamCreateFlagFileEvents | efswFSEventStreamCreateFlagNoDefer;
-	} else {
+	/// The directories are read by the stream of the FileWatcherFSEvents, without file events
+	/// the ones changed are scanned
+	if ( !FileEvents ) {
 		WatcherGen = new WatcherGeneric( ID, Directory, Listener, FWatcher.load(), Recursive );
+		WatcherGen->EventInterests = EventInterests;
+		WatcherGen->init();
 	}
+}
 
-	FSEventStreamContext ctx;
-	/* Initialize context */
-	ctx.version = 0;
-	ctx.info = this;
-	ctx.retain = NULL;
-	ctx.release = NULL;
-	ctx.copyDescription = NULL;
-
-	dispatch_queue_t queue = dispatch_queue_create(NULL, NULL);
-
-	FSStream =
-		FSEventStreamCreate( kCFAllocatorDefault, &FileWatcherFSEvents::FSEventCallback, &ctx,
-							 CFDirectoryArray, kFSEventStreamEventIdSinceNow, 0., streamFlags );
-
-	FSEventStreamSetDispatchQueue(FSStream, queue);
-
-	FSEventStreamStart( FSStream );
-
-	CFRelease( CFDirectoryArray );
-	CFRelease( CFDirectory );
+void WatcherFSEvents::sendNotice( Action action ) {
+	Batch.add( Listener, ID, Directory, "", action );
+	Batch.flush();
 }
 
 void WatcherFSEvents::sendFileAction( WatchID watchid, const std::string& dir,
 									  const std::string& filename, Action action,
 									  std::string oldFilename ) {
-	Listener->handleFileAction( watchid, FileSystem::precomposeFileName( dir ),
-								FileSystem::precomposeFileName( filename ), action, FileSystem::precomposeFileName( oldFilename ) );
+	/// FSEvents can't filter the events by kind, they're filtered here
+	if ( !accepts( action ) || !matches( dir, filename, oldFilename ) )
+		return;
+
+	Batch.add( Listener, watchid, Names.precompose( dir ), Names.precompose( filename ), action,
+			   Names.precompose( oldFilename ) );
 }
 
 void WatcherFSEvents::handleAddModDel( const Uint32& flags, const std::string& path,
 									   std::string& dirPath, std::string& filePath ) {
-	if ( flags & efswFSEventStreamEventFlagItemCreated ) {
-		if ( FileInfo::exists( path ) ) {
-			sendFileAction( ID, dirPath, filePath, Actions::Add );
-		}
+	bool created = 0 != ( flags & efswFSEventStreamEventFlagItemCreated );
+	bool removed = 0 != ( flags & efswFSEventStreamEventFlagItemRemoved );
+	// Since i don't know the order, at least i try to keep the data consistent with the real
+	// state. The item is only stat'ed when both were coalesced.
+	bool exists = created && removed ? FileInfo::exists( path ) : created;
+
+	if ( created && exists ) {
+		sendFileAction( ID, dirPath, filePath, Actions::Add );
 	}
 
 	if ( flags & efswFSEventsModified ) {
 		sendFileAction( ID, dirPath, filePath, Actions::Modified );
 	}
 
-	if ( flags & efswFSEventStreamEventFlagItemRemoved ) {
-		// Since i don't know the order, at least i try to keep the data consistent with the real
-		// state
-		if ( !FileInfo::exists( path ) ) {
-			sendFileAction( ID, dirPath, filePath, Actions::Delete );
-		}
+	if ( removed && !exists ) {
+		sendFileAction( ID, dirPath, filePath, Actions::Delete );
 	}
 }
 
 void WatcherFSEvents::handleActions( std::vector<FSEvent>& events ) {
 	size_t esize = events.size();
 
+	WatchCounters::add( Counters->Received, esize );
+
 	for ( size_t i = 0; i < esize; i++ ) {
 		FSEvent& event = events[i];
 
@@ -111,7 +104,7 @@ void WatcherFSEvents::handleActions( std::vector<FSEvent>& events ) {
 			}
 		}
 
-		if ( FileWatcherFSEvents::isGranular() ) {
+		if ( FileEvents ) {
 			std::string dirPath( FileSystem::pathRemoveFileName( event.Path ) );
 			std::string filePath( FileSystem::fileNameFromPath( event.Path ) );
 
@@ -133,14 +126,22 @@ void WatcherFSEvents::handleActions( std::vector<FSEvent>& events ) {
 			if ( event.Flags & efswFSEventStreamEventFlagItemRenamed ) {
 				if ( ( i + 1 < esize ) &&
 					 ( events[i + 1].Flags & efswFSEventStreamEventFlagItemRenamed ) &&
-					 ( events[i + 1].Id == event.Id + 1 ) ) {
+					 ( 0 != event.Inode ? events[i + 1].Inode == event.Inode
+										: events[i + 1].Id == event.Id + 1 ) ) {
 					FSEvent& nEvent = events[i + 1];
 					std::string newDir( FileSystem::pathRemoveFileName( nEvent.Path ) );
 					std::string newFilepath( FileSystem::fileNameFromPath( nEvent.Path ) );
 
 					if ( event.Path != nEvent.Path ) {
 						if ( dirPath == newDir ) {
-							if ( !FileInfo::exists( event.Path ) ) {
+							/// The same item renamed is reported from its old path to the new
+							/// one, unless a path was also created or removed meanwhile
+							bool ambiguous = 0 == event.Inode ||
+											 0 != ( ( event.Flags | nEvent.Flags ) &
+													( efswFSEventStreamEventFlagItemCreated |
+													  efswFSEventStreamEventFlagItemRemoved ) );
+
+							if ( !ambiguous || !FileInfo::exists( event.Path ) ) {
 								sendFileAction( ID, dirPath, newFilepath, Actions::Moved,
 												filePath );
 							} else {
@@ -181,18 +182,26 @@ void WatcherFSEvents::handleActions( std::vector<FSEvent>& events ) {
 			} else {
 				handleAddModDel( event.Flags, event.Path, dirPath, filePath );
 			}
+		} else if ( event.Flags & ( efswFSEventStreamEventFlagItemIsFile |
+									  efswFSEventStreamEventFlagItemIsDir |
+									  efswFSEventStreamEventFlagItemIsSymlink ) ) {
+			/// A stream of file events shared with other watches
+			efDEBUG( "Directory: %s changed\n", event.Path.c_str() );
+			DirsChanged.insert( FileSystem::pathRemoveFileName( event.Path ) );
 		} else {
 			efDEBUG( "Directory: %s changed\n", event.Path.c_str() );
 			DirsChanged.insert( event.Path );
 		}
 	}
+
+	Batch.flush();
 }
 
 void WatcherFSEvents::process() {
 	std::set<std::string>::iterator it = DirsChanged.begin();
 
 	for ( ; it != DirsChanged.end(); it++ ) {
-		if ( !FileWatcherFSEvents::isGranular() ) {
+		if ( !FileEvents ) {
 			WatcherGen->watchDir( ( *it ) );
 		} else {
 			sendFileAction( ID, FileSystem::pathRemoveFileName( ( *it ) ),
@@ -7,7 +7,9 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <CoreServices/CoreServices.h>
+#include <efsw/EventBatch.hpp>
 #include <efsw/FileInfo.hpp>
+#include <efsw/PrecomposeCache.hpp>
 #include <efsw/WatcherGeneric.hpp>
 #include <set>
 #include <vector>
@@ -18,11 +20,14 @@ class FileWatcherFSEvents;
 
 class FSEvent {
   public:
-	FSEvent( std::string path, long flags, Uint64 id ) : Path( path ), Flags( flags ), Id( id ) {}
+	FSEvent( std::string path, long flags, Uint64 id, Uint64 inode = 0 ) :
+		Path( path ), Flags( flags ), Id( id ), Inode( inode ) {}
 
 	std::string Path;
 	long Flags;
 	Uint64 Id;
+	/// The inode of the item, 0 if the stream has no extended data
+	Uint64 Inode;
 };
 
 class WatcherFSEvents : public Watcher {
@@ -40,8 +45,30 @@ class WatcherFSEvents : public Watcher {
 
 	void process();
 
+	/// Sends an event of the whole watch, e.g. Actions::Overflow
+	void sendNotice( Action action );
+
 	Atomic<FileWatcherFSEvents*> FWatcher;
-	FSEventStreamRef FSStream;
+
+	/// The last event the watch got, or the one it starts from. The earlier ones replayed by a
+	/// stream recreated aren't for it.
+	FSEventStreamEventId SinceId;
+
+	/// Set once the stream covers the watch
+	bool Started;
+
+	/// If Actions::HistoryDone is still to be sent, see Options::FSEventsSinceId
+	bool ReportHistory;
+
+	/// See Options::FSEventsLatency, in milliseconds
+	int Latency;
+
+	/// See Options::FSEventsNoDefer
+	bool NoDefer;
+
+	/// If the watch gets the events of the files, see Options::FSEventsFileEvents. Without them
+	/// the directories changed are scanned.
+	bool FileEvents;
 
 private:
 	void handleAddModDel( const Uint32& flags, const std::string& path, std::string& dirPath,
@@ -51,6 +78,12 @@ private:
 
 	std::set<std::string> DirsChanged;
 
+	/// Events of the callback being handled, delivered together at its end
+	EventBatch Batch;
+
+	/// The directories and names of the events precomposed lately
+	PrecomposeCache Names;
+
 	void sendFileAction( WatchID watchid, const std::string& dir, const std::string& filename,
 						 Action action, std::string oldFilename = "" );
 };
@@ -0,0 +1,32 @@
+#include <efsw/WatcherFanotify.hpp>
+
+namespace efsw {
+
+WatcherFanotify::WatcherFanotify( WatchID id, const std::string& directory,
+								  FileWatchListener* listener, bool recursive ) :
+	Watcher( id, directory, listener, recursive ), InotifyID( 0 ) {}
+
+void WatcherFanotify::handleFileEvent( WatchID, std::string_view dir, std::string_view filename,
+									   Action action, std::string_view oldFilename ) {
+	Listener->handleFileEvent( ID, dir, filename, action, oldFilename );
+}
+
+void WatcherFanotify::handleFileActions( const Event* events, size_t count ) {
+	mEvents.assign( events, events + count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		mEvents[i].watchid = ID;
+	}
+
+	Listener->handleFileActions( mEvents.data(), count );
+}
+
+void WatcherFanotify::handleWatchError( WatchID, Error error, std::string_view path ) {
+	Listener->handleWatchError( ID, error, path );
+}
+
+bool WatcherFanotify::isDelegated() const {
+	return 0 != InotifyID;
+}
+
+} // namespace efsw
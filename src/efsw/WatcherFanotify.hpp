@@ -0,0 +1,39 @@
+#ifndef EFSW_WATCHERFANOTIFY_HPP
+#define EFSW_WATCHERFANOTIFY_HPP
+
+#include <efsw/FileWatcherImpl.hpp>
+#include <vector>
+
+namespace efsw {
+
+/// A watch of the fanotify backend. The watches the fanotify backend can't serve are delegated
+/// to inotify, the watcher then forwards their events replacing the inotify watch id with its own.
+class WatcherFanotify : public Watcher, public FileWatchListener {
+  public:
+	WatcherFanotify( WatchID id, const std::string& directory, FileWatchListener* listener,
+					 bool recursive );
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	/// @return True if the watch is served by the inotify backend
+	bool isDelegated() const;
+
+	/// The id of the delegated inotify watch ( 0 if not delegated )
+	WatchID InotifyID;
+
+	/// Key of the file system marked for this watch ( empty if delegated )
+	std::string FileSystemID;
+
+  protected:
+	/// The batch being forwarded, reused between batches
+	std::vector<Event> mEvents;
+};
+
+} // namespace efsw
+
+#endif
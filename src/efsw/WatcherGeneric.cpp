@@ -1,25 +1,193 @@
 #include <efsw/DirWatcherGeneric.hpp>
 #include <efsw/FileSystem.hpp>
 #include <efsw/WatcherGeneric.hpp>
+#include <algorithm>
 
 namespace efsw {
 
 WatcherGeneric::WatcherGeneric( WatchID id, const std::string& directory, FileWatchListener* fwl,
 								FileWatcherImpl* fw, bool recursive ) :
-	Watcher( id, directory, fwl, recursive ), WatcherImpl( fw ), DirWatch( NULL ) {
+	Watcher( id, directory, fwl, recursive ),
+	WatcherImpl( fw ),
+	DirWatch( NULL ),
+	Removed( false ),
+	MinInterval( 1000 ),
+	MaxInterval( 1000 ),
+	TimeSlice( 0 ),
+	Links( NULL ),
+	mLastSerial( 0 ),
+	mScanned( false ) {
 	FileSystem::dirAddSlashAtEnd( Directory );
-
-	DirWatch = new DirWatcherGeneric( NULL, this, directory, recursive, false );
-
-	DirWatch->addChilds( false );
 }
 
 WatcherGeneric::~WatcherGeneric() {
 	efSAFE_DELETE( DirWatch );
 }
 
+void WatcherGeneric::init() {
+	DirWatch = new DirWatcherGeneric( NULL, this, Directory, Recursive, false );
+
+	crawl( DirWatch );
+}
+
+void WatcherGeneric::crawl( DirWatcherGeneric* dir ) {
+	RealPathCache links;
+	Links = &links;
+
+	dir->addChilds( false );
+
+	Links = NULL;
+}
+
 void WatcherGeneric::watch() {
-	DirWatch->watch();
+	Clock::time_point now = Clock::now();
+
+	takeDue( now );
+	scanTaken( now );
+}
+
+void WatcherGeneric::rescan() {
+	takeDue( Clock::time_point::max() );
+	scanTaken( Clock::now() );
+}
+
+void WatcherGeneric::scanTaken( Clock::time_point now ) {
+	while ( true ) {
+		mRound.clear();
+		nextRound( mRound );
+
+		if ( mRound.empty() )
+			break;
+
+		for ( size_t i = 0; i < mRound.size(); i++ ) {
+			scan( mRound[i], mRoundListing, now );
+		}
+
+		report( mRound.data(), mRound.size() );
+	}
+
+	countPass( now );
+}
+
+void WatcherGeneric::countPass( Clock::time_point passStart ) {
+	if ( !mScanned )
+		return;
+
+	std::chrono::microseconds elapsed =
+		std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - passStart );
+
+	WatchCounters::add( Counters->Scans );
+	WatchCounters::add( Counters->ScanTime, elapsed.count() );
+
+	mScanned = false;
+}
+
+void WatcherGeneric::takeDue( Clock::time_point now ) {
+	/// The scans resumed first, they were due before
+	mTaken.insert( mTaken.end(), mResumed.begin(), mResumed.end() );
+	mResumed.clear();
+
+	while ( !mScans.empty() && mScans.top().Due <= now ) {
+		Scan scan = mScans.top();
+		mScans.pop();
+
+		if ( mScheduled.find( scan.Serial ) == mScheduled.end() )
+			continue;
+
+		DueScan taken;
+		taken.Dir = scan.Dir;
+		taken.Serial = scan.Serial;
+		taken.Diff = NULL;
+
+		scan.Dir->Pending = true;
+		mTaken.push_back( taken );
+	}
+}
+
+void WatcherGeneric::nextRound( std::vector<DueScan>& round ) {
+	size_t kept = 0;
+
+	for ( size_t i = 0; i < mTaken.size(); i++ ) {
+		if ( mScheduled.find( mTaken[i].Serial ) == mScheduled.end() )
+			continue;
+
+		DirWatcherGeneric* parent = mTaken[i].Dir->Parent;
+
+		if ( NULL != parent && parent->Pending ) {
+			mTaken[kept++] = mTaken[i];
+		} else {
+			round.push_back( mTaken[i] );
+		}
+	}
+
+	mTaken.resize( kept );
+}
+
+void WatcherGeneric::report( DueScan* scans, size_t count ) {
+	mScanned = mScanned || count > 0;
+
+	for ( size_t i = 0; i < count; i++ ) {
+		/// Deleted by the changes of a directory reported before
+		if ( mScheduled.find( scans[i].Serial ) == mScheduled.end() )
+			continue;
+
+		DirWatcherGeneric* dir = scans[i].Dir;
+
+		if ( NULL == scans[i].Diff ) {
+			mResumed.push_back( scans[i] );
+			continue;
+		}
+
+		dir->Pending = false;
+
+		if ( dir->report( *scans[i].Diff, true ) ) {
+			dir->Interval = MinInterval;
+		} else {
+			dir->Interval = std::min( dir->Interval * 2, MaxInterval );
+		}
+
+		push( dir, Clock::now() );
+	}
+}
+
+void WatcherGeneric::scan( DueScan& due, FileInfoMap& listing, Clock::time_point passStart ) {
+	DirectorySnapshot& snapshot = due.Dir->DirSnap;
+
+	if ( TimeSlice > 0 ) {
+		due.Diff = snapshot.scan( listing, passStart + std::chrono::milliseconds( TimeSlice ) );
+	} else {
+		due.Diff = &snapshot.scan( listing );
+	}
+}
+
+WatcherGeneric::Clock::time_point WatcherGeneric::nextScan() const {
+	if ( !mResumed.empty() )
+		return Clock::now();
+
+	return mScans.empty() ? Clock::now() + std::chrono::milliseconds( MaxInterval )
+						  : mScans.top().Due;
+}
+
+void WatcherGeneric::schedule( DirWatcherGeneric* dir ) {
+	dir->Serial = ++mLastSerial;
+	dir->Interval = MinInterval;
+
+	mScheduled.insert( dir->Serial );
+
+	push( dir, Clock::now() );
+}
+
+void WatcherGeneric::unschedule( DirWatcherGeneric* dir ) {
+	mScheduled.erase( dir->Serial );
+}
+
+void WatcherGeneric::push( DirWatcherGeneric* dir, Clock::time_point now ) {
+	Scan scan;
+	scan.Due = now + std::chrono::milliseconds( dir->Interval );
+	scan.Serial = dir->Serial;
+	scan.Dir = dir;
+
+	mScans.push( scan );
 }
 
 void WatcherGeneric::watchDir( std::string dir ) {
@@ -30,4 +198,33 @@ bool WatcherGeneric::pathInWatches( std::string path ) {
 	return DirWatch->pathInWatches( path );
 }
 
+void WatcherGeneric::expand( const std::string& directory ) {
+	/// A watch inside the directory expands from its top
+	if ( 0 == Directory.compare( 0, directory.size(), directory ) ) {
+		crawl( DirWatch );
+		return;
+	}
+
+	/// The directory itself isn't watched yet when only its entries were reported
+	std::string path( directory );
+	DirWatcherGeneric* dir = NULL;
+
+	while ( NULL == dir && path.size() >= Directory.size() ) {
+		dir = DirWatch->findDirWatcher( path );
+		path = FileSystem::pathRemoveFileName( path );
+	}
+
+	if ( NULL != dir ) {
+		crawl( dir );
+	}
+}
+
+void WatcherGeneric::collapse( const std::string& directory ) {
+	DirWatcherGeneric* dir = DirWatch->findDirWatcher( directory );
+
+	if ( NULL != dir ) {
+		dir->removeChilds();
+	}
+}
+
 } // namespace efsw
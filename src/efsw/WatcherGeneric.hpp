@@ -1,27 +1,156 @@
 #ifndef EFSW_WATCHERGENERIC_HPP
 #define EFSW_WATCHERGENERIC_HPP
 
+#include <efsw/DirectorySnapshotDiff.hpp>
 #include <efsw/FileWatcherImpl.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/RealPathCache.hpp>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+#include <vector>
 
 namespace efsw {
 
 class DirWatcherGeneric;
 
+/// A watch of the generic backend. Every directory of the watch is scanned on its own schedule:
+/// a directory that changed is scanned again after MinInterval, one that stays unchanged backs
+/// off doubling its interval up to MaxInterval. Only the directories due are scanned.
+/// The directories due are taken out of the schedule first and scanned in rounds, each from
+/// several threads, then their changes are reported from one thread in the order they were due.
+/// A directory is scanned in a round after the one of its parent, once the changes of the parent
+/// ( its moves and deletions ) were applied to it.
+/// With a TimeSlice the scans of a pass stop once it's over, the directories not done are resumed
+/// by the next pass ( their subdirectories wait for them ), so a huge directory doesn't hold the
+/// others nor the watch locked for long.
 class WatcherGeneric : public Watcher {
   public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// A directory taken out of the schedule, with the changes its scan found ( NULL if its scan
+	/// isn't done yet )
+	struct DueScan {
+		DirWatcherGeneric* Dir;
+		size_t Serial;
+		DirectorySnapshotDiff* Diff;
+	};
+
 	FileWatcherImpl* WatcherImpl;
 	DirWatcherGeneric* DirWatch;
 
+	/// The listing buffer shared by the scans of the directories made while reporting changes
+	FileInfoMap Listing;
+
+	/// Held from the scans of the directories of the watch until their changes are reported
+	Mutex ScanLock;
+
+	/// Set under ScanLock once the watch was removed, it's no longer scanned
+	bool Removed;
+
+	/// Bounds of the interval between the scans of a directory, in milliseconds
+	long MinInterval;
+	long MaxInterval;
+
+	/// Milliseconds a pass scans the directories of the watch for, 0 for no limit
+	long TimeSlice;
+
+	/// The links resolved by the crawl of the watch running, NULL out of a crawl
+	RealPathCache* Links;
+
 	WatcherGeneric( WatchID id, const std::string& directory, FileWatchListener* fwl,
 					FileWatcherImpl* fw, bool recursive );
 
 	~WatcherGeneric();
 
+	/// Takes the first snapshot of the directories, once the settings of the watch are set
+	void init();
+
+	/// Scans the directories due and reports their changes from the calling thread, for the
+	/// watches polled by the other backends ( the subtrees on remote file systems or out of
+	/// kernel watches )
 	void watch() override;
 
+	/// Scans every directory now, due or not, and reports their changes from the calling thread,
+	/// to resync the watches of a backend that lost its events
+	void rescan();
+
+	/// Takes the directories due out of the schedule
+	void takeDue( Clock::time_point now );
+
+	/// Appends to round the directories taken that can be scanned next: the ones whose parent
+	/// isn't waiting for its own scan. The directories deleted meanwhile are dropped.
+	void nextRound( std::vector<DueScan>& round );
+
+	/// Reports the changes found by the scans of a round, in the order they were due, and
+	/// schedules their next scans. The scans not done are resumed by the next pass.
+	void report( DueScan* scans, size_t count );
+
+	/// Counts the pass in the counters of the watch, if it scanned any of its directories
+	void countPass( Clock::time_point passStart );
+
+	/// Scans a directory of a round
+	void scan( DueScan& due, FileInfoMap& listing, Clock::time_point passStart );
+
+	/// @return When the next directory is due, now if a scan is to be resumed
+	Clock::time_point nextScan() const;
+
 	void watchDir( std::string dir );
 
 	bool pathInWatches( std::string path );
+
+	/// Called holding ScanLock, or from the thread polling the watch
+	void expand( const std::string& directory ) override;
+
+	void collapse( const std::string& directory ) override;
+
+	/// Schedules the first scan of a directory watcher, after MinInterval
+	void schedule( DirWatcherGeneric* dir );
+
+	/// Drops the scans of a directory watcher being deleted
+	void unschedule( DirWatcherGeneric* dir );
+
+  protected:
+	struct Scan {
+		Clock::time_point Due;
+		size_t Serial;
+		DirWatcherGeneric* Dir;
+
+		bool operator>( const Scan& other ) const {
+			return Due != other.Due ? Due > other.Due : Serial > other.Serial;
+		}
+	};
+
+	/// The next scan of every directory, earliest first. The scans of the directory watchers
+	/// deleted are left in the queue and skipped once due.
+	std::priority_queue<Scan, std::vector<Scan>, std::greater<Scan>> mScans;
+
+	/// The serials of the directory watchers alive
+	std::unordered_set<size_t> mScheduled;
+
+	/// The directories taken out of the schedule and not scanned yet
+	std::vector<DueScan> mTaken;
+
+	/// The directories whose sliced scan is to be resumed by the next pass, still pending
+	std::vector<DueScan> mResumed;
+
+	size_t mLastSerial;
+
+	/// The round and the listing buffer of the scans made by watch()
+	std::vector<DueScan> mRound;
+	FileInfoMap mRoundListing;
+
+	/// Set once a round of the pass reported the scans of the watch
+	bool mScanned;
+
+	void push( DirWatcherGeneric* dir, Clock::time_point now );
+
+	/// Watches the subdirectories of a directory watcher, resolving each link once
+	void crawl( DirWatcherGeneric* dir );
+
+	/// Scans the directories taken and reports their changes, in rounds
+	void scanTaken( Clock::time_point now );
 };
 
 } // namespace efsw
@@ -1,8 +1,186 @@
+#include <efsw/EventBatch.hpp>
+#include <efsw/FileSystem.hpp>
+#include <efsw/WatcherGeneric.hpp>
 #include <efsw/WatcherInotify.hpp>
 
 namespace efsw {
 
-WatcherInotify::WatcherInotify() : Watcher(), Parent( NULL ) {}
+ColdChild::ColdChild( WatcherInotify* parent, const std::string& path, WatcherGeneric* poller ) :
+	mParent( parent ), mPath( path ), mPoller( poller ) {
+	if ( NULL != mPoller )
+		return;
+
+	add( mPath );
+
+	if ( mParent->Recursive ) {
+		crawl( 0 );
+	}
+}
+
+ColdChild::~ColdChild() {
+	efSAFE_DELETE( mPoller );
+
+	for ( size_t i = 0; i < mDirectories.size(); i++ ) {
+		efSAFE_DELETE( mDirectories[i] );
+	}
+}
+
+bool ColdChild::poll( EventBatch& batch ) {
+	if ( NULL != mPoller ) {
+		mPoller->watch();
+		return false;
+	}
+
+	bool changed = false;
+
+	for ( size_t i = 0; i < mDirectories.size(); i++ ) {
+		DirectorySnapshot& snapshot = *mDirectories[i];
+
+		if ( !snapshot.namesChanged() )
+			continue;
+
+		DirectorySnapshotDiff& Diff = snapshot.scanNames( mListing );
+
+		if ( Diff.changed() ) {
+			report( batch, snapshot, Diff );
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+void ColdChild::expand( const std::string& directory ) {
+	if ( NULL != mPoller ) {
+		mPoller->expand( directory );
+	} else if ( mParent->Recursive ) {
+		/// The directories brought in scope are entries of the ones snapshotted
+		crawl( 0 );
+	}
+}
+
+void ColdChild::add( const std::string& directory ) {
+	DirectorySnapshot* snapshot = new DirectorySnapshot( directory );
+
+	mInodes.insert( snapshot->DirectoryInfo.Inode );
+	mDirectories.push_back( snapshot );
+}
+
+void ColdChild::crawl( size_t first ) {
+	for ( size_t i = first; i < mDirectories.size(); i++ ) {
+		DirectorySnapshot& snapshot = *mDirectories[i];
+
+		for ( FileInfoMap::iterator it = snapshot.Files.begin(); it != snapshot.Files.end();
+			  ++it ) {
+			if ( !it->second.isDirectory() || mInodes.find( it->second.Inode ) != mInodes.end() )
+				continue;
+
+			std::string path( snapshot.entryPath( it->first ) );
+
+			if ( mParent->prunes( path ) )
+				continue;
+
+			FileSystem::dirAddSlashAtEnd( path );
+			add( path );
+		}
+	}
+}
+
+void ColdChild::drop( const std::string& directory ) {
+	std::string dir( directory );
+	FileSystem::dirAddSlashAtEnd( dir );
+
+	for ( size_t i = mDirectories.size(); i > 0; i-- ) {
+		DirectorySnapshot* snapshot = mDirectories[i - 1];
+
+		if ( 0 == snapshot->DirectoryInfo.Filepath.compare( 0, dir.size(), dir ) ) {
+			mInodes.erase( snapshot->DirectoryInfo.Inode );
+			mDirectories.erase( mDirectories.begin() + ( i - 1 ) );
+			efSAFE_DELETE( snapshot );
+		}
+	}
+}
+
+void ColdChild::report( EventBatch& batch, DirectorySnapshot& snapshot,
+						DirectorySnapshotDiff& Diff ) {
+	const std::string& dir = snapshot.DirectoryInfo.Filepath;
+	FileInfoList::iterator it;
+	MovedList::iterator mit;
+
+	DiffIterator( FilesCreated ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Add );
+	}
+
+	DiffIterator( FilesModified ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Modified );
+	}
+
+	DiffIterator( FilesDeleted ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Delete );
+	}
+
+	DiffMovedIterator( FilesMoved ) {
+		report( batch, dir, ( *mit ).second.Filepath, Actions::Moved, ( *mit ).first );
+	}
+
+	/// The subtree is watched again from the directories created, they aren't snapshotted
+	DiffIterator( DirsCreated ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Add );
+	}
+
+	DiffIterator( DirsModified ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Modified );
+	}
+
+	DiffIterator( DirsDeleted ) {
+		report( batch, dir, ( *it ).Filepath, Actions::Delete );
+	}
+
+	DiffMovedIterator( DirsMoved ) {
+		report( batch, dir, ( *mit ).second.Filepath, Actions::Moved, ( *mit ).first );
+		drop( snapshot.entryPath( ( *mit ).first ) );
+	}
+}
+
+void ColdChild::report( EventBatch& batch, const std::string& dir, const std::string& path,
+						Action action, const std::string& oldFilename ) {
+	WatchCounters::add( mParent->Counters->Received );
+
+	if ( !mParent->accepts( action ) )
+		return;
+
+	std::string name( FileSystem::fileNameFromPath( path ) );
+
+	if ( !mParent->matches( dir, name, oldFilename ) )
+		return;
+
+	batch.add( mParent->Listener, mParent->ID, dir, name, action, oldFilename );
+}
+
+WatcherInotify::WatcherInotify() :
+	Watcher(),
+	Parent( NULL ),
+	Shared( NULL ),
+	KeepDescriptor( false ),
+	IsLink( false ),
+	PathGeneration( 0 ),
+	DirModificationTime( 0 ),
+	Snapshot( NULL ),
+	SyncPending( false ),
+	WatchBudget( 0 ),
+	KernelWatches( 0 ),
+	PollMinInterval( 1000 ),
+	PollMaxInterval( 1000 ),
+	LastActivity( 0 ),
+	MoveWindow( 0 ) {}
+
+WatcherInotify::~WatcherInotify() {
+	efSAFE_DELETE( Snapshot );
+
+	for ( ColdChildList::iterator it = ColdChildren.begin(); it != ColdChildren.end(); ++it ) {
+		efSAFE_DELETE( it->second );
+	}
+}
 
 bool WatcherInotify::inParentTree( WatcherInotify* parent ) {
 	WatcherInotify* tNext = Parent;
@@ -18,4 +196,69 @@ bool WatcherInotify::inParentTree( WatcherInotify* parent ) {
 	return false;
 }
 
+void WatcherInotify::setParent( WatcherInotify* parent, const std::string& name ) {
+	if ( NULL != Parent ) {
+		ChildList::iterator it = Parent->Children.find( Name );
+
+		if ( it != Parent->Children.end() && it->second == this ) {
+			Parent->Children.erase( it );
+		}
+	}
+
+	Parent = parent;
+	Name = name;
+
+	if ( NULL != Parent ) {
+		Parent->Children[Name] = this;
+	}
+}
+
+WatcherInotify* WatcherInotify::findChild( const std::string& name ) const {
+	ChildList::const_iterator it = Children.find( name );
+
+	return it != Children.end() ? it->second : NULL;
+}
+
+WatcherInotify* WatcherInotify::root() {
+	WatcherInotify* watch = this;
+
+	while ( NULL != watch->Parent ) {
+		watch = watch->Parent;
+	}
+
+	return watch;
+}
+
+void WatcherInotify::handleFileEvent( WatchID, std::string_view dir, std::string_view filename,
+									  Action action, std::string_view oldFilename ) {
+	Listener->handleFileEvent( ID, dir, filename, action, oldFilename );
+}
+
+void WatcherInotify::handleFileActions( const Event* events, size_t count ) {
+	mEvents.assign( events, events + count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		mEvents[i].watchid = ID;
+	}
+
+	Listener->handleFileActions( mEvents.data(), count );
+}
+
+void WatcherInotify::handleWatchError( WatchID, Error error, std::string_view path ) {
+	Listener->handleWatchError( ID, error, path );
+}
+
+const std::string& WatcherInotify::path( Uint64 generation ) {
+	if ( PathGeneration != generation ) {
+		if ( NULL != Parent && !IsLink ) {
+			Directory = Parent->path( generation ) + Name;
+			FileSystem::dirAddSlashAtEnd( Directory );
+		}
+
+		PathGeneration = generation;
+	}
+
+	return Directory;
+}
+
 } // namespace efsw
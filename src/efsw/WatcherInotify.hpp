@@ -1,21 +1,199 @@
 #ifndef EFSW_WATCHERINOTIFY_HPP
 #define EFSW_WATCHERINOTIFY_HPP
 
-#include <efsw/FileInfo.hpp>
+#include <efsw/DirectorySnapshot.hpp>
 #include <efsw/FileWatcherImpl.hpp>
+#include <atomic>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace efsw {
 
-class WatcherInotify : public Watcher {
+class EventBatch;
+class WatcherGeneric;
+class WatcherInotify;
+
+/// A subdirectory of a watch left without kernel watches. Out of the watch budget ( or the system
+/// limit ) the directories of its subtree are snapshotted and only their times are polled: one
+/// whose time changed is listed again for its entries created, deleted and renamed. The files
+/// modified in place don't change the time of their directory, they're only seen once the subtree
+/// is watched again. On a remote file system the kernel doesn't see the changes made by the other
+/// clients, the subtree is polled for good by a generic watcher instead.
+class ColdChild {
   public:
+	/// Snapshots the subtree, unless it's given the generic watcher polling it
+	ColdChild( WatcherInotify* parent, const std::string& path, WatcherGeneric* poller );
+
+	~ColdChild();
+
+	/// Adds the changes found to the batch, the generic watcher delivers its own
+	/// @return True if a directory of the subtree changed, never for a remote subtree
+	bool poll( EventBatch& batch );
+
+	/// Snapshots a directory of the subtree brought in scope
+	void expand( const std::string& directory );
+
+	/// @return True if the subtree is polled for good
+	bool remote() const { return NULL != mPoller; }
+
+	/// @return The path of the subdirectory when it was left out, with the slash at the end
+	const std::string& path() const { return mPath; }
+
+  protected:
+	WatcherInotify* mParent;
+
+	std::string mPath;
+
+	WatcherGeneric* mPoller;
+
+	/// The directories of the subtree, parents first
+	std::vector<DirectorySnapshot*> mDirectories;
+
+	/// The inodes of the directories snapshotted, a symlink looping back is followed once
+	std::unordered_set<Uint64> mInodes;
+
+	/// Reused by the scans
+	FileInfoMap mListing;
+
+	void add( const std::string& directory );
+
+	/// Snapshots the subdirectories not snapshotted yet of the directories from the first one,
+	/// but the excluded ones
+	void crawl( size_t first );
+
+	/// Stops polling a directory renamed and its subtree, their snapshots would report them gone.
+	/// They come after the directory given.
+	void drop( const std::string& directory );
+
+	void report( EventBatch& batch, DirectorySnapshot& snapshot, DirectorySnapshotDiff& Diff );
+
+	void report( EventBatch& batch, const std::string& dir, const std::string& path,
+				 Action action, const std::string& oldFilename = "" );
+};
+
+/// A node of the tree of watched directories. Only the root ( and the directories reached
+/// through symlinks ) keep an absolute path, the subdirectories keep their name and derive the
+/// Directory from the parent, so a rename only needs to re-parent one node.
+/// The subdirectories without a kernel watch ( out of the watch budget, or on a remote file system
+/// ) are polled, the node listens to the generic watchers of the remote ones to forward their
+/// changes.
+class WatcherInotify : public Watcher, public FileWatchListener {
+  public:
+	/// The subdirectories without a kernel watch indexed by name
+	typedef std::unordered_map<std::string, ColdChild*> ColdChildList;
+
+	/// Subdirectory watchers indexed by name
+	typedef std::unordered_map<std::string, WatcherInotify*> ChildList;
+
+	/// Names looked up by std::string_view, without a copy
+	typedef std::set<std::string, std::less<>> NameSet;
+
 	WatcherInotify();
 
+	~WatcherInotify();
+
 	bool inParentTree( WatcherInotify* parent );
 
+	/// Moves the watcher under a new parent with a new name, keeping the children lists in sync
+	void setParent( WatcherInotify* parent, const std::string& name );
+
+	/// @return The child watcher of the subdirectory, or NULL if it's not watched
+	WatcherInotify* findChild( const std::string& name ) const;
+
+	/// @return The root watcher of the tree
+	WatcherInotify* root();
+
+	/// Forwards the changes found by the generic watchers of the remote children
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	/// Returns the full path of the watcher, rebuilding it if the tree changed since it was
+	/// last computed.
+	/// @param generation The current generation of the tree, incremented on every rename
+	const std::string& path( Uint64 generation );
+
 	WatcherInotify* Parent;
 	WatchID InotifyID;
 
-	FileInfo DirInfo;
+	/// The next watcher of another watch on the same descriptor: the kernel gives a directory a
+	/// single descriptor, so the watches nested in each other with different options share the
+	/// descriptors of their common directories. Only the first watcher is in the watches maps,
+	/// the events of the descriptor reach every watcher of the chain.
+	std::atomic<WatcherInotify*> Shared;
+
+	/// Detached while other watches still share its descriptor, the kernel watch is kept
+	bool KeepDescriptor;
+
+	/// Name of the directory inside its parent
+	std::string Name;
+
+	/// The directory was reached through a symlink, the Directory is the real path of it
+	bool IsLink;
+
+	/// Generation of the tree when the Directory was computed. Once it matches the current
+	/// generation the Directory isn't modified, so the event loop reads it without locking.
+	std::atomic<Uint64> PathGeneration;
+
+	/// Modification time of the directory in nanoseconds when it was last known to be in sync,
+	/// used to find the directories that changed while the events were lost
+	Uint64 DirModificationTime;
+
+	/// Snapshot of the directory kept up to date with its events, only the recently active
+	/// directories have one ( NULL otherwise )
+	DirectorySnapshot* Snapshot;
+
+	/// Position of the watcher in the list of active directories ( valid if Snapshot is set )
+	std::list<WatcherInotify*>::iterator ActiveEntry;
+
+	/// Entries created, written or moved in since the last sync of the snapshot, stat'd on the
+	/// next poll tick ( guarded by mWatchesLock of the FileWatcher ). Looked up by the names of
+	/// the events, so a name touched again isn't copied.
+	NameSet Touched;
+
+	/// The directory is queued to be synced on the next poll tick ( guarded by mWatchesLock of
+	/// the FileWatcher )
+	bool SyncPending;
+
+	ChildList Children;
+
+	/// Maximum number of kernel watches of the tree, 0 is unlimited ( only set in the root )
+	size_t WatchBudget;
+
+	/// Number of kernel watches used by the tree ( only kept in the root )
+	size_t KernelWatches;
+
+	/// Bounds of the interval between the scans of the directories polled, in milliseconds ( only
+	/// set in the root )
+	long PollMinInterval;
+	long PollMaxInterval;
+
+	/// Value of the activity clock on the last event of the directory or of its subtree
+	Uint64 LastActivity;
+
+	/// The directories of the tree but the root, the most recently active first. An activity
+	/// moves the directory and its parents to the front, so a directory never comes before its
+	/// parents ( only kept in the root )
+	std::list<WatcherInotify*> Recent;
+
+	/// Position of the watcher in the Recent list of its root ( unset in the root )
+	std::list<WatcherInotify*>::iterator RecentEntry;
+
+	/// Milliseconds the files moved out of the directory wait for the other end of the move
+	long MoveWindow;
+
+	/// The subdirectories left out of the kernel watches, polled instead
+	ColdChildList ColdChildren;
+
+  protected:
+	/// The batch of a poller being forwarded, reused between batches
+	std::vector<Event> mEvents;
 };
 
 } // namespace efsw
@@ -8,6 +8,7 @@
 #include <cstring>
 #include <dirent.h>
 #include <efsw/Debug.hpp>
+#include <efsw/EventBatch.hpp>
 #include <efsw/FileSystem.hpp>
 #include <efsw/FileWatcherKqueue.hpp>
 #include <efsw/String.hpp>
@@ -18,88 +19,59 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define KEVENT_RESERVE_VALUE ( 10 )
-
 #ifndef O_EVTONLY
 #define O_EVTONLY ( O_RDONLY | O_NONBLOCK )
 #endif
 
 namespace efsw {
 
-int comparator( const void* ke1, const void* ke2 ) {
-	const KEvent* kev1 = reinterpret_cast<const KEvent*>( ke1 );
-	const KEvent* kev2 = reinterpret_cast<const KEvent*>( ke2 );
-
-	if ( NULL != kev2->udata ) {
-		FileInfo* fi1 = reinterpret_cast<FileInfo*>( kev1->udata );
-		FileInfo* fi2 = reinterpret_cast<FileInfo*>( kev2->udata );
-
-		return strcmp( fi1->Filepath.c_str(), fi2->Filepath.c_str() );
-	}
-
-	return 1;
-}
-
 WatcherKqueue::WatcherKqueue( WatchID watchid, const std::string& dirname,
 							  FileWatchListener* listener, bool recursive,
 							  FileWatcherKqueue* watcher, WatcherKqueue* parent ) :
 	Watcher( watchid, dirname, listener, recursive ),
+	RescanPending( false ),
+	DirectoriesOnly( false ),
 	mLastWatchID( 0 ),
-	mChangeListCount( 0 ),
-#ifdef __FreeBSD__
-	mKqueue( kqueue1(O_CLOEXEC) ),
-#else
-	mKqueue( kqueue() ),
-#endif
+	mFd( -1 ),
+	mToken( 0 ),
 	mWatcher( watcher ),
 	mParent( parent ),
 	mInitOK( true ),
-	mErrno( 0 ) {
-	if ( -1 == mKqueue ) {
-		efDEBUG(
-			"kqueue() returned invalid descriptor for directory %s. File descriptors count: %ld\n",
-			Directory.c_str(), mWatcher->mFileDescriptorCount );
-
-		mInitOK = false;
-		mErrno = errno;
-	} else {
-#ifndef __FreeBSD__
-		// this is racey, but only freebsd has kqueue1
-		fcntl(mKqueue, F_SETFD, fcntl(mKqueue, F_GETFD) | FD_CLOEXEC);
-#endif
-		mWatcher->addFD();
-	}
-}
+	mErrno( 0 ) {}
 
 WatcherKqueue::~WatcherKqueue() {
 	// Remove the childs watchers ( sub-folders watches )
 	removeAll();
 
-	for ( size_t i = 0; i < mChangeListCount; i++ ) {
-		if ( NULL != mChangeList[i].udata ) {
-			FileInfo* fi = reinterpret_cast<FileInfo*>( mChangeList[i].udata );
+	// Closing the descriptors removes their kevents from the kqueue
+	for ( std::unordered_map<std::string, File>::iterator it = mFiles.begin(); it != mFiles.end();
+		  ++it ) {
+		mWatcher->removeKevent( it->second.Token );
 
-			efSAFE_DELETE( fi );
-		}
+		close( it->second.Fd );
+
+		mWatcher->removeFD();
+		WatchCounters::sub( Counters->KernelWatches );
 	}
 
-	close( mKqueue );
+	if ( -1 != mFd ) {
+		mWatcher->removeKevent( mToken );
 
-	mWatcher->removeFD();
-}
+		close( mFd );
 
-void WatcherKqueue::addAll() {
-	if ( -1 == mKqueue ) {
-		return;
+		mWatcher->removeFD();
+		WatchCounters::sub( Counters->KernelWatches );
 	}
+}
 
+void WatcherKqueue::addAll() {
 	// scan directory and call addFile(name, false) on each file
 	FileSystem::dirAddSlashAtEnd( Directory );
 
 	efDEBUG( "addAll(): Added folder: %s\n", Directory.c_str() );
 
 	// add base dir
-	int fd = open( Directory.c_str(), O_EVTONLY | O_CLOEXEC);
+	int fd = open( Directory.c_str(), O_EVTONLY | O_CLOEXEC );
 
 	if ( -1 == fd ) {
 		efDEBUG( "addAll(): Couldn't open folder: %s\n", Directory.c_str() );
@@ -113,33 +85,53 @@ void WatcherKqueue::addAll() {
 		return;
 	}
 
-	mDirSnap.setDirectoryInfo( Directory );
-	mDirSnap.scan();
+	// The kevent is registered before the snapshot is taken, so no change is missed in between
+	mToken = mWatcher->addKevent(
+		fd, NOTE_DELETE | NOTE_EXTEND | NOTE_WRITE | NOTE_ATTRIB | NOTE_RENAME, this, NULL );
+
+	if ( 0 == mToken ) {
+		mInitOK = false;
+		mErrno = errno;
+
+		close( fd );
 
-	mChangeList.resize( KEVENT_RESERVE_VALUE );
+		return;
+	}
 
-	// Creates the kevent for the folder
-	EV_SET( &mChangeList[0], fd, EVFILT_VNODE, EV_ADD | EV_ENABLE | EV_ONESHOT,
-			NOTE_DELETE | NOTE_EXTEND | NOTE_WRITE | NOTE_ATTRIB | NOTE_RENAME, 0, 0 );
+	mFd = fd;
 
 	mWatcher->addFD();
+	WatchCounters::add( Counters->KernelWatches );
+
+	mDirSnap.setDirectoryInfo( Directory );
+	mDirSnap.scan();
 
 	// Get the files and directories from the directory
 	FileInfoMap files = FileSystem::filesInfoFromPath( Directory );
 
 	for ( FileInfoMap::iterator it = files.begin(); it != files.end(); it++ ) {
-		FileInfo& fi = it->second;
+		const FileStat& fi = it->second;
+		std::string path( Directory + std::string( it->first ) );
 
 		if ( fi.isRegularFile() ) {
 			// Add the regular files kevent
-			addFile( fi.Filepath, false );
-		} else if ( Recursive && fi.isDirectory() && fi.isReadable() ) {
+			if ( watchesFile( path ) ) {
+				addFile( path, false );
+			}
+		} else if ( Recursive && fi.isDirectory() && !prunes( path ) ) {
+			if ( !fi.isReadable() ) {
+				reportError( Errors::FileNotReadable, path );
+				continue;
+			}
+
 			// Create another watcher for the subfolders ( if recursive )
-			WatchID id = addWatch( fi.Filepath, Listener, Recursive, this );
+			WatchID id = addWatch( path, Listener, Recursive, this );
 
 			// If the watcher is not adding the watcher means that the directory was created
 			if ( id > 0 && !mWatcher->isAddingWatcher() ) {
-				handleFolderAction( fi.Filepath, Actions::Add );
+				handleFolderAction( path, Actions::Add );
+			} else if ( Errors::Unspecified == id ) {
+				reportError( Errors::FileNotReadable, path );
 			}
 		}
 	}
@@ -161,11 +153,54 @@ void WatcherKqueue::removeAll() {
 	}
 }
 
+bool WatcherKqueue::watchesFile( const std::string& path ) const {
+	if ( !interestedIn( Interests::ContentClosed | Interests::ContentModified |
+						Interests::Attributes ) )
+		return false;
+
+	if ( !DirectoriesOnly )
+		return true;
+
+	return HotFiles && HotFiles->matches( Directory, FileSystem::fileNameFromPath( path ) );
+}
+
+unsigned int WatcherKqueue::fileEvents() const {
+	unsigned int fflags = NOTE_DELETE | NOTE_RENAME;
+
+	if ( interestedIn( Interests::ContentClosed | Interests::ContentModified ) ) {
+		fflags |= NOTE_EXTEND | NOTE_WRITE;
+	}
+
+	if ( interestedIn( Interests::Attributes ) ) {
+		fflags |= NOTE_ATTRIB;
+	}
+
+	return fflags;
+}
+
 void WatcherKqueue::addFile( const std::string& name, bool emitEvents ) {
 	efDEBUG( "addFile(): Added: %s\n", name.c_str() );
 
+	// Without interest in the files changes ( or in directories only mode ) the directory events
+	// are enough, no descriptor is spent on them
+	if ( !watchesFile( name ) ) {
+		if ( emitEvents ) {
+			handleAction( name, Actions::Add );
+		}
+
+		return;
+	}
+
+	if ( mFiles.find( name ) != mFiles.end() ) {
+		if ( emitEvents ) {
+			handleAction( name, Actions::Add );
+		}
+
+		return;
+	}
+
 	// Open the file to get the file descriptor
-	int fd = open( name.c_str(), O_EVTONLY | O_CLOEXEC);
+	int fd = open( name.c_str(), O_EVTONLY | O_CLOEXEC );
 
 	if ( fd == -1 ) {
 		efDEBUG( "addFile(): Could open file descriptor for %s. File descriptor count: %ld\n",
@@ -182,30 +217,20 @@ void WatcherKqueue::addFile( const std::string& name, bool emitEvents ) {
 		return;
 	}
 
-	mWatcher->addFD();
+	File& file = mFiles[name];
+	file.Fd = fd;
+	file.Info = FileInfo( name );
+	file.Token = mWatcher->addKevent( fd, fileEvents(), this, &file );
 
-	// increase the file kevent file count
-	mChangeListCount++;
+	if ( 0 == file.Token ) {
+		close( fd );
 
-	if ( mChangeListCount + KEVENT_RESERVE_VALUE > mChangeList.size() &&
-		 mChangeListCount % KEVENT_RESERVE_VALUE == 0 ) {
-		size_t reserve_size = mChangeList.size() + KEVENT_RESERVE_VALUE;
-		mChangeList.resize( reserve_size );
-		efDEBUG( "addFile(): Reserverd more KEvents space for %s, space reserved %ld, list actual "
-				 "size %ld.\n",
-				 Directory.c_str(), reserve_size, mChangeListCount );
+		mFiles.erase( name );
+	} else {
+		mWatcher->addFD();
+		WatchCounters::add( Counters->KernelWatches );
 	}
 
-	// create entry
-	FileInfo* entry = new FileInfo( name );
-
-	// set the event data at the end of the list
-	EV_SET( &mChangeList[mChangeListCount], fd, EVFILT_VNODE, EV_ADD | EV_ENABLE | EV_ONESHOT,
-			NOTE_DELETE | NOTE_EXTEND | NOTE_WRITE | NOTE_ATTRIB | NOTE_RENAME, 0, (void*)entry );
-
-	// qsort sort the list by name
-	qsort( &mChangeList[1], mChangeListCount, sizeof( KEvent ), comparator );
-
 	// handle action
 	if ( emitEvents ) {
 		handleAction( name, Actions::Add );
@@ -215,20 +240,18 @@ void WatcherKqueue::addFile( const std::string& name, bool emitEvents ) {
 void WatcherKqueue::removeFile( const std::string& name, bool emitEvents ) {
 	efDEBUG( "removeFile(): Trying to remove file: %s\n", name.c_str() );
 
-	// bsearch
-	KEvent target;
-
-	// Create a temporary file info to search the kevent ( searching the directory )
-	FileInfo tempEntry( name );
+	if ( !watchesFile( name ) ) {
+		if ( emitEvents ) {
+			handleAction( name, Actions::Delete );
+		}
 
-	target.udata = &tempEntry;
+		return;
+	}
 
-	// Search the kevent
-	KEvent* ke = (KEvent*)bsearch( &target, &mChangeList[0], mChangeListCount + 1, sizeof( KEvent ),
-								   comparator );
+	std::unordered_map<std::string, File>::iterator it = mFiles.find( name );
 
 	// Trying to remove a non-existing file?
-	if ( !ke ) {
+	if ( it == mFiles.end() ) {
 		Errors::Log::createLastError( Errors::FileNotFound, name );
 		efDEBUG( "File not removed\n" );
 		return;
@@ -241,28 +264,27 @@ void WatcherKqueue::removeFile( const std::string& name, bool emitEvents ) {
 		handleAction( name, Actions::Delete );
 	}
 
-	// Delete the user data ( FileInfo ) from the kevent closed
-	FileInfo* del = reinterpret_cast<FileInfo*>( ke->udata );
+	// close the file descriptor, which removes its kevent
+	mWatcher->removeKevent( it->second.Token );
 
-	efSAFE_DELETE( del );
-
-	// close the file descriptor from the kevent
-	close( ke->ident );
+	close( it->second.Fd );
 
 	mWatcher->removeFD();
+	WatchCounters::sub( Counters->KernelWatches );
 
-	memset( ke, 0, sizeof( KEvent ) );
-
-	// move end to current
-	memcpy( ke, &mChangeList[mChangeListCount], sizeof( KEvent ) );
-	memset( &mChangeList[mChangeListCount], 0, sizeof( KEvent ) );
-	--mChangeListCount;
+	mFiles.erase( it );
 }
 
 void WatcherKqueue::rescan() {
 	efDEBUG( "rescan(): Rescanning: %s\n", Directory.c_str() );
 
-	DirectorySnapshotDiff Diff = mDirSnap.scan();
+	/// The files with a descriptor report their own changes, so only the names new are stat'ed,
+	/// unless the files are checked by the rescan of their directory
+	DirectorySnapshotDiff& Diff =
+		DirectoriesOnly && interestedIn( Interests::ContentClosed | Interests::ContentModified |
+										 Interests::Attributes )
+			? mDirSnap.scan( mWatcher->mListing )
+			: mDirSnap.scanNames( mWatcher->mListing );
 
 	if ( Diff.DirChanged ) {
 		sendDirChanged();
@@ -294,7 +316,11 @@ void WatcherKqueue::rescan() {
 		/// Directories
 		DiffIterator( DirsCreated ) {
 			handleFolderAction( ( *it ).Filepath, Actions::Add );
-			addWatch( ( *it ).Filepath, Listener, Recursive, this );
+
+			if ( !prunes( ( *it ).Filepath ) &&
+				 Errors::Unspecified == addWatch( ( *it ).Filepath, Listener, Recursive, this ) ) {
+				reportError( Errors::FileNotReadable, ( *it ).Filepath );
+			}
 		}
 
 		DiffIterator( DirsModified ) {
@@ -329,8 +355,18 @@ WatchID WatcherKqueue::watchingDirectory( std::string dir ) {
 
 void WatcherKqueue::handleAction( const std::string& filename, efsw::Action action,
 								  const std::string& oldFilename ) {
-	Listener->handleFileAction( ID, Directory, FileSystem::fileNameFromPath( filename ), action,
-								FileSystem::fileNameFromPath( oldFilename ) );
+	WatchCounters::add( Counters->Received );
+
+	if ( !accepts( action ) )
+		return;
+
+	std::string name( FileSystem::fileNameFromPath( filename ) );
+	std::string oldName( FileSystem::fileNameFromPath( oldFilename ) );
+
+	if ( !matches( Directory, name, oldName ) )
+		return;
+
+	EventBatch::send( Listener, ID, Directory, name, action, oldName );
 }
 
 void WatcherKqueue::handleFolderAction( std::string filename, efsw::Action action,
@@ -341,78 +377,62 @@ void WatcherKqueue::handleFolderAction( std::string filename, efsw::Action actio
 }
 
 void WatcherKqueue::sendDirChanged() {
-	if ( NULL != mParent ) {
-		Listener->handleFileAction( mParent->ID, mParent->Directory,
-									FileSystem::fileNameFromPath( Directory ), Actions::Modified );
-	}
-}
-
-void WatcherKqueue::watch() {
-	if ( -1 == mKqueue ) {
+	if ( NULL == mParent )
 		return;
-	}
 
-	int nev = 0;
-	KEvent event;
+	WatchCounters::add( mParent->Counters->Received );
 
-	// First iterate the childs, to get the events from the deepest folder, to the watcher childs
-	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
-		it->second->watch();
-	}
+	if ( mParent->accepts( Actions::Modified ) ) {
+		std::string name( FileSystem::fileNameFromPath( Directory ) );
 
-	bool needScan = false;
+		if ( mParent->matches( mParent->Directory, name ) ) {
+			EventBatch::send( Listener, mParent->ID, mParent->Directory, name, Actions::Modified );
+		}
+	}
+}
 
-	// Then we get the the events of the current folder
-	while ( ( nev = kevent( mKqueue, &mChangeList[0], mChangeListCount + 1, &event, 1,
-							&mWatcher->mTimeOut ) ) != 0 ) {
-		// An error ocurred?
-		if ( nev == -1 ) {
-			efDEBUG( "watch(): Error on directory %s\n", Directory.c_str() );
-			perror( "kevent" );
-			break;
-		} else {
-			FileInfo* entry = NULL;
+bool WatcherKqueue::handleKevent( const KEvent& event, File* file ) {
+	// The directory changed, its entries were added, removed or renamed
+	if ( NULL == file ) {
+		return true;
+	}
 
-			// If udate == NULL means that it is the fisrt element of the change list, the folder.
-			// otherwise it is an event of some file inside the folder
-			if ( ( entry = reinterpret_cast<FileInfo*>( event.udata ) ) != NULL ) {
-				efDEBUG( "watch(): File: %s ", entry->Filepath.c_str() );
+	efDEBUG( "handleKevent(): File: %s ", file->Info.Filepath.c_str() );
 
-				// If the event flag is delete... the file was deleted
-				if ( event.fflags & NOTE_DELETE ) {
-					efDEBUG( "deleted\n" );
+	// If the event flag is delete... the file was deleted
+	if ( event.fflags & NOTE_DELETE ) {
+		efDEBUG( "deleted\n" );
 
-					mDirSnap.removeFile( entry->Filepath );
+		std::string path( file->Info.Filepath );
 
-					removeFile( entry->Filepath );
-				} else if ( event.fflags & NOTE_EXTEND || event.fflags & NOTE_WRITE ||
-							event.fflags & NOTE_ATTRIB ) {
-					// The file was modified
-					efDEBUG( "modified\n" );
+		mDirSnap.removeFile( path );
 
-					FileInfo fi( entry->Filepath );
+		removeFile( path );
+	} else if ( event.fflags & NOTE_EXTEND || event.fflags & NOTE_WRITE ||
+				event.fflags & NOTE_ATTRIB ) {
+		// The file was modified
+		efDEBUG( "modified\n" );
 
-					if ( fi != *entry ) {
-						*entry = fi;
+		FileInfo fi( file->Info.Filepath );
 
-						mDirSnap.updateFile( entry->Filepath );
+		if ( fi != file->Info ) {
+			file->Info = fi;
 
-						handleAction( entry->Filepath, efsw::Actions::Modified );
-					}
-				} else if ( event.fflags & NOTE_RENAME ) {
-					efDEBUG( "moved\n" );
+			mDirSnap.updateFile( file->Info.Filepath );
 
-					needScan = true;
-				}
-			} else {
-				needScan = true;
-			}
+			handleAction( file->Info.Filepath, efsw::Actions::Modified );
 		}
-	}
+	} else if ( event.fflags & NOTE_RENAME ) {
+		efDEBUG( "moved\n" );
 
-	if ( needScan ) {
-		rescan();
+		return true;
 	}
+
+	return false;
+}
+
+Uint64 WatcherKqueue::token() const {
+	return mToken;
 }
 
 Watcher* WatcherKqueue::findWatcher( const std::string path ) {
@@ -456,10 +476,10 @@ WatchID WatcherKqueue::addWatch( const std::string& directory, FileWatchListener
 		return Errors::Log::createLastError( Errors::FileNotFound, dir );
 	} else if ( pathInWatches( dir ) || pathInParent( dir ) ) {
 		return Errors::Log::createLastError( Errors::FileRepeated, directory );
-	} else if ( NULL != parent && FileSystem::isRemoteFS( dir ) ) {
-		return Errors::Log::createLastError( Errors::FileRemote, dir );
 	}
 
+	bool remote = NULL != parent && FileSystem::isRemoteFS( dir );
+
 	std::string curPath;
 	std::string link( FileSystem::getLinkRealPath( dir, curPath ) );
 
@@ -478,9 +498,25 @@ WatchID WatcherKqueue::addWatch( const std::string& directory, FileWatchListener
 		}
 	}
 
-	if ( mWatcher->availablesFD() ) {
+	if ( remote ) {
+		/// The kernel doesn't see the changes made by the other clients, the subtree is polled
+		WatcherGeneric* watch =
+			new WatcherGeneric( ++mLastWatchID, dir, watcher, mWatcher, recursive );
+		watch->EventInterests = EventInterests;
+		watch->Filter = Filter;
+		watch->Counters = Counters;
+		watch->init();
+
+		mWatches.insert( std::make_pair( mLastWatchID, watch ) );
+		mWatcher->addPoller( watch );
+	} else if ( mWatcher->availablesFD() ) {
 		WatcherKqueue* watch =
 			new WatcherKqueue( ++mLastWatchID, dir, watcher, recursive, mWatcher, parent );
+		watch->EventInterests = EventInterests;
+		watch->Filter = Filter;
+		watch->Counters = Counters;
+		watch->DirectoriesOnly = DirectoriesOnly;
+		watch->HotFiles = HotFiles;
 
 		mWatches.insert( std::make_pair( mLastWatchID, watch ) );
 
@@ -500,8 +536,13 @@ WatchID WatcherKqueue::addWatch( const std::string& directory, FileWatchListener
 			if ( EACCES != le ) {
 				WatcherGeneric* watch =
 					new WatcherGeneric( ++mLastWatchID, dir, watcher, mWatcher, recursive );
+				watch->EventInterests = EventInterests;
+				watch->Filter = Filter;
+				watch->Counters = Counters;
+				watch->init();
 
 				mWatches.insert( std::make_pair( mLastWatchID, watch ) );
+				mWatcher->addPoller( watch );
 			} else {
 				return Errors::Log::createLastError( Errors::Unspecified, link );
 			}
@@ -515,13 +556,63 @@ WatchID WatcherKqueue::addWatch( const std::string& directory, FileWatchListener
 
 		WatcherGeneric* watch =
 			new WatcherGeneric( ++mLastWatchID, dir, watcher, mWatcher, recursive );
+		watch->EventInterests = EventInterests;
+		watch->Filter = Filter;
+		watch->Counters = Counters;
+		watch->init();
 
 		mWatches.insert( std::make_pair( mLastWatchID, watch ) );
+		mWatcher->addPoller( watch );
 	}
 
 	return mLastWatchID;
 }
 
+void WatcherKqueue::expand( const std::string& directory ) {
+	bool inside = 0 == Directory.compare( 0, directory.size(), directory );
+
+	/// Only the watchers on the way to the directory and under it are visited
+	if ( !inside && 0 != directory.compare( 0, Directory.size(), Directory ) )
+		return;
+
+	if ( inside && Recursive ) {
+		for ( FileInfoMap::iterator it = mDirSnap.Files.begin(); it != mDirSnap.Files.end();
+			  ++it ) {
+			if ( !it->second.isDirectory() )
+				continue;
+
+			std::string path( mDirSnap.entryPath( it->first ) );
+			FileSystem::dirAddSlashAtEnd( path );
+
+			if ( prunes( path ) || pathInWatches( path ) )
+				continue;
+
+			if ( Errors::Unspecified == addWatch( path, Listener, Recursive, this ) ) {
+				reportError( Errors::FileNotReadable, path );
+			}
+		}
+	}
+
+	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		it->second->expand( directory );
+	}
+}
+
+void WatcherKqueue::collapse( const std::string& directory ) {
+	/// The directory itself stays watched
+	if ( Directory == directory ) {
+		removeAll();
+		return;
+	}
+
+	if ( 0 != directory.compare( 0, Directory.size(), Directory ) )
+		return;
+
+	for ( WatchMap::iterator it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		it->second->collapse( directory );
+	}
+}
+
 bool WatcherKqueue::initOK() {
 	return mInitOK;
 }
@@ -535,6 +626,7 @@ void WatcherKqueue::removeWatch( WatchID watchid ) {
 	Watcher* watch = iter->second;
 
 	mWatches.erase( iter );
+	mWatcher->removePoller( watch );
 
 	efSAFE_DELETE( watch );
 }
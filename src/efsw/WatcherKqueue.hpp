@@ -9,7 +9,7 @@
 #include <map>
 #include <sys/event.h>
 #include <sys/types.h>
-#include <vector>
+#include <unordered_map>
 
 namespace efsw {
 
@@ -21,8 +21,18 @@ typedef struct kevent KEvent;
 /// type for a map from WatchID to WatcherKqueue pointer
 typedef std::map<WatchID, Watcher*> WatchMap;
 
+/// A directory watched with kqueue. Its directory and files are registered on the kqueue shared by
+/// the FileWatcherKqueue, which hands their events back to the watcher.
 class WatcherKqueue : public Watcher {
   public:
+	/// A file of the directory with its own kevent
+	struct File {
+		int Fd;
+		/// Token of the kevent, see FileWatcherKqueue::addKevent
+		Uint64 Token;
+		FileInfo Info;
+	};
+
 	WatcherKqueue( WatchID watchid, const std::string& dirname, FileWatchListener* listener,
 				   bool recursive, FileWatcherKqueue* watcher, WatcherKqueue* parent = NULL );
 
@@ -32,6 +42,13 @@ class WatcherKqueue : public Watcher {
 
 	void removeFile( const std::string& name, bool emitEvents = true );
 
+	/// @return True if the file needs its own kevent, to report its content or attributes
+	/// changes
+	bool watchesFile( const std::string& path ) const;
+
+	/// @return The vnode events requested for the files
+	unsigned int fileEvents() const;
+
 	// called when the directory is actually changed
 	// means a file has been added or removed
 	// rescans the watched directory adding/removing files and sending notices
@@ -49,28 +66,51 @@ class WatcherKqueue : public Watcher {
 
 	WatchID watchingDirectory( std::string dir );
 
-	void watch() override;
+	/// Handles a kevent of the directory or of one of its files
+	/// @param file The file of the kevent, NULL for the directory
+	/// @return True if the directory must be rescanned
+	bool handleKevent( const KEvent& event, File* file );
+
+	/// @return The token of the kevent of the directory, 0 if it isn't registered
+	Uint64 token() const;
 
 	WatchID addWatch( const std::string& directory, FileWatchListener* watcher, bool recursive,
 					  WatcherKqueue* parent );
 
 	void removeWatch( WatchID watchid );
 
+	/// Adds the watchers of the subdirectories brought in scope, holding the lock of the events
+	void expand( const std::string& directory ) override;
+
+	/// Removes the watchers of the subdirectories of the directory
+	void collapse( const std::string& directory ) override;
+
 	bool initOK();
 
 	int lastErrno();
 
+	/// Set while the directory waits to be rescanned after the events read
+	bool RescanPending;
+
+	/// Only the directories are registered, see Options::KqueueDirectoriesOnly
+	bool DirectoriesOnly;
+
+	/// The files registered anyway with DirectoriesOnly ( Options::KqueueHotFile ), shared with
+	/// the subdirectories ( NULL if there are none )
+	std::shared_ptr<const PathFilter> HotFiles;
+
   protected:
 	WatchMap mWatches;
 	int mLastWatchID;
 
-	// index 0 is always the directory
-	std::vector<KEvent> mChangeList;
-	size_t mChangeListCount;
-	DirectorySnapshot mDirSnap;
+	/// The files with their own kevent, indexed by path
+	std::unordered_map<std::string, File> mFiles;
+
+	/// The descriptor of the directory and the token of its kevent
+	int mFd;
+	Uint64 mToken;
 
-	/// The descriptor for the kqueue
-	int mKqueue;
+	DirectorySnapshot mDirSnap;
 
 	FileWatcherKqueue* mWatcher;
 
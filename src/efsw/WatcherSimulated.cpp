@@ -0,0 +1,49 @@
+#include <efsw/FileSystem.hpp>
+#include <efsw/WatcherSimulated.hpp>
+
+namespace efsw {
+
+WatcherSimulated::WatcherSimulated( WatchID id, const std::string& directory,
+									FileWatchListener* listener, bool recursive, Uint32 seed ) :
+	Watcher( id, directory, listener, recursive ),
+	Random( seed + (Uint32)id ),
+	Changes( 0 ),
+	ScriptPosition( 0 ),
+	Start( Clock::now() ),
+	NextName( 0 ) {}
+
+void WatcherSimulated::build( int depth, int fanout, int files ) {
+	Tree.clear();
+
+	build( Directory, Recursive ? depth : 0, fanout, files );
+}
+
+void WatcherSimulated::build( const std::string& path, int depth, int fanout, int files ) {
+	Tree.push_back( Node() );
+	Tree.back().Path = path;
+
+	for ( int i = 0; i < files; i++ ) {
+		Tree.back().Files.push_back( "file-" + std::to_string( i ) );
+	}
+
+	if ( depth <= 0 )
+		return;
+
+	for ( int i = 0; i < fanout; i++ ) {
+		std::string dir( path + "dir-" + std::to_string( i ) );
+
+		if ( prunes( dir ) )
+			continue;
+
+		FileSystem::dirAddSlashAtEnd( dir );
+
+		build( dir, depth - 1, fanout, files );
+	}
+}
+
+Uint32 WatcherSimulated::random( Uint32 bound ) {
+	/// The distributions of the standard library differ between implementations
+	return bound > 0 ? (Uint32)( Random() % bound ) : 0;
+}
+
+} // namespace efsw
@@ -0,0 +1,54 @@
+#ifndef EFSW_WATCHERSIMULATED_HPP
+#define EFSW_WATCHERSIMULATED_HPP
+
+#include <efsw/FileWatcherImpl.hpp>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace efsw {
+
+/// A watch of the simulated backend, with the tree it makes changes to
+class WatcherSimulated : public Watcher {
+  public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// A directory of the tree and the names of its files
+	struct Node {
+		std::string Path;
+		std::vector<std::string> Files;
+	};
+
+	WatcherSimulated( WatchID id, const std::string& directory, FileWatchListener* listener,
+					  bool recursive, Uint32 seed );
+
+	/// Builds the tree of the watch, without the directories its patterns prune
+	void build( int depth, int fanout, int files );
+
+	/// The directories of the tree, the watched one first
+	std::vector<Node> Tree;
+
+	/// The random changes, seeded per watch
+	std::mt19937 Random;
+
+	/// The changes made, and the next change of the script
+	Uint64 Changes;
+	size_t ScriptPosition;
+
+	/// When the watch started changing its tree, to keep the rate
+	Clock::time_point Start;
+
+	/// Numbers the files added and renamed, so their names are new
+	Uint64 NextName;
+
+	/// @return A random number below the bound, the same on every platform
+	Uint32 random( Uint32 bound );
+
+  protected:
+	void build( const std::string& path, int depth, int fanout, int files );
+};
+
+} // namespace efsw
+
+#endif
@@ -0,0 +1,37 @@
+#include <efsw/WatcherUSN.hpp>
+
+namespace efsw {
+
+WatcherUSN::WatcherUSN( WatchID id, const std::string& directory, FileWatchListener* listener,
+						bool recursive ) :
+	Watcher( id, directory, listener, recursive ),
+	Win32ID( 0 ),
+	Volume( NULL ),
+	SinceUsn( 0 ),
+	HistoryEnd( 0 ),
+	ReportHistory( false ) {}
+
+void WatcherUSN::handleFileEvent( WatchID, std::string_view dir, std::string_view filename,
+								  Action action, std::string_view oldFilename ) {
+	Listener->handleFileEvent( ID, dir, filename, action, oldFilename );
+}
+
+void WatcherUSN::handleFileActions( const Event* events, size_t count ) {
+	mEvents.assign( events, events + count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		mEvents[i].watchid = ID;
+	}
+
+	Listener->handleFileActions( mEvents.data(), count );
+}
+
+void WatcherUSN::handleWatchError( WatchID, Error error, std::string_view path ) {
+	Listener->handleWatchError( ID, error, path );
+}
+
+bool WatcherUSN::isDelegated() const {
+	return 0 != Win32ID;
+}
+
+} // namespace efsw
@@ -0,0 +1,53 @@
+#ifndef EFSW_WATCHERUSN_HPP
+#define EFSW_WATCHERUSN_HPP
+
+#include <efsw/FileWatcherImpl.hpp>
+#include <vector>
+
+namespace efsw {
+
+struct VolumeUSN;
+
+/// A watch of the USN journal backend. The watches the journal can't serve are delegated to the
+/// Win32 backend, the watcher then forwards their events replacing the Win32 watch id with its
+/// own.
+class WatcherUSN : public Watcher, public FileWatchListener {
+  public:
+	WatcherUSN( WatchID id, const std::string& directory, FileWatchListener* listener,
+				bool recursive );
+
+	void handleFileEvent( WatchID watchid, std::string_view dir, std::string_view filename,
+						  Action action, std::string_view oldFilename = {} ) override;
+
+	void handleFileActions( const Event* events, size_t count ) override;
+
+	void handleWatchError( WatchID watchid, Error error, std::string_view path ) override;
+
+	/// @return True if the watch is served by the Win32 backend
+	bool isDelegated() const;
+
+	/// The id of the delegated Win32 watch ( 0 if not delegated )
+	WatchID Win32ID;
+
+	/// The volume whose journal serves the watch ( NULL if delegated )
+	VolumeUSN* Volume;
+
+	/// The records of the journal before this USN aren't reported to the watch, they were
+	/// before it started or were already reported
+	Uint64 SinceUsn;
+
+	/// The USN the records replayed since Options::UsnSinceId end at, Actions::HistoryDone is
+	/// sent once it's read
+	Uint64 HistoryEnd;
+
+	/// If Actions::HistoryDone is still to be sent
+	bool ReportHistory;
+
+  protected:
+	/// The batch being forwarded, reused between batches
+	std::vector<Event> mEvents;
+};
+
+} // namespace efsw
+
+#endif
@@ -1,4 +1,5 @@
 #include <efsw/Debug.hpp>
+#include <efsw/Lock.hpp>
 #include <efsw/String.hpp>
 #include <efsw/WatcherWin32.hpp>
 
@@ -8,71 +9,231 @@
 
 namespace efsw {
 
+/// FILE_NOTIFY_EXTENDED_INFORMATION, only declared by the SDKs targeting Windows 10
+struct NotifyExtendedInformation {
+	DWORD NextEntryOffset;
+	DWORD Action;
+	LARGE_INTEGER CreationTime;
+	LARGE_INTEGER LastModificationTime;
+	LARGE_INTEGER LastChangeTime;
+	LARGE_INTEGER LastAccessTime;
+	LARGE_INTEGER AllocatedLength;
+	LARGE_INTEGER FileSize;
+	DWORD FileAttributes;
+	DWORD ReparsePointTag;
+	LARGE_INTEGER FileId;
+	LARGE_INTEGER ParentFileId;
+	DWORD FileNameLength;
+	WCHAR FileName[1];
+};
+
+typedef BOOL( WINAPI* ReadDirectoryChangesExWFunc )( HANDLE, LPVOID, DWORD, BOOL, DWORD, LPDWORD,
+													  LPOVERLAPPED,
+													  LPOVERLAPPED_COMPLETION_ROUTINE, int );
+
+/// ReadDirectoryNotifyExtendedInformation
+static const int NotifyExtendedInformationClass = 2;
+
+/// @return ReadDirectoryChangesExW, NULL before Windows 10
+static ReadDirectoryChangesExWFunc readDirectoryChangesEx() {
+	static ReadDirectoryChangesExWFunc func = reinterpret_cast<ReadDirectoryChangesExWFunc>(
+		GetProcAddress( GetModuleHandleW( L"kernel32.dll" ), "ReadDirectoryChangesExW" ) );
+
+	return func;
+}
+
 /// Unpacks events and passes them to a user defined callback.
-void CALLBACK WatchCallback( DWORD dwNumberOfBytesTransfered, LPOVERLAPPED lpOverlapped ) {
+void WatchCallback( WatcherWin32* pWatch, const BYTE* buffer ) {
+	size_t offset = 0;
+	std::string& nfile = pWatch->NameBuffer;
+
+	for ( ;; ) {
+		DWORD nextEntryOffset;
+		DWORD action;
+		const WCHAR* fileName;
+		int fileNameLength;
+		NotifyExtendedInformation* pExtended = NULL;
+
+		if ( pWatch->Extended ) {
+			pExtended = (NotifyExtendedInformation*)&buffer[offset];
+			nextEntryOffset = pExtended->NextEntryOffset;
+			action = pExtended->Action;
+			fileName = pExtended->FileName;
+			fileNameLength = pExtended->FileNameLength / sizeof( WCHAR );
+
+			pWatch->EntryInfo = true;
+			pWatch->EntryIsDirectory = 0 != ( pExtended->FileAttributes & FILE_ATTRIBUTE_DIRECTORY );
+			pWatch->EntryId = pExtended->FileId.QuadPart;
+		} else {
+			PFILE_NOTIFY_INFORMATION pNotify = (PFILE_NOTIFY_INFORMATION)&buffer[offset];
+			nextEntryOffset = pNotify->NextEntryOffset;
+			action = pNotify->Action;
+			fileName = pNotify->FileName;
+			fileNameLength = pNotify->FileNameLength / sizeof( WCHAR );
+
+			pWatch->EntryInfo = false;
+		}
+
+		/// Converted in one pass into the buffer kept for the names
+		String::wideToUtf8( fileName, fileNameLength, nfile );
+
+		if ( !nfile.empty() ) {
+			bool skip = false;
+
+			if ( FILE_ACTION_MODIFIED == action ) {
+				Uint64 modificationTime;
+				Uint64 size;
+
+				/// The information of the notification avoids stat'ing the file
+				if ( NULL != pExtended ) {
+					modificationTime = pExtended->LastModificationTime.QuadPart;
+					size = pExtended->FileSize.QuadPart;
+				} else {
+					FileInfo fifile( std::string( pWatch->DirName ) + nfile );
+					modificationTime = fifile.ModificationTime;
+					size = fifile.Size;
+				}
+
+				if ( pWatch->LastModifiedEvent.ModificationTime == modificationTime &&
+					 pWatch->LastModifiedEvent.Size == size &&
+					 pWatch->LastModifiedEvent.fileName == nfile ) {
+					skip = true;
+				}
+
+				pWatch->LastModifiedEvent.fileName = nfile;
+				pWatch->LastModifiedEvent.ModificationTime = modificationTime;
+				pWatch->LastModifiedEvent.Size = size;
+			}
+
+			if ( !skip ) {
+				pWatch->Watch->handleAction( pWatch, nfile, action );
+			}
+		}
+
+		if ( 0 == nextEntryOffset )
+			break;
+
+		offset += nextEntryOffset;
+	}
+}
+
+static void ReleaseWatch( WatcherStructWin32* pWatch ) {
+	if ( 0 != --pWatch->Watch->Refs )
+		return;
 
+	CloseHandle( pWatch->Watch->DirHandle );
+	efSAFE_DELETE_ARRAY( pWatch->Watch->DirName );
+	efSAFE_DELETE( pWatch->Watch );
+	HeapFree( GetProcessHeap(), 0, pWatch );
+}
+
+/// Tells the listener the events were lost, then reports the changes of the tree since it was
+/// last scanned
+static void ResyncWatch( WatcherWin32* pWatch ) {
+	pWatch->Batch.add( pWatch->Listener, pWatch->ID, pWatch->Directory, "", Actions::Overflow );
+	pWatch->Batch.flush();
+
+	/// The pairing of the renames doesn't survive the events lost
+	pWatch->OldFileName.clear();
+	pWatch->OldFileId = 0;
+
+	if ( NULL != pWatch->Resync ) {
+		pWatch->Resync->rescan();
+	}
+}
+
+void CompleteWatch( DWORD dwNumberOfBytesTransfered, LPOVERLAPPED lpOverlapped, bool succeeded ) {
 	if ( NULL == lpOverlapped ) {
 		return;
 	}
 
-	PFILE_NOTIFY_INFORMATION pNotify;
 	WatcherStructWin32* tWatch = (WatcherStructWin32*)lpOverlapped;
 	WatcherWin32* pWatch = tWatch->Watch;
-	size_t offset = 0;
 
-	if ( dwNumberOfBytesTransfered == 0 ) {
-		if ( nullptr != pWatch && !pWatch->StopNow ) {
-			RefreshWatch( tWatch );
-		} else {
+	{
+		Lock lock( pWatch->Lock );
+		pWatch->Pending = false;
+
+		/// The next notification completed before the previous one was handled: the thread
+		/// handling it handles this one next, keeping their order, and takes its reference
+		if ( pWatch->Handling ) {
+			pWatch->Deferred = true;
+			pWatch->DeferredBytes = dwNumberOfBytesTransfered;
+			pWatch->DeferredSucceeded = succeeded;
 			return;
 		}
+
+		pWatch->Handling = true;
 	}
 
-	do {
-		bool skip = false;
+	for ( ;; ) {
+		/// Only the thread handling the watch switches the buffers
+		int filled = pWatch->Current;
 
-		pNotify = (PFILE_NOTIFY_INFORMATION)&pWatch->Buffer[offset];
-		offset += pNotify->NextEntryOffset;
-		int count =
-			WideCharToMultiByte( CP_UTF8, 0, pNotify->FileName,
-								 pNotify->FileNameLength / sizeof( WCHAR ), NULL, 0, NULL, NULL );
-		if ( count == 0 )
-			continue;
+		{
+			Lock lock( pWatch->Lock );
 
-		std::string nfile( count, '\0' );
+			/// The next notification is read into the spare buffer while this one is handled, so
+			/// the changes made meanwhile are queued by the system instead of overflowing it
+			if ( !pWatch->StopNow ) {
+				pWatch->Current = 1 - filled;
+				pWatch->Pending = RefreshWatch( tWatch );
 
-		count = WideCharToMultiByte( CP_UTF8, 0, pNotify->FileName,
-									 pNotify->FileNameLength / sizeof( WCHAR ), &nfile[0], count,
-									 NULL, NULL );
+				if ( pWatch->Pending ) {
+					++pWatch->Refs;
+				}
+			}
+		}
 
-		if ( FILE_ACTION_MODIFIED == pNotify->Action ) {
-			FileInfo fifile( std::string( pWatch->DirName ) + nfile );
+		/// The listeners are called without any lock held, a watch removed meanwhile is only
+		/// freed once its notification is handled
+		if ( succeeded && !pWatch->StopNow ) {
+			if ( 0 == dwNumberOfBytesTransfered ) {
+				ResyncWatch( pWatch );
+			} else {
+				WatchCallback( pWatch, pWatch->Buffers[filled].data() );
 
-			if ( pWatch->LastModifiedEvent.file.ModificationTime == fifile.ModificationTime &&
-				 pWatch->LastModifiedEvent.file.Size == fifile.Size &&
-				 pWatch->LastModifiedEvent.fileName == nfile ) {
-				skip = true;
+				/// The events of the buffer are delivered in a batch
+				pWatch->Batch.flush();
 			}
-
-			pWatch->LastModifiedEvent.fileName = nfile;
-			pWatch->LastModifiedEvent.file = fifile;
 		}
 
-		if ( !skip ) {
-			pWatch->Watch->handleAction( pWatch, nfile, pNotify->Action );
+		{
+			Lock lock( pWatch->Lock );
+
+			if ( !pWatch->Deferred ) {
+				pWatch->Handling = false;
+				break;
+			}
+
+			pWatch->Deferred = false;
+			dwNumberOfBytesTransfered = pWatch->DeferredBytes;
+			succeeded = pWatch->DeferredSucceeded;
 		}
-	} while ( pNotify->NextEntryOffset != 0 );
 
-	if ( !pWatch->StopNow ) {
-		RefreshWatch( tWatch );
+		/// The reference of the notification deferred, the one handled first is still held
+		--pWatch->Refs;
 	}
+
+	ReleaseWatch( tWatch );
 }
 
 /// Refreshes the directory monitoring.
 bool RefreshWatch( WatcherStructWin32* pWatch ) {
-	bool bRet = ReadDirectoryChangesW( pWatch->Watch->DirHandle, pWatch->Watch->Buffer.data(),
-		pWatch->Watch->Buffer.size(), pWatch->Watch->Recursive,
-		pWatch->Watch->NotifyFilter, NULL, &pWatch->Overlapped,	NULL ) != 0;
+	bool bRet;
+
+	std::vector<BYTE>& buffer = pWatch->Watch->Buffers[pWatch->Watch->Current];
+
+	if ( pWatch->Watch->Extended ) {
+		bRet = readDirectoryChangesEx()( pWatch->Watch->DirHandle, buffer.data(), buffer.size(),
+										 pWatch->Watch->Recursive, pWatch->Watch->NotifyFilter,
+										 NULL, &pWatch->Overlapped, NULL,
+										 NotifyExtendedInformationClass ) != 0;
+	} else {
+		bRet = ReadDirectoryChangesW( pWatch->Watch->DirHandle, buffer.data(), buffer.size(),
+			pWatch->Watch->Recursive, pWatch->Watch->NotifyFilter, NULL, &pWatch->Overlapped,
+			NULL ) != 0;
+	}
 
 	if ( !bRet ) {
 		std::string error = std::to_string( GetLastError() );
@@ -82,15 +243,40 @@ bool RefreshWatch( WatcherStructWin32* pWatch ) {
 	return bRet;
 }
 
-/// Stops monitoring a directory.
 void DestroyWatch( WatcherStructWin32* pWatch ) {
 	if ( pWatch ) {
 		WatcherWin32* tWatch = pWatch->Watch;
+
+		{
+			Lock lock( tWatch->Lock );
+			tWatch->StopNow = true;
+
+			if ( tWatch->Pending ) {
+				CancelIoEx( tWatch->DirHandle, &pWatch->Overlapped );
+			}
+		}
+
+		/// The reference of the watches table
+		ReleaseWatch( pWatch );
+	}
+}
+
+void FreeWatch( WatcherStructWin32* pWatch ) {
+	if ( pWatch ) {
+		WatcherWin32* tWatch = pWatch->Watch;
+		DWORD bytes = 0;
+
 		tWatch->StopNow = true;
-		CancelIoEx( pWatch->Watch->DirHandle, &pWatch->Overlapped );
-		CloseHandle( pWatch->Watch->DirHandle );
-		efSAFE_DELETE_ARRAY( pWatch->Watch->DirName );
+
+		if ( tWatch->Pending ) {
+			CancelIoEx( tWatch->DirHandle, &pWatch->Overlapped );
+			GetOverlappedResult( tWatch->DirHandle, &pWatch->Overlapped, &bytes, TRUE );
+		}
+
+		CloseHandle( tWatch->DirHandle );
+		efSAFE_DELETE_ARRAY( tWatch->DirName );
 		efSAFE_DELETE( pWatch->Watch );
+		HeapFree( GetProcessHeap(), 0, pWatch );
 	}
 }
 
@@ -104,6 +290,7 @@ WatcherStructWin32* CreateWatch( LPCWSTR szDirectory, bool recursive,
 
 	WatcherWin32* pWatch = new WatcherWin32(bufferSize);
 	tWatch->Watch = pWatch;
+	pWatch->Struct = tWatch;
 
 	pWatch->DirHandle = CreateFileW(
 		szDirectory, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
@@ -113,10 +300,7 @@ WatcherStructWin32* CreateWatch( LPCWSTR szDirectory, bool recursive,
 		 CreateIoCompletionPort( pWatch->DirHandle, iocp, 0, 1 ) ) {
 		pWatch->NotifyFilter = notifyFilter;
 		pWatch->Recursive = recursive;
-
-		if ( RefreshWatch( tWatch ) ) {
-			return tWatch;
-		}
+		return tWatch;
 	}
 
 	CloseHandle( pWatch->DirHandle );
@@ -125,6 +309,27 @@ WatcherStructWin32* CreateWatch( LPCWSTR szDirectory, bool recursive,
 	return NULL;
 }
 
+bool StartWatch( WatcherStructWin32* tWatch ) {
+	WatcherWin32* pWatch = tWatch->Watch;
+	pWatch->Extended = NULL != readDirectoryChangesEx();
+
+	bool armed = RefreshWatch( tWatch );
+
+	/// The file systems without the extended information ( e.g. network shares ) fail it
+	if ( !armed && pWatch->Extended ) {
+		pWatch->Extended = false;
+		armed = RefreshWatch( tWatch );
+	}
+
+	if ( armed ) {
+		/// The reference of the notification pending, besides the one of the watches table
+		pWatch->Pending = true;
+		pWatch->Refs = 2;
+	}
+
+	return armed;
+}
+
 } // namespace efsw
 
 #endif
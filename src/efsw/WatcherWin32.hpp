@@ -1,8 +1,12 @@
 #ifndef EFSW_WATCHERWIN32_HPP
 #define EFSW_WATCHERWIN32_HPP
 
+#include <efsw/EventBatch.hpp>
 #include <efsw/FileInfo.hpp>
 #include <efsw/FileWatcherImpl.hpp>
+#include <efsw/Mutex.hpp>
+#include <efsw/WatcherGeneric.hpp>
+#include <atomic>
 #include <vector>
 
 #if EFSW_PLATFORM == EFSW_PLATFORM_WIN32
@@ -29,42 +33,108 @@ struct WatcherStructWin32 {
 };
 
 struct sLastModifiedEvent {
-	FileInfo file;
+	Uint64 ModificationTime;
+	Uint64 Size;
 	std::string fileName;
 };
 
 bool RefreshWatch( WatcherStructWin32* pWatch );
 
-void CALLBACK WatchCallback( DWORD dwNumberOfBytesTransfered, LPOVERLAPPED lpOverlapped );
+/// Unpacks the events of a notification read into the buffer and passes them to the watcher
+void WatchCallback( WatcherWin32* pWatch, const BYTE* buffer );
 
+/// Handles a notification completed: reads the next one into the spare buffer unless the watch
+/// was stopped meanwhile, then reports its events. An empty notification completed means the
+/// buffer overflowed, the watch is resynced.
+/// @param succeeded False if the notification failed ( e.g. cancelled )
+void CompleteWatch( DWORD dwNumberOfBytesTransfered, LPOVERLAPPED lpOverlapped, bool succeeded );
+
+/// Stops monitoring a directory. The watch is freed once the notification pending completes.
 void DestroyWatch( WatcherStructWin32* pWatch );
 
+/// Stops monitoring a directory and frees the watch at once, waiting for the notification
+/// pending to be cancelled. Only once no thread handles the completions anymore.
+void FreeWatch( WatcherStructWin32* pWatch );
+
+/// Opens a directory to monitor, started once the watch is set up
 WatcherStructWin32* CreateWatch( LPCWSTR szDirectory, bool recursive,
 							     DWORD bufferSize, DWORD notifyFilter, HANDLE iocp );
 
+/// Starts monitoring the directory of a watch created
+/// @return False if it couldn't be read, the watch is to be freed
+bool StartWatch( WatcherStructWin32* pWatch );
+
 class WatcherWin32 : public Watcher {
   public:
 	WatcherWin32(DWORD dwBufferSize) :
 		Struct( NULL ),
 		DirHandle( NULL ),
-		Buffer(),
+		Current( 0 ),
 		lParam( 0 ),
 		NotifyFilter( 0 ),
 		StopNow( false ),
+		Pending( false ),
+		Refs( 1 ),
+		Handling( false ),
+		Deferred( false ),
+		DeferredBytes( 0 ),
+		DeferredSucceeded( false ),
+		Extended( false ),
+		EntryInfo( false ),
+		EntryIsDirectory( false ),
+		EntryId( 0 ),
+		OldFileId( 0 ),
 		Watch( NULL ),
-		DirName( NULL ) {
-			Buffer.resize(dwBufferSize);
+		DirName( NULL ),
+		LastModifiedEvent(),
+		Resync( NULL ) {
+			Buffers[0].resize(dwBufferSize);
+			Buffers[1].resize(dwBufferSize);
 		}
 
+	~WatcherWin32() { efSAFE_DELETE( Resync ); }
+
 	WatcherStructWin32* Struct;
 	HANDLE DirHandle;
-	std::vector<BYTE> Buffer;
+	/// The notifications are read into one buffer while the other one is handled
+	std::vector<BYTE> Buffers[2];
+	/// The buffer being read into
+	int Current;
 	LPARAM lParam;
 	DWORD NotifyFilter;
-	bool StopNow;
+	std::atomic<bool> StopNow;
+	/// If a notification is being read
+	bool Pending;
+	/// Held by the watches table and by the notification pending or being handled
+	std::atomic<int> Refs;
+	/// Guards StopNow and Pending, so a watch stopped isn't read again, and the handling state
+	Mutex Lock;
+	/// If a thread is handling a notification of the watch
+	bool Handling;
+	/// A notification completed while another one was handled, handled next by the same thread
+	bool Deferred;
+	DWORD DeferredBytes;
+	bool DeferredSucceeded;
+	/// If the notifications are read with ReadDirectoryChangesExW ( Windows 10 and newer ), with
+	/// the information of the entries
+	bool Extended;
+	/// The information of the entry being handled, if the notification has it
+	bool EntryInfo;
+	bool EntryIsDirectory;
+	Uint64 EntryId;
+	/// The file ID of the entry of OldFileName, 0 if unknown
+	Uint64 OldFileId;
+	/// The name of the entry being handled, converted into the same buffer
+	std::string NameBuffer;
 	FileWatcherImpl* Watch;
 	char* DirName;
 	sLastModifiedEvent LastModifiedEvent;
+	/// The events of the notification being handled. The notifications of a watch are read one
+	/// at a time, so they're handled in order, by one thread at a time.
+	EventBatch Batch;
+	/// The snapshot of the tree scanned to report its changes once the buffer overflowed, NULL
+	/// without Options::WinOverflowResync
+	WatcherGeneric* Resync;
 };
 
 } // namespace efsw
@@ -6,6 +6,7 @@
 #include <dirent.h>
 #include <efsw/FileInfo.hpp>
 #include <efsw/FileSystem.hpp>
+#include <fcntl.h>
 #include <unistd.h>
 
 #ifndef _DARWIN_FEATURE_64_BIT_INODE
@@ -53,101 +54,181 @@
 
 #if EFSW_OS == EFSW_OS_LINUX
 #include <cstdio>
-#include <mntent.h>
+#include <efsw/Lock.hpp>
+#include <efsw/Mutex.hpp>
+#include <poll.h>
+#include <sys/sysmacros.h>
+#include <unordered_map>
 #endif
 
 namespace efsw { namespace Platform {
 
-#if EFSW_OS == EFSW_OS_LINUX
+/// @return True if the file system type is a remote one
+static bool isRemoteType( unsigned long type ) {
+	switch ( type ) {
+		case S_MAGIC_FUSEBLK: /* 0x65735546 remote */
+		case S_MAGIC_AFS:	  /* 0x5346414F remote */
+		case S_MAGIC_AUFS:	  /* 0x61756673 remote */
+		case S_MAGIC_CEPH:	  /* 0x00C36400 remote */
+		case S_MAGIC_CIFS:	  /* 0xFF534D42 remote */
+		case S_MAGIC_CODA:	  /* 0x73757245 remote */
+		case S_MAGIC_FHGFS:	  /* 0x19830326 remote */
+		case S_MAGIC_FUSECTL: /* 0x65735543 remote */
+		case S_MAGIC_GFS:	  /* 0x01161970 remote */
+		case S_MAGIC_GPFS:	  /* 0x47504653 remote */
+		case S_MAGIC_KAFS:	  /* 0x6B414653 remote */
+		case S_MAGIC_LUSTRE:  /* 0x0BD00BD0 remote */
+		case S_MAGIC_NCP:	  /* 0x564C remote */
+		case S_MAGIC_NFS:	  /* 0x6969 remote */
+		case S_MAGIC_NFSD:	  /* 0x6E667364 remote */
+		case S_MAGIC_OCFS2:	  /* 0x7461636F remote */
+		case S_MAGIC_PANFS:	  /* 0xAAD7AAEA remote */
+		case S_MAGIC_PIPEFS:  /* 0x50495045 remote */
+		case S_MAGIC_SMB:	  /* 0x517B remote */
+		case S_MAGIC_SNFS:	  /* 0xBEEFDEAD remote */
+		case S_MAGIC_VMHGFS:  /* 0xBACBACBC remote */
+		case S_MAGIC_VXFS:	  /* 0xA501FCF5 remote */
+		{
+			return true;
+		}
+		default: {
+			return false;
+		}
+	}
+}
 
-std::string findMountPoint( std::string file ) {
-	std::string cwd = FileSystem::getCurrentWorkingDirectory();
-	struct stat last_stat;
-	struct stat file_stat;
+#if EFSW_OS == EFSW_OS_LINUX
 
-	stat( file.c_str(), &file_stat );
+/// The mount table of the process, parsed from /proc/self/mountinfo, with the file systems of the
+/// devices classified once. The kernel flags the file as changed when anything is mounted or
+/// unmounted, so it's only parsed again then, and telling if a directory is on a remote file
+/// system is a stat and a lookup by its device. Safe to use from any thread.
+class MountTable {
+  public:
+	static MountTable& instance() {
+		static MountTable table;
+		return table;
+	}
 
-	std::string mp;
+	/// @return True if the directory lives in a remote file system
+	bool isRemote( const std::string& directory ) {
+		struct stat st;
 
-	if ( efsw::FileSystem::isDirectory( file ) ) {
-		last_stat = file_stat;
+		if ( 0 != stat( directory.c_str(), &st ) )
+			return false;
 
-		if ( !FileSystem::changeWorkingDirectory( file ) )
-			return "";
-	} else {
-		std::string dir = efsw::FileSystem::pathRemoveFileName( file );
+		Lock lock( mMutex );
 
-		if ( !FileSystem::changeWorkingDirectory( dir ) )
-			return "";
+		if ( changed() )
+			load();
 
-		if ( stat( ".", &last_stat ) < 0 )
-			return "";
-	}
+		Device& device = mDevices[(Uint64)st.st_dev];
 
-	while ( true ) {
-		struct stat st;
+		if ( !device.Classified ) {
+			struct statfs statfsbuf;
 
-		if ( stat( "..", &st ) < 0 )
-			goto done;
+			if ( 0 != statfs( directory.c_str(), &statfsbuf ) )
+				return false;
 
-		if ( st.st_dev != last_stat.st_dev || st.st_ino == last_stat.st_ino )
-			break;
+			unsigned long type = statfsbuf.f_type | 0UL;
 
-		if ( !FileSystem::changeWorkingDirectory( ".." ) ) {
-			goto done;
+			/// FUSE is only local when it's mounted from something, as ntfs-3g is from its
+			/// block device
+			device.Remote = S_MAGIC_FUSEBLK == type ? !device.Mounted : isRemoteType( type );
+			device.Classified = true;
 		}
 
-		last_stat = st;
+		return device.Remote;
 	}
 
-	/* Finally reached a mount point, see what it's called.  */
-	mp = FileSystem::getCurrentWorkingDirectory();
+  protected:
+	struct Device {
+		Device() : Mounted( false ), Classified( false ), Remote( false ) {}
 
-done:
-	FileSystem::changeWorkingDirectory( cwd );
+		/// Listed in the mount table with a source
+		bool Mounted;
+		bool Classified;
+		bool Remote;
+	};
 
-	return mp;
-}
+	Mutex mMutex;
 
-std::string findDevicePath( const std::string& directory ) {
-	struct mntent* ent;
-	FILE* aFile;
+	/// /proc/self/mountinfo, kept open to be polled for changes
+	int mFD;
 
-	aFile = setmntent( "/proc/mounts", "r" );
+	/// Reused between the parses: the table and a line of it
+	std::string mBuffer;
+	std::string mLine;
 
-	if ( aFile == NULL )
-		return "";
+	/// The devices seen, by their number
+	std::unordered_map<Uint64, Device> mDevices;
 
-	while ( NULL != ( ent = getmntent( aFile ) ) ) {
-		std::string dirName( ent->mnt_dir );
+	MountTable() :
+		mFD( open( "/proc/self/mountinfo", O_RDONLY | O_CLOEXEC ) ) {
+		load();
+	}
+
+	~MountTable() {
+		if ( -1 != mFD ) {
+			close( mFD );
+		}
+	}
 
-		if ( dirName == directory ) {
-			std::string fsName( ent->mnt_fsname );
+	/// @return True if something was mounted or unmounted since the last parse
+	bool changed() {
+		if ( -1 == mFD )
+			return false;
 
-			endmntent( aFile );
+		struct pollfd pfd;
+		pfd.fd = mFD;
+		pfd.events = POLLPRI;
+		pfd.revents = 0;
 
-			return fsName;
-		}
+		return poll( &pfd, 1, 0 ) > 0 && 0 != ( pfd.revents & ( POLLPRI | POLLERR ) );
 	}
 
-	endmntent( aFile );
+	/// Reads the mount table again, forgetting the devices classified
+	void load() {
+		mDevices.clear();
 
-	return "";
-}
+		if ( -1 == mFD )
+			return;
 
-bool isLocalFUSEDirectory( std::string directory ) {
-	efsw::FileSystem::dirRemoveSlashAtEnd( directory );
+		mBuffer.clear();
 
-	directory = findMountPoint( directory );
+		char chunk[16 * 1024];
+		ssize_t nread;
+		off_t offset = 0;
 
-	if ( !directory.empty() ) {
-		std::string devicePath = findDevicePath( directory );
+		/// Reading it whole acknowledges the change
+		while ( ( nread = pread( mFD, chunk, sizeof( chunk ), offset ) ) > 0 ) {
+			mBuffer.append( chunk, nread );
+			offset += nread;
+		}
 
-		return !devicePath.empty();
-	}
+		/// "36 35 98:0 /root /mnt/point rw,noatime master:1 - ext3 /dev/root rw"
+		for ( size_t pos = 0; pos < mBuffer.size(); ) {
+			size_t end = mBuffer.find( '\n', pos );
 
-	return false;
-}
+			if ( std::string::npos == end )
+				end = mBuffer.size();
+
+			mLine.assign( mBuffer, pos, end - pos );
+			pos = end + 1;
+
+			unsigned int major, minor;
+			int sourceAt = 0;
+			const char* separator = strstr( mLine.c_str(), " - " );
+
+			if ( NULL != separator &&
+				 2 == sscanf( mLine.c_str(), "%*u %*u %u:%u", &major, &minor ) &&
+				 0 == sscanf( separator, " - %*s %n", &sourceAt ) && sourceAt > 0 ) {
+				Device& device = mDevices[(Uint64)makedev( major, minor )];
+				device.Mounted = '\0' != separator[sourceAt];
+			}
+		}
+	}
+};
 
 #endif
 
@@ -175,15 +256,188 @@ FileInfoMap FileSystem::filesInfoFromPath( const std::string& path ) {
 			std::string name( dirp->d_name );
 			std::string fpath( path + name );
 
-			files[name] = FileInfo( fpath );
+			files.append( name ).assignInfo( FileInfo( fpath ) );
 		}
 	}
 
 	closedir( dp );
 
+	files.sort();
+
 	return files;
 }
 
+static void assignStat( FileInfo& fi, const struct stat& st ) {
+	fi.ModificationTime = st.st_mtime;
+	fi.Size = st.st_size;
+	fi.OwnerId = st.st_uid;
+	fi.GroupId = st.st_gid;
+	fi.Permissions = st.st_mode;
+	fi.Inode = st.st_ino;
+}
+
+static void assignStat( FileStat& fi, const struct stat& st ) {
+	fi.ModificationTime = st.st_mtime;
+	fi.Size = st.st_size;
+	fi.Inode = st.st_ino;
+	fi.Permissions = st.st_mode;
+	fi.Ownership = FileStat::ownership( st.st_uid, st.st_gid );
+}
+
+/// The entry of a subdirectory watched on its own: only its inode tells it apart
+static void assignDirectory( FileStat& fi, Uint64 inode ) {
+	fi.ModificationTime = fi.Size = 0;
+	fi.Ownership = 0;
+	fi.Permissions = S_IFDIR;
+	fi.Inode = inode;
+}
+
+void FileSystem::listDirectory( const std::string& path, FileInfoMap& files,
+								bool statDirectories ) {
+	DIR* dp;
+	struct dirent* dirp;
+
+	if ( ( dp = opendir( path.c_str() ) ) == NULL )
+		return;
+
+	/// The entries are stat'ed relative to the directory open, no path is built
+	int fd = dirfd( dp );
+	struct stat st;
+
+	while ( ( dirp = readdir( dp ) ) != NULL ) {
+		if ( strcmp( dirp->d_name, ".." ) == 0 || strcmp( dirp->d_name, "." ) == 0 )
+			continue;
+
+#ifdef DT_DIR
+		if ( !statDirectories && DT_DIR == dirp->d_type ) {
+			assignDirectory( files.append( dirp->d_name ), dirp->d_ino );
+			continue;
+		}
+#endif
+
+		if ( 0 != fstatat( fd, dirp->d_name, &st, 0 ) ||
+			 ( !S_ISREG( st.st_mode ) && !S_ISDIR( st.st_mode ) ) )
+			continue;
+
+		FileStat& fi = files.append( dirp->d_name );
+
+		if ( !statDirectories && S_ISDIR( st.st_mode ) ) {
+			assignDirectory( fi, st.st_ino );
+		} else {
+			assignStat( fi, st );
+		}
+	}
+
+	closedir( dp );
+}
+
+void FileSystem::statEntries( const std::string& path, FileInfoMap& entries, FileInfoMap& listing,
+							  bool statDirectories ) {
+	int fd = open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	if ( -1 == fd )
+		return;
+
+	struct stat st;
+
+	for ( FileInfoMap::iterator it = entries.begin(); it != entries.end(); ++it ) {
+		if ( !statDirectories && it->second.isDirectory() ) {
+			listing.append( it->first ).assignInfo( it->second );
+		} else if ( 0 == fstatat( fd, it->first.data(), &st, 0 ) &&
+					( S_ISREG( st.st_mode ) || S_ISDIR( st.st_mode ) ) ) {
+			FileStat& fi = listing.append( it->first );
+
+			if ( !statDirectories && S_ISDIR( st.st_mode ) ) {
+				assignDirectory( fi, st.st_ino );
+			} else {
+				assignStat( fi, st );
+			}
+		}
+	}
+
+	close( fd );
+}
+
+bool FileSystem::listNames( const std::string& path, FileInfoMap& files ) {
+	DIR* dp;
+	struct dirent* dirp;
+
+	if ( ( dp = opendir( path.c_str() ) ) == NULL )
+		return false;
+
+	while ( ( dirp = readdir( dp ) ) != NULL ) {
+		if ( strcmp( dirp->d_name, ".." ) == 0 || strcmp( dirp->d_name, "." ) == 0 )
+			continue;
+
+		FileStat& fi = files.append( dirp->d_name );
+
+#ifdef DT_DIR
+		if ( DT_DIR == dirp->d_type ) {
+			assignDirectory( fi, dirp->d_ino );
+			continue;
+		}
+#endif
+
+		/// The inode tells a name replaced by another file before it's stat'ed
+		fi = FileStat();
+		fi.Inode = dirp->d_ino;
+	}
+
+	closedir( dp );
+
+	return false;
+}
+
+void FileSystem::statNames( const std::string& path, FileInfoMap& files,
+							FileInfoMap::iterator first, FileInfoMap::iterator last,
+							bool statDirectories ) {
+	int fd = open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	struct stat st;
+
+	for ( FileInfoMap::iterator it = first; it != last; ++it ) {
+		/// The directory is gone, and its entries with it
+		if ( -1 == fd ) {
+			files.erase( it );
+			continue;
+		}
+
+		if ( !statDirectories && it->second.isDirectory() )
+			continue;
+
+		if ( 0 != fstatat( fd, it->first.data(), &st, 0 ) ||
+			 ( !S_ISREG( st.st_mode ) && !S_ISDIR( st.st_mode ) ) ) {
+			files.erase( it );
+		} else if ( !statDirectories && S_ISDIR( st.st_mode ) ) {
+			assignDirectory( it->second, st.st_ino );
+		} else {
+			assignStat( it->second, st );
+		}
+	}
+
+	if ( -1 != fd ) {
+		close( fd );
+	}
+}
+
+bool FileSystem::directoryInfo( const std::string& path, FileInfo& info,
+								Uint64& modificationTime ) {
+	struct stat st;
+
+	if ( 0 != stat( path.c_str(), &st ) ) {
+		info.assignInfo( FileInfo() );
+		modificationTime = 0;
+		return false;
+	}
+
+	assignStat( info, st );
+#if EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_ANDROID
+	modificationTime = (Uint64)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#else
+	modificationTime = (Uint64)st.st_mtime * 1000000000ULL;
+#endif
+	return true;
+}
+
 char FileSystem::getOSSlash() {
 	return '/';
 }
@@ -200,50 +454,18 @@ bool FileSystem::isDirectory( const std::string& path ) {
 }
 
 bool FileSystem::isRemoteFS( const std::string& directory ) {
-#if EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_MACOSX || EFSW_OS == EFSW_OS_BSD || \
-	EFSW_OS == EFSW_OS_SOLARIS || EFSW_OS == EFSW_OS_ANDROID || EFSW_OS == EFSW_OS_IOS
+#if EFSW_OS == EFSW_OS_LINUX
+	return MountTable::instance().isRemote( directory );
+#elif EFSW_OS == EFSW_OS_MACOSX || EFSW_OS == EFSW_OS_BSD || EFSW_OS == EFSW_OS_SOLARIS || \
+	EFSW_OS == EFSW_OS_ANDROID || EFSW_OS == EFSW_OS_IOS
 	struct statfs statfsbuf;
 
 	statfs( directory.c_str(), &statfsbuf );
 
-	switch ( statfsbuf.f_type | 0UL ) {
-		case S_MAGIC_FUSEBLK: /* 0x65735546 remote */
-		{
-#if EFSW_OS == EFSW_OS_LINUX
-			return !isLocalFUSEDirectory( directory );
-#endif
-		}
-		case S_MAGIC_AFS:	  /* 0x5346414F remote */
-		case S_MAGIC_AUFS:	  /* 0x61756673 remote */
-		case S_MAGIC_CEPH:	  /* 0x00C36400 remote */
-		case S_MAGIC_CIFS:	  /* 0xFF534D42 remote */
-		case S_MAGIC_CODA:	  /* 0x73757245 remote */
-		case S_MAGIC_FHGFS:	  /* 0x19830326 remote */
-		case S_MAGIC_FUSECTL: /* 0x65735543 remote */
-		case S_MAGIC_GFS:	  /* 0x01161970 remote */
-		case S_MAGIC_GPFS:	  /* 0x47504653 remote */
-		case S_MAGIC_KAFS:	  /* 0x6B414653 remote */
-		case S_MAGIC_LUSTRE:  /* 0x0BD00BD0 remote */
-		case S_MAGIC_NCP:	  /* 0x564C remote */
-		case S_MAGIC_NFS:	  /* 0x6969 remote */
-		case S_MAGIC_NFSD:	  /* 0x6E667364 remote */
-		case S_MAGIC_OCFS2:	  /* 0x7461636F remote */
-		case S_MAGIC_PANFS:	  /* 0xAAD7AAEA remote */
-		case S_MAGIC_PIPEFS:  /* 0x50495045 remote */
-		case S_MAGIC_SMB:	  /* 0x517B remote */
-		case S_MAGIC_SNFS:	  /* 0xBEEFDEAD remote */
-		case S_MAGIC_VMHGFS:  /* 0xBACBACBC remote */
-		case S_MAGIC_VXFS:	  /* 0xA501FCF5 remote */
-		{
-			return true;
-		}
-		default: {
-			return false;
-		}
-	}
-#endif
-
+	return isRemoteType( statfsbuf.f_type | 0UL );
+#else
 	return false;
+#endif
 }
 
 }} // namespace efsw::Platform
@@ -13,6 +13,7 @@
 
 #if EFSW_OS == EFSW_OS_MACOSX
 #include <CoreFoundation/CoreFoundation.h>
+#include <sys/sysctl.h>
 #elif EFSW_OS == EFSW_OS_LINUX || EFSW_OS == EFSW_OS_ANDROID
 #include <libgen.h>
 #include <unistd.h>
@@ -141,7 +142,28 @@ void System::maxFD() {
 		struct rlimit limit;
 		getrlimit( RLIMIT_NOFILE, &limit );
 		limit.rlim_cur = limit.rlim_max;
-		setrlimit( RLIMIT_NOFILE, &limit );
+
+#if EFSW_OS == EFSW_OS_MACOSX
+		/// The hard limit is usually unlimited, the soft one can't exceed the kernel limit per
+		/// process
+		int perProcess = 0;
+		size_t size = sizeof( perProcess );
+
+		if ( 0 == sysctlbyname( "kern.maxfilesperproc", &perProcess, &size, NULL, 0 ) &&
+			 perProcess > 0 && (rlim_t)perProcess < limit.rlim_cur ) {
+			limit.rlim_cur = (rlim_t)perProcess;
+		}
+#endif
+
+		if ( 0 != setrlimit( RLIMIT_NOFILE, &limit ) ) {
+#ifdef OPEN_MAX
+			/// Some kernels refuse a limit above OPEN_MAX
+			if ( limit.rlim_cur > OPEN_MAX ) {
+				limit.rlim_cur = OPEN_MAX;
+				setrlimit( RLIMIT_NOFILE, &limit );
+			}
+#endif
+		}
 
 		getrlimit( RLIMIT_NOFILE, &limit );
 
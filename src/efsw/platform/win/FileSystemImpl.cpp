@@ -20,7 +20,7 @@ bool FileSystem::changeWorkingDirectory( const std::string& path ) {
 	int res;
 #ifdef EFSW_COMPILER_MSVC
 #ifdef UNICODE
-	res = _wchdir( String::fromUtf8( path.c_str() ).toWideString().c_str() );
+	res = _wchdir( String::utf8ToWide( path ).c_str() );
 #else
 	res = _chdir( String::fromUtf8( path.c_str() ).toAnsiString().c_str() );
 #endif
@@ -34,7 +34,8 @@ std::string FileSystem::getCurrentWorkingDirectory() {
 #ifdef EFSW_COMPILER_MSVC
 #if defined( UNICODE ) && !defined( EFSW_NO_WIDECHAR )
 	wchar_t dir[_MAX_PATH];
-	return ( 0 != GetCurrentDirectoryW( _MAX_PATH, dir ) ) ? String( dir ).toUtf8() : std::string();
+	return ( 0 != GetCurrentDirectoryW( _MAX_PATH, dir ) ) ? String::wideToUtf8( dir )
+														   : std::string();
 #else
 	char dir[_MAX_PATH];
 	return ( 0 != GetCurrentDirectory( _MAX_PATH, dir ) ) ? String( dir, std::locale() ).toUtf8()
@@ -50,46 +51,96 @@ std::string FileSystem::getCurrentWorkingDirectory() {
 FileInfoMap FileSystem::filesInfoFromPath( const std::string& path ) {
 	FileInfoMap files;
 
-	String tpath( path );
+	std::wstring tpath( String::utf8ToWide( path ) );
 
-	if ( tpath[tpath.size() - 1] == '/' || tpath[tpath.size() - 1] == '\\' ) {
-		tpath += "*";
+	if ( tpath[tpath.size() - 1] == L'/' || tpath[tpath.size() - 1] == L'\\' ) {
+		tpath += L"*";
 	} else {
-		tpath += "\\*";
+		tpath += L"\\*";
 	}
 
 	WIN32_FIND_DATAW findFileData;
-	HANDLE hFind = FindFirstFileW( (LPCWSTR)tpath.toWideString().c_str(), &findFileData );
+	HANDLE hFind = FindFirstFileW( tpath.c_str(), &findFileData );
 
 	if ( hFind != INVALID_HANDLE_VALUE ) {
-		std::string name( String( findFileData.cFileName ).toUtf8() );
+		std::string name( String::wideToUtf8( findFileData.cFileName ) );
 		std::string fpath( path + name );
 
 		if ( name != "." && name != ".." ) {
-			files[name] = FileInfo( fpath );
+			files.append( name ).assignInfo( FileInfo( fpath ) );
 		}
 
 		while ( FindNextFileW( hFind, &findFileData ) ) {
-			name = String( findFileData.cFileName ).toUtf8();
+			String::wideToUtf8( findFileData.cFileName, wcslen( findFileData.cFileName ), name );
 			fpath = path + name;
 
 			if ( name != "." && name != ".." ) {
-				files[name] = FileInfo( fpath );
+				files.append( name ).assignInfo( FileInfo( fpath ) );
 			}
 		}
 
 		FindClose( hFind );
 	}
 
+	files.sort();
+
 	return files;
 }
 
+void FileSystem::listDirectory( const std::string& path, FileInfoMap& files, bool ) {
+	FileInfoMap found( filesInfoFromPath( path ) );
+
+	for ( FileInfoMap::iterator it = found.begin(); it != found.end(); ++it ) {
+		if ( it->second.isRegularFile() || it->second.isDirectory() ) {
+			files.append( it->first ).assignInfo( it->second );
+		}
+	}
+}
+
+void FileSystem::statEntries( const std::string& path, FileInfoMap& entries, FileInfoMap& listing,
+							  bool ) {
+	FileInfo fi;
+
+	for ( FileInfoMap::iterator it = entries.begin(); it != entries.end(); ++it ) {
+		if ( fi.getInfo( path + std::string( it->first ) ) && ( fi.isRegularFile() || fi.isDirectory() ) ) {
+			listing.append( it->first ).assignInfo( fi );
+		}
+	}
+}
+
+bool FileSystem::listNames( const std::string& path, FileInfoMap& files ) {
+	listDirectory( path, files, true );
+
+	return true;
+}
+
+void FileSystem::statNames( const std::string& path, FileInfoMap& files,
+							FileInfoMap::iterator first, FileInfoMap::iterator last, bool ) {
+	FileInfo fi;
+
+	for ( FileInfoMap::iterator it = first; it != last; ++it ) {
+		if ( fi.getInfo( path + std::string( it->first ) ) && ( fi.isRegularFile() || fi.isDirectory() ) ) {
+			it->second.assignInfo( fi );
+		} else {
+			files.erase( it );
+		}
+	}
+}
+
+bool FileSystem::directoryInfo( const std::string& path, FileInfo& info,
+								Uint64& modificationTime ) {
+	/// The time of the directory isn't used to skip the listings
+	modificationTime = 0;
+
+	return info.getInfo( path );
+}
+
 char FileSystem::getOSSlash() {
 	return '\\';
 }
 
 bool FileSystem::isDirectory( const std::string& path ) {
-	DWORD attrs = GetFileAttributesW( String( path ).toWideString().c_str() );
+	DWORD attrs = GetFileAttributesW( String::utf8ToWide( path ).c_str() );
 	return attrs != INVALID_FILE_ATTRIBUTES && ( attrs & FILE_ATTRIBUTE_DIRECTORY ) != 0;
 }
 
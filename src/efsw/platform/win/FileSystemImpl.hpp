@@ -13,6 +13,18 @@ class FileSystem {
   public:
 	static FileInfoMap filesInfoFromPath( const std::string& path );
 
+	static void listDirectory( const std::string& path, FileInfoMap& files, bool statDirectories );
+
+	static void statEntries( const std::string& path, FileInfoMap& entries, FileInfoMap& listing,
+							 bool statDirectories );
+
+	static bool listNames( const std::string& path, FileInfoMap& files );
+
+	static void statNames( const std::string& path, FileInfoMap& files, FileInfoMap::iterator first,
+						   FileInfoMap::iterator last, bool statDirectories );
+
+	static bool directoryInfo( const std::string& path, FileInfo& info, Uint64& modificationTime );
+
 	static char getOSSlash();
 
 	static bool isDirectory( const std::string& path );
@@ -32,7 +32,7 @@ std::string System::getProcessPath() {
 	_wsplitpath( dllName.c_str(), szDrive, szDir, szFilename, szExt );
 #endif
 
-	return String( szDrive ).toUtf8() + String( szDir ).toUtf8();
+	return String::wideToUtf8( szDrive ) + String::wideToUtf8( szDir );
 }
 
 void System::maxFD() {}
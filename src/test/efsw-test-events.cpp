@@ -0,0 +1,492 @@
+#include <efsw/efsw.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Makes scripted changes in a temporary directory and checks the events the backends report for
+/// them, or checks how the events are encoded, one scenario per run.
+/// Usage: efsw-test-events <scenario>
+
+namespace fs = std::filesystem;
+
+/// Collects the paths reported per action
+class Recorder : public efsw::FileWatchListener {
+  public:
+	void handleFileEvent( efsw::WatchID, std::string_view dir, std::string_view filename,
+						  efsw::Action action, std::string_view oldFilename ) override {
+		std::string path( dir );
+		path.append( filename.data(), filename.size() );
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		mSeen.insert( std::make_pair( action, fs::path( path ).lexically_normal().string() ) );
+		mOrder.push_back( std::make_pair( action, fs::path( path ).lexically_normal().string() ) );
+
+		if ( efsw::Actions::Moved == action ) {
+			std::string oldPath( dir );
+			oldPath.append( oldFilename.data(), oldFilename.size() );
+			mMoves.insert( std::make_pair( fs::path( oldPath ).lexically_normal().string(),
+										   fs::path( path ).lexically_normal().string() ) );
+		}
+
+		mChanged.notify_all();
+	}
+
+	/// @return True if the action was reported for the path within the timeout
+	bool waitFor( efsw::Action action, const fs::path& path, int milliseconds = 5000 ) {
+		std::pair<efsw::Action, std::string> event( action, path.lexically_normal().string() );
+		std::unique_lock<std::mutex> lock( mMutex );
+
+		return mChanged.wait_for( lock, std::chrono::milliseconds( milliseconds ),
+								  [&] { return mSeen.count( event ) > 0; } );
+	}
+
+	/// @return True if the rename was reported as one move within the timeout
+	bool waitForMove( const fs::path& from, const fs::path& to, int milliseconds = 5000 ) {
+		std::pair<std::string, std::string> move( from.lexically_normal().string(),
+												  to.lexically_normal().string() );
+		std::unique_lock<std::mutex> lock( mMutex );
+
+		return mChanged.wait_for( lock, std::chrono::milliseconds( milliseconds ),
+								  [&] { return mMoves.count( move ) > 0; } );
+	}
+
+	/// @return True if the action was reported for the path so far
+	bool seen( efsw::Action action, const fs::path& path ) {
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mSeen.count( std::make_pair( action, path.lexically_normal().string() ) ) > 0;
+	}
+
+	/// @return True if the first action of the path was reported before the second one
+	bool before( efsw::Action first, efsw::Action second, const fs::path& path ) {
+		std::string normal( path.lexically_normal().string() );
+		std::lock_guard<std::mutex> lock( mMutex );
+
+		for ( size_t i = 0; i < mOrder.size(); i++ ) {
+			if ( mOrder[i].second != normal )
+				continue;
+
+			if ( first == mOrder[i].first || second == mOrder[i].first )
+				return first == mOrder[i].first;
+		}
+
+		return false;
+	}
+
+  protected:
+	std::mutex mMutex;
+	std::condition_variable mChanged;
+	std::set<std::pair<efsw::Action, std::string>> mSeen;
+	std::set<std::pair<std::string, std::string>> mMoves;
+	std::vector<std::pair<efsw::Action, std::string>> mOrder;
+};
+
+static bool check( bool condition, const char* what ) {
+	if ( !condition ) {
+		fprintf( stderr, "FAILED: %s\n", what );
+	}
+
+	return condition;
+}
+
+static void touch( const fs::path& path ) {
+	std::ofstream( path ) << "efsw";
+}
+
+/// A tree created at once, its directories are made before they can be watched
+static bool nestedCreate( const fs::path& root ) {
+	efsw::FileWatcher watcher;
+	Recorder recorder;
+
+	if ( !check( watcher.addWatch( root.string(), &recorder, true ) > 0, "addWatch" ) )
+		return false;
+
+	watcher.watch();
+
+	fs::create_directories( root / "n1" / "n2" );
+	touch( root / "n1" / "n2" / "deep" );
+
+	bool ok = check( recorder.waitFor( efsw::Actions::Add, root / "n1" ), "n1 added" );
+	ok = check( recorder.waitFor( efsw::Actions::Add, root / "n1" / "n2" ), "n1/n2 added" ) && ok;
+	ok = check( recorder.waitFor( efsw::Actions::Add, root / "n1" / "n2" / "deep" ),
+				"n1/n2/deep added" ) &&
+		 ok;
+
+	/// The tree is watched as well
+	touch( root / "n1" / "n2" / "later" );
+
+	return check( recorder.waitFor( efsw::Actions::Add, root / "n1" / "n2" / "later" ),
+				  "n1/n2/later added" ) &&
+		   ok;
+}
+
+/// Two recursive watches nested in each other with different options share the kernel watches
+/// of their common directories, each keeps its events whichever is added or removed first
+static bool overlappingRoots( const fs::path& root ) {
+	efsw::FileWatcher watcher;
+	Recorder outer;
+	Recorder inner;
+	fs::path sub( root / "sub" );
+	std::vector<efsw::WatcherOption> options = {
+		efsw::WatcherOption( efsw::Options::EventInterest,
+							 efsw::Interests::Created | efsw::Interests::Deleted ) };
+
+	fs::create_directories( sub );
+
+	watcher.watch();
+
+	/// The outer watch crawls into the inner one
+	efsw::WatchID innerID = watcher.addWatch( sub.string(), &inner, true, options );
+	efsw::WatchID outerID = watcher.addWatch( root.string(), &outer, true );
+
+	if ( !check( innerID > 0 && outerID > 0 && innerID != outerID, "addWatch" ) )
+		return false;
+
+	touch( sub / "f1" );
+
+	bool ok = check( outer.waitFor( efsw::Actions::Add, sub / "f1" ), "f1 added to outer" );
+	ok = check( inner.waitFor( efsw::Actions::Add, sub / "f1" ), "f1 added to inner" ) && ok;
+
+	watcher.removeWatch( innerID );
+	touch( sub / "f2" );
+
+	ok = check( outer.waitFor( efsw::Actions::Add, sub / "f2" ), "f2 added to outer" ) && ok;
+
+	/// The inner watch is added on a directory of the outer one
+	innerID = watcher.addWatch( sub.string(), &inner, true, options );
+
+	if ( !check( innerID > 0, "addWatch nested" ) )
+		return false;
+
+	fs::create_directories( sub / "d" );
+	ok = check( inner.waitFor( efsw::Actions::Add, sub / "d" ), "d added to inner" ) && ok;
+	touch( sub / "d" / "f3" );
+
+	ok = check( outer.waitFor( efsw::Actions::Add, sub / "d" / "f3" ), "d/f3 added to outer" ) &&
+		 ok;
+	ok = check( inner.waitFor( efsw::Actions::Add, sub / "d" / "f3" ), "d/f3 added to inner" ) &&
+		 ok;
+
+	watcher.removeWatch( outerID );
+	touch( sub / "f4" );
+	touch( sub / "d" / "f5" );
+
+	ok = check( inner.waitFor( efsw::Actions::Add, sub / "f4" ), "f4 added to inner" ) && ok;
+	ok = check( inner.waitFor( efsw::Actions::Add, sub / "d" / "f5" ), "d/f5 added to inner" ) &&
+		 ok;
+
+	return ok;
+}
+
+/// A watch removed by its directory written in other ways, or through a symbolic link to it
+static bool removeByDirectory( const fs::path& root ) {
+	efsw::FileWatcher watcher;
+	Recorder recorder;
+	std::string dir( root.string() );
+	const char* spellings[] = { "/./a", "//a", "/x/../a/", "/link" };
+	bool ok = true;
+
+	fs::create_directories( root / "a" );
+	fs::create_directories( root / "x" );
+	fs::create_directory_symlink( root / "a", root / "link" );
+
+	for ( size_t i = 0; i < sizeof( spellings ) / sizeof( spellings[0] ); i++ ) {
+		if ( !check( watcher.addWatch( ( root / "a" ).string(), &recorder, false ) > 0,
+					 "addWatch" ) )
+			return false;
+
+		watcher.removeWatch( dir + spellings[i] );
+
+		ok = check( watcher.directories().empty(), spellings[i] ) && ok;
+	}
+
+	/// The link removed since, the watch added through it is still found by its target
+	if ( !check( watcher.addWatch( ( root / "link" ).string(), &recorder, false ) > 0,
+				 "addWatch link" ) )
+		return false;
+
+	fs::remove( root / "link" );
+	watcher.removeWatch( dir + "/a" );
+
+	return check( watcher.directories().empty(), "link removed" ) && ok;
+}
+
+/// A file renamed while the time of its directory keeps the same second, the generic backend
+/// pairs the move by the inode without the directory looking changed
+static bool genericRenameSameTime( const fs::path& root ) {
+	efsw::FileWatcher watcher( true );
+	Recorder recorder;
+	std::vector<efsw::WatcherOption> options = {
+		efsw::WatcherOption( efsw::Options::PollMinInterval, 10 ) };
+
+	if ( !check( watcher.addWatch( root.string(), &recorder, false, options ) > 0, "addWatch" ) )
+		return false;
+
+	watcher.watch();
+
+	touch( root / "old" );
+
+	if ( !check( recorder.waitFor( efsw::Actions::Add, root / "old" ), "old added" ) )
+		return false;
+
+	/// The time set back within its second, only the nanoseconds tell the rename
+	fs::file_time_type time = fs::last_write_time( root );
+	fs::rename( root / "old", root / "new" );
+	std::chrono::nanoseconds nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		time.time_since_epoch() % std::chrono::seconds( 1 ) );
+	fs::last_write_time( root, nanos.count() > 0 ? time - std::chrono::nanoseconds( 1 )
+												 : time + std::chrono::nanoseconds( 1 ) );
+
+	return check( recorder.waitFor( efsw::Actions::Moved, root / "new" ), "old moved to new" );
+}
+
+/// Renames in one directory interleaved with other changes, each is paired as a move of its own,
+/// and a name moved out of the watch then created again is deleted before it's added. The generic
+/// backend pairs them by their inodes.
+static bool interleavedRenames( const fs::path& root, bool generic ) {
+	efsw::FileWatcher watcher( generic );
+	Recorder recorder;
+	fs::path dir( root / "w" );
+	std::vector<efsw::WatcherOption> options = {
+		efsw::WatcherOption( efsw::Options::PollMinInterval, 10 ) };
+
+	fs::create_directories( dir );
+	fs::create_directories( root / "out" );
+	touch( dir / "a" );
+	touch( dir / "d" );
+	touch( dir / "f" );
+
+	if ( !check( watcher.addWatch( dir.string(), &recorder, false, options ) > 0, "addWatch" ) )
+		return false;
+
+	watcher.watch();
+
+	fs::rename( dir / "a", dir / "b" );
+	touch( dir / "c" );
+	fs::rename( dir / "d", dir / "e" );
+	fs::rename( dir / "f", root / "out" / "f" );
+	touch( dir / "f" );
+
+	bool ok = check( recorder.waitForMove( dir / "a", dir / "b" ), "a moved to b" );
+	ok = check( recorder.waitForMove( dir / "d", dir / "e" ), "d moved to e" ) && ok;
+	ok = check( recorder.waitFor( efsw::Actions::Add, dir / "c" ), "c added" ) && ok;
+
+	/// Between two scans, the poller only sees the name of f replaced by another file
+	if ( generic ) {
+		ok = check( recorder.waitFor( efsw::Actions::Modified, dir / "f" ), "f modified" ) && ok;
+	} else {
+		ok = check( recorder.waitFor( efsw::Actions::Add, dir / "f" ), "f added" ) && ok;
+		ok = check( recorder.before( efsw::Actions::Delete, efsw::Actions::Add, dir / "f" ),
+					"f deleted before added" ) &&
+			 ok;
+	}
+
+	ok = check( !recorder.seen( efsw::Actions::Delete, dir / "a" ), "a not deleted" ) && ok;
+
+	return check( !recorder.seen( efsw::Actions::Delete, dir / "d" ), "d not deleted" ) && ok;
+}
+
+/// A tree over its watch budget: the subtrees left without a kernel watch are polled, and the
+/// files created in any of them are reported
+static bool watchBudget( const fs::path& root ) {
+	efsw::FileWatcher watcher;
+	Recorder recorder;
+	const char* dirs[] = { "s1", "s2", "s3", "s4" };
+	size_t count = sizeof( dirs ) / sizeof( dirs[0] );
+	std::vector<efsw::WatcherOption> options = {
+		efsw::WatcherOption( efsw::Options::WatchBudget, 3 ),
+		efsw::WatcherOption( efsw::Options::PollMinInterval, 10 ) };
+
+	for ( size_t i = 0; i < count; i++ ) {
+		fs::create_directories( root / dirs[i] / "sub" );
+	}
+
+	if ( !check( watcher.addWatch( root.string(), &recorder, true, options ) > 0, "addWatch" ) )
+		return false;
+
+	watcher.watch();
+
+	bool ok = true;
+
+	/// Each subtree active in turn, the least recent ones give their watches away
+	for ( size_t i = 0; i < count; i++ ) {
+		touch( root / dirs[i] / "sub" / "f" );
+
+		ok = check( recorder.waitFor( efsw::Actions::Add, root / dirs[i] / "sub" / "f" ),
+					dirs[i] ) &&
+			 ok;
+	}
+
+	for ( size_t i = 0; i < count; i++ ) {
+		touch( root / dirs[i] / "g" );
+
+		ok = check( recorder.waitFor( efsw::Actions::Add, root / dirs[i] / "g" ), dirs[i] ) && ok;
+	}
+
+	return ok;
+}
+
+static bool sameEvent( const efsw::JournalEvent& event, efsw::WatchID watchid, const char* dir,
+					   const char* filename, efsw::Action action, const char* oldFilename,
+					   uint64_t sequence ) {
+	return event.watchid == watchid && event.dir == dir && event.filename == filename &&
+		   event.action == action && event.oldFilename == oldFilename &&
+		   event.sequence == sequence;
+}
+
+/// Batches encoded back to back are decoded as the events given, a frame not there whole yet
+/// waits for the rest of it and a corrupted one is rejected
+static bool codecRoundTrip( const fs::path& ) {
+	efsw::Event batch[3];
+	batch[0].watchid = 7;
+	batch[0].dir = "/tmp/w/";
+	batch[0].filename = "a.txt";
+	batch[0].action = efsw::Actions::Add;
+	batch[1].watchid = 7;
+	batch[1].dir = "/tmp/w/";
+	batch[1].filename = "b.txt";
+	batch[1].action = efsw::Actions::Moved;
+	batch[1].oldFilename = "a.txt";
+	batch[2].watchid = -3;
+	batch[2].dir = "/tmp/w/sub/";
+	batch[2].filename = "c";
+	batch[2].action = efsw::Actions::Delete;
+
+	std::string frames;
+	efsw::EventCodec::encode( batch, 3, 41, frames );
+	size_t first = frames.size();
+
+	/// Journal events keep their own sequences, with a gap back
+	std::vector<efsw::JournalEvent> journal( 1 );
+	journal[0].watchid = 7;
+	journal[0].dir = "/tmp/w/";
+	journal[0].filename = "d";
+	journal[0].action = efsw::Actions::Modified;
+	journal[0].sequence = 12;
+	efsw::EventCodec::encode( journal.data(), journal.size(), frames );
+
+	std::vector<efsw::JournalEvent> events;
+	bool ok = check( efsw::EventCodec::decode( frames.data(), frames.size(), events ) == first,
+					 "first frame size" );
+	ok = check( events.size() == 3, "first frame count" ) && ok;
+
+	if ( events.size() == 3 ) {
+		ok = check( sameEvent( events[0], 7, "/tmp/w/", "a.txt", efsw::Actions::Add, "", 41 ),
+					"event 0" ) &&
+			 ok;
+		ok = check( sameEvent( events[1], 7, "/tmp/w/", "b.txt", efsw::Actions::Moved, "a.txt",
+							   42 ),
+					"event 1" ) &&
+			 ok;
+		ok = check( sameEvent( events[2], -3, "/tmp/w/sub/", "c", efsw::Actions::Delete, "", 43 ),
+					"event 2" ) &&
+			 ok;
+	}
+
+	ok = check( efsw::EventCodec::decode( frames.data() + first, frames.size() - first,
+										  events ) == frames.size() - first,
+				"second frame size" ) &&
+		 ok;
+	ok = check( events.size() == 1 &&
+					sameEvent( events[0], 7, "/tmp/w/", "d", efsw::Actions::Modified, "", 12 ),
+				"journal event" ) &&
+		 ok;
+
+	/// Every part of a frame waits for the rest
+	for ( size_t size = 0; size < first; size++ ) {
+		if ( !check( efsw::EventCodec::decode( frames.data(), size, events ) == 0, "truncated" ) )
+			return false;
+	}
+
+	/// The frames below are short, their length is a varint of a byte
+	std::string frame( frames, 0, first );
+	std::string corrupted( frame );
+	corrupted[1] = (char)( efsw::EventCodec::VERSION + 1 );
+	ok = check( efsw::EventCodec::decode( corrupted.data(), corrupted.size(), events ) ==
+					efsw::EventCodec::INVALID,
+				"other version" ) &&
+		 ok;
+
+	/// A length that never ends
+	corrupted.assign( 16, (char)0xFF );
+	ok = check( efsw::EventCodec::decode( corrupted.data(), corrupted.size(), events ) ==
+					efsw::EventCodec::INVALID,
+				"endless length" ) &&
+		 ok;
+
+	/// Bytes left over past the events
+	corrupted = frame + "x";
+	corrupted[0]++;
+	ok = check( efsw::EventCodec::decode( corrupted.data(), corrupted.size(), events ) ==
+					efsw::EventCodec::INVALID,
+				"trailing bytes" ) &&
+		 ok;
+
+	/// The last event cut short by the length
+	corrupted.assign( frame, 0, frame.size() - 1 );
+	corrupted[0]--;
+	ok = check( efsw::EventCodec::decode( corrupted.data(), corrupted.size(), events ) ==
+					efsw::EventCodec::INVALID,
+				"cut event" ) &&
+		 ok;
+
+	/// A first event can't share the watch of a previous one
+	const char sameWatch[] = { 6, (char)efsw::EventCodec::VERSION, 1, 0, 0x11, 0, 0 };
+	ok = check( efsw::EventCodec::decode( sameWatch, sizeof( sameWatch ), events ) ==
+					efsw::EventCodec::INVALID,
+				"first event same watch" ) &&
+		 ok;
+
+	return ok;
+}
+
+int main( int argc, char** argv ) {
+	if ( argc < 2 ) {
+		fprintf( stderr, "Usage: %s <scenario>\n", argv[0] );
+		return 2;
+	}
+
+	fs::path root = fs::temp_directory_path() /
+					( std::string( "efsw-test-" ) + argv[1] + "-" +
+					  std::to_string( std::chrono::steady_clock::now().time_since_epoch().count() ) );
+
+	fs::create_directories( root );
+
+	/// The events carry the path canonicalized by the watch
+	root = fs::canonical( root );
+
+	bool ok;
+
+	if ( 0 == strcmp( argv[1], "nested-create" ) ) {
+		ok = nestedCreate( root );
+	} else if ( 0 == strcmp( argv[1], "overlapping-roots" ) ) {
+		ok = overlappingRoots( root );
+	} else if ( 0 == strcmp( argv[1], "remove-by-directory" ) ) {
+		ok = removeByDirectory( root );
+	} else if ( 0 == strcmp( argv[1], "generic-rename-same-time" ) ) {
+		ok = genericRenameSameTime( root );
+	} else if ( 0 == strcmp( argv[1], "interleaved-renames" ) ) {
+		ok = interleavedRenames( root, false );
+	} else if ( 0 == strcmp( argv[1], "generic-interleaved-renames" ) ) {
+		ok = interleavedRenames( root, true );
+	} else if ( 0 == strcmp( argv[1], "watch-budget" ) ) {
+		ok = watchBudget( root );
+	} else if ( 0 == strcmp( argv[1], "codec-round-trip" ) ) {
+		ok = codecRoundTrip( root );
+	} else {
+		fprintf( stderr, "Unknown scenario: %s\n", argv[1] );
+		ok = false;
+	}
+
+	std::error_code error;
+	fs::remove_all( root, error );
+
+	return ok ? 0 : 1;
+}
@@ -45,6 +45,10 @@ const char * getActionName( enum efsw_action action ) {
 			return "Delete";
 		case EFSW_MOVED:
 			return "Moved";
+		case EFSW_OVERFLOW:
+			return "Overflow";
+		case EFSW_HISTORY_DONE:
+			return "History done";
 		default:
 			return "Bad Action";
 	}